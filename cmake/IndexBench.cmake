@@ -0,0 +1,55 @@
+# Builds a quasi index of a synthetic transcriptome and prints the
+# index_build_stats.json it produces.
+#
+# Expects SALMON_BIN and BENCH_DIR; BENCH_NUM_TRANSCRIPTS, BENCH_THREADS and
+# BENCH_SEED may be set to override the defaults below.
+
+if (NOT BENCH_NUM_TRANSCRIPTS)
+    set(BENCH_NUM_TRANSCRIPTS 20000)
+endif()
+if (NOT BENCH_THREADS)
+    set(BENCH_THREADS 4)
+endif()
+if (NOT BENCH_SEED)
+    set(BENCH_SEED 1)
+endif()
+
+file(MAKE_DIRECTORY ${BENCH_DIR})
+set(BENCH_FASTA ${BENCH_DIR}/synthetic_transcripts.fa)
+set(BENCH_INDEX ${BENCH_DIR}/synthetic_quasi_index)
+
+# Transcripts of 500--1499 nt; seeding only the first draw makes the whole
+# transcriptome reproducible
+string(RANDOM LENGTH 1 ALPHABET "ACGT" RANDOM_SEED ${BENCH_SEED} _unused)
+file(WRITE ${BENCH_FASTA} "")
+set(BENCH_SEQS "")
+math(EXPR BENCH_LAST "${BENCH_NUM_TRANSCRIPTS} - 1")
+foreach(i RANGE ${BENCH_LAST})
+    string(RANDOM LENGTH 3 ALPHABET "0123456789" lenDigits)
+    math(EXPR txpLen "1${lenDigits} - 500")
+    string(RANDOM LENGTH ${txpLen} ALPHABET "ACGT" txpSeq)
+    set(BENCH_SEQS "${BENCH_SEQS}>synthetic_${i}\n${txpSeq}\n")
+    # Write in chunks, so the string being built stays small
+    math(EXPR chunkPos "${i} % 100")
+    if (chunkPos EQUAL 99 OR i EQUAL BENCH_LAST)
+        file(APPEND ${BENCH_FASTA} "${BENCH_SEQS}")
+        set(BENCH_SEQS "")
+    endif()
+endforeach()
+message("Wrote ${BENCH_NUM_TRANSCRIPTS} synthetic transcripts to ${BENCH_FASTA}")
+
+file(REMOVE_RECURSE ${BENCH_INDEX})
+execute_process(COMMAND ${SALMON_BIN} index -t ${BENCH_FASTA} -i ${BENCH_INDEX}
+                        --type quasi -p ${BENCH_THREADS}
+                RESULT_VARIABLE BENCH_INDEX_RESULT
+                )
+if (BENCH_INDEX_RESULT)
+    message(FATAL_ERROR "Error running salmon index on ${BENCH_FASTA}")
+endif()
+
+if (EXISTS ${BENCH_INDEX}/index_build_stats.json)
+    file(READ ${BENCH_INDEX}/index_build_stats.json BENCH_STATS)
+    message("${BENCH_STATS}")
+else()
+    message(FATAL_ERROR "salmon index did not write index_build_stats.json")
+endif()
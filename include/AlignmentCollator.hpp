@@ -0,0 +1,563 @@
+#ifndef __ALIGNMENT_COLLATOR_HPP__
+#define __ALIGNMENT_COLLATOR_HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Collation, by read name, of alignments that come sorted by coordinate
+ * (so that a BAM file sorted for other tools needn't be sorted by name, or
+ * collated, first): MatePairer finds the mate of each record of a proper
+ * pair, and ReadGrouper gathers all of the alignments of each read.
+ *
+ * Both work on records of type RecT, owned (as RecT*) by whoever holds
+ * them, through the static functions of TraitsT:
+ *
+ *   const char* name(const RecT*)
+ *   int32_t ref(const RecT*), pos(const RecT*)
+ *   int32_t mateRef(const RecT*), matePos(const RecT*)
+ *   size_t bytes(const RecT*)        the memory the record takes
+ *   void write(std::ostream&, const RecT*)
+ *   RecT* read(std::istream&)
+ *   void destroy(RecT*)              (nothing for nullptr)
+ */
+
+namespace salmon {
+namespace collate {
+
+// An alignment of a fragment: a record, and that of its mate, if any
+template <typename RecT> struct Frag {
+  RecT* first{nullptr};
+  // nullptr for an orphan (or a single-end read)
+  RecT* second{nullptr};
+};
+
+// An out for MatePairer::add() from two functions (e.g. lambdas)
+template <typename PairF, typename SingleF> struct MateOut {
+  PairF pair;
+  SingleF single;
+};
+
+template <typename PairF, typename SingleF>
+MateOut<PairF, SingleF> makeMateOut(PairF pair, SingleF single) {
+  return MateOut<PairF, SingleF>{pair, single};
+}
+
+inline uint64_t mix_(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+// The (FNV-1a, then mixed) hash of the n bytes of name
+inline uint64_t hashName(const char* name, size_t n) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < n; ++i) {
+    h = (h ^ static_cast<unsigned char>(name[i])) * 0x100000001b3ULL;
+  }
+  return mix_(h);
+}
+
+// A position, ordered as in a coordinate-sorted file (unmapped, with a
+// negative reference or position, last)
+inline uint64_t coordinate(int32_t ref, int32_t pos) {
+  return (uint64_t{static_cast<uint32_t>(ref)} << 32) |
+         static_cast<uint32_t>(pos);
+}
+
+/**
+ * Pairs each record with its mate.  A record waits, in a table keyed by its
+ * name and the positions of the two mates, until its mate comes; since the
+ * input is sorted by coordinate, a record whose mate is behind the records
+ * now being read has lost its mate (filtered, say), and is handed back
+ * alone.  At most maxPending records wait: past that, the one whose mate
+ * is due first is handed back alone.
+ *
+ * The records are added with add(rec, name, nameLen, out), where name is
+ * the read's name without any /1 or /2 suffix; out.pair(a, b) is called
+ * with each pair found (a came first), and out.single(r) with each record
+ * handed back alone.  The records are then out's.
+ */
+template <typename RecT, typename TraitsT> class MatePairer {
+public:
+  explicit MatePairer(size_t maxPending) : maxPending_(maxPending) {}
+
+  MatePairer(const MatePairer&) = delete;
+  MatePairer& operator=(const MatePairer&) = delete;
+
+  ~MatePairer() {
+    for (auto& kv : table_) {
+      TraitsT::destroy(kv.second.rec);
+    }
+  }
+
+  template <typename OutT>
+  void add(RecT* rec, const char* name, size_t nameLen, OutT& out) {
+    uint64_t self = coordinate(TraitsT::ref(rec), TraitsT::pos(rec));
+    uint64_t mate = coordinate(TraitsT::mateRef(rec), TraitsT::matePos(rec));
+    // Whatever waits for a mate before this record can't be paired now
+    evict_(out, [self](const Waiting& w) { return w.mate < self; });
+
+    uint64_t key = key_(hashName(name, nameLen), self, mate);
+    auto range = table_.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+      Pending& p = it->second;
+      if (p.self == mate and p.mate == self and p.nameLen == nameLen and
+          std::memcmp(TraitsT::name(p.rec), name, nameLen) == 0) {
+        RecT* first = p.rec;
+        bytes_ -= TraitsT::bytes(first);
+        table_.erase(it);
+        ++numPairs_;
+        out.pair(first, rec);
+        return;
+      }
+    }
+    if (mate < self) {
+      // its mate has come and gone (or never will)
+      ++numUnpaired_;
+      out.single(rec);
+      return;
+    }
+    if (table_.size() >= maxPending_) {
+      evictFirst_(out);
+    }
+    Pending p;
+    p.rec = rec;
+    p.seq = seq_;
+    p.self = self;
+    p.mate = mate;
+    p.nameLen = static_cast<uint32_t>(nameLen);
+    table_.emplace(key, p);
+    bytes_ += TraitsT::bytes(rec);
+    Waiting w;
+    w.mate = mate;
+    w.seq = seq_;
+    w.key = key;
+    waiting_.push(w);
+    ++seq_;
+  }
+
+  // Hand back every record still waiting (at the end of a file)
+  template <typename OutT> void flush(OutT& out) {
+    evict_(out, [](const Waiting&) { return true; });
+  }
+
+  size_t numPending() const { return table_.size(); }
+  uint64_t pendingBytes() const { return bytes_; }
+  uint64_t numPairs() const { return numPairs_; }
+  // the records handed back alone
+  uint64_t numUnpaired() const { return numUnpaired_; }
+
+private:
+  struct Pending {
+    RecT* rec;
+    uint64_t seq;
+    uint64_t self;
+    uint64_t mate;
+    uint32_t nameLen;
+  };
+
+  // A waiting record, by the position of its mate (and the order in which
+  // it came); found in the table by key and seq, unless it's been paired
+  struct Waiting {
+    uint64_t mate;
+    uint64_t seq;
+    uint64_t key;
+    bool operator>(const Waiting& o) const {
+      return (mate != o.mate) ? mate > o.mate : seq > o.seq;
+    }
+  };
+
+  static uint64_t key_(uint64_t nameHash, uint64_t a, uint64_t b) {
+    uint64_t lo = std::min(a, b);
+    uint64_t hi = std::max(a, b);
+    return mix_(nameHash ^ mix_(lo) ^ (mix_(hi) * 0x9e3779b97f4a7c15ULL));
+  }
+
+  // Hand back the waiting record with key and seq, if it's still waiting
+  template <typename OutT> bool handBack_(const Waiting& w, OutT& out) {
+    auto range = table_.equal_range(w.key);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second.seq == w.seq) {
+        RecT* rec = it->second.rec;
+        bytes_ -= TraitsT::bytes(rec);
+        table_.erase(it);
+        ++numUnpaired_;
+        out.single(rec);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  template <typename OutT, typename PredT> void evict_(OutT& out, PredT due) {
+    while (!waiting_.empty() and due(waiting_.top())) {
+      Waiting w = waiting_.top();
+      waiting_.pop();
+      handBack_(w, out);
+    }
+  }
+
+  template <typename OutT> void evictFirst_(OutT& out) {
+    while (!waiting_.empty()) {
+      Waiting w = waiting_.top();
+      waiting_.pop();
+      if (handBack_(w, out)) {
+        return;
+      }
+    }
+  }
+
+  size_t maxPending_;
+  std::unordered_multimap<uint64_t, Pending> table_;
+  std::priority_queue<Waiting, std::vector<Waiting>, std::greater<Waiting>>
+      waiting_;
+  uint64_t seq_{0};
+  uint64_t bytes_{0};
+  uint64_t numPairs_{0};
+  uint64_t numUnpaired_{0};
+};
+
+/**
+ * Gathers the alignments of each read, by name.  Added with
+ * add(name, nameLen, numHits, frag, out), where numHits is the number of
+ * alignments of the read (its NH tag; 0 or less if unknown): once that many
+ * have been added, out(frags) is called with all of them, and the records
+ * are then out's.  The reads whose alignments haven't all been seen wait,
+ * in memory, until they take more than maxBytes; they are then all written,
+ * sorted by name, as a run of the spill file (see spillTo()), and their
+ * names noted in a Bloom filter.  A read that may have been spilled is
+ * never handed out before finish(), which merges the runs (and what's left
+ * in memory), and hands out every read left, with all of its alignments.
+ * Without NH tags, every read is handed out by finish().
+ */
+template <typename RecT, typename TraitsT> class ReadGrouper {
+public:
+  using FragVec = std::vector<Frag<RecT>>;
+
+  explicit ReadGrouper(uint64_t maxBytes) : maxBytes_(maxBytes) {}
+
+  ReadGrouper(const ReadGrouper&) = delete;
+  ReadGrouper& operator=(const ReadGrouper&) = delete;
+
+  ~ReadGrouper() {
+    for (auto& kv : pending_) {
+      destroy_(kv.second.frags);
+    }
+    closeSpill_();
+  }
+
+  /**
+   * Spill to the file spillPath (created, and removed by finish()); false,
+   * and everything is kept in memory, if it can't be created.
+   */
+  bool spillTo(const std::string& spillPath) {
+    spillOut_.open(spillPath, std::ios::binary | std::ios::trunc);
+    if (!spillOut_.good()) {
+      return false;
+    }
+    spillPath_ = spillPath;
+    return true;
+  }
+
+  template <typename OutT>
+  void add(const char* name, size_t nameLen, int32_t numHits, Frag<RecT> f,
+           OutT& out) {
+    // A read with a single alignment, that can't have been spilled, goes
+    // out without being kept
+    if (numHits == 1 and !maybeSpilled_(name, nameLen)) {
+      single_.clear();
+      single_.push_back(f);
+      ++numReads_;
+      out(single_);
+      single_.clear();
+      return;
+    }
+    key_.assign(name, nameLen);
+    auto it = pending_.find(key_);
+    if (it == pending_.end()) {
+      it = pending_.emplace(key_, Entry()).first;
+      it->second.numHits = numHits;
+      bytes_ += entryBytes_ + nameLen;
+    }
+    Entry& e = it->second;
+    e.frags.push_back(f);
+    bytes_ += fragBytes_(f);
+    if (e.numHits > 0 and e.frags.size() >= static_cast<size_t>(e.numHits) and
+        !maybeSpilled_(name, nameLen)) {
+      bytes_ -= entryBytes_ + nameLen + fragsBytes_(e.frags);
+      ++numReads_;
+      out(e.frags);
+      pending_.erase(it);
+    } else if (bytes_ > maxBytes_ and spillOut_.is_open()) {
+      spill_();
+    }
+    peakBytes_ = std::max(peakBytes_, bytes_);
+  }
+
+  /**
+   * Hand out every read still waiting (in the order of their names, if any
+   * were spilled), and remove the spill file.  False if the spilled reads
+   * couldn't be read back.
+   */
+  template <typename OutT> bool finish(OutT& out) {
+    bool ok{true};
+    if (spillRuns_.empty()) {
+      for (auto& kv : pending_) {
+        ++numReads_;
+        out(kv.second.frags);
+      }
+      pending_.clear();
+    } else {
+      spill_();
+      ok = mergeRuns_(out);
+    }
+    bytes_ = 0;
+    closeSpill_();
+    return ok;
+  }
+
+  size_t numPending() const { return pending_.size(); }
+  uint64_t pendingBytes() const { return bytes_; }
+  uint64_t peakBytes() const { return peakBytes_; }
+  uint64_t numReads() const { return numReads_; }
+  size_t numSpills() const { return numSpills_; }
+  uint64_t numSpilledReads() const { return numSpilledReads_; }
+
+private:
+  struct Entry {
+    int32_t numHits{0};
+    FragVec frags;
+  };
+
+  // A run of spilled reads: where it starts in the spill file, and how many
+  // reads it holds
+  struct SpillRun {
+    uint64_t offset;
+    uint64_t numReads;
+  };
+
+  // Reads the reads of one run back, in order
+  struct SpillCursor {
+    std::ifstream in;
+    uint64_t left;
+    bool failed{false};
+    std::string name;
+    FragVec frags;
+
+    SpillCursor(const std::string& path, const SpillRun& run)
+        : in(path, std::ios::binary), left(run.numReads) {
+      in.seekg(static_cast<std::streamoff>(run.offset));
+    }
+
+    ~SpillCursor() { destroy_(frags); }
+
+    // Read the next read; false once the run is exhausted (or unreadable)
+    bool next() {
+      if (left == 0 or failed) {
+        return false;
+      }
+      --left;
+      uint32_t n{0};
+      in.read(reinterpret_cast<char*>(&n), sizeof(n));
+      name.resize(n);
+      in.read(&name[0], n);
+      uint32_t numFrags{0};
+      in.read(reinterpret_cast<char*>(&numFrags), sizeof(numFrags));
+      for (uint32_t i = 0; i < numFrags and in.good(); ++i) {
+        uint8_t paired{0};
+        in.read(reinterpret_cast<char*>(&paired), sizeof(paired));
+        Frag<RecT> f;
+        f.first = TraitsT::read(in);
+        if (paired) {
+          f.second = TraitsT::read(in);
+        }
+        frags.push_back(f);
+      }
+      failed = !in.good();
+      return !failed;
+    }
+  };
+
+  static void destroy_(FragVec& frags) {
+    for (auto& f : frags) {
+      TraitsT::destroy(f.first);
+      TraitsT::destroy(f.second);
+    }
+    frags.clear();
+  }
+
+  static uint64_t fragBytes_(const Frag<RecT>& f) {
+    return sizeof(f) + TraitsT::bytes(f.first) +
+           ((f.second != nullptr) ? TraitsT::bytes(f.second) : 0);
+  }
+
+  static uint64_t fragsBytes_(const FragVec& frags) {
+    uint64_t b{0};
+    for (auto& f : frags) {
+      b += fragBytes_(f);
+    }
+    return b;
+  }
+
+  // The two bits of the filter for a name
+  std::pair<uint64_t, uint64_t> filterBits_(const char* name,
+                                            size_t nameLen) const {
+    uint64_t h = hashName(name, nameLen);
+    uint64_t m = spilledNames_.size() * 64;
+    return {h % m, mix_(h) % m};
+  }
+
+  bool maybeSpilled_(const char* name, size_t nameLen) const {
+    if (spilledNames_.empty()) {
+      return false;
+    }
+    auto b = filterBits_(name, nameLen);
+    return (spilledNames_[b.first >> 6] >> (b.first & 63) & 1) and
+           (spilledNames_[b.second >> 6] >> (b.second & 63) & 1);
+  }
+
+  /**
+   * Write every read waiting to a new run of the spill file, sorted by
+   * name, and note their names in the filter.
+   */
+  void spill_() {
+    if (pending_.empty()) {
+      return;
+    }
+    if (spilledNames_.empty()) {
+      spilledNames_.assign(filterWords_, 0);
+    }
+    typedef typename std::unordered_map<std::string, Entry>::iterator It;
+    std::vector<It> order;
+    order.reserve(pending_.size());
+    for (auto it = pending_.begin(); it != pending_.end(); ++it) {
+      order.push_back(it);
+    }
+    std::sort(order.begin(), order.end(),
+              [](const It& a, const It& b) { return a->first < b->first; });
+    SpillRun run{static_cast<uint64_t>(spillOut_.tellp()), order.size()};
+    for (auto& it : order) {
+      const std::string& name = it->first;
+      FragVec& frags = it->second.frags;
+      uint32_t n = static_cast<uint32_t>(name.size());
+      spillOut_.write(reinterpret_cast<const char*>(&n), sizeof(n));
+      spillOut_.write(name.data(), n);
+      uint32_t numFrags = static_cast<uint32_t>(frags.size());
+      spillOut_.write(reinterpret_cast<const char*>(&numFrags),
+                      sizeof(numFrags));
+      for (auto& f : frags) {
+        uint8_t paired = (f.second != nullptr) ? 1 : 0;
+        spillOut_.write(reinterpret_cast<const char*>(&paired),
+                        sizeof(paired));
+        TraitsT::write(spillOut_, f.first);
+        if (paired) {
+          TraitsT::write(spillOut_, f.second);
+        }
+      }
+      destroy_(frags);
+      auto b = filterBits_(name.data(), name.size());
+      spilledNames_[b.first >> 6] |= uint64_t{1} << (b.first & 63);
+      spilledNames_[b.second >> 6] |= uint64_t{1} << (b.second & 63);
+    }
+    spillOut_.flush();
+    spillRuns_.push_back(run);
+    ++numSpills_;
+    numSpilledReads_ += order.size();
+    pending_.clear();
+    bytes_ = 0;
+  }
+
+  /**
+   * Hand out each read of the runs, in the order of the names, with the
+   * alignments of all of its copies; false if a run couldn't be read back.
+   */
+  template <typename OutT> bool mergeRuns_(OutT& out) {
+    std::vector<std::unique_ptr<SpillCursor>> cursors;
+    auto later = [](const SpillCursor* a, const SpillCursor* b) -> bool {
+      return b->name < a->name;
+    };
+    std::priority_queue<SpillCursor*, std::vector<SpillCursor*>,
+                        decltype(later)>
+        heap(later);
+    for (auto& run : spillRuns_) {
+      cursors.emplace_back(new SpillCursor(spillPath_, run));
+      if (cursors.back()->next()) {
+        heap.push(cursors.back().get());
+      }
+    }
+    std::string name;
+    FragVec frags;
+    while (!heap.empty()) {
+      SpillCursor* c = heap.top();
+      heap.pop();
+      std::swap(name, c->name);
+      std::swap(frags, c->frags);
+      if (c->next()) {
+        heap.push(c);
+      }
+      while (!heap.empty() and heap.top()->name == name) {
+        c = heap.top();
+        heap.pop();
+        frags.insert(frags.end(), c->frags.begin(), c->frags.end());
+        c->frags.clear();
+        if (c->next()) {
+          heap.push(c);
+        }
+      }
+      ++numReads_;
+      out(frags);
+      frags.clear();
+    }
+    bool ok{true};
+    for (auto& c : cursors) {
+      ok = ok and !c->failed;
+    }
+    return ok;
+  }
+
+  void closeSpill_() {
+    if (spillOut_.is_open()) {
+      spillOut_.close();
+      std::remove(spillPath_.c_str());
+    }
+    spillRuns_.clear();
+    spilledNames_.clear();
+  }
+
+  // The (estimated) bytes of an entry of the table, besides its alignments
+  static constexpr size_t entryBytes_ = 96;
+  // 2^26 bits (8 MB) for the names of the spilled reads
+  static constexpr size_t filterWords_ = size_t{1} << 20;
+
+  uint64_t maxBytes_;
+  std::unordered_map<std::string, Entry> pending_;
+  std::string key_;
+  FragVec single_;
+  uint64_t bytes_{0};
+  uint64_t peakBytes_{0};
+  uint64_t numReads_{0};
+
+  // see spillTo()
+  std::string spillPath_;
+  std::ofstream spillOut_;
+  std::vector<SpillRun> spillRuns_;
+  std::vector<uint64_t> spilledNames_;
+  size_t numSpills_{0};
+  uint64_t numSpilledReads_{0};
+};
+
+} // namespace collate
+} // namespace salmon
+
+#endif // __ALIGNMENT_COLLATOR_HPP__
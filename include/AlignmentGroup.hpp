@@ -14,10 +14,18 @@ extern "C" {
 
 #include "ReadPair.hpp"
 #include "SalmonMath.hpp"
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 
 template <typename FragT> class AlignmentGroup {
 public:
+  // The most alignments whose room a group keeps for good once it's cleared
+  static constexpr size_t maxRetainedAlignments = 64;
+  // The number of clears in a row, each of a fragment with at most
+  // maxRetainedAlignments alignments, after which a larger buffer shrinks
+  static constexpr uint32_t shrinkAfterClears = 32;
+
   AlignmentGroup() : read_(nullptr), isUniquelyMapped_(true) {
     alignments_.reserve(10);
   }
@@ -31,11 +39,51 @@ public:
 
   inline std::vector<FragT>& alignments() { return alignments_; }
   void emplaceAlignment(FragT&& p) { alignments_.emplace_back(p); }
-  void addAlignment(FragT& p) { alignments_.push_back(p); }
 
+  /**
+   * Add the alignment p, noting whether the alignments are still in
+   * transcript order (as a BAM file sorted by name, with the alignments of
+   * each read in target order, gives them), so that sortHits needn't look at
+   * them again if they are.
+   */
+  void addAlignment(FragT& p) {
+    if (alignments_.size() != numTracked_) {
+      // (the group was cleared, or changed, through alignments())
+      inOrder_ = alignments_.empty();
+    }
+    if (inOrder_ and !alignments_.empty() and
+        p->transcriptID() < alignments_.back()->transcriptID()) {
+      inOrder_ = false;
+    }
+    alignments_.push_back(p);
+    numTracked_ = alignments_.size();
+  }
+
+  /**
+   * Empty the group for the next fragment.  The groups of a mini-batch are
+   * reused for every mini-batch, so a buffer that a highly multi-mapping
+   * fragment grew past maxRetainedAlignments isn't kept for good: once
+   * shrinkAfterClears fragments in a row have fit in maxRetainedAlignments,
+   * it shrinks back to that size.  The memory of the groups then follows the
+   * hits of the fragments being mapped, not those of the worst fragment seen
+   * so far, while a run of multi-mapping fragments keeps its buffer, rather
+   * than growing it back for each of them.
+   */
   void clearAlignments() {
+    if (alignments_.capacity() > maxRetainedAlignments) {
+      if (alignments_.size() > maxRetainedAlignments) {
+        numSmallClears_ = 0;
+      } else if (++numSmallClears_ >= shrinkAfterClears) {
+        std::vector<FragT> kept;
+        kept.reserve(maxRetainedAlignments);
+        alignments_.swap(kept);
+        numSmallClears_ = 0;
+      }
+    }
     alignments_.clear();
     isUniquelyMapped_ = true;
+    inOrder_ = true;
+    numTracked_ = 0;
   }
 
   inline bool& isUniquelyMapped() { return isUniquelyMapped_; }
@@ -47,18 +95,69 @@ public:
   }
 
   /**
-   *  Sort the alignments by their transcript ids
+   * Sort the alignments by their transcript ids (keeping the alignments to
+   * the same transcript in the order they were added).  Each alignment's
+   * transcript id is read just once, into a key that also holds its
+   * position; the keys are sorted (by insertion, for the small groups most
+   * fragments have), and the alignments are then put in their order.
    */
   inline void sortHits() {
-    std::sort(alignments_.begin(), alignments_.end(),
-              [](const FragT& x, const FragT& y) -> bool {
-                return x->transcriptID() < y->transcriptID();
-              });
+    size_t n = alignments_.size();
+    if (n < 2 or (inOrder_ and numTracked_ == n)) {
+      return;
+    }
+    static thread_local std::vector<uint64_t> keys;
+    static thread_local std::vector<FragT> sorted;
+    keys.resize(n);
+    bool inOrder{true};
+    for (size_t i = 0; i < n; ++i) {
+      // (flipping the sign bit orders the signed ids as unsigned keys)
+      uint64_t id = static_cast<uint32_t>(alignments_[i]->transcriptID()) ^
+                    0x80000000u;
+      keys[i] = (id << 32) | i;
+      inOrder = inOrder and (i == 0 or keys[i - 1] < keys[i]);
+    }
+    if (!inOrder) {
+      if (n <= insertionSortMax_) {
+        for (size_t i = 1; i < n; ++i) {
+          uint64_t key = keys[i];
+          size_t j = i;
+          for (; j > 0 and keys[j - 1] > key; --j) {
+            keys[j] = keys[j - 1];
+          }
+          keys[j] = key;
+        }
+      } else {
+        std::sort(keys.begin(), keys.end());
+      }
+      sorted.resize(n);
+      for (size_t i = 0; i < n; ++i) {
+        sorted[i] = alignments_[keys[i] & 0xffffffffu];
+      }
+      std::copy(sorted.begin(), sorted.end(), alignments_.begin());
+    }
+    inOrder_ = true;
+    numTracked_ = n;
   }
 
 private:
+  // The largest group whose keys are sorted by insertion
+  static constexpr size_t insertionSortMax_ = 32;
+
   std::vector<FragT> alignments_;
   std::string* read_;
   bool isUniquelyMapped_;
+  // Whether the numTracked_ alignments added by addAlignment are in
+  // transcript order
+  bool inOrder_{true};
+  size_t numTracked_{0};
+  // The clears in a row of fragments that fit in maxRetainedAlignments
+  uint32_t numSmallClears_{0};
 };
+
+template <typename FragT>
+constexpr size_t AlignmentGroup<FragT>::maxRetainedAlignments;
+template <typename FragT>
+constexpr uint32_t AlignmentGroup<FragT>::shrinkAfterClears;
+
 #endif // ALIGNMENT_GROUP
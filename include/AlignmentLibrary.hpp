@@ -22,13 +22,16 @@ extern "C" {
 #include "GCFragModel.hpp"
 #include "LibraryFormat.hpp"
 #include "LibraryTypeDetector.hpp"
+#include "MappingVerifier.hpp"
+#include "OnlineConvergenceMonitor.hpp"
 #include "ReadKmerDist.hpp"
 #include "SBModel.hpp"
 #include "SalmonOpts.hpp"
+#include "SalmonSpinLock.hpp"
 #include "SalmonUtils.hpp"
 #include "SimplePosBias.hpp"
-#include "SpinLock.hpp" // RapMap's with try_lock
 #include "Transcript.hpp"
+#include "TranscriptNames.hpp"
 #include "concurrentqueue.h"
 
 // Boost includes
@@ -63,7 +66,8 @@ public:
         expectedGC_(salmonOpts.numConditionalGCBins, salmonOpts.numFragGCBins,
                     distribution_utils::DistributionSpace::LOG),
         observedGC_(salmonOpts.numConditionalGCBins, salmonOpts.numFragGCBins,
-                    distribution_utils::DistributionSpace::LOG) {
+                    distribution_utils::DistributionSpace::LOG),
+        onlineConvergence_(salmonOpts.onlineStopTolerance) {
     namespace bfs = boost::filesystem;
 
     // Make sure the alignment file exists.
@@ -89,7 +93,14 @@ public:
     std::cerr << "parseThreads = " << numParseThreads << "\n";
     bq = std::unique_ptr<BAMQueue<FragT>>(
         new BAMQueue<FragT>(alnFiles, libFmt_, numParseThreads,
-                            salmonOpts.mappingCacheMemoryLimit));
+                            salmonOpts.mappingCacheMemoryLimit,
+                            salmonOpts.cramReference));
+    // The reads of coordinate-sorted alignments that don't fit in memory
+    // while they're collated are spilled next to the output
+    if (bq->collating()) {
+      bq->setCollationSpillPath(
+          (salmonOpts.outputDirectory / "collate.spill").string());
+    }
 
     std::cerr << "Checking that provided alignment files have consistent "
                  "headers . . . ";
@@ -108,16 +119,19 @@ public:
 
     // The transcript file existed, so load up the transcripts
     double alpha = 0.005;
+    transcriptNames_.reserve(header->nref);
+    transcripts_.reserve(header->nref);
     for (size_t i = 0; i < header->nref; ++i) {
-      transcripts_.emplace_back(i, header->ref[i].name, header->ref[i].len,
-                                alpha);
+      const char* name =
+          transcriptNames_.name(transcriptNames_.add(header->ref[i].name));
+      transcripts_.emplace_back(i, name, header->ref[i].len, alpha);
     }
 
     FASTAParser fp(transcriptFile.string());
 
     fmt::print(stderr, "Populating targets from aln = {}, fasta = {} . . .",
                alnFiles.front(), transcriptFile_);
-    fp.populateTargets(transcripts_, salmonOpts);
+    fp.populateTargets(transcripts_, transcriptNames_, salmonOpts);
     /*
 for (auto& txp : transcripts_) {
     // Length classes taken from
@@ -262,6 +276,8 @@ for (auto& txp : transcripts_) {
 
   std::vector<Transcript>& transcripts() { return transcripts_; }
   const std::vector<Transcript>& transcripts() const { return transcripts_; }
+  // The names of the transcripts, which their RefNames point into
+  const TranscriptNames& transcriptNames() const { return transcriptNames_; }
 
   inline bool getAlignmentGroup(AlignmentGroup<FragT>*& ag) {
     return bq->getAlignmentGroup(ag);
@@ -284,14 +300,11 @@ for (auto& txp : transcripts_) {
 
   SequenceBiasModel& sequenceBiasModel() { return seqBiasModel_; }
 
-  //    inline tbb::concurrent_queue<FragT*>& fragmentQueue() {
-  inline tbb::concurrent_queue<FragT*>& fragmentQueue() {
+  inline moodycamel::BlockingConcurrentQueue<FragT*>& fragmentQueue() {
     return bq->getFragmentQueue();
   }
 
-  //    inline tbb::concurrent_bounded_queue<AlignmentGroup<FragT*>*>&
-  //    alignmentGroupQueue() {
-  inline moodycamel::ConcurrentQueue<AlignmentGroup<FragT*>*>&
+  inline moodycamel::BlockingConcurrentQueue<AlignmentGroup<FragT*>*>&
   alignmentGroupQueue() {
     return bq->getAlignmentGroupQueue();
   }
@@ -310,6 +323,54 @@ for (auto& txp : transcripts_) {
     return static_cast<double>(numMappedFragments()) / numObservedFragments();
   }
 
+  // Alignment-based quantification does not use the per-thread
+  // mini-batch scratch buffers, so there is nothing to report.
+  uint64_t numScratchRegrowths() const { return 0; }
+
+  // Nor does it verify quasi-mappings.
+  MappingVerifierStats mappingVerifierStats() const {
+    return MappingVerifierStats();
+  }
+
+  // Nor does it cache the mappings of duplicate reads.
+  uint64_t numReadCacheLookups() const { return 0; }
+  uint64_t numReadCacheHits() const { return 0; }
+
+  // Nor does it discard repeats before mapping.
+  uint64_t numRepeatRejections() const { return 0; }
+
+  // Nor does it look at the reads' adapters or complexity.
+  uint64_t numAdapterClipped() const { return 0; }
+  uint64_t numLowComplexity() const { return 0; }
+
+  // Nor does it subsample the reads.
+  uint64_t numSubsampledOut() const { return 0; }
+
+  /**
+   * Tracks whether the online estimates have stabilized (see
+   * --onlineStopTolerance).
+   */
+  OnlineConvergenceMonitor& onlineConvergence() { return onlineConvergence_; }
+  uint64_t onlineConvergedAtFragment() const {
+    return onlineConvergence_.convergedAtFragment();
+  }
+
+  /**
+   * Record the number of (VB)EM iterations each bootstrap sample took.
+   */
+  void setBootstrapIterations(const std::vector<uint32_t>& its) {
+    bootstrapIterations_ = its;
+  }
+  const std::vector<uint32_t>& bootstrapIterations() const {
+    return bootstrapIterations_;
+  }
+
+  /**
+   * Record the fragments left out of targeted quantification (--targets).
+   */
+  void setNumBackgroundFragments(uint64_t n) { numBackgroundFragments_ = n; }
+  uint64_t numBackgroundFragments() const { return numBackgroundFragments_; }
+
   // const boost::filesystem::path& alignmentFile() { return alignmentFile_; }
 
   ClusterForest& clusterForest() { return *clusters_.get(); }
@@ -493,6 +554,8 @@ private:
    * fragment library.
    */
   LibraryFormat libFmt_;
+  // (declared before the transcripts, whose RefNames point into it)
+  TranscriptNames transcriptNames_;
   /**
    * The targets (transcripts) to be quantified.
    */
@@ -533,8 +596,12 @@ private:
    *  made through the alignment file.
    */
   size_t quantificationPasses_;
-  SpinLock sl_;
+  spin_lock sl_{"alignment_library"};
   EquivalenceClassBuilder eqBuilder_;
+  // The number of (VB)EM iterations taken by each bootstrap sample
+  std::vector<uint32_t> bootstrapIterations_;
+  // The fragments left out of targeted quantification
+  uint64_t numBackgroundFragments_{0};
 
   /** Positional bias things**/
   std::vector<uint32_t> lengthQuantiles_;
@@ -559,6 +626,7 @@ private:
   std::vector<double> expectedBias_;
   std::unique_ptr<LibraryTypeDetector> detector_{nullptr};
   std::vector<double> conditionalMeans_;
+  OnlineConvergenceMonitor onlineConvergence_;
 };
 
 #endif // ALIGNMENT_LIBRARY_HPP
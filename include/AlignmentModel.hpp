@@ -24,6 +24,24 @@ class Transcript;
 
 class AlignmentModel {
 public:
+  /**
+   * The observations a single thread has made since they were last added to
+   * the model (with addObservations()).  They are kept in linear space,
+   * relative to the largest mass seen, so that recording one is a plain
+   * addition; adding them to the model then does one atomic update per
+   * transition that was seen, rather than one per alignment column.
+   */
+  class LocalObservations {
+    friend class AlignmentModel;
+    std::vector<double> weights_;
+    std::vector<uint32_t> touched_;
+    double logScale_;
+
+  public:
+    LocalObservations();
+    bool empty() const { return touched_.empty(); }
+  };
+
   AlignmentModel(double alpha, uint32_t readBins = 4);
   bool burnedIn();
   void burnedIn(bool burnedIn);
@@ -52,6 +70,20 @@ public:
    */
   double logLikelihood(const ReadPair&, Transcript& ref);
 
+  /**
+   * As the update()s above, but record the observations in the thread's
+   * local observations rather than in the model itself.
+   */
+  void update(const UnpairedRead&, Transcript& ref, double p, double mass,
+              LocalObservations& local) const;
+  void update(const ReadPair&, Transcript& ref, double p, double mass,
+              LocalObservations& local) const;
+
+  /**
+   * Add all of a thread's local observations to the model, and clear them.
+   */
+  void addObservations(LocalObservations& local);
+
   bool hasIndel(UnpairedRead& r);
   bool hasIndel(ReadPair& r);
 
@@ -74,7 +106,7 @@ private:
   };
 
   void setBasesFromCIGAROp_(enum cigar_op op, size_t& curRefBase,
-                            size_t& curReadBase);
+                            size_t& curReadBase) const;
   // std::stringstream& readStr, std::stringstream& matchStr,
   // std::stringstream& refstr);
 
@@ -93,6 +125,18 @@ private:
   double logLikelihood(bam_seq_t* read, Transcript& ref,
                        std::vector<AtomicMatrix<double>>& mismatchProfile);
   bool hasIndel(bam_seq_t* r);
+  // tableOffset selects the left (0) or right (readBins_) tables of local
+  void update(bam_seq_t* read, Transcript& ref, double p, double mass,
+              uint32_t tableOffset, LocalObservations& local) const;
+
+  /**
+   * Visit the (read position bin, previous state, current state) of each
+   * column of the alignment; shared by update() and logLikelihood().
+   */
+  template <typename VisitT>
+  bool walkAlignment_(bam_seq_t* read, Transcript& ref, size_t readIdx,
+                      size_t uTranscriptIdx, const char* caller,
+                      VisitT&& visit) const;
 
   // NOTE: Do these need to be concurrent_vectors as before?
   // Store the mismatch probability tables for the left and right reads
@@ -0,0 +1,88 @@
+#ifndef ASYNC_BOOTSTRAP_WRITER_HPP
+#define ASYNC_BOOTSTRAP_WRITER_HPP
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "blockingconcurrentqueue.h"
+
+/**
+ * Hands finished bootstrap samples off from the threads computing them to a
+ * single, dedicated thread that writes (and compresses) them, so that the
+ * workers never wait on the output.
+ *
+ * The samples are passed in a fixed pool of buffers; a worker acquires a
+ * free buffer, fills it, and submits it to the writer, which returns it to
+ * the pool once it has been written.  The number of buffers bounds the
+ * memory used by samples waiting to be written.  If the writer falls
+ * behind, acquire() blocks until a buffer is free.
+ */
+class AsyncBootstrapWriter {
+public:
+  AsyncBootstrapWriter(
+      std::function<bool(const std::vector<double>&)>& writeBootstrap,
+      size_t numBuffers, size_t bufferSize)
+      : writeBootstrap_(writeBootstrap),
+        buffers_(numBuffers, std::vector<double>(bufferSize, 0.0)) {
+    for (auto& b : buffers_) {
+      free_.enqueue(&b);
+    }
+    writer_ = std::thread([this]() -> void { run_(); });
+  }
+
+  ~AsyncBootstrapWriter() {
+    if (writer_.joinable()) {
+      finish();
+    }
+  }
+
+  /**
+   * Get a free buffer to hold a sample; blocks if none is available.
+   */
+  std::vector<double>* acquire() {
+    std::vector<double>* buf{nullptr};
+    free_.wait_dequeue(buf);
+    return buf;
+  }
+
+  /**
+   * Pass a filled buffer (obtained from acquire()) to the writer.
+   */
+  void submit(std::vector<double>* buf) { full_.enqueue(buf); }
+
+  /**
+   * Wait for all of the submitted samples to be written and stop the
+   * writer thread.  Returns false if any sample could not be written.
+   */
+  bool finish() {
+    full_.enqueue(nullptr);
+    writer_.join();
+    return ok_;
+  }
+
+private:
+  void run_() {
+    while (true) {
+      std::vector<double>* buf{nullptr};
+      full_.wait_dequeue(buf);
+      if (buf == nullptr) {
+        break;
+      }
+      if (!writeBootstrap_(*buf)) {
+        ok_ = false;
+      }
+      free_.enqueue(buf);
+    }
+  }
+
+  std::function<bool(const std::vector<double>&)>& writeBootstrap_;
+  std::vector<std::vector<double>> buffers_;
+  moodycamel::BlockingConcurrentQueue<std::vector<double>*> free_;
+  moodycamel::BlockingConcurrentQueue<std::vector<double>*> full_;
+  std::atomic<bool> ok_{true};
+  std::thread writer_;
+};
+
+#endif // ASYNC_BOOTSTRAP_WRITER_HPP
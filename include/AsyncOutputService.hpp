@@ -0,0 +1,129 @@
+#ifndef __ASYNC_OUTPUT_SERVICE_HPP__
+#define __ASYNC_OUTPUT_SERVICE_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "spdlog/spdlog.h"
+
+/**
+ * Runs output tasks (writing a file from data that will no longer change,
+ * or from a copy of it) on a few threads of its own, so that the thread
+ * that submits them can go on with its work (e.g. drawing the bootstrap
+ * samples) rather than waiting on the disk.
+ *
+ * With a single thread, the tasks run one at a time in the order in which
+ * they were submitted (as the bootstrap samples must be written).  At most
+ * maxPending tasks wait to be run at any time; submit() blocks until there
+ * is room, so that a producer can't get arbitrarily far ahead of the disk.
+ *
+ * wait() is the barrier that must be passed before the output is complete;
+ * the destructor also waits for every submitted task to finish.
+ */
+class AsyncOutputService {
+public:
+  AsyncOutputService(std::shared_ptr<spdlog::logger> log,
+                     uint32_t numThreads = 1, size_t maxPending = 16)
+      : log_(log), maxPending_(std::max(maxPending, size_t(1))) {
+    numThreads = std::max(numThreads, uint32_t(1));
+    for (uint32_t i = 0; i < numThreads; ++i) {
+      workers_.emplace_back([this]() -> void { run_(); });
+    }
+  }
+
+  ~AsyncOutputService() {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      done_ = true;
+    }
+    taskReady_.notify_all();
+    for (auto& w : workers_) {
+      w.join();
+    }
+  }
+
+  AsyncOutputService(const AsyncOutputService&) = delete;
+  AsyncOutputService& operator=(const AsyncOutputService&) = delete;
+
+  /**
+   * Queue task, which returns false if it failed; name is used to report
+   * the failure.
+   */
+  void submit(const std::string& name, std::function<bool()> task) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    roomReady_.wait(lock, [this]() { return tasks_.size() < maxPending_; });
+    tasks_.emplace_back(name, std::move(task));
+    ++unfinished_;
+    lock.unlock();
+    taskReady_.notify_one();
+  }
+
+  /**
+   * Wait for all of the tasks submitted so far to finish; returns false if
+   * any task (ever) failed.
+   */
+  bool wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    allDone_.wait(lock, [this]() { return unfinished_ == 0; });
+    return ok_;
+  }
+
+  // False once any task has failed
+  bool ok() const { return ok_; }
+
+private:
+  void run_() {
+    while (true) {
+      std::pair<std::string, std::function<bool()>> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        taskReady_.wait(lock, [this]() { return done_ or !tasks_.empty(); });
+        if (tasks_.empty()) {
+          return;
+        }
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      roomReady_.notify_one();
+
+      bool taskOk{false};
+      try {
+        taskOk = task.second();
+      } catch (std::exception& e) {
+        log_->error("Writing {} failed with the exception [{}]", task.first,
+                    e.what());
+      }
+      if (!taskOk) {
+        log_->error("Couldn't write {}", task.first);
+        ok_ = false;
+      }
+
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (--unfinished_ == 0) {
+        allDone_.notify_all();
+      }
+    }
+  }
+
+  std::shared_ptr<spdlog::logger> log_;
+  size_t maxPending_;
+  std::deque<std::pair<std::string, std::function<bool()>>> tasks_;
+  size_t unfinished_{0};
+  bool done_{false};
+  std::atomic<bool> ok_{true};
+  std::mutex mutex_;
+  std::condition_variable taskReady_;
+  std::condition_variable roomReady_;
+  std::condition_variable allDone_;
+  std::vector<std::thread> workers_;
+};
+
+#endif // __ASYNC_OUTPUT_SERVICE_HPP__
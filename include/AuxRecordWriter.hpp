@@ -0,0 +1,206 @@
+#ifndef __AUX_RECORD_WRITER_HPP__
+#define __AUX_RECORD_WRITER_HPP__
+
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+
+#include <boost/filesystem.hpp>
+
+#include "blockingconcurrentqueue.h"
+#include "spdlog/fmt/fmt.h"
+
+/**
+ * Writes the records (e.g. the names of the unmapped reads) that the mapping
+ * threads collect, a batch at a time, in fmt::MemoryWriters of their own.
+ *
+ * A thread hands a batch over by copying it into one of a fixed number of
+ * buffers, which are passed to (and back from) a dedicated writer thread
+ * through lock-free queues, so the mapping threads never contend for the
+ * file.  If all of the buffers are waiting to be written (the disk can't
+ * keep up), write() blocks until one is free, so the memory used is
+ * bounded.  The batches of the different threads may be interleaved in any
+ * order, but each batch is written contiguously.
+ *
+ * A writer can write several files in lockstep (e.g. the two mates of
+ * paired reads): a batch then has one part per file, and the parts of a
+ * batch are written at the same point of each file.
+ *
+ * If the output is compressed, each part is deflated into a gzip member of
+ * its own by the thread that hands it over, so the compression is spread
+ * over the mapping threads; a file is then a series of gzip members, which
+ * gzip (and zcat, etc.) read as one stream.
+ */
+class AuxRecordWriter {
+public:
+  AuxRecordWriter(const boost::filesystem::path& path, bool compress,
+                  size_t numBuffers = 64)
+      : AuxRecordWriter(std::vector<boost::filesystem::path>{path}, compress,
+                        numBuffers) {}
+
+  // Write the files at paths in lockstep
+  AuxRecordWriter(const std::vector<boost::filesystem::path>& paths,
+                  bool compress, size_t numBuffers = 64)
+      : compress_(compress), buffers_(std::max(numBuffers, size_t(1))) {
+    for (auto& path : paths) {
+      std::unique_ptr<std::ofstream> file(new std::ofstream(
+          path.string(), std::ios_base::out | std::ios_base::binary));
+      if (!file->is_open()) {
+        files_.clear();
+        return;
+      }
+      files_.push_back(std::move(file));
+    }
+    std::vector<std::ostream*> outs;
+    for (auto& file : files_) {
+      outs.push_back(file.get());
+    }
+    init_(outs);
+  }
+
+  // Write to os (e.g. std::cout), which must outlive the writer
+  AuxRecordWriter(std::ostream& os, bool compress, size_t numBuffers = 64)
+      : compress_(compress), buffers_(std::max(numBuffers, size_t(1))) {
+    init_({&os});
+  }
+
+  ~AuxRecordWriter() { close(); }
+
+  AuxRecordWriter(const AuxRecordWriter&) = delete;
+  AuxRecordWriter& operator=(const AuxRecordWriter&) = delete;
+
+  // True if the files were opened
+  bool good() const { return !outs_.empty(); }
+
+  /**
+   * Hand the records in w (which should end with a newline) to the writer,
+   * and clear w.
+   */
+  void write(fmt::MemoryWriter& w) {
+    write(w.data(), w.size());
+    w.clear();
+  }
+
+  /**
+   * Hand the records of the first and the second file (of a writer of two)
+   * in first and second to the writer, as one batch, and clear them.
+   */
+  void write(fmt::MemoryWriter& first, fmt::MemoryWriter& second) {
+    if ((first.size() > 0 or second.size() > 0) and good()) {
+      std::vector<std::string>* batch = acquire_();
+      assign_((*batch)[0], first.data(), first.size());
+      assign_((*batch)[1], second.data(), second.size());
+      ++numHanded_;
+      full_.enqueue(batch);
+    }
+    first.clear();
+    second.clear();
+  }
+
+  // Hand the n bytes at data to the writer
+  void write(const char* data, size_t n) {
+    if (n == 0 or !good()) {
+      return;
+    }
+    std::vector<std::string>* batch = acquire_();
+    assign_(batch->front(), data, n);
+    ++numHanded_;
+    full_.enqueue(batch);
+  }
+
+  /**
+   * Write everything that was handed over, and close the files.  No more
+   * records can be written after this.
+   */
+  void close() {
+    if (!writer_.joinable()) {
+      return;
+    }
+    full_.enqueue(nullptr);
+    writer_.join();
+    for (auto os : outs_) {
+      os->flush();
+    }
+    for (auto& file : files_) {
+      file->close();
+    }
+  }
+
+private:
+  void init_(const std::vector<std::ostream*>& outs) {
+    outs_ = outs;
+    for (auto& b : buffers_) {
+      b.resize(outs_.size());
+      free_.enqueue(&b);
+    }
+    writer_ = std::thread([this]() -> void { run_(); });
+  }
+
+  std::vector<std::string>* acquire_() {
+    std::vector<std::string>* batch{nullptr};
+    free_.wait_dequeue(batch);
+    return batch;
+  }
+
+  // Copy (or deflate) the n bytes at data into the part buf of a batch
+  void assign_(std::string& buf, const char* data, size_t n) {
+    if (!compress_ or n == 0) {
+      buf.assign(data, n);
+      return;
+    }
+    z_stream zs;
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    // (a window of 2^15 bytes, and 16 for the gzip header and trailer)
+    deflateInit2(&zs, Z_BEST_SPEED, Z_DEFLATED, 15 + 16, 8,
+                 Z_DEFAULT_STRATEGY);
+    buf.resize(deflateBound(&zs, n));
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    zs.avail_in = static_cast<uInt>(n);
+    zs.next_out = reinterpret_cast<Bytef*>(&buf[0]);
+    zs.avail_out = static_cast<uInt>(buf.size());
+    deflate(&zs, Z_FINISH);
+    buf.resize(zs.total_out);
+    deflateEnd(&zs);
+  }
+
+  void run_() {
+    std::vector<std::string>* batch{nullptr};
+    // The queue is only FIFO per producer, so the end marker of close() may
+    // come before batches that were handed over earlier (by other threads)
+    bool closing{false};
+    uint64_t numWritten{0};
+    while (!closing or numWritten < numHanded_) {
+      full_.wait_dequeue(batch);
+      if (batch == nullptr) {
+        closing = true;
+        continue;
+      }
+      for (size_t i = 0; i < outs_.size(); ++i) {
+        auto& part = (*batch)[i];
+        outs_[i]->write(part.data(), part.size());
+        part.clear();
+      }
+      ++numWritten;
+      free_.enqueue(batch);
+    }
+  }
+
+  bool compress_;
+  // Each buffer holds one part per file
+  std::vector<std::vector<std::string>> buffers_;
+  moodycamel::BlockingConcurrentQueue<std::vector<std::string>*> free_;
+  moodycamel::BlockingConcurrentQueue<std::vector<std::string>*> full_;
+  std::atomic<uint64_t> numHanded_{0};
+  std::vector<std::unique_ptr<std::ofstream>> files_;
+  std::vector<std::ostream*> outs_;
+  std::thread writer_;
+};
+
+#endif // __AUX_RECORD_WRITER_HPP__
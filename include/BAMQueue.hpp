@@ -6,19 +6,25 @@
 #include <atomic>
 #include <condition_variable>
 #include <exception>
+#include <functional>
 #include <fstream>
 #include <iostream>
 #include <memory>
 #include <mutex>
 #include <tbb/atomic.h>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
+#include "AlignmentCollator.hpp"
 #include "AlignmentGroup.hpp"
 #include "LibraryFormat.hpp"
+#include "MemoryBudget.hpp"
 #include "ReadPair.hpp"
+#include "SalmonLogging.hpp"
 #include "SalmonMath.hpp"
 #include "UnpairedRead.hpp"
+#include "blockingconcurrentqueue.h"
 #include "concurrentqueue.h"
 #include "readerwriterqueue.h"
 #include "spdlog/spdlog.h"
@@ -33,6 +39,10 @@ extern "C" {
 #undef min
 }
 
+#ifndef BAM_FSUPPLEMENTARY
+#define BAM_FSUPPLEMENTARY 2048
+#endif
+
 /**
  * Simple structure holding info about the alignment file.
  */
@@ -42,6 +52,8 @@ struct AlignmentFile {
   scram_fd* fp;
   SAM_hdr* header;
   uint32_t numParseThreads;
+  // the reference FASTA of a CRAM file (empty otherwise)
+  std::string cramReference;
 };
 
 /**
@@ -54,7 +66,8 @@ struct AlignmentFile {
 template <typename FragT> class BAMQueue {
 public:
   BAMQueue(std::vector<boost::filesystem::path>& fnames, LibraryFormat& libFmt,
-           uint32_t numParseThreads, uint32_t cacheSize);
+           uint32_t numParseThreads, uint32_t cacheSize,
+           const std::string& cramReference = "");
   ~BAMQueue();
   void forceEndParsing();
 
@@ -76,14 +89,32 @@ public:
 
   void reset();
 
-  tbb::concurrent_queue<FragT*>& getFragmentQueue();
-  // moodycamel::ConcurrentQueue<FragT*>& getFragmentQueue();
+  /** Whether the alignments are sorted by coordinate (as declared by the
+   * header of any of the files), and so are collated by read name as
+   * they're parsed (see collateQueue_), rather than grouped as they come.
+   */
+  bool collating() const { return collate_; }
+
+  /** Where to spill the reads being collated that don't fit in memory (by
+   * default, nothing is spilled) */
+  void setCollationSpillPath(const std::string& path) {
+    collateSpillPath_ = path;
+  }
 
-  // tbb::concurrent_bounded_queue<AlignmentGroup<FragT*>*>&
-  // getAlignmentGroupQueue();
-  moodycamel::ConcurrentQueue<AlignmentGroup<FragT*>*>&
+  moodycamel::BlockingConcurrentQueue<FragT*>& getFragmentQueue();
+
+  // The pool of free alignment groups
+  moodycamel::BlockingConcurrentQueue<AlignmentGroup<FragT*>*>&
   getAlignmentGroupQueue();
 
+  /** The (estimated) memory taken by a fragment held in the pools or in
+   * the mapping cache: the fragment, a group, and the record of each
+   * read of the fragment */
+  static constexpr size_t bytesPerFragment() {
+    return sizeof(FragT) + sizeof(AlignmentGroup<FragT*>) +
+           (std::is_same<FragT, ReadPair>::value ? 2 : 1) * recordBytes_;
+  }
+
 private:
   size_t popNum{0};
   /** Fill the queue with the appropriate type of alignment
@@ -91,6 +122,66 @@ private:
    */
   template <typename FilterT> void fillQueue_(FilterT, bool);
 
+  /** Fill the queue from coordinate-sorted alignments: each record of a
+   * proper (or unmapped) pair waits for its mate, in a MatePairer, and the
+   * fragments wait, in a ReadGrouper, for all of the alignments of their
+   * read (as many as its NH tag says), before they go out as a group.  The
+   * reads that don't fit in memory are spilled (see
+   * setCollationSpillPath()), and those without an NH tag go out at the
+   * end of the input.
+   */
+  template <typename FilterT> void collateQueue_(FilterT, bool);
+
+  /** The bytes that the reads (and mates) being collated may take */
+  static uint64_t collateBytes_();
+
+  /** A record for nextRecord_ to read into, and one to keep for later */
+  bam_seq_t* takeRecord_();
+  void recycleRecord_(bam_seq_t* rec);
+
+  /** Swap the records of a collated fragment into frag, and set it up as
+   * getFrag_ would (f is left with the records frag had) */
+  static void placeRecords_(ReadPair& rpair,
+                            salmon::collate::Frag<bam_seq_t>& f);
+  static void placeRecords_(UnpairedRead& sread,
+                            salmon::collate::Frag<bam_seq_t>& f);
+
+  /** (Re-)open the given file for parsing, set up its decompression
+   * threads and return its handle (exits if it can't be opened).  A
+   * stream that was left open when its header was read is used as is.
+   */
+  scram_fd* openFile_(AlignmentFile& file);
+
+  /** The parsing thread takes the fragments and groups that the consumers
+   * recycle from their pools recycleBatchSize_ at a time, into its own free
+   * lists, rather than one at a time.  takeFrag_ allocates a new fragment
+   * while the group pool hasn't been exhausted; otherwise, both block until
+   * the consumers return something.
+   */
+  FragT* takeFrag_(std::vector<FragT*>& freeFrags, size_t& numFragAlloc);
+  AlignmentGroup<FragT*>*
+  takeGroup_(std::vector<AlignmentGroup<FragT*>*>& freeGroups);
+
+  /** True if p points into the slab of n objects starting at slab */
+  template <typename T>
+  static bool inSlab_(const T* p, const T* slab, size_t n) {
+    std::less<const T*> lt;
+    return slab != nullptr and !lt(p, slab) and lt(p, slab + n);
+  }
+
+  /** Read the next record of the current file that passes the record-level
+   * filter, which looks only at the fixed-size core of the record (its
+   * flag): supplementary (chimeric) records are dropped here, before they
+   * can become (or break the pairing of) a fragment.  Returns false at the
+   * end of the file.
+   */
+  inline bool nextRecord_(bam_seq_t** rec);
+
+  /** The NH tag (the number of alignments reported for the read) of the
+   * (first) record of the fragment, or -1 if it has none */
+  static inline int32_t numHits_(ReadPair& rpair);
+  static inline int32_t numHits_(UnpairedRead& sread);
+
   /** Overload of getFrag_ for paired-end reads */
   template <typename FilterT>
   inline bool getFrag_(ReadPair& rpair, FilterT filt);
@@ -115,32 +206,52 @@ private:
   size_t numUnaligned_;
   size_t numMappedReads_;
   size_t numUniquelyMappedReads_;
-  tbb::concurrent_queue<FragT*> fragmentQueue_;
-  // moodycamel::ConcurrentQueue<FragT*> fragmentQueue_;
+  // the records dropped by nextRecord_
+  size_t numFilteredRecords_{0};
+  // the reads found to be unique from their NH tag (see fillQueue_)
+  size_t numNHUniqueReads_{0};
+  std::unique_ptr<FragT[]> fragSlab_;
+  size_t numFragSlab_{0};
+  std::unique_ptr<AlignmentGroup<FragT*>[]> groupSlab_;
+  size_t numGroupSlab_{0};
+  salmon::memory::Account* poolAccount_{nullptr};
+  moodycamel::BlockingConcurrentQueue<FragT*> fragmentQueue_;
+  moodycamel::BlockingConcurrentQueue<AlignmentGroup<FragT*>*> alnGroupPool_;
+  // filled by the parsing thread, drained by the one calling
+  // getAlignmentGroup(), which waits on it (rather than spinning) when empty
+  moodycamel::BlockingReaderWriterQueue<AlignmentGroup<FragT*>*>
+      alnGroupQueue_;
 
-  // tbb::concurrent_bounded_queue<AlignmentGroup<FragT*>*> alnGroupPool_;
-  moodycamel::ConcurrentQueue<AlignmentGroup<FragT*>*> alnGroupPool_;
+  // see takeFrag_ and takeGroup_
+  static constexpr size_t recycleBatchSize_ = 64;
+  // the bytes of a typical (short read) BAM record, with its tags
+  static constexpr size_t recordBytes_ = 384;
+  // the fewest fragments (and groups) in the pools, however tight the
+  // memory budget
+  static constexpr uint32_t minPoolSize_ = 100000;
+  // how often getAlignmentGroup() checks, while waiting, whether parsing is
+  // done
+  static constexpr int64_t doneParsingPollUs_ = 1000;
 
-  // tbb::concurrent_bounded_queue<AlignmentGroup<FragT*>*> alnGroupQueue_;
-  moodycamel::ReaderWriterQueue<AlignmentGroup<FragT*>*> alnGroupQueue_;
-
-  /*
-  boost::lockfree::spsc_queue<AlignmentGroup<FragT*>*,
-                              boost::lockfree::capacity<65535>> alnGroupQueue_;
-                              */
-  volatile bool doneParsing_;
-  volatile bool exhaustedAlnGroupPool_;
+  std::atomic<bool> doneParsing_;
+  // only used by the parsing thread
+  bool exhaustedAlnGroupPool_;
   std::unique_ptr<std::thread> parsingThread_;
   std::shared_ptr<spdlog::logger> logger_;
+  // a BAM file with many of them would otherwise flood the log
+  salmon::logging::WarningThrottle suspiciousPairs_;
+
+  // see collating() and collateQueue_
+  bool collate_{false};
+  std::string collateSpillPath_;
+  // the buffers of records no longer needed, for takeRecord_
+  std::vector<bam_seq_t*> spareRecords_;
+  static constexpr size_t maxSpareRecords_ = 4096;
+  static constexpr uint64_t defaultCollateBytes_ = uint64_t{1} << 31;
+  static constexpr uint64_t minCollateBytes_ = uint64_t{1} << 26;
 
   size_t batchNum_;
   std::string readMode_;
-  /*
-  #if not defined(__APPLE__)
-     std::mutex agMutex_;
-      std::condition_variable workAvailable_;
-  #endif
-  */
 };
 
 #include "BAMQueue.tpp"
@@ -1,11 +1,15 @@
 #include "BAMQueue.hpp"
 #include "IOUtils.hpp"
+#include "StadenUtils.hpp"
 #include <boost/config.hpp> // for BOOST_LIKELY/BOOST_UNLIKELY
 #include <chrono>
+#include <cstddef>
+#include <cstring>
 
 template <typename FragT>
 BAMQueue<FragT>::BAMQueue(std::vector<boost::filesystem::path>& fnames, LibraryFormat& libFmt,
-                          uint32_t numParseThreads, uint32_t cacheSize):
+                          uint32_t numParseThreads, uint32_t cacheSize,
+                          const std::string& cramReference):
     files_(std::vector<AlignmentFile>()),
     libFmt_(libFmt), totalAlignments_(0),
     numUnaligned_(0), numMappedReads_(0), 
@@ -20,21 +24,33 @@ BAMQueue<FragT>::BAMQueue(std::vector<boost::filesystem::path>& fnames, LibraryF
         logger_ = spdlog::get("jointLog");
 
         uint32_t localCacheSize = std::max(uint32_t{2000000}, cacheSize);
-        uint32_t capacity{localCacheSize};
-        for (size_t i = 0; i < capacity; ++i) {
-            // avoid r-value ref until we figure out what's
-            // up with TBB 4.3
-            auto* fragPtr = new FragT;
-            fragmentQueue_.push(fragPtr);
+        // Within a memory budget, the pools get at most a quarter of what's
+        // left of it; fewer groups means fewer alignments read ahead
+        auto& budget = salmon::memory::budget();
+        if (!budget.fits(uint64_t{localCacheSize} * bytesPerFragment(), 0.25)) {
+            uint64_t fit = budget.available() / 4 / bytesPerFragment();
+            localCacheSize = static_cast<uint32_t>(
+                std::max(uint64_t{minPoolSize_}, fit));
+            logger_->info("Keeping {} alignment groups in the pools, to stay "
+                          "within the memory budget", localCacheSize);
+        }
+        poolAccount_ = &budget.account("alignment_pools");
+        uint64_t poolBytes = uint64_t{localCacheSize} * bytesPerFragment();
+        poolAccount_->charge(static_cast<int64_t>(poolBytes));
+        // The pools are each allocated as a single slab, rather than one
+        // object at a time; only the fragments allocated once the pool is
+        // exhausted (in fillQueue_) come from the heap individually.
+        numFragSlab_ = localCacheSize;
+        fragSlab_.reset(new FragT[numFragSlab_]);
+        for (size_t i = 0; i < numFragSlab_; ++i) {
+            fragmentQueue_.enqueue(&fragSlab_[i]);
         }
 
-        size_t groupCapacity = localCacheSize;
+        numGroupSlab_ = localCacheSize;
         //alnGroupPool_.set_capacity(groupCapacity);
-        for (size_t i = 0; i < groupCapacity; ++i) {
-            // avoid r-value ref until we figure out what's
-            // up with TBB 4.3
-            auto* agrpPtr = new AlignmentGroup<FragT*>; 
-            alnGroupPool_.enqueue(agrpPtr);
+        groupSlab_.reset(new AlignmentGroup<FragT*>[numGroupSlab_]);
+        for (size_t i = 0; i < numGroupSlab_; ++i) {
+            alnGroupPool_.enqueue(&groupSlab_[i]);
         }
 
         bool firstFile = true;
@@ -48,11 +64,12 @@ BAMQueue<FragT>::BAMQueue(std::vector<boost::filesystem::path>& fnames, LibraryF
                     std::exit(1);
                }
             }
-            readMode_ = "r";
-            if (fname.extension() == ".bam") {
-                readMode_ = "rb";
-            }
+            readMode_ = salmon::utils::alignmentReadMode(fname);
+            // CRAM files are decoded against the given reference, shared
+            // by all of them
+            std::string fileReference = (readMode_ == "rc") ? cramReference : "";
             auto* fp = scram_open(fname.c_str(), readMode_.c_str());
+            salmon::utils::setCRAMReference(fp, fileReference);
             // If this is the first file, then we'll be parsing it soon.
             // set the number of parse threads.
             if (firstFile) {
@@ -61,13 +78,22 @@ BAMQueue<FragT>::BAMQueue(std::vector<boost::filesystem::path>& fnames, LibraryF
             auto* header = scram_get_header(fp);
             sam_hdr_incr_ref(header);
             // If this isn't the first file, then close it.
-            // We'll open it again when we need it.
-            if (!firstFile) {
+            // We'll open it again when we need it.  A file that isn't
+            // a regular file (e.g. a pipe from the aligner) can't be
+            // re-opened, so it stays open, positioned just past its header.
+            if (!firstFile and bfs::is_regular_file(fname)) {
                 scram_close(fp);
                 fp = nullptr;
             }
-            files_.push_back({fname, readMode_, fp, header, numParseThreads});
+            files_.push_back({fname, readMode_, fp, header, numParseThreads,
+                              fileReference});
             firstFile = false;
+            if (salmon::utils::isCoordinateSorted(header)) {
+                collate_ = true;
+                logger_->info("The alignments of [{}] are sorted by "
+                              "coordinate; they'll be collated by read name "
+                              "as they're parsed", fname.string());
+            }
         }
 }
 
@@ -80,6 +106,7 @@ void BAMQueue<FragT>::reset() {
       // make sure that all of the current files are closed
       if (file.fp != nullptr) {
           scram_close(file.fp);
+          file.fp = nullptr;
           // but make sure we still have a reference to the header!
           if (file.header == nullptr or file.header->ref_count <= 0) {
               fmt::MemoryWriter errstr;
@@ -92,8 +119,28 @@ void BAMQueue<FragT>::reset() {
   }
 
   // re-open the first file
-  auto& file = files_.front();
+  openFile_(files_.front());
+
+  fmt::print(stderr, "] . . . done\n");
+  totalAlignments_ = 0;
+  numUnaligned_ = 0;
+  numMappedReads_ = 0;
+  numUniquelyMappedReads_ = 0;
+  numFilteredRecords_ = 0;
+  numNHUniqueReads_ = 0;
+  doneParsing_ = false;
+  batchNum_ = 0;
+}
+
+template <typename FragT>
+scram_fd* BAMQueue<FragT>::openFile_(AlignmentFile& file) {
+  // A stream that was left open when its header was read
+  if (file.fp != nullptr) {
+    scram_set_option(file.fp, CRAM_OPT_NTHREADS, file.numParseThreads);
+    return file.fp;
+  }
   file.fp = scram_open(file.fileName.c_str(), file.readMode.c_str());
+  salmon::utils::setCRAMReference(file.fp, file.cramReference);
 
   // If we couldn't open the file, then report this and exit.
   if (file.fp == NULL) {
@@ -102,15 +149,10 @@ void BAMQueue<FragT>::reset() {
     logger_->warn(errstr.str());
     std::exit(1);
   }
+  // Every file, not just the first, is decompressed by numParseThreads
+  // threads.
   scram_set_option(file.fp, CRAM_OPT_NTHREADS, file.numParseThreads);
-
-  fmt::print(stderr, "] . . . done\n");
-  totalAlignments_ = 0;
-  numUnaligned_ = 0;
-  numMappedReads_ = 0;
-  numUniquelyMappedReads_ = 0;
-  doneParsing_ = false;
-  batchNum_ = 0;
+  return file.fp;
 }
 
 template <typename FragT>
@@ -118,6 +160,7 @@ BAMQueue<FragT>::~BAMQueue() {
     fmt::print(stderr, "\nFreeing memory used by read queue . . . ");
     parsingThread_->join();
     fmt::print(stderr, "\nJoined parsing thread . . . ");
+    suspiciousPairs_.summarize(logger_.get(), "suspicious pair warnings");
   
     for (auto& file : files_) {
         fmt::print(stderr, "{} ", file.fileName);
@@ -140,11 +183,12 @@ BAMQueue<FragT>::~BAMQueue() {
     }
 
     fmt::print(stderr, "\nClosed all files . . . ");
-    // Free the structure holding all of the reads
+    // Free the structure holding all of the reads (those in the slab are
+    // freed along with it)
     FragT* frag;
     //while (!fragmentQueue_.empty()) { 
-    while (fragmentQueue_.try_pop(frag)) { 
-        delete frag;
+    while (fragmentQueue_.try_dequeue(frag)) { 
+        if (!inSlab_(frag, fragSlab_.get(), numFragSlab_)) { delete frag; }
         frag = nullptr;
     }
     //}
@@ -152,10 +196,23 @@ BAMQueue<FragT>::~BAMQueue() {
 
     AlignmentGroup<FragT*>* grp;
     //while(!alnGroupPool_.empty()) { alnGroupPool_.pop(grp); delete grp; grp = nullptr; }
-    while(alnGroupPool_.try_dequeue(grp)) { delete grp; grp = nullptr; }
+    while(alnGroupPool_.try_dequeue(grp)) {
+        if (!inSlab_(grp, groupSlab_.get(), numGroupSlab_)) { delete grp; }
+        grp = nullptr;
+    }
     fmt::print(stderr, "\nEmptied Alignemnt Group Pool. . ");
-    while(alnGroupQueue_.try_dequeue(grp)) { delete grp; grp = nullptr; }
+    while(alnGroupQueue_.try_dequeue(grp)) {
+        if (!inSlab_(grp, groupSlab_.get(), numGroupSlab_)) { delete grp; }
+        grp = nullptr;
+    }
     fmt::print(stderr, "\nEmptied Alignment Group Queue. . . ");
+    poolAccount_->charge(
+        -static_cast<int64_t>(numGroupSlab_ * bytesPerFragment()));
+    groupSlab_.reset();
+    fragSlab_.reset();
+    for (auto* rec : spareRecords_) {
+        staden::utils::bam_destroy(rec);
+    }
     fmt::print(stderr, "done\n");
 }
 
@@ -181,32 +238,21 @@ inline bool tryToGetWork(moodycamel::ReaderWriterQueue<AlignmentGroup<FragT*>*>&
 
 template <typename FragT>
 inline bool BAMQueue<FragT>::getAlignmentGroup(AlignmentGroup<FragT*>*& group) {
-    while (!doneParsing_) {
-        while (alnGroupQueue_.try_dequeue(group)) {
+    // Sleep on the queue's semaphore until a group arrives; the timeout only
+    // bounds how long it takes to notice that parsing is done.
+    while (!doneParsing_.load(std::memory_order_acquire)) {
+        if (alnGroupQueue_.wait_dequeue_timed(group, doneParsingPollUs_)) {
             return true;
         }
-/*
-#if not defined(__APPLE__)
-{
-            std::unique_lock<std::mutex> l(agMutex_);
-            workAvailable_.wait(l, [&group, this]() { 
-                                    return this->alnGroupQueue_.try_dequeue(group) or this->doneParsing_; 
-                                });
-            return !doneParsing_;
-}
-#endif
-    }
-*/
-    }
-
-    while (alnGroupQueue_.try_dequeue(group)) {
-        return true;
     }
-    return false;
+    // Every group was enqueued before doneParsing_ was set
+    return alnGroupQueue_.try_dequeue(group);
 }
 
 template <typename FragT>
-void BAMQueue<FragT>::forceEndParsing() { doneParsing_ = true; }
+void BAMQueue<FragT>::forceEndParsing() {
+    doneParsing_.store(true, std::memory_order_release);
+}
 
 template <typename FragT>
 SAM_hdr* BAMQueue<FragT>::header() { return files_.front().header; } 
@@ -225,22 +271,61 @@ template <typename FilterT>
 void BAMQueue<FragT>::start(FilterT filt, bool onlyProcessAmbiguousAlignments) {
     // Start the parsing thread that will fill the queue
     parsingThread_.reset(new std::thread([this, filt, onlyProcessAmbiguousAlignments]()-> void {
-            this->fillQueue_(filt, onlyProcessAmbiguousAlignments);
+            if (this->collate_) {
+                this->collateQueue_(filt, onlyProcessAmbiguousAlignments);
+            } else {
+                this->fillQueue_(filt, onlyProcessAmbiguousAlignments);
+            }
     }));
 }
 
 template <typename FragT>
-tbb::concurrent_queue<FragT*>& BAMQueue<FragT>::getFragmentQueue() {
-//moodycamel::ConcurrentQueue<FragT*>& BAMQueue<FragT>::getFragmentQueue() {
+moodycamel::BlockingConcurrentQueue<FragT*>& BAMQueue<FragT>::getFragmentQueue() {
     return fragmentQueue_;
 }
 
 template <typename FragT>
-//tbb::concurrent_bounded_queue<AlignmentGroup<FragT*>*>& BAMQueue<FragT>::getAlignmentGroupQueue() {
-moodycamel::ConcurrentQueue<AlignmentGroup<FragT*>*>& BAMQueue<FragT>::getAlignmentGroupQueue() {
+moodycamel::BlockingConcurrentQueue<AlignmentGroup<FragT*>*>& BAMQueue<FragT>::getAlignmentGroupQueue() {
     return alnGroupPool_;
 }
 
+template <typename FragT>
+FragT* BAMQueue<FragT>::takeFrag_(std::vector<FragT*>& freeFrags, size_t& numFragAlloc) {
+    if (freeFrags.empty()) {
+        freeFrags.resize(recycleBatchSize_);
+        size_t n = fragmentQueue_.try_dequeue_bulk(freeFrags.begin(), recycleBatchSize_);
+        if (n == 0) {
+            if (!exhaustedAlnGroupPool_) {
+                freeFrags.clear();
+                ++numFragAlloc;
+                return new FragT;
+            }
+            n = fragmentQueue_.wait_dequeue_bulk(freeFrags.begin(), recycleBatchSize_);
+        }
+        freeFrags.resize(n);
+    }
+    FragT* f = freeFrags.back();
+    freeFrags.pop_back();
+    return f;
+}
+
+template <typename FragT>
+AlignmentGroup<FragT*>* BAMQueue<FragT>::takeGroup_(std::vector<AlignmentGroup<FragT*>*>& freeGroups) {
+    if (freeGroups.empty()) {
+        freeGroups.resize(recycleBatchSize_);
+        size_t n = alnGroupPool_.try_dequeue_bulk(freeGroups.begin(), recycleBatchSize_);
+        if (n == 0) {
+            // Every group is waiting to be processed; wait for one back
+            exhaustedAlnGroupPool_ = true;
+            n = alnGroupPool_.wait_dequeue_bulk(freeGroups.begin(), recycleBatchSize_);
+        }
+        freeGroups.resize(n);
+    }
+    AlignmentGroup<FragT*>* g = freeGroups.back();
+    freeGroups.pop_back();
+    return g;
+}
+
 inline bool checkProperPairedNames_(const char* qname1, const char* qname2, const uint32_t nameLen) {
     bool same{true};
     bool sameEnd{true};
@@ -326,6 +411,32 @@ inline AlignmentType getPairedAlignmentType_(bam_seq_t* aln) {
     std::exit(1);
 }
 
+template <typename FragT>
+inline bool BAMQueue<FragT>::nextRecord_(bam_seq_t** rec) {
+    while (scram_get_seq(fp_, rec) >= 0) {
+        if (BOOST_LIKELY(!(bam_flag(*rec) & BAM_FSUPPLEMENTARY))) {
+            return true;
+        }
+        ++numFilteredRecords_;
+    }
+    return false;
+}
+
+inline int32_t numHitsOfRecord_(bam_seq_t* rec) {
+    uint8_t* nh = bam_aux_find(rec, "NH");
+    return (nh == nullptr) ? -1 : bam_aux_i(nh);
+}
+
+template <typename FragT>
+inline int32_t BAMQueue<FragT>::numHits_(ReadPair& rpair) {
+    return numHitsOfRecord_(rpair.read1);
+}
+
+template <typename FragT>
+inline int32_t BAMQueue<FragT>::numHits_(UnpairedRead& sread) {
+    return numHitsOfRecord_(sread.read);
+}
+
 inline uint32_t getPairedNameLen(bam_seq_t* read) {
         uint32_t l = bam_name_len(read);
         char* r = bam_name(read);
@@ -346,7 +457,7 @@ inline bool BAMQueue<FragT>::getFrag_(ReadPair& rpair, FilterT filt) {
     // Until we get a valid pair of reads
     while (!haveValidPair) {
         // Consume a single read
-        didRead1 = (scram_get_seq(fp_, &rpair.read1) >= 0);
+        didRead1 = nextRecord_(&rpair.read1);
         AlignmentType alnType;
         // If we were able to obtain a read, determine what type
         // of alignment it came from.
@@ -402,10 +513,10 @@ inline bool BAMQueue<FragT>::getFrag_(ReadPair& rpair, FilterT filt) {
             }
             // If this was not a properly mapped orphan read, then grab the next
             // read.
-            didRead1 = (scram_get_seq(fp_, &rpair.read1) >= 0);
+            didRead1 = nextRecord_(&rpair.read1);
         }
 
-        didRead2 = (scram_get_seq(fp_, &rpair.read2) >=0);
+        didRead2 = nextRecord_(&rpair.read2);
 
         // If we didn't get a read, then we've exhausted this file. 
         // NOTE: I'm not sure about the *or* condition here. In some cases, we
@@ -420,7 +531,7 @@ inline bool BAMQueue<FragT>::getFrag_(ReadPair& rpair, FilterT filt) {
             // If this is the last file, then we're done
             if (currFile_ == files_.end()) { return false; }
             // Otherwise, start parsing the next file.
-            fp_ = scram_open(currFile_->fileName.c_str(), currFile_->readMode.c_str());
+            fp_ = openFile_(*currFile_);
             hdr_ = currFile_->header;
             continue;
         }
@@ -480,7 +591,7 @@ inline bool BAMQueue<FragT>::getFrag_(ReadPair& rpair, FilterT filt) {
                     << ((bam_flag(rpair.read2) & BAM_FUNMAP) ? "not " : "") << "mapped; mate"
                     << ((bam_flag(rpair.read2) & BAM_FMUNMAP) ? "not " : "") << "mapped\n\n";
             }
-            logger_->warn(errmsg.str());
+            suspiciousPairs_.warn(logger_.get(), errmsg.str());
         }
 
 
@@ -533,7 +644,7 @@ inline bool BAMQueue<FragT>::getFrag_(UnpairedRead& sread, FilterT filt) {
     bool haveValidRead{false};
 
     while (!haveValidRead) {
-        bool didRead = (scram_get_seq(fp_, &sread.read) >= 0);
+        bool didRead = nextRecord_(&sread.read);
         // If we didn't get a read, then we've exhausted this file
         if (!didRead) { 
             // close the current file
@@ -543,7 +654,7 @@ inline bool BAMQueue<FragT>::getFrag_(UnpairedRead& sread, FilterT filt) {
             // If this is the last file, then we're done
             if (currFile_ == files_.end()) { return false; }
             // Otherwise, start parsing the next file.
-            fp_ = scram_open(currFile_->fileName.c_str(), currFile_->readMode.c_str());
+            fp_ = openFile_(*currFile_);
             hdr_ = currFile_->header;
             continue;
         }
@@ -590,19 +701,19 @@ template <typename FilterT>
 void BAMQueue<FragT>::fillQueue_(FilterT filt, bool onlyProcessAmbiguousAlignments) {
     size_t n{0};
     size_t numFragAlloc{0};
-    AlignmentGroup<FragT*>* alngroup;
-    //alnGroupPool_.pop(alngroup);
-    while (!alnGroupPool_.try_dequeue(alngroup));
+    // see takeFrag_ and takeGroup_
+    std::vector<FragT*> freeFrags;
+    std::vector<AlignmentGroup<FragT*>*> freeGroups;
+    freeFrags.reserve(recycleBatchSize_);
+    freeGroups.reserve(recycleBatchSize_);
+    AlignmentGroup<FragT*>* alngroup = takeGroup_(freeGroups);
     bool notified{false};
 
     currFile_ = files_.begin();
     fp_ = currFile_->fp;
     hdr_ = currFile_->header;
 
-    FragT* f;
-    if (!fragmentQueue_.try_pop(f)) {
-        f = new FragT;
-    }
+    FragT* f = takeFrag_(freeFrags, numFragAlloc);
 
     uint32_t prevLen{1};
     char* prevReadName = new char[255];
@@ -611,6 +722,19 @@ void BAMQueue<FragT>::fillQueue_(FilterT filt, bool onlyProcessAmbiguousAlignmen
 
     while(getFrag_(*f, filt)) {
 
+        // A read whose NH tag says it has a single alignment is unique
+        // without looking at its other alignments, so, if only the
+        // ambiguous reads are wanted, it's just counted, and its fragment
+        // reused, without ever being put in a group.  (It has a name of
+        // its own, so the group being built is unaffected.)
+        if (onlyProcessAmbiguousAlignments and numHits_(*f) == 1) {
+            ++numMappedReads_;
+            ++numUniquelyMappedReads_;
+            ++numNHUniqueReads_;
+            ++n;
+            continue;
+        }
+
         char* readName = f->getName();
         uint32_t currLen = f->getNameLength();
         // if this is a new read
@@ -624,23 +748,17 @@ void BAMQueue<FragT>::fillQueue_(FilterT filt, bool onlyProcessAmbiguousAlignmen
                 // what we parsed to the appropriate queue and continue
                 if (onlyProcessAmbiguousAlignments and 
                         readAlignsUniquely) {
-                   // return the fragments
-                   for (auto aln : alngroup->alignments()) {
-                       fragmentQueue_.push(aln); aln = nullptr;
-                   }
+                   // reuse the fragments
+                   auto& alns = alngroup->alignments();
+                   freeFrags.insert(freeFrags.end(), alns.begin(), alns.end());
                    // clear the alignments vector
                    alngroup->alignments().clear();
                    // continue to use this alignment group
                    numUniquelyMappedReads_++;
                 } else {
                     // push the align group
-                    while(!alnGroupQueue_.try_enqueue(alngroup));
-                    alngroup = nullptr;
-                    if (!alnGroupPool_.try_dequeue(alngroup)) {  
-                        exhaustedAlnGroupPool_ = true;
-                        //alnGroupPool_.pop(alngroup);
-                        while(!alnGroupPool_.try_dequeue(alngroup));
-                    }
+                    alnGroupQueue_.enqueue(alngroup);
+                    alngroup = takeGroup_(freeGroups);
                 }
             }
             
@@ -665,13 +783,7 @@ void BAMQueue<FragT>::fillQueue_(FilterT filt, bool onlyProcessAmbiguousAlignmen
             f = nullptr;
        }
 
-        while (!fragmentQueue_.try_pop(f)) {
-            if (!exhaustedAlnGroupPool_) {
-                f = new FragT;
-                ++numFragAlloc;
-                break;
-            }
-        }
+        f = takeFrag_(freeFrags, numFragAlloc);
 
        if (!notified and exhaustedAlnGroupPool_) { 
           logger_->info("\n\nThe alignment group queue pool has been exhausted.  {} extra fragments were allocated "
@@ -683,7 +795,7 @@ void BAMQueue<FragT>::fillQueue_(FilterT filt, bool onlyProcessAmbiguousAlignmen
 
     // If we popped a fragment structure off the queue, but didn't add it 
     // to an alignment group, then reclaim it here
-    if (f != nullptr) { fragmentQueue_.push(f); f = nullptr; }
+    if (f != nullptr) { freeFrags.push_back(f); f = nullptr; }
 
     // If the last alignment group is non-empty, then send 
     // it off to be processed.
@@ -695,33 +807,337 @@ void BAMQueue<FragT>::fillQueue_(FilterT filt, bool onlyProcessAmbiguousAlignmen
         if (onlyProcessAmbiguousAlignments and 
                 readAlignsUniquely) {
             // return the fragments
-            for (auto aln : alngroup->alignments()) {
-                fragmentQueue_.push(aln); aln = nullptr;
-            }
+            auto& alns = alngroup->alignments();
+            freeFrags.insert(freeFrags.end(), alns.begin(), alns.end());
             // clear the alignments vector
             alngroup->alignments().clear();
             // return the alignment group itself 
-            alnGroupPool_.enqueue(alngroup);
+            freeGroups.push_back(alngroup);
             numUniquelyMappedReads_++;
         } else {
-            while(!alnGroupQueue_.try_enqueue(alngroup));
+            alnGroupQueue_.enqueue(alngroup);
             alngroup = nullptr;
         }
     } else { // otherwise, reclaim the alignment group structure here
-        //alnGroupPool_.push(alngroup);
-        alnGroupPool_.enqueue(alngroup);
+        freeGroups.push_back(alngroup);
     }
 
+    // Return what's left of the free lists to the pools
+    fragmentQueue_.enqueue_bulk(freeFrags.begin(), freeFrags.size());
+    alnGroupPool_.enqueue_bulk(freeGroups.begin(), freeGroups.size());
+
     delete [] prevReadName;
+    if (numFilteredRecords_ > 0 or numNHUniqueReads_ > 0) {
+        logger_->info("Dropped {} supplementary alignment records; {} reads "
+                      "were counted as unique from their NH tag",
+                      numFilteredRecords_, numNHUniqueReads_);
+    }
     // We're at the end of the list of input files
     // and we're done parsing (for now).
     currFile_ = files_.end();
     fp_ = nullptr;
     hdr_ = nullptr;
-    doneParsing_ = true;
+    doneParsing_.store(true, std::memory_order_release);
     return;
 }
 
+/**
+ * The functions of io_lib's records that salmon::collate needs; the
+ * records are allocated by staden::utils::bam_init() (or grown by
+ * scram_get_seq()), and spilled as their BAM block.
+ */
+struct BAMRecordTraits {
+    static const char* name(const bam_seq_t* b) { return bam_name(b); }
+    static int32_t ref(const bam_seq_t* b) { return bam_ref(b); }
+    static int32_t pos(const bam_seq_t* b) { return bam_pos(b); }
+    static int32_t mateRef(const bam_seq_t* b) { return bam_mate_ref(b); }
+    static int32_t matePos(const bam_seq_t* b) { return bam_mate_pos(b); }
+    static size_t bytes(const bam_seq_t* b) { return b->alloc; }
+    static void write(std::ostream& os, const bam_seq_t* b) {
+        os.write(reinterpret_cast<const char*>(&b->blk_size),
+                 sizeof(b->blk_size));
+        os.write(reinterpret_cast<const char*>(&b->ref), b->blk_size);
+    }
+    static bam_seq_t* read(std::istream& is) {
+        uint32_t blkSize{0};
+        is.read(reinterpret_cast<char*>(&blkSize), sizeof(blkSize));
+        size_t alloc = std::max(sizeof(bam_seq_t),
+                                offsetof(bam_seq_t, ref) + blkSize);
+        auto* b = reinterpret_cast<bam_seq_t*>(calloc(1, alloc));
+        b->alloc = alloc;
+        b->blk_size = blkSize;
+        is.read(reinterpret_cast<char*>(&b->ref), blkSize);
+        return b;
+    }
+    static void destroy(bam_seq_t* b) { staden::utils::bam_destroy(b); }
+};
+
+// The length of the name of a record, without any /1 or /2 suffix
+inline size_t collatedNameLen_(bam_seq_t* b) {
+    const char* name = bam_name(b);
+    size_t n = std::strlen(name);
+    if (n > 2 and name[n - 2] == '/' and
+        (name[n - 1] == '1' or name[n - 1] == '2')) {
+        n -= 2;
+    }
+    return n;
+}
+
+template <typename FragT>
+bam_seq_t* BAMQueue<FragT>::takeRecord_() {
+    if (spareRecords_.empty()) {
+        return staden::utils::bam_init();
+    }
+    bam_seq_t* rec = spareRecords_.back();
+    spareRecords_.pop_back();
+    return rec;
+}
+
+template <typename FragT>
+void BAMQueue<FragT>::recycleRecord_(bam_seq_t* rec) {
+    if (rec == nullptr) {
+        return;
+    }
+    if (spareRecords_.size() < maxSpareRecords_) {
+        spareRecords_.push_back(rec);
+    } else {
+        staden::utils::bam_destroy(rec);
+    }
+}
+
+template <typename FragT>
+void BAMQueue<FragT>::placeRecords_(ReadPair& rpair,
+                                    salmon::collate::Frag<bam_seq_t>& f) {
+    std::swap(rpair.read1, f.first);
+    if (f.second != nullptr) {
+        std::swap(rpair.read2, f.second);
+        if (bam_flag(rpair.read1) & BAM_FREAD2) {
+            std::swap(rpair.read1, rpair.read2);
+        }
+        // if the "fragment" is from the forward strand,
+        // the read will map to the reverse strand, and vice-versa
+        bool isFwd1 = !(bam_flag(rpair.read1) & BAM_FREVERSE);
+        bool isFwd2 = !(bam_flag(rpair.read2) & BAM_FREVERSE);
+        rpair.libFmt = salmon::utils::hitType(bam_pos(rpair.read1), isFwd1,
+                                              bam_pos(rpair.read2), isFwd2);
+        rpair.orphanStatus = salmon::utils::OrphanStatus::Paired;
+    } else {
+        bool isFwd = !(bam_strand(rpair.read1));
+        rpair.libFmt = salmon::utils::hitType(bam_pos(rpair.read1), isFwd);
+        rpair.orphanStatus = (bam_flag(rpair.read1) & BAM_FREAD1) ?
+            salmon::utils::OrphanStatus::LeftOrphan :
+            salmon::utils::OrphanStatus::RightOrphan;
+    }
+    rpair.logProb = salmon::math::LOG_0;
+}
+
+template <typename FragT>
+void BAMQueue<FragT>::placeRecords_(UnpairedRead& sread,
+                                    salmon::collate::Frag<bam_seq_t>& f) {
+    std::swap(sread.read, f.first);
+    sread.logProb = salmon::math::LOG_0;
+}
+
+template <typename FragT>
+uint64_t BAMQueue<FragT>::collateBytes_() {
+    // Within a memory budget, at most a quarter of what's left of it
+    uint64_t bytes = defaultCollateBytes_;
+    auto& budget = salmon::memory::budget();
+    if (!budget.fits(bytes, 0.25)) {
+        bytes = std::max(uint64_t{minCollateBytes_}, budget.available() / 4);
+    }
+    return bytes;
+}
+
+template <typename FragT>
+template <typename FilterT>
+void BAMQueue<FragT>::collateQueue_(FilterT filt,
+                                    bool onlyProcessAmbiguousAlignments) {
+    using CollatedFrag = salmon::collate::Frag<bam_seq_t>;
+    size_t numFragAlloc{0};
+    // see takeFrag_ and takeGroup_
+    std::vector<FragT*> freeFrags;
+    std::vector<AlignmentGroup<FragT*>*> freeGroups;
+    freeFrags.reserve(recycleBatchSize_);
+    freeGroups.reserve(recycleBatchSize_);
+    bool notified{false};
+
+    currFile_ = files_.begin();
+    fp_ = currFile_->fp;
+    hdr_ = currFile_->header;
+
+    // A quarter of the memory for the records waiting for their mates, the
+    // rest for the reads waiting for their other alignments
+    uint64_t maxBytes = collateBytes_();
+    salmon::collate::MatePairer<bam_seq_t, BAMRecordTraits> pairer(
+        std::max(uint64_t{1024}, maxBytes / 4 / recordBytes_));
+    salmon::collate::ReadGrouper<bam_seq_t, BAMRecordTraits> grouper(
+        maxBytes - maxBytes / 4);
+    if (!collateSpillPath_.empty() and !grouper.spillTo(collateSpillPath_)) {
+        logger_->warn("Couldn't open {} to spill the reads being collated "
+                      "to; they'll all be kept in memory",
+                      collateSpillPath_);
+    }
+    auto& account = salmon::memory::budget().account("alignment_collation");
+
+    // A read, with all of its alignments, goes out as a group
+    auto emit = [&](std::vector<CollatedFrag>& frags) -> void {
+        ++numMappedReads_;
+        bool unique{true};
+        for (auto& f : frags) {
+            unique = unique and (bam_ref(f.first) == bam_ref(frags[0].first));
+        }
+        if (unique) { ++numUniquelyMappedReads_; }
+        if (onlyProcessAmbiguousAlignments and unique) {
+            for (auto& f : frags) {
+                recycleRecord_(f.first);
+                recycleRecord_(f.second);
+            }
+            return;
+        }
+        AlignmentGroup<FragT*>* alngroup = takeGroup_(freeGroups);
+        for (auto& f : frags) {
+            FragT* frag = takeFrag_(freeFrags, numFragAlloc);
+            placeRecords_(*frag, f);
+            recycleRecord_(f.first);
+            recycleRecord_(f.second);
+            alngroup->addAlignment(frag);
+        }
+        alnGroupQueue_.enqueue(alngroup);
+    };
+
+    auto addFrag = [&](bam_seq_t* r1, bam_seq_t* r2) -> void {
+        ++totalAlignments_;
+        CollatedFrag f;
+        f.first = r1;
+        f.second = r2;
+        grouper.add(bam_name(r1), collatedNameLen_(r1), numHitsOfRecord_(r1),
+                    f, emit);
+    };
+
+    // Unaligned reads are counted, and handed to the filter
+    FragT lent;
+    auto unaligned = [&](bam_seq_t* r1, bam_seq_t* r2) -> void {
+        ++numUnaligned_;
+        if (filt != nullptr) {
+            CollatedFrag f;
+            f.first = r1;
+            f.second = r2;
+            // lent the records; the second swap gives lent its own
+            // buffers back (if perhaps as read2 and read1)
+            placeRecords_(lent, f);
+            filt->processFrag(&lent);
+            placeRecords_(lent, f);
+        }
+        recycleRecord_(r1);
+        recycleRecord_(r2);
+    };
+
+    auto mates = salmon::collate::makeMateOut(
+        [&](bam_seq_t* r1, bam_seq_t* r2) -> void {
+            if (bam_flag(r1) & BAM_FUNMAP) {
+                unaligned(r1, r2);
+            } else {
+                addFrag(r1, r2);
+            }
+        },
+        // (an unmapped record without its mate isn't handed to the filter,
+        // as when the names of adjacent records don't match)
+        [&](bam_seq_t* r) -> void {
+            if (bam_flag(r) & BAM_FUNMAP) {
+                ++numUnaligned_;
+                recycleRecord_(r);
+            } else {
+                addFrag(r, nullptr);
+            }
+        });
+
+    bam_seq_t* rec = takeRecord_();
+    size_t n{0};
+    while (true) {
+        if (!nextRecord_(&rec)) {
+            // The mates in this file can't be in the next
+            pairer.flush(mates);
+            scram_close(currFile_->fp);
+            currFile_->fp = nullptr;
+            currFile_++;
+            if (currFile_ == files_.end()) { break; }
+            fp_ = openFile_(*currFile_);
+            hdr_ = currFile_->header;
+            continue;
+        }
+
+        if (std::is_same<FragT, ReadPair>::value) {
+            switch (getPairedAlignmentType_(rec)) {
+                case AlignmentType::UnmappedOrphan:
+                    unaligned(rec, nullptr);
+                    break;
+                case AlignmentType::MappedOrphan:
+                    addFrag(rec, nullptr);
+                    break;
+                case AlignmentType::MappedConcordantPair:
+                case AlignmentType::UnmappedPair:
+                    pairer.add(rec, bam_name(rec), collatedNameLen_(rec),
+                               mates);
+                    break;
+                default:
+                    // discordant pairs are skipped (see getFrag_)
+                    recycleRecord_(rec);
+                    break;
+            }
+        } else {
+            if (!(bam_flag(rec) & BAM_FDUP) and
+                !(bam_flag(rec) & BAM_FQCFAIL) and
+                !(bam_flag(rec) & BAM_FUNMAP) and bam_ref(rec) >= 0) {
+                addFrag(rec, nullptr);
+            } else {
+                ++totalAlignments_;
+                unaligned(rec, nullptr);
+            }
+        }
+        rec = takeRecord_();
+
+        if (!notified and exhaustedAlnGroupPool_) {
+            logger_->info("\n\nThe alignment group queue pool has been "
+                          "exhausted.  {} extra fragments were allocated on "
+                          "the heap to saturate the pool.  No new fragments "
+                          "will be allocated\n\n", numFragAlloc);
+            notified = true;
+        }
+        if ((++n & 0xffff) == 0) {
+            account.set(pairer.pendingBytes() + grouper.pendingBytes());
+        }
+    }
+    recycleRecord_(rec);
+
+    // The reads still waiting (those without an NH tag, or spilled)
+    if (!grouper.finish(emit)) {
+        logger_->error("Couldn't read all of the reads spilled to {} back; "
+                       "the alignments of some reads are missing",
+                       collateSpillPath_);
+    }
+    account.set(0);
+    logger_->info("Collated the alignments of {} reads by name; {} records "
+                  "of pairs didn't find their mate, and the reads waiting "
+                  "took at most {:.2f} GB ({} spills)",
+                  grouper.numReads(), pairer.numUnpaired(),
+                  grouper.peakBytes() / static_cast<double>(1 << 30),
+                  grouper.numSpills());
+
+    // Return what's left of the free lists to the pools
+    fragmentQueue_.enqueue_bulk(freeFrags.begin(), freeFrags.size());
+    alnGroupPool_.enqueue_bulk(freeGroups.begin(), freeGroups.size());
+
+    if (numFilteredRecords_ > 0) {
+        logger_->info("Dropped {} supplementary alignment records",
+                      numFilteredRecords_);
+    }
+    currFile_ = files_.end();
+    fp_ = nullptr;
+    hdr_ = nullptr;
+    doneParsing_.store(true, std::memory_order_release);
+}
+
 ///////// Proper BAM parsing graveyard
 
 /* 
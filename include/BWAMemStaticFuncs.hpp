@@ -35,57 +35,30 @@ static void mem_collect_intv(const SalmonOpts& sopt, const mem_opt_t* opt,
                              SalmonIndex* sidx, int len, const uint8_t* seq,
                              smem_aux_t* a) {
   const bwt_t* bwt = sidx->bwaIndex()->bwt;
+  const bwautils::PrefixIntervalTable& prefixes = sidx->prefixIntervals();
   int i, k, x = 0, old_n;
   int start_width = (opt->flag & MEM_F_SELF_OVLP) ? 2 : 1;
   int split_len = (int)(opt->min_seed_len * opt->split_factor + .499);
   a->mem.n = 0;
 
+  // The intervals of the auxiliary index's k-mers, if it has one
+  const KmerIntervalMap* kmers =
+      sidx->hasAuxKmerIndex() ? &sidx->auxIndex() : nullptr;
+
   // first pass: find all SMEMs
-  if (sidx->hasAuxKmerIndex()) {
-    KmerIntervalMap& auxIdx = sidx->auxIndex();
-    uint32_t klen = auxIdx.k();
-    while (x < len) {
-      if (seq[x] < 4) {
-        // Make sure there are at least k bases left
-        if (len - x < klen) {
-          x = len;
-          continue;
-        }
-        // search for this key in the auxiliary index
-        KmerKey kmer(const_cast<uint8_t*>(&(seq[x])), klen);
-        auto it = auxIdx.find(kmer);
-        // if we can't find it, move to the next key
-        if (it == auxIdx.end()) {
-          ++x;
-          continue;
-        }
-        // otherwise, start the search using the initial interval @it->second
-        // from the hash
-        int xb = x;
-        x = bwautils::bwt_smem1_with_kmer(bwt, len, seq, x, start_width,
-                                          it->second, &a->mem1, a->tmpv);
-        for (i = 0; i < a->mem1.n; ++i) {
-          bwtintv_t* p = &a->mem1.a[i];
-          int slen = (uint32_t)p->info - (p->info >> 32); // seed length
-          if (slen >= opt->min_seed_len)
-            kv_push(bwtintv_t, a->mem, *p);
-        }
-      } else
-        ++x;
-    }
-  } else {
-    while (x < len) {
-      if (seq[x] < 4) {
-        x = bwt_smem1(bwt, len, seq, x, start_width, &a->mem1, a->tmpv);
-        for (i = 0; i < a->mem1.n; ++i) {
-          bwtintv_t* p = &a->mem1.a[i];
-          int slen = (uint32_t)p->info - (p->info >> 32); // seed length
-          if (slen >= opt->min_seed_len)
-            kv_push(bwtintv_t, a->mem, *p);
-        }
-      } else
-        ++x;
-    }
+  while (x < len) {
+    if (seq[x] < 4) {
+      x = bwautils::bwt_smem1_with_prefixes(bwt, prefixes, len, seq, x,
+                                            start_width, &a->mem1, a->tmpv,
+                                            kmers);
+      for (i = 0; i < a->mem1.n; ++i) {
+        bwtintv_t* p = &a->mem1.a[i];
+        int slen = (uint32_t)p->info - (p->info >> 32); // seed length
+        if (slen >= opt->min_seed_len)
+          kv_push(bwtintv_t, a->mem, *p);
+      }
+    } else
+      ++x;
   }
 
   // For sensitive / extra-sensitive mode only
@@ -99,8 +72,9 @@ static void mem_collect_intv(const SalmonOpts& sopt, const mem_opt_t* opt,
         continue;
 
       // int idx = (start + end) >> 1;
-      bwt_smem1(bwt, len, seq, (start + end) >> 1, p->x[2] + 1, &a->mem1,
-                a->tmpv);
+      bwautils::bwt_smem1_with_prefixes(bwt, prefixes, len, seq,
+                                        (start + end) >> 1, p->x[2] + 1,
+                                        &a->mem1, a->tmpv, kmers);
       for (i = 0; i < a->mem1.n; ++i)
         if ((uint32_t)a->mem1.a[i].info - (a->mem1.a[i].info >> 32) >=
             opt->min_seed_len)
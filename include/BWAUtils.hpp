@@ -8,8 +8,45 @@ extern "C" {
 #include "utils.h"
 }
 
+#include <cstdint>
+#include <vector>
+
+#include "KmerIntervalMap.hpp"
+
 namespace bwautils {
 
+/**
+ * The forward-extension interval of every string of length 1 to k.  These
+ * are the first steps of every SMEM search, and (as the intervals are
+ * still wide) the most expensive ones, each touching two distant blocks of
+ * the occurrence array; with the table they become a single lookup.
+ */
+class PrefixIntervalTable {
+public:
+  // Fill the table for all strings of length <= k (a k of 10 takes ~33MB)
+  void build(const bwt_t* bwt, uint32_t k);
+
+  uint32_t k() const { return k_; }
+
+  /**
+   * The interval (x[0], x[1], x[2]) of the string of length len
+   * (1 <= len <= k()) whose bases, 2 bits each and the first base in the
+   * highest bits, are code.
+   */
+  const uint64_t* interval(uint32_t len, uint64_t code) const {
+    return &intervals_[3 * (offset_(len) + code)];
+  }
+
+private:
+  // The number of strings shorter than len (and at least 1 long)
+  static uint64_t offset_(uint32_t len) {
+    return ((uint64_t(1) << (2 * len)) - 4) / 3;
+  }
+
+  uint32_t k_{0};
+  std::vector<uint64_t> intervals_;
+};
+
 // Function modified from bwt_smem1a:
 // https://github.com/lh3/bwa/blob/eb428d7d31ced059ad39af2701a22ebe6d175657/bwt.c#L289
 /**
@@ -24,17 +61,19 @@ bool getIntervalForKmer(const bwt_t* bwt, // the bwt index
                         const uint8_t* q, // query
                         bwtintv_t& resInterval);
 
-// NOTE: $max_intv is not currently used in BWA-MEM
-// NOTE: Modified from the original functions to take an initial interval for
-// the search query
-int bwt_smem1a_with_kmer(const bwt_t* bwt, int len, const uint8_t* q, int x,
-                         int min_intv, uint64_t max_intv,
-                         bwtintv_t initial_interval, bwtintv_v* mem,
-                         bwtintv_v* tmpvec[2]);
-
-int bwt_smem1_with_kmer(const bwt_t* bwt, int len, const uint8_t* q, int x,
-                        int min_intv, bwtintv_t initial_interval,
-                        bwtintv_v* mem, bwtintv_v* tmpvec[2]);
+/**
+ * Equivalent to BWA's bwt_smem1, but takes the first (up to
+ * prefixes.k()) forward-extension steps from @prefixes, and prefetches the
+ * occurrence blocks of the next interval during the backward search.  If
+ * @kmers is given and has the k-mer at @x, the forward search jumps to the
+ * end of the k-mer as soon as its interval is as narrow as the k-mer's
+ * (no interval changes size in between, so the result is the same).
+ */
+int bwt_smem1_with_prefixes(const bwt_t* bwt,
+                            const PrefixIntervalTable& prefixes, int len,
+                            const uint8_t* q, int x, int min_intv,
+                            bwtintv_v* mem, bwtintv_v* tmpvec[2],
+                            const KmerIntervalMap* kmers = nullptr);
 } // namespace bwautils
 
 #endif // __BWA_UTILS_HPP__
@@ -2,13 +2,16 @@
 #define __BIAS_PARAMS__
 
 #include "DistributionUtils.hpp"
+#include "EffectiveLengthStats.hpp"
 #include "GCFragModel.hpp"
-#include "ReadKmerDist.hpp"
 #include "SBModel.hpp"
 #include "SalmonMath.hpp"
 #include "SimplePosBias.hpp"
 #include <vector>
 
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+
 struct BiasParams {
   double massFwd{salmon::math::LOG_0};
   double massRC{salmon::math::LOG_0};
@@ -26,19 +29,73 @@ struct BiasParams {
   // salmon::math::LOG_0);
   GCFragModel observedGCMass;
 
-  ReadKmerDist<8, uint32_t> seqBiasFW;
-  ReadKmerDist<8, uint32_t> seqBiasRC;
-
   /**
    * Sequence-specific bias models
    **/
   SBModel seqBiasModelFW;
   SBModel seqBiasModelRC;
 
+  /**
+   * Observed effective lengths (of the transcripts paired-end fragments
+   * were assigned to)
+   **/
+  EffectiveLengthStats observedEffLengths;
+
   BiasParams(size_t numCondBins = 3, size_t numGCBins = 101,
              bool seqBiasPseudocount = false)
-      : seqBiasFW(seqBiasPseudocount), seqBiasRC(seqBiasPseudocount),
-        posBiasFW(5), posBiasRC(5), observedGCMass(numCondBins, numGCBins) {}
+      : posBiasFW(5), posBiasRC(5), observedGCMass(numCondBins, numGCBins) {}
+
+  /**
+   * Add the observations of other to these.
+   */
+  void combine(const BiasParams& other) {
+    massFwd = salmon::math::logAdd(massFwd, other.massFwd);
+    massRC = salmon::math::logAdd(massRC, other.massRC);
+    for (size_t i = 0; i < posBiasFW.size(); ++i) {
+      posBiasFW[i].combine(other.posBiasFW[i]);
+      posBiasRC[i].combine(other.posBiasRC[i]);
+    }
+    observedGCMass.combineCounts(other.observedGCMass);
+    seqBiasModelFW.combineCounts(other.seqBiasModelFW);
+    seqBiasModelRC.combineCounts(other.seqBiasModelRC);
+    observedEffLengths.merge(other.observedEffLengths);
+  }
+
+  /**
+   * Discard all observations, so that the parameters can be reused for
+   * another round without being reallocated.
+   */
+  void reset() {
+    massFwd = salmon::math::LOG_0;
+    massRC = salmon::math::LOG_0;
+    for (size_t i = 0; i < posBiasFW.size(); ++i) {
+      posBiasFW[i].reset();
+      posBiasRC[i].reset();
+    }
+    observedGCMass.reset(observedGCMass.distributionSpace());
+    seqBiasModelFW.counts().setZero();
+    seqBiasModelRC.counts().setZero();
+    observedEffLengths.reset();
+  }
 };
 
+/**
+ * Combine the per-thread bias parameters into the first of them, pairwise
+ * and in parallel (in log2(params.size()) rounds), rather than one after
+ * another onto the global models.
+ */
+inline BiasParams& reduceBiasParams(std::vector<BiasParams>& params) {
+  for (size_t stride = 1; stride < params.size(); stride *= 2) {
+    size_t numPairs = (params.size() - stride + (2 * stride - 1)) / (2 * stride);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, numPairs),
+                      [&params, stride](const tbb::blocked_range<size_t>& r) {
+                        for (size_t p = r.begin(); p != r.end(); ++p) {
+                          size_t i = 2 * stride * p;
+                          params[i].combine(params[i + stride]);
+                        }
+                      });
+  }
+  return params.front();
+}
+
 #endif //__GC_BIAS_PARAMS__
@@ -0,0 +1,76 @@
+#ifndef BYTE_BUFFERS_HPP
+#define BYTE_BUFFERS_HPP
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include <zlib.h>
+
+/**
+ * The little-endian integers and fast-deflated blocks that salmon's binary
+ * files (the mapping files, the mapping cache, the equivalence class and
+ * columnar sample files) are made of, written (and read) the same way by
+ * each of them.
+ */
+namespace salmon {
+namespace bytes {
+
+inline void putU32(std::vector<char>& buf, uint32_t v) {
+  for (size_t i = 0; i < 4; ++i) {
+    buf.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+  }
+}
+
+inline void putU64(std::vector<char>& buf, uint64_t v) {
+  for (size_t i = 0; i < 8; ++i) {
+    buf.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+  }
+}
+
+inline uint32_t getU32(const char* p) {
+  uint32_t v{0};
+  for (size_t i = 0; i < 4; ++i) {
+    v |= static_cast<uint32_t>(static_cast<uint8_t>(p[i])) << (8 * i);
+  }
+  return v;
+}
+
+inline void writeU32(std::ostream& os, uint32_t v) {
+  char b[4];
+  for (size_t i = 0; i < 4; ++i) {
+    b[i] = static_cast<char>((v >> (8 * i)) & 0xff);
+  }
+  os.write(b, 4);
+}
+
+inline void writeU64(std::ostream& os, uint64_t v) {
+  char b[8];
+  for (size_t i = 0; i < 8; ++i) {
+    b[i] = static_cast<char>((v >> (8 * i)) & 0xff);
+  }
+  os.write(b, 8);
+}
+
+/**
+ * Append src, deflated at the fastest level, to dest.  Deflate dominates the
+ * cost of writing these files, and the fastest level compresses their
+ * varints nearly as well as the default one.
+ */
+inline bool compressAppend(const std::vector<char>& src,
+                           std::vector<char>& dest) {
+  uLong srcLen = src.size();
+  uLongf destLen = compressBound(srcLen);
+  size_t start = dest.size();
+  dest.resize(start + destLen);
+  int ret = compress2(reinterpret_cast<Bytef*>(dest.data() + start), &destLen,
+                      reinterpret_cast<const Bytef*>(src.data()), srcLen,
+                      Z_BEST_SPEED);
+  dest.resize(start + destLen);
+  return ret == Z_OK;
+}
+
+} // namespace bytes
+} // namespace salmon
+
+#endif // BYTE_BUFFERS_HPP
@@ -0,0 +1,94 @@
+#ifndef __CPU_DISPATCH_HPP__
+#define __CPU_DISPATCH_HPP__
+
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include "cereal/cereal.hpp"
+#include "cereal/types/string.hpp"
+
+/**
+ * Runtime selection among the instruction-set specific variants of the hot
+ * kernels, so that one portable binary runs the best variant that the CPU it
+ * finds itself on supports.
+ *
+ * A kernel registers a chooser (see Registration), which picks one of the
+ * kernel's variants with choose(); the choice is recorded under the kernel's
+ * name and written to meta_info.json.  A kernel whose variant is fixed when
+ * it's compiled (e.g. SSE2, which every x86-64 CPU has) just records it.
+ * The choosers run when the library is loaded, so the kernels work before
+ * (and without) init(); init(), called at the start of main, caps the
+ * instruction sets at $SALMON_MAX_ISA (if it's set, e.g. to compare the
+ * variants on one machine) and has every kernel choose again.
+ */
+namespace salmon {
+namespace cpu {
+
+// Ordered from least to most capable, within each architecture
+enum class ISA : uint8_t { scalar = 0, sse2, sse42, avx2, avx512, neon };
+
+// The name of isa ("scalar", "sse2", "sse4.2", "avx2", "avx512" or "neon")
+const char* isaName(ISA isa);
+
+// True if the CPU supports isa, and it isn't above the cap of init()
+bool supports(ISA isa);
+
+// Record that kernel runs its isa variant
+void record(const char* kernel, ISA isa);
+
+template <typename FnT> struct Variant {
+  ISA isa;
+  FnT fn;
+};
+
+/**
+ * The first of a kernel's variants (listed best first, ending with one that
+ * is always supported) that supports() allows; the choice is recorded.
+ */
+template <typename FnT>
+FnT choose(const char* kernel, std::initializer_list<Variant<FnT>> variants) {
+  const Variant<FnT>* chosen = variants.end() - 1;
+  for (auto& v : variants) {
+    if (supports(v.isa)) {
+      chosen = &v;
+      break;
+    }
+  }
+  record(kernel, chosen->isa);
+  return chosen->fn;
+}
+
+/**
+ * Registers a kernel's chooser, and runs it; a namespace-scope object of the
+ * kernel's translation unit.
+ */
+class Registration {
+public:
+  explicit Registration(void (*chooser)());
+};
+
+/**
+ * Apply the cap of $SALMON_MAX_ISA, and have every registered kernel choose
+ * again.  Must be called before any threads are started.
+ */
+void init();
+
+// The variant a kernel runs, as written to meta_info.json
+struct KernelVariant {
+  std::string kernel;
+  std::string variant;
+
+  template <typename Archive> void serialize(Archive& ar) {
+    ar(cereal::make_nvp("kernel", kernel),
+       cereal::make_nvp("variant", variant));
+  }
+};
+
+// The variants of all of the kernels, by kernel name
+std::vector<KernelVariant> chosenVariants();
+} // namespace cpu
+} // namespace salmon
+
+#endif // __CPU_DISPATCH_HPP__
@@ -0,0 +1,124 @@
+#ifndef CELL_EQUIVALENCE_CLASSES_HPP
+#define CELL_EQUIVALENCE_CLASSES_HPP
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/functional/hash.hpp>
+
+#include "cuckoohash_map.hh"
+
+/**
+ * The equivalence classes of a droplet single-cell library, kept per cell
+ * (see --cellBarcodeLength).  Cell barcodes and equivalence class labels are
+ * each given a dense id the first time they're seen, and a mapped read is
+ * then just a (cell, equivalence class, UMI) record, which its mapping
+ * thread appends to a buffer of its own (Local) --- no lock is taken per
+ * read.  finish() sorts the records, so that deduplicating the UMIs of a
+ * (cell, class) pair is a single pass, and the count of a class in a cell is
+ * its number of distinct UMIs.
+ */
+class CellEquivalenceClasses {
+public:
+  struct Record {
+    uint32_t cell;
+    uint32_t eqID;
+    uint64_t umi;
+  };
+
+  // The records of one mapping thread
+  class Local {
+  public:
+    inline void add(uint32_t cell, uint32_t eqID, uint64_t umi) {
+      records_.push_back(Record{cell, eqID, umi});
+    }
+    size_t size() const { return records_.size(); }
+
+  private:
+    std::vector<Record> records_;
+    friend class CellEquivalenceClasses;
+  };
+
+  // A class of a cell, and its number of distinct UMIs
+  struct CellClass {
+    uint32_t eqID;
+    uint32_t numUMIs;
+  };
+
+  CellEquivalenceClasses() = default;
+
+  // The 2-bit encoding of a UMI of up to 32 bases; false if it has an N
+  static bool encodeUMI(const char* umi, size_t len, uint64_t& code);
+
+  // The ids of a cell barcode and of an equivalence class label (sorted
+  // transcript ids); both are safe to call from every mapping thread.
+  uint32_t cellID(const char* barcode, size_t len);
+  uint32_t eqClassID(const std::vector<uint32_t>& txps);
+
+  // Hand the records of a (finished) mapping thread over
+  void merge(Local& local);
+
+  // Deduplicate the UMIs; the per-cell classes are only valid after this
+  void finish();
+
+  size_t numCells() const { return barcodes_.size(); }
+  size_t numEqClasses() const { return labels_.size(); }
+  size_t numRecords() const { return numRecords_; }
+  size_t numCellClasses() const { return cellClasses_.size(); }
+  const std::string& barcode(uint32_t cell) const { return barcodes_[cell]; }
+  const std::vector<uint32_t>& label(uint32_t eqID) const {
+    return labels_[eqID];
+  }
+
+  // The classes of cell, ordered by id
+  std::pair<const CellClass*, const CellClass*> cellClasses(uint32_t cell) const {
+    return {cellClasses_.data() + cellOffsets_[cell],
+            cellClasses_.data() + cellOffsets_[cell + 1]};
+  }
+
+  // The number of distinct UMIs of cell, over all of its classes
+  uint64_t cellUMIs(uint32_t cell) const;
+
+  /**
+   * Estimate the UMI counts of the transcripts of every cell with at least
+   * minUMIs UMIs by an EM over that cell's classes (the cells are processed
+   * in parallel); the result for a cell is its (transcript, count) pairs
+   * with a non-zero count, and is empty for the cells that were skipped.
+   */
+  std::vector<std::vector<std::pair<uint32_t, double>>>
+  quantify(uint64_t minUMIs, double relDiffTolerance, uint32_t maxIter) const;
+
+  /**
+   * Write the estimates as a (cell x transcript) sparse matrix, in Matrix
+   * Market format (quants_mat.mtx), with the barcodes of its rows
+   * (quants_mat_rows.txt) and the names of its columns (quants_mat_cols.txt),
+   * into outDir; only the cells with estimates are written.
+   */
+  bool writeMatrix(
+      const boost::filesystem::path& outDir,
+      const std::vector<std::pair<uint32_t, double>>* begin,
+      const std::vector<std::pair<uint32_t, double>>* end,
+      const std::vector<std::string>& txpNames) const;
+
+private:
+  cuckoohash_map<std::string, uint32_t> cellIDs_;
+  cuckoohash_map<std::vector<uint32_t>, uint32_t,
+                 boost::hash<std::vector<uint32_t>>>
+      eqIDs_;
+  std::mutex idMut_;
+  std::vector<std::string> barcodes_;
+  std::vector<std::vector<uint32_t>> labels_;
+
+  std::mutex mergeMut_;
+  std::vector<Record> records_;
+  size_t numRecords_{0};
+
+  std::vector<CellClass> cellClasses_;
+  std::vector<uint64_t> cellOffsets_;
+};
+
+#endif // CELL_EQUIVALENCE_CLASSES_HPP
@@ -1,161 +1,162 @@
 #ifndef __CLUSTER_FOREST_HPP__
 #define __CLUSTER_FOREST_HPP__
 
-#include <boost/pending/disjoint_sets.hpp>
-
-#include "SalmonSpinLock.hpp"
 #include "Transcript.hpp"
 #include "TranscriptCluster.hpp"
 
-#include <mutex>
-#include <unordered_set>
+#include "tbb/atomic.h"
+
+#include <algorithm>
+#include <atomic>
 #include <vector>
 
-/** A forest of transcript clusters */
+/**
+ * A forest of transcript clusters.
+ *
+ * The clusters are kept in a concurrent (lock-free) union-find over an atomic
+ * parent array: a merge links the root with the larger id under the one with
+ * the smaller id, with a single compare-and-swap (retried if another thread
+ * got there first), and finds halve the paths they walk.  Once a cluster's
+ * paths are flat, merging transcripts that are already in it only reads.
+ *
+ * The counts and masses are accumulated (atomically) per transcript, and the
+ * clusters' members and totals are only put together when getClusters() is
+ * called, which mustn't run concurrently with merges or updates.
+ */
 class ClusterForest {
 public:
   ClusterForest(size_t numTranscripts, std::vector<Transcript>& refs)
-      : rank_(std::vector<size_t>(numTranscripts, 0)),
-        parent_(std::vector<size_t>(numTranscripts, 0)),
-        disjointSets_(&rank_[0], &parent_[0]),
+      : parent_(numTranscripts), counts_(numTranscripts),
+        logMasses_(numTranscripts),
         clusters_(std::vector<TranscriptCluster>(numTranscripts)) {
     // Initially make a unique set for each transcript
     for (size_t tnum = 0; tnum < numTranscripts; ++tnum) {
-      disjointSets_.make_set(tnum);
-      clusters_[tnum].members_.push_front(tnum);
-      clusters_[tnum].addMass(refs[tnum].mass());
+      parent_[tnum].store(static_cast<uint32_t>(tnum));
+      counts_[tnum] = 0.0;
+      logMasses_[tnum] = refs[tnum].mass();
     }
   }
 
   template <typename FragT>
   void mergeClusters(typename std::vector<FragT>::iterator start,
                      typename std::vector<FragT>::iterator finish) {
-// Use a lock_guard to ensure this is a locked (and exception-safe) operation
-#if defined __APPLE__
-    spin_lock::scoped_lock sl(clusterMutex_);
-#else
-    std::lock_guard<std::mutex> lock(clusterMutex_);
-#endif
-    size_t firstCluster, otherCluster;
     auto firstTranscriptID = start->transcriptID();
     ++start;
-
     for (auto it = start; it != finish; ++it) {
-      firstCluster = disjointSets_.find_set(firstTranscriptID);
-      otherCluster = disjointSets_.find_set(it->transcriptID());
-      if (otherCluster != firstCluster) {
-        disjointSets_.link(firstCluster, otherCluster);
-        auto parentClust = disjointSets_.find_set(it->transcriptID());
-        auto childClust =
-            (parentClust == firstCluster) ? otherCluster : firstCluster;
-        if (parentClust == firstCluster or parentClust == otherCluster) {
-          clusters_[parentClust].merge(clusters_[childClust]);
-          clusters_[childClust].deactivate();
-        } else {
-          std::cerr << "DANGER\n";
-        }
-      }
+      union_(firstTranscriptID, it->transcriptID());
     }
   }
 
   template <typename FragT>
   void mergeClusters(typename std::vector<FragT*>::iterator start,
                      typename std::vector<FragT*>::iterator finish) {
-// Use a lock_guard to ensure this is a locked (and exception-safe) operation
-#if defined __APPLE__
-    spin_lock::scoped_lock sl(clusterMutex_);
-#else
-    std::lock_guard<std::mutex> lock(clusterMutex_);
-#endif
-
     auto firstTranscriptID = (*start)->transcriptID();
-    decltype(firstTranscriptID) firstCluster, otherCluster;
     ++start;
-
     for (auto it = start; it != finish; ++it) {
-      firstCluster = disjointSets_.find_set(firstTranscriptID);
-      otherCluster = disjointSets_.find_set((*it)->transcriptID());
-      if (otherCluster != firstCluster) {
-        disjointSets_.link(firstCluster, otherCluster);
-        auto parentClust = disjointSets_.find_set((*it)->transcriptID());
-        auto childClust =
-            (parentClust == firstCluster) ? otherCluster : firstCluster;
-        if (parentClust == firstCluster or parentClust == otherCluster) {
-          clusters_[parentClust].merge(clusters_[childClust]);
-          clusters_[childClust].deactivate();
-        } else {
-          std::cerr << "DANGER\n";
-        }
-      }
+      union_(firstTranscriptID, (*it)->transcriptID());
     }
   }
 
-  /*
-  void mergeClusters(AlignmentBatch<ReadPair>::iterator start,
-  AlignmentBatch<ReadPair>::iterator finish) {
-      // Use a lock_guard to ensure this is a locked (and exception-safe)
-  operation std::lock_guard<std::mutex> lock(clusterMutex_); size_t
-  firstCluster, otherCluster; auto firstTranscriptID = start->read1->core.tid;
-      ++start;
-
-      for (auto it = start; it != finish; ++it) {
-          firstCluster = disjointSets_.find_set(firstTranscriptID);
-          otherCluster = disjointSets_.find_set(it->read1->core.tid);
-          if (otherCluster != firstCluster)  {
-              disjointSets_.link(firstCluster, otherCluster);
-              auto parentClust = disjointSets_.find_set(it->read1->core.tid);
-              auto childClust = (parentClust == firstCluster)  ? otherCluster :
-  firstCluster; if (parentClust == firstCluster or parentClust == otherCluster)
-  { clusters_[parentClust].merge(clusters_[childClust]);
-                  clusters_[childClust].deactivate();
-              } else { std::cerr << "DANGER\n"; }
-          }
-      }
-  }
-*/
   void updateCluster(size_t memberTranscript, size_t newCount,
                      double logNewMass, bool updateCount) {
-// Use a lock_guard to ensure this is a locked (and exception-safe) operation
-#if defined __APPLE__
-    spin_lock::scoped_lock sl(clusterMutex_);
-#else
-    std::lock_guard<std::mutex> lock(clusterMutex_);
-#endif
-    auto clusterID = disjointSets_.find_set(memberTranscript);
-    auto& cluster = clusters_[clusterID];
     if (updateCount) {
-      cluster.incrementCount(newCount);
+      salmon::utils::incLoop(counts_[memberTranscript], newCount);
     }
-    cluster.addMass(logNewMass);
+    salmon::utils::incLoopLog(logMasses_[memberTranscript], logNewMass);
   }
 
   std::vector<TranscriptCluster*> getClusters() {
+    size_t numTranscripts = clusters_.size();
+    std::vector<uint32_t> roots(numTranscripts);
+    for (size_t i = 0; i < numTranscripts; ++i) {
+      roots[i] = find_(static_cast<uint32_t>(i));
+      auto& cluster = clusters_[i];
+      cluster.members_.clear();
+      cluster.count_ = 0.0;
+      cluster.logMass_ = salmon::math::LOG_0;
+      cluster.active_ = (roots[i] == i);
+    }
+
+    // A root is the smallest id in its cluster, so the clusters come out in
+    // the order of their first members
     std::vector<TranscriptCluster*> clusters;
-    std::unordered_set<size_t> observedReps;
-    for (size_t i = 0; i < clusters_.size(); ++i) {
-      auto rep = disjointSets_.find_set(i);
-      if (observedReps.find(rep) == observedReps.end()) {
-        if (!clusters_[rep].isActive()) {
-          std::cerr << "returning a non-active cluster!\n";
-          std::exit(1);
-        }
-        clusters.push_back(&clusters_[rep]);
-        observedReps.insert(rep);
+    for (size_t i = 0; i < numTranscripts; ++i) {
+      auto& cluster = clusters_[roots[i]];
+      if (roots[i] == i) {
+        clusters.push_back(&cluster);
       }
+      cluster.members_.push_back(i);
+      cluster.incrementCount(counts_[i]);
+      cluster.addMass(logMasses_[i]);
     }
     return clusters;
   }
 
+  // The state of the forest (for a checkpoint), and its inverse
+  void dumpState(std::vector<uint32_t>& parents, std::vector<double>& counts,
+                 std::vector<double>& logMasses) const {
+    size_t n = parent_.size();
+    parents.resize(n);
+    counts.resize(n);
+    logMasses.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+      parents[i] = parent_[i].load();
+      counts[i] = counts_[i];
+      logMasses[i] = logMasses_[i];
+    }
+  }
+
+  void loadState(const std::vector<uint32_t>& parents,
+                 const std::vector<double>& counts,
+                 const std::vector<double>& logMasses) {
+    for (size_t i = 0; i < parent_.size(); ++i) {
+      parent_[i].store(parents[i]);
+      counts_[i] = counts[i];
+      logMasses_[i] = logMasses[i];
+    }
+  }
+
 private:
-  std::vector<size_t> rank_;
-  std::vector<size_t> parent_;
-  boost::disjoint_sets<size_t*, size_t*> disjointSets_;
+  // The root of x's cluster; points x at its grandparent at each step
+  uint32_t find_(uint32_t x) {
+    while (true) {
+      uint32_t p = parent_[x].load();
+      if (p == x) {
+        return x;
+      }
+      uint32_t gp = parent_[p].load();
+      // Only write if x isn't already a child of a root; if another thread
+      // changed x's parent in the meantime, the new parent is as good.
+      if (gp != p) {
+        parent_[x].compare_exchange_weak(p, gp);
+      }
+      x = gp;
+    }
+  }
+
+  void union_(uint32_t a, uint32_t b) {
+    while (true) {
+      a = find_(a);
+      b = find_(b);
+      if (a == b) {
+        return;
+      }
+      if (a < b) {
+        std::swap(a, b);
+      }
+      // a is still a root (unless another thread just linked it)
+      uint32_t expected = a;
+      if (parent_[a].compare_exchange_strong(expected, b)) {
+        return;
+      }
+    }
+  }
+
+  // parent_[i] <= i, with equality only for the roots
+  std::vector<std::atomic<uint32_t>> parent_;
+  std::vector<tbb::atomic<double>> counts_;
+  std::vector<tbb::atomic<double>> logMasses_;
   std::vector<TranscriptCluster> clusters_;
-#if defined __APPLE__
-  spin_lock clusterMutex_;
-#else
-  std::mutex clusterMutex_;
-#endif
 };
 
 #endif // __CLUSTER_FOREST_HPP__
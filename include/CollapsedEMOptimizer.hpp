@@ -34,6 +34,15 @@ public:
       ExpT& readExp, SalmonOpts& sopt,
       std::function<bool(const std::vector<double>&)>& writeBootstrap,
       double relDiffTolerance, uint32_t maxIter);
+
+  /**
+   * Approximate the variance of each transcript's estimated count, from the
+   * equivalence classes and the estimates left by optimize(), without
+   * resampling (see CountVariance.hpp).
+   */
+  template <typename ExpT>
+  bool approximateVariances(ExpT& readExp, SalmonOpts& sopt,
+                            std::vector<double>& variances);
 };
 
 #endif // COLLAPSED_EM_OPTIMIZER_HPP
@@ -0,0 +1,88 @@
+#ifndef COLUMNAR_SAMPLE_WRITER_HPP
+#define COLUMNAR_SAMPLE_WRITER_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "SampleEncoding.hpp"
+
+/**
+ * Writes bootstrap / Gibbs samples in a columnar layout, so that all of the
+ * samples of a single transcript can be read without decompressing the rest
+ * of the file.
+ *
+ * The samples arrive one (full) sample at a time.  They are buffered in
+ * memory, a group of (up to 64MB of) samples at a time; once a group is
+ * full, it is transposed and written out as compressed blocks of
+ * transcripts, so the file is written sequentially, as the samples are
+ * drawn, and never re-read.  If the number of samples expected is given and
+ * they fit in a single group, each transcript's samples are in one block.
+ * The final file (all integers are little endian) consists of
+ *
+ *   header : char[8] magic ("SALMNCOL"), uint32 version (3), uint32 value
+ *            type (a SamplePrecision), uint64 number of transcripts, uint64
+ *            number of samples, uint64 transcripts per block, uint64 scale
+ *            of the fixed-point values (0 for the other value types), uint64
+ *            samples per group
+ *   blocks : for each group of samples in turn, for each block of
+ *            transcripts, a zlib stream holding, for the transcripts of the
+ *            block in order, the samples of the group of that transcript
+ *            (see SampleEncoding.hpp for the encoding of the values)
+ *   index  : for each group, for each block, uint64 file offset and uint64
+ *            compressed size
+ *   footer : uint64 offset of the index, char[8] magic
+ *
+ * so a reader can find the blocks holding a transcript from the footer and
+ * the index, and read them with one seek per group.  (Versions 1 and 2
+ * have no samples per group; all of their samples are in a single group.)
+ */
+class ColumnarSampleWriter {
+public:
+  ColumnarSampleWriter(const boost::filesystem::path& path, size_t numTargets,
+                       SamplePrecision precision = SamplePrecision::FLOAT64,
+                       uint32_t fixedScale = 0, uint64_t expectedSamples = 0);
+  ~ColumnarSampleWriter();
+
+  /**
+   * Append one sample (with a value for every transcript).
+   */
+  bool writeSample(const std::vector<double>& sample);
+
+  /**
+   * Write out the last (partial) group, the index and the footer, and fill
+   * in the number of samples in the header.  No further samples can be
+   * written after this.
+   */
+  bool finish();
+
+  uint64_t numSamples() const { return numSamples_; }
+  uint64_t samplesPerGroup() const { return samplesPerGroup_; }
+
+private:
+  bool writeHeader_();
+  // Transpose, compress and write the samples in group_
+  bool flushGroup_();
+
+  boost::filesystem::path path_;
+  std::unique_ptr<std::ofstream> out_{nullptr};
+  size_t numTargets_;
+  SamplePrecision precision_;
+  uint32_t fixedScale_;
+  uint64_t samplesPerGroup_;
+  uint64_t txpsPerBlock_;
+  // The samples of the current group, one after another
+  std::vector<double> group_;
+  uint64_t numGroupSamples_{0};
+  std::vector<std::pair<uint64_t, uint64_t>> index_;
+  uint64_t numSamples_{0};
+  bool ok_{true};
+  bool finished_{false};
+};
+
+#endif // COLUMNAR_SAMPLE_WRITER_HPP
@@ -0,0 +1,152 @@
+#ifndef COUNT_VARIANCE_HPP
+#define COUNT_VARIANCE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+
+#include "Eigen/Dense"
+
+#include "EqClassPartition.hpp"
+
+namespace salmon {
+namespace variance {
+
+/**
+ * Approximate variances of the estimated read counts, from the curvature of
+ * the likelihood at the converged estimates (the delta method), rather than
+ * from the spread of the estimates of resampled counts.
+ *
+ * With the likelihood L(a) = sum_c n_c log(sum_t w_ct a_t) of the counts a
+ * (n_c reads in class c, w_ct the combined weights used by the EM), the
+ * observed information is
+ *
+ *   I_st = sum_c n_c w_cs w_ct / (sum_u w_cu a_u)^2,
+ *
+ * which is block diagonal over the connected components of the classes.  A
+ * transcript alone in its component gets I = n / a^2 = 1 / a: the Poisson
+ * variance of its count.  The variances are the diagonal of the inverse of
+ * each component's information, computed from a dense (LDLT) factorization
+ * for components of up to maxDenseSize transcripts.  In larger components, a
+ * transcript gets its variance conditional on the others, 1 / I_tt, which
+ * ignores how they are confounded, and so is an underestimate.
+ *
+ * Transcripts that can't be told apart (in the same classes, with the same
+ * weights) make the information singular: the likelihood doesn't change
+ * with how their reads are split.  The variance of a count in a component
+ * with T reads is therefore capped at T + T^2 / 4, the Poisson variance of
+ * the component's total plus the most that any split of it can vary.
+ */
+struct VarianceStats {
+  size_t numComponents{0};
+  // the components whose information was inverted
+  size_t numDense{0};
+  // the transcripts given their conditional variance
+  size_t numConditional{0};
+};
+
+inline std::vector<double> countVariances(const EqClassPartition& partition,
+                                          const std::vector<double>& alphas,
+                                          size_t maxDenseSize,
+                                          VarianceStats& stats) {
+  const FlatEquivalenceClasses& classes = partition.classes;
+  std::vector<double> variances(alphas.size(), 0.0);
+  size_t numComponents = partition.numComponents();
+  std::atomic<size_t> numDense{0};
+  std::atomic<size_t> numConditional{0};
+
+  tbb::parallel_for(
+      tbb::blocked_range<size_t>(0, numComponents, 1),
+      [&](const tbb::blocked_range<size_t>& range) -> void {
+        Eigen::MatrixXd info;
+        std::vector<double> diag;
+        std::vector<double> g;
+        std::vector<uint32_t> idx;
+        for (size_t c = range.begin(); c < range.end(); ++c) {
+          auto tb = partition.compTxpOffsets[c];
+          size_t k = partition.compTxpOffsets[c + 1] - tb;
+          // in increasing order, so they're found by binary search
+          const uint32_t* txps = partition.compTxps.data() + tb;
+          double total{0.0};
+          for (size_t i = 0; i < k; ++i) {
+            total += alphas[txps[i]];
+          }
+          if (!(total > 0.0)) {
+            continue;
+          }
+          double maxVar = total + 0.25 * total * total;
+
+          bool dense = (k <= maxDenseSize);
+          if (dense) {
+            info.setZero(k, k);
+          } else {
+            diag.assign(k, 0.0);
+          }
+          for (auto q = partition.compOffsets[c];
+               q < partition.compOffsets[c + 1]; ++q) {
+            auto b = classes.offsets[q];
+            size_t n = classes.offsets[q + 1] - b;
+            const uint32_t* ctxps = classes.txps.data() + b;
+            const double* w = classes.combinedWeights.data() + b;
+            double lambda{0.0};
+            for (size_t i = 0; i < n; ++i) {
+              lambda += w[i] * alphas[ctxps[i]];
+            }
+            if (!(lambda > 0.0)) {
+              continue;
+            }
+            double count = static_cast<double>(classes.counts[q]);
+            g.resize(n);
+            idx.resize(n);
+            for (size_t i = 0; i < n; ++i) {
+              g[i] = w[i] / lambda;
+              idx[i] = std::lower_bound(txps, txps + k, ctxps[i]) - txps;
+            }
+            for (size_t i = 0; i < n; ++i) {
+              if (dense) {
+                for (size_t j = 0; j < n; ++j) {
+                  info(idx[i], idx[j]) += count * g[i] * g[j];
+                }
+              } else {
+                diag[idx[i]] += count * g[i] * g[i];
+              }
+            }
+          }
+
+          if (dense) {
+            // A tiny ridge, so that the factorization of a singular
+            // information matrix still gives (huge, then capped) variances
+            double ridge = 1e-12 * info.diagonal().maxCoeff();
+            info.diagonal().array() += ridge;
+            Eigen::LDLT<Eigen::MatrixXd> ldlt(info);
+            Eigen::MatrixXd inv = ldlt.solve(Eigen::MatrixXd::Identity(k, k));
+            for (size_t i = 0; i < k; ++i) {
+              double v = inv(i, i);
+              variances[txps[i]] =
+                  (v >= 0.0 and v < maxVar) ? v : maxVar;
+            }
+            ++numDense;
+          } else {
+            for (size_t i = 0; i < k; ++i) {
+              double v = (diag[i] > 0.0) ? 1.0 / diag[i] : maxVar;
+              variances[txps[i]] = std::min(v, maxVar);
+            }
+            numConditional += k;
+          }
+        }
+      });
+
+  stats.numComponents = numComponents;
+  stats.numDense = numDense;
+  stats.numConditional = numConditional;
+  return variances;
+}
+
+} // namespace variance
+} // namespace salmon
+
+#endif // COUNT_VARIANCE_HPP
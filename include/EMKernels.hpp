@@ -0,0 +1,66 @@
+#ifndef EM_KERNELS_HPP
+#define EM_KERNELS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Kernels for the innermost loops of the (VB)EM updates.  These operate on
+ * raw arrays --- in particular, on the flat layout of the equivalence
+ * classes (see FlatEquivalenceClasses) --- so that they can be used by both
+ * the serial (bootstrapping) and parallel update routines.
+ */
+namespace salmon {
+namespace emkernels {
+
+/**
+ * Compute sum_{i < n} alpha[txps[i]] * aux[i].
+ *
+ * On x86, this is dispatched at runtime to an AVX-512 or AVX2
+ * gather-multiply-reduce kernel if the CPU supports it; otherwise (and on
+ * other architectures) an unrolled scalar loop is used.
+ */
+double gatherDot(const double* alpha, const uint32_t* txps, const double* aux,
+                 size_t n);
+
+/**
+ * The same, with single-precision weights (e.g. with --emSinglePrecision);
+ * the weights are widened and the products summed in double precision.
+ */
+double gatherDot(const double* alpha, const uint32_t* txps, const float* aux,
+                 size_t n);
+
+/**
+ * The name of the implementation that gatherDot dispatches to
+ * ("avx512", "avx2" or "scalar").
+ */
+const char* gatherDotImpl();
+
+/**
+ * The scalar version of gatherDot; always available.
+ */
+double gatherDotScalar(const double* alpha, const uint32_t* txps,
+                       const double* aux, size_t n);
+double gatherDotScalar(const double* alpha, const uint32_t* txps,
+                       const float* aux, size_t n);
+
+/**
+ * The digamma function, evaluated without branches (x must be > 0).
+ * The argument is shifted up using the recurrence
+ * digamma(x) = digamma(x + 1) - 1/x and the asymptotic expansion is then
+ * used.  The relative error is < 1e-12 for all x > 0.
+ */
+double digamma(double x);
+
+/**
+ * For each i < n, compute
+ *   expTheta[i] = exp(digamma(alpha[i] + prior[i]) - logNorm)
+ * if alpha[i] + prior[i] > minAlpha, and 0 otherwise.
+ * Also, if zeroOut is not null, set zeroOut[i] = 0 for each i.
+ */
+void expDigamma(const double* alpha, const double* prior, double logNorm,
+                double minAlpha, double* expTheta, double* zeroOut, size_t n);
+}
+}
+
+#endif // EM_KERNELS_HPP
@@ -1,28 +1,49 @@
 #ifndef EFFECTIVE_LENGTH_STATS_HPP
 #define EFFECTIVE_LENGTH_STATS_HPP
 
+#include <cstdint>
+#include <unordered_map>
+
 #include "Eigen/Dense"
 
 /**
  * Record a weighted average of per-transcript observed effective lengths.
  * These can then be combined to compute an "expected" effective length.
+ * Every mapping thread keeps one of these, so only the transcripts that
+ * were actually observed have an entry.
  **/
 class EffectiveLengthStats {
-  using VectorXu = Eigen::Matrix<uint32_t, Eigen::Dynamic, 1>;
-
 public:
-  EffectiveLengthStats(size_t numTxps);
   void addFragment(uint32_t txID, uint32_t len, double logMass);
-  uint32_t getObservedCount(uint32_t txID);
-  double getExpectedEffectiveLength(uint32_t txID);
-  Eigen::VectorXd getExpectedEffectiveLengths();
+  uint32_t getObservedCount(uint32_t txID) const;
+  double getExpectedEffectiveLength(uint32_t txID) const;
+  Eigen::VectorXd getExpectedEffectiveLengths(size_t numTxps) const;
   void merge(const EffectiveLengthStats& other);
+  // Forget all observations (keeping the allocated table)
+  void reset() { stats_.clear(); }
+  // The number of transcripts with at least one observation
+  size_t size() const { return stats_.size(); }
+
+  /**
+   * Call f(txID, expected effective length, observed count) for every
+   * observed transcript.
+   */
+  template <typename CallbackT> void forEachObserved(CallbackT f) const {
+    for (auto& kv : stats_) {
+      f(kv.first, expectedLength_(kv.second), kv.second.count);
+    }
+  }
 
 private:
-  size_t numTxps_;
-  Eigen::VectorXd lengths_;
-  Eigen::VectorXd weights_;
-  VectorXu counts_;
+  struct TxpStats {
+    // log of the sum of the weighted lengths, and of the weights
+    double logLengthMass;
+    double logWeight;
+    uint32_t count;
+  };
+  static double expectedLength_(const TxpStats& s);
+
+  std::unordered_map<uint32_t, TxpStats> stats_;
 };
 
 #endif // EFFECTIVE_LENGTH_STATS_HPP
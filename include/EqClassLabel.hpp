@@ -0,0 +1,242 @@
+#ifndef EQ_CLASS_LABEL_HPP
+#define EQ_CLASS_LABEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <utility>
+
+/**
+ * The label of an equivalence class: its transcript ids, possibly followed
+ * by their range-factorization bins (or rank-ordered, see --rankEqClasses).
+ *
+ * Labels of up to InlineCapacity entries (8 transcripts with their bins),
+ * which are the large majority, are stored in place, so a key of the
+ * equivalence class map is a single contiguous object and inserting one
+ * doesn't allocate.  Longer labels are kept in a reference-counted block;
+ * once a label has been copied out of the buffer it was built in (e.g. into
+ * the equivalence class map), the copy is interned, in that further copies of
+ * it (the map's snapshot, the local maps' flushes) share the one block
+ * rather than duplicating it.  A shared block is never modified; modifying a
+ * label that shares one first gives it a block of its own.
+ *
+ * The hash (an xxhash64-style mix of the entries) is updated as each entry is
+ * appended, so hashing the label of a fragment takes no pass of its own.
+ */
+class EqClassLabel {
+public:
+  static constexpr uint32_t InlineCapacity = 16;
+
+  using value_type = uint32_t;
+  using const_iterator = const uint32_t*;
+
+  EqClassLabel() = default;
+
+  template <typename InputIt> EqClassLabel(InputIt first, InputIt last) {
+    assign(first, last);
+  }
+
+  EqClassLabel(const EqClassLabel& other) { copyFrom_(other); }
+
+  EqClassLabel(EqClassLabel&& other) noexcept { moveFrom_(other); }
+
+  EqClassLabel& operator=(const EqClassLabel& other) {
+    if (this != &other) {
+      release_();
+      copyFrom_(other);
+    }
+    return *this;
+  }
+
+  EqClassLabel& operator=(EqClassLabel&& other) noexcept {
+    if (this != &other) {
+      release_();
+      moveFrom_(other);
+    }
+    return *this;
+  }
+
+  ~EqClassLabel() { release_(); }
+
+  uint32_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  uint32_t capacity() const {
+    return block_ ? block_->capacity : InlineCapacity;
+  }
+
+  const uint32_t* data() const { return block_ ? block_->data() : inline_; }
+  const_iterator begin() const { return data(); }
+  const_iterator end() const { return data() + size_; }
+  uint32_t operator[](size_t i) const { return data()[i]; }
+
+  inline void push_back(uint32_t v) {
+    if (block_ == nullptr and size_ < InlineCapacity) {
+      inline_[size_] = v;
+    } else {
+      if (block_ == nullptr or block_->shared() or
+          size_ == block_->capacity) {
+        grow_(std::max(2 * size_, InlineCapacity));
+      }
+      block_->data()[size_] = v;
+    }
+    ++size_;
+    state_ = round_(state_, v);
+  }
+
+  /**
+   * Empty the label; a block that isn't shared is kept, so that a label
+   * that's refilled for every fragment doesn't allocate once it's warm.
+   */
+  inline void clear() {
+    if (block_ and block_->shared()) {
+      release_();
+    }
+    interned_ = false;
+    size_ = 0;
+    state_ = Seed;
+  }
+
+  void reserve(uint32_t n) {
+    if (n > capacity() or (block_ and block_->shared())) {
+      grow_(std::max(n, capacity()));
+    }
+  }
+
+  template <typename InputIt> void assign(InputIt first, InputIt last) {
+    clear();
+    for (; first != last; ++first) {
+      push_back(static_cast<uint32_t>(*first));
+    }
+  }
+
+  // The hash of the entries, as appended so far
+  inline size_t hash() const {
+    uint64_t h = state_ + static_cast<uint64_t>(size_) * Prime5;
+    h ^= h >> 33;
+    h *= Prime2;
+    h ^= h >> 29;
+    h *= Prime3;
+    h ^= h >> 32;
+    return static_cast<size_t>(h);
+  }
+
+  // Whether this label shares its block with another one
+  bool shared() const { return block_ and block_->shared(); }
+
+  friend void swap(EqClassLabel& a, EqClassLabel& b) noexcept {
+    EqClassLabel tmp(std::move(a));
+    a = std::move(b);
+    b = std::move(tmp);
+  }
+
+private:
+  // The primes of xxhash64
+  static constexpr uint64_t Prime1 = 11400714785074694791ULL;
+  static constexpr uint64_t Prime2 = 14029467366897019727ULL;
+  static constexpr uint64_t Prime3 = 1609587929392839161ULL;
+  static constexpr uint64_t Prime5 = 2870177450012600261ULL;
+  static constexpr uint64_t Seed = Prime5;
+
+  static inline uint64_t round_(uint64_t acc, uint32_t v) {
+    acc ^= (static_cast<uint64_t>(v) * Prime1);
+    acc = (acc << 27) | (acc >> 37);
+    return acc * Prime1 + Prime2;
+  }
+
+  // A reference-counted buffer, followed by capacity entries
+  struct Block {
+    std::atomic<uint32_t> refs;
+    uint32_t capacity;
+
+    uint32_t* data() { return reinterpret_cast<uint32_t*>(this + 1); }
+    const uint32_t* data() const {
+      return reinterpret_cast<const uint32_t*>(this + 1);
+    }
+    bool shared() const { return refs.load(std::memory_order_acquire) > 1; }
+
+    static Block* create(uint32_t capacity) {
+      void* mem = ::operator new(sizeof(Block) + capacity * sizeof(uint32_t));
+      Block* b = new (mem) Block;
+      b->refs.store(1, std::memory_order_relaxed);
+      b->capacity = capacity;
+      return b;
+    }
+
+    static void unref(Block* b) {
+      if (b->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        b->~Block();
+        ::operator delete(b);
+      }
+    }
+  };
+
+  // Move the entries into a block of their own, of at least capacity entries
+  void grow_(uint32_t capacity) {
+    Block* b = Block::create(std::max(capacity, size_));
+    std::memcpy(b->data(), data(), size_ * sizeof(uint32_t));
+    release_();
+    block_ = b;
+  }
+
+  void release_() {
+    if (block_) {
+      Block::unref(block_);
+      block_ = nullptr;
+    }
+    interned_ = false;
+  }
+
+  void copyFrom_(const EqClassLabel& other) {
+    size_ = other.size_;
+    state_ = other.state_;
+    if (size_ <= InlineCapacity) {
+      std::memcpy(inline_, other.data(), size_ * sizeof(uint32_t));
+    } else if (other.interned_) {
+      other.block_->refs.fetch_add(1, std::memory_order_relaxed);
+      block_ = other.block_;
+      interned_ = true;
+    } else {
+      // The first copy of a long label gets a block of exactly its size,
+      // which later copies share
+      block_ = Block::create(size_);
+      std::memcpy(block_->data(), other.data(), size_ * sizeof(uint32_t));
+      interned_ = true;
+    }
+  }
+
+  void moveFrom_(EqClassLabel& other) {
+    size_ = other.size_;
+    state_ = other.state_;
+    interned_ = other.interned_;
+    if (other.block_) {
+      block_ = other.block_;
+      other.block_ = nullptr;
+    } else {
+      std::memcpy(inline_, other.inline_, size_ * sizeof(uint32_t));
+    }
+    other.size_ = 0;
+    other.state_ = Seed;
+    other.interned_ = false;
+  }
+
+  uint32_t size_{0};
+  bool interned_{false};
+  uint64_t state_{Seed};
+  Block* block_{nullptr};
+  uint32_t inline_[InlineCapacity];
+};
+
+inline bool operator==(const EqClassLabel& lhs, const EqClassLabel& rhs) {
+  return lhs.size() == rhs.size() and
+         (lhs.data() == rhs.data() or
+          std::memcmp(lhs.data(), rhs.data(),
+                      lhs.size() * sizeof(uint32_t)) == 0);
+}
+
+inline bool operator!=(const EqClassLabel& lhs, const EqClassLabel& rhs) {
+  return !(lhs == rhs);
+}
+
+#endif // EQ_CLASS_LABEL_HPP
@@ -0,0 +1,404 @@
+#ifndef EQ_CLASS_PARTITION_HPP
+#define EQ_CLASS_PARTITION_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <vector>
+
+#include "tbb/blocked_range.h"
+#include "tbb/combinable.h"
+#include "tbb/parallel_for.h"
+#include "tbb/partitioner.h"
+
+#include "FlatEquivalenceClasses.hpp"
+#include "MemoryPlacement.hpp"
+
+/**
+ * A partitioning of the (valid) equivalence classes that allows the EM
+ * updates to be accumulated in parallel without atomic operations.
+ *
+ * The transcripts are grouped into the connected components induced by the
+ * equivalence classes (two transcripts are connected if they appear together
+ * in some class).  Two classes from different components never touch the
+ * same transcript, so whole components are packed into "blocks", each of
+ * which is processed by a single task that may update its transcripts with
+ * plain (non-atomic) additions.
+ *
+ * The partition holds its own copy of the classes, in the order in which
+ * they are processed; each block's share of it is written by the thread
+ * that goes on to process the block (see affinity()), so that its pages are
+ * local to that thread on a NUMA machine.
+ *
+ * A component that is too large to be packed into a block without hurting
+ * load balance (e.g. a big gene family) is marked as "shared".  Its classes
+ * are processed in parallel, with each thread accumulating into its own
+ * buffer, which has one entry per transcript of the shared components.  The
+ * buffers are summed into the output once all of the classes are processed.
+ */
+class EqClassPartition {
+public:
+  static constexpr uint32_t notShared = std::numeric_limits<uint32_t>::max();
+
+  EqClassPartition() = default;
+
+  /**
+   * Partition the valid classes of `eqClasses`, over `numTranscripts`
+   * transcripts, into blocks of roughly equal work for `numThreads` threads.
+   * With singlePrecision, the partition keeps its combined weights as floats
+   * (in combinedWeightsF), halving the bytes each (VB)EM sweep reads for
+   * them.
+   */
+  void build(const FlatEquivalenceClasses& eqClasses, size_t numTranscripts,
+             size_t numThreads, bool singlePrecision = false) {
+    singlePrecision_ = singlePrecision;
+    blockOffsets.clear();
+    sharedTxps.clear();
+    numClassUpdates_ = 0;
+    sharedIndex.assign(numTranscripts, static_cast<uint32_t>(notShared));
+
+    // Union the transcripts of each valid class
+    std::vector<uint32_t> parent(numTranscripts);
+    std::iota(parent.begin(), parent.end(), 0);
+    auto find = [&parent](uint32_t x) -> uint32_t {
+      while (parent[x] != x) {
+        parent[x] = parent[parent[x]];
+        x = parent[x];
+      }
+      return x;
+    };
+
+    size_t numClasses = eqClasses.numClasses();
+    uint64_t totalWork{0};
+    for (size_t eqID = 0; eqID < numClasses; ++eqID) {
+      if (!eqClasses.valid[eqID]) {
+        continue;
+      }
+      auto b = eqClasses.offsets[eqID];
+      auto e = eqClasses.offsets[eqID + 1];
+      totalWork += (e - b);
+      uint32_t r = find(eqClasses.txps[b]);
+      for (auto i = b + 1; i < e; ++i) {
+        uint32_t r2 = find(eqClasses.txps[i]);
+        if (r2 != r) {
+          parent[r2] = r;
+        }
+      }
+    }
+
+    // The work (total class size) and list of classes of each component,
+    // indexed by the component's root transcript.
+    std::vector<uint64_t> compWork(numTranscripts, 0);
+    std::vector<uint32_t> compNumClasses(numTranscripts, 0);
+    for (size_t eqID = 0; eqID < numClasses; ++eqID) {
+      if (!eqClasses.valid[eqID]) {
+        continue;
+      }
+      uint32_t r = find(eqClasses.txps[eqClasses.offsets[eqID]]);
+      compWork[r] += eqClasses.classSize(eqID);
+      ++compNumClasses[r];
+    }
+    std::vector<uint64_t> compStart(numTranscripts + 1, 0);
+    for (size_t t = 0; t < numTranscripts; ++t) {
+      compStart[t + 1] = compStart[t] + compNumClasses[t];
+    }
+    std::vector<uint32_t> byComp(compStart.back());
+    {
+      std::vector<uint64_t> fill(compStart.begin(), compStart.end() - 1);
+      for (size_t eqID = 0; eqID < numClasses; ++eqID) {
+        if (eqClasses.valid[eqID]) {
+          uint32_t r = find(eqClasses.txps[eqClasses.offsets[eqID]]);
+          byComp[fill[r]++] = eqID;
+        }
+      }
+    }
+
+    // Aim for several blocks per thread, so that the scheduler
+    // can balance the load.
+    uint64_t targetWork =
+        std::max(uint64_t(1),
+                 totalWork / (8 * std::max(numThreads, size_t(1))));
+
+    // Order the components so that the components of each block, and then
+    // the shared components, are contiguous; the classes are ordered
+    // by component.
+    std::vector<uint32_t> roots;
+    std::vector<uint32_t> sharedRoots;
+    blockOffsets.push_back(0);
+    uint64_t curWork{0};
+    for (size_t r = 0; r < numTranscripts; ++r) {
+      if (compNumClasses[r] == 0) {
+        continue;
+      }
+      if (compWork[r] > targetWork) {
+        sharedRoots.push_back(r);
+        continue;
+      }
+      roots.push_back(r);
+      curWork += compWork[r];
+      if (curWork >= targetWork) {
+        blockOffsets.push_back(roots.size());
+        curWork = 0;
+      }
+    }
+    if (blockOffsets.back() != roots.size()) {
+      blockOffsets.push_back(roots.size());
+    }
+    sharedCompBegin = roots.size();
+    roots.insert(roots.end(), sharedRoots.begin(), sharedRoots.end());
+
+    order.clear();
+    order.reserve(byComp.size());
+    compOffsets.assign(1, 0);
+    std::vector<uint32_t> compIndex(numTranscripts, 0);
+    for (size_t c = 0; c < roots.size(); ++c) {
+      auto r = roots[c];
+      compIndex[r] = c;
+      order.insert(order.end(), byComp.begin() + compStart[r],
+                   byComp.begin() + compStart[r + 1]);
+      compOffsets.push_back(order.size());
+    }
+    sharedBegin = compOffsets[sharedCompBegin];
+
+    // The transcripts of each component
+    std::vector<uint32_t> compNumTxps(roots.size(), 0);
+    for (size_t t = 0; t < numTranscripts; ++t) {
+      auto r = find(t);
+      if (compNumClasses[r] > 0) {
+        ++compNumTxps[compIndex[r]];
+      }
+    }
+    compTxpOffsets.assign(roots.size() + 1, 0);
+    for (size_t c = 0; c < roots.size(); ++c) {
+      compTxpOffsets[c + 1] = compTxpOffsets[c] + compNumTxps[c];
+    }
+    compTxps.resize(compTxpOffsets.back());
+    {
+      std::vector<uint64_t> fill(compTxpOffsets.begin(),
+                                 compTxpOffsets.end() - 1);
+      for (size_t t = 0; t < numTranscripts; ++t) {
+        auto r = find(t);
+        if (compNumClasses[r] > 0) {
+          compTxps[fill[compIndex[r]]++] = t;
+        }
+      }
+    }
+    active.assign(roots.size(), 1);
+
+    // Copy the classes in this order, so that each task streams through
+    // its classes rather than jumping around the original arrays.  Each
+    // block is copied by the task (and, through affinity_, the thread) that
+    // processes it in the (VB)EM, so that on a NUMA machine its pages are
+    // first touched, and placed, on the node of the thread that reads them.
+    classes.clear();
+    combinedWeightsF.clear();
+    classes.offsets.resize(order.size() + 1);
+    classes.offsets[0] = 0;
+    for (size_t k = 0; k < order.size(); ++k) {
+      classes.offsets[k + 1] =
+          classes.offsets[k] + eqClasses.classSize(order[k]);
+    }
+    classes.txps.resize(classes.offsets.back());
+    classes.counts.resize(order.size());
+    classes.valid.assign(order.size(), 1);
+    releaseForFirstTouch_(classes.txps);
+    releaseForFirstTouch_(classes.counts);
+    forEachClassRange_([this, &eqClasses](size_t kb, size_t ke) -> void {
+      for (size_t k = kb; k < ke; ++k) {
+        auto eqID = order[k];
+        std::copy(eqClasses.txps.begin() + eqClasses.offsets[eqID],
+                  eqClasses.txps.begin() + eqClasses.offsets[eqID + 1],
+                  classes.txps.begin() + classes.offsets[k]);
+        classes.counts[k] = eqClasses.counts[eqID];
+      }
+    });
+    refreshWeights(eqClasses);
+
+    // Give each transcript of the shared components its own
+    // slot in the per-thread buffers.
+    for (size_t k = sharedBegin; k < classes.numClasses(); ++k) {
+      for (auto i = classes.offsets[k]; i < classes.offsets[k + 1]; ++i) {
+        auto t = classes.txps[i];
+        if (sharedIndex[t] == notShared) {
+          sharedIndex[t] = sharedTxps.size();
+          sharedTxps.push_back(t);
+        }
+      }
+    }
+    size_t numShared = sharedTxps.size();
+    localSums_.reset(new tbb::combinable<std::vector<double>>(
+        [numShared]() { return std::vector<double>(numShared, 0.0); }));
+  }
+
+  /**
+   * Copy the combined weights of `eqClasses` (from which this partition was
+   * built) into the partition; must be called whenever they change.
+   */
+  void refreshWeights(const FlatEquivalenceClasses& eqClasses) {
+    if (singlePrecision_) {
+      refreshWeights_(eqClasses, combinedWeightsF);
+    } else {
+      refreshWeights_(eqClasses, classes.combinedWeights);
+    }
+  }
+
+  bool singlePrecision() const { return singlePrecision_; }
+
+  size_t numBlocks() const {
+    return blockOffsets.empty() ? 0 : blockOffsets.size() - 1;
+  }
+
+  // The buffer into which the calling thread accumulates the
+  // mass of the shared transcripts.
+  std::vector<double>& localSums() { return localSums_->local(); }
+
+  /**
+   * Add the per-thread sums of the shared transcripts to `out`,
+   * and reset them to 0.
+   */
+  void reduceShared(double* out) {
+    localSums_->combine_each([this, out](std::vector<double>& sums) -> void {
+      for (size_t j = 0; j < sums.size(); ++j) {
+        out[sharedTxps[j]] += sums[j];
+        sums[j] = 0.0;
+      }
+    });
+  }
+
+  /**
+   * Record an iteration of the EM over the active components, and stop
+   * updating the components that have converged; `alphaIn` and `alphaOut`
+   * are the estimates before and after the iteration.  A component with a
+   * single transcript receives all of the mass of its classes, and so is
+   * solved after a single iteration.  Other components are only stopped if
+   * `allowFreeze` is true and none of their transcripts with an estimate
+   * above `alphaCheckCutoff` changed by a relative amount of more than
+   * `relDiffTolerance`.  `numUpdates` is the number of (VB)EM updates that
+   * produced alphaOut from alphaIn.  Returns the number of components still
+   * active.
+   */
+  size_t freezeConverged(const double* alphaIn, const double* alphaOut,
+                         double relDiffTolerance, double alphaCheckCutoff,
+                         bool allowFreeze, uint32_t numUpdates = 1) {
+    size_t numActive{0};
+    for (size_t c = 0; c < active.size(); ++c) {
+      if (!active[c]) {
+        continue;
+      }
+      numClassUpdates_ += numUpdates * (compOffsets[c + 1] - compOffsets[c]);
+      auto tb = compTxpOffsets[c];
+      auto te = compTxpOffsets[c + 1];
+      bool converged = (te - tb == 1);
+      if (!converged and allowFreeze) {
+        converged = true;
+        for (auto i = tb; i < te; ++i) {
+          auto t = compTxps[i];
+          if (alphaOut[t] > alphaCheckCutoff and
+              std::abs(alphaIn[t] - alphaOut[t]) / alphaOut[t] >
+                  relDiffTolerance) {
+            converged = false;
+            break;
+          }
+        }
+      }
+      if (converged) {
+        active[c] = 0;
+      } else {
+        ++numActive;
+      }
+    }
+    return numActive;
+  }
+
+  /**
+   * The partitioner with which the (VB)EM should run over the blocks, so
+   * that each block goes to the thread that copied it in (and so placed it).
+   */
+  tbb::affinity_partitioner& affinity() { return affinity_; }
+
+  // The number of class updates performed, as recorded by freezeConverged
+  uint64_t numClassUpdates() const { return numClassUpdates_; }
+
+  size_t numSharedClasses() const { return classes.numClasses() - sharedBegin; }
+  size_t numComponents() const { return active.size(); }
+
+  // The valid classes, ordered by component.  The classes of component c
+  // are classes[compOffsets[c]] ... classes[compOffsets[c+1] - 1].  Only the
+  // transcripts, combined weights and counts are filled in.
+  FlatEquivalenceClasses classes;
+  std::vector<uint64_t> compOffsets;
+  // The transcripts of component c are compTxps[compTxpOffsets[c]] ...
+  std::vector<uint64_t> compTxpOffsets;
+  std::vector<uint32_t> compTxps;
+  // Block b consists of the components blockOffsets[b] ...
+  // blockOffsets[b+1] - 1.  The components from sharedCompBegin on are
+  // the shared components, whose classes start at classes[sharedBegin].
+  std::vector<uint64_t> blockOffsets;
+  size_t sharedCompBegin{0};
+  size_t sharedBegin{0};
+  // 0 if the component has converged and is no longer updated
+  std::vector<uint8_t> active;
+  // classes[k] is the class order[k] of the original classes
+  std::vector<uint32_t> order;
+  // With singlePrecision, the combined weights of the classes (and
+  // classes.combinedWeights is left empty)
+  std::vector<float> combinedWeightsF;
+  // The transcripts of the shared components, and, for each
+  // transcript, its index in sharedTxps (or notShared).
+  std::vector<uint32_t> sharedTxps;
+  std::vector<uint32_t> sharedIndex;
+
+private:
+  // Run f(kb, ke) over the classes [kb, ke) of each block, and over (ranges
+  // of) the classes of the shared components, in parallel.
+  template <typename FunT> void forEachClassRange_(FunT f) {
+    tbb::parallel_for(tbb::blocked_range<size_t>(size_t(0), numBlocks()),
+                      [this, &f](const tbb::blocked_range<size_t>& r) -> void {
+                        for (size_t b = r.begin(); b < r.end(); ++b) {
+                          f(compOffsets[blockOffsets[b]],
+                            compOffsets[blockOffsets[b + 1]]);
+                        }
+                      },
+                      affinity_);
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(sharedBegin, classes.numClasses()),
+        [&f](const tbb::blocked_range<size_t>& r) -> void {
+          f(r.begin(), r.end());
+        });
+  }
+
+  template <typename T> static void releaseForFirstTouch_(std::vector<T>& v) {
+    salmon::memory::releaseForFirstTouch(v.data(), v.size() * sizeof(T));
+  }
+
+  template <typename T>
+  void refreshWeights_(const FlatEquivalenceClasses& eqClasses,
+                       std::vector<T>& weights) {
+    // When they're first filled in, the weights are placed like the
+    // transcripts; after that they're overwritten in place.
+    if (weights.size() != classes.txps.size()) {
+      weights.assign(classes.txps.size(), T(0));
+      releaseForFirstTouch_(weights);
+    }
+    forEachClassRange_([this, &eqClasses, &weights](size_t kb,
+                                                     size_t ke) -> void {
+      for (size_t k = kb; k < ke; ++k) {
+        auto eqID = order[k];
+        std::copy(eqClasses.combinedWeights.begin() + eqClasses.offsets[eqID],
+                  eqClasses.combinedWeights.begin() +
+                      eqClasses.offsets[eqID + 1],
+                  weights.begin() + classes.offsets[k]);
+      }
+    });
+  }
+
+  bool singlePrecision_{false};
+  tbb::affinity_partitioner affinity_;
+  uint64_t numClassUpdates_{0};
+  std::unique_ptr<tbb::combinable<std::vector<double>>> localSums_{nullptr};
+};
+
+#endif // EQ_CLASS_PARTITION_HPP
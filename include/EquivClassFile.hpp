@@ -0,0 +1,104 @@
+#ifndef EQUIV_CLASS_FILE_HPP
+#define EQUIV_CLASS_FILE_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "EquivalenceClassBuilder.hpp"
+
+/**
+ * The binary equivalence class file (eq_classes.bin) written by --dumpEq
+ * with --dumpEqFormat binary.  It holds the same information as
+ * eq_classes.txt; the file (all integers are little endian) consists of
+ *
+ *   header : char[8] magic ("SALMNEQC"), uint32 version (1), uint32 flags
+ *            (bit 0 set if the classes carry weights), uint64 number of
+ *            transcripts, uint64 number of classes, uint64 classes per block
+ *   names  : uint64 compressed size, then a zlib stream holding the
+ *            transcript names, each followed by '\n'
+ *   blocks : each a zlib stream holding, for the classes of the block in
+ *            order, the number of transcripts in the class, their ids (the
+ *            first one as is, and each of the others as the zigzag-encoded
+ *            difference from the one before), the float32 weight of each
+ *            transcript (if the classes carry weights) and the count of the
+ *            class; all but the weights are LEB128 varints
+ *   index  : for each block, uint64 file offset and uint64 compressed size
+ *   footer : uint64 offset of the index, char[8] magic
+ *
+ * The transcripts of a class keep their order, so the classes can be read
+ * back exactly as they were (--rankEqClasses relies on the order).
+ */
+namespace salmon {
+namespace eqclasses {
+
+/**
+ * Write the classes of eqVec to path.  If weights is not null, it holds the
+ * weights of all of the classes back to back, with those of class i
+ * starting at (*weightOffsets)[i].
+ */
+bool writeBinary(
+    const boost::filesystem::path& path, const std::vector<std::string>& names,
+    const std::vector<std::pair<const TranscriptGroup, TGValue>>& eqVec,
+    const std::vector<double>* weights = nullptr,
+    const std::vector<uint64_t>* weightOffsets = nullptr);
+
+/**
+ * Write the flat classes `classes` to path, with their combined weights if
+ * withWeights is set.
+ */
+bool writeBinary(const boost::filesystem::path& path,
+                 const std::vector<std::string>& names,
+                 const FlatEquivalenceClasses& classes, bool withWeights);
+
+struct EquivClass {
+  std::vector<uint32_t> txps;
+  // empty unless the file carries weights
+  std::vector<float> weights;
+  uint64_t count{0};
+};
+
+/**
+ * Reads an eq_classes.bin file, either one class after another (next()) or
+ * a block at a time (readBlock(), e.g. to read the blocks in parallel with
+ * one Reader per thread).
+ */
+class Reader {
+public:
+  // Returns false if path isn't a (complete) binary equivalence class file
+  bool open(const boost::filesystem::path& path);
+
+  uint64_t numTranscripts() const { return numTranscripts_; }
+  uint64_t numClasses() const { return numClasses_; }
+  bool hasWeights() const { return hasWeights_; }
+  const std::vector<std::string>& names() const { return names_; }
+  size_t numBlocks() const { return index_.size(); }
+
+  // The classes of block b (these are classes b * classesPerBlock on)
+  bool readBlock(size_t b, std::vector<EquivClass>& classes);
+
+  // The next class; returns false once all have been read
+  bool next(EquivClass& c);
+
+private:
+  std::ifstream in_;
+  uint64_t numTranscripts_{0};
+  uint64_t numClasses_{0};
+  uint64_t classesPerBlock_{0};
+  bool hasWeights_{false};
+  std::vector<std::string> names_;
+  std::vector<std::pair<uint64_t, uint64_t>> index_;
+  // for next()
+  std::vector<EquivClass> block_;
+  size_t nextBlock_{0};
+  size_t nextInBlock_{0};
+};
+
+} // namespace eqclasses
+} // namespace salmon
+
+#endif // EQUIV_CLASS_FILE_HPP
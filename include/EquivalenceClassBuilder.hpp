@@ -1,8 +1,16 @@
 #ifndef EQUIVALENCE_CLASS_BUILDER_HPP
 #define EQUIVALENCE_CLASS_BUILDER_HPP
 
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <limits>
 #include <memory>
 #include <mutex>
+#include <numeric>
+#include <queue>
+#include <string>
 #include <thread>
 #include <unordered_map>
 #include <vector>
@@ -10,6 +18,9 @@
 // Logger includes
 #include "spdlog/spdlog.h"
 
+#include "FlatEquivalenceClasses.hpp"
+#include "MemoryBudget.hpp"
+#include "SalmonSpinLock.hpp"
 #include "SalmonUtils.hpp"
 #include "TranscriptGroup.hpp"
 #include "concurrentqueue.h"
@@ -18,7 +29,7 @@
 struct TGValue {
   TGValue(const TGValue& o) {
     weights = o.weights;
-    combinedWeights = o.combinedWeights;
+    replicateCounts = o.replicateCounts;
     count = o.count;
   }
 
@@ -40,65 +51,496 @@ struct TGValue {
   }
 
   mutable std::vector<double> weights;
-
-  // The combined auxiliary and position weights.  These
-  // are filled in by the inference algorithm.
-  mutable std::vector<double> combinedWeights;
+  // the count of the class in each online bootstrap replicate (if any)
+  std::vector<uint32_t> replicateCounts;
   uint64_t count{0};
 };
 
 class EquivalenceClassBuilder {
 public:
   EquivalenceClassBuilder(std::shared_ptr<spdlog::logger> loggerIn)
-      : logger_(loggerIn) {
-    countMap_.reserve(1000000);
+      : logger_(loggerIn),
+        account_(&salmon::memory::budget().account("eq_classes")) {
+    reserved_ = initialCapacity_();
+    countMap_.reserve(reserved_);
+    charge_(reserved_ * slotBytes_);
   }
 
-  //~EquivalenceClassBuilder() {}
+  ~EquivalenceClassBuilder() {
+    account_->charge(-charged_.load());
+    closeSpill_();
+  }
 
   void start() { active_ = true; }
 
+  /**
+   * Keep at most maxHotClasses classes in the (in-memory) table; whenever it
+   * holds more, the classes seen least often so far (at least half of them)
+   * are written, sorted by label, as a run of the file spillPath, and
+   * dropped from the table.  A class may so end up in several runs (and in
+   * the table); finish() merges the runs, and the classes left in the table,
+   * in one streaming k-way merge.  The table is sized for maxHotClasses once,
+   * here, so it never grows (and rehashes) while mapping.
+   *
+   * If maxHotClasses is 0 and a memory budget is set, it's the number of
+   * classes that fit in a quarter of the budget; if there's no budget
+   * either, nothing is spilled.  Must be called before any class is added.
+   */
+  void spillTo(const std::string& spillPath, size_t maxHotClasses) {
+    auto& b = salmon::memory::budget();
+    if (maxHotClasses == 0 and b.limited()) {
+      uint64_t classBytes = slotBytes_ + spillClassBytes_;
+      maxHotClasses = std::max(size_t{1024},
+                               static_cast<size_t>(b.limit() / 4 / classBytes));
+    }
+    if (maxHotClasses == 0) {
+      return;
+    }
+    spillOut_.open(spillPath, std::ios::binary | std::ios::trunc);
+    if (!spillOut_.good()) {
+      logger_->warn("Couldn't open {} to spill equivalence classes to; "
+                    "keeping all of them in memory",
+                    spillPath);
+      return;
+    }
+    spillPath_ = spillPath;
+    maxHotClasses_ = maxHotClasses;
+    // room for the classes added while one thread spills the others
+    size_t capacity = maxHotClasses_ + maxHotClasses_ / 8;
+    countMap_.reserve(capacity);
+    int64_t added = static_cast<int64_t>(capacity) - reserved_;
+    charge_(added * static_cast<int64_t>(slotBytes_));
+    reserved_ = capacity;
+    logger_->info("Keeping at most {} equivalence classes in memory while "
+                  "mapping; the rest are spilled to {}",
+                  maxHotClasses_, spillPath_);
+  }
+
   bool finish() {
     active_ = false;
     size_t totalCount{0};
-    auto lt = countMap_.lock_table();
-    for (auto& kv : lt) {
-      kv.second.normalizeAux();
-      totalCount += kv.second.count;
-      countVec_.push_back(kv);
+    if (spillRuns_.empty()) {
+      auto lt = countMap_.lock_table();
+      for (auto& kv : lt) {
+        kv.second.normalizeAux();
+        totalCount += kv.second.count;
+        countVec_.push_back(kv);
+      }
+    } else {
+      // Everything goes to disk, so that all the classes are in sorted runs
+      spill_(true);
+      size_t numRuns = spillRuns_.size();
+      mergeRuns_([this, &totalCount](std::vector<uint32_t>& label,
+                                     std::vector<double>& weights,
+                                     uint64_t count,
+                                     std::vector<uint32_t>& reps) -> void {
+        TGValue v(weights, count);
+        v.replicateCounts = std::move(reps);
+        v.normalizeAux();
+        totalCount += count;
+        countVec_.emplace_back(TranscriptGroup(label), v);
+      });
+      logger_->info("Merged {} runs of spilled equivalence classes ({} "
+                    "classes written in all)",
+                    numRuns, numSpilled_);
     }
+    closeSpill_();
+    flat_.build(countVec_, numReplicates_);
 
     logger_->info("Computed {} rich equivalence classes "
                   "for further processing",
                   countVec_.size());
     logger_->info("Counted {} total reads in the equivalence classes ",
                   totalCount);
+    if (!localFlushes_.empty()) {
+      fmt::MemoryWriter w;
+      for (size_t i = 0; i < localFlushes_.size(); ++i) {
+        w << ((i > 0) ? ", " : "") << localFlushes_[i];
+      }
+      logger_->info("Per-thread equivalence class flushes : [{}]", w.str());
+    }
     return true;
   }
 
+  /**
+   * Add one observation of the class g, with the given weights.  The class
+   * is looked up (by the hash that g carries) before anything is built, so
+   * adding to an existing class allocates nothing; see addGroupInPlace.
+   */
   inline void addGroup(TranscriptGroup&& g, std::vector<double>& weights) {
+    addGroupInPlace(g, weights);
+  }
 
-    auto upfn = [&weights](TGValue& x) -> void {
-      // update the count
-      x.count++;
-      // update the weights
+  /**
+   * Same as above, but the key is not consumed, and `count` observations
+   * (whose weights sum to `weights`) may be added at once.  If the class
+   * already exists, it is updated in place and no memory is allocated; the
+   * key and weights are only copied when a new class is inserted.  With online
+   * bootstraps (setNumReplicates), `replicateCounts` holds the counts of the
+   * observations in each replicate.
+   */
+  inline void addGroupInPlace(const TranscriptGroup& g,
+                              std::vector<double>& weights,
+                              uint64_t count = 1,
+                              const uint32_t* replicateCounts = nullptr) {
+    uint32_t numReplicates =
+        (replicateCounts != nullptr) ? numReplicates_ : 0;
+    auto upfn = [&weights, count, replicateCounts,
+                 numReplicates](TGValue& x) -> void {
+      x.count += count;
       for (size_t i = 0; i < x.weights.size(); ++i) {
         x.weights[i] += weights[i];
       }
+      if (numReplicates > 0) {
+        x.replicateCounts.resize(numReplicates, 0);
+        for (uint32_t r = 0; r < numReplicates; ++r) {
+          x.replicateCounts[r] += replicateCounts[r];
+        }
+      }
     };
-    TGValue v(weights, 1);
-    countMap_.upsert(g, upfn, v);
+    if (!countMap_.update_fn(g, upfn)) {
+      // If another thread inserted this class in the meantime, upsert
+      // will simply apply upfn.
+      TGValue v(weights, count);
+      v.replicateCounts.assign(replicateCounts,
+                               replicateCounts + numReplicates);
+      if (countMap_.upsert(g, upfn, v)) {
+        inserted_(g.txps.size(), weights.size(), numReplicates);
+      }
+    }
+  }
+
+  /**
+   * Keep the counts of each class in numReplicates online bootstrap
+   * replicates (see PoissonBootstrap); must be set before any class is added.
+   */
+  void setNumReplicates(uint32_t numReplicates) {
+    numReplicates_ = numReplicates;
+  }
+  uint32_t numReplicates() const { return numReplicates_; }
+
+  /**
+   * Record the number of times a mapping thread flushed
+   * its local equivalence class map (see LocalEqClassMap)
+   * into this builder.
+   */
+  void recordLocalFlushes(uint64_t numFlushes) {
+    std::lock_guard<spin_lock> lock(flushMut_);
+    localFlushes_.push_back(numFlushes);
+  }
+
+  const std::vector<uint64_t>& localFlushCounts() const {
+    return localFlushes_;
   }
 
   std::vector<std::pair<const TranscriptGroup, TGValue>>& eqVec() {
     return countVec_;
   }
 
+  /**
+   * The flat representation of eqVec(); only valid after finish()
+   * has been called.
+   */
+  FlatEquivalenceClasses& flatEqClasses() { return flat_; }
+
+  /**
+   * Copy the classes gathered so far (for a checkpoint), with their counts
+   * and summed (unnormalized) weights; the label of class i starts at
+   * offsets[i], and its weights at weightOffsets[i] (a label may be longer
+   * than its weights, see --rangeFactorizationBins).  Nothing may be added
+   * to the builder meanwhile.
+   */
+  void dumpClasses(std::vector<uint64_t>& offsets, std::vector<uint32_t>& txps,
+                   std::vector<uint64_t>& weightOffsets,
+                   std::vector<double>& weights,
+                   std::vector<uint64_t>& counts) {
+    offsets.clear();
+    txps.clear();
+    weightOffsets.clear();
+    weights.clear();
+    counts.clear();
+    if (!spillRuns_.empty()) {
+      spill_(true);
+      mergeRuns_([&](std::vector<uint32_t>& label, std::vector<double>& w,
+                     uint64_t count, std::vector<uint32_t>&) -> void {
+        offsets.push_back(txps.size());
+        weightOffsets.push_back(weights.size());
+        txps.insert(txps.end(), label.begin(), label.end());
+        weights.insert(weights.end(), w.begin(), w.end());
+        counts.push_back(count);
+      });
+      offsets.push_back(txps.size());
+      weightOffsets.push_back(weights.size());
+      return;
+    }
+    auto lt = countMap_.lock_table();
+    offsets.reserve(lt.size() + 1);
+    weightOffsets.reserve(lt.size() + 1);
+    counts.reserve(lt.size());
+    for (auto& kv : lt) {
+      offsets.push_back(txps.size());
+      weightOffsets.push_back(weights.size());
+      txps.insert(txps.end(), kv.first.txps.begin(), kv.first.txps.end());
+      weights.insert(weights.end(), kv.second.weights.begin(),
+                     kv.second.weights.end());
+      counts.push_back(kv.second.count);
+    }
+    offsets.push_back(txps.size());
+    weightOffsets.push_back(weights.size());
+  }
+
 private:
+  // The bytes of a slot of countMap_
+  static constexpr size_t slotBytes_ =
+      sizeof(std::pair<TranscriptGroup, TGValue>);
+
+  /**
+   * The classes to make room for up front: a million, or, if that wouldn't
+   * fit in a tenth of what's left of the memory budget, as many as would.
+   */
+  static size_t initialCapacity_() {
+    size_t n{1000000};
+    auto& b = salmon::memory::budget();
+    if (!b.fits(n * slotBytes_, 0.1)) {
+      n = std::max(size_t{1024},
+                   static_cast<size_t>(b.available() / 10 / slotBytes_));
+    }
+    return n;
+  }
+
+  void charge_(int64_t bytes) {
+    charged_ += bytes;
+    account_->charge(bytes);
+  }
+
+  // The bytes that the label, weights and replicate counts of a class take
+  // outside of its slot
+  static int64_t heapBytes_(size_t numTxps, size_t numWeights,
+                            size_t numReplicates) {
+    return static_cast<int64_t>(numTxps * sizeof(uint32_t) +
+                                numWeights * sizeof(double) +
+                                numReplicates * sizeof(uint32_t));
+  }
+
+  // Account for a new class, spill if the table holds too many, and warn
+  // (once) if the classes take the run past its memory budget
+  void inserted_(size_t numTxps, size_t numWeights, uint32_t numReplicates) {
+    int64_t bytes = heapBytes_(numTxps, numWeights, numReplicates);
+    ++numClasses_;
+    // the slots beyond those reserved up front come from the table growing
+    if (++numHot_ > reserved_) {
+      bytes += slotBytes_;
+    }
+    charge_(bytes);
+    if (maxHotClasses_ > 0 and numHot_ > maxHotClasses_) {
+      // whoever gets here first spills; the others carry on (the table has
+      // room for them)
+      std::unique_lock<spin_lock> lock(spillMut_, std::try_to_lock);
+      if (lock.owns_lock() and numHot_ > maxHotClasses_) {
+        spill_(false);
+      }
+    }
+    auto& b = salmon::memory::budget();
+    if (b.exceeded() and !warnedOverBudget_.exchange(true)) {
+      logger_->warn("The {} equivalence classes (~{:.2f} GB) have taken the "
+                    "run past its memory budget of {:.2f} GB",
+                    numClasses_.load(), account_->bytes() / 1073741824.0,
+                    b.limit() / 1073741824.0);
+    }
+  }
+
+  // A run of spilled classes: where it starts in the spill file, and how
+  // many classes it holds
+  struct SpillRun {
+    uint64_t offset;
+    uint64_t numClasses;
+  };
+
+  // Reads the classes of one run back, in order
+  struct SpillCursor {
+    std::ifstream in;
+    uint64_t left;
+    std::vector<uint32_t> label;
+    std::vector<double> weights;
+    uint64_t count{0};
+    std::vector<uint32_t> reps;
+
+    SpillCursor(const std::string& path, const SpillRun& run)
+        : in(path, std::ios::binary), left(run.numClasses) {
+      in.seekg(static_cast<std::streamoff>(run.offset));
+    }
+
+    // Read the next class; false once the run is exhausted
+    bool next() {
+      if (left == 0) {
+        return false;
+      }
+      --left;
+      readVec_(label);
+      readVec_(weights);
+      in.read(reinterpret_cast<char*>(&count), sizeof(count));
+      readVec_(reps);
+      return in.good();
+    }
+
+    template <typename T> void readVec_(std::vector<T>& v) {
+      uint32_t n{0};
+      in.read(reinterpret_cast<char*>(&n), sizeof(n));
+      v.resize(n);
+      in.read(reinterpret_cast<char*>(v.data()), n * sizeof(T));
+    }
+  };
+
+  template <typename T> void writeVec_(const T* v, uint32_t n) {
+    spillOut_.write(reinterpret_cast<const char*>(&n), sizeof(n));
+    spillOut_.write(reinterpret_cast<const char*>(v), n * sizeof(T));
+  }
+
+  /**
+   * Write the classes seen least often (or, if all, every class) to a new
+   * run of the spill file, sorted by label, and drop them from the table.
+   * Everything else waits on the table meanwhile.
+   */
+  void spill_(bool all) {
+    auto lt = countMap_.lock_table();
+    if (lt.size() == 0) {
+      return;
+    }
+    // the median count: those seen no more often are spilled
+    uint64_t coldCount = std::numeric_limits<uint64_t>::max();
+    if (!all) {
+      std::vector<uint64_t> counts;
+      counts.reserve(lt.size());
+      for (auto& kv : lt) {
+        counts.push_back(kv.second.count);
+      }
+      auto mid = counts.begin() + counts.size() / 2;
+      std::nth_element(counts.begin(), mid, counts.end());
+      coldCount = *mid;
+    }
+    std::vector<std::pair<TranscriptGroup, TGValue>> cold;
+    int64_t freed{0};
+    for (auto it = lt.begin(); it != lt.end();) {
+      if (it->second.count <= coldCount) {
+        cold.emplace_back(it->first, it->second);
+        freed += heapBytes_(it->first.txps.size(), it->second.weights.size(),
+                            it->second.replicateCounts.size());
+        it = lt.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    std::vector<size_t> order(cold.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&cold](size_t i, size_t j) {
+      auto& a = cold[i].first.txps;
+      auto& b = cold[j].first.txps;
+      return std::lexicographical_compare(a.begin(), a.end(), b.begin(),
+                                          b.end());
+    });
+    SpillRun run{static_cast<uint64_t>(spillOut_.tellp()), cold.size()};
+    for (auto i : order) {
+      auto& label = cold[i].first.txps;
+      auto& v = cold[i].second;
+      writeVec_(label.data(), label.size());
+      writeVec_(v.weights.data(), v.weights.size());
+      spillOut_.write(reinterpret_cast<const char*>(&v.count),
+                      sizeof(v.count));
+      writeVec_(v.replicateCounts.data(), v.replicateCounts.size());
+    }
+    spillOut_.flush();
+    spillRuns_.push_back(run);
+    numSpilled_ += cold.size();
+    numHot_ -= cold.size();
+    charge_(-freed);
+  }
+
+  /**
+   * Call f(label, weights, count, replicateCounts) once for each distinct
+   * class of the runs, in the order of the labels, with the counts, weights
+   * and replicate counts of all of its copies summed.
+   */
+  template <typename F> void mergeRuns_(F f) {
+    std::vector<std::unique_ptr<SpillCursor>> cursors;
+    auto later = [](const SpillCursor* a, const SpillCursor* b) -> bool {
+      return b->label < a->label;
+    };
+    std::priority_queue<SpillCursor*, std::vector<SpillCursor*>,
+                        decltype(later)>
+        heap(later);
+    for (auto& run : spillRuns_) {
+      cursors.emplace_back(new SpillCursor(spillPath_, run));
+      if (cursors.back()->next()) {
+        heap.push(cursors.back().get());
+      }
+    }
+    std::vector<uint32_t> label;
+    std::vector<double> weights;
+    std::vector<uint32_t> reps;
+    while (!heap.empty()) {
+      SpillCursor* c = heap.top();
+      heap.pop();
+      std::swap(label, c->label);
+      std::swap(weights, c->weights);
+      std::swap(reps, c->reps);
+      uint64_t count = c->count;
+      if (c->next()) {
+        heap.push(c);
+      }
+      while (!heap.empty() and heap.top()->label == label) {
+        c = heap.top();
+        heap.pop();
+        count += c->count;
+        for (size_t i = 0; i < weights.size(); ++i) {
+          weights[i] += c->weights[i];
+        }
+        if (c->reps.size() > reps.size()) {
+          reps.resize(c->reps.size(), 0);
+        }
+        for (size_t r = 0; r < c->reps.size(); ++r) {
+          reps[r] += c->reps[r];
+        }
+        if (c->next()) {
+          heap.push(c);
+        }
+      }
+      f(label, weights, count, reps);
+    }
+  }
+
+  void closeSpill_() {
+    if (spillOut_.is_open()) {
+      spillOut_.close();
+      std::remove(spillPath_.c_str());
+    }
+    spillRuns_.clear();
+  }
+
+  // The (estimated) bytes that a class takes outside of its slot
+  static constexpr size_t spillClassBytes_ = 64;
+
   std::atomic<bool> active_;
+  uint32_t numReplicates_{0};
   cuckoohash_map<TranscriptGroup, TGValue, TranscriptGroupHasher> countMap_;
   std::vector<std::pair<const TranscriptGroup, TGValue>> countVec_;
+  FlatEquivalenceClasses flat_;
+  spin_lock flushMut_{"eq_class_flush"};
+  std::vector<uint64_t> localFlushes_;
   std::shared_ptr<spdlog::logger> logger_;
+  salmon::memory::Account* account_;
+  size_t reserved_{0};
+  std::atomic<size_t> numClasses_{0};
+  // the classes now in the table
+  std::atomic<size_t> numHot_{0};
+  std::atomic<int64_t> charged_{0};
+  std::atomic<bool> warnedOverBudget_{false};
+  // see spillTo(); 0 : nothing is spilled
+  size_t maxHotClasses_{0};
+  std::string spillPath_;
+  std::ofstream spillOut_;
+  std::vector<SpillRun> spillRuns_;
+  size_t numSpilled_{0};
+  spin_lock spillMut_{"eq_class_spill"};
 };
 
 #endif // EQUIVALENCE_CLASS_BUILDER_HPP
@@ -4,12 +4,15 @@
 #include <vector>
 
 class Transcript;
+class TranscriptNames;
 class SalmonOpts;
 
 class FASTAParser {
 public:
   FASTAParser(const std::string& fname);
-  void populateTargets(std::vector<Transcript>& transcripts, SalmonOpts& sopt);
+  // names are those of transcripts, whose ids are their indices
+  void populateTargets(std::vector<Transcript>& transcripts,
+                       const TranscriptNames& names, SalmonOpts& sopt);
 
 private:
   std::string fname_;
@@ -0,0 +1,146 @@
+#ifndef __FASTX_INFLATE_READER__
+#define __FASTX_INFLATE_READER__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fastx_parser {
+
+/**
+ * Reads a (plain, gzip or BGZF compressed) FASTA/Q file for the parser,
+ * decompressing it ahead of the parser on background threads.
+ *
+ * For ordinary gzip (single or multi-member) and uncompressed files, one
+ * thread inflates the stream into large buffers, so that decompression
+ * overlaps with parsing.  For BGZF files (bgzip, as written by e.g. htslib),
+ * whose blocks can be inflated independently, a reader thread splits the
+ * file into batches of blocks and a pool of inflater threads decompresses
+ * the batches in parallel; they are handed to the parser in file order.
+ *
+ * The (compressed) file itself is read ahead of both by a ReadaheadFile,
+ * which keeps several large reads in flight.
+ *
+ * At most a fixed number of batches are in flight at any time, so the
+ * memory used is bounded.  Other threads (the parser's consumers, while they
+ * wait for reads) may inflate queued BGZF batches too, with helpInflate().
+ */
+class InflateReader {
+public:
+  /**
+   * Read the file at path; an uncompressed file may also be read from the
+   * given offset (e.g. to pick up where a MappedFastqReader stopped).
+   */
+  InflateReader(const std::string& path, uint32_t numInflaters,
+                uint64_t offset = 0);
+  ~InflateReader();
+
+  /**
+   * True if the file could be opened.
+   */
+  bool good() const { return good_; }
+
+  /**
+   * True if the file is BGZF compressed (and is inflated in parallel).
+   */
+  bool isBGZF() const { return isBGZF_; }
+
+  /**
+   * Read up to len bytes of decompressed data into buf.  Like gzread(),
+   * returns the number of bytes read, 0 at the end of the file and -1 on
+   * error.
+   */
+  int read(void* buf, unsigned len);
+
+  /**
+   * Inflate the next queued BGZF batch on the calling thread; false if there
+   * is none (or the file isn't BGZF compressed).
+   */
+  bool helpInflate();
+
+private:
+  struct Batch {
+    std::vector<unsigned char> in;
+    std::vector<unsigned char> out;
+    bool ok{true};
+  };
+
+  void readGzip_();
+  void readBGZF_();
+  void inflateBatches_();
+  // Inflate the blocks of batch.in into batch.out with strm
+  void inflateBatch_(void* strm, bool zok, Batch& batch);
+  // Make the batch with the given sequence number available to read().
+  void publish_(uint64_t seq, std::unique_ptr<Batch> batch);
+  // Wait until fewer than maxInFlight_ batches have not been consumed.
+  void waitForRoom_(uint64_t seq);
+
+  std::string path_;
+  uint64_t offset_;
+  bool good_{false};
+  bool isBGZF_{false};
+  uint32_t numInflaters_;
+  size_t maxInFlight_;
+
+  std::thread producer_;
+  std::vector<std::thread> inflaters_;
+
+  std::mutex mut_;
+  std::condition_variable readyCV_; // a batch was published
+  std::condition_variable roomCV_;  // a batch was consumed
+  std::condition_variable jobsCV_;  // a batch to inflate was queued
+  std::map<uint64_t, std::unique_ptr<Batch>> ready_;
+  std::deque<std::pair<uint64_t, std::unique_ptr<Batch>>> jobs_;
+  uint64_t numBatches_{0};   // the total number, once the producer is done
+  bool producerDone_{false};
+  bool stopping_{false};
+
+  // The batch currently being read
+  uint64_t nextSeq_{0};
+  std::unique_ptr<Batch> cur_{nullptr};
+  size_t curPos_{0};
+};
+
+/**
+ * The InflateReaders that a parser's threads are reading from, so that the
+ * parser's consumers can help inflate them while they wait for reads.  When
+ * decompression is the bottleneck, the mapping threads then spend their idle
+ * time decompressing, rather than backing off; when it isn't, nothing is
+ * queued and the inflater threads sleep.  The split of the threads between
+ * decompression and mapping so follows the sample, rather than being fixed.
+ */
+class InflateHelpers {
+public:
+  void add(const std::shared_ptr<InflateReader>& r);
+  void remove(const InflateReader* r);
+
+  // Inflate one queued batch of any of the readers; false if none was queued
+  bool help();
+
+  // The number of batches inflated by help()
+  uint64_t numHelped() const { return numHelped_; }
+
+private:
+  std::mutex mut_;
+  std::vector<std::shared_ptr<InflateReader>> readers_;
+  size_t next_{0};
+  std::atomic<uint64_t> numHelped_{0};
+};
+
+/**
+ * The read function used by kseq.
+ */
+inline int inflateRead(InflateReader* r, void* buf, unsigned len) {
+  return r->read(buf, len);
+}
+} // namespace fastx_parser
+
+#endif // __FASTX_INFLATE_READER__
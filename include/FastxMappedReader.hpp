@@ -0,0 +1,71 @@
+#ifndef __FASTX_MAPPED_READER__
+#define __FASTX_MAPPED_READER__
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace fastx_parser {
+
+/**
+ * A record found by the MappedFastqReader; the name and sequence point into
+ * the mapping of the file (and are not NUL terminated).
+ */
+struct MappedRecord {
+  const char* name{nullptr};
+  size_t nameLen{0};
+  const char* seq{nullptr};
+  size_t seqLen{0};
+};
+
+/**
+ * Reads an uncompressed FASTQ file by mapping it into memory, so that the
+ * parser can hand out records that point straight into the mapping rather
+ * than copying them.  Line ends are found with memchr(), and the kernel is
+ * asked to read ahead of the records being parsed.
+ *
+ * Only records in the plain 4-line form are read this way; if next() finds
+ * anything else (e.g. multi-line records), it returns -1 and offset() is the
+ * position from which the rest of the file should be read with kseq.
+ */
+class MappedFastqReader {
+public:
+  explicit MappedFastqReader(const std::string& path);
+
+  /**
+   * True if the file is a (non-empty) uncompressed FASTQ file and could be
+   * mapped.
+   */
+  bool good() const { return data_ != nullptr; }
+
+  /**
+   * Find the next record; returns 1 if there is one, 0 at the end of the
+   * file and -1 if the next record isn't in the plain 4-line form (in which
+   * case nothing is consumed).
+   */
+  int next(MappedRecord& rec);
+
+  /**
+   * The offset of the next record to be read.
+   */
+  uint64_t offset() const { return pos_; }
+
+  /**
+   * Keeps the mapping alive (for as long as records that point into it are
+   * in use).
+   */
+  std::shared_ptr<const void> mapping() const { return mapping_; }
+
+private:
+  // Ask the kernel to read the window following pos_ (if it hasn't already)
+  void prefetch_();
+
+  std::shared_ptr<const char> mapping_;
+  const char* data_{nullptr};
+  size_t size_{0};
+  size_t pos_{0};
+  size_t prefetched_{0};
+};
+} // namespace fastx_parser
+
+#endif // __FASTX_MAPPED_READER__
@@ -7,13 +7,18 @@
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
 extern "C" {
 #include "kseq.h"
 }
 
+#include "FastxInflateReader.hpp"
 #include "concurrentqueue.h"
 
 #ifndef __FASTX_PARSER_PRECXX14_MAKE_UNIQUE__
@@ -70,6 +75,66 @@ typename _Unique_if<T>::_Known_bound make_unique(Args&&...) = delete;
     ReadSeq second;
   };
 
+  /**
+   * A field (the sequence or the name) of a record, held as a span of either
+   * the buffer of the ReadChunk that the record belongs to or the mapping of
+   * an uncompressed input file.  The field is not NUL terminated.  A span is
+   * only valid while the chunk holding it is.
+   */
+  class StrSpan {
+  public:
+    StrSpan() = default;
+    // A span of (memory that outlives the chunk, e.g.) a mapped file
+    StrSpan(const char* data, size_t len) : data_(data), len_(len) {}
+    // A span of the chunk's buffer, which is given its address by
+    // resolve() once the chunk has been filled
+    StrSpan(size_t offset, size_t len) : offset_(offset), len_(len) {}
+    inline void resolve(const char* base) {
+      if (data_ == nullptr) {
+        data_ = base + offset_;
+      }
+    }
+    inline const char* data() const { return data_; }
+    inline size_t size() const { return len_; }
+    inline size_t length() const { return len_; }
+    inline bool empty() const { return len_ == 0; }
+    inline char operator[](size_t i) const { return data_[i]; }
+    inline const char* begin() const { return data_; }
+    inline const char* end() const { return data_ + len_; }
+    inline std::string str() const { return std::string(data_, len_); }
+    // Copy the field into s (reusing the capacity of s)
+    inline void assignTo(std::string& s) const { s.assign(data_, len_); }
+
+  private:
+    const char* data_{nullptr};
+    size_t offset_{0};
+    size_t len_{0};
+  };
+
+  inline std::ostream& operator<<(std::ostream& os, const StrSpan& s) {
+    return os.write(s.data(), s.size());
+  }
+
+  /**
+   * The span form of ReadSeq / ReadPair; the parser appends the fields of
+   * every record of a chunk to the chunk's buffer (or, for uncompressed
+   * FASTQ, points them straight into the mapped file) and just records where
+   * they are, rather than copying them into strings of their own.
+   */
+  struct ReadSpanSeq {
+    StrSpan seq;
+    StrSpan name;
+  };
+
+  struct ReadSpanPair {
+    ReadSpanSeq first;
+    ReadSpanSeq second;
+  };
+
+  template <typename T> struct IsPaired : std::false_type {};
+  template <> struct IsPaired<ReadPair> : std::true_type {};
+  template <> struct IsPaired<ReadSpanPair> : std::true_type {};
+
   template <typename T> class ReadChunk {
   public:
     ReadChunk(size_t want) : group_(want), want_(want), have_(want) {}
@@ -79,9 +144,22 @@ typename _Unique_if<T>::_Known_bound make_unique(Args&&...) = delete;
     T& operator[](size_t i) { return group_[i]; }
     typename std::vector<T>::iterator begin() { return group_.begin(); }
     typename std::vector<T>::iterator end() { return group_.begin() + have_; }
+    // The storage of the fields of span records (unused by ReadSeq records)
+    std::string& buffer() { return buffer_; }
+    // Keep the (mapped) storage of the records alive while they're in use
+    void hold(std::shared_ptr<const void> storage) {
+      held_.push_back(std::move(storage));
+    }
+    // Forget the records' storage before the chunk is filled again
+    void clearStorage() {
+      buffer_.clear();
+      held_.clear();
+    }
 
   private:
     std::vector<T> group_;
+    std::string buffer_;
+    std::vector<std::shared_ptr<const void>> held_;
     size_t want_;
     size_t have_;
   };
@@ -113,14 +191,44 @@ typename _Unique_if<T>::_Known_bound make_unique(Args&&...) = delete;
     moodycamel::ConsumerToken ct_;
   };
 
+  /**
+   * How the parsing threads and the consumers have waited on each other; if
+   * the consumers wait for reads (and few chunks are ready when they ask for
+   * more), parsing is the bottleneck, if the parsers wait for free chunks,
+   * the consumers are.
+   */
+  struct ParserStats {
+    // the number of filled chunks handed to the consumers
+    uint64_t numChunks{0};
+    // the mean number of filled chunks ready when a consumer asked for one
+    double meanReadyChunks{0.0};
+    // the total time the consumers spent waiting for filled chunks
+    double consumerWaitSeconds{0.0};
+    // the total time the parsing threads spent waiting for free chunks
+    double parserWaitSeconds{0.0};
+    // the number of BGZF batches the consumers inflated while they waited
+    uint64_t numHelpedBatches{0};
+  };
+
   template <typename T> class FastxParser {
   public:
+    /**
+     * Chunks hold at most chunkSize records; if maxChunkBytes is non-zero,
+     * a chunk is also handed off once the sequences and names of its records
+     * reach maxChunkBytes, so that chunks of long reads stay small.
+     */
     FastxParser(std::vector<std::string> files, uint32_t numConsumers,
-                uint32_t numParsers = 1, uint32_t chunkSize = 1000);
+                uint32_t numParsers = 1, uint32_t chunkSize = 1000,
+                size_t maxChunkBytes = 0);
 
+    /**
+     * The paired-end parser reads the #1 mates from files[i] and the #2
+     * mates from files2[i]; if files2[i] is empty, files[i] holds interleaved
+     * pairs instead (each #1 mate followed by its #2 mate).
+     */
     FastxParser(std::vector<std::string> files, std::vector<std::string> files2,
                 uint32_t numConsumers, uint32_t numParsers = 1,
-                uint32_t chunkSize = 1000);
+                uint32_t chunkSize = 1000, size_t maxChunkBytes = 0);
 
     ~FastxParser();
     bool start();
@@ -128,6 +236,25 @@ typename _Unique_if<T>::_Known_bound make_unique(Args&&...) = delete;
     ReadGroup<T> getReadGroup();
     bool refill(ReadGroup<T>& rg);
     void finishedWithGroup(ReadGroup<T>& s);
+    ParserStats stats() const;
+    // The (approximate) number of filled chunks waiting for the consumers
+    size_t numReadyChunks() const { return readQueue_.size_approx(); }
+    /**
+     * Drop the first n records (pairs) rather than handing them out (when
+     * resuming from a checkpoint); must be called before start().
+     */
+    void skipRecords(uint64_t n) { toSkip_ = n; }
+    /**
+     * Hand out only about `fraction` of the records (pairs): those whose
+     * (first mate's) name hashes, under `seed`, below the fraction of the
+     * hash range, so that the same records are chosen whenever the same
+     * input is subsampled with the same seed.  The others are dropped as soon
+     * as their name is found, before anything is copied; must be called
+     * before start().
+     */
+    void subsample(double fraction, uint64_t seed);
+    // The number of records (pairs) left out by subsample()
+    uint64_t numSubsampledOut() const { return numSubsampledOut_; }
 
   private:
     moodycamel::ProducerToken getProducerToken_();
@@ -136,6 +263,8 @@ typename _Unique_if<T>::_Known_bound make_unique(Args&&...) = delete;
     std::vector<std::string> inputStreams_;
     std::vector<std::string> inputStreams2_;
     uint32_t numParsers_;
+    // the number of inflater threads used for each (BGZF) input stream
+    uint32_t numInflaters_;
     std::atomic<uint32_t> numParsing_;
 
     // NOTE: Would like to use std::future<int> here instead, but that
@@ -149,6 +278,7 @@ typename _Unique_if<T>::_Known_bound make_unique(Args&&...) = delete;
     std::vector<int> threadResults_;
 
     size_t blockSize_;
+    size_t maxChunkBytes_;
     moodycamel::ConcurrentQueue<std::unique_ptr<ReadChunk<T>>> readQueue_,
         seqContainerQueue_;
 
@@ -158,6 +288,21 @@ typename _Unique_if<T>::_Known_bound make_unique(Args&&...) = delete;
     std::vector<std::unique_ptr<moodycamel::ProducerToken>> produceReads_;
     std::vector<std::unique_ptr<moodycamel::ConsumerToken>> consumeContainers_;
     bool isActive_{false};
+
+    // see ParserStats
+    std::atomic<uint64_t> numChunks_{0};
+    std::atomic<uint64_t> numRefills_{0};
+    std::atomic<uint64_t> readyChunkSum_{0};
+    std::atomic<uint64_t> consumerWaitNs_{0};
+    std::atomic<uint64_t> parserWaitNs_{0};
+    // the inputs being inflated, which the waiting consumers help with
+    InflateHelpers inflateHelpers_;
+    // see skipRecords()
+    std::atomic<uint64_t> toSkip_{0};
+    // see subsample(); the records are kept if their hash is below keepBelow_
+    uint64_t keepBelow_{std::numeric_limits<uint64_t>::max()};
+    uint64_t sampleSeed_{0};
+    std::atomic<uint64_t> numSubsampledOut_{0};
   };
 } // namespace fastx_parser
 #endif // __FASTX_PARSER__
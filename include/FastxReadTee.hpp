@@ -0,0 +1,86 @@
+#ifndef __FASTX_READ_TEE__
+#define __FASTX_READ_TEE__
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fastx_parser {
+
+/**
+ * Reads a (plain, gzip or BGZF compressed, local or remote) FASTA/Q file
+ * once, for several readers, each of which reads the decompressed file from
+ * a file descriptor of its own (the write end of a pipe): salmon quant with
+ * several indices quantifies the reads against each in a process of its
+ * own, and all of them are fed from the one pass over each read file.
+ *
+ * The file is decompressed (by an InflateReader) into blocks, which a
+ * thread per reader writes to its descriptor.  The readers may go at
+ * different speeds, but the blocks are only kept until the slowest has been
+ * given them, so the fastest is held back to at most maxLagBytes ahead of
+ * it.  A process that reads the mates of a pair from two tees must read
+ * both in step to within less than maxLagBytes (the parser does, to within
+ * what it reads ahead), or the two tees could each wait on a process that is
+ * waiting on the other.
+ *
+ * A reader that closes its end early is dropped (and counted), rather than
+ * holding the others back.  Each descriptor is closed once its reader has
+ * been given the whole file.
+ */
+class ReadTee {
+public:
+  static constexpr size_t blockSize = size_t(1) << 22;
+  static constexpr size_t defaultMaxLagBytes = size_t(1) << 28;
+
+  ReadTee(const std::string& path, std::vector<int> fds,
+          size_t maxLagBytes = defaultMaxLagBytes);
+  ~ReadTee();
+
+  ReadTee(const ReadTee&) = delete;
+  ReadTee& operator=(const ReadTee&) = delete;
+
+  /**
+   * Wait until the whole file has been written to every reader; true if it
+   * could be read (and decompressed) in full.
+   */
+  bool finish();
+
+  // The number of readers that closed their ends before the end of the file
+  size_t numDropped() const;
+
+private:
+  using Block = std::shared_ptr<const std::vector<char>>;
+
+  void read_();
+  void write_(size_t reader);
+  // Drop the blocks that every reader has been given (with mut_ held)
+  void trim_();
+
+  std::string path_;
+  std::vector<int> fds_;
+  size_t maxBlocks_;
+
+  mutable std::mutex mut_;
+  std::condition_variable cv_;
+  // blocks_[i] is block firstBlock_ + i of the file
+  std::deque<Block> blocks_;
+  uint64_t firstBlock_{0};
+  // The next block that each reader is to be given (~0 once it's dropped)
+  std::vector<uint64_t> next_;
+  bool atEnd_{false};
+  bool ok_{true};
+  size_t numDropped_{0};
+
+  std::thread reader_;
+  std::vector<std::thread> writers_;
+  bool finished_{false};
+};
+
+} // namespace fastx_parser
+
+#endif // __FASTX_READ_TEE__
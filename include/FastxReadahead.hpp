@@ -0,0 +1,118 @@
+#ifndef __FASTX_READAHEAD__
+#define __FASTX_READAHEAD__
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fastx_parser {
+
+/**
+ * True if path is the URL of a remote object (http://, https:// or s3://),
+ * which a ReadaheadFile reads with ranged GETs, rather than a local path.
+ */
+bool isRemotePath(const std::string& path);
+
+/**
+ * Reads a file ahead of its (one) consumer, keeping several large reads in
+ * flight at once, so that on storage with a high latency (e.g. a network
+ * block device) the consumer finds the data already read, rather than
+ * waiting out one small read after another.
+ *
+ * A regular file is read in chunks by a small pool of threads, each reading
+ * its own chunk with pread(), up to maxInFlight chunks ahead of the
+ * consumer; the chunks are handed to the consumer in file order.  A stream
+ * (stdin, a named pipe or process substitution) can only be read in order,
+ * so a single thread reads it ahead.
+ *
+ * A remote object is read the same way as a regular file, with each chunk
+ * (of at least remoteChunkSize bytes) fetched by a ranged GET, which a
+ * fetcher runs with curl.  An s3:// URL is read over https, from
+ * $SALMON_S3_ENDPOINT (path-style, for an S3-compatible store) if that is
+ * set, or else from AWS; a private object can be read through a presigned
+ * https:// URL.
+ */
+class ReadaheadFile {
+public:
+  /**
+   * Read the file at path, from the given offset on.
+   */
+  ReadaheadFile(const std::string& path, uint64_t offset = 0,
+                size_t chunkSize = size_t(1) << 22, uint32_t numFetchers = 4,
+                size_t maxInFlight = 8);
+  ~ReadaheadFile();
+
+  ReadaheadFile(const ReadaheadFile&) = delete;
+  ReadaheadFile& operator=(const ReadaheadFile&) = delete;
+
+  // The smallest chunk in which a remote object is fetched
+  static constexpr size_t remoteChunkSize = size_t(1) << 24;
+
+  /**
+   * True if the file could be opened (or, for a remote object, its size
+   * could be found).
+   */
+  bool good() const { return good_; }
+
+  /**
+   * Point data at the next chunk of the file, of len bytes, which stays
+   * valid until the next call to next() or read().  Returns false at the end
+   * of the file, or on error (see failed()).
+   */
+  bool next(const unsigned char*& data, size_t& len);
+
+  /**
+   * Read up to len bytes into buf.  Like fread(), fewer bytes are read only
+   * at the end of the file or on error.
+   */
+  size_t read(void* buf, size_t len);
+
+  /**
+   * True if a read failed.
+   */
+  bool failed() const { return failed_; }
+
+private:
+  struct Chunk {
+    std::vector<unsigned char> data;
+    bool ok{true};
+  };
+
+  void fetch_();
+  // Fill chunk with the (chunkSize_ bytes of the) chunk seq of the file
+  void readChunk_(uint64_t seq, Chunk& chunk);
+
+  bool good_{false};
+  int fd_{-1};
+  bool isStream_{false};
+  // For a remote object, its (http) URL and size
+  std::string url_;
+  uint64_t remoteSize_{0};
+  uint64_t offset_;
+  size_t chunkSize_;
+  size_t maxInFlight_;
+  std::vector<std::thread> fetchers_;
+
+  std::mutex mut_;
+  std::condition_variable readyCV_; // a chunk was read
+  std::condition_variable roomCV_;  // a chunk was consumed
+  std::map<uint64_t, std::unique_ptr<Chunk>> ready_;
+  uint64_t nextFetch_{0}; // the next chunk to be read by a fetcher
+  // The number of chunks, once a fetcher has found the end of the file
+  uint64_t numChunks_{UINT64_MAX};
+  bool stopping_{false};
+
+  // The chunk currently being consumed
+  uint64_t nextSeq_{0};
+  std::unique_ptr<Chunk> cur_{nullptr};
+  size_t curPos_{0};
+  bool failed_{false};
+};
+} // namespace fastx_parser
+
+#endif // __FASTX_READAHEAD__
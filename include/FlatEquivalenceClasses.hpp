@@ -0,0 +1,413 @@
+#ifndef FLAT_EQUIVALENCE_CLASSES_HPP
+#define FLAT_EQUIVALENCE_CLASSES_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+#include "tbb/parallel_sort.h"
+
+#include "TranscriptGroup.hpp"
+
+/**
+ * A flat (CSR-style) representation of the equivalence classes, used by the
+ * offline inference algorithms (EM / VBEM / bootstrapping / Gibbs sampling).
+ * The labels and weights of all classes are stored contiguously, so that
+ * iterating over the classes does not require chasing a pointer for every
+ * class.
+ *
+ * The transcripts of class i are txps[offsets[i]] ... txps[offsets[i+1] - 1],
+ * and the corresponding auxiliary and combined weights live at the same
+ * positions of weights and combinedWeights.  Note that, if range
+ * factorization is used, the range bins that are part of the class key are
+ * *not* stored here; only the transcripts themselves are.
+ */
+struct FlatEquivalenceClasses {
+  /**
+   * Build the flat representation from the equivalence classes in `eqVec`.
+   * Class i of the flat representation corresponds to eqVec[i].  The
+   * combined weights are allocated, but left for the inference algorithm to
+   * fill in.  With numReplicates > 0, the counts of each class in the online
+   * bootstrap replicates are kept as well.
+   */
+  template <typename EqVecT>
+  void build(const EqVecT& eqVec, uint32_t numReplicatesIn = 0) {
+    clear();
+    numReplicates = numReplicatesIn;
+    size_t numClasses = eqVec.size();
+    size_t totalSize{0};
+    for (auto& kv : eqVec) {
+      totalSize += kv.second.weights.size();
+    }
+
+    offsets.reserve(numClasses + 1);
+    txps.reserve(totalSize);
+    weights.reserve(totalSize);
+    counts.reserve(numClasses);
+    valid.reserve(numClasses);
+    replicateCounts.reserve(numClasses * numReplicates);
+
+    offsets.push_back(0);
+    for (auto& kv : eqVec) {
+      const TranscriptGroup& tg = kv.first;
+      size_t groupSize = kv.second.weights.size();
+      txps.insert(txps.end(), tg.txps.begin(), tg.txps.begin() + groupSize);
+      weights.insert(weights.end(), kv.second.weights.begin(),
+                     kv.second.weights.end());
+      counts.push_back(kv.second.count);
+      valid.push_back(tg.valid ? 1 : 0);
+      offsets.push_back(txps.size());
+      const auto& rc = kv.second.replicateCounts;
+      for (uint32_t r = 0; r < numReplicates; ++r) {
+        replicateCounts.push_back(r < rc.size() ? rc[r] : 0);
+      }
+    }
+    combinedWeights.assign(totalSize, 0.0);
+  }
+
+  /**
+   * Return a copy of these equivalence classes containing only the valid
+   * classes.
+   */
+  FlatEquivalenceClasses validClasses() const {
+    FlatEquivalenceClasses r;
+    r.numReplicates = numReplicates;
+    r.offsets.push_back(0);
+    for (size_t i = 0; i < numClasses(); ++i) {
+      if (!valid[i]) {
+        continue;
+      }
+      auto b = offsets[i];
+      auto e = offsets[i + 1];
+      r.txps.insert(r.txps.end(), txps.begin() + b, txps.begin() + e);
+      r.weights.insert(r.weights.end(), weights.begin() + b,
+                       weights.begin() + e);
+      r.combinedWeights.insert(r.combinedWeights.end(),
+                               combinedWeights.begin() + b,
+                               combinedWeights.begin() + e);
+      r.counts.push_back(counts[i]);
+      r.replicateCounts.insert(
+          r.replicateCounts.end(),
+          replicateCounts.begin() + i * numReplicates,
+          replicateCounts.begin() + (i + 1) * numReplicates);
+      r.valid.push_back(1);
+      r.offsets.push_back(r.txps.size());
+    }
+    return r;
+  }
+
+  /**
+   * Targeted quantification: keep only the valid classes of the connected
+   * components (of the transcripts linked by sharing a class) that hold one
+   * of `targets`, and mark the other classes invalid.  inTarget[t] is set
+   * (over numTranscripts transcripts) for the transcripts of the kept
+   * components, and the targets themselves.  Returns the number of
+   * fragments in the classes that were dropped.
+   */
+  uint64_t restrictToTargets(const std::vector<uint32_t>& targets,
+                             size_t numTranscripts,
+                             std::vector<bool>& inTarget) {
+    std::vector<uint32_t> parent(numTranscripts);
+    for (size_t t = 0; t < numTranscripts; ++t) {
+      parent[t] = static_cast<uint32_t>(t);
+    }
+    auto find = [&parent](uint32_t x) -> uint32_t {
+      while (parent[x] != x) {
+        parent[x] = parent[parent[x]];
+        x = parent[x];
+      }
+      return x;
+    };
+    for (size_t i = 0; i < numClasses(); ++i) {
+      if (!valid[i]) {
+        continue;
+      }
+      uint32_t r = find(txps[offsets[i]]);
+      for (auto j = offsets[i] + 1; j < offsets[i + 1]; ++j) {
+        uint32_t r2 = find(txps[j]);
+        if (r2 != r) {
+          parent[r2] = r;
+        }
+      }
+    }
+
+    std::vector<bool> targetRoot(numTranscripts, false);
+    for (auto t : targets) {
+      if (t < numTranscripts) {
+        targetRoot[find(t)] = true;
+      }
+    }
+    inTarget.assign(numTranscripts, false);
+    for (size_t t = 0; t < numTranscripts; ++t) {
+      inTarget[t] = targetRoot[find(static_cast<uint32_t>(t))];
+    }
+
+    uint64_t numDropped{0};
+    for (size_t i = 0; i < numClasses(); ++i) {
+      if (valid[i] and !inTarget[txps[offsets[i]]]) {
+        valid[i] = 0;
+        numDropped += counts[i];
+      }
+    }
+    return numDropped;
+  }
+
+  /**
+   * The gene-level counterpart of these classes, for txpGene[t] the gene of
+   * transcript t: the label of each valid class becomes the genes of its
+   * transcripts, in increasing order, and the combined weight of a gene is
+   * the sum, over its transcripts in the class, of their combined weight
+   * times withinGene[t] (the share of its gene's abundance that transcript t
+   * is taken to have).  With these weights, an EM over the genes is the EM
+   * over the transcripts with their shares of each gene held fixed.
+   *
+   * A class whose transcripts all belong to one gene gives its gene all of
+   * its fragments whatever the weights, so it gets a weight of 1, and
+   * compact() then merges all such classes of a gene into one (as it does
+   * any identical multi-gene classes).  The combined weights of this object
+   * must have been filled in.  The replicate counts aren't kept.
+   */
+  FlatEquivalenceClasses
+  collapseToGenes(const std::vector<uint32_t>& txpGene,
+                  const std::vector<double>& withinGene) const {
+    FlatEquivalenceClasses r;
+    r.offsets.push_back(0);
+    std::vector<std::pair<uint32_t, double>> members;
+    for (size_t i = 0; i < numClasses(); ++i) {
+      if (!valid[i]) {
+        continue;
+      }
+      members.clear();
+      for (auto j = offsets[i]; j < offsets[i + 1]; ++j) {
+        auto t = txps[j];
+        members.emplace_back(txpGene[t], combinedWeights[j] * withinGene[t]);
+      }
+      std::sort(members.begin(), members.end(),
+                [](const std::pair<uint32_t, double>& a,
+                   const std::pair<uint32_t, double>& b) {
+                  return a.first < b.first;
+                });
+      size_t start = r.txps.size();
+      for (auto& m : members) {
+        if (r.txps.size() > start and r.txps.back() == m.first) {
+          r.weights.back() += m.second;
+        } else {
+          r.txps.push_back(m.first);
+          r.weights.push_back(m.second);
+        }
+      }
+      if (r.txps.size() - start == 1) {
+        r.weights.back() = 1.0;
+      }
+      r.counts.push_back(counts[i]);
+      r.valid.push_back(1);
+      r.offsets.push_back(r.txps.size());
+    }
+    r.combinedWeights = r.weights;
+    r.compact();
+    return r;
+  }
+
+  /**
+   * What compact() did: the number of invalid or empty classes it dropped,
+   * and the number of classes it merged into an identical one.
+   */
+  struct Compaction {
+    size_t numDropped{0};
+    size_t numMerged{0};
+  };
+
+  /**
+   * Physically remove the invalid classes and those with no fragments, and
+   * merge the classes that have the same transcripts, in the same order,
+   * with the same auxiliary weights (e.g. classes that differ only in their
+   * range bins), adding up their counts; the (VB)EM treats such classes
+   * exactly as one.  The remaining classes keep their relative order and are
+   * renumbered, and all of them are valid, so that the passes over the
+   * classes that follow need not check.  Class i no longer corresponds to
+   * the i-th class the flat representation was built from.
+   */
+  Compaction compact() {
+    typedef tbb::blocked_range<size_t> Range;
+    size_t n = numClasses();
+    Compaction r;
+
+    // Hash the label and weights of each class that is kept, and sort the
+    // kept classes by hash, so that the duplicates of a class are found in
+    // the run of classes that share its hash.
+    std::vector<uint64_t> hashes(n, 0);
+    tbb::parallel_for(Range(0, n), [this, &hashes](const Range& range) {
+      for (size_t i = range.begin(); i != range.end(); ++i) {
+        hashes[i] = classHash_(i);
+      }
+    });
+    std::vector<uint32_t> sorted;
+    sorted.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+      if (valid[i] and counts[i] > 0) {
+        sorted.push_back(static_cast<uint32_t>(i));
+      } else {
+        ++r.numDropped;
+      }
+    }
+    tbb::parallel_sort(sorted.begin(), sorted.end(),
+                       [&hashes](uint32_t a, uint32_t b) {
+                         return hashes[a] < hashes[b] or
+                                (hashes[a] == hashes[b] and a < b);
+                       });
+
+    // rep[i] is the (first) class that class i is merged into (i itself if
+    // class i is kept as is, and n if it is dropped)
+    const uint32_t dropped = static_cast<uint32_t>(n);
+    std::vector<uint32_t> rep(n, dropped);
+    for (size_t b = 0, e = 0; b < sorted.size(); b = e) {
+      e = b + 1;
+      while (e < sorted.size() and hashes[sorted[e]] == hashes[sorted[b]]) {
+        ++e;
+      }
+      for (size_t k = b; k < e; ++k) {
+        uint32_t i = sorted[k];
+        rep[i] = i;
+        for (size_t j = b; j < k; ++j) {
+          uint32_t c = sorted[j];
+          if (rep[c] == c and sameClass_(c, i)) {
+            rep[i] = c;
+            ++r.numMerged;
+            break;
+          }
+        }
+      }
+    }
+    std::vector<uint32_t>().swap(sorted);
+    std::vector<uint64_t>().swap(hashes);
+    if (r.numDropped == 0 and r.numMerged == 0) {
+      return r;
+    }
+
+    // Renumber the classes that are kept, and add up the counts of those
+    // merged into them
+    std::vector<uint32_t> newID(n, dropped);
+    std::vector<uint64_t> newOffsets{0};
+    std::vector<uint64_t> newCounts;
+    std::vector<uint32_t> newReplicateCounts;
+    for (size_t i = 0; i < n; ++i) {
+      if (rep[i] == i) {
+        newID[i] = static_cast<uint32_t>(newCounts.size());
+        newOffsets.push_back(newOffsets.back() + classSize(i));
+        newCounts.push_back(0);
+        newReplicateCounts.resize(newReplicateCounts.size() + numReplicates,
+                                  0);
+      }
+      if (rep[i] != dropped) {
+        uint32_t k = newID[rep[i]];
+        newCounts[k] += counts[i];
+        for (uint32_t b = 0; b < numReplicates; ++b) {
+          newReplicateCounts[k * numReplicates + b] +=
+              replicateCounts[i * numReplicates + b];
+        }
+      }
+    }
+
+    // Move the members of the kept classes into place, in parallel
+    size_t total = newOffsets.back();
+    std::vector<uint32_t> newTxps(total);
+    std::vector<double> newWeights(total);
+    std::vector<double> newCombined(combinedWeights.empty() ? 0 : total);
+    tbb::parallel_for(Range(0, n), [&](const Range& range) {
+      for (size_t i = range.begin(); i != range.end(); ++i) {
+        if (rep[i] != i) {
+          continue;
+        }
+        auto b = offsets[i];
+        auto e = offsets[i + 1];
+        auto to = newOffsets[newID[i]];
+        std::copy(txps.begin() + b, txps.begin() + e, newTxps.begin() + to);
+        std::copy(weights.begin() + b, weights.begin() + e,
+                  newWeights.begin() + to);
+        if (!newCombined.empty()) {
+          std::copy(combinedWeights.begin() + b, combinedWeights.begin() + e,
+                    newCombined.begin() + to);
+        }
+      }
+    });
+
+    offsets.swap(newOffsets);
+    txps.swap(newTxps);
+    weights.swap(newWeights);
+    combinedWeights.swap(newCombined);
+    counts.swap(newCounts);
+    replicateCounts.swap(newReplicateCounts);
+    valid.assign(counts.size(), 1);
+    return r;
+  }
+
+  void clear() {
+    offsets.clear();
+    txps.clear();
+    weights.clear();
+    combinedWeights.clear();
+    counts.clear();
+    valid.clear();
+    replicateCounts.clear();
+    numReplicates = 0;
+  }
+
+  inline size_t numClasses() const { return counts.size(); }
+  inline size_t classSize(size_t i) const {
+    return offsets[i + 1] - offsets[i];
+  }
+
+  // offsets[i] is the start of class i; has numClasses() + 1 entries
+  std::vector<uint64_t> offsets;
+  // the transcripts
+  std::vector<uint32_t> txps;
+  // the auxiliary (conditional) weights
+  std::vector<double> weights;
+  // The combined auxiliary and position weights.  These
+  // are filled in by the inference algorithm.
+  std::vector<double> combinedWeights;
+  // the number of fragments in each class
+  std::vector<uint64_t> counts;
+  // 1 if the class is non-degenerate, 0 otherwise
+  std::vector<uint8_t> valid;
+  // With online bootstraps, the count of class i in replicate r is
+  // replicateCounts[i * numReplicates + r]
+  uint32_t numReplicates{0};
+  std::vector<uint32_t> replicateCounts;
+
+private:
+  // A hash of the transcripts and auxiliary weights of class i
+  uint64_t classHash_(size_t i) const {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    auto mix = [&h](uint64_t v) {
+      h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    };
+    for (auto j = offsets[i]; j < offsets[i + 1]; ++j) {
+      uint64_t w;
+      std::memcpy(&w, &weights[j], sizeof(w));
+      mix(txps[j]);
+      mix(w);
+    }
+    return h;
+  }
+
+  // True if classes a and b have the same transcripts and auxiliary weights
+  bool sameClass_(size_t a, size_t b) const {
+    size_t len = classSize(a);
+    if (len != classSize(b)) {
+      return false;
+    }
+    auto ia = offsets[a];
+    auto ib = offsets[b];
+    return std::equal(txps.begin() + ia, txps.begin() + ia + len,
+                      txps.begin() + ib) and
+           std::equal(weights.begin() + ia, weights.begin() + ia + len,
+                      weights.begin() + ib);
+  }
+};
+
+#endif // FLAT_EQUIVALENCE_CLASSES_HPP
@@ -1,58 +1,58 @@
 #ifndef __FORGETTING_MASS_CALCULATOR__
 #define __FORGETTING_MASS_CALCULATOR__
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+
 #include "SalmonMath.hpp"
-#include "SalmonSpinLock.hpp"
 #include "spdlog/spdlog.h"
 
+/**
+ * Issues the mini-batch timesteps of the online phase and the log forgetting
+ * masses that go with them.  The mapping threads ask for a timestep for
+ * every mini-batch, so this takes no lock: the timesteps are handed out with
+ * an atomic fetch-add, and the masses are kept in fixed-size chunks, each
+ * computed in full by the first thread to need it and published with a
+ * compare-and-swap (a thread that loses the race throws its copy away).
+ * Published chunks never move or change, so the masses (and cumulative
+ * masses) of any timestep that has been issued are read without locking.
+ */
 class ForgettingMassCalculator {
 public:
   ForgettingMassCalculator(double forgettingFactor = 0.65)
-      : batchNum_(0), forgettingFactor_(forgettingFactor),
-        logForgettingMass_(salmon::math::LOG_1), logForgettingMasses_({}),
-        cumulativeLogForgettingMasses_({}) {}
+      : batchNum_(0), forgettingFactor_(forgettingFactor), prefilled_(1) {
+    for (auto& c : chunks_) {
+      c.store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  ~ForgettingMassCalculator() {
+    for (auto& c : chunks_) {
+      delete c.load(std::memory_order_relaxed);
+    }
+  }
 
   ForgettingMassCalculator(const ForgettingMassCalculator&) = delete;
-  ForgettingMassCalculator(ForgettingMassCalculator&&) = default;
-  ForgettingMassCalculator& operator=(ForgettingMassCalculator&&) = default;
   ForgettingMassCalculator& operator=(const ForgettingMassCalculator&) = delete;
 
   /** Precompute the log(forgetting mass) and cumulative log(forgetting mass)
    * for the first numMiniBatches batches / timesteps.
    */
   bool prefill(uint64_t numMiniBatches) {
-    logForgettingMasses_.reserve(numMiniBatches);
-    cumulativeLogForgettingMasses_.reserve(numMiniBatches);
-
-    double fm = salmon::math::LOG_1;
-    logForgettingMasses_.push_back(fm);
-    cumulativeLogForgettingMasses_.push_back(fm);
-
-    for (size_t i = 2; i < numMiniBatches - 1; ++i) {
-      fm += forgettingFactor_ * std::log(static_cast<double>(i - 1)) -
-            std::log(std::pow(static_cast<double>(i), forgettingFactor_) - 1);
-      logForgettingMasses_.push_back(fm);
-      // fill in cumulative mass
-      cumulativeLogForgettingMasses_.push_back(
-          salmon::math::logAdd(cumulativeLogForgettingMasses_.back(), fm));
-    }
-    return true;
+    // (the prefilled masses are those of timesteps 0 ... numMiniBatches - 3)
+    prefilled_ = std::max(numMiniBatches, uint64_t(3)) - 2;
+    return ensureComputed_(prefilled_ - 1);
   }
 
   double operator()() {
-#if defined __APPLE__
-    spin_lock::scoped_lock sl(ffMutex_);
-#else
-    std::lock_guard<std::mutex> lock(ffMutex_);
-#endif
-    ++batchNum_;
-    if (batchNum_ > 1) {
-      logForgettingMass_ +=
-          forgettingFactor_ * std::log(static_cast<double>(batchNum_ - 1)) -
-          std::log(std::pow(static_cast<double>(batchNum_), forgettingFactor_) -
-                   1);
-    }
-    return logForgettingMass_;
+    double logForgettingMass{salmon::math::LOG_1};
+    uint64_t timestep{0};
+    getLogMassAndTimestep(logForgettingMass, timestep);
+    return logForgettingMass;
   }
 
   /**
@@ -63,38 +63,46 @@ public:
    */
   void getLogMassAndTimestep(double& logForgettingMass,
                              uint64_t& currentMinibatchTimestep) {
-#if defined __APPLE__
-    spin_lock::scoped_lock sl(ffMutex_);
-#else
-    std::lock_guard<std::mutex> lock(ffMutex_);
-#endif
-    if (batchNum_ < logForgettingMasses_.size()) {
-      currentMinibatchTimestep = batchNum_;
-      logForgettingMass = logForgettingMasses_[batchNum_];
-      ++batchNum_;
-    } else {
-      double fm =
-          logForgettingMasses_.back() +
-          forgettingFactor_ * std::log(static_cast<double>(batchNum_ - 1)) -
-          std::log(std::pow(static_cast<double>(batchNum_), forgettingFactor_) -
-                   1);
-
-      logForgettingMasses_.push_back(fm);
-      cumulativeLogForgettingMasses_.push_back(
-          salmon::math::logAdd(cumulativeLogForgettingMasses_.back(), fm));
-
-      currentMinibatchTimestep = batchNum_;
-      logForgettingMass = logForgettingMasses_[batchNum_];
-      ++batchNum_;
+    currentMinibatchTimestep =
+        batchNum_.fetch_add(1, std::memory_order_relaxed);
+    if (!ensureComputed_(currentMinibatchTimestep)) {
+      tooManyTimesteps_(currentMinibatchTimestep);
     }
+    logForgettingMass = logMassAt(currentMinibatchTimestep);
+  }
+
+  /**
+   * As getLogMassAndTimestep, for a mini-batch that takes numTimesteps
+   * consecutive timesteps (see numTimesteps in MiniBatchSizer.hpp): its
+   * mass is the mean of theirs, so that it carries as much as that many
+   * mini-batches of one timestep would, and firstTimestep is the first.
+   */
+  void getLogMassAndTimesteps(uint64_t numTimesteps, double& logForgettingMass,
+                              uint64_t& firstTimestep) {
+    if (numTimesteps <= 1) {
+      getLogMassAndTimestep(logForgettingMass, firstTimestep);
+      return;
+    }
+    firstTimestep =
+        batchNum_.fetch_add(numTimesteps, std::memory_order_relaxed);
+    uint64_t lastTimestep = firstTimestep + numTimesteps - 1;
+    if (!ensureComputed_(lastTimestep)) {
+      tooManyTimesteps_(lastTimestep);
+    }
+    double logMass{salmon::math::LOG_0};
+    for (uint64_t t = firstTimestep; t <= lastTimestep; ++t) {
+      logMass = salmon::math::logAdd(logMass, logMassAt(t));
+    }
+    logForgettingMass = logMass - std::log(static_cast<double>(numTimesteps));
   }
 
   // Retrieve the log(forgetting mass) at a particular timestep.  This
   // function assumes that the forgetting mass has already been computed
   // for this timestep --- otherwise, this will result in a fatal error.
   double logMassAt(uint64_t timestep) {
-    if (timestep < logForgettingMasses_.size()) {
-      return logForgettingMasses_[timestep];
+    const Chunk* c = chunkOf_(timestep);
+    if (c != nullptr) {
+      return c->logMass[timestep & (chunkSize_ - 1)];
     } else {
       spdlog::get("jointLog")
           ->error("Requested forgetting mass for timestep {} "
@@ -112,8 +120,9 @@ public:
   // This function assumes that the forgetting mass has already been computed
   // for this timestep --- otherwise, this will result in a fatal error.
   double cumulativeLogMassAt(uint64_t timestep) {
-    if (timestep < cumulativeLogForgettingMasses_.size()) {
-      return cumulativeLogForgettingMasses_[timestep];
+    const Chunk* c = chunkOf_(timestep);
+    if (c != nullptr) {
+      return c->cumulativeLogMass[timestep & (chunkSize_ - 1)];
     } else {
       spdlog::get("jointLog")
           ->error("Requested cumulative forgetting mass for timestep {} "
@@ -129,17 +138,110 @@ public:
 
   uint64_t getCurrentTimestep() { return batchNum_; }
 
+  /**
+   * Go on from timestep (when resuming from a checkpoint); the forgetting
+   * masses of the timesteps before it that weren't prefilled are computed
+   * here.
+   */
+  void setCurrentTimestep(uint64_t timestep) {
+    if (timestep > 0 and !ensureComputed_(timestep - 1)) {
+      tooManyTimesteps_(timestep - 1);
+    }
+    batchNum_ = timestep;
+  }
+
 private:
-  uint64_t batchNum_;
+  // The masses of chunkSize_ consecutive timesteps
+  static constexpr uint64_t chunkBits_ = 16;
+  static constexpr uint64_t chunkSize_ = uint64_t(1) << chunkBits_;
+  // (enough for 2^30 mini-batches)
+  static constexpr size_t maxChunks_ = size_t(1) << 14;
+  struct Chunk {
+    double logMass[chunkSize_];
+    double cumulativeLogMass[chunkSize_];
+  };
+
+  // The published chunk holding timestep (nullptr if there is none yet)
+  inline const Chunk* chunkOf_(uint64_t timestep) const {
+    uint64_t c = timestep >> chunkBits_;
+    return (c < maxChunks_) ? chunks_[c].load(std::memory_order_acquire)
+                            : nullptr;
+  }
+
+  // The log forgetting mass of timestep t > 0, given that of t - 1.  (The
+  // prefilled masses and those computed on demand have always been indexed
+  // one apart; that is kept so that the estimates don't change.)
+  inline double nextLogMass_(double prev, uint64_t t) const {
+    if (t < prefilled_) {
+      double i = static_cast<double>(t + 1);
+      return prev + (forgettingFactor_ * std::log(i - 1) -
+                     std::log(std::pow(i, forgettingFactor_) - 1));
+    }
+    double i = static_cast<double>(t);
+    return prev + forgettingFactor_ * std::log(i - 1) -
+           std::log(std::pow(i, forgettingFactor_) - 1);
+  }
+
+  // Make sure that the masses of timesteps 0 ... timestep are published;
+  // false if timestep is beyond the last chunk
+  bool ensureComputed_(uint64_t timestep) {
+    uint64_t last = timestep >> chunkBits_;
+    if (last >= maxChunks_) {
+      return false;
+    }
+    if (chunks_[last].load(std::memory_order_acquire) != nullptr) {
+      return true;
+    }
+    // The chunks are computed in order, as each follows on from the last
+    uint64_t first = last;
+    while (first > 0 and
+           chunks_[first - 1].load(std::memory_order_acquire) == nullptr) {
+      --first;
+    }
+    for (uint64_t c = first; c <= last; ++c) {
+      std::unique_ptr<Chunk> chunk(new Chunk);
+      uint64_t t = c << chunkBits_;
+      double fm = salmon::math::LOG_1;
+      double cfm = salmon::math::LOG_1;
+      size_t j = 0;
+      if (c > 0) {
+        const Chunk* prev = chunks_[c - 1].load(std::memory_order_acquire);
+        fm = prev->logMass[chunkSize_ - 1];
+        cfm = prev->cumulativeLogMass[chunkSize_ - 1];
+      } else {
+        // timestep 0
+        chunk->logMass[0] = fm;
+        chunk->cumulativeLogMass[0] = cfm;
+        j = 1;
+      }
+      for (; j < chunkSize_; ++j) {
+        fm = nextLogMass_(fm, t + j);
+        cfm = salmon::math::logAdd(cfm, fm);
+        chunk->logMass[j] = fm;
+        chunk->cumulativeLogMass[j] = cfm;
+      }
+      Chunk* expected{nullptr};
+      if (chunks_[c].compare_exchange_strong(expected, chunk.get(),
+                                             std::memory_order_acq_rel)) {
+        chunk.release();
+      }
+    }
+    return true;
+  }
+
+  void tooManyTimesteps_(uint64_t timestep) {
+    spdlog::get("jointLog")
+        ->error("Mini-batch timestep {} is beyond the {} that the "
+                "ForgettingMassCalculator can hold; use larger mini-batches",
+                timestep, maxChunks_ * chunkSize_);
+    std::exit(1);
+  }
+
+  std::atomic<uint64_t> batchNum_;
   double forgettingFactor_;
-  double logForgettingMass_;
-  std::vector<double> logForgettingMasses_;
-  std::vector<double> cumulativeLogForgettingMasses_;
-#if defined __APPLE__
-  spin_lock ffMutex_;
-#else
-  std::mutex ffMutex_;
-#endif
+  // the number of timesteps that were prefilled (see nextLogMass_)
+  uint64_t prefilled_;
+  std::array<std::atomic<Chunk*>, maxChunks_> chunks_;
 };
 
 #endif //__FORGETTING_MASS_CALCULATOR__
@@ -16,7 +16,7 @@
 #include <string>
 #include <vector>
 
-#include "SpinLock.hpp" // RapMap's with try_lock
+#include "SalmonSpinLock.hpp"
 
 /**
  * The LengthDistribution class keeps track of the observed length distribution.
@@ -42,7 +42,7 @@ class FragmentLengthDistribution {
   std::vector<double> cachedPMF_;
   volatile bool haveCachedCMF_;
   // std::mutex fldMut_;
-  SpinLock sl_;
+  spin_lock sl_{"fragment_length_dist"};
 
   /**
    * A private double that stores the total observed (logged) mass.
@@ -63,6 +63,26 @@ class FragmentLengthDistribution {
   size_t binSize_;
 
 public:
+  /**
+   * A thread's (logged) observations that have not yet been added to the
+   * distribution.  Recording an observation here touches no shared state;
+   * the whole set is then added to the distribution with addVals(), which
+   * does one atomic update for each length that was touched, rather than
+   * three for each kernel value of each observation.
+   */
+  class LocalObservations {
+    friend class FragmentLengthDistribution;
+    std::vector<double> hist_;
+    std::vector<size_t> touched_;
+    double totMass_;
+    double sum_;
+    size_t min_;
+
+  public:
+    LocalObservations();
+    bool empty() const { return touched_.empty(); }
+  };
+
   /**
    * LengthDistribution Constructor.
    * @param alpha double that sets the average pseudo-counts (logged).
@@ -103,6 +123,20 @@ public:
    * @param mass a double for the mass (logged) to add.
    */
   void addVal(size_t len, double mass);
+  /**
+   * A member function that records a new length observation in a thread's
+   * local observations (the distribution itself is not updated).
+   * @param len an integer for the observed length.
+   * @param mass a double for the mass (logged) to add.
+   * @param local the thread's local observations.
+   */
+  void addVal(size_t len, double mass, LocalObservations& local) const;
+  /**
+   * A member function that updates the distribution with all of a thread's
+   * local observations, and clears them.
+   * @param local the thread's local observations.
+   */
+  void addVals(LocalObservations& local);
   /**
    * An accessor for the (logged) probability of a given length.
    * @param len an integer for the length to return the probability of.
@@ -141,6 +175,15 @@ public:
    */
   void dumpPMF(std::vector<double>& pmfOut, size_t& minV, size_t& maxV) const;
 
+  /**
+   * The (logged) observations of the distribution, for a checkpoint; and
+   * their inverse, which replaces the observations (and drops a cached CMF).
+   */
+  void dumpState(std::vector<double>& logHist, double& logTotMass,
+                 double& logSum, size_t& minV) const;
+  void loadState(const std::vector<double>& logHist, double logTotMass,
+                 double logSum, size_t minV);
+
   /**
    * An accessor for the (logged) observation mass (including pseudo-counts).
    * @return Total observation mass.
@@ -15,6 +15,8 @@
 #include <string>
 #include <vector>
 
+#include "SalmonSpinLock.hpp"
+
 /**
  * The FragmentStartPositionDistribution class keeps track of the observed
  * fragment start position distribution. It is initialized with uniform prior
@@ -43,12 +45,25 @@ class FragmentStartPositionDistribution {
   size_t numBins_;
 
   // Mutex for this distribution
-  std::mutex fspdMut_;
+  spin_lock fspdMut_{"fragment_start_pos_dist"};
   std::atomic<bool> isUpdated_;
   std::atomic<bool> allowUpdates_;
   std::atomic<uint32_t> performingUpdate_;
 
 public:
+  /**
+   * A thread's (logged) observations that have not yet been added to the
+   * distribution (see FragmentLengthDistribution::LocalObservations).
+   */
+  class LocalObservations {
+    friend class FragmentStartPositionDistribution;
+    std::vector<double> pmf_;
+    double totMass_;
+
+  public:
+    LocalObservations();
+  };
+
   /**
    * FragmentStartPositionDistribution constructor:
    * @param numBins The number of bins to consider for
@@ -64,6 +79,23 @@ public:
    * @param mass a double for the mass (logged) to add.
    */
   void addVal(int32_t hitPos, uint32_t txpLen, double mass);
+  /**
+   * A member function that records a new start position observation in a
+   * thread's local observations (the distribution itself is not updated).
+   * @param hitPos The position where the fragment begins
+   * @param txpLen The length of the transcript
+   * @param mass a double for the mass (logged) to add.
+   * @param local the thread's local observations.
+   */
+  void addVal(int32_t hitPos, uint32_t txpLen, double mass,
+              LocalObservations& local) const;
+  /**
+   * A member function that updates the distribution with all of a thread's
+   * local observations (unless updates are no longer allowed), and clears
+   * them.
+   * @param local the thread's local observations.
+   */
+  void addVals(LocalObservations& local);
   /**
    * A member function that returns the probability that a hit
    * starts at the specified position within the given transcript length.
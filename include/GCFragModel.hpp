@@ -48,10 +48,13 @@ public:
     }
     // set the total vector to be the right size and full of 0's.
     modelTotals_.resize(condBins_, 0.0);
+    computeBins_();
+    pending_ = Eigen::MatrixXd::Zero(condBins_, numGCBins_);
   }
 
   bool writeBinary(boost::iostreams::filtering_ostream& out) const {
     auto* mutThis = const_cast<GCFragModel*>(this);
+    flushPending_();
     int32_t dtype =
         (dspace_ == distribution_utils::DistributionSpace::LINEAR) ? 0 : 1;
     out.write(reinterpret_cast<char*>(&dtype), sizeof(dtype));
@@ -68,6 +71,38 @@ public:
     return true;
   }
 
+  // Read a model written by writeBinary; false if it doesn't have this
+  // model's bins.  The models are written after the offline phase, which
+  // normalizes them (see ratio()), into linear space.
+  bool readBinary(boost::iostreams::filtering_istream& in) {
+    int32_t dtype{0};
+    in.read(reinterpret_cast<char*>(&dtype), sizeof(dtype));
+    typename Eigen::MatrixXd::Index rows{0}, cols{0};
+    in.read(reinterpret_cast<char*>(&rows),
+            sizeof(typename Eigen::MatrixXd::Index));
+    in.read(reinterpret_cast<char*>(&cols),
+            sizeof(typename Eigen::MatrixXd::Index));
+    if (!in or rows != counts_.rows() or cols != counts_.cols()) {
+      return false;
+    }
+    std::vector<double> modelTotals(rows, 0.0);
+    Eigen::MatrixXd counts(rows, cols);
+    in.read(reinterpret_cast<char*>(modelTotals.data()), sizeof(double) * rows);
+    in.read(reinterpret_cast<char*>(counts.data()),
+            rows * cols * sizeof(typename Eigen::MatrixXd::Scalar));
+    if (!in) {
+      return false;
+    }
+    modelTotals_ = std::move(modelTotals);
+    counts_ = std::move(counts);
+    pending_.setZero();
+    havePending_ = false;
+    dspace_ = (dtype == 0) ? distribution_utils::DistributionSpace::LINEAR
+                           : distribution_utils::DistributionSpace::LOG;
+    normalized_ = (dspace_ == distribution_utils::DistributionSpace::LINEAR);
+    return true;
+  }
+
   GCFragModel(const GCFragModel&) = default;
   GCFragModel(GCFragModel&&) = default;
   GCFragModel& operator=(const GCFragModel&) = default;
@@ -100,6 +135,8 @@ public:
                  distribution_utils::DistributionSpace::LOG) {
     normalized_ = false;
     dspace_ = dspace;
+    pending_.setZero();
+    havePending_ = false;
     if (dspace_ == distribution_utils::DistributionSpace::LOG) {
       counts_.setOnes();
       counts_ *= salmon::math::LOG_0;
@@ -136,19 +173,22 @@ public:
   void inc(GCDesc desc,
            double fragWeight //< the weight associated with this fragment
   ) {
-    auto ctx = (condBins_ > 1) ? desc.contextBin(condBins_) : 0;
-    auto frag = (numGCBins_ != 101) ? desc.fragBin(numGCBins_) : desc.fragBin();
+    auto ctx = contextBinOf_[desc.contextFrac];
+    auto frag = fragBinOf_[desc.fragFrac];
 
     if (dspace_ == distribution_utils::DistributionSpace::LOG) {
-      counts_(ctx, frag) = salmon::math::logAdd(counts_(ctx, frag), fragWeight);
+      // (see flushPending_())
+      pending_(ctx, frag) += std::exp(fragWeight);
+      havePending_ = true;
     } else {
       counts_(ctx, frag) += fragWeight;
     }
   }
 
   double get(GCDesc desc) {
-    auto ctx = (condBins_ > 1) ? desc.contextBin(condBins_) : 0;
-    auto frag = (numGCBins_ != 101) ? desc.fragBin(numGCBins_) : desc.fragBin();
+    flushPending_();
+    auto ctx = contextBinOf_[desc.contextFrac];
+    auto frag = fragBinOf_[desc.fragFrac];
     return counts_(ctx, frag);
   }
 
@@ -162,6 +202,8 @@ public:
           << "Cannot combine distributions that live in a different space!\n";
       std::exit(1);
     }
+    flushPending_();
+    other.flushPending_();
     if (dspace_ == distribution_utils::DistributionSpace::LOG) {
       for (size_t r = 0; r < condBins_; ++r) {
         for (size_t c = 0; c < numGCBins_; ++c) {
@@ -182,6 +224,7 @@ public:
    * NOTE: Improve interface --- also converts out of log space
    */
   void normalize(double prior = 0.1) {
+    flushPending_();
     if (!normalized_) {
       if (dspace_ == distribution_utils::DistributionSpace::LOG) {
         prior = std::log(prior);
@@ -222,12 +265,52 @@ public:
   }
 
 private:
+  // In log space, inc() is called once per mapped fragment, so rather than
+  // doing a logAdd (an exp and a log) each time, the masses are summed in
+  // linear space in pending_ (they are probabilities, so there's no risk of
+  // overflow), which is added to counts_ whenever counts_ is next read.
+  void flushPending_() const {
+    if (!havePending_) {
+      return;
+    }
+    auto* mutThis = const_cast<GCFragModel*>(this);
+    for (size_t r = 0; r < condBins_; ++r) {
+      for (size_t c = 0; c < numGCBins_; ++c) {
+        if (pending_(r, c) > 0.0) {
+          mutThis->counts_(r, c) = salmon::math::logAdd(
+              counts_(r, c), std::log(pending_(r, c)));
+        }
+      }
+    }
+    mutThis->pending_.setZero();
+    mutThis->havePending_ = false;
+  }
+
+  // inc() and get() are called for every (position, fragment length) pair
+  // of every expressed transcript when computing effective lengths, so the
+  // bins of each of the 101 possible GC percentages are computed up front
+  // (with GCDesc's own formulas) rather than with divisions on every call.
+  void computeBins_() {
+    contextBinOf_.resize(101);
+    fragBinOf_.resize(101);
+    for (int32_t frac = 0; frac <= 100; ++frac) {
+      GCDesc desc{frac, frac};
+      contextBinOf_[frac] = (condBins_ > 1) ? desc.contextBin(condBins_) : 0;
+      fragBinOf_[frac] =
+          (numGCBins_ != 101) ? desc.fragBin(numGCBins_) : desc.fragBin();
+    }
+  }
+
   size_t condBins_;
   size_t numGCBins_;
   distribution_utils::DistributionSpace dspace_;
   bool normalized_;
   Eigen::MatrixXd counts_;
+  Eigen::MatrixXd pending_;  // linear-space masses not yet in counts_
+  bool havePending_{false};
   std::vector<double> modelTotals_;
+  std::vector<int32_t> contextBinOf_; // GC percentage -> context bin
+  std::vector<int32_t> fragBinOf_;    // GC percentage -> fragment bin
 };
 
 #endif //__GC_FRAG_MODEL__
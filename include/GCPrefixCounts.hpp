@@ -0,0 +1,82 @@
+#ifndef GC_PREFIX_COUNTS_HPP
+#define GC_PREFIX_COUNTS_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <vector>
+
+/**
+ * The number of G/C bases in every prefix of a transcript, in about 1.3
+ * bits per base (rather than the 32 of a count per base): one bit per base
+ * (set for G or C), the count before every 512 base superblock (32 bits) and
+ * the count, within its superblock, before every 64 base block (16 bits).  A
+ * count is then a superblock and a block lookup and the popcount of (part
+ * of) a single word, so it's as fast as reading a per-base array, and needs
+ * none of the (rank9b) rank structure's extra levels.
+ */
+class GCPrefixCounts {
+public:
+  static constexpr uint32_t BlockBits = 6;      // 64 bases
+  static constexpr uint32_t SuperblockBits = 9; // 512 bases
+
+  GCPrefixCounts() = default;
+  GCPrefixCounts(GCPrefixCounts&&) = default;
+  GCPrefixCounts& operator=(GCPrefixCounts&&) = default;
+
+  void build(const char* seq, uint32_t len) {
+    clear();
+    uint32_t numBlocks = (len >> BlockBits) + 1;
+    words_.assign(numBlocks, 0);
+    blocks_.assign(numBlocks, 0);
+    super_.assign((len >> SuperblockBits) + 1, 0);
+    uint32_t total{0};
+    uint32_t superStart{0};
+    for (uint32_t b = 0; b < numBlocks; ++b) {
+      uint32_t blockStart = b << BlockBits;
+      if ((blockStart & ((1u << SuperblockBits) - 1)) == 0) {
+        super_[blockStart >> SuperblockBits] = total;
+        superStart = total;
+      }
+      blocks_[b] = static_cast<uint16_t>(total - superStart);
+      uint64_t word{0};
+      uint32_t blockEnd = std::min(len, blockStart + (1u << BlockBits));
+      for (uint32_t i = blockStart; i < blockEnd; ++i) {
+        auto c = std::toupper(seq[i]);
+        if (c == 'G' or c == 'C') {
+          word |= (1ULL << (i - blockStart));
+        }
+      }
+      words_[b] = word;
+      total += __builtin_popcountll(word);
+    }
+  }
+
+  // The number of G/C bases in [0, p]; p must be < the length
+  inline uint32_t count(uint32_t p) const {
+    uint32_t b = p >> BlockBits;
+    uint64_t mask = ~0ULL >> (63 - (p & ((1u << BlockBits) - 1)));
+    return super_[p >> SuperblockBits] + blocks_[b] +
+           __builtin_popcountll(words_[b] & mask);
+  }
+
+  bool empty() const { return words_.empty(); }
+
+  void clear() {
+    words_.clear();
+    blocks_.clear();
+    super_.clear();
+  }
+
+  size_t sizeInBytes() const {
+    return words_.size() * sizeof(uint64_t) +
+           blocks_.size() * sizeof(uint16_t) + super_.size() * sizeof(uint32_t);
+  }
+
+private:
+  std::vector<uint64_t> words_;
+  std::vector<uint16_t> blocks_;
+  std::vector<uint32_t> super_;
+};
+
+#endif // GC_PREFIX_COUNTS_HPP
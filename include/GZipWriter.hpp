@@ -10,8 +10,10 @@
 #include <boost/iostreams/filter/gzip.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 
+#include "ColumnarSampleWriter.hpp"
 #include "ReadExperiment.hpp"
 #include "SalmonOpts.hpp"
+#include "SampleEncoding.hpp"
 #include "SalmonSpinLock.hpp"
 
 class GZipWriter {
@@ -37,22 +39,47 @@ public:
   template <typename ExpT>
   bool writeEmptyAbundances(const SalmonOpts& sopt, ExpT& readExp);
 
+  // quant_var.sf, the approximate uncertainty of quant.sf (--approxVariance)
+  template <typename ExpT>
+  bool writeVariances(const SalmonOpts& sopt, ExpT& readExp,
+                      const std::vector<double>& variances);
+
   template <typename T>
   bool writeBootstrap(const std::vector<T>& abund, bool quiet = false);
 
   bool setSamplingPath(const SalmonOpts& sopt);
 
+  /**
+   * Finish writing the bootstrap / Gibbs samples; with the columnar format,
+   * this is when the sample file is actually written.
+   */
+  bool finishSamples();
+
 private:
+  /**
+   * True if the samples should be written sparsely: only the reduced
+   * precision encodings of the gzip format do this (unless --denseSamples is
+   * given), so that the default output keeps its original layout.
+   */
+  static bool useSparseSamples(const SalmonOpts& sopt);
+
   boost::filesystem::path path_;
   boost::filesystem::path bsPath_;
   std::shared_ptr<spdlog::logger> logger_;
   std::unique_ptr<boost::iostreams::filtering_ostream> bsStream_{nullptr};
-// only one writer thread at a time
-#if defined __APPLE__
+  // Used instead of bsStream_ if the samples are written in columnar format
+  bool columnarSamples_{false};
+  std::unique_ptr<ColumnarSampleWriter> bsColumns_{nullptr};
+  // The number of samples that will be written (so the columnar writer can
+  // keep all of them in a single group if they fit)
+  uint64_t expectedSamples_{0};
+  SamplePrecision samplePrecision_{SamplePrecision::FLOAT64};
+  uint32_t sampleFixedScale_{0};
+  bool sparseSamples_{false};
+  std::vector<char> sampleBuffer_;
+// only one writer thread at a time (since samples are handed to a single
+// writer, see AsyncBootstrapWriter, it is left unnamed and uncounted)
   spin_lock writeMutex_;
-#else
-  std::mutex writeMutex_;
-#endif
   std::atomic<uint32_t> numBootstrapsWritten_{0};
 };
 
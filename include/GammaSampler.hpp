@@ -0,0 +1,175 @@
+#ifndef _GAMMA_SAMPLER_HPP_
+#define _GAMMA_SAMPLER_HPP_
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * Draws gamma variates in batches, with the method of Marsaglia and Tsang
+ * (ACM TOMS 26(3), 2000): for shape a >= 1, with d = a - 1/3 and
+ * c = 1 / sqrt(9d), a standard normal x gives the candidate d * (1 + cx)^3,
+ * which is accepted with probability ~0.98 or more.  Shapes below 1 are
+ * boosted to a + 1, and the variate scaled by U^(1/a).  The normals are
+ * drawn with Marsaglia's polar method.
+ *
+ * The uniforms come from a counter-based generator: the i-th uniform of
+ * element `id` is a hash (the splitmix64 finalizer) of the key, id and i, so
+ * that the variate of an element depends only on (key, id), not on how the
+ * elements are split into batches or among threads, and a batch has no
+ * generator state to carry from one element to the next.
+ *
+ * The first attempt for every element of a block is made in a loop without
+ * data-dependent branches or calls into libm (the logarithm is a polynomial
+ * one, accurate to ~1e-15), which the compiler can vectorize; most attempts
+ * are accepted by the squeeze test of Marsaglia and Tsang, which needs no
+ * logarithm.  Only the few elements left are finished one at a time.
+ */
+class GammaSampler {
+public:
+  explicit GammaSampler(uint64_t key) : key_(key) {}
+
+  /**
+   * out[k] = Gamma(shapes[k], scales[k]) (shape / scale parametrization)
+   * for element ids[k], k < n; non-positive shapes give 0.
+   */
+  void operator()(const uint32_t* ids, const double* shapes,
+                  const double* scales, double* out, size_t n) const {
+    double d[blockSize];
+    double c[blockSize];
+    double x[blockSize];
+    double u[blockSize];
+    double v[blockSize];
+    // 1: accepted by the squeeze, 2: to be tested in full, 0: rejected
+    uint8_t state[blockSize];
+    for (size_t b = 0; b < n; b += blockSize) {
+      size_t m = n - b;
+      if (m > blockSize) {
+        m = blockSize;
+      }
+      const uint32_t* bids = ids + b;
+      const double* bshapes = shapes + b;
+      for (size_t k = 0; k < m; ++k) {
+        double a = bshapes[k];
+        d[k] = ((a < 1.0) ? a + 1.0 : a) - 1.0 / 3.0;
+        c[k] = 1.0 / std::sqrt(9.0 * d[k]);
+      }
+      // The first attempt, for the whole block
+      for (size_t k = 0; k < m; ++k) {
+        uint64_t s = stream_(bids[k]);
+        double v1 = 2.0 * uniform_(s, 0) - 1.0;
+        double v2 = 2.0 * uniform_(s, 1) - 1.0;
+        double q = v1 * v1 + v2 * v2;
+        bool inDisk = (q < 1.0) & (q > 0.0);
+        double qs = inDisk ? q : 0.5;
+        x[k] = v1 * std::sqrt(-2.0 * log_(qs) / qs);
+        u[k] = uniform_(s, 2);
+        double t = 1.0 + c[k] * x[k];
+        double t3 = t * t * t;
+        double x2 = x[k] * x[k];
+        bool valid = inDisk & (t3 > 0.0);
+        bool squeeze = u[k] < 1.0 - 0.0331 * x2 * x2;
+        state[k] = valid ? (squeeze ? 1 : 2) : 0;
+        v[k] = d[k] * t3;
+      }
+      // The (rare) full tests and retries, and the scaling
+      for (size_t k = 0; k < m; ++k) {
+        double a = bshapes[k];
+        if (!(a > 0.0)) {
+          out[b + k] = 0.0;
+          continue;
+        }
+        if (state[k] != 1) {
+          uint64_t s = stream_(bids[k]);
+          bool done = (state[k] == 2) and accept_(x[k], u[k], v[k], d[k]);
+          for (uint64_t i = 3; !done; i += 3) {
+            double v1 = 2.0 * uniform_(s, i) - 1.0;
+            double v2 = 2.0 * uniform_(s, i + 1) - 1.0;
+            double q = v1 * v1 + v2 * v2;
+            if (q >= 1.0 or q == 0.0) {
+              continue;
+            }
+            double xi = v1 * std::sqrt(-2.0 * log_(q) / q);
+            double t = 1.0 + c[k] * xi;
+            if (t <= 0.0) {
+              continue;
+            }
+            double ui = uniform_(s, i + 2);
+            double x2 = xi * xi;
+            v[k] = d[k] * t * t * t;
+            done = (ui < 1.0 - 0.0331 * x2 * x2) or
+                   accept_(xi, ui, v[k], d[k]);
+          }
+        }
+        if (a < 1.0) {
+          // A counter that the attempts above never reach
+          double ub = uniform_(stream_(bids[k]), boostCounter);
+          v[k] *= std::pow(ub, 1.0 / a);
+        }
+        out[b + k] = v[k] * scales[b + k];
+      }
+    }
+  }
+
+private:
+  static constexpr size_t blockSize = 64;
+  static constexpr uint64_t boostCounter = uint64_t(1) << 62;
+
+  // The full acceptance test of the candidate dv = d * (1 + cx)^3
+  static inline bool accept_(double x, double u, double dv, double d) {
+    return log_(u) < 0.5 * x * x + d - dv + d * log_(dv / d);
+  }
+
+  static inline uint64_t mix_(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+  inline uint64_t stream_(uint32_t id) const {
+    uint64_t x = static_cast<uint64_t>(id) + 1;
+    return mix_(key_ + x * 0x9e3779b97f4a7c15ULL);
+  }
+
+  // The uniform (in (0, 1)) number i of the element with the given stream
+  static inline double uniform_(uint64_t stream, uint64_t i) {
+    // the top 52 bits of the hash as the mantissa of a double in [1, 2)
+    uint64_t bits = (mix_(stream + (i + 1) * 0xd1b54a32d192ed03ULL) >> 12) |
+                    0x3ff0000000000000ULL;
+    double r;
+    std::memcpy(&r, &bits, sizeof(r));
+    return (r - 1.0) + 0.5 / 4503599627370496.0;
+  }
+
+  /**
+   * The natural logarithm of a positive, normal x: with x = m * 2^e and m in
+   * [sqrt(1/2), sqrt(2)), log(m) = 2 atanh(z) for z = (m - 1) / (m + 1),
+   * whose series converges quickly since |z| < 0.172.
+   */
+  static inline double log_(double x) {
+    uint64_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    // the (biased) exponent, as a double, by way of the bits of 2^52 + it
+    uint64_t ebits = (bits >> 52) | 0x4330000000000000ULL;
+    double e;
+    std::memcpy(&e, &ebits, sizeof(e));
+    e -= 4503599627370496.0 + 1023.0;
+    bits = (bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL;
+    double m;
+    std::memcpy(&m, &bits, sizeof(m));
+    bool high = m > 1.4142135623730951;
+    m = high ? 0.5 * m : m;
+    e = high ? e + 1.0 : e;
+    double z = (m - 1.0) / (m + 1.0);
+    double z2 = z * z;
+    double p = 1.0 / 13.0 + z2 * (1.0 / 15.0 + z2 * (1.0 / 17.0));
+    p = 1.0 / 7.0 + z2 * (1.0 / 9.0 + z2 * (1.0 / 11.0 + z2 * p));
+    p = 1.0 + z2 * (1.0 / 3.0 + z2 * (1.0 / 5.0 + z2 * p));
+    return 2.0 * z * p + e * 0.6931471805599453;
+  }
+
+  uint64_t key_;
+};
+
+#endif //_GAMMA_SAMPLER_HPP_
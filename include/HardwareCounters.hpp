@@ -0,0 +1,114 @@
+#ifndef __HARDWARE_COUNTERS_HPP__
+#define __HARDWARE_COUNTERS_HPP__
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "cereal/cereal.hpp"
+
+namespace salmon {
+namespace perf {
+
+// The hardware events that are counted
+enum class Event : uint32_t {
+  CYCLES = 0,
+  INSTRUCTIONS,
+  LLC_MISSES,
+  DTLB_MISSES,
+  BRANCH_MISSES
+};
+constexpr size_t numEvents = 5;
+
+// The name of an event, as written to meta_info.json
+const char* eventName(size_t e);
+
+/**
+ * The counts of the events over some span of a run, by some threads.  An
+ * event that the CPU (or the kernel) doesn't count isn't written at all.
+ * When there are more events than counters, the kernel takes turns with
+ * them, and each count is scaled up from the time its event was counted.
+ */
+struct CounterValues {
+  std::array<uint64_t, numEvents> counts{};
+  std::array<bool, numEvents> counted{};
+
+  CounterValues& operator+=(const CounterValues& o) {
+    for (size_t e = 0; e < numEvents; ++e) {
+      if (o.counted[e]) {
+        counts[e] += o.counts[e];
+        counted[e] = true;
+      }
+    }
+    return *this;
+  }
+
+  uint64_t operator[](Event e) const {
+    return counts[static_cast<size_t>(e)];
+  }
+
+  bool any() const {
+    for (auto c : counted) {
+      if (c) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  template <typename Archive> void save(Archive& ar) const {
+    for (size_t e = 0; e < numEvents; ++e) {
+      if (counted[e]) {
+        ar(cereal::make_nvp(eventName(e), counts[e]));
+      }
+    }
+    size_t cycles = static_cast<size_t>(Event::CYCLES);
+    size_t instructions = static_cast<size_t>(Event::INSTRUCTIONS);
+    if (counted[cycles] and counted[instructions] and counts[cycles] > 0) {
+      ar(cereal::make_nvp("instructions_per_cycle",
+                          static_cast<double>(counts[instructions]) /
+                              counts[cycles]));
+    }
+  }
+};
+
+/**
+ * Counts the events (with perf_event_open, in user space only) from its
+ * construction on, in the calling thread alone or in every thread of the
+ * process; in either case the threads that those threads start later on are
+ * counted too, once they have exited.  The counts are only available on
+ * Linux, and only where the kernel allows it (see
+ * /proc/sys/kernel/perf_event_paranoid); otherwise nothing is counted.
+ */
+class CounterSet {
+public:
+  enum class Scope { THREAD, PROCESS };
+
+  explicit CounterSet(Scope scope);
+  ~CounterSet();
+
+  CounterSet(const CounterSet&) = delete;
+  CounterSet& operator=(const CounterSet&) = delete;
+
+  // True if at least one event is being counted
+  bool good() const { return !fds_.empty(); }
+
+  // The counts so far
+  CounterValues read() const;
+
+private:
+  // One fd per event (-1 if it isn't counted) per thread counted
+  std::vector<std::array<int, numEvents>> fds_;
+};
+
+/**
+ * Whether any of the events can be counted here; if not, why not is put in
+ * why.
+ */
+bool available(std::string& why);
+
+} // namespace perf
+} // namespace salmon
+
+#endif // __HARDWARE_COUNTERS_HPP__
@@ -0,0 +1,133 @@
+#ifndef __INDEX_BUILD_STATS_HPP__
+#define __INDEX_BUILD_STATS_HPP__
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "boost/filesystem.hpp"
+#include "cereal/archives/json.hpp"
+#include "cereal/types/string.hpp"
+#include "cereal/types/vector.hpp"
+
+#include "PerformanceStats.hpp"
+
+/**
+ * Records the wall time, CPU time, peak resident set size and the bytes
+ * written to the index directory for the phases of an index build (and for
+ * the whole build, from construction to save()), and writes them to
+ * index_build_stats.json.
+ *
+ * The peak RSS is the process' high-water mark at the end of the phase
+ * (so it never decreases from one phase to the next), and the bytes
+ * written are the sizes of the files in the index directory that were
+ * modified during the phase.
+ */
+class IndexBuildStats {
+public:
+  struct Phase {
+    std::string name;
+    double wallTimeSec{0.0};
+    double cpuTimeSec{0.0};
+    uint64_t peakRSSBytes{0};
+    uint64_t bytesWritten{0};
+
+    template <typename Archive> void serialize(Archive& ar) {
+      ar(cereal::make_nvp("name", name),
+         cereal::make_nvp("wall_time_sec", wallTimeSec),
+         cereal::make_nvp("cpu_time_sec", cpuTimeSec),
+         cereal::make_nvp("peak_rss_bytes", peakRSSBytes),
+         cereal::make_nvp("bytes_written", bytesWritten));
+    }
+  };
+
+  explicit IndexBuildStats(const boost::filesystem::path& indexDir)
+      : indexDir_(indexDir) {
+    start_(total_, "total");
+  }
+
+  void startPhase(const std::string& name) { start_(current_, name); }
+  void endPhase() {
+    end_(current_);
+    phases_.push_back(current_.phase);
+  }
+
+  const std::vector<Phase>& phases() const { return phases_; }
+
+  bool save(const std::string& indexType, uint32_t numThreads) {
+    boost::filesystem::path statsFile = indexDir_ / "index_build_stats.json";
+    std::ofstream ofs(statsFile.string());
+    if (!ofs.good()) {
+      return false;
+    }
+    end_(total_);
+    {
+      cereal::JSONOutputArchive oarchive(ofs);
+      oarchive(cereal::make_nvp("index_type", indexType),
+               cereal::make_nvp("num_threads", numThreads),
+               cereal::make_nvp("total", total_.phase),
+               cereal::make_nvp("phases", phases_));
+    }
+    ofs.close();
+    return true;
+  }
+
+private:
+  struct RunningPhase {
+    Phase phase;
+    std::chrono::steady_clock::time_point wallStart;
+    double cpuStart{0.0};
+    std::time_t fileTimeStart{0};
+  };
+
+  static void start_(RunningPhase& p, const std::string& name) {
+    p.phase = Phase();
+    p.phase.name = name;
+    p.wallStart = std::chrono::steady_clock::now();
+    p.cpuStart = cpuTime_();
+    p.fileTimeStart = std::time(nullptr);
+  }
+
+  void end_(RunningPhase& p) const {
+    std::chrono::duration<double> wall =
+        std::chrono::steady_clock::now() - p.wallStart;
+    p.phase.wallTimeSec = wall.count();
+    p.phase.cpuTimeSec = cpuTime_() - p.cpuStart;
+    p.phase.peakRSSBytes = peakRSS_();
+    p.phase.bytesWritten = bytesWrittenSince_(p.fileTimeStart);
+  }
+
+  static double cpuTime_() { return PerformanceStats::cpuTimeSeconds(); }
+
+  static uint64_t peakRSS_() { return PerformanceStats::peakRSSBytes(); }
+
+  uint64_t bytesWrittenSince_(std::time_t since) const {
+    namespace bfs = boost::filesystem;
+    uint64_t total{0};
+    boost::system::error_code ec;
+    for (bfs::recursive_directory_iterator it(indexDir_, ec), end;
+         !ec and it != end; it.increment(ec)) {
+      // A file we can't stat shouldn't end the directory walk
+      boost::system::error_code fileEc;
+      if (!bfs::is_regular_file(it->status()) or
+          bfs::last_write_time(it->path(), fileEc) < since or fileEc) {
+        continue;
+      }
+      auto size = bfs::file_size(it->path(), fileEc);
+      if (!fileEc) {
+        total += size;
+      }
+    }
+    return total;
+  }
+
+  boost::filesystem::path indexDir_;
+  std::vector<Phase> phases_;
+  RunningPhase current_;
+  RunningPhase total_;
+};
+
+#endif // __INDEX_BUILD_STATS_HPP__
@@ -0,0 +1,80 @@
+#ifndef INFERENCE_SWEEP_HPP
+#define INFERENCE_SWEEP_HPP
+
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "spdlog/spdlog.h"
+
+#include "SalmonOpts.hpp"
+
+/**
+ * The inference configurations of --sweep, which are quantified, once the
+ * run's own quantification is written, from the same equivalence classes
+ * (and bias models), so that e.g. several VB priors, the EM and the VBEM,
+ * or bias correction on and off can be compared at the cost of one mapping
+ * pass and one table of classes.  The configurations are optimized one
+ * after the other (each with all of the threads), since the optimizer
+ * writes its combined weights into the (shared) classes.
+ *
+ * The sweep file has one configuration per line: its name (its output
+ * goes to <output>/sweep/<name>/quant.sf), then the options in which it
+ * differs from the run:
+ *
+ *   --useVBOpt or --useEM, --vbPrior <prior>, --perTranscriptPrior (or
+ *   --perNucleotidePrior), and --noBiasCorrect
+ *
+ * Blank lines, and those that start with '#', are skipped.  Bias
+ * correction can only be turned off (the bias models are learned while
+ * mapping, and only if the run itself is bias-corrected).
+ */
+namespace salmon {
+namespace sweep {
+
+struct Config {
+  std::string name;
+  bool useVBOpt{false};
+  double vbPrior{1e-3};
+  bool perTranscriptPrior{false};
+  // false to leave out the run's bias corrections
+  bool biasCorrect{true};
+};
+
+class Sweep {
+public:
+  /**
+   * Read the configurations of the sweep file at path (which default to
+   * the options of sopt); returns false (having said why) if it's invalid.
+   */
+  bool load(const std::string& path, const SalmonOpts& sopt,
+            spdlog::logger* log);
+
+  bool empty() const { return configs_.empty(); }
+  const std::vector<Config>& configs() const { return configs_; }
+
+  /**
+   * Keep the online estimates of experiment's transcripts (from which
+   * every configuration starts); called before the run's own optimization.
+   */
+  template <typename ExpT> void saveInitialEstimates(ExpT& experiment);
+
+  /**
+   * Optimize, and write the quant.sf of, each configuration in turn.  This
+   * changes the transcripts' estimates, so it comes after everything that
+   * is written from the run's own.  Returns false if any of them failed.
+   */
+  template <typename ExpT>
+  bool run(ExpT& experiment, SalmonOpts& sopt,
+           const boost::filesystem::path& outputDirectory);
+
+private:
+  std::vector<Config> configs_;
+  std::vector<double> initialCounts_;
+};
+
+} // namespace sweep
+} // namespace salmon
+
+#endif // INFERENCE_SWEEP_HPP
@@ -0,0 +1,122 @@
+#ifndef INTERIM_QUANT_HPP
+#define INTERIM_QUANT_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "AsyncOutputService.hpp"
+#include "spdlog/spdlog.h"
+
+class ReadExperiment;
+class Transcript;
+
+namespace salmon {
+namespace interim {
+
+/**
+ * The online abundance estimates after a prefix of the reads has been
+ * processed (see --snapshotInterval).
+ */
+struct Estimates {
+  uint64_t numObservedFragments{0};
+  // per transcript
+  std::vector<double> counts;
+  std::vector<double> effLengths;
+};
+
+/**
+ * Copy the online estimates of experiment into e: each cluster's fragments
+ * are divided among its transcripts in proportion to their masses, as
+ * normalizeAlphas divides them (but without projecting the counts onto
+ * their bounds, and without changing the transcripts).
+ */
+void take(ReadExperiment& experiment, uint64_t numObservedFragments,
+          Estimates& e);
+
+// Write e, for the given transcripts, in the format of quant.sf
+bool write(const boost::filesystem::path& path,
+           const std::vector<Transcript>& transcripts, const Estimates& e);
+
+/**
+ * Writes the online estimates to <output>/quant.partial.sf every `interval`
+ * observed fragments, so that a run can be watched (and stopped, once its
+ * answer is clear) before the offline phase.  The threads that process the
+ * mini-batches meet at a mini-batch boundary, as they do for a checkpoint
+ * (see Checkpointer): each one parks at its next call to pauseIfDue() once
+ * an estimate is due, and the last one to park copies the estimates
+ * (`takeFn`) while the others wait.  The copy is written by an
+ * AsyncOutputService (to a temporary file, renamed over the previous
+ * estimates once it's complete), while the processing goes on.
+ */
+class Snapshotter {
+public:
+  using TakeFn = std::function<void(Estimates&)>;
+
+  Snapshotter(const boost::filesystem::path& path, uint64_t interval,
+              const std::vector<Transcript>& transcripts,
+              std::shared_ptr<spdlog::logger> log);
+  ~Snapshotter();
+
+  // Start a read library, whose mini-batches numThreads threads process
+  void beginLibrary(uint32_t numThreads, TakeFn takeFn);
+
+  inline bool due(uint64_t numObservedFragments) const {
+    return numObservedFragments >= nextDue_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Called by each processing thread between its mini-batches; if an
+   * estimate is due, the thread waits until it has been taken.
+   */
+  void pauseIfDue(uint64_t numObservedFragments) {
+    if (due(numObservedFragments)) {
+      park_();
+    }
+  }
+
+  // Called by each processing thread once it has run out of mini-batches
+  void leave();
+
+  const boost::filesystem::path& path() const { return path_; }
+
+  // The number of estimates taken (written or not yet)
+  uint64_t numTaken() const { return numTaken_; }
+
+  // Wait for the last estimates to be written
+  bool finish();
+
+private:
+  void park_();
+  // with mut_ held, by the last thread to park
+  void takeLocked_();
+
+  boost::filesystem::path path_;
+  uint64_t interval_;
+  const std::vector<Transcript>& transcripts_;
+  std::shared_ptr<spdlog::logger> log_;
+  std::atomic<uint64_t> nextDue_;
+
+  std::mutex mut_;
+  std::condition_variable parked_;
+  uint32_t numActive_{0};
+  uint32_t numParked_{0};
+  uint64_t generation_{0};
+  uint64_t numTaken_{0};
+  TakeFn takeFn_;
+
+  // (one estimate is written at a time; the threads only wait on the disk if
+  // another is due before it's done)
+  AsyncOutputService writer_;
+};
+
+} // namespace interim
+} // namespace salmon
+
+#endif // INTERIM_QUANT_HPP
@@ -1,98 +1,77 @@
 #ifndef __KMER_INTERVAL_MAP_HPP__
 #define __KMER_INTERVAL_MAP_HPP__
 
-extern "C" {
-#include "bwt.h"
-}
-
+#include <cstdint>
 #include <fstream>
-#include <unordered_map>
+#include <vector>
 
-#include <jellyfish/mer_dna.hpp>
+#include <boost/filesystem.hpp>
 
 #include "cereal/archives/binary.hpp"
-#include "cereal/types/unordered_map.hpp"
-
-#include "xxhash.h"
-
-using JFMer = jellyfish::mer_dna_ns::mer_base_static<uint64_t, 1>;
-
-// What will be the keys in our k-mer has map
-struct KmerKey {
-  KmerKey() { mer_.polyT(); }
-
-  KmerKey(uint8_t* seq, uint32_t len) : mer_(len) {
-    mer_.polyT();
-    for (size_t i = 0; i < len; ++i) {
-      mer_.shift_left(seq[i]);
-    }
-  }
-
-  bool operator==(const KmerKey& ok) const { return mer_ == ok.mer_; }
-
-  // Is there a smarter way to do save / load here?
-  template <typename Archive> void save(Archive& archive) const {
-    auto key = mer_.get_bits(0, 2 * mer_.k());
-    archive(key);
-  }
-
-  template <typename Archive> void load(Archive& archive) {
-    mer_.polyT();
-    uint64_t bits;
-    archive(bits);
-    mer_.set_bits(0, 2 * mer_.k(), bits);
-  }
-
-  JFMer mer_;
-};
-
-template <typename Archive> void load(Archive& archive, bwtintv_t& interval) {
-  archive(interval.x[0], interval.x[1], interval.x[2], interval.info);
-}
-
-template <typename Archive>
-void save(Archive& archive, const bwtintv_t& interval) {
-  archive(interval.x[0], interval.x[1], interval.x[2], interval.info);
-}
+#include "cereal/types/vector.hpp"
 
 /**
  *  This class provides an efficent hash-map from
- *  k-mers to BWT intervals.
+ *  k-mers to BWT intervals.  A k-mer (k <= 31) is its code: its bases,
+ *  2 bits each, the first base in the highest bits (as in the
+ *  PrefixIntervalTable); an interval is the (x[0], x[1], x[2]) the forward
+ *  search of bwt_smem1 reaches at the end of the k-mer.  The table is open
+ *  addressing with linear probing, so a lookup is a probe of a flat array
+ *  rather than a chase through a node-based map.
  */
 class KmerIntervalMap {
 public:
-  // How we hash the keys
-  struct KmerHasher {
-    std::size_t operator()(const KmerKey& k) const {
-      void* data = static_cast<void*>(const_cast<KmerKey&>(k).mer_.data__());
-      return XXH64(data, sizeof(uint64_t), 0);
-    }
-  };
-
-private:
-  std::unordered_map<KmerKey, bwtintv_t, KmerHasher> map_;
-
-public:
-  void setK(unsigned int k) { JFMer::k(k); }
-  uint32_t k() { return JFMer::k(); }
+  static constexpr uint32_t maxK = 31;
 
-  bool hasKmer(KmerKey& k) { return map_.find(k) != map_.end(); }
+  void setK(uint32_t k) { k_ = k; }
+  uint32_t k() const { return k_; }
 
-  decltype(map_)::iterator find(const KmerKey& k) { return map_.find(k); }
-  decltype(map_)::iterator find(KmerKey&& k) { return map_.find(k); }
+  size_t size() const { return size_; }
 
-  decltype(map_)::iterator end() { return map_.end(); }
+  /**
+   * The interval of the k-mer with code @code, or nullptr if the k-mer
+   * isn't in the map.
+   */
+  const uint64_t* find(uint64_t code) const {
+    if (size_ == 0) {
+      return nullptr;
+    }
+    for (size_t slot = slot_(code);; slot = (slot + 1) & mask_) {
+      if (keys_[slot] == code) {
+        return &intervals_[3 * slot];
+      } else if (keys_[slot] == emptyKey_) {
+        return nullptr;
+      }
+    }
+  }
 
-  bwtintv_t& operator[](const KmerKey& k) { return map_[k]; }
-  bwtintv_t& operator[](KmerKey&& k) { return map_[k]; }
+  bool hasKmer(uint64_t code) const { return find(code) != nullptr; }
 
-  decltype(map_)::size_type size() { return map_.size(); }
+  // Add the k-mer with code @code (if it's not there already)
+  void insert(uint64_t code, const uint64_t interval[3]) {
+    // Keep the table at most half full
+    if (2 * (size_ + 1) > keys_.size()) {
+      rehash_(keys_.empty() ? 1024 : 2 * keys_.size());
+    }
+    size_t slot = slot_(code);
+    while (keys_[slot] != emptyKey_) {
+      if (keys_[slot] == code) {
+        return;
+      }
+      slot = (slot + 1) & mask_;
+    }
+    keys_[slot] = code;
+    intervals_[3 * slot] = interval[0];
+    intervals_[3 * slot + 1] = interval[1];
+    intervals_[3 * slot + 2] = interval[2];
+    ++size_;
+  }
 
   void save(boost::filesystem::path indexPath) {
     std::ofstream ofs(indexPath.string(), std::ios::binary);
     {
       cereal::BinaryOutputArchive oa(ofs);
-      oa(map_);
+      oa(k_, size_, keys_, intervals_);
     }
     ofs.close();
   }
@@ -101,10 +80,46 @@ public:
     std::ifstream ifs(indexPath.string(), std::ios::binary);
     {
       cereal::BinaryInputArchive ia(ifs);
-      ia(map_);
+      ia(k_, size_, keys_, intervals_);
     }
     ifs.close();
+    mask_ = keys_.empty() ? 0 : keys_.size() - 1;
+  }
+
+private:
+  // No code of a k-mer (k <= 31) has its top 2 bits set
+  static constexpr uint64_t emptyKey_ = ~uint64_t(0);
+
+  size_t slot_(uint64_t code) const {
+    // The finalizer of MurmurHash3, so that similar k-mers spread out
+    code ^= code >> 33;
+    code *= 0xff51afd7ed558ccdULL;
+    code ^= code >> 33;
+    code *= 0xc4ceb9fe1a85ec53ULL;
+    code ^= code >> 33;
+    return code & mask_;
   }
+
+  void rehash_(size_t capacity) {
+    std::vector<uint64_t> keys(capacity, uint64_t(emptyKey_));
+    std::vector<uint64_t> intervals(3 * capacity, 0);
+    keys_.swap(keys);
+    intervals_.swap(intervals);
+    mask_ = capacity - 1;
+    size_ = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      if (keys[i] != emptyKey_) {
+        insert(keys[i], &intervals[3 * i]);
+      }
+    }
+  }
+
+  uint32_t k_{0};
+  uint64_t size_{0};
+  // A power of two slots; intervals_ holds 3 words per slot
+  std::vector<uint64_t> keys_;
+  std::vector<uint64_t> intervals_;
+  uint64_t mask_{0};
 };
 
 #endif // __KMER_INTERVAL_MAP_HPP__
@@ -0,0 +1,111 @@
+#ifndef __KMER_LOOKUP_PREFETCHER_HPP__
+#define __KMER_LOOKUP_PREFETCHER_HPP__
+
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "RapMapUtils.hpp"
+
+/**
+ * Software-pipelined cache warming for quasi-mapping a chunk of reads.
+ *
+ * Mapping a read starts with a lookup of its first k-mer (and of the first
+ * k-mer of its reverse complement) in the k-mer hash, followed by reads of
+ * the suffix array interval found there and of the text the SA points to;
+ * each of these is a dependent, usually cache-missing, access.  Before
+ * mapping read i, the mapping loop hands read i + distance to operator();
+ * this looks up the k-mers of that read, so that several reads' hash lookups overlap with each
+ * other and with mapping, and prefetches the first SA entry of each interval
+ * found.  When the read is half of the distance away, the SA entry has
+ * arrived, and the text it points to is prefetched.  By the time the read is
+ * mapped, the start of each of these chains is in the cache.
+ */
+template <typename RapMapIndexT> class KmerLookupPrefetcher {
+public:
+  KmerLookupPrefetcher(RapMapIndexT* idx, uint32_t distance)
+      : idx_(idx), k_(rapmap::utils::my_mer::k()), distance_(distance),
+        slots_(2 * distance + 1) {}
+
+  uint32_t distance() const { return distance_; }
+
+  /**
+   * Called before read i of the chunk is mapped, with read i + distance
+   * (or with seq == nullptr past the end of the chunk).
+   */
+  inline void operator()(size_t i, const char* seq, size_t len) {
+    if (distance_ == 0) {
+      return;
+    }
+    if (seq != nullptr) {
+      lookup_(slots_[(i + distance_) % slots_.size()], seq, len);
+    }
+    touchText_(slots_[(i + distance_ / 2) % slots_.size()]);
+  }
+
+  /**
+   * Called, at the start of a chunk, with each of its first distance reads
+   * (which operator() isn't called with).
+   */
+  inline void prime(size_t i, const char* seq, size_t len) {
+    if (distance_ == 0) {
+      return;
+    }
+    Slot& slot = slots_[i % slots_.size()];
+    lookup_(slot, seq, len);
+    if (i < distance_ / 2) {
+      touchText_(slot);
+    }
+  }
+
+private:
+  using IndexT = typename std::remove_reference<decltype(
+      std::declval<RapMapIndexT>().SA[0])>::type;
+
+  struct Slot {
+    const IndexT* sa[2]{nullptr, nullptr};
+  };
+
+  inline void lookup_(Slot& slot, const char* seq, size_t len) {
+    slot.sa[0] = slot.sa[1] = nullptr;
+    if (len < k_) {
+      return;
+    }
+    rapmap::utils::my_mer mer;
+    auto& khash = idx_->khash;
+    // The first k-mer of the read
+    if (mer.from_chars(seq)) {
+      auto it = khash.find(mer.get_bits(0, 2 * k_));
+      if (it != khash.end()) {
+        slot.sa[0] = idx_->SA.data() + it->second.begin();
+        __builtin_prefetch(slot.sa[0]);
+      }
+    }
+    // The first k-mer of its reverse complement
+    if (mer.from_chars(seq + len - k_)) {
+      auto rc = mer.get_reverse_complement();
+      auto it = khash.find(rc.get_bits(0, 2 * k_));
+      if (it != khash.end()) {
+        slot.sa[1] = idx_->SA.data() + it->second.begin();
+        __builtin_prefetch(slot.sa[1]);
+      }
+    }
+  }
+
+  inline void touchText_(const Slot& slot) {
+    const char* text = idx_->seq.data();
+    for (auto sa : slot.sa) {
+      if (sa != nullptr) {
+        __builtin_prefetch(text + *sa);
+      }
+    }
+  }
+
+  RapMapIndexT* idx_;
+  size_t k_;
+  uint32_t distance_;
+  std::vector<Slot> slots_;
+};
+
+#endif // __KMER_LOOKUP_PREFETCHER_HPP__
@@ -18,7 +18,7 @@ public:
                          LibraryFormat::maxLibTypeID() + 1)) {}
 
   LibraryTypeDetector(const LibraryTypeDetector& other) {
-    active_ = other.active_;
+    active_ = other.active_.load();
     type_ = other.type_;
     numSamplesNeeded_.store(other.numSamplesNeeded_.load());
     libTypeCounts_ =
@@ -146,9 +146,40 @@ public:
     }
   }
 
+  /**
+   * Add the samples tallied by a mini-batch (counts[i] is the number of
+   * alignments of the format with id i), with one atomic update per format
+   * rather than one per alignment.
+   */
+  void addSamples(const std::vector<uint64_t>& counts) {
+    if (!active_ or numSamplesNeeded_ < 0) {
+      return;
+    }
+    int64_t numAdded{0};
+    for (size_t i = 0; i < counts.size(); ++i) {
+      if (counts[i] > 0 and LibraryFormat::formatFromID(i).type == type_) {
+        libTypeCounts_[i] += counts[i];
+        numAdded += counts[i];
+      }
+    }
+    numSamplesNeeded_ -= numAdded;
+  }
+
+  /**
+   * Lock the library type in (into ifmt) if we've seen enough samples;
+   * returns whether the type is still being detected, i.e. false once it's
+   * been locked in (by this or any other thread), after which ifmt holds it.
+   */
+  bool update(LibraryFormat& ifmt) {
+    if (active_ and canGuess()) {
+      mostLikelyType(ifmt);
+    }
+    return active_;
+  }
+
 private:
-  // set to false once we have guessed the type
-  bool active_{true};
+  // set to false once we have guessed the type (and written it out)
+  std::atomic<bool> active_{true};
   std::mutex mut_;
 
   // single or paired-end
@@ -3,7 +3,9 @@
 
 #include "BWAMemStaticFuncs.hpp"
 #include "EffectiveLengthStats.hpp"
+#include "MiniBatchScratch.hpp"
 #include "RapMapUtils.hpp"
+#include "SMEMChaining.hpp"
 
 class SMEMAlignment {
 public:
@@ -166,54 +168,11 @@ public:
   bool computeBestLoc_(std::vector<KmerVote>& sVotes, Transcript& transcript,
                        std::string& read, bool isRC, int32_t& maxClusterPos,
                        uint32_t& maxClusterCount, double& maxClusterScore) {
-    // Did we update the highest-scoring cluster? This will be set to
-    // true iff we have a cluster of a higher score than the score
-    // currently given in maxClusterCount.
-    bool updatedMaxScore{false};
-
-    if (sVotes.size() == 0) {
-      return updatedMaxScore;
-    }
-
-    struct VoteInfo {
-      uint32_t coverage = 0;
-      int32_t rightmostBase = 0;
-    };
-
-    uint32_t readLen = read.length();
-
-    boost::container::flat_map<uint32_t, VoteInfo> hitMap;
-    int32_t currClust{static_cast<int32_t>(sVotes.front().votePos)};
-
-    for (size_t j = 0; j < sVotes.size(); ++j) {
-
-      int32_t votePos = sVotes[j].votePos;
-      uint32_t readPos = sVotes[j].readPos;
-      uint32_t voteLen = sVotes[j].voteLen;
-
-      if (votePos >= currClust) {
-        if (votePos - currClust > 10) {
-          currClust = votePos;
-        }
-        auto& hmEntry = hitMap[currClust];
-
-        hmEntry.coverage += std::min(voteLen, (votePos + readPos + voteLen) -
-                                                  hmEntry.rightmostBase);
-        hmEntry.rightmostBase = votePos + readPos + voteLen;
-      } else if (votePos < currClust) {
-        std::cerr << "Should not have votePos = " << votePos
-                  << " <  currClust = " << currClust << "\n";
-        std::exit(1);
-      }
-
-      if (hitMap[currClust].coverage > maxClusterCount) {
-        maxClusterCount = hitMap[currClust].coverage;
-        maxClusterPos = currClust;
-        maxClusterScore = maxClusterCount / static_cast<double>(readLen);
-        updatedMaxScore = true;
-      }
-    }
-    return updatedMaxScore;
+    // Did we update the highest-scoring cluster? This will be true iff we
+    // have a cluster of a higher score than the score currently given in
+    // maxClusterCount.
+    return salmon::smem::bestVoteCluster(sVotes, read.length(), maxClusterPos,
+                                         maxClusterCount, maxClusterScore);
   }
 
   bool computeBestLoc2_(std::vector<KmerVote>& sVotes, uint32_t tlen,
@@ -576,13 +535,10 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
                       ClusterForest& clusterForest,
                       FragmentLengthDistribution& fragLengthDist,
                       BiasParams& observedGCParams,
-                      /**
-                       * NOTE : test new el model in future
-                       * EffectiveLengthStats& effLengthStats,
-                       **/
                       std::atomic<uint64_t>& numAssignedFragments,
                       std::default_random_engine& randEng, bool initialRound,
-                      std::atomic<bool>& burnedIn, double& maxZeroFrac);
+                      std::atomic<bool>& burnedIn, double& maxZeroFrac,
+                      MiniBatchScratch& scratch);
 
 template <typename CoverageCalculator>
 inline void collectHitsForRead(SalmonIndex* sidx, const bwtintv_v* a,
@@ -595,6 +551,11 @@ inline void collectHitsForRead(SalmonIndex* sidx, const bwtintv_v* a,
   bwaidx_t* idx = sidx->bwaIndex();
   mem_collect_intv(salmonOpts, memOptions, sidx, readLen, read, auxHits);
 
+  // The occurrences of the MEMs, grouped into hits once they're all found
+  // (the buffer is reused by the thread's next read)
+  static thread_local std::vector<salmon::smem::Anchor> anchors;
+  anchors.clear();
+
   // For each MEM
   int firstSeedLen{-1};
   for (int i = 0; i < auxHits->mem.n; ++i) {
@@ -771,33 +732,14 @@ inline void collectHitsForRead(SalmonIndex* sidx, const bwtintv_v* a,
         }
       }
 
-      auto hitIt = std::find_if(hits.begin(), hits.end(),
-                                [refID](CoverageCalculator& c) -> bool {
-                                  return c.targetID == refID;
-                                });
-      if (isRev) {
-        if (hitIt == hits.end()) {
-          CoverageCalculator hit;
-          hit.targetID = refID;
-          hit.addFragMatchRC(hitLoc, queryStart, slen, rlen);
-          hits.emplace_back(hit);
-        } else {
-          hitIt->addFragMatchRC(hitLoc, queryStart, slen, rlen);
-          // hits[refID].addFragMatchRC(hitLoc, queryStart , slen, rlen);
-        }
-      } else {
-        if (hitIt == hits.end()) {
-          CoverageCalculator hit;
-          hit.targetID = refID;
-          hit.addFragMatch(hitLoc, queryStart, slen);
-          hits.emplace_back(hit);
-        } else {
-          hitIt->addFragMatch(hitLoc, queryStart, slen);
-          // hits[refID].addFragMatch(hitLoc, queryStart, slen);
-        }
-      }
+      anchors.push_back({static_cast<uint32_t>(refID),
+                         static_cast<uint32_t>(anchors.size()),
+                         static_cast<uint32_t>(hitLoc),
+                         static_cast<uint32_t>(queryStart),
+                         static_cast<uint32_t>(slen), rlen, isRev != 0});
     } // for k
   }
+  salmon::smem::groupAnchors(anchors, hits);
 }
 
 inline bool consistentNames(header_sequence_qual& r) { return true; }
@@ -1421,9 +1363,8 @@ inline void getHitsForFragment(fastx_parser::ReadSeq& frag,
   }
 }
 
-// To use the parser in the following, we get "jobs" until none is
-// available. A job behaves like a pointer to the type
-// jellyfish::sequence_list (see whole_sequence_parser.hpp).
+// The reads are taken from the parser a chunk (read group) at a time, until
+// it has none left (see FastxParser.hpp).
 template <typename ParserT, typename CoverageCalculator>
 void processReadsMEM(
     ParserT* parser, ReadExperiment& readExp, ReadLibrary& rl,
@@ -1434,12 +1375,9 @@ void processReadsMEM(
     SalmonIndex* sidx, std::vector<Transcript>& transcripts,
     ForgettingMassCalculator& fmCalc, ClusterForest& clusterForest,
     FragmentLengthDistribution& fragLengthDist, BiasParams& observedGCParams,
-    /**
-     * NOTE : test new el model in future
-     * EffectiveLengthStats& obsEffLength,
-     **/
-    mem_opt_t* memOptions, const SalmonOpts& salmonOpts, double coverageThresh,
-    std::mutex& iomutex, bool initialRound, std::atomic<bool>& burnedIn,
+    MiniBatchScratch& scratch, mem_opt_t* memOptions,
+    const SalmonOpts& salmonOpts, double coverageThresh, std::mutex& iomutex,
+    bool initialRound, std::atomic<bool>& burnedIn,
     volatile bool& writeToCache) {
   // ERROR
   salmonOpts.jointLog->error("Quasimapping cannot be used with the FMD index "
@@ -1457,19 +1395,13 @@ void processReadsMEM(
     SalmonIndex* sidx, std::vector<Transcript>& transcripts,
     ForgettingMassCalculator& fmCalc, ClusterForest& clusterForest,
     FragmentLengthDistribution& fragLengthDist, BiasParams& observedGCParams,
-    /**
-     * NOTE : test new el model in future
-     * EffectiveLengthStats& obsEffLengths,
-     **/
-    mem_opt_t* memOptions, const SalmonOpts& salmonOpts, double coverageThresh,
-    std::mutex& iomutex, bool initialRound, std::atomic<bool>& burnedIn,
+    MiniBatchScratch& scratch, mem_opt_t* memOptions,
+    const SalmonOpts& salmonOpts, double coverageThresh, std::mutex& iomutex,
+    bool initialRound, std::atomic<bool>& burnedIn,
     volatile bool& writeToCache) {
   uint64_t count_fwd = 0, count_bwd = 0;
-  // Seed with a real random value, if available
-  std::random_device rd;
-
-  // Create a random uniform distribution
-  std::default_random_engine eng(rd());
+  // Seed with a real random value, unless a seed was given
+  std::default_random_engine eng(salmon::utils::onlinePhaseSeed(salmonOpts));
 
   uint64_t prevObservedFrags{1};
   uint64_t leftHitCount{0};
@@ -1488,6 +1420,7 @@ void processReadsMEM(
   uint64_t localUpperBoundHits{0};
   size_t rangeSize{0};
   double maxZeroFrac{0.0};
+  prepareScratch(scratch, salmonOpts, 0);
   auto rg = parser->getReadGroup();
   while (parser->refill(rg)) {
     rangeSize = rg.size();
@@ -1547,11 +1480,8 @@ void processReadsMEM(
     processMiniBatch<SMEMAlignment>(
         readExp, fmCalc, firstTimestepOfRound, rl, salmonOpts, hitLists,
         transcripts, clusterForest, fragLengthDist, observedGCParams,
-        /**
-         * NOTE : test new el model in future
-         * obsEffLengths,
-         **/
-        numAssignedFragments, eng, initialRound, burnedIn, maxZeroFrac);
+        numAssignedFragments, eng, initialRound, burnedIn, maxZeroFrac,
+        scratch);
   }
 
   if (maxZeroFrac > 0.0) {
@@ -1560,6 +1490,9 @@ void processReadsMEM(
                               maxZeroFrac);
   }
 
+  readExp.addScratchRegrowths(scratch.takeRegrowths());
+  scratch.finishLocalEqClasses(readExp.equivalenceClassBuilder());
+
   smem_aux_destroy(auxHits);
   smem_itr_destroy(itr);
 }
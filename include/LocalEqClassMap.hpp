@@ -0,0 +1,115 @@
+#ifndef LOCAL_EQ_CLASS_MAP_HPP
+#define LOCAL_EQ_CLASS_MAP_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "EquivalenceClassBuilder.hpp"
+#include "TranscriptGroup.hpp"
+
+/**
+ * A small, single-threaded, open-addressing map from equivalence class
+ * labels to their (summed) weights and counts.  Each mapping thread
+ * aggregates the classes of the fragments it processes in its own
+ * LocalEqClassMap, and periodically flushes the aggregated classes into the
+ * shared EquivalenceClassBuilder.  Since most fragments fall into a
+ * relatively small number of common classes, this replaces many updates of
+ * the (locked) global map with a few merges per flush.
+ *
+ * The slots (and the vectors they hold) are reused across flushes, so that
+ * once the map is warm, adding a class does not allocate.
+ */
+class LocalEqClassMap {
+public:
+  /**
+   * `flushInterval` is the number of fragments after which the map should
+   * be flushed; `log2Capacity` determines the (fixed) number of slots.  The
+   * map also asks to be flushed when it becomes half full.
+   */
+  LocalEqClassMap(uint64_t flushInterval = 0, uint32_t log2Capacity = 14)
+      : slots_(1ULL << log2Capacity), mask_((1ULL << log2Capacity) - 1),
+        flushInterval_(flushInterval) {
+    used_.reserve(slots_.size() / 2 + 1);
+  }
+
+  /**
+   * Add a single observation of the class `g` with (non-log) weights
+   * `weights`, and, with online bootstraps, its weight in each of the
+   * numReplicates replicates.  Returns true if the map should now be flushed.
+   */
+  inline bool add(const TranscriptGroup& g, const std::vector<double>& weights,
+                  const uint32_t* replicateWeights = nullptr,
+                  uint32_t numReplicates = 0) {
+    size_t idx = g.hash & mask_;
+    while (true) {
+      auto& slot = slots_[idx];
+      if (slot.count == 0) {
+        slot.key.txps.assign(g.txps.begin(), g.txps.end());
+        slot.key.hash = g.hash;
+        slot.key.valid = true;
+        slot.weights.assign(weights.begin(), weights.end());
+        if (replicateWeights != nullptr) {
+          slot.replicateCounts.assign(replicateWeights,
+                                      replicateWeights + numReplicates);
+        }
+        slot.count = 1;
+        used_.push_back(idx);
+        break;
+      } else if (slot.key.hash == g.hash and slot.key.txps == g.txps) {
+        ++slot.count;
+        for (size_t i = 0; i < weights.size(); ++i) {
+          slot.weights[i] += weights[i];
+        }
+        for (uint32_t r = 0; replicateWeights != nullptr and r < numReplicates;
+             ++r) {
+          slot.replicateCounts[r] += replicateWeights[r];
+        }
+        break;
+      }
+      idx = (idx + 1) & mask_;
+    }
+    ++numAdded_;
+    return (numAdded_ >= flushInterval_) or (2 * used_.size() > slots_.size());
+  }
+
+  /**
+   * Merge all of the classes aggregated since the last flush into `eqBuilder`
+   * and empty the map.
+   */
+  void flush(EquivalenceClassBuilder& eqBuilder) {
+    if (used_.empty()) {
+      numAdded_ = 0;
+      return;
+    }
+    for (auto idx : used_) {
+      auto& slot = slots_[idx];
+      eqBuilder.addGroupInPlace(slot.key, slot.weights, slot.count,
+                                slot.replicateCounts.empty()
+                                    ? nullptr
+                                    : slot.replicateCounts.data());
+      slot.count = 0;
+    }
+    used_.clear();
+    numAdded_ = 0;
+    ++numFlushes_;
+  }
+
+  uint64_t numFlushes() const { return numFlushes_; }
+
+private:
+  struct Slot {
+    TranscriptGroup key;
+    std::vector<double> weights;
+    std::vector<uint32_t> replicateCounts;
+    uint64_t count{0};
+  };
+
+  std::vector<Slot> slots_;
+  std::vector<size_t> used_;
+  size_t mask_;
+  uint64_t flushInterval_;
+  uint64_t numAdded_{0};
+  uint64_t numFlushes_{0};
+};
+
+#endif // LOCAL_EQ_CLASS_MAP_HPP
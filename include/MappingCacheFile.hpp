@@ -0,0 +1,264 @@
+#ifndef MAPPING_CACHE_FILE_HPP
+#define MAPPING_CACHE_FILE_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "AuxRecordWriter.hpp"
+#include "LibraryFormat.hpp"
+#include "RapMapUtils.hpp"
+
+/**
+ * The persistent mapping cache of --mappingCacheDir.  The final mappings of
+ * every fragment of a read library (after the filters and the orphan
+ * handling, as processMiniBatch sees them) are written, while mapping, to
+ * <dir>/<key>.maps, where the key is that of the index, of the read files
+ * and of the options that change the mappings (see libraryKey).  A later
+ * run with the same key replays them instead of parsing and mapping the
+ * reads, so that only the inference is redone.  The file is
+ * (all integers are little endian)
+ *
+ *   header : char[8] magic ("SALMNMPC"), uint32 version (1), char[16] key
+ *   blocks : until the end of the file, each with uint32 number of
+ *            fragments, uint32 uncompressed size, uint32 compressed size,
+ *            then a zlib stream holding records for the fragments
+ *
+ * A fragment's record holds (all LEB128 varints but the flags and the
+ * format) the number of mappings (0 if it's unmapped) and, for each
+ * mapping, the transcript id, the zigzag-encoded position, the read length,
+ * a flags byte (bit 0: the read maps forward, bit 1: its mate does, bits
+ * 2-3: the rapmap::utils::MateStatus), the LibraryFormat id of the mapping
+ * and, for a mapped pair, the zigzag-encoded position of the mate, its
+ * length and the fragment length.
+ *
+ * Each mapping thread compresses its own blocks, which are written out in
+ * the order in which they are finished (the order of the online inference
+ * isn't deterministic anyway).
+ */
+namespace salmon {
+namespace mapcache {
+
+/**
+ * The key (16 hex digits) of the mappings of the read files with the index
+ * in indexDir, and the mapping options described by options.  The index is
+ * known by the names, sizes and modification times of its files; a read
+ * file by its path, size and modification time, and the hash of its first
+ * and last MiB (rather than of all of it, which would take a pass over the
+ * reads of its own).
+ */
+std::string libraryKey(const boost::filesystem::path& indexDir,
+                       const std::vector<std::string>& readFiles,
+                       const std::string& options);
+
+// Where the mappings of key are kept in dir
+boost::filesystem::path cacheFile(const boost::filesystem::path& dir,
+                                  const std::string& key);
+
+/**
+ * Writes the cache file of a key.  The blocks go, through an AuxRecordWriter,
+ * to <key>.maps.tmp, which commit() moves into place once the library has
+ * been mapped in full; a writer that isn't committed (the run failed, or
+ * was stopped) removes its file.
+ */
+class Writer {
+public:
+  Writer(const boost::filesystem::path& dir, const std::string& key);
+  ~Writer();
+
+  Writer(const Writer&) = delete;
+  Writer& operator=(const Writer&) = delete;
+
+  bool good() const { return blocks_ != nullptr and blocks_->good(); }
+
+  // Hand a block (of a BlockEncoder) to the writer
+  void write(const char* data, size_t n) { blocks_->write(data, n); }
+
+  /**
+   * Write out everything that was handed over, and move the file into
+   * place; false if it couldn't be.
+   */
+  bool commit();
+
+private:
+  boost::filesystem::path path_;
+  boost::filesystem::path tmpPath_;
+  std::ofstream out_;
+  std::unique_ptr<AuxRecordWriter> blocks_{nullptr};
+  bool committed_{false};
+};
+
+/**
+ * Encodes the mappings of the fragments of one thread into blocks of
+ * (about) blockSize bytes before compression.
+ */
+class BlockEncoder {
+public:
+  explicit BlockEncoder(size_t blockSize = size_t(1) << 20)
+      : blockSize_(blockSize) {
+    buf_.reserve(blockSize_ + 4096);
+  }
+
+  template <typename HitT> void add(const std::vector<HitT>& hits) {
+    putVarint_(hits.size());
+    for (auto& h : hits) {
+      putVarint_(h.tid);
+      putVarint_(zigzag_(h.pos));
+      putVarint_(h.readLen);
+      uint8_t flags = (h.fwd ? 1 : 0) | (h.mateIsFwd ? 2 : 0) |
+                      (static_cast<uint8_t>(h.mateStatus) << 2);
+      buf_.push_back(static_cast<char>(flags));
+      buf_.push_back(static_cast<char>(h.format.formatID()));
+      if (h.mateStatus == rapmap::utils::MateStatus::PAIRED_END_PAIRED) {
+        putVarint_(zigzag_(h.matePos));
+        putVarint_(h.mateLen);
+        putVarint_(h.fragLen);
+      }
+    }
+    ++numFragments_;
+  }
+
+  // Compress and write the block if it's full (e.g. after each batch)
+  bool flushIfFull(Writer& w) {
+    return (buf_.size() < blockSize_) ? true : flush(w);
+  }
+
+  // Compress and write whatever has been added
+  bool flush(Writer& w);
+
+private:
+  void putVarint_(uint64_t v) {
+    while (v >= 0x80) {
+      buf_.push_back(static_cast<char>((v & 0x7f) | 0x80));
+      v >>= 7;
+    }
+    buf_.push_back(static_cast<char>(v));
+  }
+
+  static uint64_t zigzag_(int64_t d) {
+    return (static_cast<uint64_t>(d) << 1) ^ static_cast<uint64_t>(d >> 63);
+  }
+
+  size_t blockSize_;
+  std::vector<char> buf_;
+  uint32_t numFragments_{0};
+  std::vector<char> out_;
+};
+
+/**
+ * Decodes the fragments of a block (that a Reader filled it with), one at
+ * a time.
+ */
+class BlockDecoder {
+public:
+  /**
+   * Replace the contents of hits with the mappings of the next fragment of
+   * the block; false once there are none left (or the block is corrupt).
+   * HitT is a rapmap::utils::QuasiAlignment (or anything with its
+   * constructor and fields).
+   */
+  template <typename HitT> bool next(std::vector<HitT>& hits) {
+    hits.clear();
+    uint64_t numHits{0};
+    if (numLeft_ == 0 or !getVarint_(numHits)) {
+      return false;
+    }
+    for (uint64_t i = 0; i < numHits; ++i) {
+      uint64_t tid, pos, readLen;
+      if (!getVarint_(tid) or !getVarint_(pos) or !getVarint_(readLen) or
+          at_ + 2 > buf_.size()) {
+        return false;
+      }
+      uint8_t flags = static_cast<uint8_t>(buf_[at_++]);
+      uint8_t formatID = static_cast<uint8_t>(buf_[at_++]);
+      auto mateStatus = static_cast<rapmap::utils::MateStatus>(flags >> 2);
+      bool paired =
+          (mateStatus == rapmap::utils::MateStatus::PAIRED_END_PAIRED);
+      uint64_t matePos{0}, mateLen{0}, fragLen{0};
+      if (paired and
+          (!getVarint_(matePos) or !getVarint_(mateLen) or
+           !getVarint_(fragLen))) {
+        return false;
+      }
+      hits.emplace_back(static_cast<uint32_t>(tid), unzigzag_(pos),
+                        (flags & 1) != 0, static_cast<uint32_t>(readLen),
+                        static_cast<uint32_t>(fragLen), paired);
+      auto& h = hits.back();
+      h.mateIsFwd = (flags & 2) != 0;
+      h.mateStatus = mateStatus;
+      h.format = LibraryFormat::formatFromID(formatID);
+      if (paired) {
+        h.matePos = unzigzag_(matePos);
+        h.mateLen = static_cast<uint32_t>(mateLen);
+      }
+    }
+    --numLeft_;
+    return true;
+  }
+
+  // The number of fragments in the block
+  uint32_t size() const { return size_; }
+
+private:
+  friend class Reader;
+
+  bool getVarint_(uint64_t& v) {
+    v = 0;
+    for (uint32_t shift = 0; at_ < buf_.size() and shift < 64; shift += 7) {
+      uint8_t b = static_cast<uint8_t>(buf_[at_++]);
+      v |= static_cast<uint64_t>(b & 0x7f) << shift;
+      if ((b & 0x80) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static int32_t unzigzag_(uint64_t v) {
+    return static_cast<int32_t>(static_cast<int64_t>(v >> 1) ^
+                                -static_cast<int64_t>(v & 1));
+  }
+
+  std::vector<char> buf_;
+  std::vector<char> compressed_;
+  size_t at_{0};
+  uint32_t size_{0};
+  uint32_t numLeft_{0};
+};
+
+/**
+ * Reads the blocks of a cache file; any number of threads may take blocks
+ * from one Reader (each is read under a lock, and decompressed outside of
+ * it).
+ */
+class Reader {
+public:
+  /**
+   * Open the cache file at path; false if it doesn't exist, or isn't that
+   * of key.
+   */
+  bool open(const boost::filesystem::path& path, const std::string& key);
+
+  /**
+   * Read the next block into decoder; false at the end of the file (or if
+   * the file is truncated or corrupt, in which case failed() is true).
+   */
+  bool next(BlockDecoder& decoder);
+
+  bool failed() const { return failed_; }
+
+private:
+  std::mutex mutex_;
+  std::ifstream in_;
+  bool failed_{false};
+};
+
+} // namespace mapcache
+} // namespace salmon
+
+#endif // MAPPING_CACHE_FILE_HPP
@@ -0,0 +1,112 @@
+#ifndef MAPPING_FILE_HPP
+#define MAPPING_FILE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "AuxRecordWriter.hpp"
+#include "RapMapUtils.hpp"
+
+/**
+ * The binary mapping file written by --writeMappings with --binaryMappings.
+ * It holds, for each mapped read (or read pair), the information of the SAM
+ * output that quantification uses, in a small fraction of the space and of
+ * the time it takes to format.  It can be written to a pipe, and consists of
+ * (all integers are little endian)
+ *
+ *   header : char[8] magic ("SALMNMAP"), uint32 version (1), uint32 flags
+ *            (0), uint64 number of transcripts, uint64 compressed size,
+ *            then a zlib stream holding each transcript's name and length,
+ *            as "name\tlength\n"
+ *   blocks : until the end of the file, each with uint32 number of reads,
+ *            uint32 uncompressed size, uint32 compressed size, then a zlib
+ *            stream holding records for the reads
+ *
+ * A read's record holds (all LEB128 varints but the name and the flags) the
+ * length of its name, the name (without the /1 of a pair), the number of
+ * mappings and, for each mapping, the transcript id, the zigzag-encoded
+ * position, the read length, a flags byte (bit 0: the read maps forward,
+ * bit 1: its mate does, bits 2-3: the rapmap::utils::MateStatus) and, for a
+ * mapped pair, the zigzag-encoded position of the mate, its length and the
+ * fragment length.
+ *
+ * Each mapping thread compresses its own blocks, which are written out in
+ * the order in which they are finished, so the reads aren't in input order.
+ */
+namespace salmon {
+namespace mappings {
+
+/**
+ * Write the header of the file; must be handed to w before any block.
+ */
+bool writeHeader(AuxRecordWriter& w, const std::vector<std::string>& names,
+                 const std::vector<uint32_t>& lengths);
+
+/**
+ * Encodes the mappings of the reads of one thread into blocks of (about)
+ * blockSize bytes before compression.
+ */
+class BlockEncoder {
+public:
+  explicit BlockEncoder(size_t blockSize = size_t(1) << 20)
+      : blockSize_(blockSize) {
+    buf_.reserve(blockSize_ + 4096);
+  }
+
+  template <typename HitT>
+  void add(const char* name, size_t nameLen, const std::vector<HitT>& hits) {
+    if (nameLen >= 2 and name[nameLen - 2] == '/' and
+        name[nameLen - 1] == '1') {
+      nameLen -= 2;
+    }
+    putVarint_(nameLen);
+    buf_.insert(buf_.end(), name, name + nameLen);
+    putVarint_(hits.size());
+    for (auto& h : hits) {
+      putVarint_(h.tid);
+      putVarint_(zigzag_(h.pos));
+      putVarint_(h.readLen);
+      uint8_t flags = (h.fwd ? 1 : 0) | (h.mateIsFwd ? 2 : 0) |
+                      (static_cast<uint8_t>(h.mateStatus) << 2);
+      buf_.push_back(static_cast<char>(flags));
+      if (h.mateStatus == rapmap::utils::MateStatus::PAIRED_END_PAIRED) {
+        putVarint_(zigzag_(h.matePos));
+        putVarint_(h.mateLen);
+        putVarint_(h.fragLen);
+      }
+    }
+    ++numReads_;
+  }
+
+  // Compress and write the block if it's full (e.g. after each batch)
+  bool flushIfFull(AuxRecordWriter& w) {
+    return (buf_.size() < blockSize_) ? true : flush(w);
+  }
+
+  // Compress and write whatever has been added
+  bool flush(AuxRecordWriter& w);
+
+private:
+  void putVarint_(uint64_t v) {
+    while (v >= 0x80) {
+      buf_.push_back(static_cast<char>((v & 0x7f) | 0x80));
+      v >>= 7;
+    }
+    buf_.push_back(static_cast<char>(v));
+  }
+
+  static uint64_t zigzag_(int64_t d) {
+    return (static_cast<uint64_t>(d) << 1) ^ static_cast<uint64_t>(d >> 63);
+  }
+
+  size_t blockSize_;
+  std::vector<char> buf_;
+  uint32_t numReads_{0};
+  std::vector<char> out_;
+};
+
+} // namespace mappings
+} // namespace salmon
+
+#endif // MAPPING_FILE_HPP
@@ -0,0 +1,111 @@
+#ifndef __MAPPING_VERIFIER_HPP__
+#define __MAPPING_VERIFIER_HPP__
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Counts of the work done by the MappingVerifiers of all mapping threads
+ * (reported in meta_info.json).
+ */
+struct MappingVerifierStats {
+  uint64_t numChecked{0};   // candidate (read, position) pairs scored
+  uint64_t numCacheHits{0}; // of which the score was found in the cache
+  uint64_t numRejected{0};  // of which the read was too far from the txp.
+};
+
+/**
+ * An optional check of the quasi-mapping candidates of a read against the
+ * transcript sequence.  A candidate is kept only if the read, placed at the
+ * candidate position and strand, is within maxDiffs = maxEditFraction *
+ * (read length) edits of the transcript.  The edit distance is computed
+ * with dynamic programming restricted to a band of width 2 * maxDiffs + 1
+ * around the implied diagonal (so that indels of up to maxDiffs bases are
+ * allowed), and the computation stops as soon as every cell of a row
+ * exceeds maxDiffs.
+ *
+ * Duplicate reads are common, and map to the same candidates; the outcome of
+ * each check is therefore memoized in a (per-thread, bounded) cache keyed on
+ * a hash of the read sequence and the candidate (transcript, position,
+ * strand).  The cache is simply emptied when it's full.
+ */
+class MappingVerifier {
+public:
+  /**
+   * A read whose candidates are to be checked; its hash and reverse
+   * complement are computed (once) when they're first needed.
+   */
+  class Read {
+  public:
+    void reset(const std::string& seq) {
+      seq_ = &seq;
+      haveHash_ = false;
+      haveRC_ = false;
+    }
+    const std::string& seq() const { return *seq_; }
+
+  private:
+    friend class MappingVerifier;
+    const std::string* seq_{nullptr};
+    bool haveHash_{false};
+    bool haveRC_{false};
+    uint64_t hash_{0};
+    std::string rc_;
+  };
+
+  MappingVerifier(double maxEditFraction, size_t maxCacheEntries = 1 << 18)
+      : maxEditFraction_(maxEditFraction), maxCacheEntries_(maxCacheEntries) {
+  }
+
+  bool enabled() const { return maxEditFraction_ > 0.0; }
+
+  /**
+   * True if read, placed at pos on the forward (fwd) or reverse complement
+   * strand of the transcript tid (whose sequence is txpSeq, of length
+   * txpLen), is within the allowed number of edits of it.
+   */
+  bool check(Read& read, uint32_t tid, int32_t pos, bool fwd,
+             const char* txpSeq, int32_t txpLen);
+
+  const MappingVerifierStats& stats() const { return stats_; }
+
+private:
+  struct Key {
+    uint64_t readHash;
+    uint32_t tid;
+    int32_t pos;
+    bool fwd;
+    bool operator==(const Key& o) const {
+      return readHash == o.readHash and tid == o.tid and pos == o.pos and
+             fwd == o.fwd;
+    }
+  };
+  struct KeyHasher {
+    size_t operator()(const Key& k) const {
+      uint64_t h = k.readHash ^ (static_cast<uint64_t>(k.tid) << 32) ^
+                   static_cast<uint32_t>(k.pos) ^ (k.fwd ? 0x9e3779b9 : 0);
+      // a final mix (from MurmurHash3), as the keys differ in few bits
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdULL;
+      h ^= h >> 33;
+      return static_cast<size_t>(h);
+    }
+  };
+
+  // The banded edit distance of seq against txpSeq at pos, if at most
+  // maxDiffs; otherwise some value > maxDiffs.
+  int32_t bandedEditDistance_(const std::string& seq, int32_t pos,
+                              const char* txpSeq, int32_t txpLen,
+                              int32_t maxDiffs);
+
+  double maxEditFraction_;
+  size_t maxCacheEntries_;
+  std::unordered_map<Key, bool, KeyHasher> cache_;
+  std::vector<int32_t> prevRow_;
+  std::vector<int32_t> curRow_;
+  MappingVerifierStats stats_;
+};
+
+#endif // __MAPPING_VERIFIER_HPP__
@@ -0,0 +1,176 @@
+#ifndef __MEMORY_BUDGET_HPP__
+#define __MEMORY_BUDGET_HPP__
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace salmon {
+namespace memory {
+
+class Budget;
+
+/**
+ * The bytes held by one of the large structures of a run (the index, the
+ * equivalence classes, the alignment pools, ...), as reported by the code
+ * that allocates them; see Budget.
+ */
+class Account {
+public:
+  Account(Budget* budget, const std::string& name)
+      : budget_(budget), name_(name) {}
+
+  const std::string& name() const { return name_; }
+
+  // Add (or, if negative, remove) delta bytes
+  inline void charge(int64_t delta);
+
+  // The account now holds bytes
+  inline void set(uint64_t bytes);
+
+  uint64_t bytes() const {
+    int64_t b = bytes_.load(std::memory_order_relaxed);
+    return (b > 0) ? static_cast<uint64_t>(b) : 0;
+  }
+  uint64_t peakBytes() const {
+    return static_cast<uint64_t>(peak_.load(std::memory_order_relaxed));
+  }
+
+private:
+  Budget* budget_;
+  std::string name_;
+  std::atomic<int64_t> bytes_{0};
+  std::atomic<int64_t> peak_{0};
+};
+
+// A snapshot of an account
+struct AccountSummary {
+  std::string name;
+  uint64_t bytes{0};
+  uint64_t peakBytes{0};
+};
+
+/**
+ * The memory budget of a run (--memoryBudget), and the accounts of the
+ * structures that take most of the memory.  The accounts are estimates,
+ * kept by the code that sizes each structure, not a count of every
+ * allocation; they're what the code consults to size its buffers, queues
+ * and caches, and to decide between holding data in memory and reading it
+ * from disk again, so that the run stays within the budget rather than
+ * being killed by its scheduler.  Without a limit, the accounts are still
+ * kept (and written, with the performance statistics, to meta_info.json),
+ * but nothing is sized by them.
+ */
+class Budget {
+public:
+  Budget() = default;
+  Budget(const Budget&) = delete;
+  Budget& operator=(const Budget&) = delete;
+
+  // 0 means no limit
+  void setLimit(uint64_t bytes) { limit_ = bytes; }
+  uint64_t limit() const { return limit_; }
+  bool limited() const { return limit_ > 0; }
+
+  // The account name (created on first use)
+  Account& account(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& a : accounts_) {
+      if (a.name() == name) {
+        return a;
+      }
+    }
+    accounts_.emplace_back(this, name);
+    return accounts_.back();
+  }
+
+  // The bytes held by all of the accounts
+  uint64_t used() const {
+    int64_t u = used_.load(std::memory_order_relaxed);
+    return (u > 0) ? static_cast<uint64_t>(u) : 0;
+  }
+  uint64_t peakUsed() const {
+    return static_cast<uint64_t>(peak_.load(std::memory_order_relaxed));
+  }
+
+  // The bytes left before the limit (the largest uint64_t without one)
+  uint64_t available() const {
+    if (!limited()) {
+      return std::numeric_limits<uint64_t>::max();
+    }
+    uint64_t u = used();
+    return (u < limit_) ? limit_ - u : 0;
+  }
+
+  // Whether bytes more would fit in the given fraction of what's available
+  bool fits(uint64_t bytes, double fraction = 1.0) const {
+    return !limited() or
+           static_cast<double>(bytes) <= fraction * available();
+  }
+
+  // Whether the accounts hold more than the limit
+  bool exceeded() const { return limited() and used() > limit_; }
+
+  std::vector<AccountSummary> summaries() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<AccountSummary> s;
+    for (auto& a : accounts_) {
+      AccountSummary as;
+      as.name = a.name();
+      as.bytes = a.bytes();
+      as.peakBytes = a.peakBytes();
+      s.push_back(as);
+    }
+    return s;
+  }
+
+private:
+  friend class Account;
+
+  void add_(int64_t delta) {
+    int64_t u = used_.fetch_add(delta, std::memory_order_relaxed) + delta;
+    raise_(peak_, u);
+  }
+
+  static void raise_(std::atomic<int64_t>& peak, int64_t v) {
+    int64_t p = peak.load(std::memory_order_relaxed);
+    while (v > p and !peak.compare_exchange_weak(p, v,
+                                                 std::memory_order_relaxed)) {
+    }
+  }
+
+  uint64_t limit_{0};
+  std::atomic<int64_t> used_{0};
+  std::atomic<int64_t> peak_{0};
+  // never shrinks, so the accounts handed out stay valid
+  std::deque<Account> accounts_;
+  mutable std::mutex mutex_;
+};
+
+inline void Account::charge(int64_t delta) {
+  int64_t b = bytes_.fetch_add(delta, std::memory_order_relaxed) + delta;
+  Budget::raise_(peak_, b);
+  budget_->add_(delta);
+}
+
+inline void Account::set(uint64_t bytes) {
+  int64_t b = static_cast<int64_t>(bytes);
+  int64_t old = bytes_.exchange(b, std::memory_order_relaxed);
+  Budget::raise_(peak_, b);
+  budget_->add_(b - old);
+}
+
+// The budget of the run
+inline Budget& budget() {
+  static Budget b;
+  return b;
+}
+
+} // namespace memory
+} // namespace salmon
+
+#endif // __MEMORY_BUDGET_HPP__
@@ -0,0 +1,75 @@
+#ifndef __MEMORY_PLACEMENT_HPP__
+#define __MEMORY_PLACEMENT_HPP__
+
+#include <cstddef>
+#include <utility>
+
+namespace salmon {
+namespace memory {
+
+/**
+ * How the large, read-only arrays of an index should be placed in memory.
+ */
+struct Placement {
+  bool hugePages{false};  // back them with (transparent) huge pages
+  bool interleave{false}; // spread their pages across all NUMA nodes
+
+  bool isDefault() const { return !hugePages and !interleave; }
+};
+
+/**
+ * Ask the kernel to back the (whole pages of the) range [addr, addr + len)
+ * with transparent huge pages.  Returns false if this isn't supported.
+ */
+bool adviseHugePages(const void* addr, size_t len);
+
+/**
+ * Interleave the pages of the range [addr, addr + len) across the online
+ * NUMA nodes; pages that have already been touched are migrated.  Returns
+ * false if there is only one node, or if this isn't supported.
+ */
+bool interleavePages(const void* addr, size_t len, bool movePages);
+
+/**
+ * Give the (whole pages of the) freshly zeroed range [addr, addr + len) back
+ * to the kernel, so that each is faulted in again, still zeroed, on the NUMA
+ * node of the thread that next touches it (rather than on that of the thread
+ * that zeroed it).  Returns false, and leaves the range alone, if there is
+ * only one node, or if this isn't supported.
+ */
+bool releaseForFirstTouch(const void* addr, size_t len);
+
+/**
+ * Move the contents of the contiguous container c (a std::vector or
+ * std::string) into a newly allocated buffer placed according to p.  The
+ * policy is applied before the new pages are first touched, so that they're
+ * faulted in as huge pages and on the right nodes; this needs as much memory
+ * again as c holds, until the old buffer is freed.  Returns the number of
+ * bytes placed.
+ */
+template <typename ContainerT>
+size_t place(ContainerT& c, const Placement& p) {
+  using ValueT = typename ContainerT::value_type;
+  if (p.isDefault() or c.empty()) {
+    return 0;
+  }
+  ContainerT placed;
+  placed.reserve(c.size());
+  size_t len = c.size() * sizeof(ValueT);
+  // The buffer of a large container comes straight from mmap(), so none of
+  // its pages have been touched yet.
+  const void* addr = placed.data();
+  if (p.hugePages) {
+    adviseHugePages(addr, len);
+  }
+  if (p.interleave) {
+    interleavePages(addr, len, false);
+  }
+  placed.assign(c.begin(), c.end());
+  std::swap(c, placed);
+  return len;
+}
+} // namespace memory
+} // namespace salmon
+
+#endif // __MEMORY_PLACEMENT_HPP__
@@ -5,7 +5,7 @@
 #include "LibraryFormat.hpp"
 #include "ReadPair.hpp"
 #include "UnpairedRead.hpp"
-#include "concurrentqueue.h"
+#include "blockingconcurrentqueue.h"
 #include <vector>
 
 template <typename AlnGroupT> class MiniBatchInfo {
@@ -21,26 +21,21 @@ public:
   std::vector<AlnGroupT*>* alignments;
   double logForgettingMass;
 
+  // Return the fragments and the groups of the batch to their pools, each
+  // with a single bulk enqueue
   template <typename FragT>
-  void release(tbb::concurrent_queue<FragT*>& fragmentQueue,
-               moodycamel::ConcurrentQueue<AlnGroupT*>& alignmentGroupQueue) {
-    // tbb::concurrent_bounded_queue<AlnGroupT*>& alignmentGroupQueue){
-    size_t ng{0};
+  void release(
+      moodycamel::BlockingConcurrentQueue<FragT*>& fragmentQueue,
+      moodycamel::BlockingConcurrentQueue<AlnGroupT*>& alignmentGroupQueue) {
+    std::vector<FragT*> frags;
+    frags.reserve(alignments->size());
     for (auto& alnGroup : *alignments) {
-      // fragmentQueue.enqueue_bulk(alnGroup->alignments().begin(),
-      // alnGroup->alignments().size());
-
-      for (auto aln : alnGroup->alignments()) {
-        fragmentQueue.push(aln);
-        aln = nullptr;
-      }
-
-      alnGroup->alignments().clear();
-      // alignmentGroupQueue.push(alnGroup);
-      // alnGroup = nullptr;
-      ++ng;
+      auto& alns = alnGroup->alignments();
+      frags.insert(frags.end(), alns.begin(), alns.end());
+      alns.clear();
     }
 
+    fragmentQueue.enqueue_bulk(frags.begin(), frags.size());
     alignmentGroupQueue.enqueue_bulk(
         std::make_move_iterator(alignments->begin()), alignments->size());
     delete alignments;
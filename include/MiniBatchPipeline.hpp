@@ -0,0 +1,89 @@
+#ifndef __MINI_BATCH_PIPELINE_HPP__
+#define __MINI_BATCH_PIPELINE_HPP__
+
+#include <cstddef>
+#include <vector>
+
+#include "tbb/concurrent_queue.h"
+
+/**
+ * Hands the mini-batches of mapped fragments from the mapping threads to a
+ * separate pool of inference threads (which run processMiniBatch on them),
+ * so that each stage keeps its own working set (the index, or the
+ * transcripts, fragment length distribution and bias models) in cache, and
+ * the two can be sized independently (--inferenceThreads).
+ *
+ * The batches live in a fixed number of slots (each a GroupVecT, i.e. an
+ * AlnGroupVec, of the mini-batch size), which go round from the free queue
+ * to a mapping thread, which fills one and submits it, to an inference
+ * thread, which processes it and releases it.  A mapping thread waits in
+ * acquire() if all of the slots are in use (inference can't keep up), so
+ * the memory used is bounded.  (The queues are TBB's, rather than
+ * moodycamel's, since the latter are only FIFO per producer.)
+ */
+template <typename GroupVecT> class MiniBatchPipeline {
+public:
+  // A filled slot, with the number of fragments in it
+  struct Batch {
+    Batch() = default;
+    Batch(GroupVecT* h, size_t n) : hits(h), size(n) {}
+    GroupVecT* hits{nullptr};
+    size_t size{0};
+  };
+
+  MiniBatchPipeline(size_t numSlots, size_t slotSize, size_t numConsumers)
+      : numConsumers_(numConsumers) {
+    slots_.reserve(numSlots);
+    for (size_t i = 0; i < numSlots; ++i) {
+      slots_.emplace_back(slotSize);
+    }
+    for (auto& s : slots_) {
+      free_.push(&s);
+    }
+  }
+
+  MiniBatchPipeline(const MiniBatchPipeline&) = delete;
+  MiniBatchPipeline& operator=(const MiniBatchPipeline&) = delete;
+
+  // The next free slot for a mapping thread to fill
+  GroupVecT* acquire() {
+    GroupVecT* hits{nullptr};
+    free_.pop(hits);
+    return hits;
+  }
+
+  // Hand the first n fragments of hits to the inference threads
+  void submit(GroupVecT* hits, size_t n) { full_.push(Batch(hits, n)); }
+
+  /**
+   * The next batch for an inference thread to process (waiting for one);
+   * false once the pipeline is closed and everything submitted has been
+   * taken.
+   */
+  bool next(Batch& batch) {
+    full_.pop(batch);
+    return batch.hits != nullptr;
+  }
+
+  // Give back a processed batch's slot
+  void release(GroupVecT* hits) { free_.push(hits); }
+
+  /**
+   * Called once all of the mapping threads are done.  The queue is FIFO
+   * across all of the threads, so every batch submitted comes before the
+   * (one per inference thread) empty batches that end next().
+   */
+  void close() {
+    for (size_t i = 0; i < numConsumers_; ++i) {
+      full_.push(Batch());
+    }
+  }
+
+private:
+  size_t numConsumers_;
+  std::vector<GroupVecT> slots_;
+  tbb::concurrent_bounded_queue<GroupVecT*> free_;
+  tbb::concurrent_bounded_queue<Batch> full_;
+};
+
+#endif // __MINI_BATCH_PIPELINE_HPP__
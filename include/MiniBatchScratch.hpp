@@ -0,0 +1,234 @@
+#ifndef MINI_BATCH_SCRATCH_HPP
+#define MINI_BATCH_SCRATCH_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "FragmentLengthDistribution.hpp"
+#include "FragmentStartPositionDistribution.hpp"
+#include "LocalEqClassMap.hpp"
+#include "MiniBatchSizer.hpp"
+#include "SalmonMath.hpp"
+#include "TranscriptGroup.hpp"
+
+/**
+ * Per-thread buffers that are reused for every fragment processed in
+ * processMiniBatch.  Buffers are cleared, but never shrunk, between
+ * fragments; once they have grown large enough for the biggest alignment
+ * group a thread sees, the per-fragment work does no heap allocation.  The
+ * number of times any buffer had to grow is recorded so that this can be
+ * checked after the fact (it is reported in meta_info.json).
+ *
+ * Optionally, the scratch also holds a thread-local buffer of (log) mass
+ * deltas for each transcript.  When this is enabled, the mass assigned to a
+ * transcript during a mini-batch is accumulated locally, and applied to the
+ * shared transcript mass only once per mini-batch (see flushMass), rather
+ * than with one atomic update for each alignment.  The fragment lengths and
+ * start positions observed during the mini-batch are buffered in the same
+ * way (see fldObservations and fspdObservations).
+ *
+ * The scratch may also own the thread's LocalEqClassMap, into which the
+ * equivalence class of each fragment is aggregated before being flushed to
+ * the shared EquivalenceClassBuilder.
+ *
+ * A thread's scratch is kept from one read library (and online round) to
+ * the next, rather than being rebuilt for each, so that what it allocates
+ * in proportion to the number of transcripts is only allocated once.
+ */
+class MiniBatchScratch {
+public:
+  MiniBatchScratch(size_t numTranscripts, size_t libTypeCountSize,
+                   size_t initialCapacity = 128)
+      : observedEpoch_(numTranscripts, 0), libTypeCounts(libTypeCountSize, 0) {
+    // The transcript ids may be followed by their range-factorization bins
+    eqKey.txps.reserve(2 * initialCapacity);
+    auxProbs.reserve(initialCapacity);
+    rankInds.reserve(initialCapacity);
+    txpIDsTmp.reserve(2 * initialCapacity);
+    auxProbsTmp.reserve(initialCapacity);
+    prevCapacity_ = totalCapacity_();
+  }
+
+  /**
+   * Reset the per-fragment state.  This must be called before the
+   * alignments of each new fragment are considered.
+   */
+  inline void beginFragment() {
+    eqKey.txps.clear();
+    auxProbs.clear();
+    // Bumping the epoch "clears" the observed transcript set in O(1)
+    if (++epoch_ == 0) {
+      std::fill(observedEpoch_.begin(), observedEpoch_.end(), 0);
+      epoch_ = 1;
+    }
+  }
+
+  /**
+   * Record that we have seen transcript `tid` for the current fragment.
+   * Returns true if this is the first time `tid` was observed for this
+   * fragment, and false otherwise.
+   */
+  inline bool markObserved(uint32_t tid) {
+    if (observedEpoch_[tid] == epoch_) {
+      return false;
+    }
+    observedEpoch_[tid] = epoch_;
+    return true;
+  }
+
+  /**
+   * Check if any of the buffers had to grow while processing the last
+   * fragment.
+   */
+  inline void endFragment() {
+    size_t cap = totalCapacity_();
+    if (cap > prevCapacity_) {
+      ++numRegrowths_;
+      prevCapacity_ = cap;
+    }
+  }
+
+  /**
+   * Enable the thread-local mass buffer; this allocates one value for
+   * each transcript (the first time).
+   */
+  void enableLocalMass() {
+    if (localMass_) {
+      return;
+    }
+    pendingMass_.assign(observedEpoch_.size(), salmon::math::LOG_0);
+    touched_.reserve(1024);
+    localMass_ = true;
+  }
+
+  bool useLocalMass() const { return localMass_; }
+
+  /**
+   * Add `logMass` to the pending mass of transcript `tid`.
+   */
+  inline void addMass(uint32_t tid, double logMass) {
+    double& m = pendingMass_[tid];
+    if (m == salmon::math::LOG_0) {
+      touched_.push_back(tid);
+      m = logMass;
+    } else {
+      m = salmon::math::logAdd(m, logMass);
+    }
+  }
+
+  /**
+   * Apply all of the pending mass to the transcripts and reset the buffer.
+   * Each transcript that was touched during the mini-batch receives
+   * exactly one (atomic) update.
+   */
+  template <typename TranscriptVecT>
+  void flushMass(TranscriptVecT& transcripts) {
+    for (auto tid : touched_) {
+      transcripts[tid].addMass(pendingMass_[tid]);
+      pendingMass_[tid] = salmon::math::LOG_0;
+    }
+    touched_.clear();
+  }
+
+  /**
+   * Aggregate equivalence classes locally, flushing them to the shared
+   * builder at least every `flushInterval` fragments.
+   */
+  void enableLocalEqClasses(uint64_t flushInterval) {
+    if (!localEqMap_) {
+      localEqMap_.reset(new LocalEqClassMap(flushInterval));
+    }
+  }
+
+  // nullptr if equivalence classes are not being aggregated locally
+  LocalEqClassMap* localEqClasses() { return localEqMap_.get(); }
+
+  /**
+   * Flush any locally aggregated equivalence classes to `eqBuilder`, and
+   * record how many times this thread flushed them (for this library).
+   * Should be called once per library, after the thread has processed its
+   * last mini-batch of it.
+   */
+  void finishLocalEqClasses(EquivalenceClassBuilder& eqBuilder) {
+    if (localEqMap_) {
+      localEqMap_->flush(eqBuilder);
+      eqBuilder.recordLocalFlushes(localEqMap_->numFlushes() -
+                                   numFlushesRecorded_);
+      numFlushesRecorded_ = localEqMap_->numFlushes();
+    }
+  }
+
+  /**
+   * Draw the online bootstrap weights of each fragment (see
+   * PoissonBootstrap); the chunks hold up to maxBatchSize fragments.
+   */
+  void enableOnlineBootstrap(uint32_t numReplicates, size_t maxBatchSize) {
+    fragmentKeys.assign(maxBatchSize, 0);
+    replicateWeights.assign(numReplicates, 0);
+  }
+
+  // No online bootstrap weights (for a thread that has no read names)
+  void disableOnlineBootstrap() {
+    fragmentKeys.clear();
+    replicateWeights.clear();
+  }
+
+  inline void resetLibTypeCounts() {
+    std::fill(libTypeCounts.begin(), libTypeCounts.end(), 0);
+  }
+
+  // The number of times the buffers grew since this was last called
+  uint64_t takeRegrowths() {
+    uint64_t n = numRegrowths_ - numRegrowthsTaken_;
+    numRegrowthsTaken_ = numRegrowths_;
+    return n;
+  }
+
+  // The key (transcript ids) of the current fragment's equivalence class.
+  // Its txps label doubles as the list of transcript ids for the fragment.
+  TranscriptGroup eqKey;
+  // The auxiliary (conditional) probabilities of the current fragment
+  std::vector<double> auxProbs;
+  // Buffers used when ranking the transcripts of an equivalence class
+  std::vector<int> rankInds;
+  EqClassLabel txpIDsTmp;
+  std::vector<double> auxProbsTmp;
+  // Per-batch library type counts
+  std::vector<uint64_t> libTypeCounts;
+  // Fragment lengths observed during the mini-batch (used along with the
+  // local mass buffer)
+  FragmentLengthDistribution::LocalObservations fldObservations;
+  // Fragment start positions observed during the mini-batch, one set for
+  // each length class (only used with --useFSPD)
+  std::vector<FragmentStartPositionDistribution::LocalObservations>
+      fspdObservations;
+  // With online bootstraps, the key (a hash of the name) of each fragment of
+  // the chunk, and the replicate weights of the current fragment
+  std::vector<uint64_t> fragmentKeys;
+  std::vector<uint32_t> replicateWeights;
+  // The sizes of the mini-batches that each chunk is split into, and the
+  // index (in its chunk) of the current mini-batch's first fragment
+  MiniBatchSizer sizer;
+  size_t firstFragment{0};
+
+private:
+  size_t totalCapacity_() const {
+    return eqKey.txps.capacity() + auxProbs.capacity() + rankInds.capacity() +
+           txpIDsTmp.capacity() + auxProbsTmp.capacity() + touched_.capacity();
+  }
+
+  std::vector<uint32_t> observedEpoch_;
+  bool localMass_{false};
+  std::vector<double> pendingMass_;
+  std::vector<uint32_t> touched_;
+  std::unique_ptr<LocalEqClassMap> localEqMap_{nullptr};
+  uint32_t epoch_{0};
+  size_t prevCapacity_{0};
+  uint64_t numRegrowths_{0};
+  uint64_t numRegrowthsTaken_{0};
+  uint64_t numFlushesRecorded_{0};
+};
+
+#endif // MINI_BATCH_SCRATCH_HPP
@@ -0,0 +1,87 @@
+#ifndef MINI_BATCH_SIZER_HPP
+#define MINI_BATCH_SIZER_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+/**
+ * Chooses the size of the online phase's mini-batches, which needn't be that
+ * of the parser's chunks: processMiniBatch splits each chunk that a thread
+ * has mapped into mini-batches of the sizes given here.
+ *
+ * With a fixed size (--miniBatchSize n), each mini-batch holds n fragments
+ * (but for the last of a chunk).  With --miniBatchSize 0, the size is tuned
+ * as the thread goes.  Until the burn-in is over, the mini-batches are the
+ * smallest allowed (minAdaptiveSize), so that the abundances and the models
+ * learned along with them respond quickly to the first reads.  After it,
+ * each is sized to take about targetSeconds to process, from a running
+ * average of the time per fragment of those before it.  The target grows
+ * with the number of threads, since it's the rate at which all of them
+ * together take timesteps (and update the models) that the mini-batches
+ * have to keep down.
+ */
+class MiniBatchSizer {
+public:
+  static constexpr uint32_t minAdaptiveSize = 1000;
+  static constexpr uint32_t maxAdaptiveSize = uint32_t(1) << 20;
+  // The processing time per tuned mini-batch, per thread
+  static constexpr double secondsPerThread = 1e-3;
+
+  // Each chunk as one mini-batch
+  MiniBatchSizer() = default;
+
+  // Mini-batches of size fragments, or tuned ones (for numThreads threads)
+  // if size is 0
+  MiniBatchSizer(uint32_t size, uint32_t numThreads)
+      : size_(size == 0 ? uint32_t(minAdaptiveSize) : size),
+        adaptive_(size == 0),
+        targetSeconds_(secondsPerThread * std::max(numThreads, uint32_t(1))) {
+  }
+
+  bool adaptive() const { return adaptive_; }
+
+  // The size of the next mini-batch
+  uint32_t next(bool burnedIn) const {
+    return (adaptive_ and !burnedIn) ? uint32_t(minAdaptiveSize) : size_;
+  }
+
+  // Account for a mini-batch of numFragments that took seconds to process
+  void observe(size_t numFragments, double seconds) {
+    if (!adaptive_ or numFragments == 0) {
+      return;
+    }
+    double perFragment = seconds / numFragments;
+    secondsPerFragment_ = (secondsPerFragment_ > 0.0)
+                              ? 0.8 * secondsPerFragment_ + 0.2 * perFragment
+                              : perFragment;
+    double size = (secondsPerFragment_ > 0.0)
+                      ? targetSeconds_ / secondsPerFragment_
+                      : static_cast<double>(maxAdaptiveSize);
+    size_ = static_cast<uint32_t>(
+        std::min(std::max(size, static_cast<double>(minAdaptiveSize)),
+                 static_cast<double>(maxAdaptiveSize)));
+  }
+
+private:
+  uint32_t size_{std::numeric_limits<uint32_t>::max()};
+  bool adaptive_{false};
+  double targetSeconds_{0.0};
+  double secondsPerFragment_{0.0};
+};
+
+/**
+ * The number of forgetting-mass timesteps that a mini-batch of numFragments
+ * takes, when a timestep stands for timestepFragments fragments: so that
+ * the mass a fragment gets depends on how many came before it, and not on
+ * how they were batched (see
+ * ForgettingMassCalculator::getLogMassAndTimesteps).  A mini-batch takes at
+ * least one.
+ */
+inline uint64_t numTimesteps(size_t numFragments, uint32_t timestepFragments) {
+  return std::max(uint64_t(1), static_cast<uint64_t>(
+                                   (numFragments + timestepFragments / 2) /
+                                   timestepFragments));
+}
+
+#endif // MINI_BATCH_SIZER_HPP
@@ -2,66 +2,69 @@
 #define _MULTINOMIAL_SAMPLER_HPP_
 
 #include <algorithm>
+#include <cstdint>
 #include <random>
 #include <vector>
 
+#include "pcg_random.hpp"
+
+/**
+ * Draws multinomial samples as a sequence of conditional binomials: the
+ * count of category i is Binomial(n - (counts so far), p_i / (mass left)).
+ * The cost is therefore O(k) in the number of categories, independent of the
+ * number of trials n, and the probabilities need not be normalized.
+ *
+ * Each sampler owns its own (PCG) generator, so one sampler should be used
+ * per thread.  Seeding it with (seed, stream) makes the samples reproducible.
+ */
 class MultinomialSampler {
 public:
-  MultinomialSampler(std::random_device& rd) : gen_(rd()), u01_(0.0, 1.0) {}
+  MultinomialSampler(std::random_device& rd) : gen_(rd(), rd()) {}
 
-  void operator()(std::vector<uint64_t>::iterator sampleBegin, uint32_t n,
-                  uint32_t k, std::vector<double>::iterator probsBegin,
-                  bool clearCounts = true) {
-    uint32_t i, j;
-    double u, sum;
-    std::vector<double> z(k + 1, 0.0);
+  MultinomialSampler(uint64_t seed, uint64_t stream) : gen_(seed, stream) {}
 
-    if (clearCounts) {
-      for (i = 0; i < k; i++) {
-        *(sampleBegin + i) = 0;
-      }
-    }
+  /**
+   * Restart the generator from the given seed and stream.
+   */
+  void seed(uint64_t seed, uint64_t stream) { gen_.seed(seed, stream); }
 
-    z[0] = 0;
-    for (i = 1; i <= k; i++) {
-      sum = 0;
-      for (j = 0; j < i; j++)
-        sum += *(probsBegin + j);
-      z[i] = sum;
+  template <typename CountIt, typename ProbIt>
+  void operator()(CountIt sampleBegin, uint64_t n, uint32_t k,
+                  ProbIt probsBegin, bool clearCounts = true) {
+    double massLeft{0.0};
+    for (uint32_t i = 0; i < k; ++i) {
+      massLeft += *(probsBegin + i);
     }
 
-    // If k is small (<= 100), linear search is usually faster
-    if (k <= 100) {
-      for (j = 0; j < n; j++) {
-        u = u01_(gen_);
-
-        for (i = 0; i < k; i++) {
-          if ((z[i] < u) && (u <= z[i + 1])) {
-            (*(sampleBegin + i))++;
-            break;
-          }
-        }
+    uint64_t left = n;
+    uint32_t i = 0;
+    for (; i < k and left > 0; ++i) {
+      double p = *(probsBegin + i);
+      uint64_t c{0};
+      if (i + 1 == k or p >= massLeft) {
+        c = left;
+      } else if (p > 0.0) {
+        std::binomial_distribution<uint64_t> binom(left, p / massLeft);
+        c = binom(gen_);
       }
-    } else { // k is large enough to warrant binary search
-      for (j = 0; j < n; j++) {
-        u = u01_(gen_);
-
-        // Find the offset of the element to increment
-        auto it = std::lower_bound(z.begin(), z.end() - 1, u);
-        size_t offset = static_cast<size_t>(std::distance(z.begin(), it));
-
-        if (*it > u and offset > 0) {
-          offset -= 1;
-        }
-
-        (*(sampleBegin + offset))++;
+      massLeft -= p;
+      left -= c;
+      if (clearCounts) {
+        *(sampleBegin + i) = c;
+      } else {
+        *(sampleBegin + i) += c;
+      }
+    }
+    // All n trials have been assigned
+    if (clearCounts) {
+      for (; i < k; ++i) {
+        *(sampleBegin + i) = 0;
       }
     }
   }
 
 private:
-  std::mt19937 gen_;
-  std::uniform_real_distribution<> u01_;
+  pcg32 gen_;
 };
 
 #endif //_MULTINOMIAL_SAMPLER_HPP_
@@ -0,0 +1,140 @@
+#ifndef __ONLINE_CONVERGENCE_MONITOR_HPP__
+#define __ONLINE_CONVERGENCE_MONITOR_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "FragmentLengthDistribution.hpp"
+#include "SalmonMath.hpp"
+
+/**
+ * Decides when the online estimates have stopped changing, so that the
+ * rest of the fragments can skip the online updates (they are still mapped,
+ * and still counted into the equivalence classes, which is all the offline
+ * phase needs).
+ *
+ * Every checkInterval mini-batches, one thread takes a snapshot of the
+ * relative abundances of the numTop most abundant transcripts and of the
+ * fragment length distribution's mean.  The estimates are considered
+ * stable once, for two checks in a row, the total absolute change in those
+ * relative abundances, and the relative change in the mean, are both below
+ * the tolerance.  A tolerance of 0 disables the monitor.
+ */
+class OnlineConvergenceMonitor {
+public:
+  explicit OnlineConvergenceMonitor(double tolerance, size_t numTop = 1000,
+                                    uint64_t checkInterval = 256)
+      : tolerance_(tolerance), numTop_(numTop),
+        checkInterval_(checkInterval) {}
+
+  bool enabled() const { return tolerance_ > 0.0; }
+  bool converged() const { return converged_.load(); }
+
+  // The number of assigned fragments when the estimates became stable
+  // (0 if they never did).
+  uint64_t convergedAtFragment() const { return convergedAt_.load(); }
+
+  /**
+   * Called by each thread after each of its mini-batches (once the batch's
+   * observations are visible); only every checkInterval-th call does any
+   * work, and only one thread does it at a time.  Returns true for the
+   * call that found the estimates to be stable.
+   */
+  template <typename TranscriptVecT>
+  bool update(TranscriptVecT& transcripts,
+              const FragmentLengthDistribution& fld,
+              uint64_t numAssignedFragments) {
+    if (!enabled() or converged_) {
+      return false;
+    }
+    if (++numBatches_ % checkInterval_ != 0) {
+      return false;
+    }
+    std::unique_lock<std::mutex> l(mut_, std::try_to_lock);
+    if (!l.owns_lock()) {
+      return false;
+    }
+
+    // How much the relative abundances of the transcripts that were the
+    // most abundant at the last check have changed since.
+    double delta{0.0};
+    if (!top_.empty()) {
+      double total{salmon::math::LOG_0};
+      for (auto tid : top_) {
+        total = salmon::math::logAdd(total, transcripts[tid].mass(false));
+      }
+      for (size_t i = 0; i < top_.size(); ++i) {
+        double frac = salmon::math::isLog0(total)
+                          ? 0.0
+                          : std::exp(transcripts[top_[i]].mass(false) - total);
+        delta += std::abs(frac - topFrac_[i]);
+      }
+    }
+    double mean = std::exp(fld.mean());
+    double meanDelta = (prevMean_ > 0.0)
+                           ? std::abs(mean - prevMean_) / prevMean_
+                           : 1.0;
+    prevMean_ = mean;
+
+    snapshot_(transcripts);
+
+    bool stable = !top_.empty() and delta < tolerance_ and
+                  meanDelta < tolerance_;
+    numStableChecks_ = stable ? numStableChecks_ + 1 : 0;
+    if (numStableChecks_ >= 2) {
+      convergedAt_ = numAssignedFragments;
+      converged_ = true;
+      return true;
+    }
+    return false;
+  }
+
+private:
+  template <typename TranscriptVecT>
+  void snapshot_(TranscriptVecT& transcripts) {
+    std::vector<double> masses(transcripts.size());
+    for (size_t i = 0; i < transcripts.size(); ++i) {
+      masses[i] = transcripts[i].mass(false);
+    }
+    top_.resize(transcripts.size());
+    for (uint32_t i = 0; i < top_.size(); ++i) {
+      top_[i] = i;
+    }
+    if (top_.size() > numTop_) {
+      std::nth_element(top_.begin(), top_.begin() + numTop_, top_.end(),
+                       [&masses](uint32_t a, uint32_t b) -> bool {
+                         return masses[a] > masses[b];
+                       });
+      top_.resize(numTop_);
+    }
+    double total{salmon::math::LOG_0};
+    for (auto tid : top_) {
+      total = salmon::math::logAdd(total, masses[tid]);
+    }
+    topFrac_.resize(top_.size());
+    for (size_t i = 0; i < top_.size(); ++i) {
+      topFrac_[i] = salmon::math::isLog0(total)
+                        ? 0.0
+                        : std::exp(masses[top_[i]] - total);
+    }
+  }
+
+  double tolerance_;
+  size_t numTop_;
+  uint64_t checkInterval_;
+  std::atomic<uint64_t> numBatches_{0};
+  std::atomic<bool> converged_{false};
+  std::atomic<uint64_t> convergedAt_{0};
+  std::mutex mut_;
+  // Only touched by the thread holding mut_
+  std::vector<uint32_t> top_;
+  std::vector<double> topFrac_;
+  double prevMean_{0.0};
+  uint32_t numStableChecks_{0};
+};
+
+#endif // __ONLINE_CONVERGENCE_MONITOR_HPP__
@@ -0,0 +1,91 @@
+#ifndef __PAIRED_HIT_MERGER_HPP__
+#define __PAIRED_HIT_MERGER_HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "RapMapUtils.hpp"
+
+namespace salmon {
+namespace utils {
+
+/**
+ * Intersect the hits of the two ends of a fragment (each sorted by
+ * transcript, as the hit collector leaves them) with a single merge-join
+ * over the transcript IDs, writing into jointHits (whose capacity is reused
+ * from one fragment to the next).
+ *
+ * A transcript hit by both ends yields one properly-paired hit.  If only
+ * one end has hits, and orphans are allowed, they are kept as orphans (if
+ * both ends have hits, but to different transcripts, there are none).  So
+ * jointHits always comes out in transcript order, and its hits are either
+ * all paired or all orphans of the same end: the mate status of the first
+ * one is that of the fragment.
+ * Either way, the merge stops as soon as it would produce more than
+ * maxNumHits hits, in which case jointHits is left empty and true is
+ * returned (as such a fragment would be discarded anyway).
+ */
+template <typename HitCountersT>
+inline bool mergePairedHits(
+    const std::vector<rapmap::utils::QuasiAlignment>& leftHits,
+    const std::vector<rapmap::utils::QuasiAlignment>& rightHits,
+    std::vector<rapmap::utils::QuasiAlignment>& jointHits, bool allowOrphans,
+    size_t maxNumHits, HitCountersT& hctr) {
+  using rapmap::utils::MateStatus;
+  jointHits.clear();
+
+  auto leftIt = leftHits.begin();
+  auto leftEnd = leftHits.end();
+  auto rightIt = rightHits.begin();
+  auto rightEnd = rightHits.end();
+  while (leftIt != leftEnd and rightIt != rightEnd) {
+    if (leftIt->tid < rightIt->tid) {
+      ++leftIt;
+    } else if (rightIt->tid < leftIt->tid) {
+      ++rightIt;
+    } else {
+      if (jointHits.size() == maxNumHits) {
+        jointHits.clear();
+        ++hctr.tooManyHits;
+        return true;
+      }
+      int32_t startLeft = std::max(leftIt->pos, int32_t(0));
+      int32_t startRight = std::max(rightIt->pos, int32_t(0));
+      bool leftFirst = (startLeft < startRight);
+      int32_t fragStart = leftFirst ? startLeft : startRight;
+      int32_t fragEnd = leftFirst ? (startRight + rightIt->readLen)
+                                  : (startLeft + leftIt->readLen);
+      jointHits.push_back(*leftIt);
+      auto& qaln = jointHits.back();
+      qaln.fragLen = static_cast<uint32_t>(fragEnd - fragStart);
+      qaln.mateLen = rightIt->readLen;
+      qaln.matePos = rightIt->pos;
+      qaln.mateIsFwd = rightIt->fwd;
+      qaln.mateStatus = MateStatus::PAIRED_END_PAIRED;
+      ++leftIt;
+      ++rightIt;
+    }
+  }
+  if (!jointHits.empty()) {
+    hctr.peHits += jointHits.size();
+    return false;
+  }
+  if (!allowOrphans or (!leftHits.empty() and !rightHits.empty())) {
+    return false;
+  }
+
+  auto& orphanHits = leftHits.empty() ? rightHits : leftHits;
+  if (orphanHits.size() > maxNumHits) {
+    ++hctr.tooManyHits;
+    return true;
+  }
+  jointHits.assign(orphanHits.begin(), orphanHits.end());
+  hctr.seHits += jointHits.size();
+  return false;
+}
+
+} // namespace utils
+} // namespace salmon
+
+#endif // __PAIRED_HIT_MERGER_HPP__
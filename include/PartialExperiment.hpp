@@ -0,0 +1,121 @@
+#ifndef PARTIAL_EXPERIMENT_HPP
+#define PARTIAL_EXPERIMENT_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "tbb/atomic.h"
+#include "Eigen/Dense"
+
+#include "EquivalenceClassBuilder.hpp"
+#include "FragmentStartPositionDistribution.hpp"
+#include "SalmonOpts.hpp"
+#include "SalmonUtils.hpp"
+#include "Transcript.hpp"
+#include "TranscriptNames.hpp"
+
+class ReadExperiment;
+
+/**
+ * The state of a quantification run, after its reads have been mapped and
+ * before the offline optimization, written (with --writePartial) to the
+ * partial directory of its output so that the runs over the shards of one
+ * sample's reads can be merged, and optimized once (salmon merge-partials).
+ * A partial directory holds
+ *
+ *   eq_classes.bin  : the equivalence classes, with their rich weights
+ *                     (see EquivClassFile.hpp)
+ *   transcripts.tsv : name, length, log effective length, unique count and
+ *                     projected count of each transcript
+ *   flenDist.txt    : the fragment length distribution (as flenDist.txt)
+ *   stats.tsv       : the mapping statistics (key, value)
+ *
+ * The effective lengths are those of the online phase: partials carry no
+ * bias models, so the merged run isn't bias-corrected.
+ */
+bool writePartial(const boost::filesystem::path& dir, const SalmonOpts& sopt,
+                  ReadExperiment& experiment);
+
+/**
+ * The merge of one or more partial directories, with what the offline
+ * optimizer (and writeAbundances) need of an experiment.  The equivalence
+ * classes are merged by label, their counts added and their rich weights
+ * averaged (weighted by count); the effective lengths and the fragment
+ * length distributions are averaged, weighted by the number of mapped
+ * fragments of each partial.
+ */
+class PartialExperiment {
+public:
+  explicit PartialExperiment(std::shared_ptr<spdlog::logger> log)
+      : eqBuilder_(log), fragStartDists_(5) {}
+
+  // Add the partial in dir; returns false (having said why) if it can't
+  bool add(const boost::filesystem::path& dir, spdlog::logger* log);
+
+  /**
+   * Load, instead of partials, the output directory of a salmon quant run
+   * that dumped its equivalence classes with their rich weights
+   * (--dumpEq --dumpEqWeights, in either --eqClassFormat), to quantify it
+   * again (salmon quant --fromEq).  The lengths and (bias-corrected)
+   * effective lengths are those of its quant.sf, which must list every
+   * transcript (i.e. not be --sparseQuant), the fragment length
+   * distribution that of its fld.gz, and the number of fragments that of
+   * its meta_info.json; auxDir is the name of its auxiliary directory.
+   * Returns false (having said why) if it can't.
+   */
+  bool addQuantOutput(const boost::filesystem::path& dir,
+                      const std::string& auxDir, spdlog::logger* log);
+
+  // Done adding partials; builds the equivalence classes
+  void finish();
+
+  std::vector<Transcript>& transcripts() { return transcripts_; }
+  const TranscriptNames& transcriptNames() const { return transcriptNames_; }
+  EquivalenceClassBuilder& equivalenceClassBuilder() { return eqBuilder_; }
+  std::vector<FragmentStartPositionDistribution>&
+  fragmentStartPositionDistributions() {
+    return fragStartDists_;
+  }
+  uint64_t numMappedFragments() const { return numMappedFragments_; }
+  uint64_t numObservedFragments() const { return numObservedFragments_; }
+  uint64_t upperBoundHits() const { return upperBoundHits_; }
+  void setBootstrapIterations(const std::vector<uint32_t>& its) {
+    bootstrapIterations_ = its;
+  }
+  void setNumBackgroundFragments(uint64_t n) { numBackgroundFragments_ = n; }
+  size_t numPartials() const { return numPartials_; }
+
+  bool writeFragLengthDist(const boost::filesystem::path& path) const;
+
+private:
+  // (declared before the transcripts, whose RefNames point into it)
+  TranscriptNames transcriptNames_;
+  std::vector<Transcript> transcripts_;
+  std::vector<double> effLenSums_;
+  std::vector<double> fragLenMass_;
+  EquivalenceClassBuilder eqBuilder_;
+  std::vector<FragmentStartPositionDistribution> fragStartDists_;
+  std::vector<uint32_t> bootstrapIterations_;
+  uint64_t numMappedFragments_{0};
+  uint64_t numObservedFragments_{0};
+  uint64_t upperBoundHits_{0};
+  uint64_t numBackgroundFragments_{0};
+  size_t numPartials_{0};
+};
+
+namespace salmon {
+namespace utils {
+// Partials carry no bias models, so the effective lengths are left as is
+template <>
+Eigen::VectorXd
+updateEffectiveLengths<std::vector<tbb::atomic<double>>, PartialExperiment>(
+    SalmonOpts& sopt, PartialExperiment& readExp, Eigen::VectorXd& effLensIn,
+    std::vector<tbb::atomic<double>>& alphas, std::vector<bool>& available,
+    bool finalRound);
+} // namespace utils
+} // namespace salmon
+
+#endif // PARTIAL_EXPERIMENT_HPP
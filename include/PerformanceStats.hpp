@@ -0,0 +1,436 @@
+#ifndef __PERFORMANCE_STATS_HPP__
+#define __PERFORMANCE_STATS_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#include "cereal/cereal.hpp"
+#include "cereal/types/string.hpp"
+#include "cereal/types/vector.hpp"
+
+#include "HardwareCounters.hpp"
+#include "MemoryBudget.hpp"
+#include "SalmonSpinLock.hpp"
+
+/**
+ * Records where the time of a quantification run goes: the wall time, the
+ * (process) CPU time and the peak resident set size of each phase of the run
+ * (those of a phase that runs more than once, e.g. a mapping round, are
+ * summed), the throughput of each mapping thread and how the read parsers
+ * and the mapping threads waited on each other, how often the threads
+ * waited on each (named) lock, and the memory budget and accounts (see
+ * salmon::memory::Budget).  It's written, under the "performance" key, to
+ * meta_info.json.
+ *
+ * The peak RSS of a phase is the process' high-water mark at its (last) end,
+ * so it never decreases from one phase to the next.  Phases may nest (e.g.
+ * the effective length updates happen during the offline EM).
+ *
+ * With tracing enabled (--trace), every phase, and every span (see span()),
+ * is also kept as an event of a Chrome trace (which chrome://tracing and
+ * Perfetto can show), with the thread it ran on; writeTrace() writes it.
+ *
+ * With hardware counters enabled (--hwCounters), each phase also has the
+ * counts of the CPU's events (cycles, instructions, last-level cache and
+ * dTLB misses, branch mispredictions; see salmon::perf::CounterSet) of all
+ * of the process' threads, and each mapping thread those of its own.
+ */
+class PerformanceStats {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Phase {
+    std::string name;
+    uint32_t count{0};
+    double wallTimeSec{0.0};
+    double cpuTimeSec{0.0};
+    uint64_t peakRSSBytes{0};
+    salmon::perf::CounterValues counters;
+
+    template <typename Archive> void serialize(Archive& ar) {
+      ar(cereal::make_nvp("name", name), cereal::make_nvp("count", count),
+         cereal::make_nvp("wall_time_sec", wallTimeSec),
+         cereal::make_nvp("cpu_time_sec", cpuTimeSec),
+         cereal::make_nvp("peak_rss_bytes", peakRSSBytes));
+      if (counters.any()) {
+        ar(cereal::make_nvp("hw_counters", counters));
+      }
+    }
+  };
+
+  struct MappingThread {
+    uint64_t numFragments{0};
+    double wallTimeSec{0.0};
+    salmon::perf::CounterValues counters;
+
+    template <typename Archive> void serialize(Archive& ar) {
+      double rate = (wallTimeSec > 0.0) ? (numFragments / wallTimeSec) : 0.0;
+      ar(cereal::make_nvp("num_fragments", numFragments),
+         cereal::make_nvp("wall_time_sec", wallTimeSec),
+         cereal::make_nvp("fragments_per_sec", rate));
+      if (counters.any()) {
+        ar(cereal::make_nvp("hw_counters", counters));
+      }
+    }
+  };
+
+  // See salmon::locks::LockCounters
+  struct Lock {
+    salmon::locks::LockSummary summary;
+
+    template <typename Archive> void serialize(Archive& ar) {
+      ar(cereal::make_nvp("name", summary.name),
+         cereal::make_nvp("acquisitions", summary.acquisitions),
+         cereal::make_nvp("contended", summary.contended),
+         cereal::make_nvp("parked", summary.parked),
+         cereal::make_nvp("wait_sec", summary.waitSec));
+    }
+  };
+
+  // See salmon::memory::Budget
+  struct MemoryAccount {
+    salmon::memory::AccountSummary summary;
+
+    template <typename Archive> void serialize(Archive& ar) {
+      ar(cereal::make_nvp("name", summary.name),
+         cereal::make_nvp("bytes", summary.bytes),
+         cereal::make_nvp("peak_bytes", summary.peakBytes));
+    }
+  };
+
+  /**
+   * Times the phase name from construction until finish() (or destruction,
+   * whichever comes first).
+   */
+  class Scope {
+  public:
+    Scope(PerformanceStats& stats, const std::string& name)
+        : stats_(&stats), name_(name) {
+      stats_->beginPhase(name_);
+    }
+    ~Scope() { finish(); }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+    void finish() {
+      if (stats_) {
+        stats_->endPhase(name_);
+        stats_ = nullptr;
+      }
+    }
+
+  private:
+    PerformanceStats* stats_;
+    std::string name_;
+  };
+
+  PerformanceStats()
+      : runStart_(Clock::now()), runCPUStart_(cpuTimeSeconds()) {
+    threadID_();
+  }
+
+  void enableTracing() { tracing_ = true; }
+  bool tracing() const { return tracing_; }
+
+  /**
+   * Count the hardware events of each phase and mapping thread from now on;
+   * returns false (having enabled nothing) if they can't be counted here,
+   * and why not in why.
+   */
+  bool enableHardwareCounters(std::string& why) {
+    hwCounters_ = salmon::perf::available(why);
+    return hwCounters_;
+  }
+  bool hardwareCounters() const { return hwCounters_; }
+
+  /**
+   * The counters of the calling thread (see addMappingThread), or nullptr
+   * if the hardware counters aren't enabled.
+   */
+  std::unique_ptr<salmon::perf::CounterSet> threadCounters() const {
+    using salmon::perf::CounterSet;
+    return std::unique_ptr<CounterSet>(
+        hwCounters_ ? new CounterSet(CounterSet::Scope::THREAD) : nullptr);
+  }
+
+  /**
+   * If tracing, record a span name (of category cat) on the calling thread
+   * from start until now, and set start to now, so that consecutive spans
+   * of a loop can share a single time point; otherwise, does nothing.
+   */
+  void span(const char* name, Clock::time_point& start,
+            const char* cat = "thread") {
+    if (!tracing_) {
+      return;
+    }
+    auto end = Clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    addEvent_(name, cat, threadID_(), start, end);
+    start = end;
+  }
+
+  /**
+   * Start timing an occurrence of the phase name; beginning a phase that's
+   * already running has no effect.
+   */
+  void beginPhase(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& r : running_) {
+      if (r.name == name) {
+        return;
+      }
+    }
+    RunningPhase r;
+    r.name = name;
+    if (hwCounters_) {
+      r.counters = std::make_shared<salmon::perf::CounterSet>(
+          salmon::perf::CounterSet::Scope::PROCESS);
+    }
+    r.wallStart = Clock::now();
+    r.cpuStart = cpuTimeSeconds();
+    r.thread = threadID_();
+    running_.push_back(r);
+  }
+
+  /**
+   * Stop timing the phase name, and add the time to it; ending a phase that
+   * isn't running (e.g. from a thread that lost a race to end it) has no
+   * effect.
+   */
+  void endPhase(const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = running_.begin(); it != running_.end(); ++it) {
+      if (it->name != name) {
+        continue;
+      }
+      auto end = Clock::now();
+      std::chrono::duration<double> wall = end - it->wallStart;
+      if (tracing_) {
+        addEvent_(name, "phase", it->thread, it->wallStart, end);
+      }
+      Phase& p = phase_(name);
+      ++p.count;
+      p.wallTimeSec += wall.count();
+      p.cpuTimeSec += cpuTimeSeconds() - it->cpuStart;
+      p.peakRSSBytes = peakRSSBytes();
+      if (it->counters) {
+        p.counters += it->counters->read();
+      }
+      running_.erase(it);
+      return;
+    }
+  }
+
+  // The most recently begun phase that's still running (or "")
+  std::string currentPhase() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return running_.empty() ? std::string() : running_.back().name;
+  }
+
+  // Record that a mapping thread processed numFragments in wallTimeSec
+  // (and, if it was counting, the counts of its counters)
+  void addMappingThread(uint64_t numFragments, double wallTimeSec,
+                        const salmon::perf::CounterSet* counters = nullptr) {
+    MappingThread t;
+    t.numFragments = numFragments;
+    t.wallTimeSec = wallTimeSec;
+    if (counters != nullptr) {
+      t.counters = counters->read();
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    mappingThreads_.push_back(t);
+  }
+
+  /**
+   * Add the statistics of a read parser (see fastx_parser::ParserStats):
+   * the chunks it handed off, the mean number of chunks ready at each
+   * request, and the time the consumers and the parser spent waiting.
+   */
+  void addParserStats(uint64_t numChunks, double meanReadyChunks,
+                      double consumerWaitSec, double parserWaitSec,
+                      uint64_t numHelpedBatches) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // the mean over all parsers, weighted by the chunks
+    uint64_t total = parserChunks_ + numChunks;
+    if (total > 0) {
+      parserMeanReady_ =
+          (parserMeanReady_ * parserChunks_ + meanReadyChunks * numChunks) /
+          total;
+    }
+    parserChunks_ = total;
+    consumerWaitSec_ += consumerWaitSec;
+    parserWaitSec_ += parserWaitSec;
+    parserHelpedBatches_ += numHelpedBatches;
+    ++numParsers_;
+  }
+
+  template <typename Archive> void save(Archive& ar) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::chrono::duration<double> wall = Clock::now() - runStart_;
+    std::vector<Lock> locks;
+    for (auto& s : salmon::locks::summaries()) {
+      locks.push_back(Lock{s});
+    }
+    auto& budget = salmon::memory::budget();
+    std::vector<MemoryAccount> memoryAccounts;
+    for (auto& s : budget.summaries()) {
+      memoryAccounts.push_back(MemoryAccount{s});
+    }
+    ar(cereal::make_nvp("wall_time_sec", wall.count()),
+       cereal::make_nvp("cpu_time_sec", cpuTimeSeconds() - runCPUStart_),
+       cereal::make_nvp("peak_rss_bytes", peakRSSBytes()),
+       cereal::make_nvp("phases", phases_),
+       cereal::make_nvp("mapping_threads", mappingThreads_),
+       cereal::make_nvp("num_read_parsers", numParsers_),
+       cereal::make_nvp("parser_chunks", parserChunks_),
+       cereal::make_nvp("parser_mean_ready_chunks", parserMeanReady_),
+       cereal::make_nvp("mapping_wait_sec", consumerWaitSec_),
+       cereal::make_nvp("parser_wait_sec", parserWaitSec_),
+       cereal::make_nvp("mapping_helped_inflate_batches",
+                        parserHelpedBatches_),
+       cereal::make_nvp("locks", locks),
+       cereal::make_nvp("memory_budget_bytes", budget.limit()),
+       cereal::make_nvp("memory_accounted_peak_bytes", budget.peakUsed()),
+       cereal::make_nvp("memory_accounts", memoryAccounts));
+  }
+
+  /**
+   * Write the events recorded so far to path, as a Chrome trace (in the
+   * JSON object format); returns false if the file couldn't be written.
+   */
+  bool writeTrace(const std::string& path) const {
+    std::ofstream ofs(path);
+    if (!ofs.good()) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    ofs << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    for (uint32_t t = 0; t < threadIDs_.size(); ++t) {
+      ofs << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+          << "\"tid\": " << t << ", \"args\": {\"name\": \""
+          << ((t == 0) ? std::string("main") : "thread " + std::to_string(t))
+          << "\"}},\n";
+    }
+    bool first{true};
+    for (auto& e : events_) {
+      ofs << (first ? "" : ",\n") << "{\"name\": \"" << e.name
+          << "\", \"cat\": \"" << e.cat << "\", \"ph\": \"X\", \"pid\": 1, "
+          << "\"tid\": " << e.thread << ", \"ts\": " << e.startUs
+          << ", \"dur\": " << e.durUs << "}";
+      first = false;
+    }
+    ofs << "\n]}\n";
+    return ofs.good();
+  }
+
+  // The user + system CPU time of the process so far
+  static double cpuTimeSeconds() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return static_cast<double>(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) +
+           static_cast<double>(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) *
+               1e-6;
+  }
+
+  // The process' peak resident set size so far
+  static uint64_t peakRSSBytes() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+#ifdef __APPLE__
+    // bytes on OSX
+    return static_cast<uint64_t>(ru.ru_maxrss);
+#else
+    // kilobytes on Linux
+    return static_cast<uint64_t>(ru.ru_maxrss) * 1024;
+#endif
+  }
+
+private:
+  struct RunningPhase {
+    std::string name;
+    Clock::time_point wallStart;
+    double cpuStart;
+    uint32_t thread;
+    std::shared_ptr<salmon::perf::CounterSet> counters;
+  };
+
+  // A complete ("X") trace event; the times are in microseconds since the
+  // start of the run
+  struct TraceEvent {
+    std::string name;
+    const char* cat;
+    uint32_t thread;
+    int64_t startUs;
+    int64_t durUs;
+  };
+
+  // A small, dense id for the calling thread, in the order in which threads
+  // were first seen (the constructing thread is 0); mutex_ must be held,
+  // except from the constructor
+  uint32_t threadID_() {
+    auto it = threadIDs_.find(std::this_thread::get_id());
+    if (it != threadIDs_.end()) {
+      return it->second;
+    }
+    uint32_t id = static_cast<uint32_t>(threadIDs_.size());
+    threadIDs_[std::this_thread::get_id()] = id;
+    return id;
+  }
+
+  void addEvent_(const std::string& name, const char* cat, uint32_t thread,
+                 Clock::time_point start, Clock::time_point end) {
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    TraceEvent e;
+    e.name = name;
+    e.cat = cat;
+    e.thread = thread;
+    e.startUs = duration_cast<microseconds>(start - runStart_).count();
+    e.durUs = duration_cast<microseconds>(end - start).count();
+    events_.push_back(e);
+  }
+
+  Phase& phase_(const std::string& name) {
+    for (auto& p : phases_) {
+      if (p.name == name) {
+        return p;
+      }
+    }
+    phases_.emplace_back();
+    phases_.back().name = name;
+    return phases_.back();
+  }
+
+  Clock::time_point runStart_;
+  double runCPUStart_;
+  // in the order in which they (first) ended
+  std::vector<Phase> phases_;
+  std::vector<RunningPhase> running_;
+  std::vector<MappingThread> mappingThreads_;
+  uint32_t numParsers_{0};
+  uint64_t parserChunks_{0};
+  double parserMeanReady_{0.0};
+  double consumerWaitSec_{0.0};
+  double parserWaitSec_{0.0};
+  uint64_t parserHelpedBatches_{0};
+  std::atomic<bool> tracing_{false};
+  std::atomic<bool> hwCounters_{false};
+  std::unordered_map<std::thread::id, uint32_t> threadIDs_;
+  std::vector<TraceEvent> events_;
+  mutable std::mutex mutex_;
+};
+
+#endif // __PERFORMANCE_STATS_HPP__
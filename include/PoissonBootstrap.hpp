@@ -0,0 +1,63 @@
+#ifndef POISSON_BOOTSTRAP_HPP
+#define POISSON_BOOTSTRAP_HPP
+
+#include <cstdint>
+
+/**
+ * The weights of an online (Poisson) bootstrap: each fragment is counted
+ * Poisson(1) times in each replicate, which (for many fragments) behaves as
+ * a multinomial resampling of the fragments, but can be drawn while the
+ * fragments are mapped.  The weights are drawn from a counter-based
+ * generator --- a hash of (seed, fragment key, replicate) --- so a fragment's
+ * weights don't depend on which thread maps it, or when.
+ */
+class PoissonBootstrap {
+public:
+  PoissonBootstrap(uint64_t seed = 0, uint32_t numReplicates = 0)
+      : seed_(seed), numReplicates_(numReplicates) {}
+
+  uint32_t numReplicates() const { return numReplicates_; }
+  bool enabled() const { return numReplicates_ > 0; }
+
+  /**
+   * Write the weights of the fragment with the given key (e.g. a hash of its
+   * name) in each replicate to weights[0] ... weights[numReplicates() - 1].
+   */
+  inline void operator()(uint64_t key, uint32_t* weights) const {
+    uint64_t base = mix_(seed_ ^ mix_(key));
+    for (uint32_t r = 0; r < numReplicates_; ++r) {
+      weights[r] = poissonOne_(mix_(base + r));
+    }
+  }
+
+private:
+  // The splitmix64 finalizer; consecutive inputs give independent outputs
+  static inline uint64_t mix_(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
+  // A Poisson(1) draw from 64 random bits, by inversion of its CDF (scaled
+  // to 2^64); the mass of the draws above 10 (which give 11) is ~1e-8
+  static inline uint32_t poissonOne_(uint64_t bits) {
+    static constexpr uint64_t cdf[] = {
+        6786177901268885274ULL,  13572355802537770549ULL,
+        16965444753172213186ULL, 18096474403383694065ULL,
+        18379231815936564285ULL, 18435783298447138329ULL,
+        18445208545532234003ULL, 18446555009401533385ULL,
+        18446723317385195808ULL, 18446742018272269410ULL,
+        18446743888360976771ULL};
+    uint32_t k = 0;
+    while (k < 11 and bits >= cdf[k]) {
+      ++k;
+    }
+    return k;
+  }
+
+  uint64_t seed_;
+  uint32_t numReplicates_;
+};
+
+#endif // POISSON_BOOTSTRAP_HPP
@@ -0,0 +1,181 @@
+#ifndef QUANT_CHECKPOINT_HPP
+#define QUANT_CHECKPOINT_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "spdlog/spdlog.h"
+
+class ReadExperiment;
+class ForgettingMassCalculator;
+
+namespace salmon {
+namespace checkpoint {
+
+/**
+ * The state of the online phase (quasi-mapping mode) after a prefix of the
+ * reads has been processed: enough to go on from the next read, as if the
+ * run had never stopped, save for the bias models (see --checkpointInterval).
+ */
+struct Snapshot {
+  // Identify the run, so that a checkpoint isn't resumed against other
+  // inputs
+  std::string indexSeqHash;
+  std::string readFiles;
+  // The read libraries whose reads were all processed, and the number of
+  // fragments processed from the next one
+  uint32_t numLibrariesDone{0};
+  uint64_t numLibraryFragments{0};
+
+  uint64_t numObservedFragments{0};
+  uint64_t numAssignedFragments{0};
+  uint64_t upperBoundHits{0};
+  // the forgetting mass timestep (mini-batch) to go on from
+  uint64_t miniBatchTimestep{0};
+
+  // per transcript
+  std::vector<double> logMasses;
+  std::vector<uint64_t> uniqueCounts;
+  std::vector<uint64_t> totalCounts;
+  std::vector<uint64_t> lastTimesteps;
+  std::vector<double> logEffLengths;
+
+  // the cluster forest
+  std::vector<uint32_t> clusterParents;
+  std::vector<double> clusterCounts;
+  std::vector<double> clusterLogMasses;
+
+  // the (logged) fragment length histogram
+  std::vector<double> fldLogHist;
+  double fldLogTotMass{0.0};
+  double fldLogSum{0.0};
+  uint64_t fldMin{0};
+
+  // the equivalence classes, with their counts and (summed) weights, as the
+  // builder holds them before finish()
+  std::vector<uint64_t> eqOffsets;
+  std::vector<uint32_t> eqTxps;
+  std::vector<uint64_t> eqWeightOffsets;
+  std::vector<double> eqWeights;
+  std::vector<uint64_t> eqCounts;
+};
+
+bool write(const boost::filesystem::path& path, const Snapshot& s);
+bool read(const boost::filesystem::path& path, Snapshot& s);
+
+// Copy the online state of experiment (and the given counters) into s
+void take(ReadExperiment& experiment, ForgettingMassCalculator& fmCalc,
+          uint64_t numObservedFragments, uint64_t numAssignedFragments,
+          uint64_t upperBoundHits, Snapshot& s);
+
+// The inverse of take(); false (having said why) if s isn't of this run
+bool restore(const Snapshot& s, ReadExperiment& experiment,
+             ForgettingMassCalculator& fmCalc, spdlog::logger* log);
+
+/**
+ * Takes a checkpoint every `interval` observed fragments.  The mapping
+ * threads call pauseIfDue() between mini-batches; once one of them sees that
+ * a checkpoint is due, each thread parks at its next call (having flushed
+ * what it holds locally), and the last one to park copies the state
+ * (`snapshotFn`), while the others wait.  Since the chunks of reads are
+ * handed out in order (by a single parsing thread), the fragments processed
+ * at that point are a prefix of the library.  The copy is then written by a
+ * thread of the checkpointer's own (to a temporary file, renamed over the
+ * previous checkpoint once it's complete), while the mapping goes on.
+ */
+class Checkpointer {
+public:
+  using SnapshotFn = std::function<void(Snapshot&)>;
+
+  Checkpointer(const boost::filesystem::path& path, uint64_t interval,
+               std::shared_ptr<spdlog::logger> log);
+  ~Checkpointer();
+
+  /**
+   * Start a read library, processed by numThreads mapping threads, when
+   * numObservedFragments fragments have been observed.  Returns the number
+   * of the library's fragments to skip (resumeFrom() was given a checkpoint
+   * past them); all of them if it's ~0.
+   */
+  uint64_t beginLibrary(uint32_t numThreads, uint64_t numObservedFragments,
+                        SnapshotFn snapshotFn);
+
+  // Skip the fragments of the snapshot's libraries on the next run
+  void resumeFrom(const Snapshot& s);
+
+  inline bool due(uint64_t numObservedFragments) const {
+    return numObservedFragments >= nextDue_.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Called by each mapping thread between its mini-batches; if a checkpoint
+   * is due, flushLocal() is called, and the thread waits until the
+   * checkpoint has been taken.
+   */
+  template <typename FlushFn>
+  void pauseIfDue(uint64_t numObservedFragments, FlushFn flushLocal) {
+    if (due(numObservedFragments)) {
+      flushLocal();
+      park_();
+    }
+  }
+
+  // Called by each mapping thread once it has run out of reads
+  void leave();
+
+  const boost::filesystem::path& path() const { return path_; }
+
+  // The number of checkpoints taken (written or not yet)
+  uint64_t numTaken() const { return numTaken_; }
+
+  // Wait for the last checkpoint to be written
+  bool finish();
+
+private:
+  void park_();
+  // with mut_ held, by the last thread to park
+  void takeLocked_();
+  void writerLoop_();
+
+  boost::filesystem::path path_;
+  uint64_t interval_;
+  std::shared_ptr<spdlog::logger> log_;
+  std::atomic<uint64_t> nextDue_;
+
+  std::mutex mut_;
+  std::condition_variable parked_;
+  uint32_t numActive_{0};
+  uint32_t numParked_{0};
+  uint64_t generation_{0};
+  uint64_t numTaken_{0};
+  SnapshotFn snapshotFn_;
+
+  // where the library being processed stands
+  uint32_t libraryIndex_{0};
+  uint64_t libraryStart_{0};
+  uint32_t resumeLibraries_{0};
+  uint64_t resumeFragments_{0};
+
+  // the background writer
+  std::mutex writeMut_;
+  std::condition_variable writeCond_;
+  std::unique_ptr<Snapshot> pending_;
+  bool stopWriter_{false};
+  bool writeOK_{true};
+  bool writing_{false};
+  std::thread writer_;
+};
+
+} // namespace checkpoint
+} // namespace salmon
+
+#endif // QUANT_CHECKPOINT_HPP
@@ -11,20 +11,24 @@ extern "C" {
 // Our includes
 #include "ClusterForest.hpp"
 #include "DistributionUtils.hpp"
+#include "EffectiveLengthStats.hpp"
 #include "EquivalenceClassBuilder.hpp"
 #include "FragmentLengthDistribution.hpp"
 #include "FragmentStartPositionDistribution.hpp"
 #include "GCFragModel.hpp"
+#include "MappingVerifier.hpp"
+#include "OnlineConvergenceMonitor.hpp"
 #include "ReadKmerDist.hpp"
 #include "ReadLibrary.hpp"
 #include "SBModel.hpp"
 #include "SalmonIndex.hpp"
 #include "SalmonOpts.hpp"
+#include "SalmonSpinLock.hpp"
 #include "SalmonUtils.hpp"
 #include "SequenceBiasModel.hpp"
 #include "SimplePosBias.hpp"
-#include "SpinLock.hpp" // RapMap's with try_lock
 #include "Transcript.hpp"
+#include "TranscriptNames.hpp"
 #include "UtilityFunctions.hpp"
 
 // Logger includes
@@ -37,6 +41,10 @@ extern "C" {
 // Cereal includes
 #include "cereal/archives/json.hpp"
 
+// TBB includes
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+
 // Standard includes
 #include <fstream>
 #include <memory>
@@ -52,10 +60,15 @@ extern "C" {
 class ReadExperiment {
 
 public:
+  /**
+   * If salmonIndex is given, it is the (already loaded) index in
+   * indexDirectory, and is shared with the caller rather than loaded again.
+   */
   ReadExperiment(std::vector<ReadLibrary>& readLibraries,
                  // const boost::filesystem::path& transcriptFile,
                  const boost::filesystem::path& indexDirectory,
-                 SalmonOpts& sopt)
+                 SalmonOpts& sopt,
+                 std::shared_ptr<SalmonIndex> salmonIndex = nullptr)
       : readLibraries_(readLibraries),
         // transcriptFile_(transcriptFile),
         transcripts_(std::vector<Transcript>()), totalAssignedFragments_(0),
@@ -65,7 +78,8 @@ public:
         expectedGC_(sopt.numConditionalGCBins, sopt.numFragGCBins,
                     distribution_utils::DistributionSpace::LOG),
         observedGC_(sopt.numConditionalGCBins, sopt.numFragGCBins,
-                    distribution_utils::DistributionSpace::LOG) {
+                    distribution_utils::DistributionSpace::LOG),
+        onlineConvergence_(sopt.onlineStopTolerance) {
     namespace bfs = boost::filesystem;
 
     // Make sure the read libraries are valid.
@@ -136,8 +150,13 @@ public:
     auto indexType = versionInfo.indexType();
     // ==== Figure out the index type
 
-    salmonIndex_.reset(new SalmonIndex(sopt.jointLog, indexType));
-    salmonIndex_->load(indexDirectory);
+    if (salmonIndex) {
+      salmonIndex_ = salmonIndex;
+    } else {
+      salmonIndex_.reset(new SalmonIndex(sopt.jointLog, indexType));
+      salmonIndex_->load(indexDirectory);
+      salmonIndex_->placeQuasiIndex(sopt.indexPlacement);
+    }
 
     // Now we'll have either an FMD-based index or a QUASI index
     // dispatch on the correct type.
@@ -176,6 +195,8 @@ public:
 
   std::vector<Transcript>& transcripts() { return transcripts_; }
   const std::vector<Transcript>& transcripts() const { return transcripts_; }
+  // The names of the transcripts, which their RefNames point into
+  const TranscriptNames& transcriptNames() const { return transcriptNames_; }
 
   const std::vector<double>& condMeans() const { return conditionalMeans_; }
 
@@ -256,6 +277,88 @@ public:
     return shortFragStats_;
   }
 
+  /**
+   * Record the number of times the per-thread mini-batch
+   * scratch buffers had to grow (see MiniBatchScratch).
+   */
+  void addScratchRegrowths(uint64_t n) { numScratchRegrowths_ += n; }
+  uint64_t numScratchRegrowths() const { return numScratchRegrowths_; }
+
+  /**
+   * Record the work done by a mapping thread's MappingVerifier.
+   */
+  void addMappingVerifierStats(const MappingVerifierStats& stats) {
+    numVerifierChecks_ += stats.numChecked;
+    numVerifierCacheHits_ += stats.numCacheHits;
+    numVerifierRejections_ += stats.numRejected;
+  }
+  MappingVerifierStats mappingVerifierStats() const {
+    MappingVerifierStats stats;
+    stats.numChecked = numVerifierChecks_;
+    stats.numCacheHits = numVerifierCacheHits_;
+    stats.numRejected = numVerifierRejections_;
+    return stats;
+  }
+
+  /**
+   * Record the lookups in, and hits of, a mapping thread's ReadMappingCache.
+   */
+  void addReadCacheStats(uint64_t numLookups, uint64_t numHits) {
+    numReadCacheLookups_ += numLookups;
+    numReadCacheHits_ += numHits;
+  }
+  uint64_t numReadCacheLookups() const { return numReadCacheLookups_; }
+  uint64_t numReadCacheHits() const { return numReadCacheHits_; }
+
+  /**
+   * Record the fragments a mapping thread discarded as repeats (--maxKmerOcc).
+   */
+  void addRepeatRejections(uint64_t n) { numRepeatRejections_ += n; }
+  uint64_t numRepeatRejections() const { return numRepeatRejections_; }
+
+  /**
+   * Record the reads a mapping thread clipped adapters off (--adapters), and
+   * the fragments it discarded as of low complexity (--maxDust).
+   */
+  void addPrefilterStats(uint64_t numClipped, uint64_t numLowComplexity) {
+    numAdapterClipped_ += numClipped;
+    numLowComplexity_ += numLowComplexity;
+  }
+  uint64_t numAdapterClipped() const { return numAdapterClipped_; }
+  uint64_t numLowComplexity() const { return numLowComplexity_; }
+
+  /**
+   * Record the fragments a parser left out of the subsample (--subsample).
+   */
+  void addSubsampledOut(uint64_t n) { numSubsampledOut_ += n; }
+  uint64_t numSubsampledOut() const { return numSubsampledOut_; }
+
+  /**
+   * Tracks whether the online estimates have stabilized (see
+   * --onlineStopTolerance).
+   */
+  OnlineConvergenceMonitor& onlineConvergence() { return onlineConvergence_; }
+  uint64_t onlineConvergedAtFragment() const {
+    return onlineConvergence_.convergedAtFragment();
+  }
+
+  /**
+   * Record the number of (VB)EM iterations each bootstrap sample took.
+   */
+  void setBootstrapIterations(const std::vector<uint32_t>& its) {
+    bootstrapIterations_ = its;
+  }
+  const std::vector<uint32_t>& bootstrapIterations() const {
+    return bootstrapIterations_;
+  }
+
+  /**
+   * Record the fragments left out of targeted quantification (--targets),
+   * whose classes lie outside of the targets' components.
+   */
+  void setNumBackgroundFragments(uint64_t n) { numBackgroundFragments_ = n; }
+  uint64_t numBackgroundFragments() const { return numBackgroundFragments_; }
+
   uint64_t numObservedFragments() const { return numObservedFragments_; }
 
   double mappingRate() {
@@ -275,49 +378,35 @@ public:
     auto log = sopt.jointLog.get();
 
     log->info("Index contained {} targets", numRecords);
-    // transcripts_.resize(numRecords);
-    std::vector<uint32_t> lengths;
-    lengths.reserve(numRecords);
-    double alpha = 0.005;
-    for (auto i : boost::irange(size_t(0), numRecords)) {
-      uint32_t id = i;
-      const char* name = idx_->txpNames[i].c_str();
-      uint32_t len = idx_->txpLens[i];
-      // copy over the length, then we're done.
-      transcripts_.emplace_back(id, name, len, alpha);
-      auto& txp = transcripts_.back();
-      txp.setCompleteLength(idx_->txpCompleteLens[i]);
-      // The transcript sequence
-      // auto txpSeq = idx_->seq.substr(idx_->txpOffsets[i], len);
-
-      // Set the transcript sequence
-      txp.setSequenceBorrowed(idx_->seq.c_str() + idx_->txpOffsets[i],
-                              sopt.gcBiasCorrect, sopt.reduceGCMemory);
-      lengths.push_back(txp.RefLength);
-      /*
-      // Length classes taken from
-      //
-      https://github.com/cole-trapnell-lab/cufflinks/blob/master/src/biascorrection.cpp
-      // ======
-      // Roberts, Adam, et al.
-      // "Improving RNA-Seq expression estimates by correcting for fragment
-      bias."
-      // Genome Biol 12.3 (2011): R22.
-      // ======
-      // perhaps, define these in a more data-driven way
-      if (txp.RefLength <= 791) {
-      txp.lengthClassIndex(0);
-      } else if (txp.RefLength <= 1265) {
-      txp.lengthClassIndex(1);
-      } else if (txp.RefLength <= 1707) {
-      txp.lengthClassIndex(2);
-      } else if (txp.RefLength <= 2433) {
-      txp.lengthClassIndex(3);
-      } else {
-      txp.lengthClassIndex(4);
-      }
-      */
+    // The names are stored (once, serially) first; the transcripts are
+    // independent of one another, so the table is sized up front and filled
+    // in parallel.
+    transcriptNames_.reserve(numRecords);
+    for (size_t i = 0; i < numRecords; ++i) {
+      transcriptNames_.add(idx_->txpNames[i]);
     }
+    transcripts_.resize(numRecords);
+    std::vector<uint32_t> lengths(numRecords);
+    double alpha = 0.005;
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, numRecords, 1024),
+        [this, idx_, &sopt, &lengths,
+         alpha](const tbb::blocked_range<size_t>& range) -> void {
+          for (auto i = range.begin(); i != range.end(); ++i) {
+            uint32_t id = i;
+            const char* name = transcriptNames_.name(id);
+            uint32_t len = idx_->txpLens[i];
+            // copy over the length, then we're done.
+            transcripts_[i] = Transcript(id, name, len, alpha);
+            auto& txp = transcripts_[i];
+            txp.setCompleteLength(idx_->txpCompleteLens[i]);
+
+            // Set the transcript sequence
+            txp.setSequenceBorrowed(idx_->seq.c_str() + idx_->txpOffsets[i],
+                                    sopt.gcBiasCorrect);
+            lengths[i] = txp.RefLength;
+          }
+        });
     // ====== Done loading the transcripts from file
     setTranscriptLengthClasses_(lengths, posBiasFW_.size());
   }
@@ -334,7 +423,8 @@ public:
     // transcripts_.resize(numRecords);
     for (auto i : boost::irange(size_t(0), numRecords)) {
       uint32_t id = i;
-      char* name = idx_->bns->anns[i].name;
+      const char* name =
+          transcriptNames_.name(transcriptNames_.add(idx_->bns->anns[i].name));
       uint32_t len = idx_->bns->anns[i].len;
       // copy over the length, then we're done.
       transcripts_tmp.emplace_back(id, name, len);
@@ -360,7 +450,7 @@ public:
     size_t tnum = 0;
     // Load the transcript sequence from file
     for (auto& t : transcripts_tmp) {
-      transcripts_.emplace_back(t.id, t.RefName.c_str(), t.RefLength, alpha);
+      transcripts_.emplace_back(t.id, t.RefName, t.RefLength, alpha);
       /* from BWA */
       uint8_t* rseq = nullptr;
       int64_t tstart, tend, compLen, l_pac = idx_->bns->l_pac;
@@ -682,6 +772,11 @@ public:
 
   GCFragModel& observedGC() { return observedGC_; }
 
+  // The effective lengths observed for paired-end fragments, so far
+  EffectiveLengthStats& observedEffectiveLengths() {
+    return observedEffLengths_;
+  }
+
   std::vector<SimplePosBias>& posBias(salmon::utils::Direction dir) {
     return (dir == salmon::utils::Direction::FORWARD) ? posBiasFW_ : posBiasRC_;
   }
@@ -793,6 +888,8 @@ private:
    * This is expected to be a FASTA format file.
    */
   // boost::filesystem::path transcriptFile_;
+  // (declared before the transcripts, whose RefNames point into it)
+  TranscriptNames transcriptNames_;
   /**
    * The targets (transcripts) to be quantified.
    */
@@ -800,7 +897,7 @@ private:
   /**
    * The index we've built on the set of transcripts.
    */
-  std::unique_ptr<SalmonIndex> salmonIndex_{nullptr};
+  std::shared_ptr<SalmonIndex> salmonIndex_{nullptr};
   // bwaidx_t *idx_{nullptr};
   /**
    * The cluster forest maintains the dynamic relationship
@@ -828,8 +925,21 @@ private:
   uint64_t numAssignedFragsInFirstPass_{0};
   uint64_t numObservedFragsInFirstPass_{0};
   uint64_t upperBoundHits_{0};
+  std::atomic<uint64_t> numScratchRegrowths_{0};
+  std::atomic<uint64_t> numVerifierChecks_{0};
+  std::atomic<uint64_t> numVerifierCacheHits_{0};
+  std::atomic<uint64_t> numVerifierRejections_{0};
+  std::atomic<uint64_t> numReadCacheLookups_{0};
+  std::atomic<uint64_t> numReadCacheHits_{0};
+  std::atomic<uint64_t> numRepeatRejections_{0};
+  std::atomic<uint64_t> numAdapterClipped_{0};
+  std::atomic<uint64_t> numLowComplexity_{0};
+  std::atomic<uint64_t> numSubsampledOut_{0};
+  OnlineConvergenceMonitor onlineConvergence_;
+  std::vector<uint32_t> bootstrapIterations_;
+  uint64_t numBackgroundFragments_{0};
   double effectiveMappingRate_{0.0};
-  SpinLock sl_;
+  spin_lock sl_{"read_experiment"};
   std::unique_ptr<FragmentLengthDistribution> fragLengthDist_;
   EquivalenceClassBuilder eqBuilder_;
 
@@ -846,6 +956,8 @@ private:
   GCFragModel observedGC_;
   GCFragModel expectedGC_;
 
+  EffectiveLengthStats observedEffLengths_;
+
   /** Sequence specific bias things **/
   // Since multiple threads can touch this dist, we
   // need atomic counters.
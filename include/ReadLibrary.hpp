@@ -7,6 +7,7 @@
 
 #include <boost/filesystem.hpp>
 
+#include "FastxReadahead.hpp"
 #include "LibraryFormat.hpp"
 #include "LibraryTypeDetector.hpp"
 
@@ -32,6 +33,7 @@ public:
       : fmt_(rl.fmt_), unmatedFilenames_(rl.unmatedFilenames_),
         mateOneFilenames_(rl.mateOneFilenames_),
         mateTwoFilenames_(rl.mateTwoFilenames_),
+        interleavedFilenames_(rl.interleavedFilenames_),
         libTypeCounts_(std::vector<std::atomic<uint64_t>>(
             LibraryFormat::maxLibTypeID() + 1)) {
     size_t mc = LibraryFormat::maxLibTypeID() + 1;
@@ -51,6 +53,7 @@ public:
       : fmt_(rl.fmt_), unmatedFilenames_(std::move(rl.unmatedFilenames_)),
         mateOneFilenames_(std::move(rl.mateOneFilenames_)),
         mateTwoFilenames_(std::move(rl.mateTwoFilenames_)),
+        interleavedFilenames_(std::move(rl.interleavedFilenames_)),
         libTypeCounts_(std::vector<std::atomic<uint64_t>>(
             LibraryFormat::maxLibTypeID() + 1)) {
     size_t mc = LibraryFormat::maxLibTypeID() + 1;
@@ -68,7 +71,8 @@ public:
    * library.
    */
   void addMates1(const std::vector<std::string>& mateOneFilenames) {
-    mateOneFilenames_ = mateOneFilenames;
+    mateOneFilenames_.insert(mateOneFilenames_.end(), mateOneFilenames.begin(),
+                             mateOneFilenames.end());
   }
 
   /**
@@ -76,14 +80,26 @@ public:
    * library.
    */
   void addMates2(const std::vector<std::string>& mateTwoFilenames) {
-    mateTwoFilenames_ = mateTwoFilenames;
+    mateTwoFilenames_.insert(mateTwoFilenames_.end(), mateTwoFilenames.begin(),
+                             mateTwoFilenames.end());
+  }
+
+  /**
+   * Add files containing interleaved mated reads (each #1 mate followed by
+   * its #2 mate) to this library.
+   */
+  void addInterleaved(const std::vector<std::string>& interleavedFilenames) {
+    interleavedFilenames_.insert(interleavedFilenames_.end(),
+                                 interleavedFilenames.begin(),
+                                 interleavedFilenames.end());
   }
 
   /**
    * Add files containing unmated reads.
    */
   void addUnmated(const std::vector<std::string>& unmatedFilenames) {
-    unmatedFilenames_ = unmatedFilenames;
+    unmatedFilenames_.insert(unmatedFilenames_.end(), unmatedFilenames.begin(),
+                             unmatedFilenames.end());
   }
 
   /**
@@ -114,7 +130,8 @@ public:
     namespace bfs = boost::filesystem;
     bool allExist{true};
     for (auto& fn : filenames) {
-      if (!bfs::exists(fn)) {
+      // (a remote object is only found once it's read)
+      if (!fastx_parser::isRemotePath(fn) and !bfs::exists(fn)) {
         errorStream << "ERROR: file [" << fn
                     << "] does not appear to exist!\n\n";
         allExist = false;
@@ -172,6 +189,11 @@ public:
           return false;
         }
       }
+      for (auto& il : interleavedFilenames_) {
+        if (!boost::filesystem::is_regular_file(il)) {
+          return false;
+        }
+      }
     } else {
       for (auto& um : unmatedFilenames_) {
         if (!boost::filesystem::is_regular_file(um)) {
@@ -187,14 +209,21 @@ public:
     if (isPairedEnd()) {
       size_t n1 = mateOneFilenames_.size();
       size_t n2 = mateTwoFilenames_.size();
-      if (n1 == 0 or n2 == 0 or n1 != n2) {
+      size_t ni = interleavedFilenames_.size();
+      if ((n1 == 0 and ni == 0) or n1 != n2) {
         sstr << "LIBRARY INVALID --- You must provide #1 and #2 mated read "
                 "files with a paired-end library type";
       } else {
         for (size_t i = 0; i < n1; ++i) {
           sstr << "( " << mateOneFilenames_[i] << ", " << mateTwoFilenames_[i]
                << " )";
-          if (i != n1 - 1) {
+          if (i != n1 - 1 or ni > 0) {
+            sstr << ", ";
+          }
+        }
+        for (size_t i = 0; i < ni; ++i) {
+          sstr << "( " << interleavedFilenames_[i] << " )";
+          if (i != ni - 1) {
             sstr << ", ";
           }
         }
@@ -233,9 +262,10 @@ public:
     if (isPairedEnd()) {
       size_t n1 = mateOneFilenames_.size();
       size_t n2 = mateTwoFilenames_.size();
-      if (n1 == 0 or n2 == 0 or n1 != n2) {
-        errorStream << "You must provide #1 and #2 mated read files with a "
-                       "paired-end library type\n";
+      if ((n1 == 0 and interleavedFilenames_.empty()) or n1 != n2) {
+        errorStream << "You must provide #1 and #2 mated read files (or "
+                       "interleaved read files) with a paired-end library "
+                       "type\n";
         readsOK = false;
       }
     } else {
@@ -257,6 +287,8 @@ public:
               checkFileExtensions_(mateOneFilenames_, errorStream);
     readsOK = readsOK && allExist_(mateTwoFilenames_, errorStream) &&
               checkFileExtensions_(mateTwoFilenames_, errorStream);
+    readsOK = readsOK && allExist_(interleavedFilenames_, errorStream) &&
+              checkFileExtensions_(interleavedFilenames_, errorStream);
     readsOK = readsOK && allExist_(unmatedFilenames_, errorStream) &&
               checkFileExtensions_(unmatedFilenames_, errorStream);
 
@@ -275,6 +307,29 @@ public:
    */
   const std::vector<std::string>& mates2() const { return mateTwoFilenames_; }
 
+  /**
+   * Return the vector of files containing interleaved mated reads for this
+   * library.
+   */
+  const std::vector<std::string>& interleaved() const {
+    return interleavedFilenames_;
+  }
+
+  /**
+   * Return the files to give a paired-end parser as its #1 (`files1`) and #2
+   * (`files2`) files: the mate files, followed by the interleaved files, each
+   * paired with an empty #2 file name (which the parser reads as "the #2
+   * mates follow the #1 mates in the same file").
+   */
+  void parserFiles(std::vector<std::string>& files1,
+                   std::vector<std::string>& files2) const {
+    files1 = mateOneFilenames_;
+    files2 = mateTwoFilenames_;
+    files1.insert(files1.end(), interleavedFilenames_.begin(),
+                  interleavedFilenames_.end());
+    files2.resize(files1.size());
+  }
+
   /**
    * Return the vector of files containing the unmated reads for the library.
    */
@@ -312,6 +367,7 @@ private:
   std::vector<std::string> unmatedFilenames_;
   std::vector<std::string> mateOneFilenames_;
   std::vector<std::string> mateTwoFilenames_;
+  std::vector<std::string> interleavedFilenames_;
   std::vector<std::atomic<uint64_t>> libTypeCounts_;
   std::atomic<uint64_t> numCompat_;
   std::unique_ptr<LibraryTypeDetector> detector_{nullptr};
@@ -0,0 +1,91 @@
+#ifndef __READ_MAPPING_CACHE_HPP__
+#define __READ_MAPPING_CACHE_HPP__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "xxhash.h"
+
+/**
+ * A per-thread cache of the mappings of recently seen reads, so that an
+ * exact duplicate of a read (or read pair) need not be mapped again.
+ *
+ * The cache is direct-mapped: each read (pair) is hashed (with XXH64) to
+ * one of a fixed number of slots, and a new entry simply replaces the one
+ * in its slot, so the memory used is bounded and recently seen reads are
+ * the ones that are kept.  The full sequences are stored and compared, so
+ * a hash collision can never return the mappings of a different read.  The
+ * vectors and strings of a slot keep their capacity when it's reused.
+ */
+template <typename AlnT> class ReadMappingCache {
+public:
+  explicit ReadMappingCache(size_t numSlots) : slots_(numSlots) {}
+
+  bool enabled() const { return !slots_.empty(); }
+
+  /**
+   * If the read (pair) with the given sequences (second is empty for a
+   * single-end read) is in the cache, copy its mappings into hits and return
+   * true.  Either way, remember its slot for a following insert().
+   */
+  bool lookup(const std::string& first, std::vector<AlnT>& hits) {
+    return lookup(first, empty_, hits);
+  }
+  bool lookup(const std::string& first, const std::string& second,
+              std::vector<AlnT>& hits) {
+    uint64_t h = XXH64(first.data(), first.size(), 0);
+    h = XXH64(second.data(), second.size(), h);
+    last_ = &slots_[h % slots_.size()];
+    lastHash_ = h;
+    ++numLookups_;
+    if (last_->valid and last_->hash == h and last_->first == first and
+        last_->second == second) {
+      hits.assign(last_->hits.begin(), last_->hits.end());
+      ++numHits_;
+      return true;
+    }
+    return false;
+  }
+
+  /**
+   * Record the mappings of the read (pair) that was last looked up (and
+   * not found).
+   */
+  void insert(const std::string& first, const std::vector<AlnT>& hits) {
+    insert(first, empty_, hits);
+  }
+  void insert(const std::string& first, const std::string& second,
+              const std::vector<AlnT>& hits) {
+    if (last_ == nullptr) {
+      return;
+    }
+    last_->valid = true;
+    last_->hash = lastHash_;
+    last_->first.assign(first);
+    last_->second.assign(second);
+    last_->hits.assign(hits.begin(), hits.end());
+    last_ = nullptr;
+  }
+
+  uint64_t numLookups() const { return numLookups_; }
+  uint64_t numHits() const { return numHits_; }
+
+private:
+  struct Slot {
+    bool valid{false};
+    uint64_t hash{0};
+    std::string first;
+    std::string second;
+    std::vector<AlnT> hits;
+  };
+
+  const std::string empty_;
+  std::vector<Slot> slots_;
+  Slot* last_{nullptr};
+  uint64_t lastHash_{0};
+  uint64_t numLookups_{0};
+  uint64_t numHits_{0};
+};
+
+#endif // __READ_MAPPING_CACHE_HPP__
@@ -0,0 +1,127 @@
+#ifndef __READ_PREFILTER_HPP__
+#define __READ_PREFILTER_HPP__
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "SalmonStringUtils.hpp"
+
+/**
+ * A cheap look at each read before it is quasi-mapped: adapter sequence is
+ * clipped off the read, and reads of low complexity (homopolymers, poly-A
+ * tails, short tandem repeats) are discarded, so that neither goes through
+ * the hit collector, where such reads only find huge suffix array intervals
+ * (or nothing).
+ *
+ * The complexity of a read is measured by the DUST score of its triplets:
+ * the sum, over the 64 trinucleotides, of c * (c - 1) / 2 for the c times
+ * each occurs, divided by one less than the number of triplets.  A random
+ * sequence scores about 1 (whatever its length), and a homopolymer about half
+ * its length.  The bases are 2-bit encoded with the vectorized encoder of the
+ * bias models first; triplets with an N are skipped.
+ *
+ * An adapter is clipped at its first occurrence in the read, or at a partial
+ * occurrence (a prefix of the adapter of at least minOverlap bases) at the
+ * read's 3' end; a read that is (nearly) all adapter, e.g. of an adapter
+ * dimer, is then too short to be mapped.
+ */
+class ReadPrefilter {
+public:
+  ReadPrefilter(double maxDust, const std::vector<std::string>& adapters,
+                uint32_t minOverlap)
+      : maxDust_(maxDust), minOverlap_(std::max(minOverlap, uint32_t(1))) {
+    for (auto a : adapters) {
+      std::transform(a.begin(), a.end(), a.begin(), ::toupper);
+      if (!a.empty()) {
+        adapters_.push_back(a);
+      }
+    }
+  }
+
+  bool enabled() const { return filtersComplexity() or clipsAdapters(); }
+  bool filtersComplexity() const { return maxDust_ > 0.0; }
+  bool clipsAdapters() const { return !adapters_.empty(); }
+
+  /**
+   * Clip the earliest adapter found in seq off it (with what follows);
+   * returns true if anything was clipped.
+   */
+  bool clipAdapter(std::string& seq) const {
+    size_t clipAt = seq.length();
+    for (auto& a : adapters_) {
+      clipAt = std::min(clipAt, adapterStart_(seq, a));
+    }
+    if (clipAt == seq.length()) {
+      return false;
+    }
+    seq.resize(clipAt);
+    return true;
+  }
+
+  // True if seq should be discarded, unmapped, as of low complexity
+  bool lowComplexity(const std::string& seq) {
+    return filtersComplexity() and dustScore(seq) > maxDust_;
+  }
+
+  // The DUST score of seq (0 if it has fewer than two triplets)
+  double dustScore(const std::string& seq) {
+    size_t len = seq.length();
+    if (len < 4) {
+      return 0.0;
+    }
+    codes_.resize(len);
+    salmon::stringtools::encodeTwoBit(seq.data(), len, codes_.data());
+    counts_.fill(0);
+    uint64_t numTriplets{0};
+    for (size_t i = 0; i + 2 < len; ++i) {
+      int8_t a = codes_[i];
+      int8_t b = codes_[i + 1];
+      int8_t c = codes_[i + 2];
+      if ((a | b | c) < 0) {
+        continue;
+      }
+      ++counts_[(a << 4) | (b << 2) | c];
+      ++numTriplets;
+    }
+    if (numTriplets < 2) {
+      return 0.0;
+    }
+    uint64_t sum{0};
+    for (uint64_t c : counts_) {
+      if (c > 1) {
+        sum += c * (c - 1) / 2;
+      }
+    }
+    return static_cast<double>(sum) / (numTriplets - 1);
+  }
+
+private:
+  // Where adapter starts in seq (seq.length() if it doesn't)
+  size_t adapterStart_(const std::string& seq,
+                       const std::string& adapter) const {
+    size_t len = seq.length();
+    size_t minMatch = std::min(size_t(minOverlap_), adapter.length());
+    const char* s = seq.data();
+    for (size_t p = 0; p + minMatch <= len; ++p) {
+      size_t n = std::min(len - p, adapter.length());
+      if (s[p] == adapter[0] and std::memcmp(s + p, adapter.data(), n) == 0) {
+        return p;
+      }
+    }
+    return len;
+  }
+
+  double maxDust_;
+  uint32_t minOverlap_;
+  std::vector<std::string> adapters_;
+  // scratch, reused across reads
+  std::vector<int8_t> codes_;
+  std::array<uint32_t, 64> counts_;
+};
+
+#endif // __READ_PREFILTER_HPP__
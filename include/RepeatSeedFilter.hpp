@@ -0,0 +1,85 @@
+#ifndef __REPEAT_SEED_FILTER_HPP__
+#define __REPEAT_SEED_FILTER_HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+#include "RapMapUtils.hpp"
+
+/**
+ * Early rejection of reads made only of highly repetitive sequence (poly-A,
+ * Alu-like repeats, rRNA) before they are quasi-mapped.
+ *
+ * A read whose k-mers all occur many times in the index makes the hit
+ * collector walk huge suffix array intervals, only for the read to be
+ * discarded (for mapping to more than --maxReadOcc places) afterwards.  The
+ * number of occurrences of a k-mer is the size of its SA interval, which the
+ * k-mer hash holds, so it is known from the hash lookup alone, without
+ * touching the SA.  The filter looks up a tiling of the read's k-mers (in
+ * both orientations), and stops at the first one that occurs no more than
+ * maxOcc times; a read is rejected only if it has at least one k-mer in the
+ * index and all of the k-mers it looked up that are in the index occur more
+ * than maxOcc times.  A typical read is let through after its first lookup.
+ */
+template <typename RapMapIndexT> class RepeatSeedFilter {
+public:
+  RepeatSeedFilter(RapMapIndexT* idx, uint64_t maxOcc)
+      : idx_(idx), k_(rapmap::utils::my_mer::k()), maxOcc_(maxOcc) {}
+
+  bool enabled() const { return maxOcc_ > 0; }
+
+  // True if the read should be discarded without being mapped
+  bool tooFrequent(const std::string& seq) {
+    if (!enabled() or seq.length() < k_) {
+      return false;
+    }
+    bool haveSeed{false};
+    size_t last = seq.length() - k_;
+    // The k-mers at 0, k, 2k, ..., and the last one
+    for (size_t pos = 0;; pos = std::min(pos + k_, last)) {
+      uint64_t occ{0};
+      if (occurrences_(seq.data() + pos, occ)) {
+        if (occ <= maxOcc_) {
+          return false;
+        }
+        haveSeed = true;
+      }
+      if (pos == last) {
+        break;
+      }
+    }
+    return haveSeed;
+  }
+
+private:
+  // The occurrences of the k-mer at seq, in either orientation, in occ;
+  // false if it isn't in the index (or has an N)
+  inline bool occurrences_(const char* seq, uint64_t& occ) {
+    rapmap::utils::my_mer mer;
+    if (!mer.from_chars(seq)) {
+      return false;
+    }
+    auto& khash = idx_->khash;
+    bool found{false};
+    occ = 0;
+    auto it = khash.find(mer.get_bits(0, 2 * k_));
+    if (it != khash.end()) {
+      occ += it->second.end() - it->second.begin();
+      found = true;
+    }
+    auto rc = mer.get_reverse_complement();
+    it = khash.find(rc.get_bits(0, 2 * k_));
+    if (it != khash.end()) {
+      occ += it->second.end() - it->second.begin();
+      found = true;
+    }
+    return found;
+  }
+
+  RapMapIndexT* idx_;
+  size_t k_;
+  uint64_t maxOcc_;
+};
+
+#endif // __REPEAT_SEED_FILTER_HPP__
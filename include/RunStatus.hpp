@@ -0,0 +1,186 @@
+#ifndef __RUN_STATUS_HPP__
+#define __RUN_STATUS_HPP__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "spdlog/fmt/fmt.h"
+
+#include "PerformanceStats.hpp"
+
+/**
+ * The live status of a quantification run (--statusFile): the fragments
+ * processed and mapped so far, the recent throughput, the current phase, the
+ * number of parsed chunks waiting for the mapping threads, the progress of
+ * the EM and the number of posterior samples written.  While the run is
+ * active, a background thread rewrites the status, as a small JSON object,
+ * every interval seconds (and once more when it ends, with "done": true);
+ * the file is replaced by a rename, so a reader never sees it half written.
+ *
+ * Everything is read from counters the quant threads already maintain (the
+ * trackers below), or from atomics they set in passing, so nothing on the
+ * hot path waits on the status thread.
+ */
+class RunStatus {
+public:
+  RunStatus() = default;
+  ~RunStatus() { stop(); }
+
+  RunStatus(const RunStatus&) = delete;
+  RunStatus& operator=(const RunStatus&) = delete;
+
+  /**
+   * Start rewriting path every intervalSec seconds; the phase is taken from
+   * perfStats.
+   */
+  void start(const std::string& path, double intervalSec,
+             std::shared_ptr<PerformanceStats> perfStats) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (writer_.joinable()) {
+      return;
+    }
+    path_ = path;
+    interval_ = std::chrono::duration<double>(std::max(intervalSec, 0.1));
+    perfStats_ = perfStats;
+    start_ = std::chrono::steady_clock::now();
+    lastWrite_ = start_;
+    stopping_ = false;
+    writer_ = std::thread([this]() -> void { run_(); });
+  }
+
+  // Write the final status and stop the background thread
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!writer_.joinable()) {
+        return;
+      }
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    writer_.join();
+  }
+
+  /**
+   * Follow the fragments processed and mapped (over all rounds) through the
+   * given functions, until untrackFragments(), which keeps their last values.
+   */
+  void trackFragments(std::function<uint64_t()> processed,
+                      std::function<uint64_t()> mapped) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    processedFn_ = processed;
+    mappedFn_ = mapped;
+  }
+
+  void untrackFragments() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (processedFn_) {
+      numProcessed_ = processedFn_();
+    }
+    if (mappedFn_) {
+      numMapped_ = mappedFn_();
+    }
+    processedFn_ = nullptr;
+    mappedFn_ = nullptr;
+  }
+
+  /**
+   * Report the depth of the read parser's queue through depth (or stop, if
+   * depth is empty); it's only called with the lock held, so the parser may
+   * be destroyed once this returns.
+   */
+  void trackReadQueue(std::function<uint64_t()> depth) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queueDepthFn_ = depth;
+  }
+
+  // Set by the offline EM, at every iteration
+  std::atomic<uint64_t> emIteration{0};
+  std::atomic<double> emMaxRelDiff{0.0};
+  // Counted as the bootstraps / Gibbs samples are drawn
+  std::atomic<uint64_t> numSamples{0};
+
+private:
+  void run_() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+      wake_.wait_for(lock, interval_, [this]() { return stopping_; });
+      write_(stopping_);
+    }
+  }
+
+  // Rewrite the status; mutex_ must be held
+  void write_(bool done) {
+    if (processedFn_) {
+      numProcessed_ = processedFn_();
+    }
+    if (mappedFn_) {
+      numMapped_ = mappedFn_();
+    }
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed = now - start_;
+    std::chrono::duration<double> sinceLast = now - lastWrite_;
+    double recentRate =
+        (sinceLast.count() > 0.0)
+            ? (numProcessed_ - lastProcessed_) / sinceLast.count()
+            : 0.0;
+    lastWrite_ = now;
+    lastProcessed_ = numProcessed_;
+    double mappingRate =
+        (numProcessed_ > 0) ? (100.0 * numMapped_) / numProcessed_ : 0.0;
+    std::string phase = perfStats_ ? perfStats_->currentPhase() : "";
+    int64_t queueDepth =
+        queueDepthFn_ ? static_cast<int64_t>(queueDepthFn_()) : -1;
+
+    fmt::MemoryWriter w;
+    w.write("{{\n    \"elapsed_sec\": {:.1f},\n", elapsed.count());
+    w.write("    \"phase\": \"{}\",\n", phase);
+    w.write("    \"num_processed\": {},\n", numProcessed_);
+    w.write("    \"num_mapped\": {},\n", numMapped_);
+    w.write("    \"percent_mapped\": {:.2f},\n", mappingRate);
+    w.write("    \"fragments_per_sec\": {:.1f},\n", recentRate);
+    w.write("    \"read_queue_depth\": {},\n", queueDepth);
+    w.write("    \"em_iteration\": {},\n", emIteration.load());
+    w.write("    \"em_max_rel_diff\": {},\n", emMaxRelDiff.load());
+    w.write("    \"num_samples\": {},\n", numSamples.load());
+    w.write("    \"done\": {}\n}}\n", done ? "true" : "false");
+
+    std::string tmpPath = path_ + ".tmp";
+    {
+      std::ofstream ofs(tmpPath);
+      ofs.write(w.data(), w.size());
+      if (!ofs.good()) {
+        return;
+      }
+    }
+    std::rename(tmpPath.c_str(), path_.c_str());
+  }
+
+  std::string path_;
+  std::chrono::duration<double> interval_{10.0};
+  std::shared_ptr<PerformanceStats> perfStats_{nullptr};
+  std::chrono::steady_clock::time_point start_;
+  std::chrono::steady_clock::time_point lastWrite_;
+  uint64_t lastProcessed_{0};
+  uint64_t numProcessed_{0};
+  uint64_t numMapped_{0};
+  std::function<uint64_t()> processedFn_{nullptr};
+  std::function<uint64_t()> mappedFn_{nullptr};
+  std::function<uint64_t()> queueDepthFn_{nullptr};
+  bool stopping_{false};
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::thread writer_;
+};
+
+#endif // __RUN_STATUS_HPP__
@@ -7,6 +7,8 @@
 #include "jellyfish/mer_dna.hpp"
 #include <Eigen/Dense>
 #include <cmath>
+#include <utility>
+#include <vector>
 
 using Mer = jellyfish::mer_dna_ns::mer_base_static<uint64_t, 4>;
 
@@ -20,6 +22,9 @@ public:
   SBModel& operator=(SBModel&&) = default;
 
   bool writeBinary(boost::iostreams::filtering_ostream& out) const;
+  // Read a (normalized) model written by writeBinary; false if it isn't one
+  // with this model's contexts
+  bool readBinary(boost::iostreams::filtering_istream& in);
 
   inline int32_t contextBefore(bool rc) {
     return rc ? _contextRight : _contextLeft;
@@ -31,6 +36,37 @@ public:
   bool addSequence(const char* seqIn, bool revCmp, double weight = 1.0);
   bool addSequence(const Mer& mer, double weight);
 
+  /**
+   * Encode the context of a read that starts at position pos of the
+   * transcript seq (of length len), on the reverse-complement strand if rc,
+   * as the bits (2 per base) of the Mer that addSequence(mer) would be
+   * given, in a single pass over the bases rather than by way of a Mer
+   * (and, for rc, reverse_complement()).  Returns false if the context
+   * doesn't fit within the transcript or holds a base other than A, C, G
+   * or T.
+   */
+  bool encodeContext(const char* seq, int32_t len, int32_t pos, bool rc,
+                     uint64_t& code) const;
+
+  // Count a context encoded by encodeContext()
+  inline void addEncoded(uint64_t code, double weight = 1.0) {
+    for (int32_t i = 0; i < _contextLength; ++i) {
+      uint64_t idx = (code >> _shifts[i]) & ((uint64_t(1) << _widths[i]) - 1);
+      _probs(idx, i) += weight;
+    }
+  }
+
+  // Count the context of a read (see encodeContext()), if it has one
+  inline bool addContext(const char* seq, int32_t len, int32_t pos, bool rc,
+                         double weight = 1.0) {
+    uint64_t code;
+    if (!encodeContext(seq, len, pos, rc, code)) {
+      return false;
+    }
+    addEncoded(code, weight);
+    return true;
+  }
+
   Eigen::MatrixXd& counts();
   Eigen::MatrixXd& marginals();
 
@@ -62,6 +98,8 @@ public:
   }
 
 private:
+  friend class SBModelRatio;
+
   inline uint32_t _getIndex(uint32_t kmer, uint32_t offset, uint32_t _order) {
     kmer >>= offset;
     switch (_order) {
@@ -91,4 +129,41 @@ private:
   std::vector<int32_t> _widths;
 };
 
+/**
+ * The (log) ratio of two normalized SBModels with the same contexts (e.g.
+ * the observed and expected models of one read end), compiled for scoring
+ * every position of every transcript when computing effective lengths.
+ * The probabilities of each context position are flattened into one
+ * (observed, expected) table holding only the 4^(order + 1) entries that
+ * position uses, so that both models are scored with a single index
+ * computation per position, from the context's bits taken as one word.
+ * evaluateLog(mer) is exactly num.evaluateLog(mer) - den.evaluateLog(mer).
+ */
+class SBModelRatio {
+public:
+  SBModelRatio(const SBModel& num, const SBModel& den);
+
+  inline double evaluateLog(const Mer& mer) const {
+    uint64_t bits = mer.get_bits(0, contextBits_);
+    double pNum{0.0};
+    double pDen{0.0};
+    for (const auto& c : positions_) {
+      const auto& e = table_[c.offset + ((bits >> c.shift) & c.mask)];
+      pNum += e.first;
+      pDen += e.second;
+    }
+    return pNum - pDen;
+  }
+
+private:
+  struct Position {
+    uint32_t offset; // of this position's entries in table_
+    uint32_t shift;
+    uint64_t mask;
+  };
+  uint32_t contextBits_;
+  std::vector<Position> positions_;
+  std::vector<std::pair<double, double>> table_;
+};
+
 #endif //__SB_MODEL_HPP__
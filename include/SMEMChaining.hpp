@@ -0,0 +1,139 @@
+#ifndef SMEM_CHAINING_HPP
+#define SMEM_CHAINING_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/**
+ * The vote-and-chain step of the FMD (SMEM) lightweight alignment: the
+ * occurrences of a read's MEMs are grouped into one hit per transcript, and
+ * the votes of a hit (MEMs on the same diagonal, give or take a few bases)
+ * are clustered to find its best location.  Reads with many paralogs have
+ * many hits, so both are done without a search or a map per occurrence.
+ */
+namespace salmon {
+namespace smem {
+
+/**
+ * One occurrence of a MEM: transcript position tpos (the leftmost one, for
+ * the reverse complement), the MEM's start and length in the read, and the
+ * read's length.  order is the occurrence's rank in the order they were
+ * found.
+ */
+struct Anchor {
+  uint32_t targetID;
+  uint32_t order;
+  uint32_t tpos;
+  uint32_t readPos;
+  uint32_t len;
+  uint32_t readLen;
+  bool isRC;
+};
+
+/**
+ * Append to hits one hit per transcript in anchors, in the order of their
+ * transcripts' first anchor, each with the votes of its anchors in the
+ * order they were found (as adding them one by one, looking the hit up
+ * each time, would).  anchors is sorted in place.  HitT is a
+ * TranscriptHitList (or anything with targetID, votes, rcVotes,
+ * addFragMatch and addFragMatchRC).
+ */
+template <typename HitT>
+void groupAnchors(std::vector<Anchor>& anchors, std::vector<HitT>& hits) {
+  std::sort(anchors.begin(), anchors.end(),
+            [](const Anchor& a, const Anchor& b) -> bool {
+              return a.targetID < b.targetID or
+                     (a.targetID == b.targetID and a.order < b.order);
+            });
+  // The anchors of each transcript, [begin, end), by their first one
+  struct Run {
+    uint32_t firstOrder;
+    uint32_t begin;
+    uint32_t end;
+    uint32_t numRC;
+  };
+  std::vector<Run> runs;
+  for (size_t b = 0, e = 0; b < anchors.size(); b = e) {
+    uint32_t numRC{0};
+    for (e = b; e < anchors.size() and
+                anchors[e].targetID == anchors[b].targetID;
+         ++e) {
+      numRC += anchors[e].isRC ? 1 : 0;
+    }
+    runs.push_back({anchors[b].order, static_cast<uint32_t>(b),
+                    static_cast<uint32_t>(e), numRC});
+  }
+  std::sort(runs.begin(), runs.end(), [](const Run& a, const Run& b) {
+    return a.firstOrder < b.firstOrder;
+  });
+
+  hits.reserve(hits.size() + runs.size());
+  for (auto& r : runs) {
+    hits.emplace_back();
+    HitT& hit = hits.back();
+    hit.targetID = anchors[r.begin].targetID;
+    hit.votes.reserve((r.end - r.begin) - r.numRC);
+    hit.rcVotes.reserve(r.numRC);
+    for (size_t i = r.begin; i < r.end; ++i) {
+      auto& a = anchors[i];
+      if (a.isRC) {
+        hit.addFragMatchRC(a.tpos, a.readPos, a.len, a.readLen);
+      } else {
+        hit.addFragMatch(a.tpos, a.readPos, a.len);
+      }
+    }
+  }
+}
+
+/**
+ * Cluster votes (sorted by votePos, then readPos) in one pass: a cluster
+ * starts at the first vote more than clusterWidth bases to the right of
+ * the current cluster's start, so only the current cluster is ever live.
+ * A cluster's coverage is the read bases its votes cover, counted left to
+ * right.  If a cluster's coverage exceeds maxClusterCount, that cluster
+ * becomes the best one: maxClusterPos is its start, maxClusterCount its
+ * coverage and maxClusterScore its coverage over readLen.  Returns whether
+ * it did.
+ */
+template <typename VoteT>
+bool bestVoteCluster(const std::vector<VoteT>& sVotes, uint32_t readLen,
+                     int32_t& maxClusterPos, uint32_t& maxClusterCount,
+                     double& maxClusterScore, int32_t clusterWidth = 10) {
+  bool updatedMaxScore{false};
+  if (sVotes.empty()) {
+    return updatedMaxScore;
+  }
+
+  int32_t currClust = sVotes.front().votePos;
+  uint32_t coverage{0};
+  int32_t rightmostBase{0};
+  for (auto& v : sVotes) {
+    int32_t votePos = v.votePos;
+    uint32_t readPos = v.readPos;
+    uint32_t voteLen = v.voteLen;
+    if (votePos - currClust > clusterWidth) {
+      currClust = votePos;
+      coverage = 0;
+      rightmostBase = 0;
+    }
+    // (in unsigned arithmetic: a vote that ends before the cluster's
+    // rightmost base so far still adds its length)
+    coverage += std::min(voteLen, (votePos + readPos + voteLen) -
+                                      static_cast<uint32_t>(rightmostBase));
+    rightmostBase = static_cast<int32_t>(votePos + readPos + voteLen);
+
+    if (coverage > maxClusterCount) {
+      maxClusterCount = coverage;
+      maxClusterPos = currClust;
+      maxClusterScore = maxClusterCount / static_cast<double>(readLen);
+      updatedMaxScore = true;
+    }
+  }
+  return updatedMaxScore;
+}
+
+} // namespace smem
+} // namespace salmon
+
+#endif // SMEM_CHAINING_HPP
@@ -22,6 +22,8 @@ extern "C" {
 #include "FrugalBooMap.hpp"
 #include "IndexHeader.hpp"
 #include "KmerIntervalMap.hpp"
+#include "MemoryBudget.hpp"
+#include "MemoryPlacement.hpp"
 #include "RapMapSAIndex.hpp"
 #include "SalmonConfig.hpp"
 #include "SalmonIndexVersionInfo.hpp"
@@ -75,6 +77,16 @@ public:
       loadQuasiIndex_(indexDir);
     }
 
+    // The index is (about) as large in memory as on disk
+    uint64_t indexBytes{0};
+    for (bfs::recursive_directory_iterator it(indexDir), end; it != end;
+         ++it) {
+      if (bfs::is_regular_file(it->path())) {
+        indexBytes += bfs::file_size(it->path());
+      }
+    }
+    salmon::memory::budget().account("index").set(indexBytes);
+
     loaded_ = true;
   }
 
@@ -114,22 +126,32 @@ public:
           std::exit(1);
         }
         if (len < k) {
+          free(rseq);
           continue;
         }
-        for (uint32_t s = 0; s < len - k + 1; ++s) {
-          bwtintv_t resInterval;
-          KmerKey key(&(rseq[s]), k);
-          if (!auxIdx_.hasKmer(key)) {
+        // Reads match either strand, so add the k-mers of both
+        std::vector<uint8_t> rcSeq(len);
+        for (uint32_t j = 0; j < len; ++j) {
+          rcSeq[j] = 3 - rseq[len - 1 - j];
+        }
+        for (const uint8_t* seq : {rseq, rcSeq.data()}) {
+          uint64_t code{0};
+          uint64_t codeMask = (uint64_t(1) << (2 * k)) - 1;
+          for (uint32_t s = 0; s < len; ++s) {
+            code = ((code << 2) | seq[s]) & codeMask;
+            if (s + 1 < k or auxIdx_.hasKmer(code)) {
+              continue;
+            }
+            bwtintv_t resInterval;
             bool foundInterval = bwautils::getIntervalForKmer(
-                idx_->bwt, k, &(rseq[s]), resInterval);
-            // If we found the interval for this k-mer
+                idx_->bwt, k, &(seq[s + 1 - k]), resInterval);
+            // If we found the interval for this k-mer, put it in the map
             if (foundInterval) {
-              // If the interval for this k-mer isn't already in the hash
-              // then put it in the hash
-              auxIdx_[key] = resInterval;
+              auxIdx_.insert(code, resInterval.x);
             }
           }
         }
+        free(rseq);
       }
       // Since we have the de-coded reference sequences, we no longer need
       // the encoded sequences, so free them.
@@ -138,6 +160,7 @@ public:
       // ====== Done streaming through transcripts
     }
 
+    logger_->info("Auxiliary index contains {} {}-mers", auxIdx_.size(), k);
     bfs::path auxIndexFile = indexDir / "aux.idx";
     auxIdx_.save(auxIndexFile);
     return true;
@@ -180,6 +203,11 @@ public:
   bool hasAuxKmerIndex() { return versionInfo_.hasAuxKmerIndex(); }
   KmerIntervalMap& auxIndex() { return auxIdx_; }
 
+  // The intervals of all short strings, for the start of the SMEM searches
+  const bwautils::PrefixIntervalTable& prefixIntervals() const {
+    return prefixIntervals_;
+  }
+
   SalmonIndexType indexType() { return versionInfo_.indexType(); }
 
   const char* transcriptomeSeq() {
@@ -209,7 +237,43 @@ public:
   std::string seqHash() const { return seqHash_; }
   std::string nameHash() const { return nameHash_; }
 
+  /**
+   * Move the suffix array, the concatenated transcript sequence and the
+   * transcript offsets of a loaded quasi index into memory placed according
+   * to p (backed by huge pages and / or interleaved across NUMA nodes).  The
+   * k-mer hash is left where it is.
+   */
+  void placeQuasiIndex(const salmon::memory::Placement& p) {
+    if (!loaded_ or p.isDefault() or
+        indexType() != SalmonIndexType::QUASI) {
+      return;
+    }
+    size_t placed{0};
+    if (quasiIndex32_) {
+      placed = placeQuasiIndex_(quasiIndex32_.get(), p);
+    } else if (quasiIndex64_) {
+      placed = placeQuasiIndex_(quasiIndex64_.get(), p);
+    } else if (quasiIndexPerfectHash32_) {
+      placed = placeQuasiIndex_(quasiIndexPerfectHash32_.get(), p);
+    } else if (quasiIndexPerfectHash64_) {
+      placed = placeQuasiIndex_(quasiIndexPerfectHash64_.get(), p);
+    }
+    logger_->info("Placed {} MB of the quasi index{}{}", placed >> 20,
+                  p.hugePages ? " on huge pages" : "",
+                  p.interleave ? " interleaved across NUMA nodes" : "");
+  }
+
 private:
+  template <typename RapMapIndexT>
+  size_t placeQuasiIndex_(RapMapIndexT* idx,
+                          const salmon::memory::Placement& p) {
+    // One array at a time, so that at most one is held twice
+    size_t placed = salmon::memory::place(idx->SA, p);
+    placed += salmon::memory::place(idx->seq, p);
+    placed += salmon::memory::place(idx->txpOffsets, p);
+    return placed;
+  }
+
   bool buildFMDIndex_(boost::filesystem::path indexDir,
                       std::vector<std::string>& bwaArgVec, uint32_t k) {
     namespace bfs = boost::filesystem;
@@ -270,7 +334,6 @@ private:
       // Read the aux index
       logger_->info("Loading auxiliary index");
       bfs::path auxIdxFile = indexDir / "aux.idx";
-      auxIdx_.setK(versionInfo_.auxKmerLength());
       auxIdx_.load(auxIdxFile);
       logger_->info("Auxiliary index contained {} k-mers", auxIdx_.size());
       logger_->info("done");
@@ -290,6 +353,9 @@ private:
       }
     }
     logger_->info("done");
+    logger_->info("Computing the intervals of all {}-mers", prefixLength_);
+    prefixIntervals_.build(idx_->bwt, prefixLength_);
+    logger_->info("done");
     return true;
   }
 
@@ -399,6 +465,9 @@ private:
 
   bwaidx_t* idx_{nullptr};
   KmerIntervalMap auxIdx_;
+  // The longest strings whose intervals are tabulated (~33MB at 10)
+  uint32_t prefixLength_{10};
+  bwautils::PrefixIntervalTable prefixIntervals_;
   std::shared_ptr<spdlog::logger> logger_;
   std::string seqHash_;
   std::string nameHash_;
@@ -0,0 +1,103 @@
+#ifndef __SALMON_LOGGING_HPP__
+#define __SALMON_LOGGING_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include "spdlog/spdlog.h"
+
+namespace salmon {
+namespace logging {
+
+// How often the background thread of the asynchronous loggers flushes
+// their sinks
+constexpr std::chrono::milliseconds asyncFlushInterval{2000};
+
+/**
+ * Make every logger created from now on asynchronous: a message is put on
+ * a bounded queue (of queueSize messages) and written, by a background
+ * thread, to the logger's sinks, which that thread also flushes every
+ * asyncFlushInterval.  A slow file system (e.g. NFS) under the log file
+ * then holds up only the background thread, not the threads that log.  A
+ * full queue makes the thread logging wait rather than drop its message.
+ *
+ * The messages still queued when the program ends are written when the
+ * loggers are destroyed (by spdlog::drop_all(), or at exit).
+ */
+inline void setAsyncMode(size_t queueSize) {
+  spdlog::set_async_mode(queueSize, spdlog::async_overflow_policy::block_retry,
+                         nullptr, asyncFlushInterval);
+}
+
+/**
+ * Limits how often a warning that the worker threads may hit once per read
+ * (or alignment) is logged: the first `burst` occurrences are, and after
+ * that only the 2^k-th ones, each with the number of occurrences so far, so
+ * that a run with millions of them logs a few dozen lines rather than
+ * filling the logging queue (and the log).  One throttle is shared by all
+ * of the threads that can hit the warning; counting is a single atomic
+ * increment.
+ */
+class WarningThrottle {
+public:
+  explicit WarningThrottle(uint64_t burst = 10) : burst_(burst) {}
+
+  WarningThrottle(const WarningThrottle&) = delete;
+  WarningThrottle& operator=(const WarningThrottle&) = delete;
+
+  // Count an occurrence (the n-th, from 1); whether it should be logged
+  bool admit(uint64_t& n) {
+    n = count_.fetch_add(1, std::memory_order_relaxed) + 1;
+    return n <= burst_ or (n & (n - 1)) == 0;
+  }
+
+  // Count an occurrence of the warning msg, and log it if it's admitted
+  void warn(spdlog::logger* log, const std::string& msg) {
+    uint64_t n{0};
+    if (!admit(n)) {
+      return;
+    }
+    if (n <= burst_) {
+      log->warn(msg);
+    } else {
+      log->warn("{}\n(seen {} times so far; from now on, only every power "
+                "of two is logged)",
+                msg, n);
+    }
+  }
+
+  // Log how many occurrences of the warning (named what) weren't logged
+  void summarize(spdlog::logger* log, const std::string& what) const {
+    uint64_t s = suppressed();
+    if (s > 0) {
+      log->warn("{} of the {} {} weren't logged", s, count(), what);
+    }
+  }
+
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+
+  // The occurrences counted, but not logged
+  uint64_t suppressed() const {
+    uint64_t n = count();
+    if (n <= burst_) {
+      return 0;
+    }
+    uint64_t logged = burst_;
+    // (p becomes 0 once shifted past 2^63)
+    for (uint64_t p = 1; p != 0 and p <= n; p <<= 1) {
+      logged += (p > burst_) ? 1 : 0;
+    }
+    return n - logged;
+  }
+
+private:
+  uint64_t burst_;
+  std::atomic<uint64_t> count_{0};
+};
+
+} // namespace logging
+} // namespace salmon
+
+#endif // __SALMON_LOGGING_HPP__
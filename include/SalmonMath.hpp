@@ -31,6 +31,9 @@
 
 #include <cassert>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <utility>
 
 namespace salmon {
 
@@ -78,6 +81,54 @@ inline double logSub(double x, double y) {
   return diff;
 }
 
+/**
+ * Approximations of log, exp and logAdd, for the optional fast-math mode
+ * of the online phase (--fastMath).  These are the scalar fastlog and
+ * fastexp of Paul Mineiro's fastapprox (include/fastapprox.h, whose SSE
+ * half doesn't compile as C++11), evaluated in single precision.  Over the
+ * ranges that occur there, fastLog is within 1.1e-4 (absolute) of std::log,
+ * fastExp within 6.3e-5 (relative) of std::exp, and fastLogAdd within
+ * 1.2e-4 (absolute) of logAdd.
+ */
+inline double fastLog(double v) {
+  float x = static_cast<float>(v);
+  uint32_t bits;
+  std::memcpy(&bits, &x, sizeof(bits));
+  uint32_t mantissaBits = (bits & 0x007FFFFF) | 0x3f000000;
+  float m;
+  std::memcpy(&m, &mantissaBits, sizeof(m));
+  float y = static_cast<float>(bits) * 1.1920928955078125e-7f;
+  return 0.69314718f * (y - 124.22551499f - 1.498030302f * m -
+                        1.72587999f / (0.3520887068f + m));
+}
+
+inline double fastExp(double v) {
+  float p = 1.442695040f * static_cast<float>(v);
+  float offset = (p < 0) ? 1.0f : 0.0f;
+  float clipp = (p < -126) ? -126.0f : p;
+  int w = clipp;
+  float z = clipp - w + offset;
+  uint32_t bits = static_cast<uint32_t>(
+      (1 << 23) * (clipp + 121.2740575f + 27.7280233f / (4.84252568f - z) -
+                   1.49012907f * z));
+  float r;
+  std::memcpy(&r, &bits, sizeof(r));
+  return r;
+}
+
+inline double fastLogAdd(double x, double y) {
+  if (std::abs(x) == LOG_0) {
+    return y;
+  }
+  if (std::abs(y) == LOG_0) {
+    return x;
+  }
+  if (y > x) {
+    std::swap(x, y);
+  }
+  return x + fastLog(1 + fastExp(y - x));
+}
+
 } // namespace math
 
 } // namespace salmon
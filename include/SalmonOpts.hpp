@@ -9,6 +9,26 @@
 #include <fstream>
 #include <memory> // for shared_ptr
 #include <ostream>
+#include <string>
+#include <vector>
+
+#include "MemoryPlacement.hpp"
+#include "PerformanceStats.hpp"
+#include "PoissonBootstrap.hpp"
+#include "RunStatus.hpp"
+
+class AuxRecordWriter;
+namespace salmon {
+namespace checkpoint {
+class Checkpointer;
+}
+namespace interim {
+class Snapshotter;
+}
+namespace mapcache {
+class Writer;
+}
+} // namespace salmon
 
 enum class SalmonQuantMode { MAP = 1, ALIGN = 2 };
 
@@ -52,6 +72,22 @@ struct SalmonOpts {
   std::string runStopTime; // String representation of the date / time at which
                            // the run ended.
 
+  // The timings of the phases of the run (for meta_info.json)
+  std::shared_ptr<PerformanceStats> perfStats{
+      std::make_shared<PerformanceStats>()};
+
+  // Where to write the Chrome trace of the run (if anywhere)
+  std::string traceFile;
+
+  // Count the hardware events of each phase (see PerformanceStats)
+  bool hwCounters{false};
+
+  // The live status of the run, rewritten to statusFile (if given) every
+  // statusInterval seconds
+  std::shared_ptr<RunStatus> runStatus{std::make_shared<RunStatus>()};
+  std::string statusFile;
+  double statusInterval{10.0};
+
   bool consistentHits; // Enforce consistency of hits gathered during
                        // quasi-mapping.
 
@@ -59,6 +95,9 @@ struct SalmonOpts {
 
   bool dumpEqWeights; // Dump the equivalence classes rich weights
 
+  std::string eqClassFormat{"text"}; // how the equivalence classes are
+                                     // dumped: "text" or "binary"
+
   bool fasterMapping; // [Developer]: Disables some extra checks during
                       // quasi-mapping. This may make mapping a little bit
                       // faster at the potential cost of returning too many
@@ -71,6 +110,42 @@ struct SalmonOpts {
   double quasiCoverage; // [Experimental]: Default of 0.  The coverage by MMPs
                         // required for a read to be considered mapped.
 
+  double maxEditFraction{0.0}; // [Experimental]: Discard quasi-mappings whose
+                               // edit distance to the transcript exceeds this
+                               // fraction of the read length (0 = don't).
+
+  uint32_t readCacheSize{0}; // The number of recently mapped reads (per
+                             // thread) whose hits are kept, so that exact
+                             // duplicates needn't be mapped (0 = none).
+
+  uint64_t maxKmerOcc{0}; // [Experimental]: Discard reads all of whose
+                          // indexed k-mers occur more than this many times,
+                          // without mapping them (0 = don't).
+
+  double maxDust{0.0}; // [Experimental]: Discard reads whose DUST score is
+                       // above this, without mapping them (0 = don't).
+  std::vector<std::string> adapters; // Clip these off the reads
+  uint32_t minAdapterOverlap{8}; // the shortest partial adapter clipped off
+                                 // the 3' end of a read
+
+  double subsampleFraction{1.0}; // quantify only this fraction of the reads
+                                 // (chosen by a hash of their names)
+  double numReadsScale{1.0}; // the NumReads in quant.sf are scaled by this
+                             // (up from the subsample to all of the reads)
+
+  double onlineStopTolerance{0.0}; // [Experimental]: Stop updating the online
+                                   // estimates once they change by less than
+                                   // this between checks (0 = never).
+
+  bool fastMath{false}; // [Experimental]: Use approximate log / exp for the
+                        // per-alignment probabilities of the online phase.
+
+  uint32_t cellBarcodeLength{0}; // [Experimental]: Droplet single-cell mode
+                                 // (if > 0); the length of the cell barcode
+                                 // at the start of the first mate.
+  uint32_t umiLength{0}; // The length of the UMI that follows the barcode.
+  uint64_t minCellUMIs{10}; // The cells with fewer UMIs aren't quantified.
+
   bool splitSpanningSeeds; // Attempt to split seeds that span multiple
                            // transcripts.
 
@@ -127,6 +202,10 @@ struct SalmonOpts {
   double
       forgettingFactor; // The forgetting factor used to determine the
                         // learning schedule in the online inference algorithm.
+  uint32_t miniBatchSize{5000}; // fragments per online mini-batch (0 : tuned
+                                // at run time; see MiniBatchSizer)
+  uint32_t parserChunkSize{0};  // reads per chunk handed to a mapping thread
+  uint32_t timestepFragments{5000}; // fragments per forgetting-mass timestep
 
   uint32_t numBurninFrags; // Number of mapped fragments required for burn-in
 
@@ -140,8 +219,8 @@ struct SalmonOpts {
 
   uint64_t numRequiredFragments; //
   uint64_t minRequiredFrags;
-  bool reduceGCMemory; // Use a memory-efficient (rank-based) data structure for
-                       // computing fragment GC content
+  bool reduceGCMemory; // Retained for compatibility; fragment GC content
+                       // always uses the compact GCPrefixCounts now
   // uint32_t gcSampFactor; // The factor by which to down-sample the GC
   // distribution of transcripts
   uint32_t pdfSampFactor; // The factor by which to down-sample the fragment
@@ -170,11 +249,18 @@ struct SalmonOpts {
 
   boost::filesystem::path geneMapPath; // Gene map path
 
+  boost::filesystem::path geneMapCacheDirectory; // Where a gene map that is
+                                                 // parsed from a GTF file is
+                                                 // cached
+
   bool quiet; // Be quiet during quantification.
 
   bool useVBOpt; // Use Variational Bayesian EM instead of "regular" EM in the
                  // batch passes
 
+  bool useSQUAREM{false}; // Accelerate the (VB)EM (and bootstrap EM) with
+                          // SQUAREM extrapolation
+
   bool useRangeFactorization{false}; // enable range factorization
   uint32_t rangeFactorizationBins{
       0}; // Cluster reads in each Eq Class based on the
@@ -182,20 +268,50 @@ struct SalmonOpts {
 
   bool useQuasi; // Are we using the quasi-mapping based index or not.
 
+  // Use the effective lengths observed for the transcripts with more than
+  // eelCountCutoff paired-end fragments, rather than the bias-corrected ones
+  bool useObservedEffLengths{false};
   uint32_t eelCountCutoff{50};
   // For writing quasi-mappings
   std::string qmFileName;
   std::ofstream qmFile;
   std::unique_ptr<std::ostream> qmStream{nullptr};
   std::shared_ptr<spdlog::logger> qmLog{nullptr};
+  bool binaryMappings{false}; // write the quasi-mappings in binary
+  std::shared_ptr<AuxRecordWriter> qmWriter{nullptr};
 
-  std::unique_ptr<std::ofstream> unmappedFile{nullptr};
   bool writeUnmappedNames; // write the names of unmapped reads
-  std::shared_ptr<spdlog::logger> unmappedLog{nullptr};
 
-  std::unique_ptr<std::ofstream> orphanLinkFile{nullptr};
+  bool writeQuantBin{false}; // also write the abundances to quant.bin
+  bool sparseQuant{false}; // leave the transcripts without reads out of
+                           // quant.sf
+  bool writePartial{false}; // stop before the offline phase, writing the
+                            // state it needs to <output>/partial, to be
+                            // merged with salmon merge-partials
+
+  uint64_t checkpointInterval{0}; // checkpoint the online phase every this
+                                  // many fragments (0 : never)
+  bool resume{false}; // go on from the checkpoint of a previous run
+  std::shared_ptr<salmon::checkpoint::Checkpointer> checkpointer{nullptr};
+  uint64_t snapshotInterval{0}; // write the online estimates to
+                                // quant.partial.sf every this many
+                                // fragments (0 : never)
+  std::shared_ptr<salmon::interim::Snapshotter> snapshotter{nullptr};
+  std::shared_ptr<AuxRecordWriter> unmappedWriter{nullptr};
+
   bool writeOrphanLinks; // write the names of unmapped reads
-  std::shared_ptr<spdlog::logger> orphanLinkLog{nullptr};
+  std::shared_ptr<AuxRecordWriter> orphanLinkWriter{nullptr};
+  bool writeUnmappedReads{false}; // write the unmapped reads themselves
+  bool writeOrphanedReads{false}; // ... and the pairs with one mate mapped
+  std::shared_ptr<AuxRecordWriter> unmappedReadWriter{nullptr}; // single
+  std::shared_ptr<AuxRecordWriter> unmappedPairWriter{nullptr}; // paired
+  bool compressAuxRecords{false}; // gzip the unmapped names / reads &
+                                  // orphan links
+
+  std::string mappingCacheDir; // keep (and replay) the mappings of each
+                               // read library here
+  // the cache file of the library being mapped (if it isn't replayed)
+  std::shared_ptr<salmon::mapcache::Writer> mappingCacheWriter{nullptr};
 
   bool sampleOutput;    // Sample alignments according to posterior estimates of
                         // transcript abundance.
@@ -203,12 +319,83 @@ struct SalmonOpts {
 
   uint32_t numGibbsSamples; // Number of rounds of Gibbs sampling to perform
   uint32_t numBootstraps;   // Number of bootstrap samples to draw
+  double bootstrapRelDiffTolerance{0.01}; // EM convergence tolerance used
+                                          // for each bootstrap sample
+  bool bootstrapWarmStart{false}; // start each bootstrap EM from the point
+                                  // estimate rather than a uniform
+  uint32_t bootstrapBatchSize{0}; // number of bootstrap samples each worker
+                                  // solves together (interleaved); 0 picks
+                                  // one from the numbers of samples and
+                                  // threads
+  bool approxVariance{false}; // write quant_var.sf, the delta-method
+                              // variances of the counts
+  bool onlineBootstraps{false}; // draw the bootstrap replicate counts while
+                                // mapping (Poisson weights per fragment)
+  PoissonBootstrap onlineBootstrap; // the weights of the online bootstraps
+  uint64_t samplerSeed{0}; // seed for the bootstrap and Gibbs generators;
+                           // 0 means draw one at random
   uint32_t thinningFactor;  // Gibbs chain thinning factor
+  uint32_t numGibbsChains{0}; // number of Gibbs chains to run in parallel;
+                              // 0 means run them one after another
+  std::string sampleFormat{"gzip"}; // how the bootstrap / Gibbs samples are
+                                    // written: "gzip" or "columnar"
+  std::string samplePrecision{"double"}; // how sample values are stored:
+                                         // "double", "float" or "fixed"
+  uint32_t sampleFixedScale{100}; // counts are stored as round(count * this)
+                                  // with the "fixed" precision
+  bool denseSamples{false}; // don't write the reduced-precision gzip samples
+                            // sparsely
+  bool gibbsActiveSet{false}; // between Gibbs samples, resample only the
+                              // transcripts with non-zero counts
   bool dontExtrapolateCounts{false}; // In gibbs sampling, use direct counts
                                      // from re-allocation in eq classes, don't
                                      // extrapolate from txp-fraction
   bool initUniform{false}; // initialize offline optimization parameters
                            // uniformly, rather than with online estimates.
+  std::string initFrom; // an abundance profile (quant.sf or quantmerge
+                        // table) to initialize the offline optimization from
+  std::vector<double> initProfile; // its counts, by transcript id
+  std::string targetsFile; // the transcripts to quantify (the offline phase
+                           // is restricted to their components)
+  std::vector<uint32_t> targets; // their ids
+  std::string sweepFile; // the inference configurations (see
+                         // InferenceSweep.hpp) also quantified, after the
+                         // run's own, from the same equivalence classes
+  std::string importModels; // an earlier quant output directory whose
+                            // fragment length and bias models are used
+  uint32_t eqClassFlushInterval{25000}; // flush thread-local eq. classes
+                                        // after this many fragments
+  bool threadLocalMass{false}; // accumulate online transcript mass per-thread
+                               // and apply it once per mini-batch
+  bool atomicEMUpdates{false}; // accumulate the parallel EM updates with
+                               // atomic CAS rather than partitioning the
+                               // equivalence classes
+  bool componentConvergence{false}; // stop updating each component of the
+                                    // offline EM once it has converged
+  bool emSinglePrecision{false}; // keep the combined weights the offline EM
+                                 // sweeps over in single precision
+  uint32_t emObjectiveInterval{0}; // compute the log-likelihood every this
+                                   // many offline EM iterations (0 : never)
+  double emObjectiveTolerance{1e-8}; // stop the offline EM once the
+                                     // log-likelihood changes by less than
+                                     // this (relative) between computations
+  bool geneLevelEM{false}; // resolve the genes (of --geneMap) on the
+                           // gene-level equivalence classes first
+  bool refineTranscripts{false}; // with --geneLevelEM, go on to resolve the
+                                 // transcripts from the gene-level estimates
+  std::vector<uint32_t> transcriptGenes; // with --geneLevelEM, the gene of
+                                         // each transcript id
+  salmon::memory::Placement indexPlacement; // back the quasi index with huge
+                                            // pages / interleave it across
+                                            // NUMA nodes
+  bool pinThreads{false}; // pin the mapping threads, and the TBB workers of
+                          // the offline phases, to CPUs
+  double memoryBudget{0.0}; // the memory (in GB) that the structures of the
+                            // run should fit in; 0 : no limit (see
+                            // salmon::memory::Budget)
+  size_t maxInMemoryEqClasses{0}; // spill the equivalence classes beyond
+                                  // this many to disk while mapping; 0 :
+                                  // never (unless there's a memory budget)
   bool alnMode{false}; // true if we're in alignment based mode, false otherwise
   bool biasCorrect{false};    // Perform sequence-specific bias correction
   bool gcBiasCorrect{false};  // Perform gc-fragment bias correction
@@ -236,6 +423,13 @@ struct SalmonOpts {
   uint32_t numThreads;
   uint32_t numQuantThreads;
   uint32_t numParseThreads;
+  uint32_t numInferenceThreads{0}; // the threads that run processMiniBatch on
+                                   // the mapping threads' mini-batches (0 :
+                                   // the mapping threads do)
+
+  // The FASTA file of the reference that CRAM input was compressed against
+  // (by default, the targets); see salmon::utils::setCRAMReference()
+  std::string cramReference;
 };
 
 #endif // SALMON_OPTS_HPP
@@ -2,21 +2,150 @@
 #define __SALMON_SPIN_LOCK_HPP__
 
 #include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace salmon {
+namespace locks {
 
 /**
- * since std::mutex is *VERY SLOW* on OSX, we use
- * this there instead.
- * Taken from
- * (http://stackoverflow.com/questions/22899053/why-is-stdmutex-so-slow-on-osx)
+ * How often a (named) lock was taken, and how often, and for how long, the
+ * threads taking it had to wait; all the locks of the same name share their
+ * counters.
  */
-class spin_lock {
-  std::atomic<bool> _lock;
+struct LockCounters {
+  explicit LockCounters(const std::string& n) : name(n) {}
+  std::string name;
+  std::atomic<uint64_t> acquisitions{0};
+  // the acquisitions that found the lock held
+  std::atomic<uint64_t> contended{0};
+  // the contended acquisitions that had to sleep (rather than just spin)
+  std::atomic<uint64_t> parked{0};
+  std::atomic<uint64_t> waitNs{0};
+};
 
+// A snapshot of the counters of a lock
+struct LockSummary {
+  std::string name;
+  uint64_t acquisitions{0};
+  uint64_t contended{0};
+  uint64_t parked{0};
+  double waitSec{0.0};
+};
+
+inline std::mutex& registryMutex_() {
+  static std::mutex m;
+  return m;
+}
+
+// never shrinks, so the counters outlive the locks that use them
+inline std::deque<LockCounters>& registry_() {
+  static std::deque<LockCounters> r;
+  return r;
+}
+
+// The counters of the locks named name (created on first use)
+inline LockCounters* counters(const std::string& name) {
+  std::lock_guard<std::mutex> lock(registryMutex_());
+  auto& r = registry_();
+  for (auto& c : r) {
+    if (c.name == name) {
+      return &c;
+    }
+  }
+  r.emplace_back(name);
+  return &r.back();
+}
+
+// The counters of every named lock that has been taken
+inline std::vector<LockSummary> summaries() {
+  std::lock_guard<std::mutex> lock(registryMutex_());
+  std::vector<LockSummary> s;
+  for (auto& c : registry_()) {
+    if (c.acquisitions == 0) {
+      continue;
+    }
+    LockSummary l;
+    l.name = c.name;
+    l.acquisitions = c.acquisitions;
+    l.contended = c.contended;
+    l.parked = c.parked;
+    l.waitSec = c.waitNs * 1e-9;
+    s.push_back(l);
+  }
+  return s;
+}
+
+} // namespace locks
+} // namespace salmon
+
+/**
+ * A lock for short critical sections, since std::mutex is *VERY SLOW* on
+ * OSX (see
+ * http://stackoverflow.com/questions/22899053/why-is-stdmutex-so-slow-on-osx)
+ * and a pure spin lock burns a core for as long as the lock is held.
+ *
+ * A thread that finds the lock held first spins, with exponentially more
+ * pause instructions between attempts, then parks: on Linux, it sleeps on a
+ * futex until the holder releases the lock (and only then does the release
+ * need a system call); elsewhere, it sleeps briefly between attempts.  The
+ * state is that of Drepper's "Futexes are tricky" mutex: 0 is unlocked, 1
+ * locked, 2 locked with (possibly) parked waiters.
+ *
+ * A lock constructed with a name counts its acquisitions and waits (see
+ * salmon::locks::LockCounters), which are written to meta_info.json with the
+ * performance statistics; an unnamed one counts nothing.
+ */
+class spin_lock {
 public:
   spin_lock(const spin_lock&) = delete;
   spin_lock& operator=(const spin_lock&) = delete;
 
-  spin_lock() : _lock(false) {}
+  spin_lock() = default;
+  explicit spin_lock(const std::string& name)
+      : counters_(salmon::locks::counters(name)) {}
+
+  void lock() {
+    uint32_t s{0};
+    if (!state_.compare_exchange_strong(s, 1, std::memory_order_acquire,
+                                        std::memory_order_relaxed)) {
+      lockSlow_();
+    }
+    if (counters_) {
+      counters_->acquisitions.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  bool try_lock() {
+    uint32_t s{0};
+    bool locked = state_.compare_exchange_strong(
+        s, 1, std::memory_order_acquire, std::memory_order_relaxed);
+    if (locked and counters_) {
+      counters_->acquisitions.fetch_add(1, std::memory_order_relaxed);
+    }
+    return locked;
+  }
+
+  void unlock() {
+    if (state_.exchange(0, std::memory_order_release) == 2) {
+      wake_();
+    }
+  }
 
   class scoped_lock {
     spin_lock& _lock;
@@ -25,14 +154,86 @@ public:
     scoped_lock(const scoped_lock&) = delete;
     scoped_lock& operator=(const scoped_lock&) = delete;
 
-    scoped_lock(spin_lock& lock) : _lock(lock) {
-      bool expect = false;
-      while (!_lock._lock.compare_exchange_weak(expect, true)) {
-        expect = false;
+    scoped_lock(spin_lock& lock) : _lock(lock) { _lock.lock(); }
+    ~scoped_lock() { _lock.unlock(); }
+  };
+
+private:
+  // the most pause instructions between two attempts of the spinning phase
+  static constexpr uint32_t maxPauses = 256;
+
+  static inline void pause_() {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#else
+    std::this_thread::yield();
+#endif
+  }
+
+  void lockSlow_() {
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point start;
+    if (counters_) {
+      start = Clock::now();
+    }
+    bool parked{false};
+    bool locked{false};
+    for (uint32_t n = 1; n <= maxPauses and !locked; n <<= 1) {
+      for (uint32_t i = 0; i < n; ++i) {
+        pause_();
       }
+      uint32_t s = state_.load(std::memory_order_relaxed);
+      locked = (s == 0) and
+               state_.compare_exchange_weak(s, 1, std::memory_order_acquire,
+                                            std::memory_order_relaxed);
     }
-    ~scoped_lock() { _lock._lock = false; }
-  };
+    if (!locked) {
+      // Mark the lock as wanted, so the holder wakes us on release; the lock
+      // is then left in state 2 even if no one else waits, which just costs
+      // its next release a needless wake.
+      while (state_.exchange(2, std::memory_order_acquire) != 0) {
+        parked = true;
+        wait_();
+      }
+    }
+    if (counters_) {
+      counters_->contended.fetch_add(1, std::memory_order_relaxed);
+      if (parked) {
+        counters_->parked.fetch_add(1, std::memory_order_relaxed);
+      }
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    Clock::now() - start)
+                    .count();
+      counters_->waitNs.fetch_add(static_cast<uint64_t>(ns),
+                                  std::memory_order_relaxed);
+    }
+  }
+
+  // Sleep while the lock is in state 2
+  void wait_() {
+#if defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&state_),
+            FUTEX_WAIT_PRIVATE, 2, nullptr, nullptr, 0);
+#else
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+#endif
+  }
+
+  // Wake one parked waiter
+  void wake_() {
+#if defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&state_),
+            FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#endif
+  }
+
+  static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+                "the futex word must be a plain 32-bit integer");
+
+  std::atomic<uint32_t> state_{0};
+  salmon::locks::LockCounters* counters_{nullptr};
 };
 
 #endif // __SALMON_SPIN_LOCK_HPP__
@@ -130,6 +130,21 @@ constexpr uint8_t charToSamEncode[] = {
 
 uint8_t* encodeSequenceInSAM(const char* src, size_t len);
 
+/**
+ * Encode the len bases of src in codes, using the 2-bit codes of jellyfish
+ * (A = 0, C = 1, G = 2, T = 3, in either case); any other character
+ * (e.g. N) is encoded as -1.  This is vectorized (SSE2 / NEON) where
+ * available.
+ */
+void encodeTwoBit(const char* src, size_t len, int8_t* codes);
+
+/**
+ * Given the codes of a sequence (as from encodeTwoBit), write those of its
+ * reverse complement to rcCodes (-1 stays -1).
+ */
+void reverseComplementTwoBit(const int8_t* codes, size_t len,
+                             int8_t* rcCodes);
+
 /**
    Incomplete: currently only rev for 'ATCG'
  */
@@ -36,6 +36,7 @@ extern "C" {
 class ReadExperiment;
 class LibraryFormat;
 class FragmentLengthDistribution;
+class Transcript;
 
 namespace salmon {
 namespace utils {
@@ -93,7 +94,24 @@ extractReadLibraries(boost::program_options::parsed_options& orderedOptions);
 
 LibraryFormat parseLibraryFormatString(std::string& fmt);
 
-bool peekBAMIsPaired(const boost::filesystem::path& fname);
+/**
+ * The scram read mode of an alignment file, from its extension: "rb" for
+ * BAM, "rc" for CRAM and "r" (SAM) otherwise.
+ */
+std::string alignmentReadMode(const boost::filesystem::path& fname);
+
+/**
+ * Decode the (CRAM) file fp against the sequences of the FASTA file
+ * reference (which must have, or be able to have, a .fai index), rather than
+ * those found through the header (the REF_PATH / REF_CACHE of io_lib, or a
+ * download); the sequences are read from the (memory mapped) file as they
+ * are needed, so that the page cache holds a single copy of them however
+ * many processes decode against it.  Does nothing if reference is empty.
+ */
+void setCRAMReference(scram_fd* fp, const std::string& reference);
+
+bool peekBAMIsPaired(const boost::filesystem::path& fname,
+                     const std::string& cramReference = "");
 
 size_t numberOfReadsInFastaFile(const std::string& fname);
 
@@ -109,6 +127,18 @@ transcriptToGeneMapFromFeatures(std::vector<GenomicFeature<T>>& feats);
 TranscriptGeneMap transcriptGeneMapFromGTF(const std::string& fname,
                                            std::string key = "gene_id");
 
+/**
+ * As transcriptGeneMapFromGTF, but the map is cached (serialized) in
+ * cacheDir, in a file named for the checksum of the GTF file and the key,
+ * and read from there by later calls rather than re-parsing the GTF.  If
+ * cacheDir is empty, or the cache can't be read or written, this is just
+ * transcriptGeneMapFromGTF.
+ */
+TranscriptGeneMap
+cachedTranscriptGeneMapFromGTF(const std::string& fname,
+                               const boost::filesystem::path& cacheDir,
+                               std::string key = "gene_id");
+
 TranscriptGeneMap readTranscriptToGeneMap(std::ifstream& ifile);
 
 TranscriptGeneMap
@@ -169,6 +199,38 @@ inline void incLoop(tbb::atomic<double>& val, double inc) {
 
 std::string getCurrentTimeAsString();
 
+/**
+ * The seed for a random number generator of the online phase (one is
+ * created by each mapping thread).  If a seed was given (--seed), the i-th
+ * generator created is seeded with a value derived from it and i, so that
+ * a run with a single mapping thread is reproducible; otherwise, a random
+ * seed is drawn.
+ */
+uint64_t onlinePhaseSeed(const SalmonOpts& sopt);
+
+/**
+ * Read an abundance profile to start the offline (VB)EM from (--initFrom):
+ * either a quant.sf (its NumReads column), or a table of salmon quantmerge
+ * (a Name column followed by one column per sample; the samples are
+ * averaged, and NA values skipped).  profile[i] is the profile's count of
+ * the transcript with id i (of names), and 0 for the transcripts it doesn't
+ * list.  Returns false (having said why) if the file can't be read, or names
+ * none of the transcripts.
+ */
+bool readAbundanceProfile(const std::string& fname,
+                          const TranscriptNames& names,
+                          std::vector<double>& profile, spdlog::logger* log);
+
+/**
+ * Read the transcripts of targeted quantification (--targets): one name per
+ * line (the first field; blank lines and lines starting with '#' are
+ * skipped).  targets holds their ids, without repeats.  Returns false
+ * (having said why) if the file can't be read, or names none of the
+ * transcripts.
+ */
+bool readTargetList(const std::string& fname, const TranscriptNames& names,
+                    std::vector<uint32_t>& targets, spdlog::logger* log);
+
 bool validateOptionsAlignment_(SalmonOpts& sopt);
 bool validateOptionsMapping_(SalmonOpts& sopt);
 
@@ -203,8 +265,40 @@ void aggregateEstimatesToGeneLevel(TranscriptGeneMap& tgm,
 
 // NOTE: Throws an invalid_argument exception of the quant or
 // quant_bias_corrected files do not exist!
-void generateGeneLevelEstimates(boost::filesystem::path& geneMapPath,
-                                boost::filesystem::path& estDir);
+void generateGeneLevelEstimates(
+    boost::filesystem::path& geneMapPath, boost::filesystem::path& estDir,
+    const boost::filesystem::path& geneMapCacheDir = boost::filesystem::path());
+
+/**
+ * Write estDir/quant.genes.sf from the transcript abundances of experiment,
+ * as they were just written to quant.sf by GZipWriter::writeAbundances
+ * (which sets the transcripts' projectedCounts), rather than by re-reading
+ * quant.sf.
+ */
+template <typename ExpT>
+void generateGeneLevelEstimates(
+    boost::filesystem::path& geneMapPath, boost::filesystem::path& estDir,
+    ExpT& experiment,
+    const boost::filesystem::path& geneMapCacheDir = boost::filesystem::path());
+
+/**
+ * The gene of each transcript (by id), as an index into geneNames, which is
+ * filled with the genes that have a transcript, in the order of their first
+ * transcript.  A transcript that isn't in the map is its own gene.
+ */
+std::vector<uint32_t>
+transcriptGeneIDs(TranscriptGeneMap& tranGeneMap,
+                  const std::vector<Transcript>& transcripts,
+                  std::vector<std::string>& geneNames);
+
+/**
+ * As above, for the map read from geneMapPath (a GTF / GFF file, or a
+ * two-column transcript-to-gene table), without the names.
+ */
+std::vector<uint32_t> transcriptGeneIDs(
+    boost::filesystem::path& geneMapPath,
+    const std::vector<Transcript>& transcripts,
+    const boost::filesystem::path& geneMapCacheDir = boost::filesystem::path());
 
 enum class OrphanStatus : uint8_t {
   LeftOrphan = 0,
@@ -214,6 +308,12 @@ enum class OrphanStatus : uint8_t {
 
 bool headersAreConsistent(SAM_hdr* h1, SAM_hdr* h2);
 
+/**
+ * Whether the header declares the alignments sorted by coordinate (an @HD
+ * line with SO:coordinate), rather than grouped by read name.
+ */
+bool isCoordinateSorted(SAM_hdr* header);
+
 bool headersAreConsistent(std::vector<SAM_hdr*>&& headers);
 
 inline void reverseComplement(const char* s, int32_t l, std::string& o) {
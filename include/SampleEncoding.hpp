@@ -0,0 +1,269 @@
+#ifndef SAMPLE_ENCODING_HPP
+#define SAMPLE_ENCODING_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "ByteBuffers.hpp"
+
+/**
+ * How the values of the bootstrap / Gibbs samples are stored on disk.
+ *
+ *   FLOAT64 : 8-byte IEEE doubles (the original format)
+ *   FLOAT32 : 4-byte IEEE floats
+ *   FIXED   : the counts multiplied by an integer scale and rounded to the
+ *             nearest integer, stored as LEB128 varints (so that small counts
+ *             take a single byte while large counts can't overflow)
+ *
+ * The numeric values are also the value type codes of the columnar format.
+ */
+enum class SamplePrecision : uint32_t { FLOAT64 = 0, FLOAT32 = 1, FIXED = 2 };
+
+namespace salmon {
+namespace samples {
+
+inline bool parsePrecision(const std::string& s, SamplePrecision& p) {
+  if (s == "double") {
+    p = SamplePrecision::FLOAT64;
+  } else if (s == "float") {
+    p = SamplePrecision::FLOAT32;
+  } else if (s == "fixed") {
+    p = SamplePrecision::FIXED;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+inline void putVarint(std::vector<char>& buf, uint64_t v) {
+  while (v >= 0x80) {
+    buf.push_back(static_cast<char>((v & 0x7f) | 0x80));
+    v >>= 7;
+  }
+  buf.push_back(static_cast<char>(v));
+}
+
+inline uint64_t toFixed(double v, uint32_t scale) {
+  return (v > 0.0) ? static_cast<uint64_t>(std::llround(v * scale)) : 0;
+}
+
+/**
+ * Append the n values in vals to buf, with the given precision.
+ */
+inline void appendValues(std::vector<char>& buf, const double* vals, size_t n,
+                         SamplePrecision p, uint32_t scale) {
+  switch (p) {
+  case SamplePrecision::FLOAT64: {
+    size_t start = buf.size();
+    buf.resize(start + n * sizeof(double));
+    std::memcpy(buf.data() + start, vals, n * sizeof(double));
+  } break;
+  case SamplePrecision::FLOAT32: {
+    size_t start = buf.size();
+    buf.resize(start + n * sizeof(float));
+    for (size_t i = 0; i < n; ++i) {
+      float f = static_cast<float>(vals[i]);
+      std::memcpy(buf.data() + start + i * sizeof(float), &f, sizeof(float));
+    }
+  } break;
+  case SamplePrecision::FIXED:
+    for (size_t i = 0; i < n; ++i) {
+      putVarint(buf, toFixed(vals[i], scale));
+    }
+    break;
+  }
+}
+
+/**
+ * Encode a single sample (with a value for every transcript) as one record
+ * of the sample stream.  A dense record is just the values; a sparse record
+ * is the number of non-zero values (uint32), the gap before each non-zero
+ * value's index (as varints, the first relative to -1), and then the
+ * non-zero values themselves.
+ */
+inline void encodeSample(const std::vector<double>& sample, SamplePrecision p,
+                         uint32_t scale, bool sparse, std::vector<char>& buf) {
+  buf.clear();
+  if (!sparse) {
+    appendValues(buf, sample.data(), sample.size(), p, scale);
+    return;
+  }
+  std::vector<double> nonZero;
+  std::vector<char> gaps;
+  int64_t prev{-1};
+  for (size_t i = 0; i < sample.size(); ++i) {
+    if (sample[i] != 0.0) {
+      putVarint(gaps, static_cast<uint64_t>(static_cast<int64_t>(i) - prev - 1));
+      prev = static_cast<int64_t>(i);
+      nonZero.push_back(sample[i]);
+    }
+  }
+  bytes::putU32(buf, static_cast<uint32_t>(nonZero.size()));
+  buf.insert(buf.end(), gaps.begin(), gaps.end());
+  appendValues(buf, nonZero.data(), nonZero.size(), p, scale);
+}
+
+/**
+ * The sources of encoded bytes for the decoders below: a buffer in memory,
+ * and a (buffered) stream, e.g. the decompressed bootstraps.gz.
+ */
+class BufferByteSource {
+public:
+  BufferByteSource(const char* data, size_t size)
+      : p_(data), end_(data + size) {}
+  bool getByte(unsigned char& b) {
+    if (p_ == end_) {
+      return false;
+    }
+    b = static_cast<unsigned char>(*p_++);
+    return true;
+  }
+  bool read(char* dest, size_t n) {
+    if (static_cast<size_t>(end_ - p_) < n) {
+      return false;
+    }
+    std::memcpy(dest, p_, n);
+    p_ += n;
+    return true;
+  }
+
+private:
+  const char* p_;
+  const char* end_;
+};
+
+class StreamByteSource {
+public:
+  explicit StreamByteSource(std::istream& in) : in_(in), buf_(1 << 16) {}
+  bool getByte(unsigned char& b) {
+    if (pos_ == len_ and !refill_()) {
+      return false;
+    }
+    b = static_cast<unsigned char>(buf_[pos_++]);
+    return true;
+  }
+  bool read(char* dest, size_t n) {
+    while (n > 0) {
+      if (pos_ == len_ and !refill_()) {
+        return false;
+      }
+      size_t k = std::min(n, len_ - pos_);
+      std::memcpy(dest, buf_.data() + pos_, k);
+      pos_ += k;
+      dest += k;
+      n -= k;
+    }
+    return true;
+  }
+
+private:
+  bool refill_() {
+    in_.read(buf_.data(), buf_.size());
+    len_ = static_cast<size_t>(in_.gcount());
+    pos_ = 0;
+    return len_ > 0;
+  }
+
+  std::istream& in_;
+  std::vector<char> buf_;
+  size_t pos_{0};
+  size_t len_{0};
+};
+
+template <typename ByteSource>
+inline bool getVarint(ByteSource& src, uint64_t& v) {
+  v = 0;
+  unsigned char b;
+  for (uint32_t shift = 0; shift < 64; shift += 7) {
+    if (!src.getByte(b)) {
+      return false;
+    }
+    v |= static_cast<uint64_t>(b & 0x7f) << shift;
+    if (b < 0x80) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Decode n values, as written by appendValues, into vals.
+ */
+template <typename ByteSource>
+inline bool decodeValues(ByteSource& src, double* vals, size_t n,
+                         SamplePrecision p, uint32_t scale) {
+  switch (p) {
+  case SamplePrecision::FLOAT64:
+    return src.read(reinterpret_cast<char*>(vals), n * sizeof(double));
+  case SamplePrecision::FLOAT32:
+    for (size_t i = 0; i < n; ++i) {
+      float f;
+      if (!src.read(reinterpret_cast<char*>(&f), sizeof(float))) {
+        return false;
+      }
+      vals[i] = f;
+    }
+    return true;
+  case SamplePrecision::FIXED:
+    for (size_t i = 0; i < n; ++i) {
+      uint64_t v;
+      if (!getVarint(src, v)) {
+        return false;
+      }
+      vals[i] = static_cast<double>(v) / scale;
+    }
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Decode one record of the sample stream, as written by encodeSample, into
+ * sample (which must already hold a value for every transcript).
+ */
+template <typename ByteSource>
+inline bool decodeSample(ByteSource& src, SamplePrecision p, uint32_t scale,
+                         bool sparse, std::vector<double>& sample) {
+  if (!sparse) {
+    return decodeValues(src, sample.data(), sample.size(), p, scale);
+  }
+  unsigned char b[4];
+  if (!src.read(reinterpret_cast<char*>(b), 4)) {
+    return false;
+  }
+  uint32_t numNonZero = static_cast<uint32_t>(b[0]) |
+                        (static_cast<uint32_t>(b[1]) << 8) |
+                        (static_cast<uint32_t>(b[2]) << 16) |
+                        (static_cast<uint32_t>(b[3]) << 24);
+  std::vector<uint64_t> idx(numNonZero);
+  int64_t prev{-1};
+  for (auto& i : idx) {
+    uint64_t gap;
+    if (!getVarint(src, gap)) {
+      return false;
+    }
+    prev += static_cast<int64_t>(gap) + 1;
+    if (prev >= static_cast<int64_t>(sample.size())) {
+      return false;
+    }
+    i = static_cast<uint64_t>(prev);
+  }
+  std::vector<double> nonZero(numNonZero);
+  if (!decodeValues(src, nonZero.data(), numNonZero, p, scale)) {
+    return false;
+  }
+  std::fill(sample.begin(), sample.end(), 0.0);
+  for (size_t i = 0; i < numNonZero; ++i) {
+    sample[idx[i]] = nonZero[i];
+  }
+  return true;
+}
+}
+}
+
+#endif // SAMPLE_ENCODING_HPP
@@ -75,7 +75,7 @@ template <typename FragT>
 void sampleMiniBatch(AlignmentLibrary<FragT>& alnLib,
                      MiniBatchQueue<AlignmentGroup<FragT*>>& workQueue,
                      std::condition_variable& workAvailable,
-                     std::mutex& cvmutex, volatile bool& doneParsing,
+                     std::mutex& cvmutex, std::atomic<bool>& doneParsing,
                      std::atomic<size_t>& activeBatches,
                      const SalmonOpts& salmonOpts, bool& burnedIn,
                      std::atomic<size_t>& processedReads,
@@ -364,7 +364,6 @@ bool sampleLibrary(AlignmentLibrary<FragT>& alnLib,
   /**
    * Output queue
    */
-  volatile bool consumedAllInput{false};
   size_t defaultCapacity = 2000000;
   OutputQueue<FragT> outQueue;
   outQueue.set_capacity(defaultCapacity);
@@ -391,7 +390,7 @@ bool sampleLibrary(AlignmentLibrary<FragT>& alnLib,
     return false;
   }
 
-  volatile bool doneParsing{false};
+  std::atomic<bool> doneParsing{false};
   std::condition_variable workAvailable;
   std::mutex cvmutex;
   std::vector<std::thread> workers;
@@ -407,13 +406,15 @@ bool sampleLibrary(AlignmentLibrary<FragT>& alnLib,
         std::ref(processedReads), std::ref(outQueue));
   }
 
-  std::thread outputThread(
-      [&consumedAllInput, &alnLib, &outQueue, &log, sampleFilePath]() -> void {
+  // The BGZF blocks of the output are compressed by io_lib's thread pool
+  // (and written in order); this is where most of the time of this pass
+  // goes, so give it as many threads as the samplers.
+  int numCompressionThreads =
+      static_cast<int>(std::max(uint32_t{3}, salmonOpts.numQuantThreads));
+  std::thread outputThread([&alnLib, &outQueue, &log, sampleFilePath,
+                            numCompressionThreads]() -> void {
 
         scram_fd* bf = scram_open(sampleFilePath.c_str(), "wb");
-        scram_set_option(bf, CRAM_OPT_NTHREADS, 3);
-        scram_set_header(bf, alnLib.header());
-        scram_write_header(bf);
         if (bf == nullptr) {
           fmt::MemoryWriter errstr;
           errstr << ioutils::SET_RED << "ERROR: " << ioutils::RESET_COLOR
@@ -422,32 +423,38 @@ bool sampleLibrary(AlignmentLibrary<FragT>& alnLib,
           log->warn(errstr.str());
           std::exit(-1);
         }
+        scram_set_option(bf, CRAM_OPT_NTHREADS, numCompressionThreads);
+        scram_set_header(bf, alnLib.header());
+        scram_write_header(bf);
 
+        // Wait (rather than spin) for the sampled alignments; the
+        // end of the input is marked by a nullptr, pushed once all of the
+        // samplers are done.
         FragT* aln{nullptr};
-        while (!outQueue.empty() or !consumedAllInput) {
-          while (outQueue.try_pop(aln)) {
-            if (aln != nullptr) {
-              int ret = aln->writeToFile(bf);
-              if (ret != 0) {
-                std::cerr << "ret = " << ret << "\n";
-                fmt::MemoryWriter errstr;
-                errstr << ioutils::SET_RED << "ERROR:" << ioutils::RESET_COLOR
-                       << "Could not write "
-                       << "a sampled alignment to the output BAM "
-                       << "file. Please check that the file can "
-                       << "be created properly and that the disk "
-                       << "is not full.  Exiting.\n";
-                log->warn(errstr.str());
-                std::exit(-1);
-              }
-              // Eventually, as we do in BAMQueue, we should
-              // have queue of bam1_t structures that can be
-              // re-used rather than continually calling
-              // new and delete.
-              delete aln;
-              aln = nullptr;
-            }
+        while (true) {
+          outQueue.pop(aln);
+          if (aln == nullptr) {
+            break;
           }
+          int ret = aln->writeToFile(bf);
+          if (ret != 0) {
+            std::cerr << "ret = " << ret << "\n";
+            fmt::MemoryWriter errstr;
+            errstr << ioutils::SET_RED << "ERROR:" << ioutils::RESET_COLOR
+                   << "Could not write "
+                   << "a sampled alignment to the output BAM "
+                   << "file. Please check that the file can "
+                   << "be created properly and that the disk "
+                   << "is not full.  Exiting.\n";
+            log->warn(errstr.str());
+            std::exit(-1);
+          }
+          // Eventually, as we do in BAMQueue, we should
+          // have queue of bam1_t structures that can be
+          // re-used rather than continually calling
+          // new and delete.
+          delete aln;
+          aln = nullptr;
         }
 
         scram_close(bf); // will delete the header itself
@@ -494,40 +501,31 @@ bool sampleLibrary(AlignmentLibrary<FragT>& alnLib,
   }
   std::cerr << "\n";
 
-  // Free the alignments and the vector holding them
+  // Return the alignment groups to the pool (they belong to the BAMQueue)
+  // and free the vector holding them
   for (auto& aln : *alignments) {
     aln->alignments().clear();
-    delete aln;
+    bq.getAlignmentGroupQueue().enqueue(aln);
     aln = nullptr;
   }
   delete alignments;
 
-  doneParsing = true;
-
-  /**
-   * This could be a problem for small sets of alignments --- make sure the
-   * work queue is empty!!
-   * --- Thanks for finding a dataset that exposes this bug, Richard
-   * (Smith-Unna)!
-   */
-  size_t t = 0;
-  while (!workQueue.empty()) {
+  // The workers drain the work queue before they exit, so just wake them
+  // all (see quantifyLibrary)
+  {
     std::unique_lock<std::mutex> l(cvmutex);
-    workAvailable.notify_one();
+    doneParsing = true;
   }
+  workAvailable.notify_all();
 
   size_t tnum{0};
   for (auto& t : workers) {
     fmt::print(stderr, "killing thread {} . . . ", tnum++);
-    {
-      std::unique_lock<std::mutex> l(cvmutex);
-      workAvailable.notify_all();
-    }
     t.join();
     fmt::print(stderr, "done\r\r");
   }
   fmt::print(stderr, "\n");
-  consumedAllInput = true;
+  outQueue.push(nullptr);
 
   numObservedFragments += alnLib.numMappedFragments();
   fmt::print(stderr,
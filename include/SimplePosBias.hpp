@@ -2,7 +2,6 @@
 #define SIMPLE_POS_BIAS_HPP
 
 #include "spdlog/spdlog.h"
-#include "spline.h"
 #include <array>
 #include <boost/iostreams/filtering_stream.hpp>
 #include <vector>
@@ -18,14 +17,22 @@ public:
   // and add @mass to the appropriate bin
   void addMass(int32_t pos, int32_t length, double mass);
 
-  // Project, via linear interpolation, the weights contained in "bins"
-  // into the vector @out.
-  void projectWeights(std::vector<double>& out);
+  // Project the weights contained in "bins" into the vector @out (out[p]
+  // is the weight of the fraction p / out.size() of the transcript).
+  void projectWeights(std::vector<double>& out) const;
+
+  // out[p] = this model's weight over that of @expected, at the fraction
+  // p / @len of a transcript of length @len, for p < out.size().
+  void projectRatio(const SimplePosBias& expected, int32_t len,
+                    std::vector<double>& out) const;
 
   // Combine the distribution @other
   // with this distribution
   void combine(const SimplePosBias& other);
 
+  // Discard the masses added so far (keeping the pseudo-count of each bin)
+  void reset();
+
   // We're finished updating this distribution, so
   // compute the cdf etc.
   void finalize();
@@ -33,12 +40,22 @@ public:
   // Seralize this model.
   bool writeBinary(boost::iostreams::filtering_ostream& out) const;
 
+  // Read a model written by writeBinary (and finalize it); false if it
+  // doesn't have this model's bins
+  bool readBinary(boost::iostreams::filtering_istream& in);
+
 private:
   int32_t numBins_;
   std::vector<double> masses_;
   bool isLogged_{true};
   bool isFinalized_{false};
-  tk::spline s_;
+  // The number of intervals into which [0, 1] is split by the samples of
+  // the spline through the bins
+  static constexpr int32_t tableSize_ = 4096;
+  // The spline (floored at 0.001) at the fractions k / tableSize_, built by
+  // finalize; projections interpolate linearly between them, rather than
+  // evaluating the spline at every position of every transcript
+  std::vector<double> table_;
   // position bins taken from Cufflinks:
   // https://github.com/cole-trapnell-lab/cufflinks/blob/master/src/biascorrection.cpp
   const std::vector<double> positionBins_{{.02, .04, .06, .08, .10, .15, .2,
@@ -25,21 +25,13 @@ public:
   }
 
   ~TextBootstrapWriter() {
-#if defined __APPLE__
     spin_lock::scoped_lock sl(writeMutex_);
-#else
-    std::lock_guard<std::mutex> lock(writeMutex_);
-#endif
     ofile_.close();
   }
 
   bool writeHeader(std::string& comments,
                    std::vector<Transcript>& transcripts) override {
-#if defined __APPLE__
     spin_lock::scoped_lock sl(writeMutex_);
-#else
-    std::lock_guard<std::mutex> lock(writeMutex_);
-#endif
     ofile_ << comments;
     size_t numTxps = transcripts.size();
     if (numTxps == 0) {
@@ -67,11 +59,7 @@ public:
   }
 
   bool writeBootstrap(std::vector<double>& abund) override {
-#if defined __APPLE__
     spin_lock::scoped_lock sl(writeMutex_);
-#else
-    std::lock_guard<std::mutex> lock(writeMutex_);
-#endif
     size_t numTxps = abund.size();
     for (size_t tn = 0; tn < numTxps; ++tn) {
       auto& a = abund[tn];
@@ -90,12 +78,8 @@ private:
   boost::filesystem::path outputPath_;
   std::ofstream ofile_;
   std::shared_ptr<spdlog::logger> logger_;
-// only one writer thread at a time
-#if defined __APPLE__
+// only one writer thread at a time (left unnamed, as for GZipWriter)
   spin_lock writeMutex_;
-#else
-  std::mutex writeMutex_;
-#endif
   std::atomic<uint32_t> numWritten_{0};
 };
 
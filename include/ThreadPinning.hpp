@@ -0,0 +1,47 @@
+#ifndef __THREAD_PINNING_HPP__
+#define __THREAD_PINNING_HPP__
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+#include "tbb/task_scheduler_observer.h"
+
+namespace salmon {
+namespace threads {
+
+/**
+ * The CPUs that this process may run on (empty if they can't be found).
+ */
+std::vector<int> allowedCpus();
+
+/**
+ * Pin the thread t to the i-th (modulo their number) CPU that this process
+ * may run on.  Returns false if this isn't supported.
+ */
+bool pinThread(std::thread& t, size_t i);
+
+/**
+ * While it's alive, pins each TBB worker thread, as it joins the scheduler,
+ * to the next CPU that this process may run on, so that the threads of the
+ * offline phases (EM, bootstraps, ...) stay put as the mapping threads do.
+ * The thread that owns the scheduler is left alone: the parsing and mapping
+ * threads it creates would inherit its CPU.
+ */
+class TBBWorkerPinner : public tbb::task_scheduler_observer {
+public:
+  TBBWorkerPinner() : cpus_(allowedCpus()) { observe(true); }
+  ~TBBWorkerPinner() { observe(false); }
+
+  void on_scheduler_entry(bool isWorker) override;
+
+private:
+  std::vector<int> cpus_;
+  std::atomic<size_t> next_{0};
+};
+
+} // namespace threads
+} // namespace salmon
+
+#endif // __THREAD_PINNING_HPP__
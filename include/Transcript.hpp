@@ -3,6 +3,7 @@
 
 #include "FragmentLengthDistribution.hpp"
 #include "GCFragModel.hpp"
+#include "GCPrefixCounts.hpp"
 #include "SalmonMath.hpp"
 #include "SalmonStringUtils.hpp"
 #include "SalmonUtils.hpp"
@@ -12,44 +13,33 @@
 #include <cmath>
 #include <limits>
 #include <memory>
-
-#include "rapmap/bit_array.h"
-#include "rapmap/rank9b.h"
+#include <thread>
 
 class Transcript {
 public:
-  struct BitArrayDeleter {
-    void operator()(BIT_ARRAY* b) {
-      if (b != nullptr) {
-        bit_array_free(b);
-      }
-    }
-  };
-  using BitArrayPointer = std::unique_ptr<BIT_ARRAY, BitArrayDeleter>;
-  using Rank9bPointer = std::unique_ptr<rank9b>;
-
   Transcript()
-      : RefName(nullptr), RefLength(std::numeric_limits<uint32_t>::max()),
+      : RefName(""), RefLength(std::numeric_limits<uint32_t>::max()),
         CompleteLength(std::numeric_limits<uint32_t>::max()),
         EffectiveLength(-1.0), id(std::numeric_limits<uint32_t>::max()),
         logPerBasePrior_(salmon::math::LOG_0), priorMass_(salmon::math::LOG_0),
         mass_(salmon::math::LOG_0), sharedCount_(0.0),
         avgMassBias_(salmon::math::LOG_0), active_(false) {
     uniqueCount_.store(0);
-    lastUpdate_.store(0);
     lastTimestepUpdated_.store(0);
     cachedEffectiveLength_.store(salmon::math::LOG_0);
+    logRefLength_ = salmon::math::LOG_0;
   }
 
+  // (name isn't copied; see RefName)
   Transcript(size_t idIn, const char* name, uint32_t len, double alpha = 0.05)
       : RefName(name), RefLength(len), CompleteLength(len),
         EffectiveLength(-1.0), id(idIn), logPerBasePrior_(std::log(alpha)),
         priorMass_(std::log(alpha * len)), mass_(salmon::math::LOG_0),
         sharedCount_(0.0), avgMassBias_(salmon::math::LOG_0), active_(false) {
     uniqueCount_.store(0);
-    lastUpdate_.store(0);
     lastTimestepUpdated_.store(0);
-    cachedEffectiveLength_.store(std::log(static_cast<double>(RefLength)));
+    logRefLength_ = std::log(static_cast<double>(RefLength));
+    cachedEffectiveLength_.store(logRefLength_);
   }
 
   // We cannot copy; only move
@@ -59,27 +49,25 @@ public:
   Transcript(Transcript&& other) {
     id = other.id;
 
-    RefName = std::move(other.RefName);
+    RefName = other.RefName;
     RefLength = other.RefLength;
     CompleteLength = other.CompleteLength;
     EffectiveLength = other.EffectiveLength;
 
-    SAMSequence_ = std::move(other.SAMSequence_);
-    Sequence_ = std::move(other.Sequence_);
-    GCCount_ = std::move(other.GCCount_);
-    reduceGCMemory_ = other.reduceGCMemory_;
+    takeSequences_(other);
+    gcCounts_ = std::move(other.gcCounts_);
+    gcState_.store(other.gcState_.load());
     gcFracLen_ = other.gcFracLen_;
     lastRegularSample_ = other.lastRegularSample_;
-    gcBitArray_ = std::move(other.gcBitArray_);
-    gcRank_ = std::move(other.gcRank_);
 
     uniqueCount_.store(other.uniqueCount_);
     totalCount_.store(other.totalCount_.load());
     lastTimestepUpdated_.store(other.lastTimestepUpdated_.load());
     sharedCount_.store(other.sharedCount_.load());
     mass_.store(other.mass_.load());
-    lastUpdate_.store(other.lastUpdate_.load());
     cachedEffectiveLength_.store(other.cachedEffectiveLength_.load());
+    observedEffLength_ = other.observedEffLength_;
+    logRefLength_ = other.logRefLength_;
     lengthClassIndex_ = other.lengthClassIndex_;
     logPerBasePrior_ = other.logPerBasePrior_;
     priorMass_ = other.priorMass_;
@@ -91,26 +79,25 @@ public:
   Transcript& operator=(Transcript&& other) {
     id = other.id;
 
-    RefName = std::move(other.RefName);
+    RefName = other.RefName;
     RefLength = other.RefLength;
     CompleteLength = other.CompleteLength;
     EffectiveLength = other.EffectiveLength;
-    SAMSequence_ = std::move(other.SAMSequence_);
-    Sequence_ = std::move(other.Sequence_);
-    GCCount_ = std::move(other.GCCount_);
-    reduceGCMemory_ = other.reduceGCMemory_;
+    releaseSequences_();
+    takeSequences_(other);
+    gcCounts_ = std::move(other.gcCounts_);
+    gcState_.store(other.gcState_.load());
     gcFracLen_ = other.gcFracLen_;
     lastRegularSample_ = other.lastRegularSample_;
-    gcBitArray_ = std::move(other.gcBitArray_);
-    gcRank_ = std::move(other.gcRank_);
 
     uniqueCount_.store(other.uniqueCount_);
     totalCount_.store(other.totalCount_.load());
     lastTimestepUpdated_.store(other.lastTimestepUpdated_.load());
     sharedCount_.store(other.sharedCount_.load());
     mass_.store(other.mass_.load());
-    lastUpdate_.store(other.lastUpdate_.load());
     cachedEffectiveLength_.store(other.cachedEffectiveLength_.load());
+    observedEffLength_ = other.observedEffLength_;
+    logRefLength_ = other.logRefLength_;
     lengthClassIndex_ = other.lengthClassIndex_;
     logPerBasePrior_ = other.logPerBasePrior_;
     priorMass_ = other.priorMass_;
@@ -120,6 +107,8 @@ public:
     return *this;
   }
 
+  ~Transcript() { releaseSequences_(); }
+
   inline double sharedCount() { return sharedCount_.load(); }
   inline size_t uniqueCount() { return uniqueCount_.load(); }
   inline size_t totalCount() { return totalCount_.load(); }
@@ -143,7 +132,7 @@ public:
     using salmon::stringtools::encodedRevComp;
     size_t byte = idx >> 1;
     size_t nibble = idx & 0x1;
-    uint8_t* sseq = SAMSequence_.get();
+    uint8_t* sseq = SAMSequence_;
 
     switch (dir) {
     case strand::forward:
@@ -221,7 +210,6 @@ public:
                                    double logFLDMean, size_t minVal,
                                    size_t maxVal) {
 
-    double effectiveLength = salmon::math::LOG_0;
     double refLen = static_cast<double>(RefLength);
     double logRefLength = std::log(refLen);
 
@@ -229,25 +217,32 @@ public:
     // if (logRefLength <= logFLDMean) {
     //    effectiveLength = logRefLength;
     //} else {
+    // The expectation is accumulated in linear space (the pmf values are
+    // probabilities, so this can't overflow), which costs one exp per
+    // length rather than a logAdd and a log.
     uint32_t mval = maxVal;
     size_t clen = minVal;
     size_t maxLen = std::min(RefLength, mval);
+    double effectiveLength{0.0};
     while (clen <= maxLen) {
       size_t i = clen - minVal;
-      effectiveLength = salmon::math::logAdd(
-          effectiveLength, logPMF[i] + std::log(refLen - clen + 1));
+      effectiveLength += std::exp(logPMF[i]) * (refLen - clen + 1);
       ++clen;
     }
     //}
-    if (salmon::math::isLog0(effectiveLength) or
-        std::exp(effectiveLength) < 1.0) {
-      effectiveLength = logRefLength;
+    if (effectiveLength < 1.0) {
+      return logRefLength;
       // effectiveLength = //salmon::math::LOG_1;
     }
 
-    return effectiveLength;
+    return std::log(effectiveLength);
   }
 
+  /**
+   * The log of the (reference) length, computed once.
+   */
+  double logRefLength() const { return logRefLength_; }
+
   /**
    * Return the cached value for the log of the effective length.
    */
@@ -257,6 +252,14 @@ public:
     cachedEffectiveLength_.store(l);
   }
 
+  /**
+   * The average effective length observed for this transcript's fragments,
+   * if it had enough of them to be trusted (see --observedEffLens), and 0
+   * otherwise.
+   */
+  double observedEffectiveLength() const { return observedEffLength_; }
+  void setObservedEffectiveLength(double l) { observedEffLength_ = l; }
+
   void updateEffectiveLength(std::vector<double>& logPMF, double logFLDMean,
                              size_t minVal, size_t maxVal) {
     double cel = computeLogEffectiveLength(logPMF, logFLDMean, minVal, maxVal);
@@ -307,114 +310,43 @@ public:
 
     double contextSize = outsideContext + insideContext;
     int lastPos = RefLength - 1;
-    if (!reduceGCMemory_) {
-      auto cs = (s > 0) ? GCCount_[s - 1] : 0;
-      auto ce = GCCount_[e];
-
-      int fs = s - outside5p;
-      int fe = s + inside5p;
-      int ts = e - inside3p;
-      int te = e + outside3p;
-
-      bool fpLeftExists = (fs >= 0);
-      bool fpRightExists = (fe <= lastPos);
-      bool tpLeftExists = (ts >= 0);
-      bool tpRightExists = (te <= lastPos);
-
-      auto fps = (fpLeftExists) ? GCCount_[fs] : 0;
-      auto fpe = (fpRightExists) ? GCCount_[fe] : ce;
-      auto tps = (tpLeftExists) ? GCCount_[ts] : 0;
-      auto tpe = (tpRightExists) ? GCCount_[te] : ce;
-
-      // now, clamp to actual bounds
-      fs = (fs < 0) ? 0 : fs;
-      fe = (fe > lastPos) ? lastPos : fe;
-      ts = (ts < 0) ? 0 : ts;
-      te = (te > lastPos) ? lastPos : te;
-      int fpContextSize = (!fpLeftExists) ? (fe + 1) : (fe - fs);
-      int tpContextSize = (!tpLeftExists) ? (te + 1) : (te - ts);
-      contextSize = static_cast<double>(fpContextSize + tpContextSize);
-      if (contextSize == 0) {
-        // std::cerr << "" << std::endl;
-        return GCDesc();
-      }
-      valid = true;
-
-      int32_t fragFrac = std::lrint((100.0 * (ce - cs)) / (e - s + 1));
-      int32_t contextFrac =
-          std::lrint((100.0 * (((fpe - fps) + (tpe - tps)) / (contextSize))));
-      /*
-      if (contextFrac > 100) {
-        std::cerr << "NOTE : 5' count = " << (fpeCount - fpsCount) << ", 3'
-      count =" << (tpeCount - tpsCount) << ", context size = " << contextSize <<
-      std::endl; std::cerr << "s = " << s << ", e = " << e << ", l = " <<
-      RefLength << ", fs = " << fs  << ", fe =  " << fe << ", ts = " << ts << ",
-      te = " << te << std::endl; std::cerr << "fpsCount = " << fpsCount <<
-          ", fpeCount = " << fpeCount <<
-          ", tpsCount = " << tpsCount <<
-          ", tpeCount = " << tpeCount  <<
-          ", fpContextSize = " << fpContextSize  <<
-          ", tpContextSize = " << tpContextSize << std::endl;
-
-      }
-      */
-      GCDesc desc = {fragFrac, contextFrac};
-      return desc;
-    } else {
-      auto cs = (s > 0) ? gcCountInterp_(s - 1) : 0;
-      auto ce = gcCountInterp_(e);
-
-      int fs = s - outside5p;
-      int fe = s + inside5p;
-      int ts = e - inside3p;
-      int te = e + outside3p;
-
-      bool fpLeftExists = (fs >= 0);
-      bool fpRightExists = (fe <= lastPos);
-      bool tpLeftExists = (ts >= 0);
-      bool tpRightExists = (te <= lastPos);
-
-      auto fps = (fpLeftExists) ? gcCountInterp_(fs) : 0;
-      auto fpe = (fpRightExists) ? gcCountInterp_(fe) : ce;
-      auto tps = (tpLeftExists) ? gcCountInterp_(ts) : 0;
-      auto tpe = (tpRightExists) ? gcCountInterp_(te) : ce;
-
-      // now, clamp to actual bounds
-      fs = (fs < 0) ? 0 : fs;
-      fe = (fe > lastPos) ? lastPos : fe;
-      ts = (ts < 0) ? 0 : ts;
-      te = (te > lastPos) ? lastPos : te;
-      int fpContextSize = (!fpLeftExists) ? (fe + 1) : (fe - fs);
-      int tpContextSize = (!tpLeftExists) ? (te + 1) : (te - ts);
-      contextSize = static_cast<double>(fpContextSize + tpContextSize);
-      if (contextSize == 0) {
-        return GCDesc();
-      }
-      valid = true;
-
-      int32_t fragFrac = std::lrint((100.0 * (ce - cs)) / (e - s + 1));
-      int32_t contextFrac =
-          std::lrint((100.0 * (((fpe - fps) + (tpe - tps)) / (contextSize))));
-      GCDesc desc = {fragFrac, contextFrac};
-      return desc;
-      /** PREVIOUS SAMPLED IMPL (before May 23, 2017) **/
-      /*
-        auto cs = gcCountInterp_(s);
-        auto ce = gcCountInterp_(e);
-
-        valid = true;
-        auto fps = (s >= outside5p) ? gcCountInterp_(s-outside5p) : 0;
-        auto fpe = (inside5p > 0) ? gcCountInterp_(std::min(s+inside5p,
-        lastPos)) : cs; auto tps = (inside3p > 0) ?
-        ((e >= inside3p) ? gcCountInterp_(e-inside3p) : 0) : ce;
-        auto tpe = gcCountInterp_(std::min(e+outside3p, lastPos));
-
-        int32_t fragFrac = std::lrint((100.0 * (ce - cs)) / (e - s + 1));
-        int32_t contextFrac = std::lrint((100.0 * (((fpe - fps) + (tpe - tps)) /
-        (2.0 * contextSize)))); GCDesc desc = {fragFrac, contextFrac}; return
-        desc;
-      */
+    ensureGCContent_();
+    auto cs = (s > 0) ? gcCounts_.count(s - 1) : 0;
+    auto ce = gcCounts_.count(e);
+
+    int fs = s - outside5p;
+    int fe = s + inside5p;
+    int ts = e - inside3p;
+    int te = e + outside3p;
+
+    bool fpLeftExists = (fs >= 0);
+    bool fpRightExists = (fe <= lastPos);
+    bool tpLeftExists = (ts >= 0);
+    bool tpRightExists = (te <= lastPos);
+
+    auto fps = (fpLeftExists) ? gcCounts_.count(fs) : 0;
+    auto fpe = (fpRightExists) ? gcCounts_.count(fe) : ce;
+    auto tps = (tpLeftExists) ? gcCounts_.count(ts) : 0;
+    auto tpe = (tpRightExists) ? gcCounts_.count(te) : ce;
+
+    // now, clamp to actual bounds
+    fs = (fs < 0) ? 0 : fs;
+    fe = (fe > lastPos) ? lastPos : fe;
+    ts = (ts < 0) ? 0 : ts;
+    te = (te > lastPos) ? lastPos : te;
+    int fpContextSize = (!fpLeftExists) ? (fe + 1) : (fe - fs);
+    int tpContextSize = (!tpLeftExists) ? (te + 1) : (te - ts);
+    contextSize = static_cast<double>(fpContextSize + tpContextSize);
+    if (contextSize == 0) {
+      return GCDesc();
     }
+    valid = true;
+
+    int32_t fragFrac = std::lrint((100.0 * (ce - cs)) / (e - s + 1));
+    int32_t contextFrac =
+        std::lrint((100.0 * (((fpe - fps) + (tpe - tps)) / (contextSize))));
+    GCDesc desc = {fragFrac, contextFrac};
+    return desc;
   }
   inline double gcAt(int32_t s) const {
     return (s < 0) ? 0.0
@@ -424,75 +356,66 @@ public:
   // Return the fractional GC content along this transcript
   // in the interval [s,e] (note; this interval is closed on both sides).
   inline int32_t gcFrac(int32_t s, int32_t e) const {
-    if (!reduceGCMemory_) {
-      auto cs = (s > 0) ? GCCount_[s - 1] : 0;
-      auto ce = GCCount_[e];
-      return std::lrint((100.0 * (ce - cs)) / (e - s + 1));
-    } else {
-      auto cs = (s > 0) ? gcCountInterp_(s - 1) : 0;
-      auto ce = gcCountInterp_(e);
-      return std::lrint((100.0 * (ce - cs)) / (e - s + 1));
-    }
-    return 0;
+    ensureGCContent_();
+    auto cs = (s > 0) ? gcCounts_.count(s - 1) : 0;
+    auto ce = gcCounts_.count(e);
+    return std::lrint((100.0 * (ce - cs)) / (e - s + 1));
   }
 
+  // The GC content of the sequence (which needGC used to ask for) is built
+  // on first use; see ensureGCContent_().
+
   // Will *not* delete seq on destruction
-  void setSequenceBorrowed(const char* seq, bool needGC = false,
-                           bool reduceGCMemory = false) {
-    Sequence_ = std::unique_ptr<const char, void (*)(const char*)>(
-        seq,                 // store seq
-        [](const char* p) {} // do nothing deleter
-    );
-    if (needGC) {
-      computeGCContent_(reduceGCMemory);
+  void setSequenceBorrowed(const char* seq, bool needGC = false) {
+    if (ownsSequence_) {
+      delete[] Sequence_;
     }
+    Sequence_ = seq;
+    ownsSequence_ = false;
+    resetGCContent_();
   }
 
   // Will delete seq on destruction
-  void setSequenceOwned(const char* seq, bool needGC = false,
-                        bool reduceGCMemory = false) {
-    Sequence_ = std::unique_ptr<const char, void (*)(const char*)>(
-        seq,                              // store seq
-        [](const char* p) { delete[] p; } // do nothing deleter
-    );
-    if (needGC) {
-      computeGCContent_(reduceGCMemory);
+  void setSequenceOwned(const char* seq, bool needGC = false) {
+    if (ownsSequence_) {
+      delete[] Sequence_;
     }
+    Sequence_ = seq;
+    ownsSequence_ = true;
+    resetGCContent_();
   }
 
   // Will *not* delete seq on destruction
-  void setSAMSequenceBorrowed(uint8_t* seq, bool needGC = false,
-                              bool reduceGCMemory = false) {
-    SAMSequence_ = std::unique_ptr<uint8_t, void (*)(uint8_t*)>(
-        seq,              // store seq
-        [](uint8_t* p) {} // do nothing deleter
-    );
-    if (needGC) {
-      computeGCContent_(reduceGCMemory);
+  void setSAMSequenceBorrowed(uint8_t* seq, bool needGC = false) {
+    if (ownsSAMSequence_) {
+      delete[] SAMSequence_;
     }
+    SAMSequence_ = seq;
+    ownsSAMSequence_ = false;
+    resetGCContent_();
   }
 
   // Will delete seq on destruction
-  void setSAMSequenceOwned(uint8_t* seq, bool needGC = false,
-                           bool reduceGCMemory = false) {
-    SAMSequence_ = std::unique_ptr<uint8_t, void (*)(uint8_t*)>(
-        seq,                           // store seq
-        [](uint8_t* p) { delete[] p; } // do nothing deleter
-    );
-    if (needGC) {
-      computeGCContent_(reduceGCMemory);
+  void setSAMSequenceOwned(uint8_t* seq, bool needGC = false) {
+    if (ownsSAMSequence_) {
+      delete[] SAMSequence_;
     }
+    SAMSequence_ = seq;
+    ownsSAMSequence_ = true;
+    resetGCContent_();
   }
 
-  const char* Sequence() const { return Sequence_.get(); }
+  const char* Sequence() const { return Sequence_; }
 
-  uint8_t* SAMSequence() const { return SAMSequence_.get(); }
+  uint8_t* SAMSequence() const { return SAMSequence_; }
 
   void setCompleteLength(uint32_t completeLengthIn) {
     CompleteLength = completeLengthIn;
   }
 
-  std::string RefName;
+  // Points into the TranscriptNames of the experiment that owns the
+  // transcript, which outlives it
+  const char* RefName;
   uint32_t RefLength;
   uint32_t CompleteLength;
   double EffectiveLength;
@@ -506,13 +429,9 @@ public:
 private:
   // NOTE: Is it worth it to check if we have GC here?
   // we should never access these without bias correction.
-  inline double gcCount_(int32_t p) {
-    return (!reduceGCMemory_) ? static_cast<double>(GCCount_[p])
-                              : gcCountInterp_(p);
-  }
   inline double gcCount_(int32_t p) const {
-    return (!reduceGCMemory_) ? static_cast<double>(GCCount_[p])
-                              : gcCountInterp_(p);
+    ensureGCContent_();
+    return static_cast<double>(gcCounts_.count(p));
   }
 
   /*
@@ -522,13 +441,6 @@ private:
     }
   */
 
-  inline double gcCountInterp_(int32_t p) const {
-    if (p >= RefLength) {
-      p = RefLength - 1;
-    }
-    return static_cast<double>(gcRank_->rank(p + 1));
-  }
-
   /** Previous GC count interp implementation (May 23, 2017) **/
   /*
     inline double gcCountInterp_(int32_t p) const {
@@ -552,7 +464,7 @@ private:
       auto binCount = GCCount_[cb];
       // The count before or after the bin, until p
       int32_t count{0};
-      const char* seq = Sequence_.get();
+      const char* seq = Sequence_;
 
       // we hit a sampled position
       if (binPos == p) {
@@ -576,7 +488,7 @@ private:
   /*
     void computeGCContentSampled_(uint32_t step) {
         gcStep_ = step;
-        const char* seq = Sequence_.get();
+        const char* seq = Sequence_;
         size_t nsamp = std::ceil(static_cast<double>(RefLength) / step);
         GCCount_.reserve(nsamp + 2);
 
@@ -602,65 +514,101 @@ private:
     }
   */
 
-  void computeGCContent_(bool reduceGCMemory) {
-    reduceGCMemory_ = reduceGCMemory;
-    const char* seq = Sequence_.get();
-    GCCount_.clear();
-    if (!reduceGCMemory) {
-      GCCount_.resize(RefLength, 0);
-      size_t totGC{0};
-      for (size_t i = 0; i < RefLength; ++i) {
-        auto c = std::toupper(seq[i]);
-        if (c == 'G' or c == 'C') {
-          totGC++;
-        }
-        GCCount_[i] = totGC;
-      }
-    } else {
-      BIT_ARRAY* rawArray = bit_array_create(RefLength);
-      for (size_t i = 0; i < RefLength; ++i) {
-        auto c = std::toupper(seq[i]);
-        if (c == 'G' or c == 'C') {
-          bit_array_set_bit(rawArray, i);
-        }
-      }
-      gcBitArray_.reset(rawArray);
-      gcRank_.reset(new rank9b(gcBitArray_->words, RefLength));
-      // computeGCContentSampled_(gcSampFactor);
+  /**
+   * The GC prefix counts are built on first use (by whichever thread needs
+   * them first; the others wait for it), rather than when the sequence is
+   * set, so that only the transcripts whose GC content is ever looked at
+   * (those that fragments map to, or that are expressed when the effective
+   * lengths are bias-corrected) pay for them, in time or memory.
+   */
+  inline void ensureGCContent_() const {
+    if (gcState_.load(std::memory_order_acquire) != GCBuilt) {
+      buildGCContent_();
+    }
+  }
+
+  void buildGCContent_() const {
+    uint8_t expected{GCUnbuilt};
+    if (gcState_.compare_exchange_strong(expected, GCBuilding,
+                                         std::memory_order_acq_rel)) {
+      gcCounts_.build(Sequence_, RefLength);
+      gcState_.store(GCBuilt, std::memory_order_release);
+      return;
     }
+    while (gcState_.load(std::memory_order_acquire) != GCBuilt) {
+      std::this_thread::yield();
+    }
+  }
+
+  // The sequence changed; its GC prefix counts are built when next needed
+  void resetGCContent_() {
+    gcCounts_.clear();
+    gcState_.store(GCUnbuilt, std::memory_order_release);
   }
 
-  std::unique_ptr<uint8_t, void (*)(uint8_t*)> SAMSequence_ =
-      std::unique_ptr<uint8_t, void (*)(uint8_t*)>(nullptr, [](uint8_t*) {});
+  // Hand the sequences of other over to this transcript
+  void takeSequences_(Transcript& other) {
+    Sequence_ = other.Sequence_;
+    ownsSequence_ = other.ownsSequence_;
+    SAMSequence_ = other.SAMSequence_;
+    ownsSAMSequence_ = other.ownsSAMSequence_;
+    other.Sequence_ = nullptr;
+    other.ownsSequence_ = false;
+    other.SAMSequence_ = nullptr;
+    other.ownsSAMSequence_ = false;
+  }
 
-  std::unique_ptr<const char, void (*)(const char*)> Sequence_ =
-      std::unique_ptr<const char, void (*)(const char*)>(nullptr,
-                                                         [](const char*) {});
+  void releaseSequences_() {
+    if (ownsSequence_) {
+      delete[] Sequence_;
+    }
+    if (ownsSAMSequence_) {
+      delete[] SAMSequence_;
+    }
+    Sequence_ = nullptr;
+    ownsSequence_ = false;
+    SAMSequence_ = nullptr;
+    ownsSAMSequence_ = false;
+  }
 
+  /**
+   * The state that's updated, from every mapping thread, as fragments are
+   * assigned is kept together, so that updating a transcript touches as few
+   * cache lines as possible; the (read-mostly) metadata follows it.
+   */
+  tbb::atomic<double> mass_;
+  tbb::atomic<double> sharedCount_;
+  tbb::atomic<double> avgMassBias_;
   std::atomic<size_t> uniqueCount_;
   std::atomic<size_t> totalCount_;
   // The most recent timestep at which this transcript's mass was updated.
   std::atomic<size_t> lastTimestepUpdated_;
-  double priorMass_;
-  tbb::atomic<double> mass_;
-  tbb::atomic<double> sharedCount_;
   tbb::atomic<double> cachedEffectiveLength_;
-  tbb::atomic<size_t> lastUpdate_;
-  tbb::atomic<double> avgMassBias_;
-  uint32_t lengthClassIndex_;
-  double logPerBasePrior_;
   // In a paired-end protocol, a transcript has
   // an "anchor" fragment if it has a proper
   // pair of reads mapping to it.
   std::atomic<bool> hasAnchorFragment_{false};
   bool active_;
 
-  bool reduceGCMemory_{false};
-  double gcFracLen_{0.0};
+  // Whether the sequences are deleted with the transcript (see
+  // setSequenceOwned / setSequenceBorrowed)
+  bool ownsSequence_{false};
+  bool ownsSAMSequence_{false};
+  uint32_t lengthClassIndex_;
   uint32_t lastRegularSample_{0};
-  std::vector<uint32_t> GCCount_;
-  BitArrayPointer gcBitArray_{nullptr};
-  Rank9bPointer gcRank_{nullptr};
+  double priorMass_;
+  double logRefLength_;
+  double logPerBasePrior_;
+  double gcFracLen_{0.0};
+  double observedEffLength_{0.0};
+
+  const char* Sequence_{nullptr};
+  uint8_t* SAMSequence_{nullptr};
+  static constexpr uint8_t GCUnbuilt = 0;
+  static constexpr uint8_t GCBuilding = 1;
+  static constexpr uint8_t GCBuilt = 2;
+  mutable GCPrefixCounts gcCounts_;
+  mutable std::atomic<uint8_t> gcState_{GCUnbuilt};
 };
 
 #endif // TRANSCRIPT
@@ -31,6 +31,8 @@
 #include <unordered_map>
 #include <vector>
 
+#include "TranscriptNames.hpp"
+
 class TranscriptGeneMap {
   using Index = size_t;
   using Size = size_t;
@@ -39,7 +41,7 @@ class TranscriptGeneMap {
   using IndexVectorList = std::vector<std::vector<size_t>>;
 
 private:
-  NameVector _transcriptNames;
+  TranscriptNames _transcriptNames;
   NameVector _geneNames;
   IndexVector _transcriptsToGenes;
   IndexVectorList _genesToTranscripts;
@@ -69,38 +71,61 @@ private:
 
   friend class cereal::access;
 
+  // (the transcript names are written as a vector of strings)
   template <class Archive>
-  void serialize(Archive& ar, const unsigned int version) {
-    ar(_transcriptNames, _geneNames, _transcriptsToGenes, _genesToTranscripts,
+  void save(Archive& ar, const unsigned int version) const {
+    NameVector transcriptNames;
+    transcriptNames.reserve(_transcriptNames.size());
+    for (uint32_t i = 0; i < _transcriptNames.size(); ++i) {
+      transcriptNames.emplace_back(_transcriptNames.name(i));
+    }
+    ar(transcriptNames, _geneNames, _transcriptsToGenes, _genesToTranscripts,
        _haveReverseMap);
   }
 
+  template <class Archive> void load(Archive& ar, const unsigned int version) {
+    NameVector transcriptNames;
+    ar(transcriptNames, _geneNames, _transcriptsToGenes, _genesToTranscripts,
+       _haveReverseMap);
+    _setTranscriptNames(transcriptNames);
+  }
+
+  void _setTranscriptNames(const NameVector& transcriptNames) {
+    _transcriptNames = TranscriptNames();
+    _transcriptNames.reserve(transcriptNames.size());
+    for (auto& name : transcriptNames) {
+      _transcriptNames.add(name);
+    }
+  }
+
 public:
   TranscriptGeneMap()
-      : _transcriptNames(NameVector()), _geneNames(NameVector()),
-        _transcriptsToGenes(IndexVector()), _haveReverseMap(false) {}
+      : _geneNames(NameVector()), _transcriptsToGenes(IndexVector()),
+        _haveReverseMap(false) {}
 
   TranscriptGeneMap(const NameVector& transcriptNames,
                     const NameVector& geneNames,
                     const IndexVector& transcriptsToGenes)
-      : _transcriptNames(transcriptNames), _geneNames(geneNames),
-        _transcriptsToGenes(transcriptsToGenes), _haveReverseMap(false) {}
+      : _geneNames(geneNames), _transcriptsToGenes(transcriptsToGenes),
+        _haveReverseMap(false) {
+    _setTranscriptNames(transcriptNames);
+  }
 
-  TranscriptGeneMap(const TranscriptGeneMap& other) = default;
-  TranscriptGeneMap& operator=(const TranscriptGeneMap& other) = default;
+  TranscriptGeneMap(TranscriptGeneMap&& other) = default;
+  TranscriptGeneMap& operator=(TranscriptGeneMap&& other) = default;
 
   Index INVALID{std::numeric_limits<Index>::max()};
 
+  // (a hashed lookup; the names needn't be sorted)
+  Index findTranscriptID(const char* tname, size_t len) {
+    auto id = _transcriptNames.find(tname, len);
+    return (id == TranscriptNames::npos) ? INVALID : id;
+  }
   Index findTranscriptID(const std::string& tname) {
-    using std::distance;
-    using std::lower_bound;
-    auto it =
-        lower_bound(_transcriptNames.begin(), _transcriptNames.end(), tname);
-    if (it == _transcriptNames.end() or *it != tname) {
-      return INVALID;
-    } else {
-      return distance(_transcriptNames.begin(), it);
-    }
+    return findTranscriptID(tname.data(), tname.size());
+  }
+  Index findTranscriptID(const char* tname) {
+    return findTranscriptID(tname, std::strlen(tname));
   }
 
   Size numTranscripts() { return _transcriptNames.size(); }
@@ -139,7 +164,7 @@ public:
   }
 
   inline std::string transcriptName(Index transcriptID) {
-    return _transcriptNames[transcriptID];
+    return _transcriptNames.name(transcriptID);
   }
 };
 
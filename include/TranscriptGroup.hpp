@@ -6,12 +6,14 @@
 #include <cstdint>
 #include <vector>
 
+#include "EqClassLabel.hpp"
+
 class TranscriptGroup {
 public:
   TranscriptGroup();
-  TranscriptGroup(std::vector<uint32_t> txpsIn);
+  TranscriptGroup(const std::vector<uint32_t>& txpsIn);
 
-  TranscriptGroup(std::vector<uint32_t> txpsIn, size_t hashIn);
+  TranscriptGroup(const std::vector<uint32_t>& txpsIn, size_t hashIn);
 
   TranscriptGroup(TranscriptGroup&& other);
   TranscriptGroup(const TranscriptGroup& other);
@@ -24,25 +26,18 @@ public:
 
   void setValid(bool v) const;
 
-  std::vector<uint32_t> txps;
+  // Take the hash of txps, as it was appended to (see EqClassLabel)
+  void updateHash();
+
+  EqClassLabel txps;
   size_t hash;
-  double totalMass;
   mutable bool valid;
 };
 
 bool operator==(const TranscriptGroup& lhs, const TranscriptGroup& rhs);
 
 struct TranscriptGroupHasher {
-  std::size_t operator()(const TranscriptGroup& k) const {
-    return k.hash;
-    /*
-    std::size_t seed{0};
-    for (auto e : k.txps) {
-        boost::hash_combine(seed, e);
-    }
-    return seed;
-    */
-  }
+  std::size_t operator()(const TranscriptGroup& k) const { return k.hash; }
 };
 
 #endif // TRANSCRIPT_GROUP_HPP
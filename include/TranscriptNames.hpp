@@ -0,0 +1,86 @@
+#ifndef TRANSCRIPT_NAMES_HPP
+#define TRANSCRIPT_NAMES_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * The names of the transcripts, stored once, and indexed by a hash table
+ * from name to id; the transcripts (Transcript::RefName), the transcript to
+ * gene map and the writers all point into it, rather than holding copies of
+ * their own.
+ *
+ * The names are packed, NUL-terminated, into large blocks that never move,
+ * so a name's pointer stays valid for as long as the table (even when it is
+ * moved).  The index is open-addressed, at most half full, and each of its
+ * slots holds a name's id along with 32 bits of its hash, so that a lookup
+ * compares names only when their hashes agree (there's usually one probe,
+ * and one comparison, per name found).
+ */
+class TranscriptNames {
+public:
+  static constexpr uint32_t npos = std::numeric_limits<uint32_t>::max();
+
+  TranscriptNames() = default;
+  TranscriptNames(TranscriptNames&&) = default;
+  TranscriptNames& operator=(TranscriptNames&&) = default;
+  TranscriptNames(const TranscriptNames&) = delete;
+  TranscriptNames& operator=(const TranscriptNames&) = delete;
+
+  void reserve(size_t numNames);
+
+  /**
+   * Add the name of len bytes, with the next id (the number of names added
+   * before it), which is returned.  A name that's already in the table is
+   * stored again, but find() gives the id it was first added with.
+   */
+  uint32_t add(const char* name, size_t len);
+  uint32_t add(const std::string& name) {
+    return add(name.data(), name.size());
+  }
+  uint32_t add(const char* name) { return add(name, std::strlen(name)); }
+
+  // The id of the name of len bytes, or npos if it isn't in the table
+  uint32_t find(const char* name, size_t len) const;
+  uint32_t find(const std::string& name) const {
+    return find(name.data(), name.size());
+  }
+  uint32_t find(const char* name) const {
+    return find(name, std::strlen(name));
+  }
+
+  // The (NUL-terminated) name with the given id
+  const char* name(uint32_t id) const { return names_[id]; }
+  size_t length(uint32_t id) const { return lengths_[id]; }
+  size_t size() const { return names_.size(); }
+
+  // The bytes the table holds, for the names and their index
+  size_t memoryUsage() const;
+
+private:
+  // Copy n bytes, and a NUL, into the arena
+  const char* store_(const char* s, size_t n);
+  uint32_t find_(const char* name, size_t len, uint32_t hash) const;
+  // Put id in the index, under its (32-bit) hash
+  void insert_(uint32_t id, uint32_t hash);
+  void grow_(size_t numSlots);
+
+  // The arena, whose current block (of blockSize_ bytes) has blockUsed_
+  // bytes used
+  static constexpr size_t blockSize_ = size_t(1) << 20;
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  char* block_{nullptr};
+  size_t blockUsed_{0};
+  size_t arenaBytes_{0};
+
+  std::vector<const char*> names_;
+  std::vector<uint32_t> lengths_;
+  // (hash << 32 | id + 1) per slot, and 0 for an empty one
+  std::vector<uint64_t> slots_;
+};
+
+#endif // TRANSCRIPT_NAMES_HPP
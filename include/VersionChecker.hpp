@@ -48,4 +48,13 @@ private:
 
 std::string getVersionMessage();
 
+/**
+ * The version message from the on-disk cache (under $XDG_CACHE_HOME, or
+ * ~/.cache, in salmon/), if it's less than a day old.  Otherwise, returns
+ * "" right away, and refreshes the cache from a detached background
+ * process, so that the check never delays the command being run (e.g. on a
+ * node without network access, where it would wait for the timeout).
+ */
+std::string cachedVersionMessage();
+
 #endif // VERSION_CHECKER_HPP
\ No newline at end of file
@@ -0,0 +1,227 @@
+import argparse
+import gzip
+import json
+import logging
+import os
+import struct
+import sys
+import zlib
+from array import array
+
+MAGIC = b'SALMNCOL'
+HEADER = struct.Struct('<8sIIQQQ')
+# only in version >= 2: the scale of the fixed-point values
+HEADER_SCALE = struct.Struct('<Q')
+# only in version >= 3: the number of samples per group
+HEADER_GROUP = struct.Struct('<Q')
+FOOTER = struct.Struct('<Q8s')
+INDEX_ENTRY = struct.Struct('<QQ')
+# The value types / sample precisions (see SampleEncoding.hpp)
+PRECISIONS = {0: 'double', 1: 'float', 2: 'fixed'}
+TYPECODES = {'double': 'd', 'float': 'f'}
+
+
+def readVarint(buf, pos):
+    """
+    Decodes the LEB128 varint starting at buf[pos]; returns the value and the
+    position following it.
+    """
+    v = 0
+    shift = 0
+    while True:
+        b = buf[pos]
+        pos += 1
+        v |= (b & 0x7f) << shift
+        if b < 0x80:
+            return v, pos
+        shift += 7
+
+
+def decodeValues(buf, pos, n, precision, scale):
+    """
+    Decodes n sample values, stored with the given precision, starting at
+    buf[pos]; returns them (as an array of doubles) and the position
+    following them.
+    """
+    if precision == 'fixed':
+        vals = array('d')
+        for _ in range(n):
+            v, pos = readVarint(buf, pos)
+            vals.append(v / float(scale))
+        return vals, pos
+    vals = array(TYPECODES[precision])
+    end = pos + vals.itemsize * n
+    vals.frombytes(buf[pos:end])
+    if sys.byteorder != 'little':
+        vals.byteswap()
+    return array('d', vals), end
+
+
+def decodeSample(buf, pos, ntxp, precision, scale, sparse):
+    """
+    Decodes one sample record of bootstraps.gz starting at buf[pos]; returns
+    the sample and the position following it.
+    """
+    if not sparse:
+        return decodeValues(buf, pos, ntxp, precision, scale)
+    nnz = struct.unpack_from('<I', buf, pos)[0]
+    pos += 4
+    idx = []
+    prev = -1
+    for _ in range(nnz):
+        gap, pos = readVarint(buf, pos)
+        prev += gap + 1
+        idx.append(prev)
+    vals, pos = decodeValues(buf, pos, nnz, precision, scale)
+    sample = array('d', [0.0]) * ntxp
+    for i, v in zip(idx, vals):
+        sample[i] = v
+    return sample, pos
+
+
+class ColumnarSamples(object):
+    """
+    Reader for the columnar bootstrap / Gibbs sample file (bootstraps.col)
+    written by salmon with --sampleFormat columnar.  The samples are written
+    in groups; within a group, the samples of each transcript are stored
+    together, in separately compressed blocks, so the samples of a single
+    transcript can be read with one seek per group (usually, all of the
+    samples are in one group).
+    """
+
+    def __init__(self, path):
+        self.fh = open(path, 'rb')
+        (magic, version, vtype, self.numTargets, self.numSamples,
+         self.txpsPerBlock) = HEADER.unpack(self.fh.read(HEADER.size))
+        if magic != MAGIC:
+            raise ValueError("{} is not a columnar sample file".format(path))
+        if version not in (1, 2, 3) or vtype not in PRECISIONS:
+            raise ValueError("unsupported columnar sample file (version {}, "
+                             "value type {})".format(version, vtype))
+        self.precision = PRECISIONS[vtype]
+        self.scale = 0
+        if version >= 2:
+            self.scale = HEADER_SCALE.unpack(
+                self.fh.read(HEADER_SCALE.size))[0]
+        self.samplesPerGroup = self.numSamples
+        if version >= 3:
+            self.samplesPerGroup = HEADER_GROUP.unpack(
+                self.fh.read(HEADER_GROUP.size))[0]
+        self.numGroups = ((self.numSamples + self.samplesPerGroup - 1) //
+                          max(self.samplesPerGroup, 1))
+        self.fh.seek(-FOOTER.size, os.SEEK_END)
+        indexOffset, magic = FOOTER.unpack(self.fh.read(FOOTER.size))
+        if magic != MAGIC:
+            raise ValueError("{} is truncated".format(path))
+        self.numBlocks = ((self.numTargets + self.txpsPerBlock - 1) //
+                          self.txpsPerBlock)
+        numEntries = self.numGroups * self.numBlocks
+        self.fh.seek(indexOffset)
+        raw = self.fh.read(INDEX_ENTRY.size * numEntries)
+        self.index = [INDEX_ENTRY.unpack_from(raw, INDEX_ENTRY.size * e)
+                      for e in range(numEntries)]
+
+    def close(self):
+        self.fh.close()
+
+    def groupSize(self, g):
+        """
+        Returns the number of samples in group g.
+        """
+        return min(self.samplesPerGroup,
+                   self.numSamples - g * self.samplesPerGroup)
+
+    def groupBlock(self, g, b):
+        """
+        Returns the values of block b of group g (the samples of the group of
+        the block's first transcript, then those of the second, ...).
+        """
+        offset, size = self.index[g * self.numBlocks + b]
+        self.fh.seek(offset)
+        numTxps = min(self.txpsPerBlock,
+                      self.numTargets - b * self.txpsPerBlock)
+        vals, _ = decodeValues(zlib.decompress(self.fh.read(size)), 0,
+                               numTxps * self.groupSize(g), self.precision,
+                               self.scale)
+        return vals
+
+    def block(self, b):
+        """
+        Returns the values of block b (all samples of its first transcript,
+        then all samples of the second, ...).
+        """
+        if self.numGroups == 1:
+            return self.groupBlock(0, b)
+        numTxps = min(self.txpsPerBlock,
+                      self.numTargets - b * self.txpsPerBlock)
+        groups = [self.groupBlock(g, b) for g in range(self.numGroups)]
+        vals = array('d')
+        for i in range(numTxps):
+            for g, gv in enumerate(groups):
+                n = self.groupSize(g)
+                vals.extend(gv[i * n:(i + 1) * n])
+        return vals
+
+    def transcript(self, t):
+        """
+        Returns all of the samples of transcript t.
+        """
+        b, i = divmod(t, self.txpsPerBlock)
+        vals = array('d')
+        for g in range(self.numGroups):
+            n = self.groupSize(g)
+            vals.extend(self.groupBlock(g, b)[i * n:(i + 1) * n])
+        return vals
+
+    def rows(self):
+        """
+        Yields the samples one at a time (each with a value for every
+        transcript), in the order in which they were drawn.  This reads the
+        whole file into memory.
+        """
+        cols = array('d')
+        for b in range(self.numBlocks):
+            cols.extend(self.block(b))
+        for s in range(self.numSamples):
+            yield cols[s::self.numSamples]
+
+
+def readNames(quantDir, auxDir):
+    nameFile = os.path.sep.join([quantDir, auxDir, "bootstrap", "names.tsv.gz"])
+    with gzip.open(nameFile) as nf:
+        return nf.read().decode().strip().split('\t')
+
+
+def main(args):
+    logging.basicConfig(level=logging.INFO)
+    quantDir = args.quantDir
+    auxDir = "aux"
+    with open(os.path.sep.join([quantDir, "cmd_info.json"])) as cmdFile:
+        dat = json.load(cmdFile)
+        if 'auxDir' in dat:
+            auxDir = dat['auxDir']
+
+    txpNames = readNames(quantDir, auxDir)
+    txpIndex = {n: i for i, n in enumerate(txpNames)}
+    samples = ColumnarSamples(
+        os.path.sep.join([quantDir, auxDir, "bootstrap", "bootstraps.col"]))
+
+    out = sys.stdout
+    for name in args.targets:
+        if name not in txpIndex:
+            logging.error("Unknown target {}".format(name))
+            sys.exit(1)
+        vals = samples.transcript(txpIndex[name])
+        out.write(name + '\t' + '\t'.join(map(str, vals)) + '\n')
+    samples.close()
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Print all of the bootstrap / Gibbs samples of the given "
+        "targets from a columnar sample file (one target per line)")
+    parser.add_argument('quantDir', type=str,
+                        help="path to salmon quantification directory")
+    parser.add_argument('targets', type=str, nargs='+',
+                        help="names of the targets to extract")
+    main(parser.parse_args())
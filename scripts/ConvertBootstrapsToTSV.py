@@ -8,6 +8,8 @@ import sys
 import errno
 import json
 
+from ColumnarSamples import ColumnarSamples, decodeSample
+
 # from: http://stackoverflow.com/questions/600268/mkdir-p-functionality-in-python
 def mkdir_p(path):
     try:
@@ -29,7 +31,12 @@ def main(args):
         if 'auxDir' in dat:
             auxDir = dat['auxDir']
 
-    bootstrapFile = os.path.sep.join([quantDir, auxDir, "bootstrap", "bootstraps.gz"])
+    with open(os.path.sep.join([quantDir, auxDir, "meta_info.json"])) as fh:
+        meta_info = json.load(fh)
+    columnar = meta_info.get('samp_format', 'gzip') == 'columnar'
+
+    bootstrapFile = os.path.sep.join([quantDir, auxDir, "bootstrap",
+                                      "bootstraps.col" if columnar else "bootstraps.gz"])
     nameFile = os.path.sep.join([quantDir, auxDir, "bootstrap", "names.tsv.gz"])
     if not os.path.isfile(bootstrapFile):
        logging.error("The required bootstrap file {} doesn't appear to exist".format(bootstrapFile)) 
@@ -45,9 +52,6 @@ def main(args):
     ntxp = len(txpNames)
     logging.info("Expecting bootstrap info for {} transcripts".format(ntxp))
     
-    with open(os.path.sep.join([quantDir, auxDir, "meta_info.json"])) as fh:
-        meta_info = json.load(fh)
-        
     if meta_info['samp_type'] == 'gibbs':
         #s = struct.Struct('<' + 'i' * ntxp)
         s = struct.Struct('@' + 'd' * ntxp)
@@ -74,16 +78,36 @@ def main(args):
         ofile.write('\t'.join(txpNames) + '\n')
         
         # Now, iterate over the bootstrap samples and write each
-        with gzip.open(bootstrapFile) as bf:
-            while True:
-                try:
-                    x = s.unpack_from(bf.read(s.size))
-                    xs = map(str, x)
-                    ofile.write('\t'.join(xs) + '\n')
-                    numBoot += 1
-                except:
-                    logging.info("read all bootstrap values")
-                    break
+        if columnar:
+            samples = ColumnarSamples(bootstrapFile)
+            for x in samples.rows():
+                ofile.write('\t'.join(map(str, x)) + '\n')
+                numBoot += 1
+            samples.close()
+            logging.info("read all bootstrap values")
+        elif meta_info.get('samp_precision', 'double') != 'double' or meta_info.get('samp_sparse', False):
+            precision = meta_info.get('samp_precision', 'double')
+            scale = meta_info.get('samp_fixed_scale', 0)
+            sparse = meta_info.get('samp_sparse', False)
+            with gzip.open(bootstrapFile) as bf:
+                buf = bf.read()
+            pos = 0
+            while pos < len(buf):
+                x, pos = decodeSample(buf, pos, ntxp, precision, scale, sparse)
+                ofile.write('\t'.join(map(str, x)) + '\n')
+                numBoot += 1
+            logging.info("read all bootstrap values")
+        else:
+            with gzip.open(bootstrapFile) as bf:
+                while True:
+                    try:
+                        x = s.unpack_from(bf.read(s.size))
+                        xs = map(str, x)
+                        ofile.write('\t'.join(xs) + '\n')
+                        numBoot += 1
+                    except:
+                        logging.info("read all bootstrap values")
+                        break
 
     logging.info("wrote {} bootstrap samples".format(numBoot))
     logging.info("converted bootstraps successfully.")
@@ -0,0 +1,147 @@
+import argparse
+import json
+import logging
+import os
+import struct
+import sys
+import zlib
+from array import array
+
+MAGIC = b'SALMNEQC'
+HEADER = struct.Struct('<8sIIQQQ')
+FOOTER = struct.Struct('<Q8s')
+INDEX_ENTRY = struct.Struct('<QQ')
+HAS_WEIGHTS = 1
+
+
+def readVarint(buf, pos):
+    """
+    Decodes the LEB128 varint starting at buf[pos]; returns the value and the
+    position following it.
+    """
+    v = 0
+    shift = 0
+    while True:
+        b = buf[pos]
+        pos += 1
+        v |= (b & 0x7f) << shift
+        if b < 0x80:
+            return v, pos
+        shift += 7
+
+
+def unzigzag(z):
+    return (z >> 1) ^ -(z & 1)
+
+
+class EquivClasses(object):
+    """
+    Reader for the binary equivalence class file (eq_classes.bin) written by
+    salmon with --dumpEq --dumpEqFormat binary (see EquivClassFile.hpp for
+    the layout).  The classes are stored in separately compressed blocks.
+    """
+
+    def __init__(self, path):
+        self.fh = open(path, 'rb')
+        (magic, version, flags, self.numTranscripts, self.numClasses,
+         self.classesPerBlock) = HEADER.unpack(self.fh.read(HEADER.size))
+        if magic != MAGIC:
+            raise ValueError("{} is not a binary equivalence class file"
+                             .format(path))
+        if version != 1:
+            raise ValueError("unsupported equivalence class file (version {})"
+                             .format(version))
+        self.hasWeights = bool(flags & HAS_WEIGHTS)
+        namesSize = struct.unpack('<Q', self.fh.read(8))[0]
+        names = zlib.decompress(self.fh.read(namesSize)).decode()
+        self.names = names.split('\n')[:-1]
+        self.fh.seek(-FOOTER.size, os.SEEK_END)
+        indexOffset, magic = FOOTER.unpack(self.fh.read(FOOTER.size))
+        if magic != MAGIC:
+            raise ValueError("{} is truncated".format(path))
+        numBlocks = ((self.numClasses + self.classesPerBlock - 1) //
+                     self.classesPerBlock)
+        self.fh.seek(indexOffset)
+        raw = self.fh.read(INDEX_ENTRY.size * numBlocks)
+        self.index = [INDEX_ENTRY.unpack_from(raw, INDEX_ENTRY.size * b)
+                      for b in range(numBlocks)]
+
+    def close(self):
+        self.fh.close()
+
+    def block(self, b):
+        """
+        Returns the classes of block b, each as a (transcript ids, weights,
+        count) tuple; the weights are None if the file has none.
+        """
+        offset, size = self.index[b]
+        self.fh.seek(offset)
+        buf = bytearray(zlib.decompress(self.fh.read(size)))
+        numClasses = min(self.classesPerBlock,
+                         self.numClasses - b * self.classesPerBlock)
+        classes = []
+        pos = 0
+        for _ in range(numClasses):
+            n, pos = readVarint(buf, pos)
+            txps = []
+            prev = 0
+            for i in range(n):
+                v, pos = readVarint(buf, pos)
+                prev = v if i == 0 else prev + unzigzag(v)
+                txps.append(prev)
+            weights = None
+            if self.hasWeights:
+                weights = array('f')
+                weights.frombytes(bytes(buf[pos:pos + 4 * n]))
+                if sys.byteorder != 'little':
+                    weights.byteswap()
+                pos += 4 * n
+            count, pos = readVarint(buf, pos)
+            classes.append((txps, weights, count))
+        return classes
+
+    def classes(self):
+        """
+        Yields all of the classes in order.
+        """
+        for b in range(len(self.index)):
+            for c in self.block(b):
+                yield c
+
+
+def main(args):
+    logging.basicConfig(level=logging.INFO)
+    quantDir = args.quantDir
+    auxDir = "aux"
+    with open(os.path.sep.join([quantDir, "cmd_info.json"])) as cmdFile:
+        dat = json.load(cmdFile)
+        if 'auxDir' in dat:
+            auxDir = dat['auxDir']
+
+    eqFile = os.path.sep.join([quantDir, auxDir, "eq_classes.bin"])
+    if not os.path.exists(eqFile):
+        logging.error("Couldn't find {}".format(eqFile))
+        sys.exit(1)
+    eqs = EquivClasses(eqFile)
+
+    # The same layout as eq_classes.txt
+    out = sys.stdout
+    out.write("{}\n{}\n".format(eqs.numTranscripts, eqs.numClasses))
+    for n in eqs.names:
+        out.write(n + '\n')
+    for txps, weights, count in eqs.classes():
+        fields = [str(len(txps))] + [str(t) for t in txps]
+        if weights is not None:
+            fields += [repr(w) for w in weights]
+        fields.append(str(count))
+        out.write('\t'.join(fields) + '\n')
+    eqs.close()
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Print the binary equivalence classes of a salmon run "
+        "(aux/eq_classes.bin) in the text (eq_classes.txt) format")
+    parser.add_argument('quantDir', type=str,
+                        help="path to salmon quantification directory")
+    main(parser.parse_args())
@@ -0,0 +1,118 @@
+import argparse
+import struct
+import sys
+import zlib
+
+MAGIC = b'SALMNMAP'
+HEADER = struct.Struct('<8sIIQQ')
+BLOCK = struct.Struct('<III')
+# rapmap::utils::MateStatus
+SINGLE_END, PAIRED_END_LEFT, PAIRED_END_RIGHT, PAIRED_END_PAIRED = range(4)
+
+
+def readVarint(buf, pos):
+    """
+    Decodes the LEB128 varint starting at buf[pos]; returns the value and the
+    position following it.
+    """
+    v = 0
+    shift = 0
+    while True:
+        b = buf[pos]
+        pos += 1
+        v |= (b & 0x7f) << shift
+        if b < 0x80:
+            return v, pos
+        shift += 7
+
+
+def unzigzag(z):
+    return (z >> 1) ^ -(z & 1)
+
+
+class Mappings(object):
+    """
+    Reader for the binary mapping file written by salmon with --writeMappings
+    --binaryMappings (see MappingFile.hpp for the layout).
+    """
+
+    def __init__(self, fh):
+        self.fh = fh
+        (magic, version, flags, numTranscripts,
+         tableSize) = HEADER.unpack(self.fh.read(HEADER.size))
+        if magic != MAGIC:
+            raise ValueError("not a binary mapping file")
+        if version != 1:
+            raise ValueError("unsupported mapping file (version {})"
+                             .format(version))
+        table = zlib.decompress(self.fh.read(tableSize)).decode()
+        self.names = []
+        self.lengths = []
+        for line in table.split('\n')[:-1]:
+            name, length = line.rsplit('\t', 1)
+            self.names.append(name)
+            self.lengths.append(int(length))
+
+    def reads(self):
+        """
+        Yields each read as a (name, mappings) tuple; a mapping is a dict
+        with the fields of the record.
+        """
+        while True:
+            raw = self.fh.read(BLOCK.size)
+            if len(raw) < BLOCK.size:
+                return
+            numReads, _, size = BLOCK.unpack(raw)
+            buf = bytearray(zlib.decompress(self.fh.read(size)))
+            pos = 0
+            for _ in range(numReads):
+                n, pos = readVarint(buf, pos)
+                name = bytes(buf[pos:pos + n]).decode()
+                pos += n
+                numHits, pos = readVarint(buf, pos)
+                hits = []
+                for _ in range(numHits):
+                    h = {}
+                    h['tid'], pos = readVarint(buf, pos)
+                    p, pos = readVarint(buf, pos)
+                    h['pos'] = unzigzag(p)
+                    h['readLen'], pos = readVarint(buf, pos)
+                    flags = buf[pos]
+                    pos += 1
+                    h['fwd'] = bool(flags & 1)
+                    h['mateIsFwd'] = bool(flags & 2)
+                    h['mateStatus'] = flags >> 2
+                    if h['mateStatus'] == PAIRED_END_PAIRED:
+                        p, pos = readVarint(buf, pos)
+                        h['matePos'] = unzigzag(p)
+                        h['mateLen'], pos = readVarint(buf, pos)
+                        h['fragLen'], pos = readVarint(buf, pos)
+                    hits.append(h)
+                yield name, hits
+
+
+def main(args):
+    fh = sys.stdin.buffer if args.mappings == '-' else open(args.mappings, 'rb')
+    maps = Mappings(fh)
+    out = sys.stdout
+    # One line per mapping
+    out.write("read\ttranscript\tpos\tfwd\tmateStatus\tmatePos\tmateIsFwd"
+              "\tfragLen\n")
+    for name, hits in maps.reads():
+        for h in hits:
+            paired = h['mateStatus'] == PAIRED_END_PAIRED
+            out.write("{}\t{}\t{}\t{}\t{}\t{}\t{}\t{}\n".format(
+                name, maps.names[h['tid']], h['pos'], int(h['fwd']),
+                h['mateStatus'], h['matePos'] if paired else 'NA',
+                int(h['mateIsFwd']) if paired else 'NA',
+                h['fragLen'] if paired else 'NA'))
+    fh.close()
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Print the binary mappings written by salmon with "
+        "--writeMappings --binaryMappings, one mapping per line")
+    parser.add_argument('mappings', type=str,
+                        help="the mapping file (or - to read stdin)")
+    main(parser.parse_args())
@@ -0,0 +1,56 @@
+import argparse
+import os
+import struct
+import sys
+from array import array
+
+MAGIC = b'SALMNQNT'
+HEADER = struct.Struct('<8sIQ')
+
+
+def readColumn(fh, typecode, n):
+    col = array(typecode)
+    col.frombytes(fh.read(col.itemsize * n))
+    if sys.byteorder != 'little':
+        col.byteswap()
+    return col
+
+
+class QuantBin(object):
+    """
+    Reader for quant.bin, the binary companion of quant.sf written by salmon
+    with --writeQuantBin (see GZipWriter.cpp for the layout).  The columns
+    are the same as those of quant.sf, but at full precision.
+    """
+
+    def __init__(self, path):
+        with open(path, 'rb') as fh:
+            magic, version, n = HEADER.unpack(fh.read(HEADER.size))
+            if magic != MAGIC:
+                raise ValueError("{} is not a quant.bin file".format(path))
+            if version != 1:
+                raise ValueError("unsupported quant.bin file (version {})"
+                                 .format(version))
+            namesSize = struct.unpack('<Q', fh.read(8))[0]
+            self.names = fh.read(namesSize).decode().split('\n')[:-1]
+            self.length = readColumn(fh, 'I', n)
+            self.effectiveLength = readColumn(fh, 'd', n)
+            self.tpm = readColumn(fh, 'd', n)
+            self.numReads = readColumn(fh, 'd', n)
+
+
+def main(args):
+    q = QuantBin(os.path.sep.join([args.quantDir, "quant.bin"]))
+    out = sys.stdout
+    out.write("Name\tLength\tEffectiveLength\tTPM\tNumReads\n")
+    for row in zip(q.names, q.length, q.effectiveLength, q.tpm, q.numReads):
+        out.write("{}\t{}\t{!r}\t{!r}\t{!r}\n".format(*row))
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Print the abundances of a salmon run (quant.bin) in the "
+        "quant.sf format, at full precision")
+    parser.add_argument('quantDir', type=str,
+                        help="path to salmon quantification directory")
+    main(parser.parse_args())
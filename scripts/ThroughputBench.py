@@ -0,0 +1,271 @@
+"""
+End-to-end throughput benchmark of salmon quant.
+
+Simulates paired-end reads from the transcripts an index was built from (with
+a chosen abundance profile, fragment length distribution, substitution error
+rate and fraction of duplicate fragments), and streams them, through named
+pipes, into `salmon quant` at each of a number of thread counts; the reads
+are simulated once, up front, and kept in memory, so neither the disk nor the
+simulator limit the throughput being measured.  For each run it reports the
+wall time of the phases recorded in meta_info.json ("performance") and the
+mapping throughput, e.g.
+
+  python ThroughputBench.py --salmon salmon --index idx --transcripts txp.fa \\
+      --out bench --threads 1,2,4,8,16 --numFragments 2000000
+
+Everything after `--` is passed to salmon quant.  With --configs, each run
+is repeated for each of the given option sets, e.g. --configs
+'default;--gcBias --seqBias' to compare the default mapping loop with the
+bias-corrected one.
+"""
+import argparse
+import json
+import math
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import threading
+
+COMPLEMENT = str.maketrans('ACGTNacgtn', 'TGCANtgcan')
+SUBSTITUTIONS = {'A': 'CGT', 'C': 'AGT', 'G': 'ACT', 'T': 'ACG'}
+
+
+def readFasta(path):
+    """
+    Returns the (name, sequence) of each record of the FASTA file path; the
+    name is the header up to the first whitespace, as salmon index has it.
+    """
+    records = []
+    name = None
+    seq = []
+    with open(path) as fh:
+        for line in fh:
+            line = line.rstrip()
+            if line.startswith('>'):
+                if name is not None:
+                    records.append((name, ''.join(seq).upper()))
+                name = line[1:].split()[0]
+                seq = []
+            else:
+                seq.append(line)
+    if name is not None:
+        records.append((name, ''.join(seq).upper()))
+    return records
+
+
+def abundances(names, profile, rng):
+    """
+    The relative abundance (molecules, not reads) of each transcript under
+    profile, which is one of uniform, lognormal[:sigma], zipf[:exponent], or
+    the path of a file of name<TAB>abundance lines (missing ones are 0).
+    """
+    kind, _, param = profile.partition(':')
+    if kind == 'uniform':
+        return [1.0] * len(names)
+    if kind == 'lognormal':
+        sigma = float(param) if param else 1.5
+        return [rng.lognormvariate(0.0, sigma) for _ in names]
+    if kind == 'zipf':
+        s = float(param) if param else 1.0
+        ranks = list(range(1, len(names) + 1))
+        rng.shuffle(ranks)
+        return [1.0 / (r ** s) for r in ranks]
+    given = {}
+    with open(profile) as fh:
+        for line in fh:
+            toks = line.split()
+            if len(toks) >= 2:
+                given[toks[0]] = float(toks[1])
+    return [given.get(n, 0.0) for n in names]
+
+
+def addErrors(read, rate, rng):
+    """Substitutes each base of read with probability rate"""
+    if rate <= 0.0:
+        return read
+    bases = None
+    logKeep = math.log(1.0 - rate)
+    # Skip ahead a geometric number of bases to each error
+    pos = int(math.log(1.0 - rng.random()) / logKeep)
+    while pos < len(read):
+        if bases is None:
+            bases = list(read)
+        bases[pos] = rng.choice(SUBSTITUTIONS.get(bases[pos], 'ACGT'))
+        pos += 1 + int(math.log(1.0 - rng.random()) / logKeep)
+    return read if bases is None else ''.join(bases)
+
+
+def simulate(args, txps):
+    """
+    Returns the mate 1 and mate 2 FASTQ files (as bytes) of
+    args.numFragments fragments.
+    """
+    rng = random.Random(args.seed)
+    readLen = args.readLength
+    abund = abundances([n for n, _ in txps], args.abundance, rng)
+    # A transcript is sampled in proportion to its abundance and the number
+    # of positions a fragment of the mean length can start at
+    weights = []
+    for (_, seq), a in zip(txps, abund):
+        weights.append(a * max(0, len(seq) - max(readLen, int(args.fragMean)) + 1))
+    if sum(weights) <= 0.0:
+        sys.exit("no transcript is long enough to sample fragments of "
+                 "{} nt from".format(int(args.fragMean)))
+    tids = rng.choices(range(len(txps)), weights=weights, k=args.numFragments)
+
+    qual = 'I' * readLen
+    mate1 = []
+    mate2 = []
+    prev = []
+    for i, tid in enumerate(tids):
+        if prev and rng.random() < args.duplicateFraction:
+            r1, r2 = prev[rng.randrange(len(prev))]
+        else:
+            seq = txps[tid][1]
+            fragLen = int(round(rng.gauss(args.fragMean, args.fragSD)))
+            fragLen = min(len(seq), max(readLen, fragLen))
+            start = rng.randrange(len(seq) - fragLen + 1)
+            frag = seq[start:start + fragLen]
+            r1 = frag[:readLen]
+            r2 = frag[-readLen:].translate(COMPLEMENT)[::-1]
+            # unstranded: the fragment is equally likely to come from either
+            # strand
+            if rng.random() < 0.5:
+                r1, r2 = r2, r1
+            r1 = addErrors(r1, args.errorRate, rng)
+            r2 = addErrors(r2, args.errorRate, rng)
+            # keep a bounded pool of fragments to duplicate
+            if len(prev) < 100000:
+                prev.append((r1, r2))
+            else:
+                prev[rng.randrange(len(prev))] = (r1, r2)
+        mate1.append('@r{}/1\n{}\n+\n{}\n'.format(i, r1, qual[:len(r1)]))
+        mate2.append('@r{}/2\n{}\n+\n{}\n'.format(i, r2, qual[:len(r2)]))
+    return ''.join(mate1).encode(), ''.join(mate2).encode()
+
+
+def feed(path, data):
+    with open(path, 'wb') as fh:
+        fh.write(data)
+
+
+def runQuant(args, name, threads, reads, extra):
+    """
+    Runs salmon quant with threads threads on reads (streamed through named
+    pipes), into the run directory name; returns the "performance" record of
+    its meta_info.json.
+    """
+    outDir = os.path.join(args.out, name)
+    pipeDir = tempfile.mkdtemp(prefix='salmon-bench-')
+    pipes = [os.path.join(pipeDir, 'reads_{}.fq'.format(m)) for m in (1, 2)]
+    for p in pipes:
+        os.mkfifo(p)
+    # One writer per mate, since salmon reads the mates in lockstep
+    writers = [threading.Thread(target=feed, args=(p, d))
+               for p, d in zip(pipes, reads)]
+    for w in writers:
+        w.daemon = True
+        w.start()
+    cmd = [args.salmon, 'quant', '-i', args.index, '-l', 'A',
+           '-1', pipes[0], '-2', pipes[1], '-p', str(threads),
+           '-o', outDir] + extra
+    logPath = os.path.join(args.out, name + '.log')
+    with open(logPath, 'w') as log:
+        ret = subprocess.call(cmd, stdout=log, stderr=subprocess.STDOUT)
+    for w in writers:
+        w.join(1.0)
+    for p in pipes:
+        os.remove(p)
+    os.rmdir(pipeDir)
+    if ret != 0:
+        sys.exit("salmon quant failed with {} threads (see {})".format(
+            threads, logPath))
+    with open(os.path.join(outDir, 'aux_info', 'meta_info.json')) as fh:
+        return json.load(fh)['performance']
+
+
+def phaseTime(perf, name):
+    for p in perf['phases']:
+        if p['name'] == name:
+            return p['wall_time_sec']
+    return 0.0
+
+
+def main(args, extra):
+    threads = [int(t) for t in args.threads.split(',')]
+    if not os.path.exists(args.out):
+        os.makedirs(args.out)
+    txps = readFasta(args.transcripts)
+    sys.stderr.write("simulating {} fragments from {} transcripts\n".format(
+        args.numFragments, len(txps)))
+    reads = simulate(args, txps)
+
+    configs = [c.strip() for c in args.configs.split(';')]
+    phases = ['index_load', 'mapping', 'offline_em', 'write_abundances']
+    results = []
+    print('\t'.join(['config', 'threads'] + [p + '_sec' for p in phases] +
+                    ['total_sec', 'mapping_fragments_per_sec', 'speedup']))
+    for ci, config in enumerate(configs):
+        options = [] if config == 'default' else config.split()
+        base = None
+        for t in threads:
+            perf = runQuant(args, 'c{}_p{}'.format(ci, t), t, reads,
+                            options + extra)
+            mapping = phaseTime(perf, 'mapping')
+            rate = args.numFragments / mapping if mapping > 0.0 else 0.0
+            if base is None:
+                base = rate
+            speedup = rate / base if base > 0.0 else 0.0
+            print('\t'.join([config, str(t)] +
+                            ['{:.3f}'.format(phaseTime(perf, p))
+                             for p in phases] +
+                            ['{:.3f}'.format(perf['wall_time_sec']),
+                             '{:.1f}'.format(rate), '{:.2f}'.format(speedup)]))
+            sys.stdout.flush()
+            results.append({'config': config, 'threads': t,
+                            'num_fragments': args.numFragments,
+                            'mapping_fragments_per_sec': rate,
+                            'performance': perf})
+    with open(os.path.join(args.out, 'throughput.json'), 'w') as fh:
+        json.dump({'benchmarks': results}, fh, indent=4)
+
+
+if __name__ == "__main__":
+    argv = sys.argv[1:]
+    extra = []
+    if '--' in argv:
+        extra = argv[argv.index('--') + 1:]
+        argv = argv[:argv.index('--')]
+    parser = argparse.ArgumentParser(
+        description="Measure the throughput of salmon quant, at a number of "
+        "thread counts, on simulated paired-end reads")
+    parser.add_argument('--salmon', type=str, default='salmon',
+                        help="the salmon executable")
+    parser.add_argument('--index', type=str, required=True,
+                        help="the (quasi) index to quantify against")
+    parser.add_argument('--transcripts', type=str, required=True,
+                        help="the FASTA file the index was built from")
+    parser.add_argument('--out', type=str, required=True,
+                        help="the directory to write the runs to")
+    parser.add_argument('--threads', type=str, default='1,2,4,8',
+                        help="the comma-separated thread counts to run with")
+    parser.add_argument('--numFragments', type=int, default=1000000,
+                        help="the number of fragments to simulate")
+    parser.add_argument('--readLength', type=int, default=100)
+    parser.add_argument('--fragMean', type=float, default=250.0)
+    parser.add_argument('--fragSD', type=float, default=25.0)
+    parser.add_argument('--errorRate', type=float, default=0.005,
+                        help="the per-base substitution rate")
+    parser.add_argument('--duplicateFraction', type=float, default=0.0,
+                        help="the fraction of fragments that duplicate an "
+                        "earlier one")
+    parser.add_argument('--abundance', type=str, default='lognormal',
+                        help="uniform, lognormal[:sigma], zipf[:exponent], or "
+                        "a file of name<TAB>abundance lines")
+    parser.add_argument('--configs', type=str, default='default',
+                        help="the ';'-separated salmon quant option sets to "
+                        "run each thread count with ('default' for none)")
+    parser.add_argument('--seed', type=int, default=42)
+    main(parser.parse_args(argv), extra)
@@ -0,0 +1,32 @@
+#!/bin/bash
+#
+# Measure how the offline (VB)EM scales with the number of threads, with and
+# without the atomic EM updates.  Everything after the output directory is
+# passed to `salmon quant` (e.g. -i index -l A -1 r1.fq -2 r2.fq).
+#
+# usage: em_thread_scaling.sh <salmon> <out_dir> [salmon quant args ...]
+#
+# The EM time of each run is taken from the "EM took" line of the log.
+
+set -e
+
+if [ "$#" -lt 3 ]; then
+    echo "usage: $0 <salmon> <out_dir> [salmon quant args ...]"
+    exit 1
+fi
+
+salmon=$1
+outdir=$2
+shift 2
+
+threads=${THREADS:-"1 2 4 8 16 32 64"}
+
+mkdir -p ${outdir}
+printf "threads\tpartitioned_sec\tatomic_sec\n"
+for t in ${threads}; do
+    ${salmon} quant -p ${t} -o ${outdir}/p${t} "$@" > /dev/null 2>&1
+    ${salmon} quant -p ${t} --atomicEMUpdates -o ${outdir}/a${t} "$@" > /dev/null 2>&1
+    part=`sed -n 's/.*EM took \([0-9.e+-]\+\) seconds.*/\1/p' ${outdir}/p${t}/logs/salmon_quant.log`
+    atom=`sed -n 's/.*EM took \([0-9.e+-]\+\) seconds.*/\1/p' ${outdir}/a${t}/logs/salmon_quant.log`
+    printf "%s\t%s\t%s\n" ${t} ${part} ${atom}
+done
@@ -1,6 +1,10 @@
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
 #include <iostream>
+#include <limits>
 #include <map>
+#include <sstream>
 #include <tuple>
 
 #include <boost/config.hpp> // for BOOST_LIKELY/BOOST_UNLIKELY
@@ -21,6 +25,9 @@ AlignmentModel::AlignmentModel(double alpha, uint32_t readBins)
                                                  numAlignmentStates(), alpha)),
       isEnabled_(true), readBins_(readBins), burnedIn_(false) {}
 
+AlignmentModel::LocalObservations::LocalObservations()
+    : logScale_(salmon::math::LOG_0) {}
+
 bool AlignmentModel::burnedIn() { return burnedIn_; }
 void AlignmentModel::burnedIn(bool burnedIn) { burnedIn_ = burnedIn; }
 
@@ -130,7 +137,7 @@ matchStr, std::stringstream& refStr) { using salmon::stringtools::twoBitToChar;
 
 inline void AlignmentModel::setBasesFromCIGAROp_(enum cigar_op op,
                                                  size_t& curRefBase,
-                                                 size_t& curReadBase) {
+                                                 size_t& curReadBase) const {
   switch (op) {
   case BAM_UNKNOWN:
     std::cerr << "ENCOUNTERED UNKNOWN SYMBOL IN CIGAR STRING!\n";
@@ -206,11 +213,135 @@ char opToChr(enum cigar_op op) {
   return 'X';
 }
 
+/**
+ * Walk the alignment of read to ref, from readIdx in the read and
+ * uTranscriptIdx in the transcript, calling
+ * visit(readPosBin, prevStateIdx, curStateIdx) for each column.  Returns
+ * false (after logging why) if the CIGAR string refers to positions past
+ * the end of the read or of the transcript; the columns before that point
+ * will have been visited.
+ *
+ * Each operation is checked against the ends of the read and the
+ * transcript once, up front, rather than once per column, and the columns
+ * of match / mismatch operations (nearly all of them) are visited in a
+ * tight loop that just decodes the two bases and forms the state.
+ */
+template <typename VisitT>
+bool AlignmentModel::walkAlignment_(bam_seq_t* read, Transcript& ref,
+                                    size_t readIdx, size_t uTranscriptIdx,
+                                    const char* caller,
+                                    VisitT&& visit) const {
+  using namespace salmon::stringtools;
+  size_t transcriptLen = ref.RefLength;
+  uint32_t* cigar = bam_cigar(read);
+  uint32_t cigarLen = bam_cigar_len(read);
+  uint8_t* qseq = reinterpret_cast<uint8_t*>(bam_seq(read));
+  size_t readLen = static_cast<size_t>(bam_seq_len(read));
+
+  salmon::stringtools::strand readStrand = salmon::stringtools::strand::forward;
+  uint32_t readPosBin{0};
+  uint32_t prevStateIdx{startStateIdx};
+  uint32_t curStateIdx{0};
+  double invLen = static_cast<double>(readBins_) / readLen;
+
+  for (uint32_t cigarIdx = 0; cigarIdx < cigarLen; ++cigarIdx) {
+    uint32_t opLen = cigar[cigarIdx] >> BAM_CIGAR_SHIFT;
+    enum cigar_op op =
+        static_cast<enum cigar_op>(cigar[cigarIdx] & BAM_CIGAR_MASK);
+    if (opLen == 0) {
+      continue;
+    }
+    bool consumesRead = BAM_CONSUME_SEQ(op);
+    bool consumesRef = BAM_CONSUME_REF(op);
+
+    // The first column of an operation is always visited; each later one
+    // must still lie within the read (and the transcript) if the
+    // operation consumes it.
+    size_t numCols = opLen;
+    if (consumesRead) {
+      size_t left = (readIdx < readLen) ? readLen - readIdx : 0;
+      numCols = std::min(numCols, std::max(left, size_t{1}));
+    }
+    if (consumesRef) {
+      size_t left =
+          (uTranscriptIdx < transcriptLen) ? transcriptLen - uTranscriptIdx : 0;
+      numCols = std::min(numCols, std::max(left, size_t{1}));
+    }
+
+    size_t curReadBase = samToTwoBit[bam_seqi(qseq, readIdx)];
+    size_t curRefBase = samToTwoBit[ref.baseAt(uTranscriptIdx, readStrand)];
+    if (op == BAM_CMATCH or op == BAM_CBASE_MATCH or
+        op == BAM_CBASE_MISMATCH) {
+      // The first column keeps the read position bin of the previous one
+      curStateIdx = curRefBase * numStates + curReadBase;
+      visit(readPosBin, prevStateIdx, curStateIdx);
+      prevStateIdx = curStateIdx;
+      for (size_t i = 1; i < numCols; ++i) {
+        readPosBin = static_cast<uint32_t>(((readIdx + i) * invLen));
+        curStateIdx =
+            samToTwoBit[ref.baseAt(uTranscriptIdx + i, readStrand)] *
+                numStates +
+            samToTwoBit[bam_seqi(qseq, readIdx + i)];
+        visit(readPosBin, prevStateIdx, curStateIdx);
+        prevStateIdx = curStateIdx;
+      }
+    } else {
+      for (size_t i = 0; i < numCols; ++i) {
+        if (i > 0 and consumesRead) {
+          curReadBase = samToTwoBit[bam_seqi(qseq, readIdx + i)];
+          readPosBin = static_cast<uint32_t>(((readIdx + i) * invLen));
+        }
+        if (i > 0 and consumesRef) {
+          curRefBase = samToTwoBit[ref.baseAt(uTranscriptIdx + i, readStrand)];
+        }
+        setBasesFromCIGAROp_(op, curRefBase, curReadBase);
+        curStateIdx = curRefBase * numStates + curReadBase;
+        visit(readPosBin, prevStateIdx, curStateIdx);
+        prevStateIdx = curStateIdx;
+      }
+    }
+    if (consumesRead) {
+      readIdx += numCols;
+    }
+    if (consumesRef) {
+      uTranscriptIdx += numCols;
+    }
+
+    // Shouldn't happen!
+    if (numCols < opLen) {
+      if (logger_) {
+        if (consumesRead and readIdx >= readLen) {
+          logger_->warn("(in {}()) CIGAR string for read [{}] "
+                        "seems inconsistent. It refers to non-existant "
+                        "positions in the read!",
+                        caller, bam_name(read));
+          std::stringstream cigarStream;
+          for (size_t j = 0; j < cigarLen; ++j) {
+            uint32_t opLen = cigar[j] >> BAM_CIGAR_SHIFT;
+            enum cigar_op op =
+                static_cast<enum cigar_op>(cigar[j] & BAM_CIGAR_MASK);
+            cigarStream << opLen << opToChr(op);
+          }
+          logger_->warn("(in {}()) CIGAR = {}", caller, cigarStream.str());
+        } else {
+          logger_->warn(
+              "(in {}()) CIGAR string for read [{}] "
+              "seems inconsistent. It refers to non-existant "
+              "positions in the reference! Transcript name "
+              "is {}, length is {}, id is {}. Read things refid is {}",
+              caller, bam_name(read), ref.RefName, transcriptLen, ref.id,
+              bam_ref(read));
+        }
+      }
+      return false;
+    }
+  }
+  return true;
+}
+
 double AlignmentModel::logLikelihood(
     bam_seq_t* read, Transcript& ref,
     std::vector<AtomicMatrix<double>>& transitionProbs) {
-  using namespace salmon::stringtools;
-  bool useQual{false};
   size_t readIdx{0};
   auto transcriptIdx = bam_pos(read);
   size_t transcriptLen = ref.RefLength;
@@ -231,107 +362,20 @@ double AlignmentModel::logLikelihood(
     return salmon::math::LOG_0;
   }
 
-  // std::stringstream readStream, matchStream, refStream;
-
   uint32_t* cigar = bam_cigar(read);
   uint32_t cigarLen = bam_cigar_len(read);
-  uint8_t* qseq = reinterpret_cast<uint8_t*>(bam_seq(read));
-  uint8_t* qualStr = reinterpret_cast<uint8_t*>(bam_qual(read));
-  int32_t readLen = bam_seq_len(read);
-
   if (cigarLen == 0 or !cigar) {
     return salmon::math::LOG_EPSILON;
   }
 
-  salmon::stringtools::strand readStrand = salmon::stringtools::strand::forward;
   double logLike = salmon::math::LOG_1;
-
-  bool advanceInRead{false};
-  bool advanceInReference{false};
-  uint32_t readPosBin{0};
-  uint32_t cigarIdx{0};
-  uint32_t prevStateIdx{startStateIdx};
-  uint32_t curStateIdx{0};
-  double invLen = static_cast<double>(readBins_) / bam_seq_len(read);
-
-  for (uint32_t cigarIdx = 0; cigarIdx < cigarLen; ++cigarIdx) {
-    uint32_t opLen = cigar[cigarIdx] >> BAM_CIGAR_SHIFT;
-    enum cigar_op op =
-        static_cast<enum cigar_op>(cigar[cigarIdx] & BAM_CIGAR_MASK);
-    size_t curReadBase = samToTwoBit[bam_seqi(qseq, readIdx)];
-    size_t curRefBase = samToTwoBit[ref.baseAt(uTranscriptIdx, readStrand)];
-    advanceInRead = false;
-    advanceInReference = false;
-
-    for (size_t i = 0; i < opLen; ++i) {
-      if (advanceInRead) {
-        // Shouldn't happen!
-        if (readIdx >= readLen) {
-          if (logger_) {
-            logger_->warn("(in logLikelihood()) CIGAR string for read [{}] "
-                          "seems inconsistent. It refers to non-existant "
-                          "positions in the read!",
-                          bam_name(read));
-            std::stringstream cigarStream;
-            for (size_t j = 0; j < cigarLen; ++j) {
-              uint32_t opLen = cigar[j] >> BAM_CIGAR_SHIFT;
-              enum cigar_op op =
-                  static_cast<enum cigar_op>(cigar[j] & BAM_CIGAR_MASK);
-              cigarStream << opLen << opToChr(op);
-            }
-            logger_->warn("(in logLikelihood()) CIGAR = {}", cigarStream.str());
-          }
-          return logLike;
-        }
-        curReadBase = samToTwoBit[bam_seqi(qseq, readIdx)];
-        readPosBin = static_cast<uint32_t>((readIdx * invLen));
-        advanceInRead = false;
-      }
-      if (advanceInReference) {
-        // Shouldn't happen!
-        if (uTranscriptIdx >= transcriptLen) {
-          if (logger_) {
-            logger_->warn(
-                "(in logLikelihood()) CIGAR string for read [{}] "
-                "seems inconsistent. It refers to non-existant "
-                "positions in the reference! Transcript name "
-                "is {}, length is {}, id is {}. Read things refid is {}",
-                bam_name(read), ref.RefName, transcriptLen, ref.id,
-                bam_ref(read));
-          }
-          return logLike;
-        }
-        curRefBase = samToTwoBit[ref.baseAt(uTranscriptIdx, readStrand)];
-        advanceInReference = false;
-      }
-
-      setBasesFromCIGAROp_(
-          op, curRefBase, curReadBase); //, readStream, matchStream, refStream);
-      curStateIdx = curRefBase * numStates + curReadBase;
-      double tp = transitionProbs[readPosBin](prevStateIdx, curStateIdx);
-      logLike += tp;
-      prevStateIdx = curStateIdx;
-      if (BAM_CONSUME_SEQ(op)) {
-        ++readIdx;
-        advanceInRead = true;
-      }
-      if (BAM_CONSUME_REF(op)) {
-        ++uTranscriptIdx;
-        advanceInReference = true;
-      }
-    }
-  }
-
-  /*
-  {
-      std::lock_guard<std::mutex> l(outputMutex_);
-      std::cerr << "\n\nread:   " << readStream.str() << "\n";
-      std::cerr << "        " << matchStream.str() << "\n";
-      std::cerr << "ref:    " << refStream.str() << "\n";
-      //std::cerr << "states: " << stateStream.str() << "\n";
-  }
-  */
-
+  walkAlignment_(read, ref, readIdx, uTranscriptIdx, "logLikelihood",
+                 [&logLike, &transitionProbs](uint32_t readPosBin,
+                                              uint32_t prevStateIdx,
+                                              uint32_t curStateIdx) -> void {
+                   logLike +=
+                       transitionProbs[readPosBin](prevStateIdx, curStateIdx);
+                 });
   return logLike;
 }
 
@@ -413,11 +457,8 @@ void AlignmentModel::update(const UnpairedRead& hit, Transcript& ref, double p,
 void AlignmentModel::update(
     bam_seq_t* read, Transcript& ref, double p, double mass,
     std::vector<AtomicMatrix<double>>& transitionProbs) {
-  using namespace salmon::stringtools;
-  bool useQual{false};
   size_t readIdx{0};
   auto transcriptIdx = bam_pos(read);
-  size_t transcriptLen = ref.RefLength;
   // if the read starts before the beginning of the transcript,
   // only consider the part overlapping the transcript
   if (transcriptIdx < 0) {
@@ -427,123 +468,56 @@ void AlignmentModel::update(
   // unsigned version of transcriptIdx
   size_t uTranscriptIdx = static_cast<size_t>(transcriptIdx);
 
-  // std::stringstream readStream, matchStream, refStream;
-
   uint32_t* cigar = bam_cigar(read);
   uint32_t cigarLen = bam_cigar_len(read);
-  uint8_t* qseq = reinterpret_cast<uint8_t*>(bam_seq(read));
-  uint8_t* qualStr = reinterpret_cast<uint8_t*>(bam_qual(read));
-  int32_t readLen = bam_seq_len(read);
-
-  if (cigarLen > 0 and cigar) {
-
-    salmon::stringtools::strand readStrand =
-        salmon::stringtools::strand::forward;
-
-    bool advanceInRead{false};
-    bool advanceInReference{false};
-    uint32_t readPosBin{0};
-    uint32_t cigarIdx{0};
-    uint32_t prevStateIdx{startStateIdx};
-    uint32_t curStateIdx{0};
-    double invLen = static_cast<double>(readBins_) / readLen;
-
-    for (uint32_t cigarIdx = 0; cigarIdx < cigarLen; ++cigarIdx) {
-      uint32_t opLen = cigar[cigarIdx] >> BAM_CIGAR_SHIFT;
-      enum cigar_op op =
-          static_cast<enum cigar_op>(cigar[cigarIdx] & BAM_CIGAR_MASK);
-      size_t curReadBase = samToTwoBit[bam_seqi(qseq, readIdx)];
-      size_t curRefBase = samToTwoBit[ref.baseAt(uTranscriptIdx, readStrand)];
-      advanceInRead = false;
-      advanceInReference = false;
-
-      for (size_t i = 0; i < opLen; ++i) {
-        if (advanceInRead) {
-          // Shouldn't happen!
-          if (readIdx >= readLen) {
-            if (logger_) {
-              logger_->warn("(in update()) CIGAR string for read [{}] "
-                            "seems inconsistent. It refers to non-existant "
-                            "positions in the read!",
-                            bam_name(read));
-              std::stringstream cigarStream;
-              for (size_t j = 0; j < cigarLen; ++j) {
-                uint32_t opLen = cigar[j] >> BAM_CIGAR_SHIFT;
-                enum cigar_op op =
-                    static_cast<enum cigar_op>(cigar[j] & BAM_CIGAR_MASK);
-                cigarStream << opLen << opToChr(op);
-              }
-              logger_->warn("CIGAR = {}", cigarStream.str());
-            }
-            return;
-          }
-          curReadBase = samToTwoBit[bam_seqi(qseq, readIdx)];
-          readPosBin = static_cast<uint32_t>((readIdx * invLen));
-          advanceInRead = false;
-        }
-        if (advanceInReference) {
-          // Shouldn't happen!
-          if (uTranscriptIdx >= transcriptLen) {
-            if (logger_) {
-              logger_->warn(
-                  "(in update()) CIGAR string for read [{}] "
-                  "seems inconsistent. It refers to non-existant "
-                  "positions in the reference! Transcript name "
-                  "is {}, length is {}, id is {}. Read things refid is {}",
-                  bam_name(read), ref.RefName, transcriptLen, ref.id,
-                  bam_ref(read));
-            }
-            return;
-          }
-          curRefBase = samToTwoBit[ref.baseAt(uTranscriptIdx, readStrand)];
-          advanceInReference = false;
-        }
-
-        setBasesFromCIGAROp_(
-            op, curRefBase,
-            curReadBase); //, readStream, matchStream, refStream);
-        curStateIdx = curRefBase * numStates + curReadBase;
-
-        // update the state in the actual model
-        transitionProbs[readPosBin].increment(prevStateIdx, curStateIdx,
-                                              mass + p);
+  if (cigarLen == 0 or !cigar) {
+    return;
+  }
 
-        prevStateIdx = curStateIdx;
-        if (BAM_CONSUME_SEQ(op)) {
-          ++readIdx;
-          advanceInRead = true;
-          /* DEBUG -- print what happened
-             std::cerr << "read name = " << bam_name(read) << "\n";
-             std::cerr << "curReadBase = " << readIdx << "\n";
-             std::cerr << "readLen = " << bam_seq_len(read) << "\n";
-             std::cerr << "ref = ";
-             for (size_t j = 0; j <
-             std::min(static_cast<size_t>(bam_seq_len(read)),
-             static_cast<size_t>(transcriptLen - transcriptIdx)); ++j) {
-             std::cerr << salmon::stringtools::samCodeToChar[ref.baseAt(j,
-             readStrand)];
-             }
-             std::cerr << "\n";
-             std::cerr << "read = ";
-             for (size_t j = 0; j < bam_seq_len(read); ++j) {
-             std::cerr << salmon::stringtools::samCodeToChar[bam_seqi(qseq, j)];
-             }
-             std::cerr << "\nCIGAR = ";
-             for (size_t j = 0; j < cigarLen; ++j) {
-             uint32_t opLen = cigar[j] >> BAM_CIGAR_SHIFT;
-             enum cigar_op op = static_cast<enum cigar_op>(cigar[j] &
-             BAM_CIGAR_MASK); std::cerr << opLen << opToChr(op);
-             }
-             std::cerr << "\n";
-             */
+  // Most of the columns of a read repeat a handful of transitions, so
+  // count them first, in a small open-addressing table, and then add each
+  // distinct one to the model once (with log(its count) added to the
+  // mass), rather than paying for two atomic log-space increments per
+  // column.  Should the table fill up, the remaining transitions are
+  // added one at a time.
+  constexpr uint32_t n = numAlignmentStates();
+  constexpr uint32_t tableSize = 256;
+  constexpr uint32_t emptyKey = std::numeric_limits<uint32_t>::max();
+  uint32_t keys[tableSize];
+  uint32_t counts[tableSize];
+  std::fill(keys, keys + tableSize, emptyKey);
+  uint32_t numKeys{0};
+  double amt = mass + p;
+  walkAlignment_(
+      read, ref, readIdx, uTranscriptIdx, "update",
+      [&](uint32_t readPosBin, uint32_t prevStateIdx,
+          uint32_t curStateIdx) -> void {
+        uint32_t key = (readPosBin * n + prevStateIdx) * n + curStateIdx;
+        uint32_t slot = (key * 2654435761u) >> 24;
+        while (keys[slot] != emptyKey and keys[slot] != key) {
+          slot = (slot + 1) % tableSize;
         }
-        if (BAM_CONSUME_REF(op)) {
-          ++uTranscriptIdx;
-          advanceInReference = true;
+        if (keys[slot] == key) {
+          ++counts[slot];
+        } else if (numKeys < (3 * tableSize) / 4) {
+          keys[slot] = key;
+          counts[slot] = 1;
+          ++numKeys;
+        } else {
+          transitionProbs[readPosBin].increment(prevStateIdx, curStateIdx,
+                                                amt);
         }
-      }
+      });
+
+  for (uint32_t slot = 0; slot < tableSize; ++slot) {
+    uint32_t key = keys[slot];
+    if (key == emptyKey) {
+      continue;
     }
-  } // if we had a cigar string
+    double logCount = (counts[slot] == 1) ? 0.0 : std::log(counts[slot]);
+    transitionProbs[key / (n * n)].increment((key / n) % n, key % n,
+                                             amt + logCount);
+  }
 }
 
 void AlignmentModel::update(const ReadPair& hit, Transcript& ref, double p,
@@ -571,6 +545,108 @@ void AlignmentModel::update(const ReadPair& hit, Transcript& ref, double p,
   }
 }
 
+void AlignmentModel::update(bam_seq_t* read, Transcript& ref, double p,
+                            double mass, uint32_t tableOffset,
+                            LocalObservations& local) const {
+  size_t readIdx{0};
+  auto transcriptIdx = bam_pos(read);
+  // if the read starts before the beginning of the transcript,
+  // only consider the part overlapping the transcript
+  if (transcriptIdx < 0) {
+    readIdx = -transcriptIdx;
+    transcriptIdx = 0;
+  }
+  // unsigned version of transcriptIdx
+  size_t uTranscriptIdx = static_cast<size_t>(transcriptIdx);
+
+  uint32_t* cigar = bam_cigar(read);
+  uint32_t cigarLen = bam_cigar_len(read);
+  if (cigarLen == 0 or !cigar) {
+    return;
+  }
+
+  constexpr uint32_t n = numAlignmentStates();
+  if (local.weights_.size() != 2 * readBins_ * n * n) {
+    local.weights_.assign(2 * readBins_ * n * n, 0.0);
+    local.touched_.clear();
+    local.logScale_ = salmon::math::LOG_0;
+  }
+  // Keep the weights relative to the largest mass seen so far
+  double amt = mass + p;
+  if (local.touched_.empty() or amt > local.logScale_) {
+    double rescale = local.touched_.empty()
+                         ? 0.0
+                         : std::exp(local.logScale_ - amt);
+    for (auto k : local.touched_) {
+      local.weights_[k] *= rescale;
+    }
+    local.logScale_ = amt;
+  }
+  double w = std::exp(amt - local.logScale_);
+  uint32_t base = tableOffset * n * n;
+  walkAlignment_(read, ref, readIdx, uTranscriptIdx, "update",
+                 [&local, w, base](uint32_t readPosBin, uint32_t prevStateIdx,
+                                   uint32_t curStateIdx) -> void {
+                   uint32_t k = base + (readPosBin * n + prevStateIdx) * n +
+                                curStateIdx;
+                   double& weight = local.weights_[k];
+                   if (weight == 0.0) {
+                     local.touched_.push_back(k);
+                   }
+                   weight += w;
+                 });
+}
+
+void AlignmentModel::update(const UnpairedRead& hit, Transcript& ref, double p,
+                            double mass, LocalObservations& local) const {
+  if (mass == salmon::math::LOG_0) {
+    return;
+  }
+  if (BOOST_UNLIKELY(!isEnabled_)) {
+    return;
+  }
+  update(hit.read, ref, p, mass, 0, local);
+}
+
+void AlignmentModel::update(const ReadPair& hit, Transcript& ref, double p,
+                            double mass, LocalObservations& local) const {
+  if (mass == salmon::math::LOG_0) {
+    return;
+  }
+  if (BOOST_UNLIKELY(!isEnabled_)) {
+    return;
+  }
+
+  uint32_t rightOffset = static_cast<uint32_t>(readBins_);
+  if (hit.isPaired()) {
+    bam_seq_t* leftRead =
+        (bam_pos(hit.read1) < bam_pos(hit.read2)) ? hit.read1 : hit.read2;
+    bam_seq_t* rightRead =
+        (bam_pos(hit.read1) < bam_pos(hit.read2)) ? hit.read2 : hit.read1;
+    update(leftRead, ref, p, mass, 0, local);
+    update(rightRead, ref, p, mass, rightOffset, local);
+  } else if (hit.isLeftOrphan()) {
+    update(hit.read1, ref, p, mass, 0, local);
+  } else if (hit.isRightOrphan()) {
+    update(hit.read1, ref, p, mass, rightOffset, local);
+  }
+}
+
+void AlignmentModel::addObservations(LocalObservations& local) {
+  constexpr uint32_t n = numAlignmentStates();
+  for (auto k : local.touched_) {
+    uint32_t table = k / (n * n);
+    auto& transitionProbs = (table < readBins_)
+                                ? transitionProbsLeft_[table]
+                                : transitionProbsRight_[table - readBins_];
+    transitionProbs.increment((k / n) % n, k % n,
+                              local.logScale_ + std::log(local.weights_[k]));
+    local.weights_[k] = 0.0;
+  }
+  local.touched_.clear();
+  local.logScale_ = salmon::math::LOG_0;
+}
+
 // CIGAR string with printing
 /*
     std::stringstream readStr;
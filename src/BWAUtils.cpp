@@ -1,5 +1,7 @@
 #include "BWAUtils.hpp"
 
+#include <algorithm>
+
 namespace bwautils {
 static void bwt_reverse_intvs(bwtintv_v* p) {
   if (p->n > 1) {
@@ -64,13 +66,53 @@ bool getIntervalForKmer(const bwt_t* bwt, // the bwt index
   }
 }
 
-// NOTE: $max_intv is not currently used in BWA-MEM
-// NOTE: Modified from the original functions to take an initial interval for
-// the search query
-int bwt_smem1a_with_kmer(const bwt_t* bwt, int len, const uint8_t* q, int x,
-                         int min_intv, uint64_t max_intv,
-                         bwtintv_t initial_interval, bwtintv_v* mem,
-                         bwtintv_v* tmpvec[2]) {
+void PrefixIntervalTable::build(const bwt_t* bwt, uint32_t k) {
+  k_ = k;
+  intervals_.assign(3 * offset_(k + 1), 0);
+  if (k == 0) {
+    return;
+  }
+  bwtintv_t ik, ok[4];
+  for (int c = 0; c < 4; ++c) {
+    bwt_set_intv(bwt, c, ik);
+    uint64_t* dest = &intervals_[3 * (offset_(1) + c)];
+    dest[0] = ik.x[0];
+    dest[1] = ik.x[1];
+    dest[2] = ik.x[2];
+  }
+  for (uint32_t len = 1; len < k; ++len) {
+    uint64_t numCodes = uint64_t(1) << (2 * len);
+    for (uint64_t code = 0; code < numCodes; ++code) {
+      const uint64_t* parent = interval(len, code);
+      // Strings that don't occur have no extensions (left all 0)
+      if (parent[2] == 0) {
+        continue;
+      }
+      ik.x[0] = parent[0];
+      ik.x[1] = parent[1];
+      ik.x[2] = parent[2];
+      bwt_extend(bwt, &ik, ok, 0);
+      for (int b = 0; b < 4; ++b) {
+        // As in the forward search of bwt_smem1, appending base b selects
+        // the interval of its complement
+        const bwtintv_t& child = ok[3 - b];
+        uint64_t* dest = &intervals_[3 * (offset_(len + 1) + (code << 2) + b)];
+        dest[0] = child.x[0];
+        dest[1] = child.x[1];
+        dest[2] = child.x[2];
+      }
+    }
+  }
+}
+
+// Function modified from bwt_smem1a (with max_intv = 0, as bwt_smem1 calls
+// it):
+// https://github.com/lh3/bwa/blob/eb428d7d31ced059ad39af2701a22ebe6d175657/bwt.c#L289
+int bwt_smem1_with_prefixes(const bwt_t* bwt,
+                            const PrefixIntervalTable& prefixes, int len,
+                            const uint8_t* q, int x, int min_intv,
+                            bwtintv_v* mem, bwtintv_v* tmpvec[2],
+                            const KmerIntervalMap* kmers) {
   int i, j, c, ret;
   bwtintv_t ik, ok[4];
   bwtintv_v a[2], *prev, *curr, *swap;
@@ -85,24 +127,46 @@ int bwt_smem1a_with_kmer(const bwt_t* bwt, int len, const uint8_t* q, int x,
   prev = tmpvec && tmpvec[0] ? tmpvec[0]
                              : &a[0]; // use the temporary vector if provided
   curr = tmpvec && tmpvec[1] ? tmpvec[1] : &a[1];
-  // bwt_set_intv(bwt, q[x], ik); // the initial interval of a single base
-  // ik.info = x + 1;
-
-  // ROB: set ik to our initial interval
-  ik.x[0] = initial_interval.x[0];
-  ik.x[1] = initial_interval.x[1];
-  ik.x[2] = initial_interval.x[2];
-  // Is this last one right?
-  int k = initial_interval.info;
-  ik.info = x + k;
+  bwt_set_intv(bwt, q[x], ik); // the initial interval of a single base
+  ik.info = x + 1;
 
-  for (i = x + k, curr->n = 0; i < len; ++i) { // forward search
-    if (ik.x[2] < max_intv) {                  // an interval small enough
-      kv_push(bwtintv_t, *curr, ik);
-      break;
-    } else if (q[i] < 4) { // an A/C/G/T base
-      c = 3 - q[i];        // complement of q[i]
-      bwt_extend(bwt, &ik, ok, 0);
+  // The code of the string q[x, i), for the table lookups
+  uint64_t code = q[x];
+  int tableEnd = std::min(len, x + static_cast<int>(prefixes.k()));
+  // The interval of the k-mer q[x, kmerEnd), if the map has it
+  const uint64_t* kmerInterval{nullptr};
+  int kmerEnd = x + static_cast<int>(kmers ? kmers->k() : 0);
+  if (kmers and kmerEnd > tableEnd and kmerEnd <= len) {
+    uint64_t kmerCode{0};
+    for (i = x; i < kmerEnd and q[i] < 4; ++i) {
+      kmerCode = (kmerCode << 2) | q[i];
+    }
+    if (i == kmerEnd) {
+      kmerInterval = kmers->find(kmerCode);
+    }
+  }
+  for (i = x + 1, curr->n = 0; i < len; ++i) { // forward search
+    if (kmerInterval and i >= tableEnd and i < kmerEnd and
+        ik.x[2] == kmerInterval[2]) {
+      // The interval won't change size before the end of the k-mer
+      ik.x[0] = kmerInterval[0];
+      ik.x[1] = kmerInterval[1];
+      ik.x[2] = kmerInterval[2];
+      ik.info = kmerEnd;
+      i = kmerEnd - 1;
+      continue;
+    }
+    if (q[i] < 4) { // an A/C/G/T base
+      c = 3 - q[i];                            // complement of q[i]
+      if (i < tableEnd) {
+        code = (code << 2) | q[i];
+        const uint64_t* next = prefixes.interval(i - x + 1, code);
+        ok[c].x[0] = next[0];
+        ok[c].x[1] = next[1];
+        ok[c].x[2] = next[2];
+      } else {
+        bwt_extend(bwt, &ik, ok, 0);
+      }
       if (ok[c].x[2] != ik.x[2]) { // change of the interval size
         kv_push(bwtintv_t, *curr, ik);
         if (ok[c].x[2] < min_intv)
@@ -131,9 +195,18 @@ int bwt_smem1a_with_kmer(const bwt_t* bwt, int len, const uint8_t* q, int x,
             : q[i] < 4 ? q[i] : -1; // c==-1 if i<0 or q[i] is an ambiguous base
     for (j = 0, curr->n = 0; j < prev->n; ++j) {
       bwtintv_t* p = &prev->a[j];
-      if (c >= 0 && ik.x[2] >= max_intv)
+      if (c >= 0) {
+        // The backward extension of the next interval reads the occurrence
+        // blocks around its x[0] - 1 and x[0] - 1 + x[2]; fetch them while
+        // this one is extended
+        if (j + 1 < prev->n and prev->a[j + 1].x[0] > 0) {
+          const bwtintv_t* n = &prev->a[j + 1];
+          __builtin_prefetch(bwt_occ_intv(bwt, n->x[0] - 1));
+          __builtin_prefetch(bwt_occ_intv(bwt, n->x[0] - 1 + n->x[2]));
+        }
         bwt_extend(bwt, p, ok, 1);
-      if (c < 0 || ik.x[2] < max_intv ||
+      }
+      if (c < 0 ||
           ok[c].x[2] < min_intv) { // keep the hit if reaching the beginning or
                                    // an ambiguous base or the intv is small
                                    // enough
@@ -165,11 +238,4 @@ int bwt_smem1a_with_kmer(const bwt_t* bwt, int len, const uint8_t* q, int x,
     free(a[1].a);
   return ret;
 }
-
-int bwt_smem1_with_kmer(const bwt_t* bwt, int len, const uint8_t* q, int x,
-                        int min_intv, bwtintv_t initial_interval,
-                        bwtintv_v* mem, bwtintv_v* tmpvec[2]) {
-  return bwt_smem1a_with_kmer(bwt, len, q, x, min_intv, 0, initial_interval,
-                              mem, tmpvec);
-}
 } // namespace bwautils
@@ -36,7 +36,9 @@
 #include "tbb/task_scheduler_init.h"
 
 #include "GenomicFeature.hpp"
+#include "IndexBuildStats.hpp"
 #include "SalmonIndex.hpp"
+#include "SalmonLogging.hpp"
 #include "SalmonUtils.hpp"
 #include "Transcript.hpp"
 #include "spdlog/fmt/fmt.h"
@@ -64,6 +66,7 @@ int salmonIndex(int argc, char* argv[]) {
   string indexTypeStr = "fmd";
   uint32_t saSampInterval = 1;
   uint32_t auxKmerLen = 0;
+  uint32_t fmdAuxKmerLen = 0;
   uint32_t numThreads;
   bool useQuasi{false};
   bool perfectHash{false};
@@ -109,7 +112,14 @@ int salmonIndex(int argc, char* argv[]) {
       "The interval at which the suffix array should be sampled. "
       "Smaller values are faster, but produce a larger index. "
       "The default should be OK, unless your transcriptome is huge. "
-      "This value should be a power of 2.");
+      "This value should be a power of 2.")(
+      "auxKmerLen",
+      po::value<uint32_t>(&fmdAuxKmerLen)->default_value(0),
+      "[fmd index only] Also store the BWT interval of every k-mer of this "
+      "length (at most 31) in the transcriptome, so that the seed searches "
+      "can skip ahead to the end of a k-mer.  Longer k-mers skip further, "
+      "but the table takes 64-128 bytes per distinct k-mer.  0 (the default) "
+      "builds no such table.");
 
   po::variables_map vm;
   int ret = 0;
@@ -149,6 +159,15 @@ Creates a salmon index.
       throw(std::logic_error(errWriter.str()));
     }
 
+    uint32_t maxAuxKmerLen = KmerIntervalMap::maxK;
+    if (!useQuasi and fmdAuxKmerLen > maxAuxKmerLen) {
+      fmt::MemoryWriter errWriter;
+      errWriter << "Error: The auxiliary k-mer length can be at most "
+                << maxAuxKmerLen << ", but " << fmdAuxKmerLen
+                << " was provided.";
+      throw(std::logic_error(errWriter.str()));
+    }
+
     string transcriptFile = vm["transcripts"].as<string>();
     bfs::path indexDirectory(vm["index"].as<string>());
 
@@ -172,10 +191,11 @@ Creates a salmon index.
                 << " . . . creating it\n";
       bfs::create_directories(indexDirectory);
     }
+    IndexBuildStats buildStats(indexDirectory);
 
     bfs::path logPath = indexDirectory / "indexing.log";
     size_t max_q_size = 2097152;
-    // spdlog::set_async_mode(max_q_size);
+    salmon::logging::setAsyncMode(max_q_size);
 
     auto fileSink = std::make_shared<spdlog::sinks::simple_file_sink_mt>(
         logPath.string(), true);
@@ -244,18 +264,22 @@ Creates a salmon index.
       argVec->push_back(outputPrefix.string());
       argVec->push_back(transcriptFile);
       sidx.reset(new SalmonIndex(jointLog, SalmonIndexType::FMD));
-      // Disable the auxiliary k-mer index for now
-      auxKmerLen = 0;
+      // The (optional) auxiliary k-mer index has its own k-mer length
+      auxKmerLen = fmdAuxKmerLen;
     }
 
     jointLog->info("building index");
+    // Reading the transcripts, building the suffix array and hash, and
+    // writing them out all happen inside the indexer, so they're timed as
+    // one phase.
+    buildStats.startPhase("build");
     sidx->build(indexDirectory, *(argVec.get()), auxKmerLen);
+    buildStats.endPhase();
     jointLog->info("done building index");
-    // If we want to build the auxiliary k-mer index, do it here.
-    /*
-    uint32_t k = 15;
-    buildAuxKmerIndex(outputPrefix, k, jointLog);
-    */
+    if (!buildStats.save(indexTypeStr, numThreads)) {
+      jointLog->warn("Couldn't write index_build_stats.json to {}",
+                     indexDirectory.string());
+    }
 
   } catch (po::error& e) {
     std::cerr << "exception : [" << e.what() << "]. Exiting.\n";
@@ -270,5 +294,7 @@ Creates a salmon index.
               << " index --help\nExiting.\n";
     ret = 1;
   }
+  // Write out whatever the (asynchronous) loggers still have queued
+  spdlog::drop_all();
   return ret;
 }
@@ -0,0 +1,133 @@
+#include "CPUDispatch.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                              \
+    (defined(__GNUC__) || defined(__clang__))
+#define SALMON_CPU_DISPATCH_X86 1
+#endif
+
+namespace salmon {
+namespace cpu {
+
+namespace {
+// The instruction sets of the CPU, detected once
+struct Features {
+  bool sse2{false};
+  bool sse42{false};
+  bool avx2{false};
+  bool avx512{false};
+  bool neon{false};
+
+  Features() {
+#ifdef SALMON_CPU_DISPATCH_X86
+    __builtin_cpu_init();
+    sse2 = __builtin_cpu_supports("sse2");
+    sse42 = __builtin_cpu_supports("sse4.2");
+    avx2 = __builtin_cpu_supports("avx2");
+    avx512 = __builtin_cpu_supports("avx512f");
+#elif defined(__ARM_NEON)
+    neon = true;
+#endif
+  }
+};
+
+const Features& features() {
+  static Features f;
+  return f;
+}
+
+// The most capable ISA (of any architecture) that supports() allows
+ISA& maxISA() {
+  static ISA cap{ISA::neon};
+  return cap;
+}
+
+std::vector<void (*)()>& choosers() {
+  static std::vector<void (*)()> c;
+  return c;
+}
+
+std::map<std::string, ISA>& choices() {
+  static std::map<std::string, ISA> c;
+  return c;
+}
+} // namespace
+
+const char* isaName(ISA isa) {
+  switch (isa) {
+  case ISA::sse2:
+    return "sse2";
+  case ISA::sse42:
+    return "sse4.2";
+  case ISA::avx2:
+    return "avx2";
+  case ISA::avx512:
+    return "avx512";
+  case ISA::neon:
+    return "neon";
+  default:
+    return "scalar";
+  }
+}
+
+bool supports(ISA isa) {
+  // The cap only orders the x86 sets; neon is allowed by any cap above
+  // scalar.
+  auto cap = maxISA();
+  if (isa != ISA::scalar and cap == ISA::scalar) {
+    return false;
+  }
+  if (isa != ISA::neon and cap != ISA::neon and isa > cap) {
+    return false;
+  }
+  auto& f = features();
+  switch (isa) {
+  case ISA::sse2:
+    return f.sse2;
+  case ISA::sse42:
+    return f.sse42;
+  case ISA::avx2:
+    return f.avx2;
+  case ISA::avx512:
+    return f.avx512;
+  case ISA::neon:
+    return f.neon;
+  default:
+    return true;
+  }
+}
+
+void record(const char* kernel, ISA isa) { choices()[kernel] = isa; }
+
+Registration::Registration(void (*chooser)()) {
+  choosers().push_back(chooser);
+  chooser();
+}
+
+void init() {
+  maxISA() = ISA::neon;
+  if (const char* cap = std::getenv("SALMON_MAX_ISA")) {
+    for (auto isa : {ISA::scalar, ISA::sse2, ISA::sse42, ISA::avx2,
+                     ISA::avx512, ISA::neon}) {
+      if (std::strcmp(cap, isaName(isa)) == 0) {
+        maxISA() = isa;
+      }
+    }
+  }
+  for (auto chooser : choosers()) {
+    chooser();
+  }
+}
+
+std::vector<KernelVariant> chosenVariants() {
+  std::vector<KernelVariant> variants;
+  for (auto& c : choices()) {
+    variants.push_back(KernelVariant{c.first, isaName(c.second)});
+  }
+  return variants;
+}
+} // namespace cpu
+} // namespace salmon
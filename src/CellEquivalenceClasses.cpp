@@ -0,0 +1,240 @@
+#include "CellEquivalenceClasses.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+#include "tbb/parallel_sort.h"
+
+bool CellEquivalenceClasses::encodeUMI(const char* umi, size_t len,
+                                       uint64_t& code) {
+  if (len > 32) {
+    return false;
+  }
+  code = 0;
+  for (size_t i = 0; i < len; ++i) {
+    uint64_t c;
+    switch (umi[i]) {
+    case 'A':
+    case 'a':
+      c = 0;
+      break;
+    case 'C':
+    case 'c':
+      c = 1;
+      break;
+    case 'G':
+    case 'g':
+      c = 2;
+      break;
+    case 'T':
+    case 't':
+      c = 3;
+      break;
+    default:
+      return false;
+    }
+    code = (code << 2) | c;
+  }
+  return true;
+}
+
+uint32_t CellEquivalenceClasses::cellID(const char* barcode, size_t len) {
+  std::string bc(barcode, len);
+  uint32_t id;
+  if (cellIDs_.find(bc, id)) {
+    return id;
+  }
+  std::lock_guard<std::mutex> lock(idMut_);
+  if (cellIDs_.find(bc, id)) {
+    return id;
+  }
+  id = static_cast<uint32_t>(barcodes_.size());
+  barcodes_.push_back(bc);
+  cellIDs_.insert(bc, id);
+  return id;
+}
+
+uint32_t
+CellEquivalenceClasses::eqClassID(const std::vector<uint32_t>& txps) {
+  uint32_t id;
+  if (eqIDs_.find(txps, id)) {
+    return id;
+  }
+  std::lock_guard<std::mutex> lock(idMut_);
+  if (eqIDs_.find(txps, id)) {
+    return id;
+  }
+  id = static_cast<uint32_t>(labels_.size());
+  labels_.push_back(txps);
+  eqIDs_.insert(txps, id);
+  return id;
+}
+
+void CellEquivalenceClasses::merge(Local& local) {
+  std::lock_guard<std::mutex> lock(mergeMut_);
+  records_.insert(records_.end(), local.records_.begin(),
+                  local.records_.end());
+  std::vector<Record>().swap(local.records_);
+}
+
+void CellEquivalenceClasses::finish() {
+  numRecords_ = records_.size();
+  tbb::parallel_sort(records_.begin(), records_.end(),
+                     [](const Record& a, const Record& b) -> bool {
+                       return (a.cell != b.cell)
+                                  ? (a.cell < b.cell)
+                                  : ((a.eqID != b.eqID) ? (a.eqID < b.eqID)
+                                                        : (a.umi < b.umi));
+                     });
+
+  cellClasses_.clear();
+  cellOffsets_.assign(barcodes_.size() + 1, 0);
+  size_t i = 0;
+  while (i < records_.size()) {
+    auto cell = records_[i].cell;
+    auto eqID = records_[i].eqID;
+    uint32_t numUMIs{0};
+    uint64_t prevUMI{0};
+    for (; i < records_.size() and records_[i].cell == cell and
+           records_[i].eqID == eqID;
+         ++i) {
+      if (numUMIs == 0 or records_[i].umi != prevUMI) {
+        ++numUMIs;
+        prevUMI = records_[i].umi;
+      }
+    }
+    cellClasses_.push_back(CellClass{eqID, numUMIs});
+    ++cellOffsets_[cell + 1];
+  }
+  for (size_t c = 1; c < cellOffsets_.size(); ++c) {
+    cellOffsets_[c] += cellOffsets_[c - 1];
+  }
+  std::vector<Record>().swap(records_);
+}
+
+uint64_t CellEquivalenceClasses::cellUMIs(uint32_t cell) const {
+  uint64_t total{0};
+  auto classes = cellClasses(cell);
+  for (auto it = classes.first; it != classes.second; ++it) {
+    total += it->numUMIs;
+  }
+  return total;
+}
+
+std::vector<std::vector<std::pair<uint32_t, double>>>
+CellEquivalenceClasses::quantify(uint64_t minUMIs, double relDiffTolerance,
+                                 uint32_t maxIter) const {
+  std::vector<std::vector<std::pair<uint32_t, double>>> estimates(numCells());
+  tbb::parallel_for(
+      tbb::blocked_range<size_t>(0, numCells()),
+      [&](const tbb::blocked_range<size_t>& range) -> void {
+        std::vector<uint32_t> txps;
+        std::vector<double> alphas;
+        std::vector<double> newAlphas;
+        for (auto cell = range.begin(); cell != range.end(); ++cell) {
+          if (cellUMIs(cell) < minUMIs) {
+            continue;
+          }
+          auto classes = cellClasses(cell);
+
+          // The transcripts of this cell (its EM is over those alone)
+          txps.clear();
+          for (auto it = classes.first; it != classes.second; ++it) {
+            auto& l = labels_[it->eqID];
+            txps.insert(txps.end(), l.begin(), l.end());
+          }
+          std::sort(txps.begin(), txps.end());
+          txps.erase(std::unique(txps.begin(), txps.end()), txps.end());
+          auto localID = [&txps](uint32_t t) -> size_t {
+            return std::lower_bound(txps.begin(), txps.end(), t) - txps.begin();
+          };
+
+          alphas.assign(txps.size(), 1.0 / txps.size());
+          newAlphas.assign(txps.size(), 0.0);
+          for (uint32_t iter = 0; iter < maxIter; ++iter) {
+            for (auto it = classes.first; it != classes.second; ++it) {
+              auto& l = labels_[it->eqID];
+              if (l.size() == 1) {
+                newAlphas[localID(l.front())] += it->numUMIs;
+                continue;
+              }
+              double denom{0.0};
+              for (auto t : l) {
+                denom += alphas[localID(t)];
+              }
+              if (denom <= 0.0) {
+                continue;
+              }
+              double norm = it->numUMIs / denom;
+              for (auto t : l) {
+                auto lt = localID(t);
+                newAlphas[lt] += alphas[lt] * norm;
+              }
+            }
+            bool converged{true};
+            for (size_t j = 0; j < alphas.size(); ++j) {
+              if (newAlphas[j] > 1e-8 and
+                  std::abs(newAlphas[j] - alphas[j]) / newAlphas[j] >
+                      relDiffTolerance) {
+                converged = false;
+              }
+            }
+            alphas.swap(newAlphas);
+            std::fill(newAlphas.begin(), newAlphas.end(), 0.0);
+            if (converged) {
+              break;
+            }
+          }
+
+          auto& est = estimates[cell];
+          for (size_t j = 0; j < txps.size(); ++j) {
+            if (alphas[j] > 1e-8) {
+              est.emplace_back(txps[j], alphas[j]);
+            }
+          }
+        }
+      });
+  return estimates;
+}
+
+bool CellEquivalenceClasses::writeMatrix(
+    const boost::filesystem::path& outDir,
+    const std::vector<std::pair<uint32_t, double>>* begin,
+    const std::vector<std::pair<uint32_t, double>>* end,
+    const std::vector<std::string>& txpNames) const {
+  std::ofstream rows((outDir / "quants_mat_rows.txt").string());
+  std::ofstream cols((outDir / "quants_mat_cols.txt").string());
+  std::ofstream mat((outDir / "quants_mat.mtx").string());
+  if (!rows.good() or !cols.good() or !mat.good()) {
+    return false;
+  }
+  for (auto& n : txpNames) {
+    cols << n << '\n';
+  }
+
+  size_t numRows{0};
+  size_t numEntries{0};
+  for (auto it = begin; it != end; ++it) {
+    if (!it->empty()) {
+      ++numRows;
+      numEntries += it->size();
+    }
+  }
+  mat << "%%MatrixMarket matrix coordinate real general\n";
+  mat << numRows << ' ' << txpNames.size() << ' ' << numEntries << '\n';
+  size_t row{0};
+  for (auto it = begin; it != end; ++it) {
+    if (it->empty()) {
+      continue;
+    }
+    ++row;
+    rows << barcodes_[it - begin] << '\n';
+    for (auto& e : *it) {
+      mat << row << ' ' << (e.first + 1) << ' ' << e.second << '\n';
+    }
+  }
+  return rows.good() and cols.good() and mat.good();
+}
@@ -1,4 +1,7 @@
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <numeric>
 #include <unordered_map>
 #include <vector>
 
@@ -10,7 +13,6 @@
 #include "tbb/task_scheduler_init.h"
 
 //#include "fastapprox.h"
-#include <boost/math/special_functions/digamma.hpp>
 
 // C++ string formatting library
 #include "spdlog/fmt/fmt.h"
@@ -19,9 +21,16 @@
 #include "cuckoohash_map.hh"
 
 #include "AlignmentLibrary.hpp"
+#include "AsyncBootstrapWriter.hpp"
 #include "BootstrapWriter.hpp"
 #include "CollapsedEMOptimizer.hpp"
+#include "CountVariance.hpp"
+#include "EMKernels.hpp"
+#include "EqClassPartition.hpp"
+#include "FlatEquivalenceClasses.hpp"
+#include "MemoryBudget.hpp"
 #include "MultinomialSampler.hpp"
+#include "PartialExperiment.hpp"
 #include "ReadExperiment.hpp"
 #include "ReadPair.hpp"
 #include "SalmonMath.hpp"
@@ -38,6 +47,22 @@ constexpr double minWeight = std::numeric_limits<double>::denorm_min();
 // A bit more conservative of a minimum as an argument to the digamma function.
 constexpr double digammaMin = 1e-10;
 
+// The EM kernels operate on raw arrays of doubles; these give such a view
+// of either kind of count vector.
+static_assert(sizeof(tbb::atomic<double>) == sizeof(double),
+              "tbb::atomic<double> must have the layout of a double");
+
+inline const double* rawValues(const std::vector<double>& v) {
+  return v.data();
+}
+inline double* rawValues(std::vector<double>& v) { return v.data(); }
+inline const double* rawValues(const std::vector<tbb::atomic<double>>& v) {
+  return reinterpret_cast<const double*>(v.data());
+}
+inline double* rawValues(std::vector<tbb::atomic<double>>& v) {
+  return reinterpret_cast<double*>(v.data());
+}
+
 double normalize(std::vector<tbb::atomic<double>>& vec) {
   double sum{0.0};
   for (auto& v : vec) {
@@ -108,45 +133,191 @@ std::vector<double> populatePriorAlphas_(
   return priorAlphas;
 }
 
+/**
+ * The parts of the VBEM update that depend only on the prior, computed once
+ * and shared by all of the bootstrap samples: the sum of the prior, and
+ * exp(digamma(prior[i])), which is expTheta[i] (before normalization) for
+ * each transcript whose abundance is 0 --- most of them, in a sample.
+ */
+struct VBEMPriorTerms {
+  explicit VBEMPriorTerms(const std::vector<double>& priorAlphas)
+      : alphas(priorAlphas), expDigamma(priorAlphas.size(), 0.0) {
+    for (size_t i = 0; i < alphas.size(); ++i) {
+      sum += alphas[i];
+      if (alphas[i] > ::digammaMin) {
+        expDigamma[i] = std::exp(salmon::emkernels::digamma(alphas[i]));
+      }
+    }
+  }
+
+  const std::vector<double>& alphas;
+  double sum{0.0};
+  std::vector<double> expDigamma;
+};
+
+/**
+ * The contribution of the classes begin ... end-1 to the
+ * log-likelihood of the (unnormalized) abundances alpha, where
+ * logAlphaSum = log(sum(alpha)).
+ */
+inline double logLikelihoodRange_(const FlatEquivalenceClasses& eqClasses,
+                                  const std::vector<uint64_t>& counts,
+                                  const double* alpha, double logAlphaSum,
+                                  size_t begin, size_t end) {
+  const uint32_t* txps = eqClasses.txps.data();
+  const double* auxs = eqClasses.combinedWeights.data();
+  double ll{0.0};
+  for (size_t eqID = begin; eqID < end; ++eqID) {
+    if (counts[eqID] == 0) {
+      continue;
+    }
+    size_t start = eqClasses.offsets[eqID];
+    double denom = salmon::emkernels::gatherDot(
+        alpha, txps + start, auxs + start, eqClasses.offsets[eqID + 1] - start);
+    ll += counts[eqID] * (std::log(denom) - logAlphaSum);
+  }
+  return ll;
+}
+
+/**
+ * The log-likelihood of alpha given the class counts `counts`.
+ */
+double logLikelihood_(const FlatEquivalenceClasses& eqClasses,
+                      const std::vector<uint64_t>& counts, const double* alpha,
+                      size_t numTranscripts) {
+  double alphaSum = std::accumulate(alpha, alpha + numTranscripts, 0.0);
+  return logLikelihoodRange_(eqClasses, counts, alpha, std::log(alphaSum), 0,
+                             eqClasses.numClasses());
+}
+
+/**
+ * Same as above, using the counts of eqClasses, and computed in parallel.
+ */
+double parallelLogLikelihood_(const FlatEquivalenceClasses& eqClasses,
+                              const double* alpha, size_t numTranscripts) {
+  double alphaSum = std::accumulate(alpha, alpha + numTranscripts, 0.0);
+  double logAlphaSum = std::log(alphaSum);
+  return tbb::parallel_reduce(
+      BlockedIndexRange(size_t(0), eqClasses.numClasses()), 0.0,
+      [&eqClasses, alpha, logAlphaSum](const BlockedIndexRange& range,
+                                       double ll) -> double {
+        return ll + logLikelihoodRange_(eqClasses, eqClasses.counts, alpha,
+                                        logAlphaSum, range.begin(),
+                                        range.end());
+      },
+      std::plus<double>());
+}
+
+/**
+ * One SQUAREM (scheme S3 of Varadhan & Roland, 2008) cycle of the (VB)EM.
+ * From theta0 = alphas, two (VB)EM updates give theta1 and theta2, which are
+ * used to extrapolate to a new point theta'.  One more update, of theta',
+ * gives the result, alphasPrime.  If that decreases the likelihood relative
+ * to alphas, the extrapolation is rejected and alphasPrime = theta2
+ * instead (a plain EM update never decreases the likelihood).
+ *
+ * step(in, out) must perform a single (VB)EM update, and logLik(x) must
+ * compute the log-likelihood of x.  logLikIn is the log-likelihood of
+ * alphas, or NaN if it is not known; on return, it holds the
+ * log-likelihood of alphasPrime (or NaN).  Returns the number of (VB)EM
+ * updates performed.
+ */
+template <typename VecT, typename StepFn, typename LikFn>
+uint32_t squaremCycle_(VecT& alphas, VecT& theta1, VecT& theta2,
+                       VecT& alphasPrime, StepFn& step, LikFn& logLik,
+                       double& logLikIn) {
+  step(alphas, theta1);
+  step(theta1, theta2);
+
+  const double* t0 = rawValues(alphas);
+  double* t1 = rawValues(theta1);
+  const double* t2 = rawValues(theta2);
+  double* out = rawValues(alphasPrime);
+  size_t M = alphas.size();
+
+  double rNorm{0.0};
+  double vNorm{0.0};
+  for (size_t i = 0; i < M; ++i) {
+    double r = t1[i] - t0[i];
+    double v = (t2[i] - t1[i]) - r;
+    rNorm += r * r;
+    vNorm += v * v;
+  }
+  if (vNorm <= 0.0) {
+    // The updates are no longer changing; there is nothing to extrapolate
+    std::copy(t2, t2 + M, out);
+    logLikIn = std::numeric_limits<double>::quiet_NaN();
+    return 2;
+  }
+
+  // The step length; a step of -1 gives theta' = theta2.
+  double a = std::min(-1.0, -std::sqrt(rNorm / vNorm));
+  // theta1 is not needed anymore; hold theta' there.
+  for (size_t i = 0; i < M; ++i) {
+    double r = t1[i] - t0[i];
+    double v = (t2[i] - t1[i]) - r;
+    t1[i] = std::max(0.0, t0[i] - 2.0 * a * r + a * a * v);
+  }
+  step(theta1, alphasPrime);
+
+  if (a == -1.0) {
+    // Just a (monotone) EM update of theta2
+    logLikIn = std::numeric_limits<double>::quiet_NaN();
+    return 3;
+  }
+
+  if (std::isnan(logLikIn)) {
+    logLikIn = logLik(t0);
+  }
+  double logLikOut = logLik(out);
+  if (!(logLikOut >= logLikIn)) {
+    // The extrapolation overshot; fall back to the EM update
+    std::copy(t2, t2 + M, out);
+    logLikOut = std::numeric_limits<double>::quiet_NaN();
+  }
+  logLikIn = logLikOut;
+  return 3;
+}
+
 /**
  * Single-threaded EM-update routine for use in bootstrapping
  */
 template <typename VecT>
-void EMUpdate_(std::vector<std::vector<uint32_t>>& txpGroupLabels,
-               std::vector<std::vector<double>>& txpGroupCombinedWeights,
-               std::vector<uint64_t>& txpGroupCounts,
+void EMUpdate_(const FlatEquivalenceClasses& eqClasses,
+               const std::vector<uint64_t>& txpGroupCounts,
                std::vector<Transcript>& transcripts, const VecT& alphaIn,
                VecT& alphaOut) {
 
   assert(alphaIn.size() == alphaOut.size());
 
-  size_t numEqClasses = txpGroupLabels.size();
+  const auto& offsets = eqClasses.offsets;
+  const uint32_t* txps = eqClasses.txps.data();
+  const double* auxs = eqClasses.combinedWeights.data();
+  const double* alphaVals = rawValues(alphaIn);
+
+  size_t numEqClasses = eqClasses.numClasses();
   for (size_t eqID = 0; eqID < numEqClasses; ++eqID) {
     uint64_t count = txpGroupCounts[eqID];
     // for each transcript in this class
-    const std::vector<uint32_t>& txps = txpGroupLabels[eqID];
-    const auto& auxs = txpGroupCombinedWeights[eqID];
+    size_t start = offsets[eqID];
+    size_t groupSize = offsets[eqID + 1] - start;
+    const uint32_t* gtxps = txps + start;
+    const double* gauxs = auxs + start;
 
     double denom = 0.0;
-    size_t groupSize = txpGroupCombinedWeights[eqID].size(); // txps.size();
     // If this is a single-transcript group,
     // then it gets the full count.  Otherwise,
     // update according to our VBEM rule.
     if (BOOST_LIKELY(groupSize > 1)) {
-      for (size_t i = 0; i < groupSize; ++i) {
-        auto tid = txps[i];
-        auto aux = auxs[i];
-        double v = alphaIn[tid] * aux;
-        denom += v;
-      }
+      denom = salmon::emkernels::gatherDot(alphaVals, gtxps, gauxs, groupSize);
 
       if (denom <= ::minEQClassWeight) {
         // tgroup.setValid(false);
       } else {
         double invDenom = count / denom;
         for (size_t i = 0; i < groupSize; ++i) {
-          auto tid = txps[i];
-          auto aux = auxs[i];
+          auto tid = gtxps[i];
+          auto aux = gauxs[i];
           double v = alphaIn[tid] * aux;
           if (!std::isnan(v)) {
             salmon::utils::incLoop(alphaOut[tid], v * invDenom);
@@ -154,7 +325,7 @@ void EMUpdate_(std::vector<std::vector<uint32_t>>& txpGroupLabels,
         }
       }
     } else {
-      salmon::utils::incLoop(alphaOut[txps.front()], count);
+      salmon::utils::incLoop(alphaOut[gtxps[0]], count);
     }
   }
 }
@@ -163,61 +334,55 @@ void EMUpdate_(std::vector<std::vector<uint32_t>>& txpGroupLabels,
  * Single-threaded VBEM-update routine for use in bootstrapping
  */
 template <typename VecT>
-void VBEMUpdate_(std::vector<std::vector<uint32_t>>& txpGroupLabels,
-                 std::vector<std::vector<double>>& txpGroupCombinedWeights,
-                 std::vector<uint64_t>& txpGroupCounts,
+void VBEMUpdate_(const FlatEquivalenceClasses& eqClasses,
+                 const std::vector<uint64_t>& txpGroupCounts,
                  std::vector<Transcript>& transcripts,
                  std::vector<double>& priorAlphas, double totLen,
                  const VecT& alphaIn, VecT& alphaOut, VecT& expTheta) {
 
   assert(alphaIn.size() == alphaOut.size());
   size_t M = alphaIn.size();
-  size_t numEQClasses = txpGroupLabels.size();
+  size_t numEQClasses = eqClasses.numClasses();
   double alphaSum = {0.0};
   for (size_t i = 0; i < M; ++i) {
     alphaSum += alphaIn[i] + priorAlphas[i];
   }
 
-  double logNorm = boost::math::digamma(alphaSum);
+  double logNorm = salmon::emkernels::digamma(alphaSum);
 
-  // double prior = priorAlpha;
+  // Compute expTheta, and reset alphaOut to 0
+  salmon::emkernels::expDigamma(rawValues(alphaIn), priorAlphas.data(),
+                                logNorm, ::digammaMin, rawValues(expTheta),
+                                rawValues(alphaOut), M);
 
-  for (size_t i = 0; i < M; ++i) {
-    auto ap = alphaIn[i] + priorAlphas[i];
-    if (ap > ::digammaMin) {
-      expTheta[i] = std::exp(boost::math::digamma(ap) - logNorm);
-    } else {
-      expTheta[i] = 0.0;
-    }
-    alphaOut[i] = 0.0; // priorAlphas[i];
-  }
+  const auto& offsets = eqClasses.offsets;
+  const uint32_t* txps = eqClasses.txps.data();
+  const double* auxs = eqClasses.combinedWeights.data();
+  const double* expThetaVals = rawValues(expTheta);
 
   for (size_t eqID = 0; eqID < numEQClasses; ++eqID) {
     uint64_t count = txpGroupCounts[eqID];
-    const std::vector<uint32_t>& txps = txpGroupLabels[eqID];
-    const auto& auxs = txpGroupCombinedWeights[eqID];
+    size_t start = offsets[eqID];
+    size_t groupSize = offsets[eqID + 1] - start;
+    const uint32_t* gtxps = txps + start;
+    const double* gauxs = auxs + start;
 
     double denom = 0.0;
-    size_t groupSize = txpGroupCombinedWeights[eqID].size(); // txps.size();
     // If this is a single-transcript group,
     // then it gets the full count.  Otherwise,
     // update according to our VBEM rule.
     if (BOOST_LIKELY(groupSize > 1)) {
-      for (size_t i = 0; i < groupSize; ++i) {
-        auto tid = txps[i];
-        auto aux = auxs[i];
-        if (expTheta[tid] > 0.0) {
-          double v = expTheta[tid] * aux;
-          denom += v;
-        }
-      }
+      // expTheta is 0 for any transcript we should skip, so
+      // those contribute nothing to the sum.
+      denom =
+          salmon::emkernels::gatherDot(expThetaVals, gtxps, gauxs, groupSize);
       if (denom <= ::minEQClassWeight) {
         // tgroup.setValid(false);
       } else {
         double invDenom = count / denom;
         for (size_t i = 0; i < groupSize; ++i) {
-          auto tid = txps[i];
-          auto aux = auxs[i];
+          auto tid = gtxps[i];
+          auto aux = gauxs[i];
           if (expTheta[tid] > 0.0) {
             double v = expTheta[tid] * aux;
             salmon::utils::incLoop(alphaOut[tid], v * invDenom);
@@ -226,177 +391,572 @@ void VBEMUpdate_(std::vector<std::vector<uint32_t>>& txpGroupLabels,
       }
 
     } else {
-      salmon::utils::incLoop(alphaOut[txps.front()], count);
+      salmon::utils::incLoop(alphaOut[gtxps[0]], count);
+    }
+  }
+}
+
+/**
+ * The EM update of K bootstrap samples at once.  The abundances and the
+ * class counts of the samples are interleaved (those of transcript, or
+ * class, i are at i*K ... i*K + K-1), so that the transcripts and weights of
+ * each class are read once per iteration for all K samples, and the inner
+ * loops run over the samples.  alphaOut must be zeroed by the caller, and
+ * `scale` holds K doubles of scratch.  For the VBEM, alphaIn is expTheta.
+ *
+ * With a FixedK other than 0 (which must then equal K), the inner loops have
+ * a length known at compile time, so that they are unrolled into a few full
+ * SIMD vectors, and the per-class scale stays in registers rather than in
+ * `scale`.  The counts are doubles, so that the loops convert nothing.
+ */
+template <size_t FixedK>
+void batchedEMUpdate_(const FlatEquivalenceClasses& eqClasses,
+                      const std::vector<double>& counts, size_t K,
+                      const double* alphaIn, double* alphaOut, double* scale) {
+  const size_t width = (FixedK > 0) ? FixedK : K;
+  double fixedScale[(FixedK > 0) ? FixedK : 1];
+  double* s = (FixedK > 0) ? fixedScale : scale;
+  const auto& offsets = eqClasses.offsets;
+  const uint32_t* txps = eqClasses.txps.data();
+  const double* auxs = eqClasses.combinedWeights.data();
+
+  size_t numEqClasses = eqClasses.numClasses();
+  for (size_t eqID = 0; eqID < numEqClasses; ++eqID) {
+    const double* c = counts.data() + eqID * width;
+    size_t start = offsets[eqID];
+    size_t groupSize = offsets[eqID + 1] - start;
+    const uint32_t* gtxps = txps + start;
+    const double* gauxs = auxs + start;
+
+    if (BOOST_UNLIKELY(groupSize == 1)) {
+      double* out = alphaOut + gtxps[0] * width;
+      for (size_t k = 0; k < width; ++k) {
+        out[k] += c[k];
+      }
+      continue;
+    }
+
+    for (size_t k = 0; k < width; ++k) {
+      s[k] = 0.0;
+    }
+    for (size_t i = 0; i < groupSize; ++i) {
+      const double* in = alphaIn + gtxps[i] * width;
+      double aux = gauxs[i];
+      for (size_t k = 0; k < width; ++k) {
+        s[k] += in[k] * aux;
+      }
+    }
+    for (size_t k = 0; k < width; ++k) {
+      s[k] = (s[k] > ::minEQClassWeight) ? c[k] / s[k] : 0.0;
+    }
+    for (size_t i = 0; i < groupSize; ++i) {
+      const double* in = alphaIn + gtxps[i] * width;
+      double* out = alphaOut + gtxps[i] * width;
+      double aux = gauxs[i];
+      for (size_t k = 0; k < width; ++k) {
+        out[k] += in[k] * aux * s[k];
+      }
+    }
+  }
+}
+
+// batchedEMUpdate_, specialized for the default batch sizes
+void batchedEMUpdateAnyK_(const FlatEquivalenceClasses& eqClasses,
+                          const std::vector<double>& counts, size_t K,
+                          const double* alphaIn, double* alphaOut,
+                          double* scale) {
+  switch (K) {
+  case 2:
+    batchedEMUpdate_<2>(eqClasses, counts, K, alphaIn, alphaOut, scale);
+    break;
+  case 4:
+    batchedEMUpdate_<4>(eqClasses, counts, K, alphaIn, alphaOut, scale);
+    break;
+  default:
+    batchedEMUpdate_<0>(eqClasses, counts, K, alphaIn, alphaOut, scale);
+  }
+}
+
+/**
+ * expTheta of the VBEM for K interleaved bootstrap samples (see
+ * batchedEMUpdate_); `scratch` holds 2K doubles.  The entries whose
+ * abundance is 0 scale the prior's cached term rather than evaluating the
+ * digamma function again.
+ */
+void batchedExpTheta_(const double* alphaIn, const VBEMPriorTerms& prior,
+                      size_t K, double* expTheta, double* scratch) {
+  size_t M = prior.alphas.size();
+  double* logNorms = scratch;
+  double* norms = scratch + K;
+  std::fill(logNorms, logNorms + K, prior.sum);
+  for (size_t i = 0; i < M; ++i) {
+    const double* in = alphaIn + i * K;
+    for (size_t k = 0; k < K; ++k) {
+      logNorms[k] += in[k];
+    }
+  }
+  for (size_t k = 0; k < K; ++k) {
+    logNorms[k] = salmon::emkernels::digamma(logNorms[k]);
+    norms[k] = std::exp(-logNorms[k]);
+  }
+  for (size_t i = 0; i < M; ++i) {
+    const double* in = alphaIn + i * K;
+    double* out = expTheta + i * K;
+    double priorAlpha = prior.alphas[i];
+    double priorTerm = prior.expDigamma[i];
+    for (size_t k = 0; k < K; ++k) {
+      if (in[k] == 0.0) {
+        out[k] = priorTerm * norms[k];
+        continue;
+      }
+      double ap = in[k] + priorAlpha;
+      out[k] = (ap > ::digammaMin)
+                   ? std::exp(salmon::emkernels::digamma(ap) - logNorms[k])
+                   : 0.0;
+    }
+  }
+}
+
+/**
+ * Recompute the combined weights `gcombined` of a class of `count`
+ * fragments, from its auxiliary weights `gweights` and the effective lengths
+ * of its transcripts: count * weight / effLen, normalized to sum to 1.
+ */
+inline void refreshClassWeights_(const uint32_t* gtxps, const double* gweights,
+                                 size_t groupSize, uint64_t count,
+                                 const Eigen::VectorXd& effLens,
+                                 double* gcombined) {
+  double wsum{0.0};
+  for (size_t i = 0; i < groupSize; ++i) {
+    auto probStartPos = 1.0 / effLens(gtxps[i]);
+    gcombined[i] = count * (gweights[i] * probStartPos);
+    wsum += gcombined[i];
+  }
+  double wnorm = 1.0 / wsum;
+  for (size_t i = 0; i < groupSize; ++i) {
+    gcombined[i] *= wnorm;
+  }
+}
+
+/**
+ * The (VB)EM update for a single equivalence class.  `weightsIn` holds
+ * alpha (for the EM) or expTheta (for the VBEM), and add(tid, v) is called
+ * to add the mass v to transcript tid.  The combined weights `gauxs` may be
+ * single precision (--emSinglePrecision); the sums are in double precision.
+ */
+template <typename AuxT, typename AddFn>
+inline void updateClass_(const double* weightsIn, const uint32_t* gtxps,
+                         const AuxT* gauxs, size_t groupSize, uint64_t count,
+                         AddFn& add) {
+  // If this is a single-transcript group,
+  // then it gets the full count.  Otherwise,
+  // update according to our (VB)EM rule.
+  if (BOOST_LIKELY(groupSize > 1)) {
+    double denom =
+        salmon::emkernels::gatherDot(weightsIn, gtxps, gauxs, groupSize);
+    if (denom > ::minEQClassWeight) {
+      double invDenom = count / denom;
+      for (size_t i = 0; i < groupSize; ++i) {
+        auto tid = gtxps[i];
+        double v = weightsIn[tid] * gauxs[i];
+        if (!std::isnan(v)) {
+          add(tid, v * invDenom);
+        }
+      }
+    }
+  } else {
+    add(gtxps[0], static_cast<double>(count));
+  }
+}
+
+/**
+ * Apply the (VB)EM update of every valid class to `out`, using the
+ * partitioning of the classes in `partition` rather than atomic updates.
+ * Components that are no longer active keep their current estimates
+ * (i.e. out = alphaIn for their transcripts).
+ *
+ * If refreshEffLens is given, the combined weights of each class (those of
+ * the partition and of `eqClasses`, from which it was built) are first
+ * recomputed for these effective lengths, in the same pass, rather than in a
+ * pass of their own.
+ *
+ * `auxs` holds the partition's combined weights, in single or double
+ * precision.
+ */
+template <typename AuxT>
+void partitionedUpdateImpl_(EqClassPartition& partition, AuxT* auxs,
+                            const double* weightsIn, const double* alphaIn,
+                            double* out, FlatEquivalenceClasses* eqClasses,
+                            const Eigen::VectorXd* refreshEffLens) {
+  auto& classes = partition.classes;
+  const auto& offsets = classes.offsets;
+  const auto& counts = classes.counts;
+  const uint32_t* txps = classes.txps.data();
+
+  auto refreshClass = [&partition, &offsets, &counts, txps, auxs, eqClasses,
+                       refreshEffLens](size_t k) -> void {
+    if (refreshEffLens == nullptr) {
+      return;
+    }
+    size_t start = offsets[k];
+    size_t groupSize = offsets[k + 1] - start;
+    size_t origStart = eqClasses->offsets[partition.order[k]];
+    double* orig = eqClasses->combinedWeights.data() + origStart;
+    refreshClassWeights_(txps + start, eqClasses->weights.data() + origStart,
+                         groupSize, counts[k], *refreshEffLens, orig);
+    std::copy(orig, orig + groupSize, auxs + start);
+  };
+
+  auto keepComponent = [&partition, &refreshClass, alphaIn,
+                        out](size_t c) -> void {
+    for (auto i = partition.compTxpOffsets[c];
+         i < partition.compTxpOffsets[c + 1]; ++i) {
+      auto t = partition.compTxps[i];
+      out[t] = alphaIn[t];
+    }
+    for (auto k = partition.compOffsets[c]; k < partition.compOffsets[c + 1];
+         ++k) {
+      refreshClass(k);
+    }
+  };
+
+  // The transcripts of each block are owned by the task processing it (which,
+  // through the partition's affinity, runs where the block's classes live)
+  tbb::parallel_for(
+      BlockedIndexRange(size_t(0), partition.numBlocks()),
+      [&offsets, &counts, txps, auxs, weightsIn, out, &partition,
+       &keepComponent, &refreshClass](const BlockedIndexRange& range) -> void {
+        auto add = [out](uint32_t tid, double v) -> void { out[tid] += v; };
+        for (auto b : boost::irange(range.begin(), range.end())) {
+          for (auto c = partition.blockOffsets[b];
+               c < partition.blockOffsets[b + 1]; ++c) {
+            if (!partition.active[c]) {
+              keepComponent(c);
+              continue;
+            }
+            for (auto k = partition.compOffsets[c];
+                 k < partition.compOffsets[c + 1]; ++k) {
+              refreshClass(k);
+              size_t start = offsets[k];
+              updateClass_(weightsIn, txps + start, auxs + start,
+                           offsets[k + 1] - start, counts[k], add);
+            }
+          }
+        }
+      },
+      partition.affinity());
+
+  // The classes of the shared components accumulate into per-thread buffers
+  if (partition.numSharedClasses() > 0) {
+    for (size_t c = partition.sharedCompBegin; c < partition.numComponents();
+         ++c) {
+      if (!partition.active[c]) {
+        keepComponent(c);
+        continue;
+      }
+      tbb::parallel_for(
+          BlockedIndexRange(partition.compOffsets[c],
+                            partition.compOffsets[c + 1]),
+          [&offsets, &counts, txps, auxs, weightsIn, &partition,
+           &refreshClass](const BlockedIndexRange& range) -> void {
+            auto& sums = partition.localSums();
+            const auto& sharedIndex = partition.sharedIndex;
+            auto add = [&sums, &sharedIndex](uint32_t tid, double v) -> void {
+              sums[sharedIndex[tid]] += v;
+            };
+            for (auto k : boost::irange(range.begin(), range.end())) {
+              refreshClass(k);
+              size_t start = offsets[k];
+              updateClass_(weightsIn, txps + start, auxs + start,
+                           offsets[k + 1] - start, counts[k], add);
+            }
+          });
     }
+    partition.reduceShared(out);
+  }
+}
+
+void partitionedUpdate_(EqClassPartition& partition, const double* weightsIn,
+                        const double* alphaIn, double* out,
+                        FlatEquivalenceClasses* eqClasses = nullptr,
+                        const Eigen::VectorXd* refreshEffLens = nullptr) {
+  if (partition.singlePrecision()) {
+    partitionedUpdateImpl_(partition, partition.combinedWeightsF.data(),
+                           weightsIn, alphaIn, out, eqClasses,
+                           refreshEffLens);
+  } else {
+    partitionedUpdateImpl_(partition, partition.classes.combinedWeights.data(),
+                           weightsIn, alphaIn, out, eqClasses,
+                           refreshEffLens);
   }
 }
 
 /*
  * Use the "standard" EM algorithm over equivalence
  * classes to estimate the latent variables (alphaOut)
- * given the current estimates (alphaIn).
+ * given the current estimates (alphaIn).  If refreshEffLens is given, the
+ * combined weights are first recomputed for these effective lengths (as by
+ * updateEqClassWeights), class by class, in the same pass.
  */
-void EMUpdate_(std::vector<std::pair<const TranscriptGroup, TGValue>>& eqVec,
+void EMUpdate_(FlatEquivalenceClasses& eqClasses,
                std::vector<Transcript>& transcripts,
                const CollapsedEMOptimizer::VecType& alphaIn,
-               CollapsedEMOptimizer::VecType& alphaOut) {
+               CollapsedEMOptimizer::VecType& alphaOut,
+               EqClassPartition* partition = nullptr,
+               const Eigen::VectorXd* refreshEffLens = nullptr) {
 
   assert(alphaIn.size() == alphaOut.size());
 
+  if (partition != nullptr) {
+    partitionedUpdate_(*partition, rawValues(alphaIn), rawValues(alphaIn),
+                       rawValues(alphaOut), &eqClasses, refreshEffLens);
+    return;
+  }
+
+  const auto& offsets = eqClasses.offsets;
+  const auto& counts = eqClasses.counts;
+  const uint32_t* txps = eqClasses.txps.data();
+  const double* weights = eqClasses.weights.data();
+  double* auxs = eqClasses.combinedWeights.data();
+  const double* alphaVals = rawValues(alphaIn);
+
   tbb::parallel_for(
-      BlockedIndexRange(size_t(0), size_t(eqVec.size())),
-      [&eqVec, &alphaIn, &alphaOut](const BlockedIndexRange& range) -> void {
+      BlockedIndexRange(size_t(0), size_t(eqClasses.numClasses())),
+      [&offsets, &counts, txps, weights, auxs, alphaVals, &alphaIn,
+       &alphaOut, refreshEffLens](const BlockedIndexRange& range) -> void {
         for (auto eqID : boost::irange(range.begin(), range.end())) {
-          auto& kv = eqVec[eqID];
-
-          uint64_t count = kv.second.count;
+          uint64_t count = counts[eqID];
+          if (refreshEffLens != nullptr) {
+            size_t start = offsets[eqID];
+            refreshClassWeights_(txps + start, weights + start,
+                                 offsets[eqID + 1] - start, count,
+                                 *refreshEffLens, auxs + start);
+          }
           // for each transcript in this class
-          const TranscriptGroup& tgroup = kv.first;
-          if (tgroup.valid) {
-            const std::vector<uint32_t>& txps = tgroup.txps;
-            const auto& auxs = kv.second.combinedWeights;
-
-            double denom = 0.0;
-            size_t groupSize = kv.second.weights.size(); // txps.size();
-            // If this is a single-transcript group,
-            // then it gets the full count.  Otherwise,
-            // update according to our VBEM rule.
-            if (BOOST_LIKELY(groupSize > 1)) {
+          size_t start = offsets[eqID];
+          size_t groupSize = offsets[eqID + 1] - start;
+          const uint32_t* gtxps = txps + start;
+          const double* gauxs = auxs + start;
+
+          double denom = 0.0;
+          // If this is a single-transcript group,
+          // then it gets the full count.  Otherwise,
+          // update according to our VBEM rule.
+          if (BOOST_LIKELY(groupSize > 1)) {
+            denom = salmon::emkernels::gatherDot(alphaVals, gtxps, gauxs,
+                                                 groupSize);
+
+            if (denom <= ::minEQClassWeight) {
+              // tgroup.setValid(false);
+            } else {
+              double invDenom = count / denom;
               for (size_t i = 0; i < groupSize; ++i) {
-                auto tid = txps[i];
-                auto aux = auxs[i];
+                auto tid = gtxps[i];
+                auto aux = gauxs[i];
                 double v = alphaIn[tid] * aux;
-                denom += v;
-              }
-
-              if (denom <= ::minEQClassWeight) {
-                // tgroup.setValid(false);
-              } else {
-                double invDenom = count / denom;
-                for (size_t i = 0; i < groupSize; ++i) {
-                  auto tid = txps[i];
-                  auto aux = auxs[i];
-                  double v = alphaIn[tid] * aux;
-                  if (!std::isnan(v)) {
-                    salmon::utils::incLoop(alphaOut[tid], v * invDenom);
-                  }
+                if (!std::isnan(v)) {
+                  salmon::utils::incLoop(alphaOut[tid], v * invDenom);
                 }
               }
-            } else {
-              salmon::utils::incLoop(alphaOut[txps.front()], count);
             }
+          } else {
+            salmon::utils::incLoop(alphaOut[gtxps[0]], count);
           }
         }
       });
 }
 
+/**
+ * The transcripts that appear in some valid equivalence class.  The (VB)EM
+ * gives the others no mass, so, once their abundances are 0, the passes
+ * over the transcripts made in each iteration can skip them.  Against huge
+ * references (e.g. metagenomic ones, with --meta), where nearly all of the
+ * transcripts have no reads, the iterations then cost in proportion to the
+ * transcripts that were observed rather than to the size of the reference.
+ */
+struct PresentTranscripts {
+  void build(const FlatEquivalenceClasses& eqClasses, size_t numTranscripts) {
+    std::vector<bool> present(numTranscripts, false);
+    for (size_t eqID = 0; eqID < eqClasses.numClasses(); ++eqID) {
+      if (!eqClasses.valid[eqID]) {
+        continue;
+      }
+      for (auto i = eqClasses.offsets[eqID]; i < eqClasses.offsets[eqID + 1];
+           ++i) {
+        present[eqClasses.txps[i]] = true;
+      }
+    }
+    ids.clear();
+    for (size_t t = 0; t < numTranscripts; ++t) {
+      if (present[t]) {
+        ids.push_back(static_cast<uint32_t>(t));
+      }
+    }
+    // The dense passes are vectorized, so they're only skipped when few of
+    // the transcripts are present
+    sparse = (2 * ids.size() < numTranscripts);
+  }
+
+  // The prior mass of the transcripts that aren't present (for the VBEM)
+  void setPriors(const std::vector<double>& priorAlphas) {
+    absentPriorSum = std::accumulate(priorAlphas.begin(), priorAlphas.end(),
+                                     0.0);
+    for (auto t : ids) {
+      absentPriorSum -= priorAlphas[t];
+    }
+  }
+
+  std::vector<uint32_t> ids;
+  double absentPriorSum{0.0};
+  bool sparse{false};
+};
+
 /*
  * Use the Variational Bayesian EM algorithm over equivalence
  * classes to estimate the latent variables (alphaOut)
- * given the current estimates (alphaIn).
+ * given the current estimates (alphaIn).  With a sparse set of `present`
+ * transcripts, the others must have alphaIn = alphaOut = 0.  As with
+ * EMUpdate_, the combined weights are recomputed in the same pass if
+ * refreshEffLens is given.
  */
-void VBEMUpdate_(std::vector<std::pair<const TranscriptGroup, TGValue>>& eqVec,
+void VBEMUpdate_(FlatEquivalenceClasses& eqClasses,
                  std::vector<Transcript>& transcripts,
                  std::vector<double>& priorAlphas, double totLen,
                  const CollapsedEMOptimizer::VecType& alphaIn,
                  CollapsedEMOptimizer::VecType& alphaOut,
-                 CollapsedEMOptimizer::VecType& expTheta) {
+                 CollapsedEMOptimizer::VecType& expTheta,
+                 EqClassPartition* partition = nullptr,
+                 const PresentTranscripts* present = nullptr,
+                 const Eigen::VectorXd* refreshEffLens = nullptr) {
 
   assert(alphaIn.size() == alphaOut.size());
-  size_t M = alphaIn.size();
-  double alphaSum = {0.0};
-  for (size_t i = 0; i < M; ++i) {
-    alphaSum += alphaIn[i] + priorAlphas[i];
-  }
-
-  double logNorm = boost::math::digamma(alphaSum);
+  const double* alphaVals = rawValues(alphaIn);
+  double* expThetaVals = rawValues(expTheta);
+  double* alphaOutVals = rawValues(alphaOut);
+
+  // Compute expTheta, and reset alphaOut to 0
+  if (present != nullptr and present->sparse) {
+    const auto& ids = present->ids;
+    double alphaSum = present->absentPriorSum;
+    for (auto t : ids) {
+      alphaSum += alphaIn[t] + priorAlphas[t];
+    }
+    double logNorm = salmon::emkernels::digamma(alphaSum);
+    tbb::parallel_for(
+        BlockedIndexRange(size_t(0), ids.size()),
+        [logNorm, &priorAlphas, &ids, alphaVals, expThetaVals,
+         alphaOutVals](const BlockedIndexRange& range) -> void {
+          for (auto k : boost::irange(range.begin(), range.end())) {
+            auto t = ids[k];
+            salmon::emkernels::expDigamma(alphaVals + t,
+                                          priorAlphas.data() + t, logNorm,
+                                          ::digammaMin, expThetaVals + t,
+                                          alphaOutVals + t, 1);
+          }
+        });
+  } else {
+    size_t M = alphaIn.size();
+    double alphaSum = {0.0};
+    for (size_t i = 0; i < M; ++i) {
+      alphaSum += alphaIn[i] + priorAlphas[i];
+    }
 
-  tbb::parallel_for(BlockedIndexRange(size_t(0), size_t(transcripts.size())),
-                    [logNorm, totLen, &priorAlphas, &alphaIn, &alphaOut,
-                     &expTheta](const BlockedIndexRange& range) -> void {
+    double logNorm = salmon::emkernels::digamma(alphaSum);
+
+    tbb::parallel_for(
+        BlockedIndexRange(size_t(0), size_t(transcripts.size())),
+        [logNorm, &priorAlphas, alphaVals, expThetaVals,
+         alphaOutVals](const BlockedIndexRange& range) -> void {
+          size_t b = range.begin();
+          salmon::emkernels::expDigamma(alphaVals + b, priorAlphas.data() + b,
+                                        logNorm, ::digammaMin,
+                                        expThetaVals + b, alphaOutVals + b,
+                                        range.size());
+        });
+  }
 
-                      // double prior = priorAlpha;
+  if (partition != nullptr) {
+    partitionedUpdate_(*partition, expThetaVals, alphaVals, alphaOutVals,
+                       &eqClasses, refreshEffLens);
+    return;
+  }
 
-                      for (auto i : boost::irange(range.begin(), range.end())) {
-                        auto ap = alphaIn[i].load() + priorAlphas[i];
-                        if (ap > ::digammaMin) {
-                          expTheta[i] =
-                              std::exp(boost::math::digamma(ap) - logNorm);
-                        } else {
-                          expTheta[i] = 0.0;
-                        }
-                        // alphaOut[i] = prior * transcripts[i].RefLength;
-                        alphaOut[i] = 0.0;
-                      }
-                    });
+  const auto& offsets = eqClasses.offsets;
+  const auto& counts = eqClasses.counts;
+  const uint32_t* txps = eqClasses.txps.data();
+  const double* weights = eqClasses.weights.data();
+  double* auxs = eqClasses.combinedWeights.data();
 
   tbb::parallel_for(
-      BlockedIndexRange(size_t(0), size_t(eqVec.size())),
-      [&eqVec, &alphaIn, &alphaOut,
-       &expTheta](const BlockedIndexRange& range) -> void {
+      BlockedIndexRange(size_t(0), size_t(eqClasses.numClasses())),
+      [&offsets, &counts, txps, weights, auxs, expThetaVals, &alphaIn,
+       &alphaOut, &expTheta,
+       refreshEffLens](const BlockedIndexRange& range) -> void {
         for (auto eqID : boost::irange(range.begin(), range.end())) {
-          auto& kv = eqVec[eqID];
-
-          uint64_t count = kv.second.count;
+          uint64_t count = counts[eqID];
+          if (refreshEffLens != nullptr) {
+            size_t start = offsets[eqID];
+            refreshClassWeights_(txps + start, weights + start,
+                                 offsets[eqID + 1] - start, count,
+                                 *refreshEffLens, auxs + start);
+          }
           // for each transcript in this class
-          const TranscriptGroup& tgroup = kv.first;
-          if (tgroup.valid) {
-            const std::vector<uint32_t>& txps = tgroup.txps;
-            const auto& auxs = kv.second.combinedWeights;
-
-            double denom = 0.0;
-            size_t groupSize = kv.second.weights.size(); // txps.size();
-            // If this is a single-transcript group,
-            // then it gets the full count.  Otherwise,
-            // update according to our VBEM rule.
-            if (BOOST_LIKELY(groupSize > 1)) {
+          size_t start = offsets[eqID];
+          size_t groupSize = offsets[eqID + 1] - start;
+          const uint32_t* gtxps = txps + start;
+          const double* gauxs = auxs + start;
+
+          double denom = 0.0;
+          // If this is a single-transcript group,
+          // then it gets the full count.  Otherwise,
+          // update according to our VBEM rule.
+          if (BOOST_LIKELY(groupSize > 1)) {
+            // expTheta is 0 for any transcript we should skip, so
+            // those contribute nothing to the sum.
+            denom = salmon::emkernels::gatherDot(expThetaVals, gtxps, gauxs,
+                                                 groupSize);
+            if (denom <= ::minEQClassWeight) {
+              // tgroup.setValid(false);
+            } else {
+              double invDenom = count / denom;
               for (size_t i = 0; i < groupSize; ++i) {
-                auto tid = txps[i];
-                auto aux = auxs[i];
+                auto tid = gtxps[i];
+                auto aux = gauxs[i];
                 if (expTheta[tid] > 0.0) {
                   double v = expTheta[tid] * aux;
-                  denom += v;
-                }
-              }
-              if (denom <= ::minEQClassWeight) {
-                // tgroup.setValid(false);
-              } else {
-                double invDenom = count / denom;
-                for (size_t i = 0; i < groupSize; ++i) {
-                  auto tid = txps[i];
-                  auto aux = auxs[i];
-                  if (expTheta[tid] > 0.0) {
-                    double v = expTheta[tid] * aux;
-                    salmon::utils::incLoop(alphaOut[tid], v * invDenom);
-                  }
+                  salmon::utils::incLoop(alphaOut[tid], v * invDenom);
                 }
               }
-
-            } else {
-              salmon::utils::incLoop(alphaOut[txps.front()], count);
             }
+
+          } else {
+            salmon::utils::incLoop(alphaOut[gtxps[0]], count);
           }
         }
       });
 }
 
 template <typename VecT>
-size_t markDegenerateClasses(
-    std::vector<std::pair<const TranscriptGroup, TGValue>>& eqVec,
-    VecT& alphaIn, Eigen::VectorXd& effLens, std::vector<bool>& available,
-    std::shared_ptr<spdlog::logger> jointLog, bool verbose = false) {
+size_t markDegenerateClasses(FlatEquivalenceClasses& eqClasses, VecT& alphaIn,
+                             Eigen::VectorXd& effLens,
+                             std::vector<bool>& available,
+                             std::shared_ptr<spdlog::logger> jointLog,
+                             bool verbose = false) {
 
   size_t numDropped{0};
-  size_t idx{0};
-  for (auto& kv : eqVec) {
-    uint64_t count = kv.second.count;
+  for (size_t eqID = 0; eqID < eqClasses.numClasses(); ++eqID) {
+    // e.g. outside of the targets' components
+    if (!eqClasses.valid[eqID]) {
+      continue;
+    }
+    uint64_t count = eqClasses.counts[eqID];
     // for each transcript in this class
-    const TranscriptGroup& tgroup = kv.first;
-    const std::vector<uint32_t>& txps = tgroup.txps;
-    const auto& auxs = kv.second.combinedWeights;
+    size_t start = eqClasses.offsets[eqID];
+    size_t groupSize = eqClasses.classSize(eqID);
+    const uint32_t* txps = eqClasses.txps.data() + start;
+    const double* auxs = eqClasses.combinedWeights.data() + start;
 
     double denom = 0.0;
-    size_t groupSize = kv.second.weights.size();
     for (size_t i = 0; i < groupSize; ++i) {
       auto tid = txps[i];
       auto aux = auxs[i];
@@ -416,18 +976,18 @@ size_t markDegenerateClasses(
 
       errstream << "denom = 0, count = " << count << "\n";
       errstream << "class = { ";
-      for (auto e : txps) {
-        errstream << e << " ";
+      for (size_t i = 0; i < groupSize; ++i) {
+        errstream << txps[i] << " ";
       }
       errstream << "}\n";
       errstream << "alphas = { ";
-      for (auto e : txps) {
-        errstream << alphaIn[e] << " ";
+      for (size_t i = 0; i < groupSize; ++i) {
+        errstream << alphaIn[txps[i]] << " ";
       }
       errstream << "}\n";
       errstream << "weights = { ";
-      for (auto e : auxs) {
-        errstream << e << " ";
+      for (size_t i = 0; i < groupSize; ++i) {
+        errstream << auxs[i] << " ";
       }
       errstream << "}\n";
       errstream << "============================\n\n";
@@ -437,7 +997,7 @@ size_t markDegenerateClasses(
         jointLog->info(errstream.str());
       }
       ++numDropped;
-      kv.first.setValid(false);
+      eqClasses.valid[eqID] = 0;
     } else {
       for (size_t i = 0; i < groupSize; ++i) {
         auto tid = txps[i];
@@ -450,15 +1010,77 @@ size_t markDegenerateClasses(
 
 CollapsedEMOptimizer::CollapsedEMOptimizer() {}
 
+/**
+ * The class counts of bootstrap sample r, when they were drawn online (see
+ * PoissonBootstrap)
+ */
+void onlineCounts_(const FlatEquivalenceClasses& eqClasses, uint32_t r,
+                   std::vector<uint64_t>& counts) {
+  size_t R = eqClasses.numReplicates;
+  for (size_t i = 0; i < counts.size(); ++i) {
+    counts[i] = eqClasses.replicateCounts[i * R + r];
+  }
+}
+
+/**
+ * Truncate the tiny abundances of a solved bootstrap sample, scale it to
+ * counts if need be, and hand it off to the writer thread; false if its
+ * total weight is too small.
+ */
+bool submitBootstrapSample_(CollapsedEMOptimizer::SerialVecType& alphas,
+                            double cutoff, bool useScaledCounts,
+                            uint64_t numMappedFrags, SalmonOpts& sopt,
+                            AsyncBootstrapWriter& bsWriter) {
+  // Truncate tiny expression values
+  // (With the VBEM and a per-nucleotide prior, the per-transcript
+  // cutoffs are all minAlpha as well, so a single cutoff suffices and
+  // we avoid allocating a vector of them for every sample.)
+  double alphaSum = truncateCountVector(alphas, cutoff);
+
+  if (alphaSum < minWeight) {
+    sopt.jointLog->error("Total alpha weight was too small! "
+                         "Make sure you ran salmon correclty.");
+    return false;
+  }
+
+  if (useScaledCounts) {
+    double mappedFragsDouble = static_cast<double>(numMappedFrags);
+    double alphaSum = 0.0;
+    for (auto a : alphas) {
+      alphaSum += a;
+    }
+    if (alphaSum > ::minWeight) {
+      double scaleFrac = 1.0 / alphaSum;
+      // scaleFrac converts alpha to nucleotide fraction,
+      // and multiplying by numMappedFrags scales by the total
+      // number of mapped fragments to provide an estimated count.
+      for (auto& a : alphas) {
+        a = mappedFragsDouble * (a * scaleFrac);
+      }
+    } else { // This shouldn't happen!
+      sopt.jointLog->error(
+          "Bootstrap had insufficient number of fragments!"
+          "Something is probably wrong; please check that you "
+          "have run salmon correctly and report this to GitHub.");
+    }
+  }
+  // Hand the sample off to the writer thread
+  auto* sample = bsWriter.acquire();
+  std::copy(alphas.begin(), alphas.end(), sample->begin());
+  bsWriter.submit(sample);
+  ++sopt.runStatus->numSamples;
+  return true;
+}
+
 bool doBootstrap(
-    std::vector<std::vector<uint32_t>>& txpGroups,
-    std::vector<std::vector<double>>& txpGroupCombinedWeights,
-    std::vector<Transcript>& transcripts, Eigen::VectorXd& effLens,
+    FlatEquivalenceClasses& txpGroups, std::vector<Transcript>& transcripts,
+    Eigen::VectorXd& effLens,
     const std::vector<double>& sampleWeights, uint64_t totalNumFrags,
-    uint64_t numMappedFrags, double uniformTxpWeight,
+    uint64_t numMappedFrags,
     std::atomic<uint32_t>& bsNum, SalmonOpts& sopt,
-    std::vector<double>& priorAlphas,
-    std::function<bool(const std::vector<double>&)>& writeBootstrap,
+    std::vector<double>& priorAlphas, AsyncBootstrapWriter& bsWriter,
+    const std::vector<double>& initAlphas,
+    std::vector<uint32_t>& bsIterations, uint64_t seed,
     double relDiffTolerance, uint32_t maxIter) {
 
   // An EM termination criterion, adopted from Bray et al. 2016
@@ -467,39 +1089,39 @@ bool doBootstrap(
   // Determine up front if we're going to use scaled counts.
   bool useScaledCounts = !(sopt.useQuasi or sopt.allowOrphans);
   bool useVBEM{sopt.useVBOpt};
-  size_t numClasses = txpGroups.size();
+  size_t numClasses = txpGroups.numClasses();
   CollapsedEMOptimizer::SerialVecType alphas(transcripts.size(), 0.0);
   CollapsedEMOptimizer::SerialVecType alphasPrime(transcripts.size(), 0.0);
   CollapsedEMOptimizer::SerialVecType expTheta(transcripts.size(), 0.0);
   std::vector<uint64_t> sampCounts(numClasses, 0);
+  // Only needed for SQUAREM
+  bool useSQUAREM{sopt.useSQUAREM};
+  CollapsedEMOptimizer::SerialVecType theta1(useSQUAREM ? transcripts.size()
+                                                        : 0);
+  CollapsedEMOptimizer::SerialVecType theta2(useSQUAREM ? transcripts.size()
+                                                        : 0);
 
   uint32_t numBootstraps = sopt.numBootstraps;
-  bool perTranscriptPrior{sopt.perTranscriptPrior};
 
-  auto& jointLog = sopt.jointLog;
-
-  std::random_device rd;
-  std::mt19937 gen(rd());
-  // MultinomialSampler msamp(rd);
-  std::discrete_distribution<uint64_t> csamp(sampleWeights.begin(),
-                                             sampleWeights.end());
-  while (bsNum++ < numBootstraps) {
-    csamp.reset();
-
-    for (size_t sc = 0; sc < sampCounts.size(); ++sc) {
-      sampCounts[sc] = 0;
-    }
-    for (size_t fn = 0; fn < totalNumFrags; ++fn) {
-      ++sampCounts[csamp(gen)];
+  MultinomialSampler msamp(seed, 0);
+  uint32_t bsIdx{0};
+  while ((bsIdx = bsNum++) < numBootstraps) {
+    auto spanStart = PerformanceStats::Clock::now();
+    if (txpGroups.numReplicates > 0) {
+      // The counts were drawn online, while mapping
+      onlineCounts_(txpGroups, bsIdx, sampCounts);
+    } else {
+      // Each sample draws from its own stream, so that the samples depend
+      // only on the seed, and not on which worker happens to draw them.
+      msamp.seed(seed, bsIdx);
+      // Do a new bootstrap
+      msamp(sampCounts.begin(), totalNumFrags, numClasses,
+            sampleWeights.begin());
     }
-    // Do a new bootstrap
-    // msamp(sampCounts.begin(), totalNumFrags, numClasses,
-    // sampleWeights.begin());
 
     double totalLen{0.0};
     for (size_t i = 0; i < transcripts.size(); ++i) {
-      alphas[i] =
-          transcripts[i].getActive() ? uniformTxpWeight * totalNumFrags : 0.0;
+      alphas[i] = initAlphas[i];
       totalLen += effLens(i);
     }
 
@@ -515,14 +1137,34 @@ bool doBootstrap(
     double alphaCheckCutoff = 1e-2;
     double cutoff = minAlpha;
 
+    using SerialVecT = CollapsedEMOptimizer::SerialVecType;
+    auto emStep = [&](const SerialVecT& in, SerialVecT& out) -> void {
+      if (useVBEM) {
+        VBEMUpdate_(txpGroups, sampCounts, transcripts, priorAlphas, totalLen,
+                    in, out, expTheta);
+      } else {
+        std::fill(out.begin(), out.end(), 0.0);
+        EMUpdate_(txpGroups, sampCounts, transcripts, in, out);
+      }
+    };
+    auto logLik = [&](const double* a) -> double {
+      return logLikelihood_(txpGroups, sampCounts, a, transcripts.size());
+    };
+    double logLikCur = std::numeric_limits<double>::quiet_NaN();
+
     while (itNum < minIter or (itNum < maxIter and !converged)) {
 
-      if (useVBEM) {
-        VBEMUpdate_(txpGroups, txpGroupCombinedWeights, sampCounts, transcripts,
-                    priorAlphas, totalLen, alphas, alphasPrime, expTheta);
+      if (useSQUAREM) {
+        // Counts the EM updates, so that minIter and maxIter
+        // bound the same amount of work.
+        itNum += squaremCycle_(alphas, theta1, theta2, alphasPrime, emStep,
+                               logLik, logLikCur) -
+                 1;
+      } else if (useVBEM) {
+        VBEMUpdate_(txpGroups, sampCounts, transcripts, priorAlphas, totalLen,
+                    alphas, alphasPrime, expTheta);
       } else {
-        EMUpdate_(txpGroups, txpGroupCombinedWeights, sampCounts, transcripts,
-                  alphas, alphasPrime);
+        EMUpdate_(txpGroups, sampCounts, transcripts, alphas, alphasPrime);
       }
 
       converged = true;
@@ -542,49 +1184,136 @@ bool doBootstrap(
 
       ++itNum;
     }
+    bsIterations[bsIdx] = itNum;
 
-    // Truncate tiny expression values
-    double alphaSum = 0.0;
-    if (useVBEM and !perTranscriptPrior) {
-      std::vector<double> cutoffs(transcripts.size(), 0.0);
-      for (size_t i = 0; i < transcripts.size(); ++i) {
-        cutoffs[i] = minAlpha;
-      }
-      // alphaSum = truncateCountVector(alphas, cutoffs);
-      alphaSum = truncateCountVector(alphas, cutoffs);
-    } else {
-      // Truncate tiny expression values
-      alphaSum = truncateCountVector(alphas, cutoff);
+    if (!submitBootstrapSample_(alphas, cutoff, useScaledCounts,
+                                numMappedFrags, sopt, bsWriter)) {
+      return false;
     }
+    sopt.perfStats->span("bootstrap", spanStart, "sampling");
+  }
+  return true;
+}
 
-    if (alphaSum < minWeight) {
-      jointLog->error("Total alpha weight was too small! "
-                      "Make sure you ran salmon correclty.");
-      return false;
+/**
+ * Same as doBootstrap, but each worker takes the samples batchSize at a time
+ * and solves them together (see batchedEMUpdate_); a batch is iterated until
+ * its last sample has converged, and each sample's abundances are left as
+ * they were at the iteration where it converged.  SQUAREM isn't supported
+ * here (its step length is per sample).
+ */
+bool doBootstrapBatch(
+    FlatEquivalenceClasses& txpGroups, std::vector<Transcript>& transcripts,
+    const std::vector<double>& sampleWeights, uint64_t totalNumFrags,
+    uint64_t numMappedFrags, std::atomic<uint32_t>& bsNum, SalmonOpts& sopt,
+    const VBEMPriorTerms& prior, AsyncBootstrapWriter& bsWriter,
+    const std::vector<double>& initAlphas, std::vector<uint32_t>& bsIterations,
+    uint64_t seed, double relDiffTolerance, uint32_t maxIter,
+    uint32_t batchSize) {
+
+  uint32_t minIter = 50;
+  double minAlpha = 1e-8;
+  double alphaCheckCutoff = 1e-2;
+
+  bool useScaledCounts = !(sopt.useQuasi or sopt.allowOrphans);
+  bool useVBEM{sopt.useVBOpt};
+  size_t numClasses = txpGroups.numClasses();
+  size_t M = transcripts.size();
+  size_t K = batchSize;
+  uint32_t numBootstraps = sopt.numBootstraps;
+
+  std::vector<double> alphas(M * K, 0.0);
+  std::vector<double> alphasPrime(M * K, 0.0);
+  std::vector<double> expTheta(useVBEM ? M * K : 0, 0.0);
+  std::vector<double> scratch(2 * K, 0.0);
+  std::vector<uint64_t> sampCounts(numClasses, 0);
+  std::vector<double> batchCounts(numClasses * K, 0.0);
+  std::vector<uint8_t> done(K, 0);
+  std::vector<uint8_t> converged(K, 0);
+  CollapsedEMOptimizer::SerialVecType sample(M, 0.0);
+
+  MultinomialSampler msamp(seed, 0);
+  uint32_t first{0};
+  while ((first = bsNum.fetch_add(batchSize)) < numBootstraps) {
+    auto spanStart = PerformanceStats::Clock::now();
+    size_t n = std::min(K, static_cast<size_t>(numBootstraps - first));
+    // The samples are drawn exactly as doBootstrap draws them; the lanes past
+    // the last sample have no counts, and are done from the start.
+    for (size_t k = 0; k < K; ++k) {
+      if (k < n and txpGroups.numReplicates > 0) {
+        onlineCounts_(txpGroups, first + k, sampCounts);
+      } else if (k < n) {
+        msamp.seed(seed, first + k);
+        msamp(sampCounts.begin(), totalNumFrags, numClasses,
+              sampleWeights.begin());
+      } else {
+        std::fill(sampCounts.begin(), sampCounts.end(), 0);
+      }
+      for (size_t e = 0; e < numClasses; ++e) {
+        batchCounts[e * K + k] = sampCounts[e];
+      }
+      for (size_t i = 0; i < M; ++i) {
+        alphas[i * K + k] = (k < n) ? initAlphas[i] : 0.0;
+      }
+      done[k] = (k < n) ? 0 : 1;
     }
 
-    if (useScaledCounts) {
-      double mappedFragsDouble = static_cast<double>(numMappedFrags);
-      double alphaSum = 0.0;
-      for (auto a : alphas) {
-        alphaSum += a;
+    size_t numLeft = n;
+    size_t itNum = 0;
+    while (numLeft > 0) {
+      std::fill(alphasPrime.begin(), alphasPrime.end(), 0.0);
+      if (useVBEM) {
+        batchedExpTheta_(alphas.data(), prior, K, expTheta.data(),
+                         scratch.data());
+        batchedEMUpdateAnyK_(txpGroups, batchCounts, K, expTheta.data(),
+                             alphasPrime.data(), scratch.data());
+      } else {
+        batchedEMUpdateAnyK_(txpGroups, batchCounts, K, alphas.data(),
+                             alphasPrime.data(), scratch.data());
+      }
+      ++itNum;
+
+      std::fill(converged.begin(), converged.end(), 1);
+      for (size_t i = 0; i < M; ++i) {
+        const double* a = alphas.data() + i * K;
+        const double* ap = alphasPrime.data() + i * K;
+        for (size_t k = 0; k < K; ++k) {
+          if (ap[k] > alphaCheckCutoff and
+              std::abs(a[k] - ap[k]) / ap[k] > relDiffTolerance) {
+            converged[k] = 0;
+          }
+        }
       }
-      if (alphaSum > ::minWeight) {
-        double scaleFrac = 1.0 / alphaSum;
-        // scaleFrac converts alpha to nucleotide fraction,
-        // and multiplying by numMappedFrags scales by the total
-        // number of mapped fragments to provide an estimated count.
-        for (auto& a : alphas) {
-          a = mappedFragsDouble * (a * scaleFrac);
+      // Freeze the samples that are done; the others take the update
+      for (size_t i = 0; i < M; ++i) {
+        double* a = alphas.data() + i * K;
+        const double* ap = alphasPrime.data() + i * K;
+        for (size_t k = 0; k < K; ++k) {
+          if (!done[k]) {
+            a[k] = ap[k];
+          }
         }
-      } else { // This shouldn't happen!
-        sopt.jointLog->error(
-            "Bootstrap had insufficient number of fragments!"
-            "Something is probably wrong; please check that you "
-            "have run salmon correctly and report this to GitHub.");
+      }
+      for (size_t k = 0; k < n; ++k) {
+        if (!done[k] and itNum >= minIter and
+            (converged[k] or itNum >= maxIter)) {
+          done[k] = 1;
+          bsIterations[first + k] = itNum;
+          --numLeft;
+        }
+      }
+    }
+
+    for (size_t k = 0; k < n; ++k) {
+      for (size_t i = 0; i < M; ++i) {
+        sample[i] = alphas[i * K + k];
+      }
+      if (!submitBootstrapSample_(sample, minAlpha, useScaledCounts,
+                                  numMappedFrags, sopt, bsWriter)) {
+        return false;
       }
     }
-    writeBootstrap(alphas);
+    sopt.perfStats->span("bootstrap", spanStart, "sampling");
   }
   return true;
 }
@@ -611,13 +1340,16 @@ bool CollapsedEMOptimizer::gatherBootstraps(
 
   uint32_t numBootstraps = sopt.numBootstraps;
 
-  std::vector<std::pair<const TranscriptGroup, TGValue>>& eqVec =
-      readExp.equivalenceClassBuilder().eqVec();
+  FlatEquivalenceClasses& eqClasses =
+      readExp.equivalenceClassBuilder().flatEqClasses();
 
+  // optimize() has compacted the classes, so (e.g. in targeted mode) only
+  // the classes it kept are left
   std::unordered_set<uint32_t> activeTranscriptIDs;
-  for (auto& kv : eqVec) {
-    auto& tg = kv.first;
-    for (auto& t : tg.txps) {
+  for (size_t eqID = 0; eqID < eqClasses.numClasses(); ++eqID) {
+    for (auto i = eqClasses.offsets[eqID]; i < eqClasses.offsets[eqID + 1];
+         ++i) {
+      auto t = eqClasses.txps[i];
       transcripts[t].setActive();
       activeTranscriptIDs.insert(t);
     }
@@ -630,7 +1362,8 @@ bool CollapsedEMOptimizer::gatherBootstraps(
   auto jointLog = sopt.jointLog;
 
   jointLog->info("Will draw {} bootstrap samples", numBootstraps);
-  jointLog->info("Optimizing over {} equivalence classes", eqVec.size());
+  jointLog->info("Optimizing over {} equivalence classes",
+                 eqClasses.numClasses());
 
   double totalNumFrags{static_cast<double>(numMappedFrags)};
   double totalLen{0.0};
@@ -655,8 +1388,8 @@ bool CollapsedEMOptimizer::gatherBootstraps(
   std::vector<double> priorAlphas = populatePriorAlphas_(
       transcripts, effLens, priorValue, perTranscriptPrior);
 
-  auto numRemoved =
-      markDegenerateClasses(eqVec, alphas, effLens, available, sopt.jointLog);
+  auto numRemoved = markDegenerateClasses(eqClasses, alphas, effLens,
+                                          available, sopt.jointLog);
   sopt.jointLog->info("Marked {} weighted equivalence classes as degenerate",
                       numRemoved);
 
@@ -668,92 +1401,339 @@ bool CollapsedEMOptimizer::gatherBootstraps(
 
   // Since we will use the same weights and transcript groups for each
   // of the bootstrap samples (only the count vector will change), it
-  // makes sense to keep only one copy of these.
-  using TGroupLabelT = std::vector<uint32_t>;
-  using TGroupWeightVec = std::vector<double>;
-  std::vector<TGroupLabelT> txpGroups;
-  std::vector<TGroupWeightVec> txpGroupCombinedWeights;
-  std::vector<uint64_t> origCounts;
+  // makes sense to keep only one copy of these.  The classes were compacted
+  // by optimize(); only if some are degenerate under the starting abundances
+  // here are the others copied (rather than compacted in place, since the
+  // classes may be being written out, with --dumpEq, meanwhile).
+  FlatEquivalenceClasses pruned;
+  if (numRemoved > 0) {
+    pruned = eqClasses.validClasses();
+  }
+  FlatEquivalenceClasses& txpGroups = (numRemoved > 0) ? pruned : eqClasses;
+  const std::vector<uint64_t>& origCounts = txpGroups.counts;
   uint64_t totalCount{0};
-
-  for (auto& kv : eqVec) {
-    uint64_t count = kv.second.count;
-    // for each transcript in this class
-    const TranscriptGroup& tgroup = kv.first;
-    if (tgroup.valid) {
-      const std::vector<uint32_t>& txps = tgroup.txps;
-      const auto& auxs = kv.second.combinedWeights;
-      txpGroups.push_back(txps);
-      // Convert to non-atomic
-      txpGroupCombinedWeights.emplace_back(auxs.begin(), auxs.end());
-      origCounts.push_back(count);
-      totalCount += count;
-    }
+  for (auto count : origCounts) {
+    totalCount += count;
   }
 
   double floatCount = totalCount;
-  std::vector<double> samplingWeights(txpGroups.size(), 0.0);
+  std::vector<double> samplingWeights(txpGroups.numClasses(), 0.0);
   for (size_t i = 0; i < origCounts.size(); ++i) {
     samplingWeights[i] = origCounts[i] / floatCount;
   }
 
+  if (txpGroups.numReplicates > 0) {
+    if (txpGroups.numReplicates != numBootstraps) {
+      jointLog->error("There are online counts for {} bootstrap samples, "
+                      "but {} were asked for",
+                      txpGroups.numReplicates, numBootstraps);
+      return false;
+    }
+    jointLog->info("Using the bootstrap counts that were drawn online");
+  }
+
+  // Each bootstrap solve starts from the initial alphas: uniform ones, or
+  // with --bootstrapWarmStart, the point estimates (which each bootstrap
+  // sample is only a small perturbation of).  A warm-started solve stops
+  // nearer the point estimates, so it is opt-in.  Since the EM can never
+  // move mass to a transcript whose abundance is 0, the point estimates are
+  // floored at a small fraction of the uniform abundance.
+  std::vector<double> initAlphas(transcripts.size(), 0.0);
+  double uniformAlpha = scale * totalCount;
+  double warmStartFloor = 1e-3 * uniformAlpha;
+  for (size_t i = 0; i < transcripts.size(); ++i) {
+    if (!transcripts[i].getActive()) {
+      continue;
+    }
+    initAlphas[i] =
+        sopt.bootstrapWarmStart
+            ? std::max(transcripts[i].sharedCount(), warmStartFloor)
+            : uniformAlpha;
+  }
+  std::vector<uint32_t> bsIterations(numBootstraps, 0);
+  // (the samples solved in batches share the prior's terms of the VBEM)
+  VBEMPriorTerms priorTerms(priorAlphas);
+
+  // Solving the samples in batches reads the equivalence classes once per
+  // iteration for the whole batch (SQUAREM solves them one at a time).  By
+  // default (0), the batches are of 4 (or 2) samples, as long as that still
+  // leaves a batch for every worker thread.
+  uint32_t batchSize = sopt.bootstrapBatchSize;
+  if (batchSize == 0) {
+    uint32_t numWorkers = std::max(sopt.numThreads, uint32_t(2)) - 1;
+    batchSize = 1;
+    if (!sopt.useSQUAREM) {
+      for (uint32_t k : {4, 2}) {
+        if (numBootstraps >= k * numWorkers) {
+          batchSize = k;
+          break;
+        }
+      }
+    }
+  }
+  if (batchSize > 1 and sopt.useSQUAREM) {
+    jointLog->info("--bootstrapBatchSize has no effect with --useSQUAREM; "
+                   "solving the bootstrap samples one at a time");
+    batchSize = 1;
+  }
+  batchSize = std::min(batchSize, std::max(numBootstraps, uint32_t(1)));
+  uint32_t numBatches = (numBootstraps + batchSize - 1) / batchSize;
+
   size_t numWorkerThreads{1};
-  if (sopt.numThreads > 1 and numBootstraps > 1) {
-    numWorkerThreads = std::min(sopt.numThreads - 1, numBootstraps - 1);
+  if (sopt.numThreads > 1 and numBatches > 1) {
+    numWorkerThreads = std::min(sopt.numThreads - 1, numBatches - 1);
+  }
+
+  // The samples are written (and compressed) by a dedicated thread; a
+  // couple of buffers per worker let the workers run ahead of it (as many
+  // as fit in a quarter of what's left of the memory budget, if fewer).
+  size_t numBuffers = 2 * numWorkerThreads;
+  uint64_t bufferBytes = transcripts.size() * sizeof(double);
+  auto& memBudget = salmon::memory::budget();
+  if (!memBudget.fits(numBuffers * bufferBytes, 0.25)) {
+    uint64_t fit = memBudget.available() / 4 / bufferBytes;
+    numBuffers = std::max(uint64_t{1}, fit);
+    jointLog->info("Keeping {} bootstrap samples waiting to be written, to "
+                   "stay within the memory budget",
+                   numBuffers);
   }
+  auto& bufferAccount = memBudget.account("bootstrap_buffers");
+  bufferAccount.set(numBuffers * bufferBytes);
+  AsyncBootstrapWriter bsWriter(writeBootstrap, numBuffers,
+                                transcripts.size());
+
+  uint64_t seed = sopt.samplerSeed;
+  if (seed == 0) {
+    std::random_device rd;
+    seed = (static_cast<uint64_t>(rd()) << 32) | rd();
+  }
+  jointLog->info("Drawing the bootstrap samples with seed {} "
+                 "(pass --seed to reproduce them)",
+                 seed);
 
   std::atomic<uint32_t> bsCounter{0};
   std::vector<std::thread> workerThreads;
   for (size_t tn = 0; tn < numWorkerThreads; ++tn) {
-    workerThreads.emplace_back(
-        doBootstrap, std::ref(txpGroups), std::ref(txpGroupCombinedWeights),
-        std::ref(transcripts), std::ref(effLens), std::ref(samplingWeights),
-        totalCount, numMappedFrags, scale, std::ref(bsCounter), std::ref(sopt),
-        std::ref(priorAlphas), std::ref(writeBootstrap), relDiffTolerance,
-        maxIter);
+    if (batchSize > 1) {
+      workerThreads.emplace_back(
+          doBootstrapBatch, std::ref(txpGroups), std::ref(transcripts),
+          std::ref(samplingWeights), totalCount, numMappedFrags,
+          std::ref(bsCounter), std::ref(sopt), std::cref(priorTerms),
+          std::ref(bsWriter), std::cref(initAlphas), std::ref(bsIterations),
+          seed, relDiffTolerance, maxIter, batchSize);
+    } else {
+      workerThreads.emplace_back(
+          doBootstrap, std::ref(txpGroups), std::ref(transcripts),
+          std::ref(effLens), std::ref(samplingWeights), totalCount,
+          numMappedFrags, std::ref(bsCounter), std::ref(sopt),
+          std::ref(priorAlphas), std::ref(bsWriter), std::cref(initAlphas),
+          std::ref(bsIterations), seed, relDiffTolerance, maxIter);
+    }
   }
 
   for (auto& t : workerThreads) {
     t.join();
   }
+  bool written = bsWriter.finish();
+  bufferAccount.set(0);
+  if (!written) {
+    jointLog->error("Could not write the bootstrap samples");
+    return false;
+  }
+
+  if (!bsIterations.empty()) {
+    auto mm = std::minmax_element(bsIterations.begin(), bsIterations.end());
+    double meanIt =
+        std::accumulate(bsIterations.begin(), bsIterations.end(), 0.0) /
+        bsIterations.size();
+    jointLog->info("Bootstrap EM iterations: mean = {}, min = {}, max = {}",
+                   meanIt, *mm.first, *mm.second);
+  }
+  readExp.setBootstrapIterations(bsIterations);
   return true;
 }
 
-void updateEqClassWeights(
-    std::vector<std::pair<const TranscriptGroup, TGValue>>& eqVec,
-    Eigen::VectorXd& effLens) {
+/**
+ * The convergence test of an offline (VB)EM iteration: the largest relative
+ * change of a transcript with more than alphaCheckCutoff reads, and whether
+ * it is within relDiffTolerance.  The new estimates are moved into alphas
+ * (and alphasPrime reset to 0) in the same pass, which runs in parallel over
+ * the transcripts (only the present ones, if they're sparse).
+ */
+struct ConvergenceCheck {
+  double maxRelDiff;
+  bool converged;
+};
+
+ConvergenceCheck checkConvergence_(CollapsedEMOptimizer::VecType& alphas,
+                                   CollapsedEMOptimizer::VecType& alphasPrime,
+                                   const PresentTranscripts& present,
+                                   double alphaCheckCutoff,
+                                   double relDiffTolerance) {
+  double* a = rawValues(alphas);
+  double* ap = rawValues(alphasPrime);
+  size_t numChecked = present.sparse ? present.ids.size() : alphas.size();
+  const uint32_t* ids = present.sparse ? present.ids.data() : nullptr;
+  double maxRelDiff = tbb::parallel_reduce(
+      BlockedIndexRange(size_t(0), numChecked),
+      -std::numeric_limits<double>::max(),
+      [a, ap, ids, alphaCheckCutoff](const BlockedIndexRange& range,
+                                     double m) -> double {
+        for (auto k : boost::irange(range.begin(), range.end())) {
+          size_t i = (ids != nullptr) ? ids[k] : k;
+          if (ap[i] > alphaCheckCutoff) {
+            double relDiff = std::abs(a[i] - ap[i]) / ap[i];
+            m = (relDiff > m) ? relDiff : m;
+          }
+          a[i] = ap[i];
+          ap[i] = 0.0;
+        }
+        return m;
+      },
+      [](double x, double y) -> double { return std::max(x, y); });
+  return ConvergenceCheck{maxRelDiff, !(maxRelDiff > relDiffTolerance)};
+}
+
+void updateEqClassWeights(FlatEquivalenceClasses& eqClasses,
+                          Eigen::VectorXd& effLens) {
   tbb::parallel_for(
-      BlockedIndexRange(size_t(0), size_t(eqVec.size())),
-      [&eqVec, &effLens](const BlockedIndexRange& range) -> void {
+      BlockedIndexRange(size_t(0), size_t(eqClasses.numClasses())),
+      [&eqClasses, &effLens](const BlockedIndexRange& range) -> void {
         // For each index in the equivalence class vector
         for (auto eqID : boost::irange(range.begin(), range.end())) {
-          // The vector entry
-          auto& kv = eqVec[eqID];
-          // The label of the equivalence class
-          const TranscriptGroup& k = kv.first;
-          // The size of the label
-          size_t classSize = kv.second.weights.size(); // k.txps.size();
-          // The weights of the label
-          TGValue& v = kv.second;
-
-          // Iterate over each weight and set it equal to
-          // 1 / effLen of the corresponding transcript
-          double wsum{0.0};
-          for (size_t i = 0; i < classSize; ++i) {
-            auto tid = k.txps[i];
-            auto probStartPos = 1.0 / effLens(tid);
-            v.combinedWeights[i] =
-                kv.second.count * (v.weights[i] * probStartPos);
-            wsum += v.combinedWeights[i];
-          }
-          double wnorm = 1.0 / wsum;
-          for (size_t i = 0; i < classSize; ++i) {
-            v.combinedWeights[i] *= wnorm;
-          }
+          size_t start = eqClasses.offsets[eqID];
+          refreshClassWeights_(eqClasses.txps.data() + start,
+                               eqClasses.weights.data() + start,
+                               eqClasses.classSize(eqID),
+                               eqClasses.counts[eqID], effLens,
+                               eqClasses.combinedWeights.data() + start);
         }
       });
 }
 
+/**
+ * --geneLevelEM: run the EM over the genes (txpGene[t] is the gene of
+ * transcript t), on the gene-level classes of eqClasses (see
+ * FlatEquivalenceClasses::collapseToGenes), and replace alphas with the
+ * result, each gene's abundance split among its transcripts as alphas split
+ * it on entry.  The transcripts that aren't in any class get none of it.
+ */
+void geneLevelEM_(FlatEquivalenceClasses& eqClasses,
+                  const std::vector<uint32_t>& txpGene,
+                  std::vector<Transcript>& transcripts,
+                  CollapsedEMOptimizer::VecType& alphas,
+                  double relDiffTolerance, uint32_t maxIter,
+                  spdlog::logger* log) {
+  // EM termination criteria, as for the transcripts
+  constexpr uint32_t minIter = 100;
+  constexpr double minAlpha = 1e-8;
+  constexpr double alphaCheckCutoff = 1e-2;
+  auto start = std::chrono::steady_clock::now();
+
+  size_t numTxps = alphas.size();
+  size_t numGenes{0};
+  for (auto g : txpGene) {
+    numGenes = std::max(numGenes, static_cast<size_t>(g) + 1);
+  }
+
+  // The share of its gene's abundance that each transcript is taken to have;
+  // the transcripts that are in some class get at least a little of it, so
+  // that no class is left without weight.
+  std::vector<bool> present(numTxps, false);
+  for (auto t : eqClasses.txps) {
+    present[t] = true;
+  }
+  std::vector<double> withinGene(numTxps, 0.0);
+  std::vector<double> geneSum(numGenes, 0.0);
+  for (size_t t = 0; t < numTxps; ++t) {
+    if (present[t]) {
+      withinGene[t] = std::max(alphas[t].load(), minAlpha);
+      geneSum[txpGene[t]] += withinGene[t];
+    }
+  }
+  for (size_t t = 0; t < numTxps; ++t) {
+    if (present[t]) {
+      withinGene[t] /= geneSum[txpGene[t]];
+    }
+  }
+
+  FlatEquivalenceClasses geneClasses =
+      eqClasses.collapseToGenes(txpGene, withinGene);
+  log->info("Collapsed the {} equivalence classes onto {} genes: {} "
+            "gene-level classes remain",
+            eqClasses.numClasses(), numGenes, geneClasses.numClasses());
+
+  CollapsedEMOptimizer::VecType geneAlphas(numGenes, 0.0);
+  CollapsedEMOptimizer::VecType geneAlphasPrime(numGenes, 0.0);
+  for (size_t t = 0; t < numTxps; ++t) {
+    if (present[t]) {
+      geneAlphas[txpGene[t]] = geneAlphas[txpGene[t]] + alphas[t];
+    }
+  }
+
+  PresentTranscripts allGenes;
+  uint32_t itNum{0};
+  bool converged{false};
+  double maxRelDiff{0.0};
+  while (itNum < minIter or (itNum < maxIter and !converged)) {
+    EMUpdate_(geneClasses, transcripts, geneAlphas, geneAlphasPrime);
+    auto check = checkConvergence_(geneAlphas, geneAlphasPrime, allGenes,
+                                   alphaCheckCutoff, relDiffTolerance);
+    converged = check.converged;
+    maxRelDiff = check.maxRelDiff;
+    ++itNum;
+  }
+
+  for (size_t t = 0; t < numTxps; ++t) {
+    alphas[t] = geneAlphas[txpGene[t]] * withinGene[t];
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  log->info("The gene-level EM took {} iterations (max rel diff. = {}) and "
+            "{} seconds",
+            itNum, maxRelDiff, elapsed.count());
+}
+
+// The components of up to this many transcripts have their information
+// inverted for --approxVariance (O(n^3), ~1s at this size); the transcripts
+// of larger ones get their conditional variances.
+constexpr size_t maxDenseVarianceComponent = 2000;
+
+template <typename ExpT>
+bool CollapsedEMOptimizer::approximateVariances(
+    ExpT& readExp, SalmonOpts& sopt, std::vector<double>& variances) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<Transcript>& transcripts = readExp.transcripts();
+  FlatEquivalenceClasses& eqClasses =
+      readExp.equivalenceClassBuilder().flatEqClasses();
+
+  std::vector<double> alphas(transcripts.size(), 0.0);
+  for (size_t i = 0; i < transcripts.size(); ++i) {
+    alphas[i] = transcripts[i].sharedCount();
+  }
+  // optimize() has compacted the classes, so all of them are valid
+  EqClassPartition partition;
+  partition.build(eqClasses, transcripts.size(), sopt.numThreads);
+
+  salmon::variance::VarianceStats stats;
+  variances = salmon::variance::countVariances(
+      partition, alphas, maxDenseVarianceComponent, stats);
+
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  sopt.jointLog->info("Approximated the count variances over {} components "
+                      "in {:.2f} seconds",
+                      stats.numComponents, elapsed.count());
+  if (stats.numConditional > 0) {
+    sopt.jointLog->warn("{} transcripts are in components of more than {} "
+                        "transcripts; their variances ignore the "
+                        "transcripts they are confounded with, and are "
+                        "likely underestimated",
+                        stats.numConditional, maxDenseVarianceComponent);
+  }
+  return true;
+}
+
 template <typename ExpT>
 bool CollapsedEMOptimizer::optimize(ExpT& readExp, SalmonOpts& sopt,
                                     double relDiffTolerance, uint32_t maxIter) {
@@ -776,11 +1756,31 @@ bool CollapsedEMOptimizer::optimize(ExpT& readExp, SalmonOpts& sopt,
   VecType alphas(transcripts.size(), 0.0);
   VecType alphasPrime(transcripts.size(), 0.0);
   VecType expTheta(transcripts.size());
+  // Only needed for SQUAREM
+  bool useSQUAREM{sopt.useSQUAREM};
+  VecType theta1(useSQUAREM ? transcripts.size() : 0);
+  VecType theta2(useSQUAREM ? transcripts.size() : 0);
 
   Eigen::VectorXd effLens(transcripts.size());
 
-  std::vector<std::pair<const TranscriptGroup, TGValue>>& eqVec =
-      readExp.equivalenceClassBuilder().eqVec();
+  FlatEquivalenceClasses& eqClasses =
+      readExp.equivalenceClassBuilder().flatEqClasses();
+
+  // In targeted mode (--targets), the classes outside of the targets'
+  // components are dropped here, so that neither the (VB)EM nor the
+  // bootstraps nor the Gibbs sampler look at them again; their fragments are
+  // counted as background.
+  std::vector<bool> inTarget;
+  if (!sopt.targets.empty()) {
+    uint64_t numBackground = eqClasses.restrictToTargets(
+        sopt.targets, transcripts.size(), inTarget);
+    readExp.setNumBackgroundFragments(numBackground);
+    sopt.jointLog->info("Quantifying the components of {} targets ({} "
+                        "transcripts); {} fragments are background",
+                        sopt.targets.size(),
+                        std::count(inTarget.begin(), inTarget.end(), true),
+                        numBackground);
+  }
 
   bool noRichEq = sopt.noRichEqClasses;
   bool useFSPD{sopt.useFSPD};
@@ -840,6 +1840,21 @@ bool CollapsedEMOptimizer::optimize(ExpT& readExp, SalmonOpts& sopt,
       alphas[i] = alphasPrime[i];
       alphasPrime[i] = 1.0;
     }
+  } else if (sopt.initProfile.size() == alphas.size()) {
+    // Start from the given (e.g. cohort-wide) profile, scaled to this
+    // sample's fragments.  Since the EM can never move mass to a transcript
+    // whose abundance is 0, the profile is floored at a small fraction of the
+    // uniform abundance (as the bootstrap warm starts are).
+    double profileSum = std::accumulate(sopt.initProfile.begin(),
+                                        sopt.initProfile.end(), 0.0);
+    double profileScale =
+        (profileSum > 0.0) ? totalNumFrags / profileSum : 0.0;
+    double profileFloor = 1e-3 * totalNumFrags / numActive;
+    for (size_t i = 0; i < alphas.size(); ++i) {
+      alphas[i] =
+          std::max(sopt.initProfile[i] * profileScale, profileFloor);
+      alphasPrime[i] = 1.0;
+    }
   } else { // otherwise, initalize with a linear combination of the true and
            // uniform alphas
     for (size_t i = 0; i < alphas.size(); ++i) {
@@ -850,6 +1865,15 @@ bool CollapsedEMOptimizer::optimize(ExpT& readExp, SalmonOpts& sopt,
       alphasPrime[i] = 1.0;
     }
   }
+  // The transcripts outside of the targets' components get no mass, so that
+  // the bias correction skips their effective lengths
+  if (!inTarget.empty()) {
+    for (size_t i = 0; i < alphas.size(); ++i) {
+      if (!inTarget[i]) {
+        alphas[i] = 0.0;
+      }
+    }
+  }
 
   // If the user requested *not* to use "rich" equivalence classes,
   // then wipe out all of the weight information here and simply replace
@@ -857,51 +1881,132 @@ bool CollapsedEMOptimizer::optimize(ExpT& readExp, SalmonOpts& sopt,
   // the effective length).  Otherwise, multiply the existing weight terms
   // by the effective length term.
   tbb::parallel_for(
-      BlockedIndexRange(size_t(0), size_t(eqVec.size())),
-      [&eqVec, &effLens, noRichEq](const BlockedIndexRange& range) -> void {
+      BlockedIndexRange(size_t(0), size_t(eqClasses.numClasses())),
+      [&eqClasses, &effLens, noRichEq](const BlockedIndexRange& range) -> void {
+        auto& weights = eqClasses.weights;
+        auto& combinedWeights = eqClasses.combinedWeights;
         // For each index in the equivalence class vector
         for (auto eqID : boost::irange(range.begin(), range.end())) {
-          // The vector entry
-          auto& kv = eqVec[eqID];
-          // The label of the equivalence class
-          const TranscriptGroup& k = kv.first;
-          // The size of the label
-          size_t classSize = kv.second.weights.size(); // k.txps.size();
-          // The weights of the label
-          TGValue& v = kv.second;
+          // The range of this class
+          size_t start = eqClasses.offsets[eqID];
+          size_t end = eqClasses.offsets[eqID + 1];
+          uint64_t count = eqClasses.counts[eqID];
 
           // Iterate over each weight and set it
           double wsum{0.0};
 
-          for (size_t i = 0; i < classSize; ++i) {
-            auto tid = k.txps[i];
+          for (size_t i = start; i < end; ++i) {
+            auto tid = eqClasses.txps[i];
             double el = effLens(tid);
             if (el <= 1.0) {
               el = 1.0;
             }
             if (noRichEq) {
               // Keep length factor separate for the time being
-              v.weights[i] = 1.0;
+              weights[i] = 1.0;
             }
             // meaningful values.
             auto probStartPos = 1.0 / el;
 
             // combined weight
-            v.combinedWeights.push_back(v.count * v.weights[i] * probStartPos);
-            wsum += v.combinedWeights.back();
+            combinedWeights[i] = count * weights[i] * probStartPos;
+            wsum += combinedWeights[i];
           }
 
           double wnorm = 1.0 / wsum;
-          for (size_t i = 0; i < classSize; ++i) {
-            v.combinedWeights[i] = v.combinedWeights[i] * wnorm;
+          for (size_t i = start; i < end; ++i) {
+            combinedWeights[i] = combinedWeights[i] * wnorm;
           }
         }
       });
 
-  auto numRemoved =
-      markDegenerateClasses(eqVec, alphas, effLens, available, sopt.jointLog);
+  auto numRemoved = markDegenerateClasses(eqClasses, alphas, effLens,
+                                          available, sopt.jointLog);
   sopt.jointLog->info("Marked {} weighted equivalence classes as degenerate",
                       numRemoved);
+  // Drop the degenerate (and, in targeted mode, the background) classes for
+  // good, so that neither the (VB)EM nor the bootstraps, the Gibbs sampler
+  // or the --dumpEq output visit them again
+  auto compaction = eqClasses.compact();
+  sopt.jointLog->info("Compacted the equivalence classes: dropped {} invalid "
+                      "or empty classes and merged {} duplicates; {} remain",
+                      compaction.numDropped, compaction.numMerged,
+                      eqClasses.numClasses());
+  sopt.jointLog->info("Using the {} EM kernels",
+                      salmon::emkernels::gatherDotImpl());
+
+  // With --geneLevelEM, resolve the genes first.  The transcripts are then
+  // either resolved starting from there, or (without --refineTranscripts)
+  // left with their genes' abundances, split as the initial estimates split
+  // them.  The bias correction needs the transcripts' abundances.
+  bool geneLevelOnly{false};
+  if (sopt.geneLevelEM) {
+    if (sopt.transcriptGenes.size() != transcripts.size()) {
+      sopt.transcriptGenes = salmon::utils::transcriptGeneIDs(
+          sopt.geneMapPath, transcripts, sopt.geneMapCacheDirectory);
+    }
+    geneLevelEM_(eqClasses, sopt.transcriptGenes, transcripts, alphas,
+                 relDiffTolerance, maxIter, jointLog.get());
+    geneLevelOnly = !sopt.refineTranscripts and !doBiasCorrect;
+    if (!sopt.refineTranscripts and doBiasCorrect) {
+      jointLog->info("The bias correction needs the transcript-level "
+                     "estimates; refining them");
+    }
+  }
+
+  // Unless atomic updates are requested, partition the classes
+  // so that the EM can accumulate its updates without atomics.
+  std::unique_ptr<EqClassPartition> partition{nullptr};
+  if (!sopt.atomicEMUpdates and !geneLevelOnly) {
+    partition.reset(new EqClassPartition);
+    partition->build(eqClasses, transcripts.size(), sopt.numThreads,
+                     sopt.emSinglePrecision);
+    if (sopt.emSinglePrecision) {
+      sopt.jointLog->info("Using single-precision weights in the EM");
+    }
+    sopt.jointLog->info("Partitioned the equivalence classes into {} blocks "
+                        "({} classes in shared components)",
+                        partition->numBlocks(),
+                        partition->numSharedClasses());
+  }
+
+  // The transcripts that aren't in any valid class have no mass after the
+  // first iteration; when they're most of them, they get none from the start
+  // and the iterations skip them.  (The SQUAREM steps stay dense.)
+  PresentTranscripts present;
+  if (!useSQUAREM) {
+    present.build(eqClasses, transcripts.size());
+  }
+  if (present.sparse) {
+    size_t k{0};
+    for (size_t i = 0; i < transcripts.size(); ++i) {
+      if (k < present.ids.size() and present.ids[k] == i) {
+        ++k;
+        continue;
+      }
+      alphas[i] = 0.0;
+      alphasPrime[i] = 0.0;
+    }
+    present.setPriors(priorAlphas);
+    jointLog->info("Iterating over the {} of {} transcripts that appear in "
+                   "an equivalence class",
+                   present.ids.size(), transcripts.size());
+  }
+  auto emStart = std::chrono::steady_clock::now();
+
+  auto emStep = [&](const VecType& in, VecType& out) -> void {
+    if (useVBEM) {
+      VBEMUpdate_(eqClasses, transcripts, priorAlphas, totalLen, in, out,
+                  expTheta, partition.get());
+    } else {
+      std::fill(rawValues(out), rawValues(out) + out.size(), 0.0);
+      EMUpdate_(eqClasses, transcripts, in, out, partition.get());
+    }
+  };
+  auto logLik = [&](const double* a) -> double {
+    return parallelLogLikelihood_(eqClasses, a, transcripts.size());
+  };
+  double logLikCur = std::numeric_limits<double>::quiet_NaN();
 
   size_t itNum{0};
 
@@ -918,23 +2023,38 @@ bool CollapsedEMOptimizer::optimize(ExpT& readExp, SalmonOpts& sopt,
   bool converged{false};
   double maxRelDiff = -std::numeric_limits<double>::max();
   bool needBias = doBiasCorrect;
+  // The log-likelihood is tracked every this many iterations (0 = never)
+  uint32_t objectiveInterval = sopt.emObjectiveInterval;
+  double prevObjective = std::numeric_limits<double>::quiet_NaN();
+  // The effective lengths for which the next (VB)EM update is to recompute
+  // the combined weights (once the biases have been accounted for)
+  const Eigen::VectorXd* refreshEffLens{nullptr};
   size_t targetIt{10};
   /* -- v0.8.x
   double alphaSum = 0.0;
   */
 
-  while (itNum < minIter or (itNum < maxIter and !converged) or needBias) {
+  // The iterations are traced in batches (of those between log lines)
+  auto emBatchStart = PerformanceStats::Clock::now();
+  while (!geneLevelOnly and
+         (itNum < minIter or (itNum < maxIter and !converged) or needBias)) {
     if (needBias and (itNum > targetIt or converged)) {
 
       jointLog->info(
           "iteration {}, adjusting effective lengths to account for biases",
           itNum);
+      PerformanceStats::Scope effLenPhase(*sopt.perfStats,
+                                          "update_effective_lengths");
       effLens = salmon::utils::updateEffectiveLengths(sopt, readExp, effLens,
                                                       alphas, available, true);
+      effLenPhase.finish();
       // if we're doing the VB optimization, update the priors
       if (useVBEM) {
         priorAlphas = populatePriorAlphas_(transcripts, effLens, priorValue,
                                            perTranscriptPrior);
+        if (present.sparse) {
+          present.setPriors(priorAlphas);
+        }
       }
 
       // Check for strangeness with the lengths.
@@ -943,29 +2063,69 @@ bool CollapsedEMOptimizer::optimize(ExpT& readExp, SalmonOpts& sopt,
           jointLog->warn("Transcript {} had length {}", i, effLens(i));
         }
       }
-      updateEqClassWeights(eqVec, effLens);
+      if (useSQUAREM) {
+        updateEqClassWeights(eqClasses, effLens);
+        if (partition) {
+          partition->refreshWeights(eqClasses);
+        }
+      } else {
+        // The next (VB)EM update recomputes the weights as it goes
+        refreshEffLens = &effLens;
+      }
+      // The likelihood changes along with the weights
+      logLikCur = std::numeric_limits<double>::quiet_NaN();
       needBias = false;
     }
 
-    if (useVBEM) {
-      VBEMUpdate_(eqVec, transcripts, priorAlphas, totalLen, alphas,
-                  alphasPrime, expTheta);
+    size_t prevItNum = itNum;
+    if (useSQUAREM) {
+      // Counts the EM updates, so that minIter, maxIter and the bias
+      // correction schedule refer to the same amount of work.
+      itNum += squaremCycle_(alphas, theta1, theta2, alphasPrime, emStep,
+                             logLik, logLikCur) -
+               1;
+    } else if (useVBEM) {
+      VBEMUpdate_(eqClasses, transcripts, priorAlphas, totalLen, alphas,
+                  alphasPrime, expTheta, partition.get(), &present,
+                  refreshEffLens);
     } else {
-      EMUpdate_(eqVec, transcripts, alphas, alphasPrime);
+      EMUpdate_(eqClasses, transcripts, alphas, alphasPrime, partition.get(),
+                refreshEffLens);
+    }
+    refreshEffLens = nullptr;
+
+    // Stop updating the components that have converged on their own.  Only
+    // single-transcript components may stop before minIter (or while we
+    // still have to account for biases), since their solution is exact.
+    if (partition and sopt.componentConvergence) {
+      partition->freezeConverged(rawValues(alphas), rawValues(alphasPrime),
+                                 relDiffTolerance, alphaCheckCutoff,
+                                 itNum >= minIter and !needBias,
+                                 itNum - prevItNum + 1);
     }
 
-    converged = true;
-    maxRelDiff = -std::numeric_limits<double>::max();
-    for (size_t i = 0; i < transcripts.size(); ++i) {
-      if (alphasPrime[i] > alphaCheckCutoff) {
-        double relDiff = std::abs(alphas[i] - alphasPrime[i]) / alphasPrime[i];
-        maxRelDiff = (relDiff > maxRelDiff) ? relDiff : maxRelDiff;
-        if (relDiff > relDiffTolerance) {
-          converged = false;
-        }
+    auto check = checkConvergence_(alphas, alphasPrime, present,
+                                   alphaCheckCutoff, relDiffTolerance);
+    converged = check.converged;
+    maxRelDiff = check.maxRelDiff;
+
+    // Every objectiveInterval iterations, stop once the log-likelihood has
+    // stagnated, even if a few (low-abundance) transcripts are still moving
+    if (objectiveInterval > 0 and itNum % objectiveInterval == 0) {
+      double ll = logLik(rawValues(alphas));
+      bool stagnant = std::isfinite(prevObjective) and
+                      std::abs(ll - prevObjective) <=
+                          sopt.emObjectiveTolerance * std::abs(prevObjective);
+      prevObjective = needBias ? std::numeric_limits<double>::quiet_NaN() : ll;
+      jointLog->info("iteration = {} | log-likelihood = {}", itNum, ll);
+      if (stagnant and !converged and itNum >= minIter and !needBias) {
+        jointLog->info("The log-likelihood changed by less than a relative {} "
+                       "over the last {} iterations (max rel diff. = {}); "
+                       "stopping",
+                       sopt.emObjectiveTolerance, objectiveInterval,
+                       maxRelDiff);
+        converged = true;
       }
-      alphas[i] = alphasPrime[i];
-      alphasPrime[i] = 0.0;
     }
 
     /* -- v0.8.x
@@ -992,12 +2152,16 @@ bool CollapsedEMOptimizer::optimize(ExpT& readExp, SalmonOpts& sopt,
     }
     */
 
-    if (itNum % 100 == 0) {
+    if (itNum / 100 != prevItNum / 100 or itNum % 100 == 0) {
       jointLog->info("iteration = {} | max rel diff. = {}", itNum, maxRelDiff);
+      sopt.perfStats->span("em_iterations", emBatchStart, "em");
     }
+    sopt.runStatus->emIteration = itNum;
+    sopt.runStatus->emMaxRelDiff = maxRelDiff;
 
     ++itNum;
   }
+  sopt.perfStats->span("em_iterations", emBatchStart, "em");
 
   /* -- v0.8.x
   if (alphaSum < minWeight) {
@@ -1011,7 +2175,23 @@ bool CollapsedEMOptimizer::optimize(ExpT& readExp, SalmonOpts& sopt,
   sopt.gcBiasCorrect = gcBiasCorrect;
   sopt.biasCorrect = seqBiasCorrect;
 
-  jointLog->info("iteration = {} | max rel diff. = {}", itNum, maxRelDiff);
+  if (!geneLevelOnly) {
+    jointLog->info("iteration = {} | max rel diff. = {}", itNum, maxRelDiff);
+  }
+  std::chrono::duration<double> emTime =
+      std::chrono::steady_clock::now() - emStart;
+  jointLog->info("EM took {} seconds with {} threads", emTime.count(),
+                 sopt.numThreads);
+  if (partition and sopt.componentConvergence) {
+    double fullUpdates = static_cast<double>(itNum) *
+                         partition->classes.numClasses();
+    jointLog->info("Solving the {} components independently took {:.1f}% of "
+                   "the class updates of a global EM",
+                   partition->numComponents(),
+                   (fullUpdates > 0.0)
+                       ? 100.0 * partition->numClassUpdates() / fullUpdates
+                       : 0.0);
+  }
 
   double alphaSum = 0.0;
   if (useVBEM and !perTranscriptPrior) {
@@ -1058,6 +2238,10 @@ template bool CollapsedEMOptimizer::optimize<AlignmentLibrary<ReadPair>>(
     AlignmentLibrary<ReadPair>& readExp, SalmonOpts& sopt,
     double relDiffTolerance, uint32_t maxIter);
 
+template bool CollapsedEMOptimizer::optimize<PartialExperiment>(
+    PartialExperiment& readExp, SalmonOpts& sopt, double relDiffTolerance,
+    uint32_t maxIter);
+
 template bool CollapsedEMOptimizer::gatherBootstraps<ReadExperiment>(
     ReadExperiment& readExp, SalmonOpts& sopt,
     std::function<bool(const std::vector<double>&)>& writeBootstrap,
@@ -1075,4 +2259,26 @@ CollapsedEMOptimizer::gatherBootstraps<AlignmentLibrary<ReadPair>>(
     std::function<bool(const std::vector<double>&)>& writeBootstrap,
     double relDiffTolerance, uint32_t maxIter);
 
+template bool CollapsedEMOptimizer::gatherBootstraps<PartialExperiment>(
+    PartialExperiment& readExp, SalmonOpts& sopt,
+    std::function<bool(const std::vector<double>&)>& writeBootstrap,
+    double relDiffTolerance, uint32_t maxIter);
+
+template bool CollapsedEMOptimizer::approximateVariances<ReadExperiment>(
+    ReadExperiment& readExp, SalmonOpts& sopt, std::vector<double>& variances);
+
+template bool
+CollapsedEMOptimizer::approximateVariances<AlignmentLibrary<UnpairedRead>>(
+    AlignmentLibrary<UnpairedRead>& readExp, SalmonOpts& sopt,
+    std::vector<double>& variances);
+
+template bool
+CollapsedEMOptimizer::approximateVariances<AlignmentLibrary<ReadPair>>(
+    AlignmentLibrary<ReadPair>& readExp, SalmonOpts& sopt,
+    std::vector<double>& variances);
+
+template bool CollapsedEMOptimizer::approximateVariances<PartialExperiment>(
+    PartialExperiment& readExp, SalmonOpts& sopt,
+    std::vector<double>& variances);
+
 // Unused / old
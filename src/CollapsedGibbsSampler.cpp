@@ -1,4 +1,5 @@
 #include <atomic>
+#include <chrono>
 #include <mutex>
 #include <random>
 #include <thread>
@@ -6,12 +7,12 @@
 #include <vector>
 
 #include "tbb/blocked_range.h"
-#include "tbb/combinable.h"
 #include "tbb/enumerable_thread_specific.h"
 #include "tbb/parallel_for.h"
 #include "tbb/parallel_for_each.h"
 #include "tbb/parallel_reduce.h"
 #include "tbb/partitioner.h"
+#include "tbb/task_arena.h"
 #include "tbb/task_scheduler_init.h"
 
 //#include "fastapprox.h"
@@ -30,13 +31,17 @@
 #include "AlignmentLibrary.hpp"
 #include "BootstrapWriter.hpp"
 #include "CollapsedGibbsSampler.hpp"
+#include "FlatEquivalenceClasses.hpp"
+#include "GammaSampler.hpp"
 #include "MultinomialSampler.hpp"
+#include "PartialExperiment.hpp"
 #include "ReadExperiment.hpp"
 #include "ReadPair.hpp"
 #include "SalmonMath.hpp"
 #include "Transcript.hpp"
 #include "TranscriptGroup.hpp"
 #include "UnpairedRead.hpp"
+#include "blockingconcurrentqueue.h"
 #include "ezETAProgressBar.hpp"
 
 using BlockedIndexRange = tbb::blocked_range<size_t>;
@@ -76,6 +81,43 @@ divide_work(Iterator begin, Iterator end, std::size_t n) {
   return ranges;
 }
 
+// The number of transcripts (or equivalence classes) handled by each task of
+// a sampling round.
+constexpr size_t gibbsGrainSize = 1024;
+
+/**
+ * Scramble x (with the splitmix64 finalizer); used to derive well-separated
+ * seeds for each chain and round from the master seed.
+ */
+inline uint64_t mixSeed_(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+/**
+ * The work done, and the time spent, in the sampling rounds (of all of the
+ * chains), to report their throughput.
+ */
+struct GibbsRoundStats {
+  std::atomic<uint64_t> numRounds{0};
+  // the transcript fractions drawn from their gamma distributions
+  std::atomic<uint64_t> numGammaDraws{0};
+  // the reads of multi-transcript classes reassigned by multinomial draws
+  std::atomic<uint64_t> numReadsDrawn{0};
+  std::atomic<uint64_t> gammaNs{0};
+  std::atomic<uint64_t> multinomialNs{0};
+};
+
+/**
+ * The (hard) read counts of the transcripts, as drawn by a chain's latest
+ * round; a transcript would need more than 2^32 reads to overflow its count.
+ * The rounds add to the counts of a chain atomically, so a round needs no
+ * per-thread copies of them.
+ */
+using GibbsTxpCounts = std::vector<std::atomic<uint32_t>>;
+
 /**
  * This non-collapsed Gibbs step is largely inspired by the method first
  * introduced by  Turro et al. [1].  Given the current estimates `txpCount` of
@@ -88,160 +130,286 @@ divide_work(Iterator begin, Iterator end, std::size_t n) {
  * [1] Haplotype and isoform specific expression estimation using multi-mapping
  *RNA-seq reads. Turro E, Su S-Y, Goncalves A, Coin L, Richardson S and Lewin A.
  * Genome Biology, 2011 Feb; 12:R13.  doi: 10.1186/gb-2011-12-2-r13.
+ *
+ * Only the transcripts in `activeList` are resampled.  If `classList` is not
+ * null, only the equivalence classes it lists are resampled; the caller must
+ * ensure that muGlobal is 0 for the transcripts of these classes that are
+ * not active.
+ *
+ * The fractions are drawn a batch (a task's range of transcripts) at a time
+ * by GammaSampler, from counter-based streams keyed by the round seed and the
+ * transcript, and the reads of each class are reassigned by a single
+ * multinomial draw (as a sequence of conditional binomials, in O(class size)
+ * rather than O(reads) time).
+ *
+ * The counts are taken from `initCounts` (the non-integral counts a chain
+ * starts from) if it is not null, and from `txpCount` otherwise; the round
+ * leaves the counts it draws in `txpCount`.
  **/
 void sampleRoundNonCollapsedMultithreaded_(
-    std::vector<std::pair<const TranscriptGroup, TGValue>>& eqVec,
-    std::vector<bool>& active, std::vector<uint32_t>& activeList,
-    std::vector<uint64_t>& countMap, std::vector<double>& probMap,
-    std::vector<double>& muGlobal, Eigen::VectorXd& effLens,
-    const std::vector<double>& priorAlphas, std::vector<double>& txpCount,
-    std::vector<uint32_t>& offsetMap) {
+    FlatEquivalenceClasses& eqClasses, std::vector<bool>& active,
+    std::vector<uint32_t>& activeList, std::vector<double>& muGlobal,
+    Eigen::VectorXd& effLens, const std::vector<double>& priorAlphas,
+    const std::vector<double>* initCounts, GibbsTxpCounts& txpCount,
+    uint64_t roundSeed, GibbsRoundStats& stats,
+    const std::vector<uint32_t>* classList = nullptr) {
 
   // generate coeff for \mu from \alpha and \effLens
   double beta = 0.1;
   double norm = 0.0;
 
   // Sample the transcript fractions \mu from a gamma distribution, and
-  // reset txpCounts to zero for each transcript.
-  typedef tbb::enumerable_thread_specific<pcg32_unique> GeneratorType;
-  auto getGenerator = []() -> pcg32_unique {
-    return pcg32_unique(pcg_extras::seed_seq_from<std::random_device>());
-  };
-  GeneratorType localGenerator(getGenerator);
-
-  // Compute the mu to be used in the equiv class resampling
+  // reset txpCounts to zero for each transcript.  The fraction of a
+  // transcript depends only on the round seed and the transcript, not on
+  // the scheduling.
+  auto gammaStart = std::chrono::steady_clock::now();
+  GammaSampler gammaSampler(roundSeed);
   tbb::parallel_for(
-      BlockedIndexRange(
-          size_t(0), size_t(activeList.size())), // 1024 is grainsize, use only
-                                                 // with simple_partitioner
+      BlockedIndexRange(size_t(0), size_t(activeList.size()),
+                        gibbsGrainSize),
       [&, beta](const BlockedIndexRange& range) -> void {
-        GeneratorType::reference gen = localGenerator.local();
-        for (auto activeIdx : boost::irange(range.begin(), range.end())) {
-          auto i = activeList[activeIdx];
-          double ci = static_cast<double>(txpCount[i] + priorAlphas[i]);
-          std::gamma_distribution<double> d(ci, 1.0 / (beta + effLens(i)));
-          muGlobal[i] = d(gen);
-          txpCount[i] = 0.0;
-          /** DEBUG
-          if (std::isnan(muGlobal[i]) or std::isinf(muGlobal[i])) {
-            std::cerr << "txpCount = " << txpCount[i] << ", prior = " <<
-          priorAlphas[i] << ", alpha = " << ci << ", beta = " << (1.0 / (beta +
-          effLens(i))) << ", mu = " << muGlobal[i] << "\n"; std::exit(1);
-          }
-          **/
+        size_t n = range.size();
+        const uint32_t* ids = activeList.data() + range.begin();
+        std::vector<double> shapes(n);
+        std::vector<double> scales(n);
+        std::vector<double> mus(n);
+        for (size_t k = 0; k < n; ++k) {
+          auto i = ids[k];
+          double count = (initCounts)
+                             ? (*initCounts)[i]
+                             : txpCount[i].load(std::memory_order_relaxed);
+          shapes[k] = count + priorAlphas[i];
+          scales[k] = 1.0 / (beta + effLens(i));
+          txpCount[i].store(0, std::memory_order_relaxed);
         }
-      });
-
-  /**
-   * These will store "thread local" parameters
-   * for the threads doing local sampling of equivalence class counts.
-   */
-  class CombineableTxpCounts {
-  public:
-    CombineableTxpCounts(uint32_t numTxp) : txpCount(numTxp, 0) {
-      gen.reset(
-          new pcg32_unique(pcg_extras::seed_seq_from<std::random_device>()));
-    }
-    std::vector<int> txpCount;
-    std::unique_ptr<pcg32_unique> gen{nullptr};
-  };
-  tbb::combinable<CombineableTxpCounts> combineableCounts(txpCount.size());
+        gammaSampler(ids, shapes.data(), scales.data(), mus.data(), n);
+        for (size_t k = 0; k < n; ++k) {
+          muGlobal[ids[k]] = mus[k];
+        }
+      },
+      tbb::simple_partitioner());
+  auto gammaEnd = std::chrono::steady_clock::now();
 
   std::mutex writeMut;
+  std::atomic<uint64_t> numReadsDrawn{0};
   // resample within each equivalence class
+  size_t numRoundClasses =
+      (classList) ? classList->size() : eqClasses.numClasses();
   tbb::parallel_for(
-      BlockedIndexRange(size_t(0), size_t(eqVec.size())),
+      BlockedIndexRange(size_t(0), numRoundClasses, gibbsGrainSize),
       [&](const BlockedIndexRange& range) -> void {
 
-        auto& txpCountLoc = combineableCounts.local().txpCount;
-        auto& gen = *(combineableCounts.local().gen.get());
-        for (auto eqid : boost::irange(range.begin(), range.end())) {
-          auto& eqClass = eqVec[eqid];
-          size_t offset = offsetMap[eqid];
+        // Each range gets its own generator, seeded from the round seed and
+        // the start of the range.  Since the simple_partitioner always
+        // splits the work into the same ranges, the samples don't depend on
+        // the scheduling.
+        MultinomialSampler msamp(roundSeed, 2 * range.begin() + 1);
+        std::vector<uint64_t> classTxpCounts;
+        // the probabilities of the transcripts of the current class
+        std::vector<double> probs;
+        uint64_t rangeReadsDrawn{0};
+        for (auto classIdx : boost::irange(range.begin(), range.end())) {
+          size_t eqid = (classList) ? (*classList)[classIdx] : classIdx;
+          size_t offset = eqClasses.offsets[eqid];
 
           // get total number of reads for an equivalence class
-          uint64_t classCount = eqClass.second.count;
+          uint64_t classCount = eqClasses.counts[eqid];
 
           // for each transcript in this class
-          const TranscriptGroup& tgroup = eqClass.first;
-          const size_t groupSize =
-              eqClass.second.weights.size(); // tgroup.txps.size();
-          if (tgroup.valid) {
-            const std::vector<uint32_t>& txps = tgroup.txps;
-            const auto& auxs = eqClass.second.combinedWeights;
-            const auto& weights = eqClass.second.weights;
+          const size_t groupSize = eqClasses.classSize(eqid);
+          const uint32_t* txps = eqClasses.txps.data() + offset;
+          const double* weights = eqClasses.weights.data() + offset;
+
+          double denom = 0.0;
+          // If this is a single-transcript group,
+          // then it gets the full count --- otherwise,
+          // sample!
+          if (BOOST_LIKELY(groupSize > 1)) {
+            // For each transcript in the group
+            double muSum = 0.0;
+            probs.resize(groupSize);
+            for (size_t i = 0; i < groupSize; ++i) {
+              auto tid = txps[i];
+              probs[i] = (1000.0 * muGlobal[tid]) * weights[i];
+              muSum += probs[i];
+              denom += probs[i];
+            }
 
-            double denom = 0.0;
-            // If this is a single-transcript group,
-            // then it gets the full count --- otherwise,
-            // sample!
-            if (BOOST_LIKELY(groupSize > 1)) {
-              // For each transcript in the group
-              double muSum = 0.0;
+            if (denom <= ::minEQClassWeight) {
+              {
+                std::lock_guard<std::mutex> lg(writeMut);
+                std::cerr
+                    << "[WARNING] eq class denom was too small : denom = "
+                    << denom << ", numReads = " << classCount
+                    << ". Distributing reads evenly for this class\n";
+              }
+
+              denom = 0.0;
+              muSum = 0.0;
               for (size_t i = 0; i < groupSize; ++i) {
                 auto tid = txps[i];
-                size_t gi = offset + i;
-                probMap[gi] = (1000.0 * muGlobal[tid]) * weights[i];
-                muSum += probMap[gi];
-                denom += probMap[gi];
+                probs[i] = 1.0 / effLens(tid);
+                muSum += probs[i];
+                denom += probs[i];
               }
 
+              // If it's still too small --- divide evenly
               if (denom <= ::minEQClassWeight) {
-                {
-                  std::lock_guard<std::mutex> lg(writeMut);
-                  std::cerr
-                      << "[WARNING] eq class denom was too small : denom = "
-                      << denom << ", numReads = " << classCount
-                      << ". Distributing reads evenly for this class\n";
-                }
-
-                denom = 0.0;
-                muSum = 0.0;
                 for (size_t i = 0; i < groupSize; ++i) {
                   auto tid = txps[i];
-                  size_t gi = offset + i;
-                  probMap[gi] = 1.0 / effLens(tid);
-                  muSum += probMap[gi];
-                  denom += probMap[gi];
-                }
-
-                // If it's still too small --- divide evenly
-                if (denom <= ::minEQClassWeight) {
-                  for (size_t i = 0; i < groupSize; ++i) {
-                    auto tid = txps[i];
-                    size_t gi = offset + i;
-                    probMap[gi] = 1.0;
-                  }
-                  denom = groupSize;
-                  muSum = groupSize;
+                  probs[i] = 1.0;
                 }
+                denom = groupSize;
+                muSum = groupSize;
               }
+            }
 
-              if (denom > ::minEQClassWeight) {
-                // Local multinomial
-                std::discrete_distribution<int> dist(probMap.begin() + offset,
-                                                     probMap.begin() + offset +
-                                                         groupSize);
-                for (size_t s = 0; s < classCount; ++s) {
-                  auto ind = dist(gen);
-                  ++txpCountLoc[txps[ind]];
+            if (denom > ::minEQClassWeight) {
+              // Local multinomial
+              classTxpCounts.resize(groupSize);
+              msamp(classTxpCounts.begin(), classCount, groupSize,
+                    probs.begin());
+              for (size_t i = 0; i < groupSize; ++i) {
+                if (classTxpCounts[i] > 0) {
+                  txpCount[txps[i]].fetch_add(
+                      static_cast<uint32_t>(classTxpCounts[i]),
+                      std::memory_order_relaxed);
                 }
               }
-            } // do nothing if group size less than 2
-            else {
-              auto tid = txps[0];
-              txpCountLoc[tid] += static_cast<int>(classCount);
+              rangeReadsDrawn += classCount;
             }
-          } // valid group
+          } // do nothing if group size less than 2
+          else {
+            auto tid = txps[0];
+            txpCount[tid].fetch_add(static_cast<uint32_t>(classCount),
+                                    std::memory_order_relaxed);
+          }
         }   // loop over all eq classes
-      });
+        numReadsDrawn += rangeReadsDrawn;
+      },
+      tbb::simple_partitioner());
+
+  auto roundEnd = std::chrono::steady_clock::now();
+  using std::chrono::duration_cast;
+  using std::chrono::nanoseconds;
+  ++stats.numRounds;
+  stats.numGammaDraws += activeList.size();
+  stats.numReadsDrawn += numReadsDrawn;
+  stats.gammaNs += duration_cast<nanoseconds>(gammaEnd - gammaStart).count();
+  stats.multinomialNs +=
+      duration_cast<nanoseconds>(roundEnd - gammaEnd).count();
+}
 
-  auto combineCounts = [&txpCount](const CombineableTxpCounts& p) -> void {
-    for (size_t i = 0; i < txpCount.size(); ++i) {
-      txpCount[i] += static_cast<double>(p.txpCount[i]);
+/**
+ * Run a single Gibbs chain, starting from the counts alphasInit, and pass each
+ * of its numChainSamples (thinned) samples to emitSample.  The samples depend
+ * only on chainSeed.
+ *
+ * If useActiveSet is true, all but the last round between two samples
+ * resample only the transcripts that had (non-negligible) counts after the
+ * previous sample, and only the classes that contain at least one of them;
+ * every sample is still taken after a round over all of the transcripts.
+ *
+ * The classes, effective lengths, priors and initial counts are shared,
+ * read-only, by all of the chains; a chain holds only its transcript
+ * fractions, its (32-bit) counts and the sample it emits.
+ */
+template <typename EmitFunT>
+void runGibbsChain_(FlatEquivalenceClasses& eqClasses,
+                    std::vector<bool>& active,
+                    std::vector<uint32_t>& activeList, Eigen::VectorXd& effLens,
+                    const std::vector<double>& priorAlphas,
+                    const std::vector<double>& alphasInit,
+                    uint32_t numInternalRounds, uint32_t numChainSamples,
+                    bool dontExtrapolateCounts, double numMappedFragments,
+                    uint64_t chainSeed, bool useActiveSet,
+                    GibbsRoundStats& stats, EmitFunT& emitSample) {
+  size_t numTranscripts{alphasInit.size()};
+  // the counts drawn by the latest round (none before the first one)
+  GibbsTxpCounts alphasIn(numTranscripts);
+  bool firstRound{true};
+  auto countOf = [&](uint32_t i) -> double {
+    return firstRound ? alphasInit[i]
+                      : alphasIn[i].load(std::memory_order_relaxed);
+  };
+  // will hold estimated counts
+  std::vector<double> alphas(numTranscripts, 0.0);
+  std::vector<double> mu(numTranscripts, 0.0);
+
+  // The transcripts (and classes) resampled in the rounds between samples,
+  // if we're using the active set.
+  double minActiveCount = 1e-8;
+  std::vector<uint32_t> roundActiveList;
+  std::vector<uint32_t> roundClasses;
+  auto shrinkActiveSet = [&]() -> void {
+    roundActiveList.clear();
+    for (auto i : activeList) {
+      if (countOf(i) > minActiveCount) {
+        roundActiveList.push_back(i);
+      } else {
+        mu[i] = 0.0;
+      }
+    }
+    roundClasses.clear();
+    for (size_t eqid = 0; eqid < eqClasses.numClasses(); ++eqid) {
+      for (auto j = eqClasses.offsets[eqid]; j < eqClasses.offsets[eqid + 1];
+           ++j) {
+        if (countOf(eqClasses.txps[j]) > minActiveCount) {
+          roundClasses.push_back(eqid);
+          break;
+        }
+      }
     }
   };
-  combineableCounts.combine_each(combineCounts);
+
+  uint64_t roundNum{0};
+  for (size_t sampleID = 0; sampleID < numChainSamples; ++sampleID) {
+    bool shrink = useActiveSet and numInternalRounds > 1;
+    if (shrink) {
+      shrinkActiveSet();
+    }
+    // Thin the chain by a factor of (numInternalRounds)
+    for (size_t i = 0; i < numInternalRounds; ++i) {
+      // The last round before a sample always covers everything
+      bool fullRound = !shrink or (i + 1 == numInternalRounds);
+      sampleRoundNonCollapsedMultithreaded_(
+          eqClasses,  // encodes equivalence classes
+          active,     // the set of active transcripts
+          fullRound ? activeList : roundActiveList, // the list of active
+                                                    // transcript ids
+          mu,      // transcript fractions
+          effLens, // the effective transcript lengths
+          priorAlphas, // the prior transcript counts
+          firstRound ? &alphasInit : nullptr, // the counts to start from
+          alphasIn, // [input/output param] the (hard) fragment counts per txp
+                    // from the previous iteration
+          mixSeed_(chainSeed + roundNum++), // the seed for this round
+          stats, // the work and time of the rounds
+          fullRound ? nullptr : &roundClasses // the classes to resample
+      );
+      firstRound = false;
+    }
+
+    if (dontExtrapolateCounts) {
+      for (size_t tn = 0; tn < numTranscripts; ++tn) {
+        alphas[tn] = countOf(tn);
+      }
+    } else {
+      double denom{0.0};
+      for (size_t tn = 0; tn < numTranscripts; ++tn) {
+        denom += mu[tn] * effLens[tn];
+      }
+      double scale = numMappedFragments / denom;
+
+      // A read cutoff for a txp to be present, adopted from Bray et al. 2016
+      double minAlpha = 1e-8;
+      for (size_t tn = 0; tn < numTranscripts; ++tn) {
+        alphas[tn] = (mu[tn] * effLens[tn]) * scale;
+        alphas[tn] = (alphas[tn] > minAlpha) ? alphas[tn] : 0.0;
+      }
+    }
+    emitSample(alphas);
+  }
 }
 
 CollapsedGibbsSampler::CollapsedGibbsSampler() {}
@@ -295,15 +463,10 @@ bool CollapsedGibbsSampler::sample(
   // Fill in the effective length vector
   Eigen::VectorXd effLens(transcripts.size());
 
-  std::vector<std::pair<const TranscriptGroup, TGValue>>& eqVec =
-      readExp.equivalenceClassBuilder().eqVec();
+  // optimize() has compacted the classes, so all of them are valid
+  FlatEquivalenceClasses& eqClasses =
+      readExp.equivalenceClassBuilder().flatEqClasses();
 
-  using VecT = CollapsedGibbsSampler::VecType;
-
-  std::vector<std::vector<int>> allSamples(
-      numSamples, std::vector<int>(transcripts.size(), 0));
-
-  std::vector<double> alphasIn(transcripts.size(), 0.0);
   std::vector<double> alphasInit(transcripts.size(), 0.0);
 
   bool useScaledCounts = (!sopt.useQuasi and !sopt.allowOrphans);
@@ -314,7 +477,6 @@ bool CollapsedGibbsSampler::sample(
 
   for (size_t i = 0; i < transcripts.size(); ++i) {
     auto& txp = transcripts[i];
-    alphasIn[i] = txp.projectedCounts;
     alphasInit[i] = txp.projectedCounts;
     effLens(i) = txp.EffectiveLength;
   }
@@ -334,18 +496,11 @@ bool CollapsedGibbsSampler::sample(
   **/
 
   std::vector<bool> active(numTranscripts, false);
-  size_t countMapSize{0};
-  std::vector<uint32_t> offsetMap(eqVec.size(), 0);
-  for (size_t i = 0; i < eqVec.size(); ++i) {
-    if (eqVec[i].first.valid) {
-      countMapSize +=
-          eqVec[i].second.weights.size(); // eqVec[i].first.txps.size();
-      for (auto t : eqVec[i].first.txps) {
-        active[t] = true;
-      }
-      if (i < eqVec.size() - 1) {
-        offsetMap[i + 1] = countMapSize;
-      }
+  for (size_t i = 0; i < eqClasses.numClasses(); ++i) {
+    auto start = eqClasses.offsets[i];
+    auto end = eqClasses.offsets[i + 1];
+    for (auto j = start; j < end; ++j) {
+      active[eqClasses.txps[j]] = true;
     }
   }
 
@@ -355,44 +510,36 @@ bool CollapsedGibbsSampler::sample(
     if (active[i]) {
       activeList.push_back(i);
     } else {
-      alphasIn[i] = 0.0;
       alphasInit[i] = 0.0;
     }
   }
 
-  // will hold estimated counts
-  std::vector<double> alphas(numTranscripts, 0.0);
-  std::vector<double> mu(numTranscripts, 0.0);
-  std::vector<uint64_t> countMap(countMapSize, 0);
-  std::vector<double> probMap(countMapSize, 0.0);
-
-  /*
-  std::random_device rd;
-  MultinomialSampler ms(rd);
-  initCountMap_(eqVec, transcripts, alphasIn, priorAlphas, ms, countMap,
-  probMap, effLens, allSamples[0]);
-  */
-
-  uint32_t nchains{1};
-  if (numSamples >= 50) {
-    nchains = 2;
-  }
-  if (numSamples >= 100) {
-    nchains = 4;
-  }
-  if (numSamples >= 200) {
-    nchains = 8;
+  uint64_t seed = sopt.samplerSeed;
+  if (seed == 0) {
+    std::random_device rd;
+    seed = (static_cast<uint64_t>(rd()) << 32) | rd();
   }
-
-  std::vector<uint32_t> newChainIter{0};
-  if (nchains > 1) {
-    auto step = numSamples / nchains;
-    for (size_t i = 1; i < nchains; ++i) {
-      newChainIter.push_back(i * step);
+  jointLog->info("Drawing the Gibbs samples with seed {} "
+                 "(pass --seed to reproduce them)",
+                 seed);
+
+  GibbsRoundStats roundStats;
+  auto reportThroughput = [&]() -> void {
+    uint64_t numRounds = roundStats.numRounds;
+    double gammaSec = roundStats.gammaNs * 1e-9;
+    double multinomialSec = roundStats.multinomialNs * 1e-9;
+    if (numRounds == 0) {
+      return;
     }
-  }
-
-  auto nextChainStart = newChainIter.begin();
+    jointLog->info("Gibbs sampling took {:.2f} ms per round ({} rounds): "
+                   "{:.3g} gamma draws / s, {:.3g} reads reassigned / s",
+                   1e3 * (gammaSec + multinomialSec) / numRounds, numRounds,
+                   (gammaSec > 0.0) ? roundStats.numGammaDraws / gammaSec
+                                    : 0.0,
+                   (multinomialSec > 0.0)
+                       ? roundStats.numReadsDrawn / multinomialSec
+                       : 0.0);
+  };
 
   // For each sample this thread should generate
   std::unique_ptr<ez::ezETAProgressBar> pbar{nullptr};
@@ -400,62 +547,104 @@ bool CollapsedGibbsSampler::sample(
     pbar.reset(new ez::ezETAProgressBar(numSamples));
     pbar->start();
   }
-  bool isFirstSample{true};
-  for (size_t sampleID = 0; sampleID < numSamples; ++sampleID) {
-    if (pbar) {
-      ++(*pbar);
+
+  if (sopt.numGibbsChains == 0) {
+    // Run the chains one after another, each using all of the threads
+    uint32_t nchains{1};
+    if (numSamples >= 50) {
+      nchains = 2;
     }
-    // If we should start a new chain here, then do it!
-    if (nextChainStart < newChainIter.end() and sampleID == *nextChainStart) {
-      alphasIn = alphasInit;
-      ++nextChainStart;
+    if (numSamples >= 100) {
+      nchains = 4;
     }
-    /*
-      if (!isFirstSample) {
-          // the counts start at what they were last round.
-        allSamples[sampleID] = allSamples[sampleID-1];
+    if (numSamples >= 200) {
+      nchains = 8;
+    }
+
+    auto emitSample = [&](const std::vector<double>& alphas) -> void {
+      if (pbar) {
+        ++(*pbar);
       }
-      */
+      writeBootstrap(alphas);
+    };
 
-    // Thin the chain by a factor of (numInternalRounds)
-    for (size_t i = 0; i < numInternalRounds; ++i) {
-      sampleRoundNonCollapsedMultithreaded_(
-          eqVec,      // encodes equivalence classes
-          active,     // the set of active transcripts
-          activeList, // the list of active transcript ids
-          countMap,   // the count of reads in each eq coming from each eq class
-          probMap, // the probability of reads in each eq class coming from each
-                   // txp
-          mu,      // transcript fractions
-          effLens, // the effective transcript lengths
-          priorAlphas, // the prior transcript counts
-          alphasIn, // [input/output param] the (hard) fragment counts per txp
-                    // from the previous iteration
-          offsetMap // where the information begins for each equivalence class
-      );
+    auto step = numSamples / nchains;
+    for (uint32_t c = 0; c < nchains; ++c) {
+      uint32_t chainStart = c * step;
+      uint32_t chainEnd = (c + 1 < nchains) ? (c + 1) * step : numSamples;
+      runGibbsChain_(eqClasses, active, activeList, effLens, priorAlphas,
+                     alphasInit, numInternalRounds, chainEnd - chainStart,
+                     sopt.dontExtrapolateCounts, numMappedFragments,
+                     mixSeed_(seed + c), sopt.gibbsActiveSet, roundStats,
+                     emitSample);
     }
+    reportThroughput();
+    return true;
+  }
 
-    if (sopt.dontExtrapolateCounts) {
-      alphas = alphasIn;
-    } else {
-      double denom{0.0};
-      for (size_t tn = 0; tn < numTranscripts; ++tn) {
-        denom += mu[tn] * effLens[tn];
-      }
-      double scale = numMappedFragments / denom;
-      double asum = {0.0};
+  // Run the chains side by side, each with its own share of the threads.
+  // Chain c produces samples c, c + numChains, ...; they are written in
+  // order by this thread, so the output is the same from run to run.
+  uint32_t numChains = std::min(sopt.numGibbsChains, numSamples);
+  uint32_t threadsPerChain =
+      std::max(uint32_t(1), static_cast<uint32_t>(sopt.numThreads) / numChains);
+  jointLog->info("Running {} Gibbs chains in parallel, with {} threads each",
+                 numChains, threadsPerChain);
+
+  // Each chain hands its samples to the writer through a couple of its own
+  // buffers, and waits for one to be written if it gets too far ahead.
+  using BufferQueue = moodycamel::BlockingConcurrentQueue<std::vector<double>*>;
+  std::vector<std::vector<double>> buffers(
+      2 * numChains, std::vector<double>(numTranscripts, 0.0));
+  std::vector<std::unique_ptr<BufferQueue>> freeBuffers;
+  std::vector<std::unique_ptr<BufferQueue>> fullBuffers;
+  for (uint32_t c = 0; c < numChains; ++c) {
+    freeBuffers.emplace_back(new BufferQueue);
+    fullBuffers.emplace_back(new BufferQueue);
+    freeBuffers[c]->enqueue(&buffers[2 * c]);
+    freeBuffers[c]->enqueue(&buffers[2 * c + 1]);
+  }
 
-      // A read cutoff for a txp to be present, adopted from Bray et al. 2016
-      double minAlpha = 1e-8;
-      for (size_t tn = 0; tn < numTranscripts; ++tn) {
-        alphas[tn] = (mu[tn] * effLens[tn]) * scale;
-        alphas[tn] = (alphas[tn] > minAlpha) ? alphas[tn] : 0.0;
-        asum += alphas[tn];
-      }
+  std::vector<std::thread> chainThreads;
+  for (uint32_t c = 0; c < numChains; ++c) {
+    uint32_t numChainSamples =
+        numSamples / numChains + ((c < numSamples % numChains) ? 1 : 0);
+    chainThreads.emplace_back([&, c, numChainSamples]() -> void {
+      auto emitSample = [&, c](const std::vector<double>& alphas) -> void {
+        std::vector<double>* buf{nullptr};
+        freeBuffers[c]->wait_dequeue(buf);
+        std::copy(alphas.begin(), alphas.end(), buf->begin());
+        fullBuffers[c]->enqueue(buf);
+      };
+      auto spanStart = PerformanceStats::Clock::now();
+      tbb::task_arena arena(threadsPerChain);
+      arena.execute([&]() -> void {
+        runGibbsChain_(eqClasses, active, activeList, effLens, priorAlphas,
+                       alphasInit, numInternalRounds, numChainSamples,
+                       sopt.dontExtrapolateCounts, numMappedFragments,
+                       mixSeed_(seed + c), sopt.gibbsActiveSet, roundStats,
+                     emitSample);
+      });
+      sopt.perfStats->span("gibbs_chain", spanStart, "sampling");
+    });
+  }
+
+  for (uint32_t sampleID = 0; sampleID < numSamples; ++sampleID) {
+    uint32_t c = sampleID % numChains;
+    std::vector<double>* buf{nullptr};
+    fullBuffers[c]->wait_dequeue(buf);
+    writeBootstrap(*buf);
+    freeBuffers[c]->enqueue(buf);
+    ++sopt.runStatus->numSamples;
+    if (pbar) {
+      ++(*pbar);
     }
-    writeBootstrap(alphas);
-    isFirstSample = false;
   }
+
+  for (auto& t : chainThreads) {
+    t.join();
+  }
+  reportThroughput();
   return true;
 }
 
@@ -475,7 +664,7 @@ void initCountMap_(
     const TranscriptGroup& tgroup = eqClass.first;
     const size_t groupSize = tgroup.txps.size();
     if (tgroup.valid) {
-      const std::vector<uint32_t>& txps = tgroup.txps;
+      const EqClassLabel& txps = tgroup.txps;
       const auto& auxs = eqClass.second.combinedWeights;
 
       double denom = 0.0;
@@ -568,7 +757,7 @@ void sampleRoundNonCollapsed_(
     const TranscriptGroup& tgroup = eqClass.first;
     const size_t groupSize = tgroup.txps.size();
     if (tgroup.valid) {
-      const std::vector<uint32_t>& txps = tgroup.txps;
+      const EqClassLabel& txps = tgroup.txps;
       const auto& auxs = eqClass.second.combinedWeights;
 
       double denom = 0.0;
@@ -653,7 +842,7 @@ void sampleRound_(
         const TranscriptGroup& tgroup = eqClass.first;
         const size_t groupSize = tgroup.txps.size();
         if (tgroup.valid) {
-            const std::vector<uint32_t>& txps = tgroup.txps;
+            const EqClassLabel& txps = tgroup.txps;
             const auto& auxs = eqClass.second.combinedWeights;
 
             double denom = 0.0;
@@ -871,6 +1060,11 @@ template bool CollapsedGibbsSampler::sample<AlignmentLibrary<ReadPair>>(
     AlignmentLibrary<ReadPair>& readExp, SalmonOpts& sopt,
     std::function<bool(const std::vector<double>&)>& writeBootstrap,
     uint32_t maxIter);
+
+template bool CollapsedGibbsSampler::sample<PartialExperiment>(
+    PartialExperiment& readExp, SalmonOpts& sopt,
+    std::function<bool(const std::vector<double>&)>& writeBootstrap,
+    uint32_t maxIter);
 /*
 template
 bool CollapsedGibbsSampler::sampleMultipleChains<ReadExperiment>(ReadExperiment&
@@ -0,0 +1,144 @@
+#include "ColumnarSampleWriter.hpp"
+
+#include <algorithm>
+
+#include <zlib.h>
+
+namespace {
+const char colMagic[8] = {'S', 'A', 'L', 'M', 'N', 'C', 'O', 'L'};
+constexpr uint32_t colVersion = 3;
+// The uncompressed size at which the transcripts are split into blocks
+constexpr size_t targetBlockBytes = size_t(1) << 18;
+// The most memory used to hold a group of samples
+constexpr size_t maxGroupBytes = size_t(1) << 26;
+// The offset of the number of samples in the header
+constexpr std::streamoff numSamplesOffset = 24;
+
+using salmon::bytes::writeU32;
+using salmon::bytes::writeU64;
+}
+
+ColumnarSampleWriter::ColumnarSampleWriter(const boost::filesystem::path& path,
+                                           size_t numTargets,
+                                           SamplePrecision precision,
+                                           uint32_t fixedScale,
+                                           uint64_t expectedSamples)
+    : path_(path), numTargets_(numTargets), precision_(precision),
+      fixedScale_((precision == SamplePrecision::FIXED) ? fixedScale : 0) {
+  samplesPerGroup_ = std::max(
+      uint64_t(1),
+      static_cast<uint64_t>(maxGroupBytes /
+                            (sizeof(double) *
+                             std::max(numTargets_, size_t(1)))));
+  if (expectedSamples > 0) {
+    samplesPerGroup_ = std::min(samplesPerGroup_, expectedSamples);
+  }
+  txpsPerBlock_ = std::max(
+      uint64_t(1),
+      static_cast<uint64_t>(targetBlockBytes /
+                            (sizeof(double) * samplesPerGroup_)));
+}
+
+ColumnarSampleWriter::~ColumnarSampleWriter() {
+  if (!finished_) {
+    finish();
+  }
+}
+
+bool ColumnarSampleWriter::writeHeader_() {
+  out_.reset(new std::ofstream(path_.string(),
+                               std::ios_base::out | std::ios_base::binary));
+  out_->write(colMagic, 8);
+  writeU32(*out_, colVersion);
+  writeU32(*out_, static_cast<uint32_t>(precision_));
+  writeU64(*out_, numTargets_);
+  // the number of samples, filled in by finish()
+  writeU64(*out_, 0);
+  writeU64(*out_, txpsPerBlock_);
+  writeU64(*out_, fixedScale_);
+  writeU64(*out_, samplesPerGroup_);
+  return out_->good();
+}
+
+bool ColumnarSampleWriter::writeSample(const std::vector<double>& sample) {
+  if (finished_ or !ok_ or sample.size() != numTargets_) {
+    return false;
+  }
+  if (!out_) {
+    ok_ = writeHeader_();
+    group_.reserve(samplesPerGroup_ * numTargets_);
+  }
+  group_.insert(group_.end(), sample.begin(), sample.end());
+  ++numGroupSamples_;
+  ++numSamples_;
+  if (ok_ and numGroupSamples_ == samplesPerGroup_) {
+    ok_ = flushGroup_();
+  }
+  return ok_;
+}
+
+bool ColumnarSampleWriter::flushGroup_() {
+  uint64_t n = numGroupSamples_;
+  std::vector<double> block;
+  std::vector<char> encoded;
+  std::vector<Bytef> compressed;
+  for (uint64_t blockStart = 0; blockStart < numTargets_;
+       blockStart += txpsPerBlock_) {
+    uint64_t numBlockTxps =
+        std::min(txpsPerBlock_, static_cast<uint64_t>(numTargets_) -
+                                    blockStart);
+    block.resize(numBlockTxps * n);
+    for (uint64_t s = 0; s < n; ++s) {
+      const double* row = group_.data() + s * numTargets_ + blockStart;
+      for (uint64_t t = 0; t < numBlockTxps; ++t) {
+        block[t * n + s] = row[t];
+      }
+    }
+    encoded.clear();
+    salmon::samples::appendValues(encoded, block.data(), block.size(),
+                                  precision_, fixedScale_);
+    uLong srcLen = encoded.size();
+    uLongf destLen = compressBound(srcLen);
+    compressed.resize(destLen);
+    int ret = compress2(compressed.data(), &destLen,
+                        reinterpret_cast<const Bytef*>(encoded.data()),
+                        srcLen, 6);
+    if (ret != Z_OK) {
+      return false;
+    }
+    index_.emplace_back(static_cast<uint64_t>(out_->tellp()), destLen);
+    out_->write(reinterpret_cast<const char*>(compressed.data()), destLen);
+  }
+  group_.clear();
+  numGroupSamples_ = 0;
+  return out_->good();
+}
+
+bool ColumnarSampleWriter::finish() {
+  if (finished_) {
+    return false;
+  }
+  finished_ = true;
+  if (!out_) {
+    // no samples: just the header, an empty index and the footer
+    ok_ = writeHeader_() and ok_;
+  }
+  if (ok_ and numGroupSamples_ > 0) {
+    ok_ = flushGroup_();
+  }
+
+  uint64_t indexOffset = static_cast<uint64_t>(out_->tellp());
+  for (auto& e : index_) {
+    writeU64(*out_, e.first);
+    writeU64(*out_, e.second);
+  }
+  writeU64(*out_, indexOffset);
+  out_->write(colMagic, 8);
+  out_->seekp(numSamplesOffset);
+  writeU64(*out_, numSamples_);
+  ok_ = ok_ and out_->good();
+  out_->close();
+  out_.reset();
+  std::vector<double>().swap(group_);
+  return ok_;
+}
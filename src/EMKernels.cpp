@@ -0,0 +1,229 @@
+#include "EMKernels.hpp"
+
+#include <cmath>
+
+#include "CPUDispatch.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) &&                              \
+    (defined(__GNUC__) || defined(__clang__))
+#define SALMON_EM_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+namespace salmon {
+namespace emkernels {
+
+namespace {
+template <typename AuxT>
+inline double gatherDotScalar_(const double* alpha, const uint32_t* txps,
+                               const AuxT* aux, size_t n) {
+  // Four independent accumulators, so that consecutive
+  // multiply-adds don't wait on each other.
+  double s0{0.0}, s1{0.0}, s2{0.0}, s3{0.0};
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    s0 += alpha[txps[i]] * aux[i];
+    s1 += alpha[txps[i + 1]] * aux[i + 1];
+    s2 += alpha[txps[i + 2]] * aux[i + 2];
+    s3 += alpha[txps[i + 3]] * aux[i + 3];
+  }
+  for (; i < n; ++i) {
+    s0 += alpha[txps[i]] * aux[i];
+  }
+  return (s0 + s1) + (s2 + s3);
+}
+}
+
+double gatherDotScalar(const double* alpha, const uint32_t* txps,
+                       const double* aux, size_t n) {
+  return gatherDotScalar_(alpha, txps, aux, n);
+}
+
+double gatherDotScalar(const double* alpha, const uint32_t* txps,
+                       const float* aux, size_t n) {
+  return gatherDotScalar_(alpha, txps, aux, n);
+}
+
+#ifdef SALMON_EM_KERNELS_X86
+
+__attribute__((target("avx2"))) static double
+gatherDotAVX2(const double* alpha, const uint32_t* txps, const double* aux,
+              size_t n) {
+  __m256d acc = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i idx =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(txps + i));
+    __m256d a = _mm256_i32gather_pd(alpha, idx, 8);
+    __m256d w = _mm256_loadu_pd(aux + i);
+    acc = _mm256_add_pd(acc, _mm256_mul_pd(a, w));
+  }
+  __m128d lo = _mm256_castpd256_pd128(acc);
+  __m128d hi = _mm256_extractf128_pd(acc, 1);
+  lo = _mm_add_pd(lo, hi);
+  double s = _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+  for (; i < n; ++i) {
+    s += alpha[txps[i]] * aux[i];
+  }
+  return s;
+}
+
+__attribute__((target("avx512f,avx2"))) static double
+gatherDotAVX512(const double* alpha, const uint32_t* txps, const double* aux,
+                size_t n) {
+  __m512d acc = _mm512_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i idx =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(txps + i));
+    __m512d a = _mm512_i32gather_pd(idx, alpha, 8);
+    __m512d w = _mm512_loadu_pd(aux + i);
+    acc = _mm512_add_pd(acc, _mm512_mul_pd(a, w));
+  }
+  double s = _mm512_reduce_add_pd(acc);
+  // Use the AVX2 kernel for the remaining (< 8) elements
+  return s + gatherDotAVX2(alpha, txps + i, aux + i, n - i);
+}
+
+// The single-precision weights are widened as they are loaded
+__attribute__((target("avx2"))) static double
+gatherDotAVX2(const double* alpha, const uint32_t* txps, const float* aux,
+              size_t n) {
+  __m256d acc = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i idx =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(txps + i));
+    __m256d a = _mm256_i32gather_pd(alpha, idx, 8);
+    __m256d w = _mm256_cvtps_pd(_mm_loadu_ps(aux + i));
+    acc = _mm256_add_pd(acc, _mm256_mul_pd(a, w));
+  }
+  __m128d lo = _mm256_castpd256_pd128(acc);
+  __m128d hi = _mm256_extractf128_pd(acc, 1);
+  lo = _mm_add_pd(lo, hi);
+  double s = _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+  for (; i < n; ++i) {
+    s += alpha[txps[i]] * aux[i];
+  }
+  return s;
+}
+
+__attribute__((target("avx512f,avx2"))) static double
+gatherDotAVX512(const double* alpha, const uint32_t* txps, const float* aux,
+                size_t n) {
+  __m512d acc = _mm512_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i idx =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(txps + i));
+    __m512d a = _mm512_i32gather_pd(idx, alpha, 8);
+    __m512d w = _mm512_cvtps_pd(_mm256_loadu_ps(aux + i));
+    acc = _mm512_add_pd(acc, _mm512_mul_pd(a, w));
+  }
+  double s = _mm512_reduce_add_pd(acc);
+  return s + gatherDotAVX2(alpha, txps + i, aux + i, n - i);
+}
+
+#endif // SALMON_EM_KERNELS_X86
+
+namespace {
+using GatherDotFn = double (*)(const double*, const uint32_t*, const double*,
+                               size_t);
+using GatherDotFloatFn = double (*)(const double*, const uint32_t*,
+                                    const float*, size_t);
+
+GatherDotFn gatherDotFn = gatherDotScalar;
+GatherDotFloatFn gatherDotFloatFn = gatherDotScalar;
+
+// Choose the gatherDot kernels when the library is loaded (and again in
+// salmon::cpu::init()), rather than on the first call from inside the EM.
+void chooseGatherDot() {
+  using salmon::cpu::ISA;
+  gatherDotFn = salmon::cpu::choose<GatherDotFn>(
+      "em_gather_dot", {
+#ifdef SALMON_EM_KERNELS_X86
+                           {ISA::avx512, gatherDotAVX512},
+                           {ISA::avx2, gatherDotAVX2},
+#endif
+                           {ISA::scalar, gatherDotScalar}});
+  gatherDotFloatFn = salmon::cpu::choose<GatherDotFloatFn>(
+      "em_gather_dot_f32", {
+#ifdef SALMON_EM_KERNELS_X86
+                               {ISA::avx512, gatherDotAVX512},
+                               {ISA::avx2, gatherDotAVX2},
+#endif
+                               {ISA::scalar, gatherDotScalar}});
+}
+
+const salmon::cpu::Registration gatherDotRegistration(chooseGatherDot);
+}
+
+double gatherDot(const double* alpha, const uint32_t* txps, const double* aux,
+                 size_t n) {
+  return gatherDotFn(alpha, txps, aux, n);
+}
+
+double gatherDot(const double* alpha, const uint32_t* txps, const float* aux,
+                 size_t n) {
+  return gatherDotFloatFn(alpha, txps, aux, n);
+}
+
+const char* gatherDotImpl() {
+#ifdef SALMON_EM_KERNELS_X86
+  if (gatherDotFn == static_cast<GatherDotFn>(gatherDotAVX512)) {
+    return "avx512";
+  }
+  if (gatherDotFn == static_cast<GatherDotFn>(gatherDotAVX2)) {
+    return "avx2";
+  }
+#endif
+  return "scalar";
+}
+
+namespace {
+// Number of recurrence steps taken before the asymptotic expansion is used.
+constexpr int digammaShift = 8;
+
+/**
+ * Writes y = x + digammaShift and returns digamma(x) - log(y).
+ */
+inline double digammaMinusLog(double x, double& y) {
+  double recip{0.0};
+  for (int k = 0; k < digammaShift; ++k) {
+    recip += 1.0 / (x + k);
+  }
+  y = x + digammaShift;
+  double iy = 1.0 / y;
+  double z = iy * iy;
+  double series =
+      z * (1.0 / 12.0 -
+           z * (1.0 / 120.0 -
+                z * (1.0 / 252.0 -
+                     z * (1.0 / 240.0 -
+                          z * (1.0 / 132.0 - z * (691.0 / 32760.0))))));
+  return -0.5 * iy - series - recip;
+}
+}
+
+double digamma(double x) {
+  double y;
+  double r = digammaMinusLog(x, y);
+  return std::log(y) + r;
+}
+
+void expDigamma(const double* alpha, const double* prior, double logNorm,
+                double minAlpha, double* expTheta, double* zeroOut, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    double ap = alpha[i] + prior[i];
+    double y;
+    // exp(digamma(ap) - logNorm) = y * exp(digamma(ap) - log(y) - logNorm),
+    // which avoids computing the logarithm.
+    double r = digammaMinusLog(ap, y);
+    expTheta[i] = (ap > minAlpha) ? y * std::exp(r - logNorm) : 0.0;
+    if (zeroOut != nullptr) {
+      zeroOut[i] = 0.0;
+    }
+  }
+}
+}
+}
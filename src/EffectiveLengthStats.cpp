@@ -1,51 +1,59 @@
 #include "EffectiveLengthStats.hpp"
 #include "SalmonMath.hpp"
 
-EffectiveLengthStats::EffectiveLengthStats(size_t numTxps)
-    : numTxps_(numTxps), lengths_(numTxps), weights_(numTxps),
-      counts_(numTxps) {
-  for (size_t i = 0; i < numTxps_; ++i) {
-    lengths_(i) = salmon::math::LOG_0;
-    weights_(i) = salmon::math::LOG_0;
-    counts_(i) = 0;
-  }
-}
-
 void EffectiveLengthStats::addFragment(uint32_t txID, uint32_t len,
                                        double logMass) {
   len = (len >= 1) ? len : 1;
   const double logLen = std::log(static_cast<double>(len));
-  lengths_(txID) = salmon::math::logAdd(lengths_(txID), logLen + logMass);
-  weights_(txID) = salmon::math::logAdd(weights_(txID), logMass);
-  ++counts_(txID);
+  auto it = stats_.find(txID);
+  if (it == stats_.end()) {
+    stats_[txID] = TxpStats{logLen + logMass, logMass, 1};
+    return;
+  }
+  auto& s = it->second;
+  s.logLengthMass = salmon::math::logAdd(s.logLengthMass, logLen + logMass);
+  s.logWeight = salmon::math::logAdd(s.logWeight, logMass);
+  ++s.count;
 }
 
-uint32_t EffectiveLengthStats::getObservedCount(uint32_t txID) {
-  return counts_(txID);
+uint32_t EffectiveLengthStats::getObservedCount(uint32_t txID) const {
+  auto it = stats_.find(txID);
+  return (it == stats_.end()) ? 0 : it->second.count;
 }
 
-double EffectiveLengthStats::getExpectedEffectiveLength(uint32_t txID) {
-  return (!salmon::math::isLog0(weights_(txID)))
-             ? std::exp(lengths_(txID) - weights_(txID))
+double EffectiveLengthStats::expectedLength_(const TxpStats& s) {
+  return (!salmon::math::isLog0(s.logWeight))
+             ? std::exp(s.logLengthMass - s.logWeight)
              : 0.01;
-  // return (weights_(txID) > 0) ? static_cast<double>(lengths_(txID)) /
-  // weights_(txID) : 0.01;
 }
 
-Eigen::VectorXd EffectiveLengthStats::getExpectedEffectiveLengths() {
+double EffectiveLengthStats::getExpectedEffectiveLength(uint32_t txID) const {
+  auto it = stats_.find(txID);
+  return (it == stats_.end()) ? 0.01 : expectedLength_(it->second);
+}
+
+Eigen::VectorXd
+EffectiveLengthStats::getExpectedEffectiveLengths(size_t numTxps) const {
   // expected effective lengths
-  Eigen::VectorXd eel(numTxps_);
-  eel.setZero();
-  for (size_t i = 0; i < numTxps_; ++i) {
-    eel(i) = getExpectedEffectiveLength(i);
+  Eigen::VectorXd eel(numTxps);
+  eel.setConstant(0.01);
+  for (auto& kv : stats_) {
+    eel(kv.first) = expectedLength_(kv.second);
   }
   return eel;
 }
 
 void EffectiveLengthStats::merge(const EffectiveLengthStats& other) {
-  for (size_t i = 0; i < weights_.size(); ++i) {
-    lengths_(i) = salmon::math::logAdd(lengths_(i), other.lengths_(i));
-    weights_(i) = salmon::math::logAdd(weights_(i), other.weights_(i));
-    counts_(i) = other.counts_(i);
+  for (auto& kv : other.stats_) {
+    auto it = stats_.find(kv.first);
+    if (it == stats_.end()) {
+      stats_.insert(kv);
+      continue;
+    }
+    auto& s = it->second;
+    s.logLengthMass =
+        salmon::math::logAdd(s.logLengthMass, kv.second.logLengthMass);
+    s.logWeight = salmon::math::logAdd(s.logWeight, kv.second.logWeight);
+    s.count += kv.second.count;
   }
 }
@@ -0,0 +1,354 @@
+#include "EquivClassFile.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include <zlib.h>
+
+#include "ByteBuffers.hpp"
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+
+namespace salmon {
+namespace eqclasses {
+
+namespace {
+const char eqMagic[8] = {'S', 'A', 'L', 'M', 'N', 'E', 'Q', 'C'};
+constexpr uint32_t eqVersion = 1;
+constexpr uint32_t hasWeightsFlag = 1;
+// The number of classes that are compressed together
+constexpr uint64_t classesPerBlock = 16384;
+
+using salmon::bytes::compressAppend;
+using salmon::bytes::writeU32;
+using salmon::bytes::writeU64;
+
+bool readU32(std::istream& is, uint32_t& v) {
+  unsigned char b[4];
+  if (!is.read(reinterpret_cast<char*>(b), 4)) {
+    return false;
+  }
+  v = 0;
+  for (size_t i = 0; i < 4; ++i) {
+    v |= static_cast<uint32_t>(b[i]) << (8 * i);
+  }
+  return true;
+}
+
+bool readU64(std::istream& is, uint64_t& v) {
+  unsigned char b[8];
+  if (!is.read(reinterpret_cast<char*>(b), 8)) {
+    return false;
+  }
+  v = 0;
+  for (size_t i = 0; i < 8; ++i) {
+    v |= static_cast<uint64_t>(b[i]) << (8 * i);
+  }
+  return true;
+}
+
+inline void putVarint(std::vector<char>& buf, uint64_t v) {
+  while (v >= 0x80) {
+    buf.push_back(static_cast<char>((v & 0x7f) | 0x80));
+    v >>= 7;
+  }
+  buf.push_back(static_cast<char>(v));
+}
+
+inline bool getVarint(const std::vector<char>& buf, size_t& pos,
+                      uint64_t& v) {
+  v = 0;
+  for (uint32_t shift = 0; pos < buf.size() and shift < 64; shift += 7) {
+    auto b = static_cast<unsigned char>(buf[pos++]);
+    v |= static_cast<uint64_t>(b & 0x7f) << shift;
+    if (b < 0x80) {
+      return true;
+    }
+  }
+  return false;
+}
+
+inline uint64_t zigzag(int64_t d) {
+  return (static_cast<uint64_t>(d) << 1) ^ static_cast<uint64_t>(d >> 63);
+}
+
+inline int64_t unzigzag(uint64_t z) {
+  return static_cast<int64_t>(z >> 1) ^ -static_cast<int64_t>(z & 1);
+}
+
+bool uncompressBuffer(const std::vector<char>& src, std::vector<char>& dest) {
+  z_stream zs;
+  std::memset(&zs, 0, sizeof(zs));
+  if (inflateInit(&zs) != Z_OK) {
+    return false;
+  }
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(src.data()));
+  zs.avail_in = static_cast<uInt>(src.size());
+  dest.resize(std::max(size_t(1) << 16, 4 * src.size()));
+  int ret{Z_OK};
+  size_t produced{0};
+  while (ret == Z_OK) {
+    if (produced == dest.size()) {
+      dest.resize(2 * dest.size());
+    }
+    zs.next_out = reinterpret_cast<Bytef*>(dest.data() + produced);
+    zs.avail_out = static_cast<uInt>(dest.size() - produced);
+    ret = inflate(&zs, Z_NO_FLUSH);
+    produced = dest.size() - zs.avail_out;
+  }
+  inflateEnd(&zs);
+  dest.resize(produced);
+  return ret == Z_STREAM_END;
+}
+
+// Append class (of groupSize transcripts, with the given weights unless
+// weights is null) to buf
+void encodeClass(std::vector<char>& buf, const uint32_t* txps,
+                 uint32_t groupSize, const double* weights, uint64_t count) {
+  putVarint(buf, groupSize);
+  int64_t prev{0};
+  for (uint32_t i = 0; i < groupSize; ++i) {
+    int64_t t = txps[i];
+    putVarint(buf,
+              (i == 0) ? static_cast<uint64_t>(t) : zigzag(t - prev));
+    prev = t;
+  }
+  if (weights != nullptr) {
+    for (uint32_t i = 0; i < groupSize; ++i) {
+      float f = static_cast<float>(weights[i]);
+      char fb[sizeof(float)];
+      std::memcpy(fb, &f, sizeof(float));
+      buf.insert(buf.end(), fb, fb + sizeof(float));
+    }
+  }
+  putVarint(buf, count);
+}
+
+/**
+ * Write numClasses classes to path; encode(eqID, buf) appends class eqID
+ * to buf (see encodeClass).
+ */
+template <typename EncodeFn>
+bool writeClasses(const boost::filesystem::path& path,
+                  const std::vector<std::string>& names, uint64_t numClasses,
+                  bool withWeights, EncodeFn encode) {
+  std::ofstream out(path.string(), std::ios_base::out | std::ios_base::binary);
+  if (!out.good()) {
+    return false;
+  }
+  out.write(eqMagic, 8);
+  writeU32(out, eqVersion);
+  writeU32(out, withWeights ? hasWeightsFlag : 0);
+  writeU64(out, names.size());
+  writeU64(out, numClasses);
+  writeU64(out, classesPerBlock);
+
+  std::vector<char> compressed;
+  {
+    std::vector<char> nameBuf;
+    for (auto& n : names) {
+      nameBuf.insert(nameBuf.end(), n.begin(), n.end());
+      nameBuf.push_back('\n');
+    }
+    if (!compressAppend(nameBuf, compressed)) {
+      return false;
+    }
+    writeU64(out, compressed.size());
+    out.write(compressed.data(), compressed.size());
+  }
+
+  // Encode and compress the blocks in parallel; they're written in order
+  // afterwards.
+  size_t numBlocks = (numClasses + classesPerBlock - 1) / classesPerBlock;
+  std::vector<std::vector<char>> blocks(numBlocks);
+  std::atomic<bool> ok{true};
+  tbb::parallel_for(
+      tbb::blocked_range<size_t>(0, numBlocks),
+      [&](const tbb::blocked_range<size_t>& r) -> void {
+        std::vector<char> encoded;
+        for (size_t b = r.begin(); b != r.end(); ++b) {
+          encoded.clear();
+          uint64_t end = std::min(numClasses, (b + 1) * classesPerBlock);
+          for (uint64_t eqID = b * classesPerBlock; eqID < end; ++eqID) {
+            encode(eqID, encoded);
+          }
+          if (!compressAppend(encoded, blocks[b])) {
+            ok = false;
+          }
+        }
+      });
+  if (!ok) {
+    return false;
+  }
+
+  std::vector<std::pair<uint64_t, uint64_t>> index;
+  index.reserve(numBlocks);
+  for (auto& block : blocks) {
+    index.emplace_back(static_cast<uint64_t>(out.tellp()), block.size());
+    out.write(block.data(), block.size());
+    std::vector<char>().swap(block);
+  }
+  uint64_t indexOffset = static_cast<uint64_t>(out.tellp());
+  for (auto& e : index) {
+    writeU64(out, e.first);
+    writeU64(out, e.second);
+  }
+  writeU64(out, indexOffset);
+  out.write(eqMagic, 8);
+  bool good = out.good();
+  out.close();
+  return good;
+}
+} // namespace
+
+bool writeBinary(
+    const boost::filesystem::path& path, const std::vector<std::string>& names,
+    const std::vector<std::pair<const TranscriptGroup, TGValue>>& eqVec,
+    const std::vector<double>* weights,
+    const std::vector<uint64_t>* weightOffsets) {
+  bool withWeights = (weights != nullptr and weightOffsets != nullptr);
+  return writeClasses(
+      path, names, eqVec.size(), withWeights,
+      [&](uint64_t eqID, std::vector<char>& encoded) -> void {
+        auto& eq = eqVec[eqID];
+        // as in eq_classes.txt, only the transcripts that have weights
+        // (any range-factorization bins that follow them are dropped)
+        uint32_t groupSize = eq.second.weights.size();
+        encodeClass(encoded, eq.first.txps.data(), groupSize,
+                    withWeights ? weights->data() + (*weightOffsets)[eqID]
+                                : nullptr,
+                    eq.second.count);
+      });
+}
+
+bool writeBinary(const boost::filesystem::path& path,
+                 const std::vector<std::string>& names,
+                 const FlatEquivalenceClasses& classes, bool withWeights) {
+  return writeClasses(
+      path, names, classes.numClasses(), withWeights,
+      [&](uint64_t eqID, std::vector<char>& encoded) -> void {
+        auto start = classes.offsets[eqID];
+        encodeClass(encoded, classes.txps.data() + start,
+                    classes.classSize(eqID),
+                    withWeights ? classes.combinedWeights.data() + start
+                                : nullptr,
+                    classes.counts[eqID]);
+      });
+}
+
+bool Reader::open(const boost::filesystem::path& path) {
+  in_.open(path.string(), std::ios_base::in | std::ios_base::binary);
+  char magic[8];
+  uint32_t version, flags;
+  uint64_t numNames;
+  if (!in_.read(magic, 8) or std::memcmp(magic, eqMagic, 8) != 0 or
+      !readU32(in_, version) or version != eqVersion or
+      !readU32(in_, flags) or !readU64(in_, numNames) or
+      !readU64(in_, numClasses_) or !readU64(in_, classesPerBlock_) or
+      classesPerBlock_ == 0) {
+    return false;
+  }
+  numTranscripts_ = numNames;
+  hasWeights_ = (flags & hasWeightsFlag);
+
+  uint64_t namesSize;
+  if (!readU64(in_, namesSize)) {
+    return false;
+  }
+  std::vector<char> raw(namesSize), nameBuf;
+  if (!in_.read(raw.data(), namesSize) or !uncompressBuffer(raw, nameBuf)) {
+    return false;
+  }
+  names_.clear();
+  names_.reserve(numNames);
+  auto start = nameBuf.begin();
+  for (auto it = nameBuf.begin(); it != nameBuf.end(); ++it) {
+    if (*it == '\n') {
+      names_.emplace_back(start, it);
+      start = it + 1;
+    }
+  }
+  if (names_.size() != numNames) {
+    return false;
+  }
+
+  // The index, from the footer
+  uint64_t indexOffset;
+  in_.seekg(-16, std::ios_base::end);
+  if (!readU64(in_, indexOffset) or !in_.read(magic, 8) or
+      std::memcmp(magic, eqMagic, 8) != 0) {
+    return false;
+  }
+  size_t numBlocks = (numClasses_ + classesPerBlock_ - 1) / classesPerBlock_;
+  in_.seekg(indexOffset);
+  index_.resize(numBlocks);
+  for (auto& e : index_) {
+    if (!readU64(in_, e.first) or !readU64(in_, e.second)) {
+      return false;
+    }
+  }
+  block_.clear();
+  nextBlock_ = 0;
+  nextInBlock_ = 0;
+  return true;
+}
+
+bool Reader::readBlock(size_t b, std::vector<EquivClass>& classes) {
+  if (b >= index_.size()) {
+    return false;
+  }
+  std::vector<char> raw(index_[b].second), encoded;
+  in_.clear();
+  in_.seekg(index_[b].first);
+  if (!in_.read(raw.data(), raw.size()) or !uncompressBuffer(raw, encoded)) {
+    return false;
+  }
+  uint64_t n = std::min(classesPerBlock_, numClasses_ - b * classesPerBlock_);
+  classes.resize(n);
+  size_t pos{0};
+  uint64_t v;
+  for (auto& c : classes) {
+    if (!getVarint(encoded, pos, v)) {
+      return false;
+    }
+    c.txps.resize(v);
+    int64_t prev{0};
+    for (size_t i = 0; i < c.txps.size(); ++i) {
+      if (!getVarint(encoded, pos, v)) {
+        return false;
+      }
+      prev = (i == 0) ? static_cast<int64_t>(v) : prev + unzigzag(v);
+      c.txps[i] = static_cast<uint32_t>(prev);
+    }
+    c.weights.clear();
+    if (hasWeights_) {
+      if (pos + sizeof(float) * c.txps.size() > encoded.size()) {
+        return false;
+      }
+      c.weights.resize(c.txps.size());
+      std::memcpy(c.weights.data(), encoded.data() + pos,
+                  sizeof(float) * c.txps.size());
+      pos += sizeof(float) * c.txps.size();
+    }
+    if (!getVarint(encoded, pos, c.count)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Reader::next(EquivClass& c) {
+  while (nextInBlock_ >= block_.size()) {
+    if (nextBlock_ >= index_.size() or !readBlock(nextBlock_, block_)) {
+      return false;
+    }
+    ++nextBlock_;
+    nextInBlock_ = 0;
+  }
+  c = std::move(block_[nextInBlock_++]);
+  return true;
+}
+
+} // namespace eqclasses
+} // namespace salmon
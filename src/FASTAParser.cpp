@@ -1,9 +1,15 @@
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
 #include <iostream>
 #include <random>
 #include <unistd.h>
 #include <unordered_map>
 
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+#include "tbb/task_scheduler_init.h"
+
 #include "FastxParser.hpp"
 #include "jellyfish/mer_dna.hpp"
 
@@ -11,21 +17,15 @@
 #include "SalmonOpts.hpp"
 #include "SalmonStringUtils.hpp"
 #include "Transcript.hpp"
+#include "TranscriptNames.hpp"
 
 FASTAParser::FASTAParser(const std::string& fname) : fname_(fname) {}
 
 void FASTAParser::populateTargets(std::vector<Transcript>& refs,
+                                  const TranscriptNames& names,
                                   SalmonOpts& sopt) {
   using single_parser = fastx_parser::FastxParser<fastx_parser::ReadSeq>;
 
-  using std::string;
-  using std::unordered_map;
-
-  unordered_map<string, size_t> nameToID;
-  for (auto& ref : refs) {
-    nameToID[ref.RefName] = ref.id;
-  }
-
   // Separators for the header (default ' ' and '\t')
   // If we have the gencode flag, then add '|'.
   std::string sepStr = " \t";
@@ -44,65 +44,93 @@ void FASTAParser::populateTargets(std::vector<Transcript>& refs,
   // Create a random uniform distribution
   std::random_device rd;
   std::default_random_engine eng(rd());
-  std::uniform_int_distribution<> dis(0, 3);
-  uint64_t numNucleotidesReplaced{0};
-
-  // All header names we encounter in the fasta file
-  std::unordered_set<std::string> fastaNames;
+  std::atomic<uint64_t> numNucleotidesReplaced{0};
+
+  // The targets whose names we encounter in the fasta file
+  std::vector<bool> inFasta(refs.size(), false);
+
+  // The records of each read group are looked up serially, and then
+  // encoded (and, if needed, their GC content computed) in parallel.  Each
+  // record gets its own generator for the replacement bases, seeded from
+  // eng in file order.
+  struct TargetRecord {
+    size_t recordIdx;
+    size_t targetID;
+    uint64_t seed;
+  };
+  std::vector<TargetRecord> work;
+  std::unordered_map<size_t, size_t> workIdxOfTarget;
+  tbb::task_scheduler_init tbbScheduler(sopt.numThreads);
 
   auto rg = parser.getReadGroup();
   while (parser.refill(rg)) {
-    for (auto& read : rg) {
-      std::string& header = read.name;
-      std::string name = header.substr(0, header.find_first_of(sepStr));
-      fastaNames.insert(name);
-
-      auto it = nameToID.find(name);
-      if (it == nameToID.end()) {
+    work.clear();
+    workIdxOfTarget.clear();
+    for (size_t r = 0; r < rg.size(); ++r) {
+      std::string& header = rg[r].name;
+      size_t nameLen = std::min(header.find_first_of(sepStr), header.size());
+      uint32_t targetID = names.find(header.data(), nameLen);
+      if (targetID == TranscriptNames::npos) {
         sopt.jointLog->warn("Transcript {} appears in the reference but did "
                             "not appear in the BAM",
-                            name);
+                            header.substr(0, nameLen));
+        continue;
+      }
+      inFasta[targetID] = true;
+      // If a target appears more than once, the last record wins (as
+      // each record replaces the target's sequence)
+      auto wit = workIdxOfTarget.find(targetID);
+      if (wit != workIdxOfTarget.end()) {
+        work[wit->second].recordIdx = r;
       } else {
-
-        // std::string& seq = j->data[i].seq;
-        std::string& seq = read.seq;
-        size_t readLen = seq.length();
-
-        refs[it->second].setSAMSequenceOwned(
-            salmon::stringtools::encodeSequenceInSAM(seq.c_str(), readLen));
-
-        // Replace non-ACGT bases
-        for (size_t b = 0; b < readLen; ++b) {
-          seq[b] = ::toupper(seq[b]);
-          int c = jellyfish::mer_dna::code(seq[b]);
-          // Replace non-ACGT bases with pseudo-random bases
-          if (jellyfish::mer_dna::not_dna(c)) {
-            char rbase = bases[dis(eng)];
-            c = jellyfish::mer_dna::code(rbase);
-            seq[b] = rbase;
-            ++numNucleotidesReplaced;
-          }
-        }
-
-        // allocate space for the new copy
-        char* seqCopy = new char[seq.length() + 1];
-        std::strcpy(seqCopy, seq.c_str());
-        refs[it->second].setSequenceOwned(seqCopy, sopt.gcBiasCorrect,
-                                          sopt.reduceGCMemory);
-        // seqCopy will only be freed when the transcript is destructed!
+        workIdxOfTarget[targetID] = work.size();
+        work.push_back({r, targetID, static_cast<uint64_t>(eng())});
       }
     }
+
+    tbb::parallel_for(
+        tbb::blocked_range<size_t>(0, work.size()),
+        [&](const tbb::blocked_range<size_t>& range) -> void {
+          for (size_t w = range.begin(); w < range.end(); ++w) {
+            auto& target = work[w];
+            std::string& seq = rg[target.recordIdx].seq;
+            size_t readLen = seq.length();
+            auto& ref = refs[target.targetID];
+
+            ref.setSAMSequenceOwned(salmon::stringtools::encodeSequenceInSAM(
+                seq.c_str(), readLen));
+
+            // Copy the sequence, upper-cased, and with non-ACGT bases
+            // replaced by pseudo-random bases
+            std::default_random_engine recordEng(target.seed);
+            std::uniform_int_distribution<> dis(0, 3);
+            uint64_t numReplaced{0};
+            // this copy will only be freed when the transcript is destructed!
+            char* seqCopy = new char[readLen + 1];
+            for (size_t b = 0; b < readLen; ++b) {
+              char base = ::toupper(seq[b]);
+              int c = jellyfish::mer_dna::code(base);
+              if (jellyfish::mer_dna::not_dna(c)) {
+                base = bases[dis(recordEng)];
+                ++numReplaced;
+              }
+              seqCopy[b] = base;
+            }
+            seqCopy[readLen] = '\0';
+            ref.setSequenceOwned(seqCopy, sopt.gcBiasCorrect);
+            numNucleotidesReplaced += numReplaced;
+          }
+        });
   }
 
   // Check that every sequence present in the BAM header was also present in the
   // transcriptome fasta.
   bool missingTxpError{false};
-  for (auto& kv : nameToID) {
-    auto& name = kv.first;
-    if (fastaNames.find(name) == fastaNames.end()) {
+  for (uint32_t i = 0; i < names.size(); ++i) {
+    if (!inFasta[i]) {
       sopt.jointLog->critical("Transcript {} appeared in the BAM header, but "
                               "was not in the provided FASTA file",
-                              name);
+                              names.name(i));
       missingTxpError = true;
     }
   }
@@ -122,5 +150,5 @@ void FASTAParser::populateTargets(std::vector<Transcript>& refs,
 
   sopt.jointLog->info(
       "replaced {} non-ACGT nucleotides with random nucleotides",
-      numNucleotidesReplaced);
+      numNucleotidesReplaced.load());
 }
@@ -0,0 +1,454 @@
+#include "FastxInflateReader.hpp"
+#include "FastxReadahead.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include <sys/stat.h>
+#include <zlib.h>
+
+namespace fastx_parser {
+
+namespace {
+// The size of the buffers inflated into for non-BGZF input
+constexpr size_t gzipBatchSize = size_t(1) << 22;
+// The (compressed) size of a batch of BGZF blocks
+constexpr size_t bgzfBatchSize = size_t(1) << 20;
+constexpr size_t bgzfHeaderSize = 12;
+constexpr size_t bgzfFooterSize = 8;
+
+inline uint16_t getU16(const unsigned char* p) {
+  return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+inline uint32_t getU32(const unsigned char* p) {
+  return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+         (static_cast<uint32_t>(p[2]) << 16) |
+         (static_cast<uint32_t>(p[3]) << 24);
+}
+
+/**
+ * If the (xlen bytes of) gzip extra field at extra contain the BGZF
+ * subfield, set bsize to the recorded block size - 1 and return true.
+ */
+bool findBSIZE(const unsigned char* extra, size_t xlen, uint16_t& bsize) {
+  size_t pos = 0;
+  while (pos + 4 <= xlen) {
+    uint16_t slen = getU16(extra + pos + 2);
+    if (extra[pos] == 'B' and extra[pos + 1] == 'C' and slen == 2 and
+        pos + 6 <= xlen) {
+      bsize = getU16(extra + pos + 4);
+      return true;
+    }
+    pos += 4 + slen;
+  }
+  return false;
+}
+
+/**
+ * Read the header of the next BGZF block, with readIn (which reads like
+ * fread() does), into hdr (which must be able to hold bgzfHeaderSize + 65535
+ * bytes); on success, headerLen is the size of the header (including the
+ * extra field) and blockLen that of the whole block.  Returns false if the
+ * next block is not a BGZF block, or at the end of the file, in which case
+ * atEnd is true.
+ */
+template <typename ReadFunT>
+bool readBGZFHeader(ReadFunT readIn, unsigned char* hdr, size_t& headerLen,
+                    size_t& blockLen, bool& atEnd) {
+  size_t n = readIn(hdr, bgzfHeaderSize);
+  atEnd = (n == 0);
+  if (n != bgzfHeaderSize) {
+    return false;
+  }
+  if (hdr[0] != 31 or hdr[1] != 139 or hdr[2] != 8 or !(hdr[3] & 4)) {
+    return false;
+  }
+  size_t xlen = getU16(hdr + 10);
+  if (readIn(hdr + bgzfHeaderSize, xlen) != xlen) {
+    return false;
+  }
+  uint16_t bsize{0};
+  if (!findBSIZE(hdr + bgzfHeaderSize, xlen, bsize)) {
+    return false;
+  }
+  headerLen = bgzfHeaderSize + xlen;
+  blockLen = static_cast<size_t>(bsize) + 1;
+  return blockLen >= headerLen + bgzfFooterSize;
+}
+}
+
+InflateReader::InflateReader(const std::string& path, uint32_t numInflaters,
+                             uint64_t offset)
+    : path_(path), offset_(offset),
+      numInflaters_(std::max(numInflaters, uint32_t(1))) {
+  // Only a regular file is opened to look for the BGZF header; a stream
+  // (stdin, a named pipe or process substitution) can only be opened and
+  // read once, so it is always read as a gzip stream.  So is a remote
+  // object (a BGZF file is a series of gzip members), which then takes a
+  // single pass over the network.
+  bool remote = isRemotePath(path_);
+  struct stat st;
+  if (!remote and ::stat(path_.c_str(), &st) != 0) {
+    return;
+  }
+  if (!remote and S_ISREG(st.st_mode) and offset_ == 0) {
+    FILE* fp = std::fopen(path_.c_str(), "rb");
+    if (fp == nullptr) {
+      return;
+    }
+    std::vector<unsigned char> hdr(bgzfHeaderSize + 65536);
+    size_t headerLen{0}, blockLen{0};
+    bool atEnd{false};
+    isBGZF_ = readBGZFHeader(
+        [fp](unsigned char* buf, size_t n) -> size_t {
+          return std::fread(buf, 1, n, fp);
+        },
+        hdr.data(), headerLen, blockLen, atEnd);
+    std::fclose(fp);
+  }
+  good_ = true;
+
+  if (isBGZF_) {
+    maxInFlight_ = 2 * numInflaters_ + 2;
+    producer_ = std::thread([this]() -> void { readBGZF_(); });
+    for (uint32_t i = 0; i < numInflaters_; ++i) {
+      inflaters_.emplace_back([this]() -> void { inflateBatches_(); });
+    }
+  } else {
+    maxInFlight_ = 4;
+    producer_ = std::thread([this]() -> void { readGzip_(); });
+  }
+}
+
+InflateReader::~InflateReader() {
+  {
+    std::lock_guard<std::mutex> l(mut_);
+    stopping_ = true;
+  }
+  roomCV_.notify_all();
+  jobsCV_.notify_all();
+  if (producer_.joinable()) {
+    producer_.join();
+  }
+  for (auto& t : inflaters_) {
+    t.join();
+  }
+}
+
+void InflateReader::waitForRoom_(uint64_t seq) {
+  std::unique_lock<std::mutex> l(mut_);
+  roomCV_.wait(l, [this, seq]() -> bool {
+    return stopping_ or seq < nextSeq_ + maxInFlight_;
+  });
+}
+
+void InflateReader::publish_(uint64_t seq, std::unique_ptr<Batch> batch) {
+  {
+    std::lock_guard<std::mutex> l(mut_);
+    ready_[seq] = std::move(batch);
+  }
+  readyCV_.notify_all();
+}
+
+void InflateReader::readGzip_() {
+  ReadaheadFile in(path_, offset_);
+  z_stream strm;
+  std::memset(&strm, 0, sizeof(strm));
+  // (15 + 32: a gzip, or zlib, stream whose header is detected)
+  bool zok = (inflateInit2(&strm, 15 + 32) == Z_OK);
+  const unsigned char* data{nullptr};
+  size_t len{0};
+  bool haveInput = in.good() and zok and in.next(data, len);
+  // Like gzread(), pass input that isn't gzip compressed through as is
+  bool plain = haveInput and (len < 2 or data[0] != 31 or data[1] != 139);
+  bool streamEnded{false};
+  uint64_t seq{0};
+  bool done{!haveInput};
+  if (!in.good() or !zok or in.failed()) {
+    std::unique_ptr<Batch> batch(new Batch);
+    batch->ok = false;
+    publish_(seq++, std::move(batch));
+  }
+  while (!done) {
+    waitForRoom_(seq);
+    {
+      std::lock_guard<std::mutex> l(mut_);
+      if (stopping_) {
+        break;
+      }
+    }
+    std::unique_ptr<Batch> batch(new Batch);
+    batch->out.resize(gzipBatchSize);
+    size_t have{0};
+    while (have < gzipBatchSize) {
+      if (len == 0 and !in.next(data, len)) {
+        // A gzip stream that ends part way through a member is truncated
+        batch->ok = !in.failed() and (plain or streamEnded);
+        done = true;
+        break;
+      }
+      if (plain) {
+        size_t n = std::min(len, gzipBatchSize - have);
+        std::memcpy(batch->out.data() + have, data, n);
+        data += n;
+        len -= n;
+        have += n;
+        continue;
+      }
+      if (streamEnded) {
+        // Another member follows; anything else after the last member is
+        // ignored, as gzread() does
+        if (data[0] != 31) {
+          done = true;
+          break;
+        }
+        inflateReset(&strm);
+        streamEnded = false;
+      }
+      strm.next_in = const_cast<Bytef*>(data);
+      strm.avail_in = static_cast<uInt>(len);
+      strm.next_out = batch->out.data() + have;
+      strm.avail_out = static_cast<uInt>(gzipBatchSize - have);
+      int ret = inflate(&strm, Z_NO_FLUSH);
+      data += len - strm.avail_in;
+      len = strm.avail_in;
+      have = gzipBatchSize - strm.avail_out;
+      if (ret == Z_STREAM_END) {
+        streamEnded = true;
+      } else if (ret != Z_OK and ret != Z_BUF_ERROR) {
+        batch->ok = false;
+        done = true;
+        break;
+      }
+    }
+    batch->out.resize(have);
+    publish_(seq++, std::move(batch));
+  }
+  if (zok) {
+    inflateEnd(&strm);
+  }
+  {
+    std::lock_guard<std::mutex> l(mut_);
+    numBatches_ = seq;
+    producerDone_ = true;
+  }
+  readyCV_.notify_all();
+}
+
+void InflateReader::readBGZF_() {
+  ReadaheadFile in(path_);
+  auto readIn = [&in](unsigned char* buf, size_t n) -> size_t {
+    return in.read(buf, n);
+  };
+  std::vector<unsigned char> hdr(bgzfHeaderSize + 65536);
+  uint64_t seq{0};
+  bool done{false};
+  bool ok{in.good()};
+  while (ok and !done) {
+    waitForRoom_(seq);
+    std::unique_ptr<Batch> batch(new Batch);
+    while (batch->in.size() < bgzfBatchSize) {
+      size_t headerLen{0}, blockLen{0};
+      bool atEnd{false};
+      if (!readBGZFHeader(readIn, hdr.data(), headerLen, blockLen, atEnd)) {
+        // the end of the file, or a truncated block, or one that is not a
+        // BGZF block
+        ok = atEnd and !in.failed();
+        done = true;
+        break;
+      }
+      size_t start = batch->in.size();
+      batch->in.resize(start + blockLen);
+      std::memcpy(batch->in.data() + start, hdr.data(), headerLen);
+      size_t rest = blockLen - headerLen;
+      if (in.read(batch->in.data() + start + headerLen, rest) != rest) {
+        ok = false;
+        done = true;
+        break;
+      }
+    }
+    if (!ok) {
+      batch->ok = false;
+    }
+    {
+      std::lock_guard<std::mutex> l(mut_);
+      if (stopping_) {
+        break;
+      }
+      jobs_.emplace_back(seq++, std::move(batch));
+    }
+    jobsCV_.notify_one();
+  }
+  if (!in.good()) {
+    std::unique_ptr<Batch> batch(new Batch);
+    batch->ok = false;
+    publish_(seq++, std::move(batch));
+  }
+  {
+    std::lock_guard<std::mutex> l(mut_);
+    numBatches_ = seq;
+    producerDone_ = true;
+  }
+  jobsCV_.notify_all();
+  readyCV_.notify_all();
+}
+
+void InflateReader::inflateBatches_() {
+  z_stream strm;
+  std::memset(&strm, 0, sizeof(strm));
+  bool zok = (inflateInit2(&strm, -15) == Z_OK);
+  while (true) {
+    std::pair<uint64_t, std::unique_ptr<Batch>> job;
+    {
+      std::unique_lock<std::mutex> l(mut_);
+      jobsCV_.wait(l, [this]() -> bool {
+        return stopping_ or producerDone_ or !jobs_.empty();
+      });
+      if (jobs_.empty()) {
+        break;
+      }
+      job = std::move(jobs_.front());
+      jobs_.pop_front();
+    }
+    inflateBatch_(&strm, zok, *job.second);
+    publish_(job.first, std::move(job.second));
+  }
+  if (zok) {
+    inflateEnd(&strm);
+  }
+}
+
+bool InflateReader::helpInflate() {
+  if (!isBGZF_) {
+    return false;
+  }
+  std::pair<uint64_t, std::unique_ptr<Batch>> job;
+  {
+    std::lock_guard<std::mutex> l(mut_);
+    if (stopping_ or jobs_.empty()) {
+      return false;
+    }
+    job = std::move(jobs_.front());
+    jobs_.pop_front();
+  }
+  z_stream strm;
+  std::memset(&strm, 0, sizeof(strm));
+  bool zok = (inflateInit2(&strm, -15) == Z_OK);
+  inflateBatch_(&strm, zok, *job.second);
+  if (zok) {
+    inflateEnd(&strm);
+  }
+  publish_(job.first, std::move(job.second));
+  return true;
+}
+
+void InflateReader::inflateBatch_(void* strmPtr, bool zok, Batch& batch) {
+  z_stream& strm = *static_cast<z_stream*>(strmPtr);
+  batch.ok = batch.ok and zok;
+  size_t pos{0};
+  while (batch.ok and pos < batch.in.size()) {
+    const unsigned char* block = batch.in.data() + pos;
+    size_t xlen = getU16(block + 10);
+    uint16_t bsize{0};
+    findBSIZE(block + bgzfHeaderSize, xlen, bsize);
+    size_t blockLen = static_cast<size_t>(bsize) + 1;
+    size_t cdataLen = blockLen - bgzfHeaderSize - xlen - bgzfFooterSize;
+    uint32_t crc = getU32(block + blockLen - 8);
+    uint32_t isize = getU32(block + blockLen - 4);
+
+    size_t outStart = batch.out.size();
+    batch.out.resize(outStart + isize);
+    inflateReset(&strm);
+    strm.next_in = const_cast<Bytef*>(block + bgzfHeaderSize + xlen);
+    strm.avail_in = static_cast<uInt>(cdataLen);
+    strm.next_out = batch.out.data() + outStart;
+    strm.avail_out = isize;
+    int ret = inflate(&strm, Z_FINISH);
+    if (ret != Z_STREAM_END or strm.avail_out != 0 or
+        crc32(crc32(0L, Z_NULL, 0), batch.out.data() + outStart, isize) !=
+            crc) {
+      batch.ok = false;
+    }
+    pos += blockLen;
+  }
+  batch.in.clear();
+  batch.in.shrink_to_fit();
+}
+
+int InflateReader::read(void* buf, unsigned len) {
+  if (!good_) {
+    return -1;
+  }
+  unsigned char* dest = static_cast<unsigned char*>(buf);
+  size_t copied{0};
+  while (copied < len) {
+    if (!cur_ or curPos_ == cur_->out.size()) {
+      cur_.reset();
+      {
+        std::unique_lock<std::mutex> l(mut_);
+        readyCV_.wait(l, [this]() -> bool {
+          return ready_.count(nextSeq_) > 0 or
+                 (producerDone_ and nextSeq_ >= numBatches_);
+        });
+        auto it = ready_.find(nextSeq_);
+        if (it == ready_.end()) {
+          // end of the file
+          break;
+        }
+        cur_ = std::move(it->second);
+        ready_.erase(it);
+        ++nextSeq_;
+        curPos_ = 0;
+      }
+      roomCV_.notify_all();
+      if (!cur_->ok) {
+        return -1;
+      }
+      continue;
+    }
+    size_t n = std::min(static_cast<size_t>(len) - copied,
+                        cur_->out.size() - curPos_);
+    std::memcpy(dest + copied, cur_->out.data() + curPos_, n);
+    copied += n;
+    curPos_ += n;
+  }
+  return static_cast<int>(copied);
+}
+
+void InflateHelpers::add(const std::shared_ptr<InflateReader>& r) {
+  std::lock_guard<std::mutex> l(mut_);
+  readers_.push_back(r);
+}
+
+void InflateHelpers::remove(const InflateReader* r) {
+  std::lock_guard<std::mutex> l(mut_);
+  readers_.erase(std::remove_if(readers_.begin(), readers_.end(),
+                                [r](const std::shared_ptr<InflateReader>& p)
+                                    -> bool { return p.get() == r; }),
+                 readers_.end());
+}
+
+bool InflateHelpers::help() {
+  // (a reader may be removed while it's being helped; the copy of its
+  // pointer keeps it alive until then)
+  std::vector<std::shared_ptr<InflateReader>> readers;
+  size_t start{0};
+  {
+    std::lock_guard<std::mutex> l(mut_);
+    if (readers_.empty()) {
+      return false;
+    }
+    readers = readers_;
+    start = next_++;
+  }
+  // start at a different reader each time, so that all of them are helped
+  for (size_t i = 0; i < readers.size(); ++i) {
+    if (readers[(start + i) % readers.size()]->helpInflate()) {
+      ++numHelped_;
+      return true;
+    }
+  }
+  return false;
+}
+} // namespace fastx_parser
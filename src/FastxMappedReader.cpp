@@ -0,0 +1,138 @@
+#include "FastxMappedReader.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fastx_parser {
+
+namespace {
+// How far ahead of the parser the kernel is asked to read
+constexpr size_t prefetchWindow = size_t(1) << 24;
+
+inline const char* findNewline(const char* p, const char* end) {
+  return static_cast<const char*>(std::memchr(p, '\n', end - p));
+}
+
+// The length of the line [p, lineEnd), without a trailing '\r' (as kseq)
+inline size_t lineLength(const char* p, const char* lineEnd) {
+  size_t len = lineEnd - p;
+  if (len > 1 and p[len - 1] == '\r') {
+    --len;
+  }
+  return len;
+}
+}
+
+MappedFastqReader::MappedFastqReader(const std::string& path) {
+  // Don't open anything but a regular file: a stream (e.g. a named pipe)
+  // can only be opened once, by the InflateReader that will read it.
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0 or !S_ISREG(st.st_mode) or
+      st.st_size == 0) {
+    return;
+  }
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  if (::fstat(fd, &st) != 0 or !S_ISREG(st.st_mode) or st.st_size == 0) {
+    ::close(fd);
+    return;
+  }
+  size_t size = static_cast<size_t>(st.st_size);
+  void* addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping stays valid once the file is closed
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    return;
+  }
+  mapping_.reset(static_cast<const char*>(addr), [size](const char* p) {
+    ::munmap(const_cast<char*>(p), size);
+  });
+  // Only FASTQ is read from the mapping (not FASTA, nor compressed files)
+  if (static_cast<const char*>(addr)[0] != '@') {
+    mapping_.reset();
+    return;
+  }
+  data_ = mapping_.get();
+  size_ = size;
+  ::madvise(addr, size_, MADV_SEQUENTIAL);
+  prefetch_();
+}
+
+void MappedFastqReader::prefetch_() {
+  if (pos_ + prefetchWindow <= prefetched_ or prefetched_ >= size_) {
+    return;
+  }
+  size_t pageSize = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+  size_t start = prefetched_ - (prefetched_ % pageSize);
+  size_t len = std::min(2 * prefetchWindow, size_ - start);
+  ::madvise(const_cast<char*>(data_) + start, len, MADV_WILLNEED);
+  prefetched_ = start + len;
+}
+
+int MappedFastqReader::next(MappedRecord& rec) {
+  if (data_ == nullptr) {
+    return 0;
+  }
+  const char* end = data_ + size_;
+  const char* p = data_ + pos_;
+  // skip empty lines between records (and at the end of the file)
+  while (p < end and (*p == '\n' or *p == '\r')) {
+    ++p;
+  }
+  if (p == end) {
+    pos_ = size_;
+    return 0;
+  }
+  if (*p != '@') {
+    return -1;
+  }
+
+  const char* headerEnd = findNewline(p, end);
+  if (headerEnd == nullptr) {
+    return -1;
+  }
+  const char* name = p + 1;
+  const char* nameEnd = name;
+  while (nameEnd < headerEnd and
+         !std::isspace(static_cast<unsigned char>(*nameEnd))) {
+    ++nameEnd;
+  }
+
+  const char* seq = headerEnd + 1;
+  const char* seqEnd = (seq < end) ? findNewline(seq, end) : nullptr;
+  if (seqEnd == nullptr or seqEnd == seq or *seq == '@' or *seq == '>' or
+      *seq == '+' or seqEnd + 1 == end or seqEnd[1] != '+') {
+    return -1;
+  }
+  size_t seqLen = lineLength(seq, seqEnd);
+
+  const char* plusEnd = findNewline(seqEnd + 1, end);
+  if (plusEnd == nullptr) {
+    return -1;
+  }
+  const char* qual = plusEnd + 1;
+  const char* qualEnd = (qual < end) ? findNewline(qual, end) : nullptr;
+  if (qualEnd == nullptr) {
+    qualEnd = end;
+  }
+  if (lineLength(qual, qualEnd) != seqLen) {
+    return -1;
+  }
+
+  rec.name = name;
+  rec.nameLen = nameEnd - name;
+  rec.seq = seq;
+  rec.seqLen = seqLen;
+  pos_ = (qualEnd == end) ? size_ : static_cast<size_t>(qualEnd + 1 - data_);
+  prefetch_();
+  return 1;
+}
+} // namespace fastx_parser
@@ -1,9 +1,15 @@
 #include "FastxParser.hpp"
+#include "FastxInflateReader.hpp"
+#include "FastxMappedReader.hpp"
 #include "FastxParserThreadUtils.hpp"
+#include "xxhash.h"
 
 #include "fcntl.h"
 #include "unistd.h"
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
@@ -14,23 +20,26 @@
 #include <vector>
 #include <zlib.h>
 
-// STEP 1: declare the type of file handler and the read() function
-KSEQ_INIT(gzFile, gzread)
+// STEP 1: declare the type of file handler and the read() function; the
+// InflateReader decompresses the input ahead of the parser on its own
+// thread(s), so that the parsing thread only has to split records.
+KSEQ_INIT(fastx_parser::InflateReader*, fastx_parser::inflateRead)
 
 namespace fastx_parser {
 template <typename T>
 FastxParser<T>::FastxParser(std::vector<std::string> files,
                             uint32_t numConsumers, uint32_t numParsers,
-                            uint32_t chunkSize)
-    : FastxParser(files, {}, numConsumers, numParsers, chunkSize) {}
+                            uint32_t chunkSize, size_t maxChunkBytes)
+    : FastxParser(files, {}, numConsumers, numParsers, chunkSize,
+                  maxChunkBytes) {}
 
 template <typename T>
 FastxParser<T>::FastxParser(std::vector<std::string> files,
                             std::vector<std::string> files2,
                             uint32_t numConsumers, uint32_t numParsers,
-                            uint32_t chunkSize)
+                            uint32_t chunkSize, size_t maxChunkBytes)
     : inputStreams_(files), inputStreams2_(files2), numParsing_(0),
-      blockSize_(chunkSize) {
+      blockSize_(chunkSize), maxChunkBytes_(maxChunkBytes) {
 
   if (numParsers > files.size()) {
     std::cerr << "Can't make user of more parsing threads than file (pairs); "
@@ -40,6 +49,17 @@ FastxParser<T>::FastxParser(std::vector<std::string> files,
   }
   numParsers_ = numParsers;
 
+  // Share the consumers among the streams being decompressed at once; each
+  // stream gets (at least) one inflater thread (which is only used in
+  // parallel if the stream is BGZF compressed).  A file of interleaved pairs
+  // (an empty #2 file) is a single stream.
+  bool haveMates2 =
+      std::any_of(files2.begin(), files2.end(),
+                  [](const std::string& f) -> bool { return !f.empty(); });
+  uint32_t numStreams = numParsers_ * (haveMates2 ? 2 : 1);
+  numInflaters_ = std::max(uint32_t(1),
+                           numConsumers / std::max(uint32_t(1), 2 * numStreams));
+
   // nobody is parsing yet
   numParsing_ = 0;
 
@@ -138,104 +158,372 @@ template <typename T> bool FastxParser<T>::stop() {
   return ret;
 }
 
-inline void copyRecord(kseq_t* seq, ReadSeq* s) {
+inline void copyRecord(kseq_t* seq, ReadSeq* s, std::string& /*buf*/) {
   // Copy over the sequence and read name
   s->seq.assign(seq->seq.s, seq->seq.l);
   s->name.assign(seq->name.s, seq->name.l);
 }
 
+inline void copyRecord(const MappedRecord& rec, ReadSeq* s) {
+  s->seq.assign(rec.seq, rec.seqLen);
+  s->name.assign(rec.name, rec.nameLen);
+}
+
+inline StrSpan appendField(const kstring_t& field, std::string& buf) {
+  size_t offset = buf.size();
+  buf.append(field.s, field.l);
+  return StrSpan(offset, field.l);
+}
+
+inline void copyRecord(kseq_t* seq, ReadSpanSeq* s, std::string& buf) {
+  // Append the sequence and read name to the chunk's buffer
+  s->seq = appendField(seq->seq, buf);
+  s->name = appendField(seq->name, buf);
+}
+
+inline void copyRecord(const MappedRecord& rec, ReadSpanSeq* s) {
+  // Point straight into the mapped file
+  s->seq = StrSpan(rec.seq, rec.seqLen);
+  s->name = StrSpan(rec.name, rec.nameLen);
+}
+
+// Give the spans of the first n records of a (filled) chunk their address
+inline void resolveSpans(ReadChunk<ReadSeq>& /*chunk*/, size_t /*n*/) {}
+inline void resolveSpans(ReadChunk<ReadPair>& /*chunk*/, size_t /*n*/) {}
+
+inline void resolveSpans(ReadChunk<ReadSpanSeq>& chunk, size_t n) {
+  const char* base = chunk.buffer().data();
+  for (size_t i = 0; i < n; ++i) {
+    chunk[i].seq.resolve(base);
+    chunk[i].name.resolve(base);
+  }
+}
+
+inline void resolveSpans(ReadChunk<ReadSpanPair>& chunk, size_t n) {
+  const char* base = chunk.buffer().data();
+  for (size_t i = 0; i < n; ++i) {
+    chunk[i].first.seq.resolve(base);
+    chunk[i].first.name.resolve(base);
+    chunk[i].second.seq.resolve(base);
+    chunk[i].second.name.resolve(base);
+  }
+}
+
+// What the parsing threads are told by (and report to) the parser
+struct ParseSettings {
+  // the number of inflater threads used for each (BGZF) input stream
+  uint32_t numInflaters;
+  // the byte limit of a chunk (0 for no limit)
+  size_t maxChunkBytes;
+  // the total time spent waiting for free chunks
+  std::atomic<uint64_t>& waitNs;
+  // the number of records still to be dropped (see skipRecords())
+  std::atomic<uint64_t>& toSkip;
+  // where the readers are registered for the consumers to help inflate
+  InflateHelpers& helpers;
+  // the records kept by subsampling (see subsample()), and those left out
+  uint64_t keepBelow;
+  uint64_t sampleSeed;
+  std::atomic<uint64_t>& numSubsampledOut;
+};
+
+// True if the next record, with the given name, is to be dropped
+inline bool skipRecord(const ParseSettings& settings, const char* name,
+                       size_t nameLen) {
+  if (settings.keepBelow != std::numeric_limits<uint64_t>::max() and
+      XXH64(name, nameLen, settings.sampleSeed) >= settings.keepBelow) {
+    settings.numSubsampledOut.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  // (the records to skip are counted among those kept by subsampling, as
+  // the checkpoints count them)
+  if (settings.toSkip.load(std::memory_order_relaxed) == 0) {
+    return false;
+  }
+  --settings.toSkip;
+  return true;
+}
+
+/**
+ * Fills the chunks of a parsing thread with records, handing each one to
+ * the consumers once it is full.
+ */
+template <typename T> class ChunkFiller {
+public:
+  ChunkFiller(
+      moodycamel::ConsumerToken* cCont, moodycamel::ProducerToken* pRead,
+      moodycamel::ConcurrentQueue<std::unique_ptr<ReadChunk<T>>>&
+          seqContainerQueue,
+      moodycamel::ConcurrentQueue<std::unique_ptr<ReadChunk<T>>>& readQueue,
+      const ParseSettings& settings)
+      : cCont_(cCont), pRead_(pRead), seqContainerQueue_(seqContainerQueue),
+        readQueue_(readQueue), settings_(settings) {
+    getChunk_();
+  }
+
+  // The chunk being filled
+  ReadChunk<T>& chunk() { return *local_; }
+
+  // The next record to fill
+  T* next() {
+    if (numWaiting_ == 0) {
+      local_->clearStorage();
+    }
+    return &((*local_)[numWaiting_++]);
+  }
+
+  // True if the record returned by next() is the first of its chunk
+  bool startedChunk() const { return numWaiting_ == 1; }
+
+  // Give back the record returned by next(), which couldn't be filled
+  void unfill() { --numWaiting_; }
+
+  // Call once the record returned by next() has been filled (with
+  // recordBytes bytes of sequence and name)
+  void filled(size_t recordBytes) {
+    numBytes_ += recordBytes;
+    // If we've filled the local vector (or reached the byte limit), then dump
+    // to the concurrent queue
+    if (numWaiting_ == numObtained_ or
+        (settings_.maxChunkBytes > 0 and
+         numBytes_ >= settings_.maxChunkBytes)) {
+      local_->have(numWaiting_);
+      resolveSpans(*local_, numWaiting_);
+      auto curMaxDelay = fastx_parser::thread_utils::MIN_BACKOFF_ITERS;
+      // (through the producer token, so that the chunks of a parsing thread
+      // are handed out in the order they were filled)
+      while (!readQueue_.try_enqueue(*pRead_, std::move(local_))) {
+        fastx_parser::thread_utils::backoffOrYield(curMaxDelay);
+      }
+      numWaiting_ = 0;
+      numObtained_ = 0;
+      numBytes_ = 0;
+      // And get more empty reads
+      getChunk_();
+    }
+  }
+
+  // If we hit the end of the file and have any reads in our local buffer
+  // then dump them here (otherwise, give the empty chunk back).
+  void finish() {
+    if (numWaiting_ > 0) {
+      local_->have(numWaiting_);
+      resolveSpans(*local_, numWaiting_);
+      auto curMaxDelay = fastx_parser::thread_utils::MIN_BACKOFF_ITERS;
+      while (!readQueue_.try_enqueue(*pRead_, std::move(local_))) {
+        fastx_parser::thread_utils::backoffOrYield(curMaxDelay);
+      }
+      numWaiting_ = 0;
+      numBytes_ = 0;
+    } else {
+      seqContainerQueue_.enqueue(std::move(local_));
+    }
+  }
+
+private:
+  void getChunk_() {
+    if (!seqContainerQueue_.try_dequeue(*cCont_, local_)) {
+      // All of the chunks are in use; wait (and count the time spent waiting)
+      auto start = std::chrono::steady_clock::now();
+      auto curMaxDelay = fastx_parser::thread_utils::MIN_BACKOFF_ITERS;
+      while (!seqContainerQueue_.try_dequeue(*cCont_, local_)) {
+        fastx_parser::thread_utils::backoffOrYield(curMaxDelay);
+        // Think of a way to do this that wouldn't be loud (or would allow a
+        // user-definable logging mechanism) std::cerr << "couldn't dequeue
+        // read chunk\n";
+      }
+      settings_.waitNs +=
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - start)
+              .count();
+    }
+    // The chunk may have been handed off partially filled the last time
+    local_->have(local_->want());
+    numObtained_ = local_->size();
+  }
+
+  moodycamel::ConsumerToken* cCont_;
+  moodycamel::ProducerToken* pRead_;
+  moodycamel::ConcurrentQueue<std::unique_ptr<ReadChunk<T>>>&
+      seqContainerQueue_;
+  moodycamel::ConcurrentQueue<std::unique_ptr<ReadChunk<T>>>& readQueue_;
+  const ParseSettings& settings_;
+  std::unique_ptr<ReadChunk<T>> local_;
+  // The number of reads we have in the local vector
+  size_t numWaiting_{0};
+  size_t numObtained_{0};
+  // The number of bytes of sequence and name in the local vector
+  size_t numBytes_{0};
+};
+
 template <typename T>
 int parseReads(
-    std::vector<std::string>& inputStreams, std::atomic<uint32_t>& numParsing,
+    std::vector<std::string>& inputStreams, const ParseSettings& settings,
+    std::atomic<uint32_t>& numParsing,
     moodycamel::ConsumerToken* cCont, moodycamel::ProducerToken* pRead,
     moodycamel::ConcurrentQueue<uint32_t>& workQueue,
     moodycamel::ConcurrentQueue<std::unique_ptr<ReadChunk<T>>>&
         seqContainerQueue_,
     moodycamel::ConcurrentQueue<std::unique_ptr<ReadChunk<T>>>& readQueue_) {
 
-  using fastx_parser::thread_utils::MIN_BACKOFF_ITERS;
-  auto curMaxDelay = MIN_BACKOFF_ITERS;
   kseq_t* seq;
   T* s;
   uint32_t fn{0};
   while (workQueue.try_dequeue(fn)) {
     auto file = inputStreams[fn];
-    std::unique_ptr<ReadChunk<T>> local;
-    while (!seqContainerQueue_.try_dequeue(*cCont, local)) {
-      fastx_parser::thread_utils::backoffOrYield(curMaxDelay);
-      // Think of a way to do this that wouldn't be loud (or would allow a
-      // user-definable logging mechanism) std::cerr << "couldn't dequeue read
-      // chunk\n";
+    ChunkFiller<T> filler(cCont, pRead, seqContainerQueue_, readQueue_,
+                          settings);
+
+    // Uncompressed FASTQ is read straight from a mapping of the file, for as
+    // long as the records are in the plain 4-line form; kseq reads the rest.
+    bool useKseq{true};
+    uint64_t offset{0};
+    {
+      MappedFastqReader mapped(file);
+      if (mapped.good()) {
+        MappedRecord rec;
+        int mv{0};
+        while ((mv = mapped.next(rec)) > 0) {
+          if (skipRecord(settings, rec.name, rec.nameLen)) {
+            continue;
+          }
+          s = filler.next();
+          if (filler.startedChunk()) {
+            filler.chunk().hold(mapped.mapping());
+          }
+          copyRecord(rec, s);
+          filler.filled(rec.seqLen + rec.nameLen);
+        }
+        useKseq = (mv < 0);
+        offset = mapped.offset();
+      }
     }
-    size_t numObtained{local->size()};
-    // open the file and init the parser
-    auto fp = gzopen(file.c_str(), "r");
 
-    // The number of reads we have in the local vector
-    size_t numWaiting{0};
+    if (useKseq) {
+      // open the file and init the parser
+      std::shared_ptr<InflateReader> fp(
+          new InflateReader(file, settings.numInflaters, offset));
+      settings.helpers.add(fp);
+      seq = kseq_init(fp.get());
+      int ksv = kseq_read(seq);
+
+      while (ksv >= 0) {
+        if (skipRecord(settings, seq->name.s, seq->name.l)) {
+          ksv = kseq_read(seq);
+          continue;
+        }
+        s = filler.next();
+        copyRecord(seq, s, filler.chunk().buffer());
+        filler.filled(seq->seq.l + seq->name.l);
+        ksv = kseq_read(seq);
+      }
 
-    seq = kseq_init(fp);
-    int ksv = kseq_read(seq);
+      // destroy the parser and close the file
+      kseq_destroy(seq);
+      settings.helpers.remove(fp.get());
+      fp.reset();
+      if (ksv == -3) {
+        --numParsing;
+        return -3;
+      }
+    }
 
-    while (ksv >= 0) {
-      s = &((*local)[numWaiting++]);
+    filler.finish();
+  }
 
-      copyRecord(seq, s);
+  --numParsing;
+  return 0;
+}
 
-      // If we've filled the local vector, then dump to the concurrent queue
-      if (numWaiting == numObtained) {
-        curMaxDelay = MIN_BACKOFF_ITERS;
-        while (!readQueue_.try_enqueue(std::move(local))) {
-          fastx_parser::thread_utils::backoffOrYield(curMaxDelay);
+/**
+ * Parse a file of interleaved pairs (each #1 mate followed by its #2 mate)
+ * into filler; returns 0, or the (< -1) error code of kseq.  A #1 mate left
+ * without a #2 mate at the end of the file is ignored, as are the reads past
+ * the end of the shorter file of a (#1, #2) file pair.
+ */
+template <typename T>
+int parseInterleavedPairs(const std::string& file,
+                          const ParseSettings& settings,
+                          ChunkFiller<T>& filler) {
+  bool useKseq{true};
+  uint64_t offset{0};
+  {
+    MappedFastqReader mapped(file);
+    if (mapped.good()) {
+      MappedRecord rec, rec2;
+      int mv{0}, mv2{1};
+      while (true) {
+        // (the kseq reader restarts at the #1 mate of a partly read pair)
+        offset = mapped.offset();
+        mv = mapped.next(rec);
+        if (mv <= 0) {
+          break;
+        }
+        mv2 = mapped.next(rec2);
+        if (mv2 <= 0) {
+          break;
         }
-        numWaiting = 0;
-        numObtained = 0;
-        // And get more empty reads
-        curMaxDelay = MIN_BACKOFF_ITERS;
-        while (!seqContainerQueue_.try_dequeue(*cCont, local)) {
-          fastx_parser::thread_utils::backoffOrYield(curMaxDelay);
+        if (skipRecord(settings, rec.name, rec.nameLen)) {
+          continue;
         }
-        numObtained = local->size();
+        T* s = filler.next();
+        if (filler.startedChunk()) {
+          filler.chunk().hold(mapped.mapping());
+        }
+        copyRecord(rec, &s->first);
+        copyRecord(rec2, &s->second);
+        filler.filled(rec.seqLen + rec.nameLen + rec2.seqLen + rec2.nameLen);
       }
-      ksv = kseq_read(seq);
-    }
-
-    if (ksv == -3) {
-      --numParsing;
-      return -3;
+      useKseq = (mv < 0 or mv2 < 0);
     }
+  }
+  if (!useKseq) {
+    return 0;
+  }
 
-    // If we hit the end of the file and have any reads in our local buffer
-    // then dump them here.
-    if (numWaiting > 0) {
-      local->have(numWaiting);
-      curMaxDelay = MIN_BACKOFF_ITERS;
-      while (!readQueue_.try_enqueue(*pRead, std::move(local))) {
-        fastx_parser::thread_utils::backoffOrYield(curMaxDelay);
+  std::shared_ptr<InflateReader> fp(
+      new InflateReader(file, settings.numInflaters, offset));
+  settings.helpers.add(fp);
+  kseq_t* seq = kseq_init(fp.get());
+  int ksv = kseq_read(seq);
+  while (ksv >= 0) {
+    if (skipRecord(settings, seq->name.s, seq->name.l)) {
+      ksv = kseq_read(seq);
+      if (ksv >= 0) {
+        ksv = kseq_read(seq);
       }
-      numWaiting = 0;
+      continue;
+    }
+    // The #1 mate is copied before kseq reuses its buffers for the #2 mate
+    T* s = filler.next();
+    copyRecord(seq, &s->first, filler.chunk().buffer());
+    size_t recordBytes = seq->seq.l + seq->name.l;
+    ksv = kseq_read(seq);
+    if (ksv < 0) {
+      filler.unfill();
+      break;
     }
-    // destroy the parser and close the file
-    kseq_destroy(seq);
-    gzclose(fp);
+    copyRecord(seq, &s->second, filler.chunk().buffer());
+    filler.filled(recordBytes + seq->seq.l + seq->name.l);
+    ksv = kseq_read(seq);
   }
-
-  --numParsing;
-  return 0;
+  kseq_destroy(seq);
+  settings.helpers.remove(fp.get());
+  fp.reset();
+  return (ksv < -1) ? ksv : 0;
 }
 
 template <typename T>
 int parseReadPair(
     std::vector<std::string>& inputStreams,
-    std::vector<std::string>& inputStreams2, std::atomic<uint32_t>& numParsing,
+    std::vector<std::string>& inputStreams2, const ParseSettings& settings,
+    std::atomic<uint32_t>& numParsing,
     moodycamel::ConsumerToken* cCont, moodycamel::ProducerToken* pRead,
     moodycamel::ConcurrentQueue<uint32_t>& workQueue,
     moodycamel::ConcurrentQueue<std::unique_ptr<ReadChunk<T>>>&
         seqContainerQueue_,
     moodycamel::ConcurrentQueue<std::unique_ptr<ReadChunk<T>>>& readQueue_) {
 
-  using fastx_parser::thread_utils::MIN_BACKOFF_ITERS;
-  size_t curMaxDelay = MIN_BACKOFF_ITERS;
   kseq_t* seq;
   kseq_t* seq2;
   T* s;
@@ -245,115 +533,154 @@ int parseReadPair(
     // for (size_t fn = 0; fn < inputStreams.size(); ++fn) {
     auto& file = inputStreams[fn];
     auto& file2 = inputStreams2[fn];
-
-    std::unique_ptr<ReadChunk<T>> local;
-    while (!seqContainerQueue_.try_dequeue(*cCont, local)) {
-      fastx_parser::thread_utils::backoffOrYield(curMaxDelay);
-      // Think of a way to do this that wouldn't be loud (or would allow a
-      // user-definable logging mechanism) std::cerr << "couldn't dequeue read
-      // chunk\n";
+    ChunkFiller<T> filler(cCont, pRead, seqContainerQueue_, readQueue_,
+                          settings);
+
+    // (an empty #2 file means the #2 mates are interleaved with the #1s)
+    if (file2.empty()) {
+      int res = parseInterleavedPairs(file, settings, filler);
+      if (res < -1) {
+        --numParsing;
+        return res;
+      }
+      filler.finish();
+      continue;
     }
-    size_t numObtained{local->size()};
-    // open the file and init the parser
-    auto fp = gzopen(file.c_str(), "r");
-    auto fp2 = gzopen(file2.c_str(), "r");
-
-    // The number of reads we have in the local vector
-    size_t numWaiting{0};
-
-    seq = kseq_init(fp);
-    seq2 = kseq_init(fp2);
-
-    int ksv = kseq_read(seq);
-    int ksv2 = kseq_read(seq2);
-    while (ksv >= 0 and ksv2 >= 0) {
-
-      s = &((*local)[numWaiting++]);
-      copyRecord(seq, &s->first);
-      copyRecord(seq2, &s->second);
-
-      // If we've filled the local vector, then dump to the concurrent queue
-      if (numWaiting == numObtained) {
-        curMaxDelay = MIN_BACKOFF_ITERS;
-        while (!readQueue_.try_enqueue(std::move(local))) {
-          fastx_parser::thread_utils::backoffOrYield(curMaxDelay);
-        }
-        numWaiting = 0;
-        numObtained = 0;
-        // And get more empty reads
-        curMaxDelay = MIN_BACKOFF_ITERS;
-        while (!seqContainerQueue_.try_dequeue(*cCont, local)) {
-          fastx_parser::thread_utils::backoffOrYield(curMaxDelay);
+
+    // If both mates are uncompressed FASTQ, read them straight from their
+    // mappings for as long as both are in the plain 4-line form.
+    bool useKseq{true};
+    uint64_t offset{0};
+    uint64_t offset2{0};
+    {
+      MappedFastqReader mapped(file);
+      MappedFastqReader mapped2(file2);
+      if (mapped.good() and mapped2.good()) {
+        MappedRecord rec, rec2;
+        int mv{0}, mv2{0};
+        while (true) {
+          offset = mapped.offset();
+          offset2 = mapped2.offset();
+          mv = mapped.next(rec);
+          mv2 = mapped2.next(rec2);
+          if (mv <= 0 or mv2 <= 0) {
+            break;
+          }
+          if (skipRecord(settings, rec.name, rec.nameLen)) {
+            continue;
+          }
+          s = filler.next();
+          if (filler.startedChunk()) {
+            filler.chunk().hold(mapped.mapping());
+            filler.chunk().hold(mapped2.mapping());
+          }
+          copyRecord(rec, &s->first);
+          copyRecord(rec2, &s->second);
+          filler.filled(rec.seqLen + rec.nameLen + rec2.seqLen + rec2.nameLen);
         }
-        numObtained = local->size();
+        // As with kseq, reads past the end of the shorter file are ignored
+        useKseq = (mv < 0 or mv2 < 0) and (mv != 0 and mv2 != 0);
       }
-      ksv = kseq_read(seq);
-      ksv2 = kseq_read(seq2);
     }
 
-    if (ksv == -3 or ksv2 == -3) {
-      --numParsing;
-      return -3;
-    } else if (ksv < -1 or ksv2 < -1) {
-      --numParsing;
-      return std::min(ksv, ksv2);
-    }
+    if (useKseq) {
+      // open the files and init the parsers
+      std::shared_ptr<InflateReader> fp(
+          new InflateReader(file, settings.numInflaters, offset));
+      std::shared_ptr<InflateReader> fp2(
+          new InflateReader(file2, settings.numInflaters, offset2));
+      settings.helpers.add(fp);
+      settings.helpers.add(fp2);
+
+      seq = kseq_init(fp.get());
+      seq2 = kseq_init(fp2.get());
+
+      int ksv = kseq_read(seq);
+      int ksv2 = kseq_read(seq2);
+      while (ksv >= 0 and ksv2 >= 0) {
+        if (skipRecord(settings, seq->name.s, seq->name.l)) {
+          ksv = kseq_read(seq);
+          ksv2 = kseq_read(seq2);
+          continue;
+        }
+        s = filler.next();
+        copyRecord(seq, &s->first, filler.chunk().buffer());
+        copyRecord(seq2, &s->second, filler.chunk().buffer());
+        filler.filled(seq->seq.l + seq->name.l + seq2->seq.l + seq2->name.l);
+        ksv = kseq_read(seq);
+        ksv2 = kseq_read(seq2);
+      }
 
-    // If we hit the end of the file and have any reads in our local buffer
-    // then dump them here.
-    if (numWaiting > 0) {
-      local->have(numWaiting);
-      curMaxDelay = MIN_BACKOFF_ITERS;
-      while (!readQueue_.try_enqueue(*pRead, std::move(local))) {
-        fastx_parser::thread_utils::backoffOrYield(curMaxDelay);
+      // destroy the parsers and close the files
+      kseq_destroy(seq);
+      settings.helpers.remove(fp.get());
+      fp.reset();
+      kseq_destroy(seq2);
+      settings.helpers.remove(fp2.get());
+      fp2.reset();
+
+      if (ksv == -3 or ksv2 == -3) {
+        --numParsing;
+        return -3;
+      } else if (ksv < -1 or ksv2 < -1) {
+        --numParsing;
+        return std::min(ksv, ksv2);
       }
-      numWaiting = 0;
     }
-    // destroy the parser and close the file
-    kseq_destroy(seq);
-    gzclose(fp);
-    kseq_destroy(seq2);
-    gzclose(fp2);
+
+    filler.finish();
   }
 
   --numParsing;
   return 0;
 }
 
-template <> bool FastxParser<ReadSeq>::start() {
-  if (numParsing_ == 0) {
-    isActive_ = true;
-    threadResults_.resize(numParsers_);
-    std::fill(threadResults_.begin(), threadResults_.end(), 0);
-    for (size_t i = 0; i < numParsers_; ++i) {
-      ++numParsing_;
-      parsingThreads_.emplace_back(new std::thread([this, i]() {
-        this->threadResults_[i] = parseReads(
-            this->inputStreams_, this->numParsing_,
-            this->consumeContainers_[i].get(), this->produceReads_[i].get(),
-            this->workQueue_, this->seqContainerQueue_, this->readQueue_);
-      }));
-    }
-    return true;
-  } else {
-    return false;
-  }
+// Parse the single-end (false_type) or paired-end (true_type) input
+template <typename T>
+int parseStreams(
+    std::false_type, std::vector<std::string>& inputStreams,
+    std::vector<std::string>& /*inputStreams2*/, const ParseSettings& settings,
+    std::atomic<uint32_t>& numParsing, moodycamel::ConsumerToken* cCont,
+    moodycamel::ProducerToken* pRead,
+    moodycamel::ConcurrentQueue<uint32_t>& workQueue,
+    moodycamel::ConcurrentQueue<std::unique_ptr<ReadChunk<T>>>&
+        seqContainerQueue_,
+    moodycamel::ConcurrentQueue<std::unique_ptr<ReadChunk<T>>>& readQueue_) {
+  return parseReads(inputStreams, settings, numParsing, cCont, pRead,
+                    workQueue, seqContainerQueue_, readQueue_);
 }
 
-template <> bool FastxParser<ReadPair>::start() {
+template <typename T>
+int parseStreams(
+    std::true_type, std::vector<std::string>& inputStreams,
+    std::vector<std::string>& inputStreams2, const ParseSettings& settings,
+    std::atomic<uint32_t>& numParsing, moodycamel::ConsumerToken* cCont,
+    moodycamel::ProducerToken* pRead,
+    moodycamel::ConcurrentQueue<uint32_t>& workQueue,
+    moodycamel::ConcurrentQueue<std::unique_ptr<ReadChunk<T>>>&
+        seqContainerQueue_,
+    moodycamel::ConcurrentQueue<std::unique_ptr<ReadChunk<T>>>& readQueue_) {
+  return parseReadPair(inputStreams, inputStreams2, settings, numParsing,
+                       cCont, pRead, workQueue, seqContainerQueue_,
+                       readQueue_);
+}
+
+template <typename T> bool FastxParser<T>::start() {
   if (numParsing_ == 0) {
     isActive_ = true;
-    // Some basic checking to ensure the read files look "sane".
-    if (inputStreams_.size() != inputStreams2_.size()) {
-      throw std::invalid_argument("There should be the same number "
-                                  "of files for the left and right reads");
-    }
-    for (size_t i = 0; i < inputStreams_.size(); ++i) {
-      auto& s1 = inputStreams_[i];
-      auto& s2 = inputStreams2_[i];
-      if (s1 == s2) {
-        throw std::invalid_argument("You provided the same file " + s1 +
-                                    " as both a left and right file");
+    if (IsPaired<T>::value) {
+      // Some basic checking to ensure the read files look "sane".
+      if (inputStreams_.size() != inputStreams2_.size()) {
+        throw std::invalid_argument("There should be the same number "
+                                    "of files for the left and right reads");
+      }
+      for (size_t i = 0; i < inputStreams_.size(); ++i) {
+        auto& s1 = inputStreams_[i];
+        auto& s2 = inputStreams2_[i];
+        if (!s2.empty() and s1 == s2) {
+          throw std::invalid_argument("You provided the same file " + s1 +
+                                      " as both a left and right file");
+        }
       }
     }
 
@@ -363,8 +690,13 @@ template <> bool FastxParser<ReadPair>::start() {
     for (size_t i = 0; i < numParsers_; ++i) {
       ++numParsing_;
       parsingThreads_.emplace_back(new std::thread([this, i]() {
-        this->threadResults_[i] = parseReadPair(
-            this->inputStreams_, this->inputStreams2_, this->numParsing_,
+        ParseSettings settings{this->numInflaters_,   this->maxChunkBytes_,
+                               this->parserWaitNs_,   this->toSkip_,
+                               this->inflateHelpers_, this->keepBelow_,
+                               this->sampleSeed_,     this->numSubsampledOut_};
+        this->threadResults_[i] = parseStreams(
+            IsPaired<T>(), this->inputStreams_, this->inputStreams2_,
+            settings, this->numParsing_,
             this->consumeContainers_[i].get(), this->produceReads_[i].get(),
             this->workQueue_, this->seqContainerQueue_, this->readQueue_);
       }));
@@ -375,16 +707,60 @@ template <> bool FastxParser<ReadPair>::start() {
   }
 }
 
+template <typename T>
+void FastxParser<T>::subsample(double fraction, uint64_t seed) {
+  // (ldexp(fraction, 64) is the fraction of the 2^64 hash values)
+  keepBelow_ = (fraction >= 1.0)
+                   ? std::numeric_limits<uint64_t>::max()
+                   : static_cast<uint64_t>(
+                         std::ldexp(std::max(fraction, 0.0), 64));
+  sampleSeed_ = seed;
+}
+
 template <typename T> bool FastxParser<T>::refill(ReadGroup<T>& seqs) {
   finishedWithGroup(seqs);
+  ++numRefills_;
+  readyChunkSum_ += readQueue_.size_approx();
+  if (readQueue_.try_dequeue(seqs.consumerToken(), seqs.chunkPtr())) {
+    ++numChunks_;
+    return true;
+  }
+  // Nothing is ready; wait (and count the time spent waiting), inflating
+  // the input in the meantime if that's what the parsers are waiting on
+  auto start = std::chrono::steady_clock::now();
+  bool got{false};
   auto curMaxDelay = fastx_parser::thread_utils::MIN_BACKOFF_ITERS;
   while (numParsing_ > 0) {
     if (readQueue_.try_dequeue(seqs.consumerToken(), seqs.chunkPtr())) {
-      return true;
+      got = true;
+      break;
+    }
+    if (inflateHelpers_.help()) {
+      curMaxDelay = fastx_parser::thread_utils::MIN_BACKOFF_ITERS;
+      continue;
     }
     fastx_parser::thread_utils::backoffOrYield(curMaxDelay);
   }
-  return readQueue_.try_dequeue(seqs.consumerToken(), seqs.chunkPtr());
+  if (!got) {
+    got = readQueue_.try_dequeue(seqs.consumerToken(), seqs.chunkPtr());
+  }
+  consumerWaitNs_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+  numChunks_ += got;
+  return got;
+}
+
+template <typename T> ParserStats FastxParser<T>::stats() const {
+  ParserStats st;
+  uint64_t numRefills = numRefills_;
+  st.numChunks = numChunks_;
+  st.meanReadyChunks =
+      (numRefills > 0) ? static_cast<double>(readyChunkSum_) / numRefills : 0.0;
+  st.consumerWaitSeconds = consumerWaitNs_ * 1e-9;
+  st.parserWaitSeconds = parserWaitNs_ * 1e-9;
+  st.numHelpedBatches = inflateHelpers_.numHelped();
+  return st;
 }
 
 template <typename T> void FastxParser<T>::finishedWithGroup(ReadGroup<T>& s) {
@@ -397,4 +773,6 @@ template <typename T> void FastxParser<T>::finishedWithGroup(ReadGroup<T>& s) {
 
 template class FastxParser<ReadSeq>;
 template class FastxParser<ReadPair>;
+template class FastxParser<ReadSpanSeq>;
+template class FastxParser<ReadSpanPair>;
 } // namespace fastx_parser
@@ -0,0 +1,138 @@
+#include "FastxReadTee.hpp"
+
+#include <algorithm>
+#include <cerrno>
+
+#include <unistd.h>
+
+#include "FastxInflateReader.hpp"
+
+namespace fastx_parser {
+
+namespace {
+constexpr uint64_t dropped = ~uint64_t(0);
+
+// Write all len bytes of data to fd; false if the reader has gone away
+bool writeAll(int fd, const char* data, size_t len) {
+  while (len > 0) {
+    ssize_t w = ::write(fd, data, len);
+    if (w < 0 and errno == EINTR) {
+      continue;
+    }
+    if (w <= 0) {
+      return false;
+    }
+    data += w;
+    len -= static_cast<size_t>(w);
+  }
+  return true;
+}
+} // namespace
+
+constexpr size_t ReadTee::blockSize;
+constexpr size_t ReadTee::defaultMaxLagBytes;
+
+ReadTee::ReadTee(const std::string& path, std::vector<int> fds,
+                 size_t maxLagBytes)
+    : path_(path), fds_(std::move(fds)),
+      maxBlocks_(std::max(maxLagBytes / blockSize, size_t(1))),
+      next_(fds_.size(), 0) {
+  reader_ = std::thread([this]() -> void { read_(); });
+  for (size_t i = 0; i < fds_.size(); ++i) {
+    writers_.emplace_back([this, i]() -> void { write_(i); });
+  }
+}
+
+ReadTee::~ReadTee() { finish(); }
+
+bool ReadTee::finish() {
+  if (!finished_) {
+    reader_.join();
+    for (auto& w : writers_) {
+      w.join();
+    }
+    finished_ = true;
+  }
+  std::lock_guard<std::mutex> l(mut_);
+  return ok_;
+}
+
+size_t ReadTee::numDropped() const {
+  std::lock_guard<std::mutex> l(mut_);
+  return numDropped_;
+}
+
+void ReadTee::read_() {
+  InflateReader in(path_, 2);
+  bool ok = in.good();
+  while (ok) {
+    std::shared_ptr<std::vector<char>> block(new std::vector<char>(blockSize));
+    size_t have{0};
+    while (have < blockSize) {
+      int r = in.read(block->data() + have,
+                      static_cast<unsigned>(blockSize - have));
+      if (r <= 0) {
+        ok = (r == 0);
+        break;
+      }
+      have += static_cast<size_t>(r);
+    }
+    bool last = (have < blockSize);
+    block->resize(have);
+    std::unique_lock<std::mutex> l(mut_);
+    cv_.wait(l, [this]() -> bool { return blocks_.size() < maxBlocks_; });
+    if (have > 0) {
+      blocks_.push_back(block);
+    }
+    cv_.notify_all();
+    if (last) {
+      break;
+    }
+  }
+  std::lock_guard<std::mutex> l(mut_);
+  ok_ = ok;
+  atEnd_ = true;
+  cv_.notify_all();
+}
+
+void ReadTee::write_(size_t reader) {
+  int fd = fds_[reader];
+  while (true) {
+    Block block;
+    {
+      std::unique_lock<std::mutex> l(mut_);
+      uint64_t b = next_[reader];
+      cv_.wait(l, [this, b]() -> bool {
+        return atEnd_ or b < firstBlock_ + blocks_.size();
+      });
+      if (b >= firstBlock_ + blocks_.size()) {
+        break;
+      }
+      block = blocks_[b - firstBlock_];
+    }
+    bool written = writeAll(fd, block->data(), block->size());
+    std::lock_guard<std::mutex> l(mut_);
+    if (!written) {
+      next_[reader] = dropped;
+      ++numDropped_;
+    } else {
+      ++next_[reader];
+    }
+    trim_();
+    cv_.notify_all();
+    if (!written) {
+      break;
+    }
+  }
+  ::close(fd);
+}
+
+void ReadTee::trim_() {
+  uint64_t slowest = *std::min_element(next_.begin(), next_.end());
+  while (!blocks_.empty() and firstBlock_ < slowest) {
+    blocks_.pop_front();
+    ++firstBlock_;
+  }
+}
+
+} // namespace fastx_parser
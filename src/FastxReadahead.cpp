@@ -0,0 +1,326 @@
+#include "FastxReadahead.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+namespace fastx_parser {
+
+namespace {
+bool startsWith(const std::string& s, const char* prefix) {
+  return s.compare(0, std::strlen(prefix), prefix) == 0;
+}
+
+// The http(s) URL of a remote path
+std::string httpURL(const std::string& path) {
+  if (!startsWith(path, "s3://")) {
+    return path;
+  }
+  std::string rest = path.substr(5);
+  if (const char* endpoint = std::getenv("SALMON_S3_ENDPOINT")) {
+    std::string url(endpoint);
+    if (!url.empty() and url.back() == '/') {
+      url.pop_back();
+    }
+    return url + "/" + rest;
+  }
+  auto slash = rest.find('/');
+  if (slash == std::string::npos) {
+    return "https://" + rest + ".s3.amazonaws.com/";
+  }
+  return "https://" + rest.substr(0, slash) + ".s3.amazonaws.com" +
+         rest.substr(slash);
+}
+
+/**
+ * Run curl with args, and append what it writes to out; false if it can't
+ * be run or fails.  curl is spawned directly (not through a shell), so the
+ * URL is never interpreted.
+ */
+bool runCurl(const std::vector<std::string>& args,
+             std::vector<unsigned char>& out) {
+  int fds[2];
+  // (close-on-exec, so that the curls of the other fetchers don't hold
+  // this pipe open; pipe2 would set it at once, but is Linux-only)
+  if (::pipe(fds) != 0) {
+    return false;
+  }
+  for (int fd : fds) {
+    if (::fcntl(fd, F_SETFD, FD_CLOEXEC) != 0) {
+      ::close(fds[0]);
+      ::close(fds[1]);
+      return false;
+    }
+  }
+  std::vector<char*> argv;
+  std::string curl("curl");
+  argv.push_back(&curl[0]);
+  std::vector<std::string> argStore(args);
+  for (auto& a : argStore) {
+    argv.push_back(&a[0]);
+  }
+  argv.push_back(nullptr);
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+  posix_spawn_file_actions_adddup2(&actions, fds[1], 1);
+  pid_t pid{0};
+  int rc = ::posix_spawnp(&pid, "curl", &actions, nullptr, argv.data(),
+                          environ);
+  posix_spawn_file_actions_destroy(&actions);
+  ::close(fds[1]);
+  if (rc != 0) {
+    ::close(fds[0]);
+    return false;
+  }
+  unsigned char buf[1 << 16];
+  while (true) {
+    ssize_t r = ::read(fds[0], buf, sizeof(buf));
+    if (r < 0 and errno == EINTR) {
+      continue;
+    }
+    if (r <= 0) {
+      break;
+    }
+    out.insert(out.end(), buf, buf + r);
+  }
+  ::close(fds[0]);
+  int status{0};
+  while (::waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) {
+      return false;
+    }
+  }
+  return WIFEXITED(status) and WEXITSTATUS(status) == 0;
+}
+
+/**
+ * The size of the remote object at url, from the Content-Range of a GET of
+ * its first byte (rather than a HEAD, which a presigned URL doesn't allow).
+ */
+bool remoteSize(const std::string& url, uint64_t& size) {
+  std::vector<unsigned char> headers;
+  if (!runCurl({"-sfL", "--retry", "3", "-r", "0-0", "-D", "-", "-o",
+                "/dev/null", url},
+               headers)) {
+    return false;
+  }
+  // (the last Content-Range, after any redirects)
+  std::string h(headers.begin(), headers.end());
+  std::transform(h.begin(), h.end(), h.begin(), ::tolower);
+  auto at = h.rfind("content-range:");
+  if (at == std::string::npos) {
+    return false;
+  }
+  auto slash = h.find('/', at);
+  auto eol = h.find('\n', at);
+  if (slash == std::string::npos or slash > eol) {
+    return false;
+  }
+  size = std::strtoull(h.c_str() + slash + 1, nullptr, 10);
+  return true;
+}
+} // namespace
+
+bool isRemotePath(const std::string& path) {
+  return startsWith(path, "http://") or startsWith(path, "https://") or
+         startsWith(path, "s3://");
+}
+
+constexpr size_t ReadaheadFile::remoteChunkSize;
+
+ReadaheadFile::ReadaheadFile(const std::string& path, uint64_t offset,
+                             size_t chunkSize, uint32_t numFetchers,
+                             size_t maxInFlight)
+    : offset_(offset), chunkSize_(std::max(chunkSize, size_t(1))),
+      maxInFlight_(std::max(maxInFlight, size_t(1))) {
+  if (isRemotePath(path)) {
+    url_ = httpURL(path);
+    if (!remoteSize(url_, remoteSize_)) {
+      return;
+    }
+    chunkSize_ = std::max(chunkSize_, remoteChunkSize);
+    uint64_t rest = (remoteSize_ > offset_) ? remoteSize_ - offset_ : 0;
+    numChunks_ = (rest + chunkSize_ - 1) / chunkSize_;
+  } else {
+    fd_ = ::open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+      return;
+    }
+  }
+  good_ = true;
+  struct stat st;
+  isStream_ = url_.empty() and
+              (::fstat(fd_, &st) != 0 or !S_ISREG(st.st_mode));
+  if (isStream_) {
+    numFetchers = 1;
+  } else if (fd_ >= 0) {
+#if defined(POSIX_FADV_SEQUENTIAL)
+    ::posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+  }
+  numFetchers = std::max(std::min(numFetchers, uint32_t(maxInFlight_)),
+                         uint32_t(1));
+  for (uint32_t i = 0; i < numFetchers; ++i) {
+    fetchers_.emplace_back([this]() -> void { fetch_(); });
+  }
+}
+
+ReadaheadFile::~ReadaheadFile() {
+  {
+    std::lock_guard<std::mutex> l(mut_);
+    stopping_ = true;
+  }
+  roomCV_.notify_all();
+  for (auto& t : fetchers_) {
+    t.join();
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+void ReadaheadFile::readChunk_(uint64_t seq, Chunk& chunk) {
+  if (!url_.empty()) {
+    uint64_t begin = offset_ + seq * chunkSize_;
+    uint64_t end = std::min(begin + chunkSize_, remoteSize_);
+    chunk.data.reserve(end - begin);
+    chunk.ok = runCurl({"-sfL", "--retry", "3", "-r",
+                        std::to_string(begin) + "-" + std::to_string(end - 1),
+                        url_},
+                       chunk.data) and
+               chunk.data.size() == end - begin;
+    return;
+  }
+  chunk.data.resize(chunkSize_);
+  size_t have{0};
+  if (isStream_ and seq == 0) {
+    // A stream can't seek, so the bytes before the offset are read and
+    // dropped
+    uint64_t skipped{0};
+    while (skipped < offset_) {
+      size_t n = static_cast<size_t>(
+          std::min(offset_ - skipped, static_cast<uint64_t>(chunkSize_)));
+      ssize_t r = ::read(fd_, chunk.data.data(), n);
+      if (r < 0 and errno == EINTR) {
+        continue;
+      }
+      if (r <= 0) {
+        chunk.ok = (r == 0);
+        chunk.data.clear();
+        return;
+      }
+      skipped += static_cast<uint64_t>(r);
+    }
+  }
+  uint64_t pos = offset_ + seq * chunkSize_;
+  while (have < chunkSize_) {
+    ssize_t r = isStream_
+                    ? ::read(fd_, chunk.data.data() + have, chunkSize_ - have)
+                    : ::pread(fd_, chunk.data.data() + have, chunkSize_ - have,
+                              static_cast<off_t>(pos + have));
+    if (r < 0 and errno == EINTR) {
+      continue;
+    }
+    if (r < 0) {
+      chunk.ok = false;
+      break;
+    }
+    if (r == 0) {
+      break;
+    }
+    have += static_cast<size_t>(r);
+  }
+  chunk.data.resize(have);
+}
+
+void ReadaheadFile::fetch_() {
+  while (true) {
+    uint64_t seq{0};
+    {
+      std::unique_lock<std::mutex> l(mut_);
+      roomCV_.wait(l, [this]() -> bool {
+        return stopping_ or nextFetch_ >= numChunks_ or
+               nextFetch_ < nextSeq_ + maxInFlight_;
+      });
+      if (stopping_ or nextFetch_ >= numChunks_) {
+        break;
+      }
+      seq = nextFetch_++;
+    }
+    std::unique_ptr<Chunk> chunk(new Chunk);
+    readChunk_(seq, *chunk);
+    {
+      std::lock_guard<std::mutex> l(mut_);
+      // A short (or failed) chunk is the last one
+      if (!chunk->ok or chunk->data.size() < chunkSize_) {
+        numChunks_ = std::min(numChunks_, seq + 1);
+      }
+      ready_[seq] = std::move(chunk);
+    }
+    readyCV_.notify_all();
+    // (the other fetchers may be waiting for room, and can stop now)
+    roomCV_.notify_all();
+  }
+}
+
+bool ReadaheadFile::next(const unsigned char*& data, size_t& len) {
+  cur_.reset();
+  curPos_ = 0;
+  if (!good_ or failed_) {
+    failed_ = true;
+    return false;
+  }
+  {
+    std::unique_lock<std::mutex> l(mut_);
+    readyCV_.wait(l, [this]() -> bool {
+      return ready_.count(nextSeq_) > 0 or nextSeq_ >= numChunks_;
+    });
+    auto it = ready_.find(nextSeq_);
+    if (it == ready_.end()) {
+      return false;
+    }
+    cur_ = std::move(it->second);
+    ready_.erase(it);
+    ++nextSeq_;
+  }
+  roomCV_.notify_all();
+  if (!cur_->ok) {
+    failed_ = true;
+    return false;
+  }
+  data = cur_->data.data();
+  len = cur_->data.size();
+  return len > 0;
+}
+
+size_t ReadaheadFile::read(void* buf, size_t len) {
+  unsigned char* dest = static_cast<unsigned char*>(buf);
+  size_t copied{0};
+  while (copied < len) {
+    if (!cur_ or curPos_ == cur_->data.size()) {
+      const unsigned char* data{nullptr};
+      size_t n{0};
+      if (!next(data, n)) {
+        break;
+      }
+      continue;
+    }
+    size_t n = std::min(len - copied, cur_->data.size() - curPos_);
+    std::memcpy(dest + copied, cur_->data.data() + curPos_, n);
+    copied += n;
+    curPos_ += n;
+  }
+  return copied;
+}
+} // namespace fastx_parser
@@ -15,6 +15,7 @@
 #include <cassert>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <numeric>
 
 using namespace std;
@@ -77,8 +78,21 @@ size_t FragmentLengthDistribution::minVal() const {
   return min_;
 }
 
+/**
+ * Atomically add the (logged) mass to the (logged) value val.
+ */
+static inline void atomicLogAdd(tbb::atomic<double>& val, double mass) {
+  double oldVal = val;
+  double retVal = oldVal;
+  double newVal = 0.0;
+  do {
+    oldVal = retVal;
+    newVal = salmon::math::logAdd(oldVal, mass);
+    retVal = val.compare_and_swap(newVal, oldVal);
+  } while (retVal != oldVal);
+}
+
 void FragmentLengthDistribution::addVal(size_t len, double mass) {
-  using salmon::math::logAdd;
   // assert(!isnan(mass));
   // assert(kernel_.size());
 
@@ -96,33 +110,76 @@ void FragmentLengthDistribution::addVal(size_t len, double mass) {
   for (size_t i = 0; i < kernel_.size(); i++) {
     if (offset > 0 && offset < hist_.size()) {
       double kMass = mass + kernel_[i];
-      double oldVal = hist_[offset];
-      double retVal = oldVal;
-      double newVal = 0.0;
-      do {
-        oldVal = retVal;
-        newVal = logAdd(oldVal, kMass);
-        retVal = hist_[offset].compare_and_swap(newVal, oldVal);
-      } while (retVal != oldVal);
-
-      retVal = sum_;
-      do {
-        oldVal = retVal;
-        newVal = logAdd(oldVal, log(static_cast<double>(offset)) + kMass);
-        retVal = sum_.compare_and_swap(newVal, oldVal);
-      } while (retVal != oldVal);
-
-      retVal = totMass_;
-      do {
-        oldVal = retVal;
-        newVal = logAdd(oldVal, kMass);
-        retVal = totMass_.compare_and_swap(newVal, oldVal);
-      } while (retVal != oldVal);
+      atomicLogAdd(hist_[offset], kMass);
+      atomicLogAdd(sum_, log(static_cast<double>(offset)) + kMass);
+      atomicLogAdd(totMass_, kMass);
     }
     offset++;
   }
 }
 
+FragmentLengthDistribution::LocalObservations::LocalObservations()
+    : totMass_(salmon::math::LOG_0), sum_(salmon::math::LOG_0),
+      min_(std::numeric_limits<size_t>::max()) {}
+
+void FragmentLengthDistribution::addVal(size_t len, double mass,
+                                        LocalObservations& local) const {
+  using salmon::math::logAdd;
+  using salmon::math::LOG_0;
+
+  if (local.hist_.size() != hist_.size()) {
+    local.hist_.assign(hist_.size(), LOG_0);
+    local.touched_.clear();
+  }
+
+  len /= binSize_;
+
+  if (len > maxVal()) {
+    len = maxVal();
+  }
+  if (len < local.min_) {
+    local.min_ = len;
+  }
+
+  size_t offset = len - kernel_.size() / 2;
+
+  for (size_t i = 0; i < kernel_.size(); i++) {
+    if (offset > 0 && offset < hist_.size()) {
+      double kMass = mass + kernel_[i];
+      double& h = local.hist_[offset];
+      if (h == LOG_0) {
+        local.touched_.push_back(offset);
+        h = kMass;
+      } else {
+        h = logAdd(h, kMass);
+      }
+      local.sum_ = logAdd(local.sum_, log(static_cast<double>(offset)) + kMass);
+      local.totMass_ = logAdd(local.totMass_, kMass);
+    }
+    offset++;
+  }
+}
+
+void FragmentLengthDistribution::addVals(LocalObservations& local) {
+  using salmon::math::LOG_0;
+
+  if (local.min_ < min_) {
+    min_ = local.min_;
+  }
+  for (auto offset : local.touched_) {
+    atomicLogAdd(hist_[offset], local.hist_[offset]);
+    local.hist_[offset] = LOG_0;
+  }
+  if (!local.touched_.empty()) {
+    atomicLogAdd(sum_, local.sum_);
+    atomicLogAdd(totMass_, local.totMass_);
+  }
+  local.touched_.clear();
+  local.totMass_ = LOG_0;
+  local.sum_ = LOG_0;
+  local.min_ = std::numeric_limits<size_t>::max();
+}
+
 /**
  * Returns the *LOG* probability of observing a fragment of length *len*.
  */
@@ -153,6 +210,27 @@ void FragmentLengthDistribution::dumpPMF(std::vector<double>& pmfOut,
   }
 }
 
+void FragmentLengthDistribution::dumpState(std::vector<double>& logHist,
+                                           double& logTotMass, double& logSum,
+                                           size_t& minV) const {
+  logHist.assign(hist_.begin(), hist_.end());
+  logTotMass = totMass_;
+  logSum = sum_;
+  minV = min_;
+}
+
+void FragmentLengthDistribution::loadState(const std::vector<double>& logHist,
+                                           double logTotMass, double logSum,
+                                           size_t minV) {
+  for (size_t i = 0; i < hist_.size() and i < logHist.size(); ++i) {
+    hist_[i] = logHist[i];
+  }
+  totMass_ = logTotMass;
+  sum_ = logSum;
+  min_ = minV;
+  haveCachedCMF_ = false;
+}
+
 double FragmentLengthDistribution::cmf(size_t len) const {
   if (haveCachedCMF_) {
     return (len < cachedCMF_.size()) ? cachedCMF_[len] : cachedCMF_.back();
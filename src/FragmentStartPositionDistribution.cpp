@@ -88,6 +88,62 @@ void FragmentStartPositionDistribution::addVal(int32_t hitPos, uint32_t txpLen,
   --performingUpdate_;
 }
 
+FragmentStartPositionDistribution::LocalObservations::LocalObservations()
+    : totMass_(salmon::math::LOG_0) {}
+
+void FragmentStartPositionDistribution::addVal(int32_t hitPos, uint32_t txpLen,
+                                               double mass,
+                                               LocalObservations& local) const {
+  using salmon::math::logAdd;
+  if (hitPos >= static_cast<int32_t>(txpLen)) {
+    return; // hit should happen within the transcript
+  }
+  if (local.pmf_.size() != pmf_.size()) {
+    local.pmf_.assign(pmf_.size(), salmon::math::LOG_0);
+  }
+
+  if (hitPos < 0) {
+    hitPos = 0;
+  }
+  double logLen = log(txpLen);
+
+  // The same binning as addVal(hitPos, txpLen, mass) above
+  uint32_t i;
+  double a = hitPos * 1.0 / txpLen;
+  double b;
+
+  for (i = ((long long)hitPos) * numBins_ / txpLen + 1;
+       i < (((long long)hitPos + 1) * numBins_ - 1) / txpLen + 1; i++) {
+    b = i * 1.0 / numBins_;
+    double updateMass = log(b - a) + logLen + mass;
+    local.pmf_[i] = logAdd(local.pmf_[i], updateMass);
+    local.totMass_ = logAdd(local.totMass_, updateMass);
+    a = b;
+  }
+  b = (hitPos + 1.0) / txpLen;
+  double updateMass = log(b - a) + logLen + mass;
+  local.pmf_[i] = logAdd(local.pmf_[i], updateMass);
+  local.totMass_ = logAdd(local.totMass_, updateMass);
+}
+
+void FragmentStartPositionDistribution::addVals(LocalObservations& local) {
+  if (salmon::math::isLog0(local.totMass_)) {
+    return;
+  }
+  ++performingUpdate_;
+  if (allowUpdates_) {
+    for (size_t i = 0; i < local.pmf_.size(); ++i) {
+      if (!salmon::math::isLog0(local.pmf_[i])) {
+        logAddMass(pmf_[i], local.pmf_[i]);
+      }
+    }
+    logAddMass(totMass_, local.totMass_);
+  }
+  --performingUpdate_;
+  std::fill(local.pmf_.begin(), local.pmf_.end(), salmon::math::LOG_0);
+  local.totMass_ = salmon::math::LOG_0;
+}
+
 double FragmentStartPositionDistribution::evalCDF(int32_t hitPos,
                                                   uint32_t txpLen) {
   int i = static_cast<int>((static_cast<double>(hitPos) * numBins_) / txpLen);
@@ -103,7 +159,7 @@ void FragmentStartPositionDistribution::update() {
   }
   // TODO: Is this (thread)-safe yet?
   allowUpdates_ = false;
-  std::lock_guard<std::mutex> lg(fspdMut_);
+  std::lock_guard<spin_lock> lg(fspdMut_);
   // Make sure an update isn't being performed
   while (performingUpdate_) {
   }
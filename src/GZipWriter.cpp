@@ -1,11 +1,17 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <ctime>
 #include <fstream>
 
 #include "cereal/archives/json.hpp"
 
 #include "AlignmentLibrary.hpp"
+#include "CPUDispatch.hpp"
 #include "DistributionUtils.hpp"
+#include "EquivClassFile.hpp"
 #include "GZipWriter.hpp"
+#include "PartialExperiment.hpp"
 #include "ReadExperiment.hpp"
 #include "ReadPair.hpp"
 #include "SalmonOpts.hpp"
@@ -19,6 +25,9 @@ GZipWriter::~GZipWriter() {
   if (bsStream_) {
     bsStream_->reset();
   }
+  if (bsColumns_) {
+    finishSamples();
+  }
 }
 
 /**
@@ -60,41 +69,50 @@ bool GZipWriter::writeEquivCounts(const SalmonOpts& opts, ExpT& experiment) {
 
   bfs::path auxDir = path_ / opts.auxDir;
   bool auxSuccess = boost::filesystem::create_directories(auxDir);
-  bfs::path eqFilePath = auxDir / "eq_classes.txt";
-
-  std::ofstream equivFile(eqFilePath.string());
 
   auto& transcripts = experiment.transcripts();
-  std::vector<std::pair<const TranscriptGroup, TGValue>>& eqVec =
-      experiment.equivalenceClassBuilder().eqVec();
+  // The classes as the optimizer left them (compacted, see
+  // FlatEquivalenceClasses::compact()), with their combined weights
+  const FlatEquivalenceClasses& flatEqClasses =
+      experiment.equivalenceClassBuilder().flatEqClasses();
   bool dumpRichWeights = opts.dumpEqWeights;
 
+  if (opts.eqClassFormat == "binary") {
+    std::vector<std::string> names;
+    names.reserve(transcripts.size());
+    for (auto& t : transcripts) {
+      names.push_back(t.RefName);
+    }
+    return salmon::eqclasses::writeBinary(auxDir / "eq_classes.bin", names,
+                                          flatEqClasses, dumpRichWeights);
+  }
+
+  bfs::path eqFilePath = auxDir / "eq_classes.txt";
+  std::ofstream equivFile(eqFilePath.string());
+
   // Number of transcripts
   equivFile << transcripts.size() << '\n';
 
   // Number of equivalence classes
-  equivFile << eqVec.size() << '\n';
+  equivFile << flatEqClasses.numClasses() << '\n';
 
   for (auto& t : transcripts) {
     equivFile << t.RefName << '\n';
   }
 
-  for (auto& eq : eqVec) {
-    uint64_t count = eq.second.count;
-    // for each transcript in this class
-    const TranscriptGroup& tgroup = eq.first;
-    const std::vector<uint32_t>& txps = tgroup.txps;
+  for (size_t eqID = 0; eqID < flatEqClasses.numClasses(); ++eqID) {
+    uint64_t count = flatEqClasses.counts[eqID];
+    auto start = flatEqClasses.offsets[eqID];
+    auto end = flatEqClasses.offsets[eqID + 1];
     // group size
-    uint32_t groupSize = eq.second.weights.size();
-    equivFile << groupSize << '\t';
+    equivFile << (end - start) << '\t';
     // each group member
-    for (uint32_t i = 0; i < groupSize; i++) {
-      equivFile << txps[i] << '\t';
+    for (auto i = start; i < end; ++i) {
+      equivFile << flatEqClasses.txps[i] << '\t';
     }
     if (dumpRichWeights) {
-      const auto& auxs = eq.second.combinedWeights;
-      for (auto aux : auxs) {
-        equivFile << aux << '\t';
+      for (auto i = start; i < end; ++i) {
+        equivFile << flatEqClasses.combinedWeights[i] << '\t';
       }
     }
     // count for this class
@@ -167,6 +185,10 @@ bool GZipWriter::writeEmptyMeta(const SalmonOpts& opts, const ExpT& experiment,
     // with weights.  In which case it contains the string "scalar_weights".
     std::vector<std::string> props;
     oa(cereal::make_nvp("eq_class_properties", props));
+    if (opts.dumpEq) {
+      // "text" : eq_classes.txt, "binary" : eq_classes.bin
+      oa(cereal::make_nvp("eq_class_format", opts.eqClassFormat));
+    }
 
     oa(cereal::make_nvp("length_classes", experiment.getLengthQuantiles()));
     oa(cereal::make_nvp("index_seq_hash", experiment.getIndexSeqHash()));
@@ -176,9 +198,17 @@ bool GZipWriter::writeEmptyMeta(const SalmonOpts& opts, const ExpT& experiment,
     oa(cereal::make_nvp("num_mapped", experiment.numMappedFragments()));
     oa(cereal::make_nvp("percent_mapped",
                         experiment.effectiveMappingRate() * 100.0));
+    // The number of times the per-thread mapping scratch buffers had to
+    // grow; this should be small and independent of the number of reads.
+    oa(cereal::make_nvp("num_scratch_regrowths",
+                        experiment.numScratchRegrowths()));
     oa(cereal::make_nvp("call", std::string("quant")));
     oa(cereal::make_nvp("start_time", opts.runStartTime));
     oa(cereal::make_nvp("end_time", opts.runStopTime));
+    // The instruction set variant that each hot kernel ran
+    oa(cereal::make_nvp("cpu_kernels", salmon::cpu::chosenVariants()));
+    // Where the time (and the memory) of the run went
+    oa(cereal::make_nvp("performance", *opts.perfStats));
   }
   return true;
 }
@@ -445,18 +475,113 @@ bool GZipWriter::writeMeta(const SalmonOpts& opts, const ExpT& experiment) {
       props.push_back("scalar_weights");
     }
     oa(cereal::make_nvp("eq_class_properties", props));
+    if (opts.dumpEq) {
+      // "text" : eq_classes.txt, "binary" : eq_classes.bin
+      oa(cereal::make_nvp("eq_class_format", opts.eqClassFormat));
+    }
 
     oa(cereal::make_nvp("length_classes", experiment.getLengthQuantiles()));
     oa(cereal::make_nvp("index_seq_hash", experiment.getIndexSeqHash()));
     oa(cereal::make_nvp("index_name_hash", experiment.getIndexNameHash()));
     oa(cereal::make_nvp("num_bootstraps", numSamples));
+    if (numSamples > 0) {
+      // "gzip" : bootstraps.gz, "columnar" : bootstraps.col
+      oa(cereal::make_nvp("samp_format", opts.sampleFormat));
+      // "double", "float" or "fixed" (see SampleEncoding.hpp)
+      oa(cereal::make_nvp("samp_precision", opts.samplePrecision));
+      if (opts.samplePrecision == "fixed") {
+        oa(cereal::make_nvp("samp_fixed_scale", opts.sampleFixedScale));
+      }
+      oa(cereal::make_nvp("samp_sparse", useSparseSamples(opts)));
+    }
     oa(cereal::make_nvp("num_processed", experiment.numObservedFragments()));
     oa(cereal::make_nvp("num_mapped", experiment.numMappedFragments()));
     oa(cereal::make_nvp("percent_mapped",
                         experiment.effectiveMappingRate() * 100.0));
+    // The number of times the per-thread mapping scratch buffers had to
+    // grow; this should be small and independent of the number of reads.
+    oa(cereal::make_nvp("num_scratch_regrowths",
+                        experiment.numScratchRegrowths()));
+    // How many quasi-mappings were scored against the transcript sequence
+    // (and how many of those scores came from the cache), if any were.
+    if (opts.maxEditFraction > 0.0) {
+      auto verifierStats = experiment.mappingVerifierStats();
+      oa(cereal::make_nvp("num_verified_mappings", verifierStats.numChecked));
+      oa(cereal::make_nvp("num_verifier_cache_hits",
+                          verifierStats.numCacheHits));
+      oa(cereal::make_nvp("num_rejected_mappings",
+                          verifierStats.numRejected));
+    }
+    // How many reads were looked up in the duplicate-read cache, and how
+    // many of them were found there (and so weren't mapped again).
+    if (opts.readCacheSize > 0) {
+      oa(cereal::make_nvp("num_read_cache_lookups",
+                          experiment.numReadCacheLookups()));
+      oa(cereal::make_nvp("num_read_cache_hits",
+                          experiment.numReadCacheHits()));
+    }
+    // How many fragments were discarded, unmapped, as repeats
+    if (opts.maxKmerOcc > 0) {
+      oa(cereal::make_nvp("num_repeat_rejected_frags",
+                          experiment.numRepeatRejections()));
+    }
+    // How many reads had adapters clipped off, and how many fragments were
+    // discarded, unmapped, as of low complexity
+    if (!opts.adapters.empty()) {
+      oa(cereal::make_nvp("num_adapter_clipped_reads",
+                          experiment.numAdapterClipped()));
+    }
+    if (opts.maxDust > 0.0) {
+      oa(cereal::make_nvp("num_low_complexity_frags",
+                          experiment.numLowComplexity()));
+    }
+    // The fraction of the reads quantified, and how many were left out
+    if (opts.subsampleFraction < 1.0) {
+      oa(cereal::make_nvp("subsample_fraction", opts.subsampleFraction));
+      oa(cereal::make_nvp("num_subsampled_out_frags",
+                          experiment.numSubsampledOut()));
+      oa(cereal::make_nvp("num_reads_scale", opts.numReadsScale));
+    }
+    // The number of assigned fragments after which the online estimates
+    // were considered stable (0 if they never were).
+    if (opts.onlineStopTolerance > 0.0) {
+      oa(cereal::make_nvp("online_converged_at_frags",
+                          experiment.onlineConvergedAtFragment()));
+    }
+    // The number of times each mapping thread flushed its local
+    // equivalence classes into the global map.
+    oa(cereal::make_nvp(
+        "eq_class_local_flushes",
+        const_cast<ExpT&>(experiment).equivalenceClassBuilder().localFlushCounts()));
+    // Where the offline (VB)EM started from
+    oa(cereal::make_nvp("em_init_source",
+                        !opts.initFrom.empty()
+                            ? opts.initFrom
+                            : std::string(opts.initUniform ? "uniform"
+                                                           : "online")));
+    // The transcripts of targeted quantification, and the fragments outside
+    // of their components
+    if (!opts.targets.empty()) {
+      oa(cereal::make_nvp("num_targets", opts.targets.size()));
+      oa(cereal::make_nvp("num_background_frags",
+                          experiment.numBackgroundFragments()));
+    }
+    // The earlier run whose fragment length and bias models were used
+    if (!opts.importModels.empty()) {
+      oa(cereal::make_nvp("imported_models", opts.importModels));
+    }
+    // The number of (VB)EM iterations taken by each bootstrap sample
+    if (opts.numBootstraps > 0) {
+      oa(cereal::make_nvp("bootstrap_iterations",
+                          experiment.bootstrapIterations()));
+    }
     oa(cereal::make_nvp("call", std::string("quant")));
     oa(cereal::make_nvp("start_time", opts.runStartTime));
     oa(cereal::make_nvp("end_time", opts.runStopTime));
+    // The instruction set variant that each hot kernel ran
+    oa(cereal::make_nvp("cpu_kernels", salmon::cpu::chosenVariants()));
+    // Where the time (and the memory) of the run went
+    oa(cereal::make_nvp("performance", *opts.perfStats));
   }
 
   {
@@ -478,7 +603,7 @@ bool GZipWriter::writeMeta(const SalmonOpts& opts, const ExpT& experiment) {
     for (auto& eq : eqVec) {
       uint64_t count = eq.second.count;
       const TranscriptGroup& tgroup = eq.first;
-      const std::vector<uint32_t>& txps = tgroup.txps;
+      const EqClassLabel& txps = tgroup.txps;
       if (txps.size() > 1) {
         for (auto tid : txps) {
           counts[tid].potential += count;
@@ -495,6 +620,76 @@ bool GZipWriter::writeMeta(const SalmonOpts& opts, const ExpT& experiment) {
   return true;
 }
 
+namespace {
+/**
+ * The rows of quant.sf are formatted into a buffer, which is written out
+ * whenever it holds more than this many bytes (rather than issuing a
+ * separate, locked, write for every row).
+ */
+constexpr size_t quantFlushBytes = 1 << 20;
+
+inline void flushQuantBuffer(std::FILE* output, fmt::MemoryWriter& w) {
+  std::fwrite(w.data(), 1, w.size(), output);
+  w.clear();
+}
+
+void writeLE(std::ostream& os, uint64_t v, size_t nbytes) {
+  char b[8];
+  for (size_t i = 0; i < nbytes; ++i) {
+    b[i] = static_cast<char>((v >> (8 * i)) & 0xff);
+  }
+  os.write(b, nbytes);
+}
+
+/**
+ * Writes quant.bin, a binary companion of quant.sf holding the same columns
+ * at full precision (all integers are little endian):
+ *
+ *   header  : char[8] magic ("SALMNQNT"), uint32 version (1), uint64 number
+ *             of transcripts (n)
+ *   names   : uint64 size, then the transcript names, each followed by '\n'
+ *   columns : uint32 Length[n], then float64 EffectiveLength[n], TPM[n] and
+ *             NumReads[n]
+ *
+ * (see scripts/QuantBin.py for a reader).
+ */
+bool writeQuantBin(const boost::filesystem::path& path,
+                   const std::vector<Transcript>& transcripts,
+                   const std::vector<double>& effLengths,
+                   const std::vector<double>& tpms,
+                   const std::vector<double>& counts) {
+  std::ofstream out(path.string(), std::ios_base::out | std::ios_base::binary);
+  if (!out.good()) {
+    return false;
+  }
+  const char magic[8] = {'S', 'A', 'L', 'M', 'N', 'Q', 'N', 'T'};
+  out.write(magic, 8);
+  writeLE(out, 1, 4);
+  writeLE(out, transcripts.size(), 8);
+  uint64_t namesSize{0};
+  for (auto& t : transcripts) {
+    namesSize += std::strlen(t.RefName) + 1;
+  }
+  writeLE(out, namesSize, 8);
+  for (auto& t : transcripts) {
+    out << t.RefName << '\n';
+  }
+  for (auto& t : transcripts) {
+    writeLE(out, t.CompleteLength, 4);
+  }
+  for (auto* column : {&effLengths, &tpms, &counts}) {
+    for (double v : *column) {
+      uint64_t bits;
+      std::memcpy(&bits, &v, sizeof(bits));
+      writeLE(out, bits, 8);
+    }
+  }
+  bool good = out.good();
+  out.close();
+  return good;
+}
+} // namespace
+
 template <typename ExpT>
 bool GZipWriter::writeEmptyAbundances(const SalmonOpts& sopt, ExpT& readExp) {
 
@@ -503,13 +698,33 @@ bool GZipWriter::writeEmptyAbundances(const SalmonOpts& sopt, ExpT& readExp) {
   bfs::path fname = path_ / "quant.sf";
   std::unique_ptr<std::FILE, int (*)(std::FILE*)> output(
       std::fopen(fname.c_str(), "w"), std::fclose);
-  fmt::print(output.get(), "Name\tLength\tEffectiveLength\tTPM\tNumReads\n");
+  fmt::MemoryWriter w;
+  w << "Name\tLength\tEffectiveLength\tTPM\tNumReads\n";
   // Now posterior has the transcript fraction
   std::vector<Transcript>& transcripts_ = readExp.transcripts();
   for (auto& transcript : transcripts_) {
-    fmt::print(output.get(), "{}\t{}\t{:.3f}\t{:f}\t{:f}\n", transcript.RefName,
-               transcript.CompleteLength,
-               static_cast<float>(transcript.CompleteLength), 0.0, 0.0);
+    if (sopt.sparseQuant) {
+      break;
+    }
+    w.write("{}\t{}\t{:.3f}\t{:f}\t{:f}\n", transcript.RefName,
+            transcript.CompleteLength,
+            static_cast<float>(transcript.CompleteLength), 0.0, 0.0);
+    if (w.size() > quantFlushBytes) {
+      flushQuantBuffer(output.get(), w);
+    }
+  }
+  flushQuantBuffer(output.get(), w);
+
+  if (sopt.writeQuantBin) {
+    std::vector<double> effLengths(transcripts_.size());
+    std::vector<double> zeros(transcripts_.size(), 0.0);
+    for (size_t i = 0; i < transcripts_.size(); ++i) {
+      effLengths[i] = static_cast<float>(transcripts_[i].CompleteLength);
+    }
+    if (!writeQuantBin(path_ / "quant.bin", transcripts_, effLengths, zeros,
+                       zeros)) {
+      logger_->warn("Couldn't write {}", (path_ / "quant.bin").string());
+    }
   }
   return true;
 }
@@ -530,37 +745,118 @@ bool GZipWriter::writeAbundances(const SalmonOpts& sopt, ExpT& readExp) {
   std::unique_ptr<std::FILE, int (*)(std::FILE*)> output(
       std::fopen(fname.c_str(), "w"), std::fclose);
 
-  fmt::print(output.get(), "Name\tLength\tEffectiveLength\tTPM\tNumReads\n");
-
   double numMappedFrags = readExp.upperBoundHits();
 
+  // The counts, and the TPM normalizer, in one pass
   std::vector<Transcript>& transcripts_ = readExp.transcripts();
+  double tfracDenom{0.0};
   for (auto& transcript : transcripts_) {
     transcript.projectedCounts = useScaledCounts
                                      ? (transcript.mass(false) * numMappedFrags)
                                      : transcript.sharedCount();
-  }
-
-  double tfracDenom{0.0};
-  for (auto& transcript : transcripts_) {
     double refLength = transcript.EffectiveLength;
     tfracDenom += (transcript.projectedCounts / numMappedFrags) / refLength;
   }
 
+  bool writeBin = sopt.writeQuantBin;
+  std::vector<double> effLengths, tpms, counts;
+  if (writeBin) {
+    effLengths.reserve(transcripts_.size());
+    tpms.reserve(transcripts_.size());
+    counts.reserve(transcripts_.size());
+  }
+
+  fmt::MemoryWriter w;
+  w << "Name\tLength\tEffectiveLength\tTPM\tNumReads\n";
   double million = 1000000.0;
   // Now posterior has the transcript fraction
   for (auto& transcript : transcripts_) {
-    double count = transcript.projectedCounts;
+    // (scaled up to all of the reads, if only a subsample was quantified)
+    double count = transcript.projectedCounts * sopt.numReadsScale;
     double npm = (transcript.projectedCounts / numMappedFrags);
     double effLength = transcript.EffectiveLength;
     double tfrac = (npm / effLength) / tfracDenom;
     double tpm = tfrac * million;
-    fmt::print(output.get(), "{}\t{}\t{:.3f}\t{:f}\t{:f}\n", transcript.RefName,
-               transcript.CompleteLength, effLength, tpm, count);
+    if (count > 0.0 or !sopt.sparseQuant) {
+      w.write("{}\t{}\t{:.3f}\t{:f}\t{:f}\n", transcript.RefName,
+              transcript.CompleteLength, effLength, tpm, count);
+      if (w.size() > quantFlushBytes) {
+        flushQuantBuffer(output.get(), w);
+      }
+    }
+    if (writeBin) {
+      effLengths.push_back(effLength);
+      tpms.push_back(tpm);
+      counts.push_back(count);
+    }
+  }
+  flushQuantBuffer(output.get(), w);
+
+  if (writeBin and !writeQuantBin(path_ / "quant.bin", transcripts_,
+                                  effLengths, tpms, counts)) {
+    logger_->warn("Couldn't write {}", (path_ / "quant.bin").string());
   }
   return true;
 }
 
+/**
+ * quant_var.sf: the columns of quant.sf, followed by the standard deviations
+ * of the TPM and of the NumReads, and a (normal) 95% interval of the
+ * NumReads, from the count variances found by
+ * CollapsedEMOptimizer::approximateVariances.  Must be called after
+ * writeAbundances (which projects the counts).
+ */
+template <typename ExpT>
+bool GZipWriter::writeVariances(const SalmonOpts& sopt, ExpT& readExp,
+                                const std::vector<double>& variances) {
+  namespace bfs = boost::filesystem;
+  bfs::path fname = path_ / "quant_var.sf";
+  std::unique_ptr<std::FILE, int (*)(std::FILE*)> output(
+      std::fopen(fname.c_str(), "w"), std::fclose);
+  if (!output) {
+    logger_->error("Couldn't open {} for writing", fname.string());
+    return false;
+  }
+
+  double numMappedFrags = readExp.upperBoundHits();
+  std::vector<Transcript>& transcripts_ = readExp.transcripts();
+  double tfracDenom{0.0};
+  for (auto& transcript : transcripts_) {
+    tfracDenom += (transcript.projectedCounts / numMappedFrags) /
+                  transcript.EffectiveLength;
+  }
+
+  fmt::MemoryWriter w;
+  w << "Name\tLength\tEffectiveLength\tTPM\tNumReads\tTPMSD\tNumReadsSD"
+       "\tNumReadsCI95Low\tNumReadsCI95High\n";
+  double million = 1000000.0;
+  for (size_t i = 0; i < transcripts_.size(); ++i) {
+    auto& transcript = transcripts_[i];
+    double count = transcript.projectedCounts * sopt.numReadsScale;
+    double effLength = transcript.EffectiveLength;
+    // the TPM of a single (projected) read of this transcript
+    double tpmPerRead = million / (numMappedFrags * effLength * tfracDenom);
+    double tpm = transcript.projectedCounts * tpmPerRead;
+    // the variances are of the (unprojected) estimate
+    double shared = transcript.sharedCount();
+    double projection =
+        (shared > 0.0) ? transcript.projectedCounts / shared : 1.0;
+    double sd = std::sqrt(variances[i]) * projection;
+    double countSD = sd * sopt.numReadsScale;
+    if (count > 0.0 or !sopt.sparseQuant) {
+      w.write("{}\t{}\t{:.3f}\t{:f}\t{:f}\t{:f}\t{:f}\t{:f}\t{:f}\n",
+              transcript.RefName, transcript.CompleteLength, effLength, tpm,
+              count, sd * tpmPerRead, countSD,
+              std::max(count - 1.96 * countSD, 0.0), count + 1.96 * countSD);
+      if (w.size() > quantFlushBytes) {
+        flushQuantBuffer(output.get(), w);
+      }
+    }
+  }
+  flushQuantBuffer(output.get(), w);
+  return true;
+}
+
 bool GZipWriter::setSamplingPath(const SalmonOpts& sopt) {
   namespace bfs = boost::filesystem;
 
@@ -574,6 +870,12 @@ bool GZipWriter::setSamplingPath(const SalmonOpts& sopt) {
     }
   }
   bsPath_ = auxDir / "bootstrap";
+  columnarSamples_ = (sopt.sampleFormat == "columnar");
+  expectedSamples_ = (sopt.numBootstraps > 0) ? sopt.numBootstraps
+                                               : sopt.numGibbsSamples;
+  salmon::samples::parsePrecision(sopt.samplePrecision, samplePrecision_);
+  sampleFixedScale_ = sopt.sampleFixedScale;
+  sparseSamples_ = useSparseSamples(sopt);
   if (!bfs::exists(bsPath_)) {
     bool bsSuccess = boost::filesystem::create_directories(bsPath_);
     if (!bsSuccess) {
@@ -587,11 +889,26 @@ bool GZipWriter::setSamplingPath(const SalmonOpts& sopt) {
 
 template <typename T>
 bool GZipWriter::writeBootstrap(const std::vector<T>& abund, bool quiet) {
-#if defined __APPLE__
   spin_lock::scoped_lock sl(writeMutex_);
-#else
-  std::lock_guard<std::mutex> lock(writeMutex_);
-#endif
+  if (columnarSamples_) {
+    if (!bsColumns_) {
+      bsColumns_.reset(new ColumnarSampleWriter(
+          bsPath_ / "bootstraps.col", abund.size(), samplePrecision_,
+          sampleFixedScale_, expectedSamples_));
+    }
+    std::vector<double> sample(abund.begin(), abund.end());
+    if (!bsColumns_->writeSample(sample)) {
+      logger_->error("could not write bootstrap {}",
+                     numBootstrapsWritten_.load() + 1);
+      return false;
+    }
+    if (!quiet) {
+      logger_->info("wrote {} bootstraps", numBootstrapsWritten_.load() + 1);
+    }
+    ++numBootstrapsWritten_;
+    return true;
+  }
+
   if (!bsStream_) {
     bsStream_.reset(new boost::iostreams::filtering_ostream);
     bsStream_->push(boost::iostreams::gzip_compressor(6));
@@ -601,10 +918,17 @@ bool GZipWriter::writeBootstrap(const std::vector<T>& abund, bool quiet) {
   }
 
   boost::iostreams::filtering_ostream& ofile = *bsStream_;
-  size_t num = abund.size();
-  size_t elSize = sizeof(typename std::vector<T>::value_type);
-  ofile.write(reinterpret_cast<char*>(const_cast<T*>(abund.data())),
-              elSize * num);
+  if (samplePrecision_ == SamplePrecision::FLOAT64 and !sparseSamples_) {
+    size_t num = abund.size();
+    size_t elSize = sizeof(typename std::vector<T>::value_type);
+    ofile.write(reinterpret_cast<char*>(const_cast<T*>(abund.data())),
+                elSize * num);
+  } else {
+    std::vector<double> sample(abund.begin(), abund.end());
+    salmon::samples::encodeSample(sample, samplePrecision_, sampleFixedScale_,
+                                  sparseSamples_, sampleBuffer_);
+    ofile.write(sampleBuffer_.data(), sampleBuffer_.size());
+  }
   if (!quiet) {
     logger_->info("wrote {} bootstraps", numBootstrapsWritten_.load() + 1);
   }
@@ -612,6 +936,28 @@ bool GZipWriter::writeBootstrap(const std::vector<T>& abund, bool quiet) {
   return true;
 }
 
+bool GZipWriter::useSparseSamples(const SalmonOpts& sopt) {
+  return sopt.sampleFormat == "gzip" and sopt.samplePrecision != "double" and
+         !sopt.denseSamples;
+}
+
+bool GZipWriter::finishSamples() {
+  spin_lock::scoped_lock sl(writeMutex_);
+  if (bsStream_) {
+    bsStream_->reset();
+    bsStream_.reset();
+  }
+  if (bsColumns_) {
+    bool ok = bsColumns_->finish();
+    bsColumns_.reset();
+    if (!ok) {
+      logger_->error("could not write the columnar sample file");
+      return false;
+    }
+  }
+  return true;
+}
+
 template bool
 GZipWriter::writeBootstrap<double>(const std::vector<double>& abund,
                                    bool quiet);
@@ -633,6 +979,22 @@ template bool GZipWriter::writeAbundances<AlignmentLibrary<UnpairedRead>>(
     const SalmonOpts& sopt, AlignmentLibrary<UnpairedRead>& readExp);
 template bool GZipWriter::writeAbundances<AlignmentLibrary<ReadPair>>(
     const SalmonOpts& sopt, AlignmentLibrary<ReadPair>& readExp);
+template bool
+GZipWriter::writeAbundances<PartialExperiment>(const SalmonOpts& sopt,
+                                               PartialExperiment& readExp);
+
+template bool GZipWriter::writeVariances<ReadExperiment>(
+    const SalmonOpts& sopt, ReadExperiment& readExp,
+    const std::vector<double>& variances);
+template bool GZipWriter::writeVariances<AlignmentLibrary<UnpairedRead>>(
+    const SalmonOpts& sopt, AlignmentLibrary<UnpairedRead>& readExp,
+    const std::vector<double>& variances);
+template bool GZipWriter::writeVariances<AlignmentLibrary<ReadPair>>(
+    const SalmonOpts& sopt, AlignmentLibrary<ReadPair>& readExp,
+    const std::vector<double>& variances);
+template bool GZipWriter::writeVariances<PartialExperiment>(
+    const SalmonOpts& sopt, PartialExperiment& readExp,
+    const std::vector<double>& variances);
 
 template bool
 GZipWriter::writeEmptyAbundances<ReadExperiment>(const SalmonOpts& sopt,
@@ -0,0 +1,155 @@
+#include "HardwareCounters.hpp"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace salmon {
+namespace perf {
+
+const char* eventName(size_t e) {
+  static const char* names[numEvents] = {"cycles", "instructions",
+                                         "llc_misses", "dtlb_misses",
+                                         "branch_misses"};
+  return (e < numEvents) ? names[e] : "";
+}
+
+#if defined(__linux__)
+namespace {
+// The type and config of each event
+void eventAttr(size_t e, perf_event_attr& attr) {
+  attr.type = PERF_TYPE_HARDWARE;
+  switch (static_cast<Event>(e)) {
+  case Event::CYCLES:
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    break;
+  case Event::INSTRUCTIONS:
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    break;
+  case Event::LLC_MISSES:
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    break;
+  case Event::DTLB_MISSES:
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    break;
+  case Event::BRANCH_MISSES:
+    attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+    break;
+  }
+}
+
+// Count event e of the thread tid (0 for the calling thread); -1 if it can't
+// be counted
+int openEvent(size_t e, pid_t tid) {
+  perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  eventAttr(e, attr);
+  attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return static_cast<int>(
+      ::syscall(SYS_perf_event_open, &attr, tid, -1, -1, PERF_FLAG_FD_CLOEXEC));
+}
+
+// The threads of this process
+std::vector<pid_t> processThreads() {
+  std::vector<pid_t> tids;
+  DIR* dir = ::opendir("/proc/self/task");
+  if (dir == nullptr) {
+    return tids;
+  }
+  while (struct dirent* ent = ::readdir(dir)) {
+    if (ent->d_name[0] != '.') {
+      tids.push_back(static_cast<pid_t>(std::atol(ent->d_name)));
+    }
+  }
+  ::closedir(dir);
+  return tids;
+}
+} // namespace
+
+CounterSet::CounterSet(Scope scope) {
+  std::vector<pid_t> tids = (scope == Scope::PROCESS) ? processThreads()
+                                                      : std::vector<pid_t>{0};
+  for (auto tid : tids) {
+    std::array<int, numEvents> fds;
+    bool any{false};
+    for (size_t e = 0; e < numEvents; ++e) {
+      fds[e] = openEvent(e, tid);
+      any = any or (fds[e] >= 0);
+    }
+    if (any) {
+      fds_.push_back(fds);
+    }
+  }
+}
+
+CounterSet::~CounterSet() {
+  for (auto& fds : fds_) {
+    for (int fd : fds) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+  }
+}
+
+CounterValues CounterSet::read() const {
+  CounterValues v;
+  for (auto& fds : fds_) {
+    for (size_t e = 0; e < numEvents; ++e) {
+      // the count, the time enabled and the time running
+      uint64_t buf[3];
+      if (fds[e] < 0 or ::read(fds[e], buf, sizeof(buf)) != sizeof(buf)) {
+        continue;
+      }
+      uint64_t count = buf[0];
+      if (buf[2] > 0 and buf[2] < buf[1]) {
+        count = static_cast<uint64_t>(static_cast<double>(count) * buf[1] /
+                                      buf[2]);
+      }
+      v.counts[e] += count;
+      v.counted[e] = true;
+    }
+  }
+  return v;
+}
+
+bool available(std::string& why) {
+  for (size_t e = 0; e < numEvents; ++e) {
+    int fd = openEvent(e, 0);
+    if (fd >= 0) {
+      ::close(fd);
+      return true;
+    }
+    if (e == 0) {
+      why = std::strerror(errno);
+    }
+  }
+  return false;
+}
+#else
+CounterSet::CounterSet(Scope) {}
+CounterSet::~CounterSet() {}
+CounterValues CounterSet::read() const { return CounterValues(); }
+bool available(std::string& why) {
+  why = "hardware counters are only read on Linux";
+  return false;
+}
+#endif
+
+} // namespace perf
+} // namespace salmon
@@ -0,0 +1,169 @@
+#include "InferenceSweep.hpp"
+
+#include <fstream>
+#include <set>
+
+#include <boost/program_options.hpp>
+
+#include "CollapsedEMOptimizer.hpp"
+#include "GZipWriter.hpp"
+#include "PartialExperiment.hpp"
+#include "PerformanceStats.hpp"
+#include "ReadExperiment.hpp"
+
+namespace salmon {
+namespace sweep {
+
+bool Sweep::load(const std::string& path, const SalmonOpts& sopt,
+                 spdlog::logger* log) {
+  namespace po = boost::program_options;
+  std::ifstream in(path);
+  if (!in.good()) {
+    log->error("Couldn't open the sweep file {}", path);
+    return false;
+  }
+  bool runBiasCorrect =
+      sopt.biasCorrect or sopt.gcBiasCorrect or sopt.posBiasCorrect;
+  std::set<std::string> names;
+  std::string line;
+  for (size_t lineNum = 1; std::getline(in, line); ++lineNum) {
+    auto first = line.find_first_not_of(" \t\r");
+    if (first == std::string::npos or line[first] == '#') {
+      continue;
+    }
+    auto nameEnd = line.find_first_of(" \t\r", first);
+    Config c;
+    c.name = line.substr(first, nameEnd - first);
+    c.useVBOpt = sopt.useVBOpt;
+    c.vbPrior = sopt.vbPrior;
+    c.perTranscriptPrior = sopt.perTranscriptPrior;
+    if (c.name.find('/') != std::string::npos or c.name == "." or
+        c.name == ".." or !names.insert(c.name).second) {
+      log->error("line {} of {}: the configuration name {} is not a "
+                 "distinct file name",
+                 lineNum, path, c.name);
+      return false;
+    }
+
+    bool useVB{false}, useEM{false}, perTxp{false}, perNuc{false};
+    bool noBias{false};
+    po::options_description desc;
+    desc.add_options()("useVBOpt", po::bool_switch(&useVB))(
+        "useEM", po::bool_switch(&useEM))(
+        "vbPrior", po::value<double>(&c.vbPrior))(
+        "perTranscriptPrior", po::bool_switch(&perTxp))(
+        "perNucleotidePrior", po::bool_switch(&perNuc))(
+        "noBiasCorrect", po::bool_switch(&noBias));
+    try {
+      auto args = (nameEnd == std::string::npos)
+                      ? std::vector<std::string>()
+                      : po::split_unix(line.substr(nameEnd));
+      po::variables_map vm;
+      po::store(po::command_line_parser(args).options(desc).run(), vm);
+      po::notify(vm);
+    } catch (po::error& e) {
+      log->error("line {} of {}: {}", lineNum, path, e.what());
+      return false;
+    }
+    if ((useVB and useEM) or (perTxp and perNuc)) {
+      log->error("line {} of {}: contradictory options", lineNum, path);
+      return false;
+    }
+    c.useVBOpt = useVB or (c.useVBOpt and !useEM);
+    c.perTranscriptPrior = perTxp or (c.perTranscriptPrior and !perNuc);
+    c.biasCorrect = !noBias;
+    if (noBias and !runBiasCorrect) {
+      log->warn("line {} of {}: the run isn't bias-corrected, so "
+                "--noBiasCorrect changes nothing",
+                lineNum, path);
+    }
+    configs_.push_back(c);
+  }
+  log->info("Read {} inference configurations from {}", configs_.size(),
+            path);
+  return true;
+}
+
+template <typename ExpT> void Sweep::saveInitialEstimates(ExpT& experiment) {
+  auto& transcripts = experiment.transcripts();
+  initialCounts_.resize(transcripts.size());
+  for (size_t i = 0; i < transcripts.size(); ++i) {
+    initialCounts_[i] = transcripts[i].projectedCounts;
+  }
+}
+
+template <typename ExpT>
+bool Sweep::run(ExpT& experiment, SalmonOpts& sopt,
+                const boost::filesystem::path& outputDirectory) {
+  namespace bfs = boost::filesystem;
+  auto& transcripts = experiment.transcripts();
+  auto& jointLog = sopt.jointLog;
+
+  // The options that the configurations change, to be put back after
+  bool useVBOpt = sopt.useVBOpt;
+  double vbPrior = sopt.vbPrior;
+  bool perTranscriptPrior = sopt.perTranscriptPrior;
+  bool seqBiasCorrect = sopt.biasCorrect;
+  bool gcBiasCorrect = sopt.gcBiasCorrect;
+  bool posBiasCorrect = sopt.posBiasCorrect;
+  // The run's own optimization has restricted the classes to the targets'
+  // components (and counted the others' fragments as background) already
+  std::vector<uint32_t> targets;
+  targets.swap(sopt.targets);
+
+  bool ok{true};
+  CollapsedEMOptimizer optimizer;
+  for (auto& c : configs_) {
+    for (size_t i = 0; i < transcripts.size(); ++i) {
+      transcripts[i].projectedCounts = initialCounts_[i];
+    }
+    sopt.useVBOpt = c.useVBOpt;
+    sopt.vbPrior = c.vbPrior;
+    sopt.perTranscriptPrior = c.perTranscriptPrior;
+    sopt.biasCorrect = seqBiasCorrect and c.biasCorrect;
+    sopt.gcBiasCorrect = gcBiasCorrect and c.biasCorrect;
+    sopt.posBiasCorrect = posBiasCorrect and c.biasCorrect;
+
+    jointLog->info("Quantifying the configuration {} of the sweep", c.name);
+    PerformanceStats::Scope sweepPhase(*sopt.perfStats, "sweep_em");
+    if (!optimizer.optimize(experiment, sopt, 0.01, 10000)) {
+      jointLog->error("The optimization of the configuration {} failed",
+                      c.name);
+      ok = false;
+      continue;
+    }
+    sweepPhase.finish();
+
+    bfs::path dir = outputDirectory / "sweep" / c.name;
+    boost::system::error_code ec;
+    bfs::create_directories(dir, ec);
+    GZipWriter gzw(dir, jointLog);
+    if (ec or !gzw.writeAbundances(sopt, experiment)) {
+      jointLog->error("Couldn't write {}", (dir / "quant.sf").string());
+      ok = false;
+    }
+  }
+
+  sopt.useVBOpt = useVBOpt;
+  sopt.vbPrior = vbPrior;
+  sopt.perTranscriptPrior = perTranscriptPrior;
+  sopt.biasCorrect = seqBiasCorrect;
+  sopt.gcBiasCorrect = gcBiasCorrect;
+  sopt.posBiasCorrect = posBiasCorrect;
+  sopt.targets.swap(targets);
+  return ok;
+}
+
+template void Sweep::saveInitialEstimates<ReadExperiment>(
+    ReadExperiment& experiment);
+template void Sweep::saveInitialEstimates<PartialExperiment>(
+    PartialExperiment& experiment);
+template bool Sweep::run<ReadExperiment>(
+    ReadExperiment& experiment, SalmonOpts& sopt,
+    const boost::filesystem::path& outputDirectory);
+template bool Sweep::run<PartialExperiment>(
+    PartialExperiment& experiment, SalmonOpts& sopt,
+    const boost::filesystem::path& outputDirectory);
+
+} // namespace sweep
+} // namespace salmon
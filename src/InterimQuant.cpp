@@ -0,0 +1,142 @@
+#include "InterimQuant.hpp"
+
+#include <cmath>
+#include <cstdio>
+
+#include "ClusterForest.hpp"
+#include "ReadExperiment.hpp"
+#include "SalmonMath.hpp"
+#include "Transcript.hpp"
+
+namespace salmon {
+namespace interim {
+
+void take(ReadExperiment& experiment, uint64_t numObservedFragments,
+          Estimates& e) {
+  using salmon::math::LOG_0;
+  e.numObservedFragments = numObservedFragments;
+  auto& transcripts = experiment.transcripts();
+  size_t n = transcripts.size();
+  e.counts.assign(n, 0.0);
+  e.effLengths.resize(n);
+  for (auto cptr : experiment.clusterForest().getClusters()) {
+    double logClusterMass{LOG_0};
+    for (auto transcriptID : cptr->members()) {
+      logClusterMass = salmon::math::logAdd(
+          logClusterMass, transcripts[transcriptID].mass(false));
+    }
+    if (logClusterMass == LOG_0) {
+      continue;
+    }
+    double logClusterCount = std::log(static_cast<double>(cptr->numHits()));
+    for (auto transcriptID : cptr->members()) {
+      double logTranscriptMass = transcripts[transcriptID].mass(false);
+      if (logTranscriptMass != LOG_0) {
+        e.counts[transcriptID] =
+            std::exp(logTranscriptMass - logClusterMass + logClusterCount);
+      }
+    }
+  }
+  for (size_t i = 0; i < n; ++i) {
+    e.effLengths[i] = std::exp(transcripts[i].getCachedLogEffectiveLength());
+  }
+}
+
+bool write(const boost::filesystem::path& path,
+           const std::vector<Transcript>& transcripts, const Estimates& e) {
+  std::unique_ptr<std::FILE, int (*)(std::FILE*)> output(
+      std::fopen(path.c_str(), "w"), std::fclose);
+  if (!output) {
+    return false;
+  }
+  double tfracDenom{0.0};
+  for (size_t i = 0; i < transcripts.size(); ++i) {
+    if (e.effLengths[i] > 0.0) {
+      tfracDenom += e.counts[i] / e.effLengths[i];
+    }
+  }
+  fmt::MemoryWriter w;
+  w << "Name\tLength\tEffectiveLength\tTPM\tNumReads\n";
+  double million = 1000000.0;
+  for (size_t i = 0; i < transcripts.size(); ++i) {
+    double tpm = (tfracDenom > 0.0 and e.effLengths[i] > 0.0)
+                     ? million * (e.counts[i] / e.effLengths[i]) / tfracDenom
+                     : 0.0;
+    w.write("{}\t{}\t{:.3f}\t{:f}\t{:f}\n", transcripts[i].RefName,
+            transcripts[i].CompleteLength, e.effLengths[i], tpm,
+            e.counts[i]);
+    if (w.size() > (size_t(1) << 20)) {
+      std::fwrite(w.data(), 1, w.size(), output.get());
+      w.clear();
+    }
+  }
+  std::fwrite(w.data(), 1, w.size(), output.get());
+  return std::fflush(output.get()) == 0 and !std::ferror(output.get());
+}
+
+Snapshotter::Snapshotter(const boost::filesystem::path& path,
+                         uint64_t interval,
+                         const std::vector<Transcript>& transcripts,
+                         std::shared_ptr<spdlog::logger> log)
+    : path_(path), interval_(interval), transcripts_(transcripts), log_(log),
+      nextDue_(interval), writer_(log, 1, 1) {}
+
+Snapshotter::~Snapshotter() { finish(); }
+
+void Snapshotter::beginLibrary(uint32_t numThreads, TakeFn takeFn) {
+  std::lock_guard<std::mutex> lock(mut_);
+  numActive_ = numThreads;
+  numParked_ = 0;
+  takeFn_ = std::move(takeFn);
+}
+
+void Snapshotter::park_() {
+  std::unique_lock<std::mutex> lock(mut_);
+  auto gen = generation_;
+  ++numParked_;
+  if (numParked_ == numActive_) {
+    takeLocked_();
+    return;
+  }
+  parked_.wait(lock, [this, gen]() { return generation_ != gen; });
+}
+
+void Snapshotter::leave() {
+  std::lock_guard<std::mutex> lock(mut_);
+  --numActive_;
+  if (numParked_ > 0 and numParked_ == numActive_) {
+    takeLocked_();
+  }
+}
+
+void Snapshotter::takeLocked_() {
+  std::shared_ptr<Estimates> e(new Estimates);
+  takeFn_(*e);
+  nextDue_ = e->numObservedFragments + interval_;
+  ++numTaken_;
+  writer_.submit(path_.string(), [this, e]() -> bool {
+    namespace bfs = boost::filesystem;
+    bfs::path tmpPath = path_;
+    tmpPath += ".tmp";
+    if (!write(tmpPath, transcripts_, *e)) {
+      return false;
+    }
+    boost::system::error_code ec;
+    bfs::rename(tmpPath, path_, ec);
+    if (ec) {
+      return false;
+    }
+    log_->info("Wrote the estimates after {} fragments to {}",
+               e->numObservedFragments, path_.string());
+    return true;
+  });
+
+  numParked_ = 0;
+  ++generation_;
+  parked_.notify_all();
+}
+
+bool Snapshotter::finish() { return writer_.wait(); }
+
+} // namespace interim
+} // namespace salmon
@@ -0,0 +1,223 @@
+#include "MappingCacheFile.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+#include <zlib.h>
+
+#include "ByteBuffers.hpp"
+#include "xxhash.h"
+
+namespace salmon {
+namespace mapcache {
+
+namespace {
+const char cacheMagic[8] = {'S', 'A', 'L', 'M', 'N', 'M', 'P', 'C'};
+constexpr uint32_t cacheVersion = 1;
+constexpr size_t keyLength = 16;
+// The bytes at either end of a read file that its key hashes
+constexpr size_t sampledBytes = size_t(1) << 20;
+
+using salmon::bytes::compressAppend;
+using salmon::bytes::getU32;
+using salmon::bytes::putU32;
+
+// The name, size and modification time of the file at p
+void describeFile(const boost::filesystem::path& p, std::string& desc) {
+  boost::system::error_code ec;
+  desc += p.string();
+  desc += '\t';
+  desc += std::to_string(boost::filesystem::file_size(p, ec));
+  desc += '\t';
+  desc += std::to_string(
+      static_cast<int64_t>(boost::filesystem::last_write_time(p, ec)));
+  desc += '\n';
+}
+
+// The hash of the first and last sampledBytes of the file at p
+uint64_t sampleHash(const boost::filesystem::path& p) {
+  std::ifstream in(p.string(), std::ios::binary);
+  std::vector<char> buf(sampledBytes);
+  in.read(buf.data(), buf.size());
+  uint64_t h = XXH64(buf.data(), static_cast<size_t>(in.gcount()), 0);
+  in.clear();
+  in.seekg(0, std::ios::end);
+  auto end = static_cast<int64_t>(in.tellg());
+  if (end > static_cast<int64_t>(sampledBytes)) {
+    in.seekg(end - static_cast<int64_t>(sampledBytes));
+    in.read(buf.data(), buf.size());
+    h = XXH64(buf.data(), static_cast<size_t>(in.gcount()), h);
+  }
+  return h;
+}
+} // namespace
+
+std::string libraryKey(const boost::filesystem::path& indexDir,
+                       const std::vector<std::string>& readFiles,
+                       const std::string& options) {
+  namespace bfs = boost::filesystem;
+  std::string desc("salmon mapping cache\n");
+  desc += options;
+  desc += '\n';
+
+  boost::system::error_code ec;
+  std::vector<bfs::path> indexFiles;
+  for (bfs::directory_iterator it(indexDir, ec), end; !ec and it != end;
+       it.increment(ec)) {
+    if (bfs::is_regular_file(it->path())) {
+      indexFiles.push_back(it->path());
+    }
+  }
+  std::sort(indexFiles.begin(), indexFiles.end());
+  for (auto& p : indexFiles) {
+    describeFile(p, desc);
+  }
+
+  for (auto& f : readFiles) {
+    bfs::path p = bfs::absolute(f);
+    describeFile(p, desc);
+    if (bfs::is_regular_file(p)) {
+      desc += std::to_string(sampleHash(p));
+      desc += '\n';
+    }
+  }
+
+  char key[keyLength + 1];
+  std::snprintf(key, sizeof(key), "%016llx",
+                static_cast<unsigned long long>(
+                    XXH64(desc.data(), desc.size(), 0)));
+  return std::string(key, keyLength);
+}
+
+boost::filesystem::path cacheFile(const boost::filesystem::path& dir,
+                                  const std::string& key) {
+  return dir / (key + ".maps");
+}
+
+Writer::Writer(const boost::filesystem::path& dir, const std::string& key)
+    : path_(cacheFile(dir, key)), tmpPath_(path_.string() + ".tmp") {
+  out_.open(tmpPath_.string(), std::ios::out | std::ios::binary);
+  if (!out_.is_open()) {
+    return;
+  }
+  // The header is written here, as the blocks may come from any thread
+  std::vector<char> header(cacheMagic, cacheMagic + 8);
+  putU32(header, cacheVersion);
+  header.insert(header.end(), key.begin(), key.end());
+  out_.write(header.data(), header.size());
+  blocks_.reset(new AuxRecordWriter(out_, false));
+}
+
+Writer::~Writer() {
+  if (blocks_ != nullptr) {
+    blocks_->close();
+  }
+  if (!committed_ and out_.is_open()) {
+    out_.close();
+    boost::system::error_code ec;
+    boost::filesystem::remove(tmpPath_, ec);
+  }
+}
+
+bool Writer::commit() {
+  if (!good()) {
+    return false;
+  }
+  blocks_->close();
+  out_.close();
+  boost::system::error_code ec;
+  if (out_.fail()) {
+    boost::filesystem::remove(tmpPath_, ec);
+    return false;
+  }
+  boost::filesystem::rename(tmpPath_, path_, ec);
+  committed_ = !ec;
+  return committed_;
+}
+
+bool BlockEncoder::flush(Writer& w) {
+  if (numFragments_ == 0) {
+    return true;
+  }
+  out_.clear();
+  putU32(out_, numFragments_);
+  putU32(out_, static_cast<uint32_t>(buf_.size()));
+  // room for the compressed size, which we don't know yet
+  putU32(out_, 0);
+  bool ok = compressAppend(buf_, out_);
+  uint32_t compressedSize = static_cast<uint32_t>(out_.size() - 12);
+  for (size_t i = 0; i < 4; ++i) {
+    out_[8 + i] = static_cast<char>((compressedSize >> (8 * i)) & 0xff);
+  }
+  if (ok) {
+    w.write(out_.data(), out_.size());
+  }
+  buf_.clear();
+  numFragments_ = 0;
+  return ok;
+}
+
+bool Reader::open(const boost::filesystem::path& path,
+                  const std::string& key) {
+  in_.open(path.string(), std::ios::binary);
+  if (!in_.is_open()) {
+    return false;
+  }
+  char header[8 + 4 + keyLength];
+  in_.read(header, sizeof(header));
+  if (in_.gcount() != sizeof(header) or
+      !std::equal(cacheMagic, cacheMagic + 8, header) or
+      getU32(header + 8) != cacheVersion or
+      std::string(header + 12, keyLength) != key) {
+    in_.close();
+    return false;
+  }
+  return true;
+}
+
+bool Reader::next(BlockDecoder& decoder) {
+  uint32_t rawSize{0};
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (failed_) {
+      return false;
+    }
+    char blockHeader[12];
+    in_.read(blockHeader, sizeof(blockHeader));
+    if (in_.gcount() == 0) {
+      return false;
+    }
+    if (in_.gcount() != sizeof(blockHeader)) {
+      failed_ = true;
+      return false;
+    }
+    decoder.size_ = getU32(blockHeader);
+    rawSize = getU32(blockHeader + 4);
+    uint32_t compressedSize = getU32(blockHeader + 8);
+    decoder.compressed_.resize(compressedSize);
+    in_.read(decoder.compressed_.data(), compressedSize);
+    if (static_cast<uint32_t>(in_.gcount()) != compressedSize) {
+      failed_ = true;
+      return false;
+    }
+  }
+
+  decoder.buf_.resize(rawSize);
+  uLongf destLen = rawSize;
+  int ret = uncompress(reinterpret_cast<Bytef*>(decoder.buf_.data()),
+                       &destLen,
+                       reinterpret_cast<const Bytef*>(
+                           decoder.compressed_.data()),
+                       decoder.compressed_.size());
+  if (ret != Z_OK or destLen != rawSize) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    failed_ = true;
+    return false;
+  }
+  decoder.at_ = 0;
+  decoder.numLeft_ = decoder.size_;
+  return true;
+}
+
+} // namespace mapcache
+} // namespace salmon
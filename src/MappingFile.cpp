@@ -0,0 +1,65 @@
+#include "MappingFile.hpp"
+
+#include "ByteBuffers.hpp"
+
+namespace salmon {
+namespace mappings {
+
+namespace {
+const char mapMagic[8] = {'S', 'A', 'L', 'M', 'N', 'M', 'A', 'P'};
+constexpr uint32_t mapVersion = 1;
+
+using salmon::bytes::compressAppend;
+using salmon::bytes::putU32;
+using salmon::bytes::putU64;
+} // namespace
+
+bool writeHeader(AuxRecordWriter& w, const std::vector<std::string>& names,
+                 const std::vector<uint32_t>& lengths) {
+  std::vector<char> table;
+  for (size_t i = 0; i < names.size(); ++i) {
+    table.insert(table.end(), names[i].begin(), names[i].end());
+    table.push_back('\t');
+    auto len = std::to_string(lengths[i]);
+    table.insert(table.end(), len.begin(), len.end());
+    table.push_back('\n');
+  }
+  std::vector<char> compressed;
+  if (!compressAppend(table, compressed)) {
+    return false;
+  }
+
+  std::vector<char> header(mapMagic, mapMagic + 8);
+  putU32(header, mapVersion);
+  putU32(header, 0);
+  putU64(header, names.size());
+  putU64(header, compressed.size());
+  header.insert(header.end(), compressed.begin(), compressed.end());
+  w.write(header.data(), header.size());
+  return true;
+}
+
+bool BlockEncoder::flush(AuxRecordWriter& w) {
+  if (numReads_ == 0) {
+    return true;
+  }
+  out_.clear();
+  putU32(out_, numReads_);
+  putU32(out_, static_cast<uint32_t>(buf_.size()));
+  // room for the compressed size, which we don't know yet
+  putU32(out_, 0);
+  bool ok = compressAppend(buf_, out_);
+  uint32_t compressedSize = static_cast<uint32_t>(out_.size() - 12);
+  for (size_t i = 0; i < 4; ++i) {
+    out_[8 + i] = static_cast<char>((compressedSize >> (8 * i)) & 0xff);
+  }
+  if (ok) {
+    w.write(out_.data(), out_.size());
+  }
+  buf_.clear();
+  numReads_ = 0;
+  return ok;
+}
+
+} // namespace mappings
+} // namespace salmon
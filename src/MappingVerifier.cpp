@@ -0,0 +1,92 @@
+#include "MappingVerifier.hpp"
+
+#include <algorithm>
+#include <limits>
+
+#include "SalmonStringUtils.hpp"
+#include "xxhash.h"
+
+bool MappingVerifier::check(Read& read, uint32_t tid, int32_t pos, bool fwd,
+                            const char* txpSeq, int32_t txpLen) {
+  const std::string& fwSeq = *read.seq_;
+  if (!read.haveHash_) {
+    read.hash_ = XXH64(fwSeq.data(), fwSeq.size(), 0);
+    read.haveHash_ = true;
+  }
+  ++stats_.numChecked;
+
+  Key key{read.hash_, tid, pos, fwd};
+  auto it = cache_.find(key);
+  if (it != cache_.end()) {
+    ++stats_.numCacheHits;
+    if (!it->second) {
+      ++stats_.numRejected;
+    }
+    return it->second;
+  }
+
+  if (!fwd and !read.haveRC_) {
+    read.rc_.resize(fwSeq.size());
+    for (size_t i = 0, j = fwSeq.size(); i < fwSeq.size(); ++i) {
+      read.rc_[i] = salmon::stringtools::charRC[static_cast<uint8_t>(
+          fwSeq[--j])];
+    }
+    read.haveRC_ = true;
+  }
+  const std::string& seq = fwd ? fwSeq : read.rc_;
+  int32_t maxDiffs =
+      static_cast<int32_t>(maxEditFraction_ * static_cast<double>(seq.size()));
+  bool ok =
+      bandedEditDistance_(seq, pos, txpSeq, txpLen, maxDiffs) <= maxDiffs;
+
+  if (cache_.size() >= maxCacheEntries_) {
+    cache_.clear();
+  }
+  cache_.emplace(key, ok);
+  if (!ok) {
+    ++stats_.numRejected;
+  }
+  return ok;
+}
+
+int32_t MappingVerifier::bandedEditDistance_(const std::string& seq,
+                                             int32_t pos, const char* txpSeq,
+                                             int32_t txpLen,
+                                             int32_t maxDiffs) {
+  // Cell k of row i is the distance between the first i read bases and the
+  // transcript up to (not including) position pos + i + (k - maxDiffs); the
+  // read may start anywhere within the band.  Transcript positions outside
+  // of [0, txpLen) match nothing.
+  constexpr int32_t inf = std::numeric_limits<int32_t>::max() / 2;
+  int32_t width = 2 * maxDiffs + 1;
+  prevRow_.assign(width, 0);
+  curRow_.resize(width);
+  int32_t m = static_cast<int32_t>(seq.size());
+
+  for (int32_t i = 1; i <= m; ++i) {
+    char c = seq[i - 1];
+    int32_t rowMin = inf;
+    for (int32_t k = 0; k < width; ++k) {
+      int32_t j = pos + i + (k - maxDiffs); // one past the aligned txp. base
+      bool match = (j >= 1 and j <= txpLen and txpSeq[j - 1] == c and
+                    c != 'N');
+      // (mis)match: the same diagonal on the previous row
+      int32_t best = prevRow_[k] + (match ? 0 : 1);
+      // a read base against no transcript base
+      if (k + 1 < width) {
+        best = std::min(best, prevRow_[k + 1] + 1);
+      }
+      // a transcript base against no read base
+      if (k > 0) {
+        best = std::min(best, curRow_[k - 1] + 1);
+      }
+      curRow_[k] = best;
+      rowMin = std::min(rowMin, best);
+    }
+    if (rowMin > maxDiffs) {
+      return rowMin;
+    }
+    std::swap(prevRow_, curRow_);
+  }
+  return *std::min_element(prevRow_.begin(), prevRow_.end());
+}
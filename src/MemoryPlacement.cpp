@@ -0,0 +1,132 @@
+#include "MemoryPlacement.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace salmon {
+namespace memory {
+
+#if defined(__linux__)
+namespace {
+// Round [addr, addr + len) inwards to whole pages; false if none are left.
+bool pageRange(const void* addr, size_t len, uintptr_t& start, size_t& plen) {
+  uintptr_t pageSize = static_cast<uintptr_t>(::sysconf(_SC_PAGESIZE));
+  uintptr_t b = reinterpret_cast<uintptr_t>(addr);
+  uintptr_t e = b + len;
+  start = (b + pageSize - 1) & ~(pageSize - 1);
+  uintptr_t end = e & ~(pageSize - 1);
+  if (addr == nullptr or end <= start) {
+    return false;
+  }
+  plen = end - start;
+  return true;
+}
+
+// The node mask of the online NUMA nodes (from sysfs)
+std::vector<unsigned long> onlineNodes(size_t& numNodes, size_t& maxNode) {
+  std::vector<unsigned long> mask;
+  numNodes = 0;
+  maxNode = 0;
+  DIR* dir = ::opendir("/sys/devices/system/node");
+  if (dir == nullptr) {
+    return mask;
+  }
+  constexpr size_t bitsPerWord = 8 * sizeof(unsigned long);
+  while (auto* ent = ::readdir(dir)) {
+    unsigned long node{0};
+    char rest{0};
+    if (std::sscanf(ent->d_name, "node%lu%c", &node, &rest) != 1) {
+      continue;
+    }
+    if (node / bitsPerWord >= mask.size()) {
+      mask.resize(node / bitsPerWord + 1, 0);
+    }
+    mask[node / bitsPerWord] |= (1UL << (node % bitsPerWord));
+    ++numNodes;
+    maxNode = std::max(maxNode, static_cast<size_t>(node) + 1);
+  }
+  ::closedir(dir);
+  // mbind() reads maxNode + 1 bits of the mask
+  mask.resize(maxNode / bitsPerWord + 1, 0);
+  return mask;
+}
+}
+
+bool adviseHugePages(const void* addr, size_t len) {
+#if defined(MADV_HUGEPAGE)
+  uintptr_t start{0};
+  size_t plen{0};
+  if (!pageRange(addr, len, start, plen)) {
+    return false;
+  }
+  return ::madvise(reinterpret_cast<void*>(start), plen, MADV_HUGEPAGE) == 0;
+#else
+  (void)addr;
+  (void)len;
+  return false;
+#endif
+}
+
+bool interleavePages(const void* addr, size_t len, bool movePages) {
+  uintptr_t start{0};
+  size_t plen{0};
+  if (!pageRange(addr, len, start, plen)) {
+    return false;
+  }
+  size_t numNodes{0}, maxNode{0};
+  auto mask = onlineNodes(numNodes, maxNode);
+  if (numNodes < 2) {
+    return false;
+  }
+  // maxnode is one past the highest bit the kernel should look at
+  unsigned flags = movePages ? MPOL_MF_MOVE : 0;
+  return ::syscall(SYS_mbind, reinterpret_cast<void*>(start), plen,
+                   MPOL_INTERLEAVE, mask.data(), maxNode + 1, flags) == 0;
+}
+
+bool releaseForFirstTouch(const void* addr, size_t len) {
+  uintptr_t start{0};
+  size_t plen{0};
+  if (!pageRange(addr, len, start, plen)) {
+    return false;
+  }
+  size_t numNodes{0}, maxNode{0};
+  onlineNodes(numNodes, maxNode);
+  if (numNodes < 2) {
+    return false;
+  }
+  // Private anonymous pages read back as zeros once they're dropped
+  return ::madvise(reinterpret_cast<void*>(start), plen, MADV_DONTNEED) == 0;
+}
+#else
+bool adviseHugePages(const void* addr, size_t len) {
+  (void)addr;
+  (void)len;
+  return false;
+}
+
+bool interleavePages(const void* addr, size_t len, bool movePages) {
+  (void)addr;
+  (void)len;
+  (void)movePages;
+  return false;
+}
+
+bool releaseForFirstTouch(const void* addr, size_t len) {
+  (void)addr;
+  (void)len;
+  return false;
+}
+#endif
+} // namespace memory
+} // namespace salmon
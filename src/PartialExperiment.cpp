@@ -0,0 +1,388 @@
+#include "PartialExperiment.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+
+#include <zlib.h>
+
+#include "EquivClassFile.hpp"
+#include "ReadExperiment.hpp"
+
+namespace {
+bool readStats(const boost::filesystem::path& path,
+               std::map<std::string, std::string>& stats) {
+  std::ifstream in(path.string());
+  if (!in.good()) {
+    return false;
+  }
+  std::string key, value;
+  while (in >> key >> value) {
+    stats[key] = value;
+  }
+  return true;
+}
+
+uint64_t statValue(std::map<std::string, std::string>& stats,
+                   const std::string& key) {
+  auto it = stats.find(key);
+  return (it == stats.end()) ? 0 : std::stoull(it->second);
+}
+
+/**
+ * Calls add on each class of the eq_classes.txt at path (see
+ * GZipWriter::writeEquivCounts), having checked that its transcripts are
+ * names; false if they aren't, or if the classes carry no weights.
+ */
+template <typename AddFunT>
+bool readEqClassText(const boost::filesystem::path& path,
+                     const std::vector<std::string>& names, AddFunT add) {
+  std::ifstream in(path.string());
+  size_t numTxps{0}, numClasses{0};
+  if (!(in >> numTxps >> numClasses) or numTxps != names.size()) {
+    return false;
+  }
+  std::string name;
+  for (size_t i = 0; i < numTxps; ++i) {
+    if (!(in >> name) or name != names[i]) {
+      return false;
+    }
+  }
+  salmon::eqclasses::EquivClass c;
+  std::string line;
+  std::vector<double> fields;
+  std::getline(in, line);
+  for (size_t k = 0; k < numClasses; ++k) {
+    if (!std::getline(in, line)) {
+      return false;
+    }
+    std::istringstream ls(line);
+    fields.clear();
+    double v;
+    while (ls >> v) {
+      fields.push_back(v);
+    }
+    // the size n, n transcripts, (with weights) n weights and the count
+    size_t n = fields.empty() ? 0 : static_cast<size_t>(fields[0]);
+    if (n == 0 or fields.size() != 2 * n + 2) {
+      return false;
+    }
+    c.txps.assign(fields.begin() + 1, fields.begin() + 1 + n);
+    c.weights.assign(fields.begin() + 1 + n, fields.begin() + 1 + 2 * n);
+    c.count = static_cast<uint64_t>(fields.back());
+    for (auto t : c.txps) {
+      if (t >= numTxps) {
+        return false;
+      }
+    }
+    add(c);
+  }
+  return true;
+}
+
+// The fragment length samples of the fld.gz at path (gzipped int32s)
+bool readFragLengthSamples(const boost::filesystem::path& path,
+                           std::vector<int32_t>& samples) {
+  gzFile in = gzopen(path.string().c_str(), "rb");
+  if (in == nullptr) {
+    return false;
+  }
+  int32_t buf[4096];
+  int n{0};
+  while ((n = gzread(in, buf, sizeof(buf))) > 0) {
+    samples.insert(samples.end(), buf, buf + n / sizeof(int32_t));
+  }
+  gzclose(in);
+  return n == 0 and !samples.empty();
+}
+
+// The number of fragments ("num_processed") in the meta_info.json at path
+uint64_t numProcessed(const boost::filesystem::path& path) {
+  std::ifstream in(path.string());
+  std::string json((std::istreambuf_iterator<char>(in)),
+                   std::istreambuf_iterator<char>());
+  auto at = json.find("\"num_processed\"");
+  if (at == std::string::npos) {
+    return 0;
+  }
+  at = json.find_first_of("0123456789", at);
+  return (at == std::string::npos) ? 0 : std::stoull(json.substr(at));
+}
+}
+
+bool writePartial(const boost::filesystem::path& dir, const SalmonOpts& sopt,
+                  ReadExperiment& experiment) {
+  namespace bfs = boost::filesystem;
+  boost::system::error_code ec;
+  bfs::create_directories(dir, ec);
+
+  auto& transcripts = experiment.transcripts();
+  std::vector<std::string> names;
+  names.reserve(transcripts.size());
+  for (auto& t : transcripts) {
+    names.push_back(t.RefName);
+  }
+  auto& eqBuilder = experiment.equivalenceClassBuilder();
+  auto& flat = eqBuilder.flatEqClasses();
+  if (!salmon::eqclasses::writeBinary(dir / "eq_classes.bin", names,
+                                      eqBuilder.eqVec(), &flat.weights,
+                                      &flat.offsets)) {
+    return false;
+  }
+
+  std::ofstream txpFile((dir / "transcripts.tsv").string());
+  txpFile << std::setprecision(17);
+  for (auto& t : transcripts) {
+    txpFile << t.RefName << '\t' << t.RefLength << '\t' << t.CompleteLength
+            << '\t' << t.getCachedLogEffectiveLength() << '\t'
+            << t.uniqueCount() << '\t' << t.projectedCounts << '\n';
+  }
+
+  std::ofstream fldFile((dir / "flenDist.txt").string());
+  fldFile << experiment.fragmentLengthDistribution()->toString();
+
+  std::ofstream statFile((dir / "stats.tsv").string());
+  statFile << "num_observed_fragments\t" << experiment.numObservedFragments()
+           << '\n'
+           << "num_mapped_fragments\t" << experiment.numMappedFragments()
+           << '\n'
+           << "upper_bound_hits\t" << experiment.upperBoundHits() << '\n'
+           << "num_transcripts\t" << transcripts.size() << '\n'
+           << "index_seq_hash\t" << experiment.getIndexSeqHash() << '\n';
+  return txpFile.good() and fldFile.good() and statFile.good();
+}
+
+bool PartialExperiment::add(const boost::filesystem::path& dir,
+                            spdlog::logger* log) {
+  std::map<std::string, std::string> stats;
+  if (!readStats(dir / "stats.tsv", stats)) {
+    log->error("{} is not a partial directory (see --writePartial)",
+               dir.string());
+    return false;
+  }
+  uint64_t numMapped = statValue(stats, "num_mapped_fragments");
+
+  std::ifstream txpFile((dir / "transcripts.tsv").string());
+  std::string line;
+  size_t i{0};
+  bool first = (numPartials_ == 0);
+  while (std::getline(txpFile, line)) {
+    std::istringstream fields(line);
+    std::string name;
+    uint32_t len, completeLen;
+    double logEffLen, projected;
+    size_t uniqueCount;
+    if (!(fields >> name >> len >> completeLen >> logEffLen >> uniqueCount >>
+          projected)) {
+      log->error("malformed line {} of {}", i + 1,
+                 (dir / "transcripts.tsv").string());
+      return false;
+    }
+    if (first) {
+      transcripts_.emplace_back(
+          i, transcriptNames_.name(transcriptNames_.add(name)), len);
+      transcripts_.back().setCompleteLength(completeLen);
+      effLenSums_.push_back(0.0);
+    } else if (i >= transcripts_.size() or transcripts_[i].RefName != name) {
+      log->error("The transcripts of {} differ from those of the partials "
+                 "before it (the shards must be quantified against the "
+                 "same index)",
+                 dir.string());
+      return false;
+    }
+    auto& t = transcripts_[i];
+    t.addUniqueCount(uniqueCount);
+    t.projectedCounts += projected;
+    effLenSums_[i] += numMapped * std::exp(logEffLen);
+    ++i;
+  }
+  if (i != transcripts_.size()) {
+    log->error("{} has {} transcripts, rather than {}",
+               (dir / "transcripts.tsv").string(), i, transcripts_.size());
+    return false;
+  }
+
+  std::ifstream fldFile((dir / "flenDist.txt").string());
+  double v;
+  for (size_t j = 0; fldFile >> v; ++j) {
+    if (j >= fragLenMass_.size()) {
+      fragLenMass_.resize(j + 1, 0.0);
+    }
+    fragLenMass_[j] += numMapped * v;
+  }
+
+  salmon::eqclasses::Reader reader;
+  if (!reader.open(dir / "eq_classes.bin") or !reader.hasWeights() or
+      reader.numTranscripts() != transcripts_.size()) {
+    log->error("{} is not a binary equivalence class file with rich weights "
+               "for {} transcripts",
+               (dir / "eq_classes.bin").string(), transcripts_.size());
+    return false;
+  }
+  salmon::eqclasses::EquivClass c;
+  std::vector<double> weights;
+  while (reader.next(c)) {
+    // The weights are added (scaled by the count), and the builder
+    // normalizes them once all of the partials are in.
+    weights.assign(c.weights.begin(), c.weights.end());
+    for (auto& w : weights) {
+      w *= c.count;
+    }
+    TranscriptGroup g(c.txps);
+    eqBuilder_.addGroupInPlace(g, weights, c.count);
+  }
+
+  numMappedFragments_ += numMapped;
+  numObservedFragments_ += statValue(stats, "num_observed_fragments");
+  upperBoundHits_ += statValue(stats, "upper_bound_hits");
+  ++numPartials_;
+  log->info("added the partial {} ({} mapped fragments, {} classes)",
+            dir.string(), numMapped, reader.numClasses());
+  return true;
+}
+
+bool PartialExperiment::addQuantOutput(const boost::filesystem::path& dir,
+                                       const std::string& auxDir,
+                                       spdlog::logger* log) {
+  if (numPartials_ > 0) {
+    log->error("a quant output can't be merged with anything else");
+    return false;
+  }
+  auto quantPath = dir / "quant.sf";
+  std::ifstream quantFile(quantPath.string());
+  std::string line;
+  if (!std::getline(quantFile, line)) {
+    log->error("{} is not a salmon quant output directory", dir.string());
+    return false;
+  }
+  std::vector<std::string> names;
+  std::vector<double> effLens;
+  while (std::getline(quantFile, line)) {
+    std::istringstream fields(line);
+    std::string name;
+    uint32_t len;
+    double effLen, tpm, numReads;
+    if (!(fields >> name >> len >> effLen >> tpm >> numReads)) {
+      log->error("malformed line {} of {}", names.size() + 2,
+                 quantPath.string());
+      return false;
+    }
+    transcripts_.emplace_back(
+        names.size(), transcriptNames_.name(transcriptNames_.add(name)), len);
+    transcripts_.back().setCompleteLength(len);
+    transcripts_.back().projectedCounts = numReads;
+    names.push_back(name);
+    effLens.push_back(std::max(effLen, 1.0));
+  }
+
+  // The dumped weights are those the optimizer combined (i.e. divided by
+  // the effective lengths, and normalized); they're multiplied by the
+  // effective lengths here, so that it recombines them to the same values.
+  uint64_t numMapped{0}, numClasses{0};
+  std::vector<double> weights;
+  auto addClass = [this, &effLens, &weights, &numMapped,
+                   &numClasses](salmon::eqclasses::EquivClass& c) -> void {
+    weights.resize(c.txps.size());
+    for (size_t i = 0; i < c.txps.size(); ++i) {
+      weights[i] = c.count * c.weights[i] * effLens[c.txps[i]];
+    }
+    TranscriptGroup g(c.txps);
+    eqBuilder_.addGroupInPlace(g, weights, c.count);
+    numMapped += c.count;
+    ++numClasses;
+  };
+  auto auxPath = dir / auxDir;
+  auto binPath = auxPath / "eq_classes.bin";
+  auto textPath = auxPath / "eq_classes.txt";
+  bool loaded{false};
+  if (boost::filesystem::exists(binPath)) {
+    salmon::eqclasses::Reader reader;
+    if (reader.open(binPath) and reader.hasWeights() and
+        reader.names() == names) {
+      salmon::eqclasses::EquivClass c;
+      bool valid{true};
+      while (valid and reader.next(c)) {
+        valid = std::all_of(c.txps.begin(), c.txps.end(),
+                            [&names](uint32_t t) { return t < names.size(); });
+        if (valid) {
+          addClass(c);
+        }
+      }
+      loaded = valid;
+    }
+  } else {
+    loaded = readEqClassText(textPath, names, addClass);
+  }
+  if (!loaded) {
+    log->error("{} has no equivalence classes with rich weights (see "
+               "--dumpEq and --dumpEqWeights) for the transcripts of its "
+               "quant.sf (which must not be --sparseQuant)",
+               dir.string());
+    return false;
+  }
+
+  std::vector<int32_t> fldSamples;
+  if (!readFragLengthSamples(auxPath / "fld.gz", fldSamples)) {
+    log->error("couldn't read the fragment length distribution {}",
+               (auxPath / "fld.gz").string());
+    return false;
+  }
+  for (auto l : fldSamples) {
+    size_t j = static_cast<size_t>(std::max(l, 0));
+    if (j >= fragLenMass_.size()) {
+      fragLenMass_.resize(j + 1, 0.0);
+    }
+    fragLenMass_[j] += static_cast<double>(numMapped) / fldSamples.size();
+  }
+
+  effLenSums_.resize(effLens.size());
+  for (size_t i = 0; i < effLens.size(); ++i) {
+    effLenSums_[i] = numMapped * effLens[i];
+  }
+  numMappedFragments_ = numMapped;
+  numObservedFragments_ =
+      std::max(numProcessed(auxPath / "meta_info.json"), numMapped);
+  upperBoundHits_ = numMapped;
+  numPartials_ = 1;
+  log->info("loaded {} ({} mapped fragments, {} classes)", dir.string(),
+            numMapped, numClasses);
+  return true;
+}
+
+void PartialExperiment::finish() {
+  for (size_t i = 0; i < transcripts_.size(); ++i) {
+    auto& t = transcripts_[i];
+    double effLen = (numMappedFragments_ > 0)
+                        ? effLenSums_[i] / numMappedFragments_
+                        : static_cast<double>(t.RefLength);
+    t.setCachedLogEffectiveLength(std::log(std::max(effLen, 1.0)));
+  }
+  eqBuilder_.finish();
+}
+
+bool PartialExperiment::writeFragLengthDist(
+    const boost::filesystem::path& path) const {
+  std::ofstream out(path.string());
+  double norm = (numMappedFragments_ > 0) ? 1.0 / numMappedFragments_ : 0.0;
+  for (size_t i = 0; i < fragLenMass_.size(); ++i) {
+    out << fragLenMass_[i] * norm
+        << ((i + 1 < fragLenMass_.size()) ? '\t' : '\n');
+  }
+  return out.good();
+}
+
+namespace salmon {
+namespace utils {
+template <>
+Eigen::VectorXd
+updateEffectiveLengths<std::vector<tbb::atomic<double>>, PartialExperiment>(
+    SalmonOpts& sopt, PartialExperiment& readExp, Eigen::VectorXd& effLensIn,
+    std::vector<tbb::atomic<double>>& alphas, std::vector<bool>& available,
+    bool finalRound) {
+  return effLensIn;
+}
+} // namespace utils
+} // namespace salmon
@@ -0,0 +1,328 @@
+#include "QuantCheckpoint.hpp"
+
+#include <cstring>
+#include <fstream>
+
+#include "ClusterForest.hpp"
+#include "ForgettingMassCalculator.hpp"
+#include "FragmentLengthDistribution.hpp"
+#include "ReadExperiment.hpp"
+
+namespace salmon {
+namespace checkpoint {
+
+namespace {
+const char ckptMagic[8] = {'S', 'A', 'L', 'M', 'N', 'C', 'K', 'P'};
+constexpr uint32_t ckptVersion = 1;
+
+// The values are written as they are in memory: a checkpoint is only ever
+// resumed on the machine (type) that wrote it.
+template <typename T> void writeValue(std::ostream& os, const T& v) {
+  os.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+template <typename T> bool readValue(std::istream& is, T& v) {
+  return static_cast<bool>(is.read(reinterpret_cast<char*>(&v), sizeof(T)));
+}
+
+template <typename T>
+void writeVector(std::ostream& os, const std::vector<T>& v) {
+  writeValue(os, static_cast<uint64_t>(v.size()));
+  os.write(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(T));
+}
+
+template <typename T> bool readVector(std::istream& is, std::vector<T>& v) {
+  uint64_t n{0};
+  if (!readValue(is, n)) {
+    return false;
+  }
+  v.resize(n);
+  return static_cast<bool>(
+      is.read(reinterpret_cast<char*>(v.data()), n * sizeof(T)));
+}
+
+void writeString(std::ostream& os, const std::string& s) {
+  writeValue(os, static_cast<uint64_t>(s.size()));
+  os.write(s.data(), s.size());
+}
+
+bool readString(std::istream& is, std::string& s) {
+  uint64_t n{0};
+  if (!readValue(is, n)) {
+    return false;
+  }
+  s.resize(n);
+  return static_cast<bool>(is.read(&s[0], n));
+}
+} // namespace
+
+bool write(const boost::filesystem::path& path, const Snapshot& s) {
+  std::ofstream os(path.string(), std::ios::binary);
+  if (!os.good()) {
+    return false;
+  }
+  os.write(ckptMagic, sizeof(ckptMagic));
+  writeValue(os, ckptVersion);
+  writeString(os, s.indexSeqHash);
+  writeString(os, s.readFiles);
+  writeValue(os, s.numLibrariesDone);
+  writeValue(os, s.numLibraryFragments);
+  writeValue(os, s.numObservedFragments);
+  writeValue(os, s.numAssignedFragments);
+  writeValue(os, s.upperBoundHits);
+  writeValue(os, s.miniBatchTimestep);
+  writeVector(os, s.logMasses);
+  writeVector(os, s.uniqueCounts);
+  writeVector(os, s.totalCounts);
+  writeVector(os, s.lastTimesteps);
+  writeVector(os, s.logEffLengths);
+  writeVector(os, s.clusterParents);
+  writeVector(os, s.clusterCounts);
+  writeVector(os, s.clusterLogMasses);
+  writeVector(os, s.fldLogHist);
+  writeValue(os, s.fldLogTotMass);
+  writeValue(os, s.fldLogSum);
+  writeValue(os, s.fldMin);
+  writeVector(os, s.eqOffsets);
+  writeVector(os, s.eqTxps);
+  writeVector(os, s.eqWeightOffsets);
+  writeVector(os, s.eqWeights);
+  writeVector(os, s.eqCounts);
+  // the magic again, so that a truncated file is never taken for a complete
+  // one
+  os.write(ckptMagic, sizeof(ckptMagic));
+  os.close();
+  return !os.fail();
+}
+
+bool read(const boost::filesystem::path& path, Snapshot& s) {
+  std::ifstream is(path.string(), std::ios::binary);
+  char magic[8];
+  uint32_t version{0};
+  if (!is.read(magic, sizeof(magic)) or
+      std::memcmp(magic, ckptMagic, sizeof(magic)) != 0 or
+      !readValue(is, version) or version != ckptVersion) {
+    return false;
+  }
+  bool ok = readString(is, s.indexSeqHash) and readString(is, s.readFiles) and
+            readValue(is, s.numLibrariesDone) and
+            readValue(is, s.numLibraryFragments) and
+            readValue(is, s.numObservedFragments) and
+            readValue(is, s.numAssignedFragments) and
+            readValue(is, s.upperBoundHits) and
+            readValue(is, s.miniBatchTimestep) and
+            readVector(is, s.logMasses) and readVector(is, s.uniqueCounts) and
+            readVector(is, s.totalCounts) and
+            readVector(is, s.lastTimesteps) and
+            readVector(is, s.logEffLengths) and
+            readVector(is, s.clusterParents) and
+            readVector(is, s.clusterCounts) and
+            readVector(is, s.clusterLogMasses) and
+            readVector(is, s.fldLogHist) and readValue(is, s.fldLogTotMass) and
+            readValue(is, s.fldLogSum) and readValue(is, s.fldMin) and
+            readVector(is, s.eqOffsets) and readVector(is, s.eqTxps) and
+            readVector(is, s.eqWeightOffsets) and
+            readVector(is, s.eqWeights) and readVector(is, s.eqCounts);
+  return ok and is.read(magic, sizeof(magic)) and
+         std::memcmp(magic, ckptMagic, sizeof(magic)) == 0;
+}
+
+void take(ReadExperiment& experiment, ForgettingMassCalculator& fmCalc,
+          uint64_t numObservedFragments, uint64_t numAssignedFragments,
+          uint64_t upperBoundHits, Snapshot& s) {
+  s.indexSeqHash = experiment.getIndexSeqHash();
+  s.readFiles = experiment.readFilesAsString();
+  s.numObservedFragments = numObservedFragments;
+  s.numAssignedFragments = numAssignedFragments;
+  s.upperBoundHits = upperBoundHits;
+  s.miniBatchTimestep = fmCalc.getCurrentTimestep();
+
+  auto& transcripts = experiment.transcripts();
+  size_t n = transcripts.size();
+  s.logMasses.resize(n);
+  s.uniqueCounts.resize(n);
+  s.totalCounts.resize(n);
+  s.lastTimesteps.resize(n);
+  s.logEffLengths.resize(n);
+  for (size_t i = 0; i < n; ++i) {
+    auto& t = transcripts[i];
+    s.logMasses[i] = t.mass(false);
+    s.uniqueCounts[i] = t.uniqueCount();
+    s.totalCounts[i] = t.totalCount();
+    s.lastTimesteps[i] = t.lastTimestepUpdated();
+    s.logEffLengths[i] = t.getCachedLogEffectiveLength();
+  }
+  experiment.clusterForest().dumpState(s.clusterParents, s.clusterCounts,
+                                       s.clusterLogMasses);
+  size_t fldMin{0};
+  experiment.fragmentLengthDistribution()->dumpState(
+      s.fldLogHist, s.fldLogTotMass, s.fldLogSum, fldMin);
+  s.fldMin = fldMin;
+  experiment.equivalenceClassBuilder().dumpClasses(
+      s.eqOffsets, s.eqTxps, s.eqWeightOffsets, s.eqWeights, s.eqCounts);
+}
+
+bool restore(const Snapshot& s, ReadExperiment& experiment,
+             ForgettingMassCalculator& fmCalc, spdlog::logger* log) {
+  auto& transcripts = experiment.transcripts();
+  if (s.indexSeqHash != experiment.getIndexSeqHash() or
+      s.logMasses.size() != transcripts.size()) {
+    log->error("The checkpoint was taken against another index.");
+    return false;
+  }
+  if (s.readFiles != experiment.readFilesAsString()) {
+    log->error("The checkpoint was taken over other reads ({}).", s.readFiles);
+    return false;
+  }
+
+  for (size_t i = 0; i < transcripts.size(); ++i) {
+    auto& t = transcripts[i];
+    t.setMass(s.logMasses[i]);
+    t.addUniqueCount(s.uniqueCounts[i]);
+    t.addTotalCount(s.totalCounts[i]);
+    t.setLastTimestepUpdated(s.lastTimesteps[i]);
+    t.setCachedLogEffectiveLength(s.logEffLengths[i]);
+  }
+  experiment.clusterForest().loadState(s.clusterParents, s.clusterCounts,
+                                       s.clusterLogMasses);
+  experiment.fragmentLengthDistribution()->loadState(
+      s.fldLogHist, s.fldLogTotMass, s.fldLogSum, s.fldMin);
+  fmCalc.setCurrentTimestep(s.miniBatchTimestep);
+
+  auto& eqBuilder = experiment.equivalenceClassBuilder();
+  std::vector<uint32_t> txps;
+  std::vector<double> weights;
+  for (size_t i = 0; i + 1 < s.eqOffsets.size(); ++i) {
+    txps.assign(s.eqTxps.begin() + s.eqOffsets[i],
+                s.eqTxps.begin() + s.eqOffsets[i + 1]);
+    weights.assign(s.eqWeights.begin() + s.eqWeightOffsets[i],
+                   s.eqWeights.begin() + s.eqWeightOffsets[i + 1]);
+    TranscriptGroup g(txps);
+    eqBuilder.addGroupInPlace(g, weights, s.eqCounts[i]);
+  }
+  experiment.numAssignedFragmentsAtomic().store(s.numAssignedFragments);
+  return true;
+}
+
+Checkpointer::Checkpointer(const boost::filesystem::path& path,
+                           uint64_t interval,
+                           std::shared_ptr<spdlog::logger> log)
+    : path_(path), interval_(interval), log_(log), nextDue_(interval) {
+  writer_ = std::thread([this]() { writerLoop_(); });
+}
+
+Checkpointer::~Checkpointer() { finish(); }
+
+uint64_t Checkpointer::beginLibrary(uint32_t numThreads,
+                                    uint64_t numObservedFragments,
+                                    SnapshotFn snapshotFn) {
+  std::lock_guard<std::mutex> lock(mut_);
+  uint32_t library = libraryIndex_++;
+  numActive_ = numThreads;
+  numParked_ = 0;
+  snapshotFn_ = std::move(snapshotFn);
+  uint64_t skip{0};
+  if (library < resumeLibraries_) {
+    skip = ~uint64_t(0);
+  } else if (library == resumeLibraries_) {
+    skip = resumeFragments_;
+  }
+  libraryStart_ =
+      (skip == ~uint64_t(0)) ? numObservedFragments : numObservedFragments - skip;
+  return skip;
+}
+
+void Checkpointer::resumeFrom(const Snapshot& s) {
+  std::lock_guard<std::mutex> lock(mut_);
+  resumeLibraries_ = s.numLibrariesDone;
+  resumeFragments_ = s.numLibraryFragments;
+  nextDue_ = s.numObservedFragments + interval_;
+}
+
+void Checkpointer::park_() {
+  std::unique_lock<std::mutex> lock(mut_);
+  auto gen = generation_;
+  ++numParked_;
+  if (numParked_ == numActive_) {
+    takeLocked_();
+    return;
+  }
+  parked_.wait(lock, [this, gen]() { return generation_ != gen; });
+}
+
+void Checkpointer::leave() {
+  std::lock_guard<std::mutex> lock(mut_);
+  --numActive_;
+  if (numParked_ > 0 and numParked_ == numActive_) {
+    takeLocked_();
+  }
+}
+
+void Checkpointer::takeLocked_() {
+  std::unique_ptr<Snapshot> s(new Snapshot);
+  snapshotFn_(*s);
+  s->numLibrariesDone = libraryIndex_ - 1;
+  s->numLibraryFragments = s->numObservedFragments - libraryStart_;
+  nextDue_ = s->numObservedFragments + interval_;
+  ++numTaken_;
+  {
+    // (replaces a snapshot that is still waiting to be written)
+    std::lock_guard<std::mutex> wlock(writeMut_);
+    pending_ = std::move(s);
+  }
+  writeCond_.notify_one();
+
+  numParked_ = 0;
+  ++generation_;
+  parked_.notify_all();
+}
+
+void Checkpointer::writerLoop_() {
+  namespace bfs = boost::filesystem;
+  std::unique_lock<std::mutex> lock(writeMut_);
+  while (true) {
+    writeCond_.wait(lock, [this]() { return pending_ or stopWriter_; });
+    if (!pending_) {
+      return;
+    }
+    std::unique_ptr<Snapshot> s = std::move(pending_);
+    writing_ = true;
+    lock.unlock();
+
+    bfs::path tmpPath = path_;
+    tmpPath += ".tmp";
+    bool ok = write(tmpPath, *s);
+    boost::system::error_code ec;
+    if (ok) {
+      bfs::rename(tmpPath, path_, ec);
+      ok = !ec;
+    }
+    if (ok) {
+      log_->info("Wrote a checkpoint after {} fragments to {}",
+                 s->numObservedFragments, path_.string());
+    } else {
+      log_->warn("Couldn't write the checkpoint {}", path_.string());
+    }
+
+    lock.lock();
+    writing_ = false;
+    writeOK_ = writeOK_ and ok;
+    writeCond_.notify_all();
+  }
+}
+
+bool Checkpointer::finish() {
+  {
+    std::unique_lock<std::mutex> lock(writeMut_);
+    writeCond_.wait(lock, [this]() { return !pending_ and !writing_; });
+    stopWriter_ = true;
+  }
+  writeCond_.notify_all();
+  if (writer_.joinable()) {
+    writer_.join();
+  }
+  return writeOK_;
+}
+
+} // namespace checkpoint
+} // namespace salmon
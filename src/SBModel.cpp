@@ -111,6 +111,59 @@ bool SBModel::writeBinary(boost::iostreams::filtering_ostream& out) const {
   return true;
 }
 
+bool SBModel::readBinary(boost::iostreams::filtering_istream& in) {
+  int32_t contextLength{0}, contextLeft{0}, contextRight{0};
+  in.read(reinterpret_cast<char*>(&contextLength), sizeof(int32_t));
+  in.read(reinterpret_cast<char*>(&contextLeft), sizeof(int32_t));
+  in.read(reinterpret_cast<char*>(&contextRight), sizeof(int32_t));
+  if (!in or contextLength != _contextLength or contextLeft != _contextLeft or
+      contextRight != _contextRight) {
+    return false;
+  }
+  std::vector<int32_t> order(_contextLength), shifts(_contextLength),
+      widths(_contextLength);
+  in.read(reinterpret_cast<char*>(order.data()),
+          _contextLength * sizeof(int32_t));
+  in.read(reinterpret_cast<char*>(shifts.data()),
+          _contextLength * sizeof(int32_t));
+  in.read(reinterpret_cast<char*>(widths.data()),
+          _contextLength * sizeof(int32_t));
+  if (!in or order != _order or shifts != _shifts or widths != _widths) {
+    return false;
+  }
+
+  using Index = typename Eigen::MatrixXd::Index;
+  using Scalar = typename Eigen::MatrixXd::Scalar;
+  Index prows{0}, pcols{0};
+  in.read(reinterpret_cast<char*>(&prows), sizeof(Index));
+  in.read(reinterpret_cast<char*>(&pcols), sizeof(Index));
+  if (!in or prows != _probs.rows() or pcols != _probs.cols()) {
+    return false;
+  }
+  Eigen::MatrixXd probs(prows, pcols);
+  in.read(reinterpret_cast<char*>(probs.data()),
+          prows * pcols * sizeof(Scalar));
+
+  Index mrows{0}, mcols{0};
+  in.read(reinterpret_cast<char*>(&mrows), sizeof(Index));
+  in.read(reinterpret_cast<char*>(&mcols), sizeof(Index));
+  if (!in or mrows != _marginals.rows() or mcols != _marginals.cols()) {
+    return false;
+  }
+  Eigen::MatrixXd marginals(mrows, mcols);
+  in.read(reinterpret_cast<char*>(marginals.data()),
+          mrows * mcols * sizeof(Scalar));
+  if (!in) {
+    return false;
+  }
+
+  // The model was written once normalized (its probabilities logged)
+  _probs = std::move(probs);
+  _marginals = std::move(marginals);
+  _trained = true;
+  return true;
+}
+
 double SBModel::evaluateLog(const char* seqIn) {
   double p = 0;
   Mer mer;
@@ -133,6 +186,21 @@ double SBModel::evaluateLog(const Mer& mer) {
   return p;
 }
 
+SBModelRatio::SBModelRatio(const SBModel& num, const SBModel& den)
+    : contextBits_(2 * num._contextLength) {
+  positions_.reserve(num._contextLength);
+  for (int32_t i = 0; i < num._contextLength; ++i) {
+    Position c;
+    c.offset = static_cast<uint32_t>(table_.size());
+    c.shift = static_cast<uint32_t>(num._shifts[i]);
+    c.mask = (uint64_t(1) << num._widths[i]) - 1;
+    positions_.push_back(c);
+    for (uint64_t idx = 0; idx <= c.mask; ++idx) {
+      table_.emplace_back(num._probs(idx, i), den._probs(idx, i));
+    }
+  }
+}
+
 /** inlined member functions
 
 inline int32_t SBModel::contextBefore(bool rc);
@@ -190,6 +258,53 @@ bool SBModel::addSequence(const char* seqIn, bool revCmp, double weight) {
   return addSequence(_mer, weight);
 }
 
+namespace {
+// The 2-bit code of each base (-1 for anything but A, C, G and T)
+struct BaseCodes {
+  int8_t code[256];
+  BaseCodes() {
+    for (size_t i = 0; i < 256; ++i) {
+      code[i] = -1;
+    }
+    code['A'] = code['a'] = 0;
+    code['C'] = code['c'] = 1;
+    code['G'] = code['g'] = 2;
+    code['T'] = code['t'] = 3;
+  }
+};
+const BaseCodes baseCodes;
+} // namespace
+
+bool SBModel::encodeContext(const char* seq, int32_t len, int32_t pos,
+                            bool rc, uint64_t& code) const {
+  int32_t before = rc ? _contextRight : _contextLeft;
+  int32_t after = rc ? _contextLeft : _contextRight;
+  if (pos < before or pos + after >= len) {
+    return false;
+  }
+  const unsigned char* s =
+      reinterpret_cast<const unsigned char*>(seq + pos - before);
+  uint64_t w{0};
+  int8_t bad{0};
+  if (!rc) {
+    for (int32_t i = 0; i < _contextLength; ++i) {
+      int8_t c = baseCodes.code[s[i]];
+      bad |= c;
+      w = (w << 2) | static_cast<uint64_t>(c & 0x3);
+    }
+  } else {
+    // the reverse complement: the bases from last to first, complemented
+    for (int32_t i = _contextLength - 1; i >= 0; --i) {
+      int8_t c = baseCodes.code[s[i]];
+      bad |= c;
+      w = (w << 2) | static_cast<uint64_t>(3 - (c & 0x3));
+    }
+  }
+  // (bad is negative iff some base had code -1)
+  code = w;
+  return bad >= 0;
+}
+
 bool SBModel::addSequence(const Mer& mer, double weight) {
   for (int32_t i = 0; i < _contextLength; ++i) {
     uint64_t idx = mer.get_bits(_shifts[i], _widths[i]);
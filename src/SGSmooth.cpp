@@ -19,6 +19,9 @@
 #include <cmath>   // for fabs
 #include <cstddef> // for size_t
 #include <cstdio>
+#include <map>
+#include <mutex>
+#include <utility>
 #include <vector>
 
 //! default convergence
@@ -373,14 +376,50 @@ static float_vect sg_coeff(const float_vect& b, const size_t deg) {
   return res;
 }
 
+//! the sg-coefficients of the windows of one (width, degree).
+struct sg_coeffs {
+  //! those of the border windows: for the i-th point from either end
+  std::vector<float_vect> border;
+  //! the "symmetric" ones, for every other point
+  float_vect center;
+};
+
+/*! the sg-coefficients of (width, deg).  They depend only on those, so
+ * they are fit once and kept, and each smoothing is just the sliding
+ * dot products. */
+static const sg_coeffs& sg_coeff_cache(const int width, const int deg) {
+  static std::mutex cacheMutex;
+  // (std::map never moves its elements, so the references stay valid)
+  static std::map<std::pair<int, int>, sg_coeffs> cache;
+
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  auto key = std::make_pair(width, deg);
+  auto it = cache.find(key);
+  if (it == cache.end()) {
+    const int window = 2 * width + 1;
+    sg_coeffs coeffs;
+    for (int i = 0; i < width; ++i) {
+      float_vect b1(window, 0.0);
+      b1[i] = 1.0;
+      coeffs.border.push_back(sg_coeff(b1, deg));
+    }
+    float_vect b2(window, 0.0);
+    b2[width] = 1.0;
+    coeffs.center = sg_coeff(b2, deg);
+    it = cache.insert(std::make_pair(key, std::move(coeffs))).first;
+  }
+  return it->second;
+}
+
 /*! \brief savitzky golay smoothing.
  *
  * This method means fitting a polynome of degree 'deg' to a sliding window
  * of width 2w+1 throughout the data.  The needed coefficients are
- * generated dynamically by doing a least squares fit on a "symmetric" unit
+ * generated by doing a least squares fit on a "symmetric" unit
  * vector of size 2w+1, e.g. for w=2 b=(0,0,1,0,0). evaluating the polynome
  * yields the sg-coefficients.  at the border non symmectric vectors b are
- * used. */
+ * used.  The coefficients of each (w, deg) are only generated once (see
+ * sg_coeff_cache). */
 float_vect sg_smooth(const float_vect& v, const int width, const int deg) {
   float_vect res(v.size(), 0.0);
   if ((width < 1) || (deg < 0) || (v.size() < (2 * width + 2))) {
@@ -421,15 +460,14 @@ float_vect sg_smooth(const float_vect& v, const int width, const int deg) {
     return res;
   }
 
+  const sg_coeffs& coeffs = sg_coeff_cache(width, deg);
+
 // handle border cases first because we need different coefficients
 #if defined(_OPENMP)
 #pragma omp parallel for private(i, j) schedule(static)
 #endif
   for (i = 0; i < width; ++i) {
-    float_vect b1(window, 0.0);
-    b1[i] = 1.0;
-
-    const float_vect c1(sg_coeff(b1, deg));
+    const float_vect& c1 = coeffs.border[i];
     for (j = 0; j < window; ++j) {
       res[i] += c1[j] * v[j];
       res[endidx - i] += c1[j] * v[endidx - j];
@@ -437,9 +475,7 @@ float_vect sg_smooth(const float_vect& v, const int width, const int deg) {
   }
 
   // now loop over rest of data. reusing the "symmetric" coefficients.
-  float_vect b2(window, 0.0);
-  b2[width] = 1.0;
-  const float_vect c2(sg_coeff(b2, deg));
+  const float_vect& c2 = coeffs.center;
 
 #if defined(_OPENMP)
 #pragma omp parallel for private(i, j) schedule(static)
@@ -42,6 +42,7 @@
 // C++ string formatting library
 #include "spdlog/fmt/fmt.h"
 
+#include "CPUDispatch.hpp"
 #include "GenomicFeature.hpp"
 #include "SalmonConfig.hpp"
 #include "VersionChecker.hpp"
@@ -57,9 +58,13 @@ int help(std::vector<std::string> opts) { //}int argc, char* argv[]) {
   helpMsg.write("Commands:\n");
   helpMsg.write("     index Create a salmon index\n");
   helpMsg.write("     quant Quantify a sample\n");
+  helpMsg.write("     serve Quantify many samples against one loaded index\n");
   helpMsg.write("     swim  Perform super-secret operation\n");
   helpMsg.write(
       "     quantmerge Merge multiple quantifications into a single file\n");
+  helpMsg.write("     merge-partials Optimize the merged partial results "
+                "(--writePartial)\n"
+                "                    of the shards of one sample\n");
 
   std::cerr << helpMsg.str();
   return 0;
@@ -147,6 +152,11 @@ int salmonIndex(int argc, char* argv[]);
 int salmonQuantify(int argc, char* argv[]);
 int salmonAlignmentQuantify(int argc, char* argv[]);
 int salmonQuantMerge(int argc, char* argv[]);
+int salmonServe(int argc, char* argv[]);
+int salmonMergePartials(int argc, char* argv[]);
+int salmonQuantBatch(int argc, char* argv[]);
+int salmonQuantMultiIndex(int argc, char* argv[]);
+int salmonQuantFromEq(int argc, char* argv[]);
 
 bool verbose = false;
 
@@ -154,6 +164,9 @@ int main(int argc, char* argv[]) {
   using std::string;
   namespace po = boost::program_options;
 
+  // Choose the variants of the hot kernels for this CPU
+  salmon::cpu::init();
+
   // With no arguments, print help
   if (argc == 1) {
     std::vector<std::string> o;
@@ -206,8 +219,7 @@ int main(int argc, char* argv[]) {
     }
 
     if (!vm.count("no-version-check")) {
-      std::string versionMessage = getVersionMessage();
-      std::cerr << versionMessage;
+      std::cerr << cachedVersionMessage();
     }
 
     // po::notify(vm);
@@ -226,6 +238,8 @@ int main(int argc, char* argv[]) {
         {{"index", salmonIndex},
          {"quant", salmonQuantify},
          {"quantmerge", salmonQuantMerge},
+         {"merge-partials", salmonMergePartials},
+         {"serve", salmonServe},
          {"swim", salmonSwim}});
 
     /*
@@ -278,8 +292,37 @@ int main(int argc, char* argv[]) {
             break;
           }
         }
+        bool useBatch{false};
+        for (size_t i = 0; i < subCommandArgc; ++i) {
+          if (strncmp(argv2[i], "--batch", 7) == 0 and
+              strncmp(argv2[i], "--batchJobs", 11) != 0) {
+            useBatch = true;
+            break;
+          }
+        }
+        size_t numIndices{0};
+        for (size_t i = 0; i < subCommandArgc; ++i) {
+          if (strcmp(argv2[i], "-i") == 0 or
+              strcmp(argv2[i], "--index") == 0 or
+              strncmp(argv2[i], "--index=", 8) == 0) {
+            ++numIndices;
+          }
+        }
+        bool useFromEq{false};
+        for (size_t i = 0; i < subCommandArgc; ++i) {
+          if (strcmp(argv2[i], "--fromEq") == 0) {
+            useFromEq = true;
+            break;
+          }
+        }
         if (useSalmonAlign) {
           return salmonAlignmentQuantify(subCommandArgc, argv2.get());
+        } else if (numIndices > 1) {
+          return salmonQuantMultiIndex(subCommandArgc, argv2.get());
+        } else if (useBatch) {
+          return salmonQuantBatch(subCommandArgc, argv2.get());
+        } else if (useFromEq) {
+          return salmonQuantFromEq(subCommandArgc, argv2.get());
         } else {
           return salmonQuantify(subCommandArgc, argv2.get());
         }
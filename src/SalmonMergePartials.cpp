@@ -0,0 +1,203 @@
+/**
+>HEADER
+    Copyright (c) 2013, 2014, 2015, 2016 Rob Patro rob.patro@cs.stonybrook.edu
+
+    This file is part of Salmon.
+
+    Salmon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Salmon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Salmon.  If not, see <http://www.gnu.org/licenses/>.
+<HEADER
+**/
+
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include "tbb/task_scheduler_init.h"
+
+// logger includes
+#include "spdlog/spdlog.h"
+
+#include "CollapsedEMOptimizer.hpp"
+#include "GZipWriter.hpp"
+#include "PartialExperiment.hpp"
+#include "SalmonOpts.hpp"
+
+/**
+ * salmon merge-partials : merge the partial results (quant --writePartial)
+ * of the runs over the shards of one sample's reads, and run the offline
+ * optimization (and the bootstraps) once, over the merged equivalence
+ * classes, as if the sample had been quantified in a single run.
+ */
+int salmonMergePartials(int argc, char* argv[]) {
+  using std::string;
+  using std::vector;
+  namespace bfs = boost::filesystem;
+  namespace po = boost::program_options;
+
+  vector<string> partialDirs;
+  string outputName;
+  SalmonOpts sopt;
+  // Only the options that matter to the offline phase; the others are set to
+  // the defaults of salmon quant.
+  po::options_description generic("\n"
+                                  "basic options");
+  generic.add_options()("version,v", "print version string")(
+      "help,h", "produce help message")(
+      "partials",
+      po::value<vector<string>>(&partialDirs)->multitoken()->required(),
+      "The partial directories (<quant output>/partial) to merge; these must "
+      "all have been quantified against the same index.")(
+      "output,o", po::value<string>(&outputName)->required(),
+      "Output quantification directory.")(
+      "threads,p",
+      po::value<uint32_t>(&sopt.numThreads)
+          ->default_value(std::thread::hardware_concurrency()),
+      "The number of threads used by the optimization.")(
+      "useVBOpt", po::bool_switch(&sopt.useVBOpt)->default_value(false),
+      "Use the Variational Bayesian EM rather than the \"standard\" EM.")(
+      "numBootstraps",
+      po::value<uint32_t>(&sopt.numBootstraps)->default_value(0),
+      "The number of bootstrap samples to draw from the merged equivalence "
+      "classes.")(
+      "approxVariance",
+      po::bool_switch(&sopt.approxVariance)->default_value(false),
+      "Also write quant_var.sf, with the delta-method (approximate) standard "
+      "deviations and 95% intervals of the merged estimates.")(
+      "seed", po::value<uint64_t>(&sopt.samplerSeed)->default_value(0),
+      "The seed of the bootstrap sampler (0 draws one at random).")(
+      "writeQuantBin",
+      po::bool_switch(&sopt.writeQuantBin)->default_value(false),
+      "Also write the abundances of quant.sf to quant.bin.")(
+      "sparseQuant", po::bool_switch(&sopt.sparseQuant)->default_value(false),
+      "Only list the transcripts with reads in quant.sf.");
+
+  po::options_description visible("salmon merge-partials options");
+  visible.add(generic);
+
+  po::variables_map vm;
+  try {
+    auto orderedOptions =
+        po::command_line_parser(argc, argv).options(visible).run();
+    po::store(orderedOptions, vm);
+
+    if (vm.count("help")) {
+      auto hstring = R"(
+merge-partials
+==============
+Merge the partial results (salmon quant --writePartial) of
+the shards of one sample, and quantify the merged sample.
+)";
+      std::cerr << hstring << std::endl;
+      std::cerr << visible << std::endl;
+      std::exit(0);
+    }
+    po::notify(vm);
+  } catch (po::error& e) {
+    std::cerr << "Exception : [" << e.what() << "]. Exiting.\n";
+    std::exit(1);
+  }
+
+  auto consoleSink =
+      std::make_shared<spdlog::sinks::ansicolor_stdout_sink_mt>();
+  auto jointLog = spdlog::create("mergePartialsLog", {consoleSink});
+
+  // The offline phase reads these, and quant sets them from its options
+  sopt.jointLog = jointLog;
+  sopt.outputDirectory = outputName;
+  sopt.auxDir = "aux_info";
+  sopt.useQuasi = true;
+  sopt.allowOrphans = false;
+  sopt.alternativeInitMode = false;
+  sopt.meta = false;
+  sopt.useFSPD = false;
+  sopt.noRichEqClasses = false;
+  sopt.noEffectiveLengthCorrection = false;
+  sopt.noLengthCorrection = false;
+  sopt.numRequiredFragments = 50000000;
+  sopt.quiet = false;
+  sopt.biasCorrect = false;
+  sopt.gcBiasCorrect = false;
+  sopt.posBiasCorrect = false;
+
+  bfs::path outputDirectory(outputName);
+  bfs::path paramsDirectory = outputDirectory / "libParams";
+  boost::system::error_code ec;
+  bfs::create_directories(paramsDirectory, ec);
+  if (ec) {
+    jointLog->error("Could not create the output directory {}",
+                    paramsDirectory.string());
+    return 1;
+  }
+
+  tbb::task_scheduler_init tbbScheduler(sopt.numThreads);
+
+  PartialExperiment experiment(jointLog);
+  for (auto& d : partialDirs) {
+    if (!experiment.add(d, jointLog.get())) {
+      return 1;
+    }
+  }
+  experiment.finish();
+  jointLog->info("merged {} partials ({} mapped fragments)",
+                 experiment.numPartials(), experiment.numMappedFragments());
+
+  CollapsedEMOptimizer optimizer;
+  jointLog->info("Starting optimizer");
+  if (!optimizer.optimize(experiment, sopt, 0.01, 10000)) {
+    jointLog->error("The optimization algorithm failed on the merged "
+                    "partials.");
+    return 1;
+  }
+  jointLog->info("Finished optimizer");
+
+  GZipWriter gzw(outputDirectory, jointLog);
+  gzw.writeAbundances(sopt, experiment);
+  if (sopt.approxVariance) {
+    std::vector<double> variances;
+    if (!optimizer.approximateVariances(experiment, sopt, variances) or
+        !gzw.writeVariances(sopt, experiment, variances)) {
+      return 1;
+    }
+  }
+  if (!experiment.writeFragLengthDist(paramsDirectory / "flenDist.txt")) {
+    jointLog->warn("Couldn't write {}",
+                   (paramsDirectory / "flenDist.txt").string());
+  }
+
+  if (sopt.numBootstraps > 0) {
+    if (!gzw.setSamplingPath(sopt)) {
+      return 1;
+    }
+    std::function<bool(const std::vector<double>&)> bsWriter =
+        [&gzw](const std::vector<double>& alphas) -> bool {
+      return gzw.writeBootstrap(alphas);
+    };
+    jointLog->info("Starting Bootstrapping");
+    if (!optimizer.gatherBootstraps(experiment, sopt, bsWriter,
+                                    sopt.bootstrapRelDiffTolerance, 10000) or
+        !gzw.finishSamples()) {
+      jointLog->error("Encountered error during bootstrapping.");
+      return 1;
+    }
+    jointLog->info("Finished Bootstrapping");
+  }
+  jointLog->flush();
+  return 0;
+}
@@ -0,0 +1,274 @@
+/**
+>HEADER
+    Copyright (c) 2013, 2014, 2015, 2016 Rob Patro rob.patro@cs.stonybrook.edu
+
+    This file is part of Salmon.
+
+    Salmon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Salmon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Salmon.  If not, see <http://www.gnu.org/licenses/>.
+<HEADER
+**/
+
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include "tbb/task_scheduler_init.h"
+
+// logger includes
+#include "spdlog/spdlog.h"
+
+#include "CollapsedEMOptimizer.hpp"
+#include "CollapsedGibbsSampler.hpp"
+#include "GZipWriter.hpp"
+#include "InferenceSweep.hpp"
+#include "PartialExperiment.hpp"
+#include "SalmonOpts.hpp"
+#include "SalmonUtils.hpp"
+
+/**
+ * salmon quant --fromEq : quantify a sample again from the output of an
+ * earlier salmon quant run over it (with --dumpEq --dumpEqWeights), i.e.
+ * run only the offline phase (the optimization, the bootstraps or Gibbs
+ * samples and the gene-level estimates), e.g. with other VB priors or
+ * number of samples, without mapping the reads again.  The effective
+ * lengths are the (bias-corrected, if it was) final ones of that run.
+ */
+int salmonQuantFromEq(int argc, char* argv[]) {
+  using std::string;
+  namespace bfs = boost::filesystem;
+  namespace po = boost::program_options;
+
+  string inputName;
+  string outputName;
+  string inputAuxDir;
+  SalmonOpts sopt;
+  // Only the options that matter to the offline phase; the others are set to
+  // the defaults of salmon quant.
+  po::options_description generic("\n"
+                                  "basic options");
+  generic.add_options()("version,v", "print version string")(
+      "help,h", "produce help message")(
+      "fromEq", po::value<string>(&inputName)->required(),
+      "The output directory of the salmon quant run (with --dumpEq and "
+      "--dumpEqWeights) to quantify again.")(
+      "fromEqAuxDir",
+      po::value<string>(&inputAuxDir)->default_value("aux_info"),
+      "The name of the auxiliary directory of that run (its --auxDir).")(
+      "output,o", po::value<string>(&outputName)->required(),
+      "Output quantification directory.")(
+      "threads,p",
+      po::value<uint32_t>(&sopt.numThreads)
+          ->default_value(std::thread::hardware_concurrency()),
+      "The number of threads used by the optimization.")(
+      "useVBOpt", po::bool_switch(&sopt.useVBOpt)->default_value(false),
+      "Use the Variational Bayesian EM rather than the \"standard\" EM.")(
+      "vbPrior", po::value<double>(&sopt.vbPrior)->default_value(1e-3),
+      "The prior that will be used in the VBEM algorithm (per-nucleotide, "
+      "unless --perTranscriptPrior is given).")(
+      "perTranscriptPrior", po::bool_switch(&sopt.perTranscriptPrior),
+      "Interpret --vbPrior as a transcript-level prior.")(
+      "numBootstraps",
+      po::value<uint32_t>(&sopt.numBootstraps)->default_value(0),
+      "The number of bootstrap samples to draw from the equivalence "
+      "classes.")(
+      "numGibbsSamples",
+      po::value<uint32_t>(&sopt.numGibbsSamples)->default_value(0),
+      "The number of Gibbs samples to draw (exclusive of --numBootstraps).")(
+      "thinningFactor",
+      po::value<uint32_t>(&sopt.thinningFactor)->default_value(16),
+      "Number of steps to discard for every sample kept from the Gibbs "
+      "chain.")(
+      "seed", po::value<uint64_t>(&sopt.samplerSeed)->default_value(0),
+      "The seed of the bootstrap and Gibbs samplers (0 draws one at "
+      "random).")(
+      "approxVariance",
+      po::bool_switch(&sopt.approxVariance)->default_value(false),
+      "Also write quant_var.sf, with the delta-method (approximate) standard "
+      "deviations and 95% intervals of the estimates.")(
+      "geneMap,g", po::value<string>(),
+      "File containing a mapping of transcripts to genes (as for salmon "
+      "quant); quant.genes.sf is then written too.")(
+      "writeQuantBin",
+      po::bool_switch(&sopt.writeQuantBin)->default_value(false),
+      "Also write the abundances of quant.sf to quant.bin.")(
+      "sparseQuant", po::bool_switch(&sopt.sparseQuant)->default_value(false),
+      "Only list the transcripts with reads in quant.sf.")(
+      "sweep", po::value<string>(&sopt.sweepFile),
+      "Also quantify the sample with each of the inference configurations "
+      "in this file (as for salmon quant --sweep).");
+
+  po::options_description visible("salmon quant --fromEq options");
+  visible.add(generic);
+
+  po::variables_map vm;
+  try {
+    auto orderedOptions =
+        po::command_line_parser(argc, argv).options(visible).run();
+    po::store(orderedOptions, vm);
+
+    if (vm.count("help")) {
+      auto hstring = R"(
+quant --fromEq
+==============
+Quantify a sample again from the equivalence classes that an
+earlier run of salmon quant (--dumpEq --dumpEqWeights) wrote.
+)";
+      std::cerr << hstring << std::endl;
+      std::cerr << visible << std::endl;
+      std::exit(0);
+    }
+    po::notify(vm);
+  } catch (po::error& e) {
+    std::cerr << "Exception : [" << e.what() << "]. Exiting.\n";
+    std::exit(1);
+  }
+
+  if (sopt.numBootstraps > 0 and sopt.numGibbsSamples > 0) {
+    std::cerr << "You cannot perform both Gibbs sampling and bootstrapping. "
+                 "Please choose one.\n";
+    std::exit(1);
+  }
+  if (vm.count("geneMap")) {
+    sopt.geneMapPath = vm["geneMap"].as<string>();
+    if (!bfs::exists(sopt.geneMapPath)) {
+      std::cerr << "Could not find transcript <=> gene map file "
+                << sopt.geneMapPath << "\n";
+      std::exit(1);
+    }
+  }
+
+  auto consoleSink =
+      std::make_shared<spdlog::sinks::ansicolor_stdout_sink_mt>();
+  // (the gene-level estimates log to "jointLog")
+  auto jointLog = spdlog::create("jointLog", {consoleSink});
+
+  // The offline phase reads these, and quant sets them from its options
+  sopt.jointLog = jointLog;
+  sopt.outputDirectory = outputName;
+  sopt.auxDir = "aux_info";
+  sopt.useQuasi = true;
+  sopt.allowOrphans = false;
+  sopt.alternativeInitMode = false;
+  sopt.meta = false;
+  sopt.useFSPD = false;
+  sopt.noRichEqClasses = false;
+  sopt.noEffectiveLengthCorrection = false;
+  sopt.noLengthCorrection = false;
+  sopt.numRequiredFragments = 50000000;
+  sopt.quiet = false;
+  sopt.biasCorrect = false;
+  sopt.gcBiasCorrect = false;
+  sopt.posBiasCorrect = false;
+
+  bfs::path outputDirectory(outputName);
+  bfs::path paramsDirectory = outputDirectory / "libParams";
+  boost::system::error_code ec;
+  bfs::create_directories(paramsDirectory, ec);
+  if (ec) {
+    jointLog->error("Could not create the output directory {}",
+                    paramsDirectory.string());
+    return 1;
+  }
+
+  tbb::task_scheduler_init tbbScheduler(sopt.numThreads);
+
+  PartialExperiment experiment(jointLog);
+  if (!experiment.addQuantOutput(inputName, inputAuxDir, jointLog.get())) {
+    return 1;
+  }
+  experiment.finish();
+
+  salmon::sweep::Sweep sweep;
+  if (!sopt.sweepFile.empty()) {
+    if (!sweep.load(sopt.sweepFile, sopt, jointLog.get())) {
+      return 1;
+    }
+    sweep.saveInitialEstimates(experiment);
+  }
+
+  CollapsedEMOptimizer optimizer;
+  jointLog->info("Starting optimizer");
+  if (!optimizer.optimize(experiment, sopt, 0.01, 10000)) {
+    jointLog->error("The optimization algorithm failed on the equivalence "
+                    "classes of {}.",
+                    inputName);
+    return 1;
+  }
+  jointLog->info("Finished optimizer");
+
+  GZipWriter gzw(outputDirectory, jointLog);
+  gzw.writeAbundances(sopt, experiment);
+  if (sopt.approxVariance) {
+    std::vector<double> variances;
+    if (!optimizer.approximateVariances(experiment, sopt, variances) or
+        !gzw.writeVariances(sopt, experiment, variances)) {
+      return 1;
+    }
+  }
+  if (vm.count("geneMap")) {
+    try {
+      salmon::utils::generateGeneLevelEstimates(
+          sopt.geneMapPath, outputDirectory, experiment,
+          sopt.geneMapCacheDirectory);
+    } catch (std::invalid_argument& e) {
+      jointLog->error("[{}] when trying to compute gene-level estimates",
+                      e.what());
+    }
+  }
+  if (!experiment.writeFragLengthDist(paramsDirectory / "flenDist.txt")) {
+    jointLog->warn("Couldn't write {}",
+                   (paramsDirectory / "flenDist.txt").string());
+  }
+
+  if (sopt.numGibbsSamples > 0 or sopt.numBootstraps > 0) {
+    if (!gzw.setSamplingPath(sopt)) {
+      return 1;
+    }
+    bool gibbs = (sopt.numGibbsSamples > 0);
+    std::function<bool(const std::vector<double>&)> sampleWriter =
+        [&gzw, gibbs](const std::vector<double>& alphas) -> bool {
+      return gzw.writeBootstrap(alphas, gibbs);
+    };
+    bool sampled{false};
+    if (gibbs) {
+      jointLog->info("Starting Gibbs Sampler");
+      CollapsedGibbsSampler sampler;
+      sampled = sampler.sample(experiment, sopt, sampleWriter,
+                               sopt.numGibbsSamples);
+    } else {
+      jointLog->info("Starting Bootstrapping");
+      sampled = optimizer.gatherBootstraps(experiment, sopt, sampleWriter,
+                                           sopt.bootstrapRelDiffTolerance,
+                                           10000);
+    }
+    if (!sampled or !gzw.finishSamples()) {
+      jointLog->error("Encountered error during {}.",
+                      gibbs ? "Gibbs sampling" : "bootstrapping");
+      return 1;
+    }
+    jointLog->info("Finished {}", gibbs ? "Gibbs Sampler" : "Bootstrapping");
+  }
+
+  if (!sweep.empty() and !sweep.run(experiment, sopt, outputDirectory)) {
+    return 1;
+  }
+  jointLog->flush();
+  return 0;
+}
@@ -21,13 +21,35 @@
 
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <memory>
-// C++ string formatting library #include "spdlog/fmt/fmt.h"
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+#include <boost/iostreams/device/file.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <zlib.h>
+
+#include "cereal/archives/json.hpp"
+
+#include "tbb/blocked_range.h"
+#include "tbb/parallel_for.h"
+#include "tbb/task_scheduler_init.h"
+
+// C++ string formatting library
+#include "spdlog/fmt/fmt.h"
 // logger includes
 #include "spdlog/spdlog.h"
 
+#include "SalmonLogging.hpp"
+#include "SampleEncoding.hpp"
+#include "xxhash.h"
+
 enum class TargetColumn { LEN, ELEN, TPM, NREADS };
 
 class QuantMergeOptions {
@@ -35,7 +57,15 @@ public:
   std::vector<std::string> samples;
   std::vector<std::string> names;
   std::string outputName;
+  std::string binaryOutputName;
+  std::string bootstrapSummaryName;
   std::string outputCol;
+  std::string quantileList;
+  std::vector<double> quantiles;
+  // quant.sf, or quant.genes.sf with --genes
+  std::string quantFileName{"quant.sf"};
+  bool genes{false};
+  uint32_t numThreads;
   std::shared_ptr<spdlog::logger> log;
   TargetColumn tcol;
 
@@ -60,6 +90,12 @@ public:
     }
     log->info("output column : {}", outputCol);
     log->info("output file : {}", outputName);
+    if (!binaryOutputName.empty()) {
+      log->info("binary output file : {}", binaryOutputName);
+    }
+    if (!bootstrapSummaryName.empty()) {
+      log->info("replicate summary file : {}", bootstrapSummaryName);
+    }
   }
 };
 
@@ -83,6 +119,29 @@ bool validateOptions(boost::program_options::variables_map& vm,
     }
   }
 
+  if (qmOpts.numThreads == 0) {
+    qmOpts.numThreads = 1;
+  }
+  if (qmOpts.genes) {
+    qmOpts.quantFileName = "quant.genes.sf";
+  }
+
+  if (!qmOpts.bootstrapSummaryName.empty()) {
+    std::stringstream ss(qmOpts.quantileList);
+    std::string q;
+    while (std::getline(ss, q, ',')) {
+      char* end;
+      double p = std::strtod(q.c_str(), &end);
+      if (q.empty() or *end != '\0' or !(p >= 0.0 and p <= 1.0)) {
+        log->critical("The quantiles should be a comma-separated list of "
+                      "numbers between 0 and 1, but I found {}",
+                      q);
+        std::exit(1);
+      }
+      qmOpts.quantiles.push_back(p);
+    }
+  }
+
   std::transform(qmOpts.outputCol.begin(), qmOpts.outputCol.end(),
                  qmOpts.outputCol.begin(),
                  [](unsigned char c) { return std::toupper(c); });
@@ -109,96 +168,431 @@ bool validateOptions(boost::program_options::variables_map& vm,
   return true;
 }
 
-struct ExpressionRecord {
-  uint32_t snum;
-  uint32_t len;
-  double effectiveLen;
-  double tpm;
-  double numReads;
-};
+namespace {
+// The number of samples whose values are held in memory at once; each such
+// block of samples is parsed in parallel and written out before the next is
+// read.
+constexpr size_t samplesPerBlock = 256;
 
-bool doMerge(QuantMergeOptions& qmOpts) {
-  std::unordered_map<std::string, std::vector<ExpressionRecord>> recs;
-  for (uint32_t n = 0; n < qmOpts.samples.size(); ++n) {
-    auto& sampDir = qmOpts.samples[n];
-    auto quantFile = boost::filesystem::path(sampDir) / "quant.sf";
-    if (boost::filesystem::exists(quantFile) and
-        boost::filesystem::is_regular_file(quantFile)) {
-      qmOpts.log->info("Parsing {}", quantFile.string());
-      std::ifstream ifile(quantFile.string());
-      std::string header;
-      std::getline(ifile, header);
-      std::string targetName;
-      uint32_t len;
-      double effectiveLen, tpm, numReads;
-      while (ifile >> targetName >> len >> effectiveLen >> tpm >> numReads) {
-        recs[targetName].push_back({n, len, effectiveLen, tpm, numReads});
+constexpr double missingValue = std::numeric_limits<double>::quiet_NaN();
+
+/**
+ * The targets of the merged output, in the order of the first sample's
+ * quantification file, followed by any that appear (only) in later samples.
+ * Each target is also kept as a hash of its name, so that a sample listing
+ * the same targets in the same order (the usual case) can be matched row by
+ * row without any lookups.
+ */
+struct MergeTargets {
+  std::vector<std::string> names;
+  std::vector<uint64_t> hashes;
+  std::unordered_map<std::string, uint32_t> index;
+
+  static uint64_t hash(const char* s, size_t len) { return XXH64(s, len, 0); }
+
+  uint32_t lookupOrAdd(const std::string& name) {
+    if (index.empty()) {
+      index.reserve(names.size());
+      for (uint32_t i = 0; i < names.size(); ++i) {
+        index[names[i]] = i;
       }
-      ifile.close();
+    }
+    auto it = index.find(name);
+    if (it != index.end()) {
+      return it->second;
+    }
+    uint32_t i = names.size();
+    names.push_back(name);
+    hashes.push_back(hash(name.data(), name.size()));
+    index[name] = i;
+    return i;
+  }
+};
+
+/**
+ * The requested column of one sample.  The value of target i is values[i]
+ * for each row whose name matched the row of the same position in the
+ * targets; the rows that didn't (if any) are in unmatched.
+ */
+struct SampleColumn {
+  std::vector<double> values;
+  std::vector<std::pair<std::string, double>> unmatched;
+  bool ok{false};
+};
+
+inline const char* skipField(const char* p) {
+  while (*p != '\t' and *p != '\n' and *p != '\0') {
+    ++p;
+  }
+  return (*p == '\t') ? p + 1 : p;
+}
+
+bool readFile(const boost::filesystem::path& path, std::string& contents) {
+  std::ifstream ifile(path.string(), std::ios::in | std::ios::binary);
+  if (!ifile.good()) {
+    return false;
+  }
+  ifile.seekg(0, std::ios::end);
+  contents.resize(static_cast<size_t>(ifile.tellg()));
+  ifile.seekg(0, std::ios::beg);
+  ifile.read(&contents[0], contents.size());
+  return ifile.good();
+}
+
+// Parses the (tab-separated) quantification file at path, keeping only the
+// column selected by tcol.
+void parseSample(const boost::filesystem::path& path, TargetColumn tcol,
+                 const MergeTargets& targets, SampleColumn& col) {
+  std::string contents;
+  if (!readFile(path, contents)) {
+    return;
+  }
+  // The header is skipped.
+  const char* p = std::strchr(contents.c_str(), '\n');
+  if (p == nullptr) {
+    return;
+  }
+  ++p;
+  size_t skip = static_cast<size_t>(tcol) + 1;
+  col.values.assign(targets.names.size(), missingValue);
+  size_t row{0};
+  while (*p != '\0') {
+    const char* name = p;
+    while (*p != '\t' and *p != '\n' and *p != '\0') {
+      ++p;
+    }
+    size_t nameLen = p - name;
+    if (*p != '\t') {
+      // a line without any values; the file is truncated or malformed
+      return;
+    }
+    ++p;
+    for (size_t i = 1; i < skip; ++i) {
+      p = skipField(p);
+    }
+    char* end;
+    double v = std::strtod(p, &end);
+    if (end == p) {
+      return;
+    }
+    p = end;
+    while (*p != '\n' and *p != '\0') {
+      ++p;
+    }
+    if (*p == '\n') {
+      ++p;
+    }
+    if (row < targets.hashes.size() and
+        targets.hashes[row] == MergeTargets::hash(name, nameLen)) {
+      col.values[row] = v;
     } else {
-      qmOpts.log->critical("The sample directory {} either doesn't exist, "
-                           "or doesn't contain a quant.sf file",
-                           sampDir);
-      return false;
+      col.unmatched.emplace_back(std::string(name, nameLen), v);
+    }
+    ++row;
+  }
+  col.ok = true;
+}
+
+void writeLE(std::ostream& os, uint64_t v, size_t nbytes) {
+  char b[8];
+  for (size_t i = 0; i < nbytes; ++i) {
+    b[i] = static_cast<char>((v >> (8 * i)) & 0xff);
+  }
+  os.write(b, nbytes);
+}
+
+/**
+ * Writes a matrix of float64 columns, one value per target in each (all
+ * integers are little endian), as
+ *
+ *   header  : char[8] magic, uint32 version (1), uint32 tag (which depends on
+ *             the kind of file), uint64 number of targets (t), uint64 number
+ *             of columns (c)
+ *   names   : uint64 size, then the target names, each followed by '\n';
+ *             uint64 size, then the column names, each followed by '\n'
+ *   values  : c columns of t float64 values (NaN where a column has no value
+ *             for a target)
+ *
+ * The columns are read, in order, from columnsIn, where column i holds only
+ * the first columnRows[i] values (the targets that were known when it was
+ * written); the rest are written as NaN.
+ */
+bool writeColumnFile(const std::string& path, const char magic[8], uint32_t tag,
+                     const std::vector<std::string>& targetNames,
+                     const std::vector<std::string>& columnNames,
+                     std::istream& columnsIn,
+                     const std::vector<size_t>& columnRows) {
+  std::ofstream out(path, std::ios_base::out | std::ios_base::binary);
+  if (!out.is_open()) {
+    return false;
+  }
+  out.write(magic, 8);
+  writeLE(out, 1, 4);
+  writeLE(out, tag, 4);
+  writeLE(out, targetNames.size(), 8);
+  writeLE(out, columnNames.size(), 8);
+  for (auto* names : {&targetNames, &columnNames}) {
+    uint64_t namesSize{0};
+    for (auto& n : *names) {
+      namesSize += n.size() + 1;
+    }
+    writeLE(out, namesSize, 8);
+    for (auto& n : *names) {
+      out << n << '\n';
     }
   }
+  std::vector<double> column;
+  for (auto rows : columnRows) {
+    column.assign(targetNames.size(), missingValue);
+    columnsIn.read(reinterpret_cast<char*>(column.data()),
+                   sizeof(double) * rows);
+    for (double v : column) {
+      uint64_t bits;
+      std::memcpy(&bits, &v, sizeof(bits));
+      writeLE(out, bits, 8);
+    }
+  }
+  bool good = out.good() and columnsIn.good();
+  out.close();
+  return good;
+}
+
+inline void writeValue(fmt::MemoryWriter& w, TargetColumn tcol, double v) {
+  if (v != v) {
+    w << "\tNA";
+  } else if (tcol == TargetColumn::LEN) {
+    w.write("\t{}", static_cast<uint64_t>(v));
+  } else {
+    // the same as the default formatting of an std::ostream
+    w.write("\t{:g}", v);
+  }
+}
+} // namespace
+
+/**
+ * Merges the requested column of the quantification files of all of the
+ * samples into a matrix with one row per target and one column per sample.
+ *
+ * The samples are processed in blocks of samplesPerBlock, the files of each
+ * block being parsed in parallel; only the requested column of the samples of
+ * the current block is held in memory.  The rows of each block are written
+ * to a temporary file, and the output is assembled, row by row, from these
+ * files at the end.
+ *
+ * If a binary output is requested, the matrix is also written to it by
+ * writeColumnFile, with the magic "SALMNMRG", the merged column (0 = len,
+ * 1 = elen, 2 = tpm, 3 = numreads) as the tag, and a column per sample.
+ */
+bool doMerge(QuantMergeOptions& qmOpts) {
+  namespace bfs = boost::filesystem;
 
   auto outputPath =
-      boost::filesystem::absolute(boost::filesystem::path(qmOpts.outputName))
-          .parent_path();
-  if (!boost::filesystem::exists(outputPath)) {
-    if (!boost::filesystem::create_directories(outputPath)) {
+      bfs::absolute(bfs::path(qmOpts.outputName)).parent_path();
+  if (!bfs::exists(outputPath)) {
+    if (!bfs::create_directories(outputPath)) {
       qmOpts.log->critical("Couldn't create output path {}",
                            outputPath.string());
       std::exit(1);
     }
   }
 
+  size_t numSamples = qmOpts.samples.size();
+  std::vector<bfs::path> quantFiles;
+  for (auto& sampDir : qmOpts.samples) {
+    auto quantFile = bfs::path(sampDir) / qmOpts.quantFileName;
+    if (!bfs::exists(quantFile) or !bfs::is_regular_file(quantFile)) {
+      qmOpts.log->critical("The sample directory {} either doesn't exist, "
+                           "or doesn't contain a {} file",
+                           sampDir, qmOpts.quantFileName);
+      return false;
+    }
+    quantFiles.push_back(quantFile);
+  }
+
+  // The targets, in the order of the first sample.
+  MergeTargets targets;
+  {
+    std::string contents;
+    if (!readFile(quantFiles.front(), contents)) {
+      qmOpts.log->critical("Couldn't read {}", quantFiles.front().string());
+      return false;
+    }
+    std::istringstream iss(contents);
+    std::string line;
+    std::getline(iss, line);
+    while (std::getline(iss, line)) {
+      auto tab = line.find('\t');
+      if (tab == std::string::npos) {
+        continue;
+      }
+      targets.names.push_back(line.substr(0, tab));
+      targets.hashes.push_back(MergeTargets::hash(line.data(), tab));
+    }
+  }
+
+  tbb::task_scheduler_init tbbScheduler(qmOpts.numThreads);
+
+  std::vector<bfs::path> blockFiles;
+  std::vector<size_t> blockRows;
+  bfs::path columnFile;
+  std::unique_ptr<std::ofstream> columnStream{nullptr};
+  std::vector<size_t> columnRows;
+  if (!qmOpts.binaryOutputName.empty()) {
+    columnFile =
+        outputPath / bfs::unique_path(".quantmerge-%%%%-%%%%-columns.tmp");
+    columnStream.reset(new std::ofstream(
+        columnFile.string(), std::ios_base::out | std::ios_base::binary));
+  }
+  auto removeTemporaries = [&]() -> void {
+    boost::system::error_code ec;
+    for (auto& f : blockFiles) {
+      bfs::remove(f, ec);
+    }
+    if (!columnFile.empty()) {
+      columnStream.reset(nullptr);
+      bfs::remove(columnFile, ec);
+    }
+  };
+
   size_t missingValues{0};
+  std::vector<SampleColumn> cols;
+  for (size_t first = 0; first < numSamples; first += samplesPerBlock) {
+    size_t last = std::min(numSamples, first + samplesPerBlock);
+    cols.clear();
+    cols.resize(last - first);
+    tbb::parallel_for(tbb::blocked_range<size_t>(first, last),
+                      [&](const tbb::blocked_range<size_t>& r) -> void {
+                        for (size_t n = r.begin(); n != r.end(); ++n) {
+                          parseSample(quantFiles[n], qmOpts.tcol, targets,
+                                      cols[n - first]);
+                        }
+                      });
+
+    // Place the rows that didn't line up with the targets (adding any new
+    // targets) once all of the samples of the block are parsed.
+    for (size_t n = first; n < last; ++n) {
+      auto& col = cols[n - first];
+      if (!col.ok) {
+        qmOpts.log->critical("Couldn't parse {}", quantFiles[n].string());
+        removeTemporaries();
+        return false;
+      }
+      if (!col.unmatched.empty()) {
+        qmOpts.log->info("The targets of {} are not in the same order as "
+                         "those of {}",
+                         quantFiles[n].string(), quantFiles.front().string());
+        for (auto& nv : col.unmatched) {
+          auto i = targets.lookupOrAdd(nv.first);
+          if (i >= col.values.size()) {
+            col.values.resize(i + 1, missingValue);
+          }
+          col.values[i] = nv.second;
+        }
+        std::vector<std::pair<std::string, double>>().swap(col.unmatched);
+      }
+    }
+    size_t numRows = targets.names.size();
+    for (auto& col : cols) {
+      col.values.resize(numRows, missingValue);
+    }
+
+    // The rows of this block
+    blockFiles.push_back(outputPath /
+                         bfs::unique_path(".quantmerge-%%%%-%%%%-rows.tmp"));
+    blockRows.push_back(numRows);
+    std::unique_ptr<std::FILE, int (*)(std::FILE*)> blockOut(
+        std::fopen(blockFiles.back().c_str(), "w"), std::fclose);
+    if (!blockOut) {
+      qmOpts.log->critical("Couldn't create temporary file {}",
+                           blockFiles.back().string());
+      removeTemporaries();
+      return false;
+    }
+    fmt::MemoryWriter w;
+    for (size_t i = 0; i < numRows; ++i) {
+      for (auto& col : cols) {
+        if (col.values[i] != col.values[i]) {
+          ++missingValues;
+        }
+        writeValue(w, qmOpts.tcol, col.values[i]);
+      }
+      w << '\n';
+      if (w.size() > (1 << 20)) {
+        std::fwrite(w.data(), 1, w.size(), blockOut.get());
+        w.clear();
+      }
+    }
+    std::fwrite(w.data(), 1, w.size(), blockOut.get());
+
+    if (columnStream) {
+      for (auto& col : cols) {
+        columnStream->write(reinterpret_cast<const char*>(col.values.data()),
+                            sizeof(double) * numRows);
+        columnRows.push_back(numRows);
+      }
+    }
+  }
+  std::vector<SampleColumn>().swap(cols);
+
   // Now, the path exists
   std::ofstream outFile(qmOpts.outputName);
   if (!outFile.is_open()) {
     qmOpts.log->critical("Couldn't create output file {}", qmOpts.outputName);
     outFile.close();
+    removeTemporaries();
     std::exit(1);
   }
 
   outFile << "Name";
-  for (size_t n = 0; n < qmOpts.samples.size(); ++n) {
+  for (size_t n = 0; n < numSamples; ++n) {
     outFile << '\t' << qmOpts.names[n];
   }
   outFile << '\n';
 
-  for (auto& kv : recs) {
-    auto& trecs = kv.second;
-    outFile << kv.first;
-    uint32_t nextTrec{0};
-    for (uint32_t n = 0; n < qmOpts.samples.size(); ++n) {
-      if (nextTrec < trecs.size() and trecs[nextTrec].snum == n) {
-        switch (qmOpts.tcol) {
-        case TargetColumn::LEN:
-          outFile << '\t' << trecs[nextTrec].len;
-          break;
-        case TargetColumn::ELEN:
-          outFile << '\t' << trecs[nextTrec].effectiveLen;
-          break;
-        case TargetColumn::TPM:
-          outFile << '\t' << trecs[nextTrec].tpm;
-          break;
-        case TargetColumn::NREADS:
-          outFile << '\t' << trecs[nextTrec].numReads;
-          break;
+  {
+    std::vector<std::unique_ptr<std::ifstream>> blockIn;
+    for (auto& f : blockFiles) {
+      blockIn.emplace_back(new std::ifstream(f.string()));
+    }
+    std::string line;
+    for (size_t i = 0; i < targets.names.size(); ++i) {
+      outFile << targets.names[i];
+      for (size_t b = 0; b < blockFiles.size(); ++b) {
+        if (i < blockRows[b]) {
+          std::getline(*blockIn[b], line);
+          outFile << line;
+        } else {
+          // a target that first appeared in a later block
+          size_t blockSize =
+              std::min(numSamples, (b + 1) * samplesPerBlock) -
+              b * samplesPerBlock;
+          for (size_t n = 0; n < blockSize; ++n) {
+            outFile << "\tNA";
+          }
+          missingValues += blockSize;
         }
-        ++nextTrec;
-      } else {
-        ++missingValues;
-        outFile << '\t' << "NA";
       }
+      outFile << '\n';
     }
-    outFile << '\n';
   }
   outFile.close();
 
+  if (columnStream) {
+    columnStream->close();
+    std::ifstream columnsIn(columnFile.string(),
+                            std::ios_base::in | std::ios_base::binary);
+    const char magic[8] = {'S', 'A', 'L', 'M', 'N', 'M', 'R', 'G'};
+    if (!writeColumnFile(qmOpts.binaryOutputName, magic,
+                         static_cast<uint32_t>(qmOpts.tcol), targets.names,
+                         qmOpts.names, columnsIn, columnRows)) {
+      qmOpts.log->critical("Couldn't write output file {}",
+                           qmOpts.binaryOutputName);
+      removeTemporaries();
+      std::exit(1);
+    }
+  }
+  removeTemporaries();
+
   if (missingValues > 0) {
     qmOpts.log->warn(
         "There were {} missing entries (recorded as \"NA\") in the output",
@@ -208,6 +602,520 @@ bool doMerge(QuantMergeOptions& qmOpts) {
   return true;
 }
 
+namespace {
+/**
+ * How the bootstrap / Gibbs replicates of a sample were written (from its
+ * meta_info.json; the defaults are those of runs that predate the sample
+ * formats).
+ */
+struct ReplicateInfo {
+  boost::filesystem::path dir;
+  uint64_t numReplicates{0};
+  std::string format{"gzip"};
+  std::string precision{"double"};
+  uint32_t fixedScale{0};
+  bool sparse{false};
+};
+
+// Reads the field name of the JSON file at path into v, if it's there.
+template <typename T>
+bool readJSONField(const boost::filesystem::path& path, const char* name,
+                   T& v) {
+  std::ifstream ifs(path.string());
+  if (!ifs.good()) {
+    return false;
+  }
+  try {
+    cereal::JSONInputArchive iarchive(ifs);
+    iarchive(cereal::make_nvp(name, v));
+  } catch (std::exception& e) {
+    return false;
+  }
+  return true;
+}
+
+bool readReplicateInfo(const boost::filesystem::path& sampleDir,
+                       ReplicateInfo& info) {
+  std::string auxDir{"aux_info"};
+  readJSONField(sampleDir / "cmd_info.json", "auxDir", auxDir);
+  auto metaFile = sampleDir / auxDir / "meta_info.json";
+  if (!readJSONField(metaFile, "num_bootstraps", info.numReplicates)) {
+    return false;
+  }
+  readJSONField(metaFile, "samp_format", info.format);
+  readJSONField(metaFile, "samp_precision", info.precision);
+  readJSONField(metaFile, "samp_fixed_scale", info.fixedScale);
+  readJSONField(metaFile, "samp_sparse", info.sparse);
+  info.dir = sampleDir / auxDir / "bootstrap";
+  return true;
+}
+
+bool readReplicateNames(const boost::filesystem::path& bsDir,
+                        std::vector<std::string>& names) {
+  namespace bio = boost::iostreams;
+  auto nameFile = bsDir / "names.tsv.gz";
+  if (!boost::filesystem::exists(nameFile)) {
+    return false;
+  }
+  bio::filtering_istream in;
+  in.push(bio::gzip_decompressor());
+  in.push(bio::file_source(nameFile.string(), std::ios_base::in));
+  std::string line;
+  std::getline(in, line);
+  names.clear();
+  size_t start{0};
+  while (start <= line.size()) {
+    auto tab = line.find('\t', start);
+    if (tab == std::string::npos) {
+      tab = line.size();
+    }
+    names.push_back(line.substr(start, tab - start));
+    start = tab + 1;
+  }
+  return !names.empty();
+}
+
+// The quantile p of the n sorted values, interpolated as by R's default
+// (type 7) quantile.
+double sortedQuantile(const double* sorted, size_t n, double p) {
+  double h = (n - 1) * p;
+  size_t lo = static_cast<size_t>(h);
+  if (lo + 1 >= n) {
+    return sorted[n - 1];
+  }
+  return sorted[lo] + (h - lo) * (sorted[lo + 1] - sorted[lo]);
+}
+
+/**
+ * The P-square estimate (Jain & Chlamtac, 1985) of a single quantile of a
+ * stream of values, in constant space.  The first five values are kept as
+ * they are, so the estimate is exact until then.
+ */
+struct P2Quantile {
+  double q[5];
+  int32_t n[5];
+
+  // Add x, the count-th value (from 0) of the stream.
+  void add(double x, uint64_t count, double p) {
+    if (count < 5) {
+      q[count] = x;
+      if (count == 4) {
+        std::sort(q, q + 5);
+        for (int32_t i = 0; i < 5; ++i) {
+          n[i] = i;
+        }
+      }
+      return;
+    }
+    int k;
+    if (x < q[0]) {
+      q[0] = x;
+      k = 0;
+    } else if (x >= q[4]) {
+      q[4] = x;
+      k = 3;
+    } else {
+      k = 0;
+      while (x >= q[k + 1]) {
+        ++k;
+      }
+    }
+    for (int i = k + 1; i < 5; ++i) {
+      ++n[i];
+    }
+    // The desired marker positions, now that there are count + 1 values
+    const double dn[5] = {0.0, p / 2.0, p, (1.0 + p) / 2.0, 1.0};
+    for (int i = 1; i < 4; ++i) {
+      double d = count * dn[i] - n[i];
+      if ((d >= 1.0 and n[i + 1] - n[i] > 1) or
+          (d <= -1.0 and n[i - 1] - n[i] < -1)) {
+        int s = (d > 0.0) ? 1 : -1;
+        double np = n[i + 1] - n[i], nm = n[i] - n[i - 1];
+        double qp = q[i] + s / static_cast<double>(n[i + 1] - n[i - 1]) *
+                               ((nm + s) * (q[i + 1] - q[i]) / np +
+                                (np - s) * (q[i] - q[i - 1]) / nm);
+        if (q[i - 1] < qp and qp < q[i + 1]) {
+          q[i] = qp;
+        } else {
+          q[i] += s * (q[i + s] - q[i]) / (n[i + s] - n[i]);
+        }
+        n[i] += s;
+      }
+    }
+  }
+
+  // The estimate, given the total number of values added.
+  double value(uint64_t count, double p) const {
+    if (count == 0) {
+      return missingValue;
+    }
+    if (count < 5) {
+      double sorted[5];
+      std::copy(q, q + count, sorted);
+      std::sort(sorted, sorted + count);
+      return sortedQuantile(sorted, count, p);
+    }
+    return q[2];
+  }
+};
+
+/**
+ * The statistics of the replicates of one sample, each as a column with a
+ * value per target (in the order of the sample's names.tsv.gz): the mean,
+ * the (sample) variance and each of the requested quantiles.
+ */
+struct ReplicateSummary {
+  std::vector<std::vector<double>> stats;
+  std::vector<std::string> names;
+  uint64_t numReplicates{0};
+  std::string error;
+};
+
+// A single pass over the (row-major) bootstraps.gz, one replicate at a time;
+// the quantiles are P-square estimates.
+bool summarizeGZipReplicates(const ReplicateInfo& info,
+                             const std::vector<double>& quantiles,
+                             ReplicateSummary& summary) {
+  namespace bio = boost::iostreams;
+  SamplePrecision precision;
+  if (!salmon::samples::parsePrecision(info.precision, precision)) {
+    summary.error = "unknown sample precision " + info.precision;
+    return false;
+  }
+  size_t numTargets = summary.names.size();
+  size_t numQuantiles = quantiles.size();
+  std::vector<double> mean(numTargets, 0.0), m2(numTargets, 0.0);
+  std::vector<P2Quantile> estimates(numTargets * numQuantiles);
+
+  bio::filtering_istream in;
+  in.push(bio::gzip_decompressor());
+  in.push(bio::file_source((info.dir / "bootstraps.gz").string(),
+                           std::ios_base::in | std::ios_base::binary));
+  salmon::samples::StreamByteSource src(in);
+  std::vector<double> replicate(numTargets);
+  uint64_t count{0};
+  for (; count < info.numReplicates; ++count) {
+    if (!salmon::samples::decodeSample(src, precision, info.fixedScale,
+                                       info.sparse, replicate)) {
+      break;
+    }
+    for (size_t t = 0; t < numTargets; ++t) {
+      double x = replicate[t];
+      double delta = x - mean[t];
+      mean[t] += delta / (count + 1);
+      m2[t] += delta * (x - mean[t]);
+      P2Quantile* e = &estimates[t * numQuantiles];
+      for (size_t j = 0; j < numQuantiles; ++j) {
+        e[j].add(x, count, quantiles[j]);
+      }
+    }
+  }
+  if (count == 0) {
+    summary.error = "couldn't read any replicates";
+    return false;
+  }
+
+  summary.numReplicates = count;
+  summary.stats.resize(2 + numQuantiles);
+  summary.stats[0] = std::move(mean);
+  for (auto& v : m2) {
+    v = (count > 1) ? v / (count - 1) : 0.0;
+  }
+  summary.stats[1] = std::move(m2);
+  for (size_t j = 0; j < numQuantiles; ++j) {
+    auto& col = summary.stats[2 + j];
+    col.resize(numTargets);
+    for (size_t t = 0; t < numTargets; ++t) {
+      col[t] = estimates[t * numQuantiles + j].value(count, quantiles[j]);
+    }
+  }
+  return true;
+}
+
+bool inflateBlock(const std::vector<char>& src, std::vector<char>& dest) {
+  z_stream zs;
+  std::memset(&zs, 0, sizeof(zs));
+  if (inflateInit(&zs) != Z_OK) {
+    return false;
+  }
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(src.data()));
+  zs.avail_in = static_cast<uInt>(src.size());
+  dest.resize(std::max(size_t(1) << 16, 4 * src.size()));
+  int ret{Z_OK};
+  size_t produced{0};
+  while (ret == Z_OK) {
+    if (produced == dest.size()) {
+      dest.resize(2 * dest.size());
+    }
+    zs.next_out = reinterpret_cast<Bytef*>(dest.data() + produced);
+    zs.avail_out = static_cast<uInt>(dest.size() - produced);
+    ret = inflate(&zs, Z_NO_FLUSH);
+    produced = dest.size() - zs.avail_out;
+  }
+  inflateEnd(&zs);
+  dest.resize(produced);
+  return ret == Z_STREAM_END;
+}
+
+bool readU64(std::istream& is, uint64_t& v, size_t nbytes = 8) {
+  unsigned char b[8];
+  if (!is.read(reinterpret_cast<char*>(b), nbytes)) {
+    return false;
+  }
+  v = 0;
+  for (size_t i = 0; i < nbytes; ++i) {
+    v |= static_cast<uint64_t>(b[i]) << (8 * i);
+  }
+  return true;
+}
+
+// One block (of transcripts) of the columnar bootstraps.col at a time, with
+// the replicates of its transcripts gathered from every group of samples;
+// since all of them are at hand, the quantiles are exact.
+bool summarizeColumnarReplicates(const ReplicateInfo& info,
+                                 const std::vector<double>& quantiles,
+                                 ReplicateSummary& summary) {
+  std::ifstream in((info.dir / "bootstraps.col").string(),
+                   std::ios_base::in | std::ios_base::binary);
+  char magic[8];
+  uint64_t version, valueType, numTargets, numSamples, txpsPerBlock;
+  uint64_t scale{0};
+  uint64_t samplesPerGroup{0};
+  const char colMagic[8] = {'S', 'A', 'L', 'M', 'N', 'C', 'O', 'L'};
+  if (!in.read(magic, 8) or std::memcmp(magic, colMagic, 8) != 0 or
+      !readU64(in, version, 4) or !readU64(in, valueType, 4) or
+      !readU64(in, numTargets) or !readU64(in, numSamples) or
+      !readU64(in, txpsPerBlock) or txpsPerBlock == 0 or
+      (version >= 2 and !readU64(in, scale)) or
+      (version >= 3 and
+       (!readU64(in, samplesPerGroup) or samplesPerGroup == 0))) {
+    summary.error = "not a columnar sample file";
+    return false;
+  }
+  if (numTargets != summary.names.size() or numSamples == 0) {
+    summary.error = "the number of transcripts doesn't match names.tsv.gz";
+    return false;
+  }
+  auto precision = static_cast<SamplePrecision>(valueType);
+  // (before version 3, all of the samples are in one group)
+  if (version < 3) {
+    samplesPerGroup = numSamples;
+  }
+  size_t numGroups = (numSamples + samplesPerGroup - 1) / samplesPerGroup;
+
+  uint64_t indexOffset;
+  in.seekg(-16, std::ios_base::end);
+  if (!readU64(in, indexOffset) or !in.read(magic, 8) or
+      std::memcmp(magic, colMagic, 8) != 0) {
+    summary.error = "truncated columnar sample file";
+    return false;
+  }
+  size_t numBlocks = (numTargets + txpsPerBlock - 1) / txpsPerBlock;
+  std::vector<std::pair<uint64_t, uint64_t>> index(numGroups * numBlocks);
+  in.seekg(indexOffset);
+  for (auto& e : index) {
+    if (!readU64(in, e.first) or !readU64(in, e.second)) {
+      summary.error = "truncated columnar sample file";
+      return false;
+    }
+  }
+
+  size_t numQuantiles = quantiles.size();
+  summary.numReplicates = numSamples;
+  summary.stats.assign(2 + numQuantiles, std::vector<double>(numTargets));
+  std::vector<char> raw, encoded;
+  std::vector<double> vals, groupVals;
+  for (size_t b = 0; b < numBlocks; ++b) {
+    uint64_t first = b * txpsPerBlock;
+    uint64_t numBlockTxps = std::min(txpsPerBlock, numTargets - first);
+    vals.resize(numBlockTxps * numSamples);
+    for (size_t g = 0; g < numGroups; ++g) {
+      uint64_t groupStart = g * samplesPerGroup;
+      uint64_t n = std::min(samplesPerGroup, numSamples - groupStart);
+      auto& e = index[g * numBlocks + b];
+      raw.resize(e.second);
+      in.seekg(e.first);
+      if (!in.read(raw.data(), raw.size()) or !inflateBlock(raw, encoded)) {
+        summary.error = "couldn't read a block of the columnar sample file";
+        return false;
+      }
+      salmon::samples::BufferByteSource src(encoded.data(), encoded.size());
+      groupVals.resize(numBlockTxps * n);
+      if (!salmon::samples::decodeValues(src, groupVals.data(),
+                                         groupVals.size(), precision, scale)) {
+        summary.error = "couldn't decode a block of the columnar sample file";
+        return false;
+      }
+      for (uint64_t i = 0; i < numBlockTxps; ++i) {
+        std::copy(groupVals.begin() + i * n, groupVals.begin() + (i + 1) * n,
+                  vals.begin() + i * numSamples + groupStart);
+      }
+    }
+    for (uint64_t i = 0; i < numBlockTxps; ++i) {
+      double* x = vals.data() + i * numSamples;
+      double sum{0.0};
+      for (uint64_t s = 0; s < numSamples; ++s) {
+        sum += x[s];
+      }
+      double mean = sum / numSamples;
+      double ss{0.0};
+      for (uint64_t s = 0; s < numSamples; ++s) {
+        ss += (x[s] - mean) * (x[s] - mean);
+      }
+      summary.stats[0][first + i] = mean;
+      summary.stats[1][first + i] = (numSamples > 1) ? ss / (numSamples - 1)
+                                                     : 0.0;
+      std::sort(x, x + numSamples);
+      for (size_t j = 0; j < numQuantiles; ++j) {
+        summary.stats[2 + j][first + i] =
+            sortedQuantile(x, numSamples, quantiles[j]);
+      }
+    }
+  }
+  return true;
+}
+
+void summarizeReplicates(const boost::filesystem::path& sampleDir,
+                         const std::vector<double>& quantiles,
+                         ReplicateSummary& summary) {
+  ReplicateInfo info;
+  if (!readReplicateInfo(sampleDir, info)) {
+    summary.error = "couldn't read meta_info.json";
+    return;
+  }
+  if (info.numReplicates == 0) {
+    summary.error = "the sample has no bootstrap or Gibbs replicates";
+    return;
+  }
+  if (!readReplicateNames(info.dir, summary.names)) {
+    summary.error = "couldn't read names.tsv.gz";
+    return;
+  }
+  if (info.format == "columnar") {
+    summarizeColumnarReplicates(info, quantiles, summary);
+  } else {
+    summarizeGZipReplicates(info, quantiles, summary);
+  }
+}
+} // namespace
+
+/**
+ * Reduces the bootstrap / Gibbs replicates of every sample to, for each
+ * transcript, their mean, variance and the requested quantiles, and writes
+ * these to a single file (by writeColumnFile, with the magic "SALMNBSS", the
+ * number of statistics per sample as the tag, and the columns of the
+ * statistics of each sample in turn, named <sample>:<statistic>).
+ *
+ * Replicates in bootstraps.gz are read in a single, streaming pass (so that
+ * the quantiles are estimates); those in the columnar bootstraps.col are
+ * read a block of transcripts at a time, and their quantiles are exact.
+ * A few samples (one per thread) are summarized in parallel at a time.
+ */
+bool mergeReplicateSummaries(QuantMergeOptions& qmOpts) {
+  namespace bfs = boost::filesystem;
+
+  auto outputPath =
+      bfs::absolute(bfs::path(qmOpts.bootstrapSummaryName)).parent_path();
+  if (!bfs::exists(outputPath) and !bfs::create_directories(outputPath)) {
+    qmOpts.log->critical("Couldn't create output path {}",
+                         outputPath.string());
+    return false;
+  }
+
+  std::vector<std::string> statNames{"mean", "variance"};
+  for (auto p : qmOpts.quantiles) {
+    statNames.push_back(fmt::format("q{:g}", p));
+  }
+
+  MergeTargets targets;
+  std::vector<std::string> columnNames;
+  std::vector<size_t> columnRows;
+  bfs::path columnFile =
+      outputPath / bfs::unique_path(".quantmerge-%%%%-%%%%-stats.tmp");
+  std::unique_ptr<std::ofstream> columnStream(new std::ofstream(
+      columnFile.string(), std::ios_base::out | std::ios_base::binary));
+  auto removeTemporaries = [&]() -> void {
+    boost::system::error_code ec;
+    columnStream.reset(nullptr);
+    bfs::remove(columnFile, ec);
+  };
+
+  size_t numSamples = qmOpts.samples.size();
+  size_t blockSize = std::max(qmOpts.numThreads, uint32_t(1));
+  std::vector<ReplicateSummary> summaries;
+  std::vector<double> column;
+  for (size_t first = 0; first < numSamples; first += blockSize) {
+    size_t last = std::min(numSamples, first + blockSize);
+    summaries.clear();
+    summaries.resize(last - first);
+    tbb::parallel_for(tbb::blocked_range<size_t>(first, last),
+                      [&](const tbb::blocked_range<size_t>& r) -> void {
+                        for (size_t n = r.begin(); n != r.end(); ++n) {
+                          summarizeReplicates(qmOpts.samples[n],
+                                              qmOpts.quantiles,
+                                              summaries[n - first]);
+                        }
+                      });
+
+    for (size_t n = first; n < last; ++n) {
+      auto& summary = summaries[n - first];
+      if (!summary.error.empty()) {
+        qmOpts.log->critical("Couldn't summarize the replicates of {}: {}",
+                             qmOpts.samples[n], summary.error);
+        removeTemporaries();
+        return false;
+      }
+      qmOpts.log->info("Summarized the {} replicates of {}",
+                       summary.numReplicates, qmOpts.samples[n]);
+      if (targets.names.empty()) {
+        for (auto& name : summary.names) {
+          targets.names.push_back(name);
+          targets.hashes.push_back(
+              MergeTargets::hash(name.data(), name.size()));
+        }
+      }
+      // The position of each of the sample's targets in the output
+      std::vector<uint32_t> rows(summary.names.size());
+      for (size_t i = 0; i < summary.names.size(); ++i) {
+        auto& name = summary.names[i];
+        rows[i] = (i < targets.hashes.size() and
+                   targets.hashes[i] ==
+                       MergeTargets::hash(name.data(), name.size()))
+                      ? i
+                      : targets.lookupOrAdd(name);
+      }
+      size_t numRows = targets.names.size();
+      for (size_t k = 0; k < statNames.size(); ++k) {
+        column.assign(numRows, missingValue);
+        for (size_t i = 0; i < rows.size(); ++i) {
+          column[rows[i]] = summary.stats[k][i];
+        }
+        columnStream->write(reinterpret_cast<const char*>(column.data()),
+                            sizeof(double) * numRows);
+        columnRows.push_back(numRows);
+        columnNames.push_back(qmOpts.names[n] + ":" + statNames[k]);
+      }
+    }
+  }
+  std::vector<ReplicateSummary>().swap(summaries);
+
+  columnStream->close();
+  std::ifstream columnsIn(columnFile.string(),
+                          std::ios_base::in | std::ios_base::binary);
+  const char magic[8] = {'S', 'A', 'L', 'M', 'N', 'B', 'S', 'S'};
+  bool ok = writeColumnFile(qmOpts.bootstrapSummaryName, magic,
+                            static_cast<uint32_t>(statNames.size()),
+                            targets.names, columnNames, columnsIn, columnRows);
+  columnsIn.close();
+  removeTemporaries();
+  if (!ok) {
+    qmOpts.log->critical("Couldn't write output file {}",
+                         qmOpts.bootstrapSummaryName);
+    return false;
+  }
+  return true;
+}
+
 int salmonQuantMerge(int argc, char* argv[]) {
   using std::cerr;
   using std::vector;
@@ -232,7 +1140,30 @@ int salmonQuantMerge(int argc, char* argv[]) {
       "The options are {len, elen, tpm, numreads}")(
 
       "output,o", po::value<std::string>(&qmOpts.outputName)->required(),
-      "Output quantification file.");
+      "Output quantification file.")(
+      "binaryOutput",
+      po::value<std::string>(&qmOpts.binaryOutputName)->default_value(""),
+      "If given, the merged matrix is also written to this (binary) file, "
+      "as a float64 column for each sample.")(
+      "genes",
+      po::bool_switch(&qmOpts.genes)->default_value(false),
+      "Merge the gene-level estimates (quant.genes.sf) rather than the "
+      "transcript-level ones (quant.sf).")(
+      "bootstrapSummary",
+      po::value<std::string>(&qmOpts.bootstrapSummaryName)->default_value(""),
+      "If given, the bootstrap / Gibbs replicates of every sample are reduced "
+      "to the mean, variance and quantiles (see --quantiles) of each "
+      "transcript, and these are written to this (binary) file.")(
+      "quantiles",
+      po::value<std::string>(&qmOpts.quantileList)
+          ->default_value("0.025,0.5,0.975"),
+      "The comma-separated quantiles of the replicates that are written to "
+      "the --bootstrapSummary file.")(
+      "threads,p",
+      po::value<uint32_t>(&qmOpts.numThreads)
+          ->default_value(std::thread::hardware_concurrency()),
+      "The number of threads that are used to parse the quantification "
+      "files.");
 
   po::options_description all("salmon quantmerge options");
   all.add(generic);
@@ -261,7 +1192,7 @@ a single file.
 
     po::notify(vm);
     size_t max_q_size = 131072;
-    spdlog::set_async_mode(max_q_size);
+    salmon::logging::setAsyncMode(max_q_size);
 
     auto consoleSink =
         std::make_shared<spdlog::sinks::ansicolor_stdout_sink_mt>();
@@ -271,7 +1202,13 @@ a single file.
     validateOptions(vm, qmOpts, consoleLog);
     qmOpts.print();
 
-    doMerge(qmOpts);
+    if (!doMerge(qmOpts)) {
+      std::exit(1);
+    }
+    if (!qmOpts.bootstrapSummaryName.empty() and
+        !mergeReplicateSummaries(qmOpts)) {
+      std::exit(1);
+    }
 
   } catch (po::error& e) {
     std::cerr << "Exception : [" << e.what() << "]. Exiting.\n";
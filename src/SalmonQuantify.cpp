@@ -22,9 +22,11 @@
 #include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstdio>
 #include <exception>
+#include <fstream>
 #include <functional>
 #include <iterator>
 #include <map>
@@ -62,6 +64,9 @@ extern "C" {
 #include <boost/container/flat_map.hpp>
 #include <boost/dynamic_bitset/dynamic_bitset.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/iostreams/device/file.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
 #include <boost/lockfree/queue.hpp>
 #include <boost/program_options.hpp>
 #include <boost/range/irange.hpp>
@@ -94,6 +99,8 @@ extern "C" {
 #include "FastxParser.hpp"
 #include "IOUtils.hpp"
 #include "LibraryFormat.hpp"
+#include "MappingCacheFile.hpp"
+#include "MappingFile.hpp"
 #include "ReadLibrary.hpp"
 #include "SalmonConfig.hpp"
 #include "SalmonExceptions.hpp"
@@ -103,8 +110,11 @@ extern "C" {
 #include "Transcript.hpp"
 
 #include "AlignmentGroup.hpp"
+#include "AsyncOutputService.hpp"
+#include "AuxRecordWriter.hpp"
 #include "BWAUtils.hpp"
 #include "BiasParams.hpp"
+#include "CellEquivalenceClasses.hpp"
 #include "CollapsedEMOptimizer.hpp"
 #include "CollapsedGibbsSampler.hpp"
 #include "EquivalenceClassBuilder.hpp"
@@ -112,7 +122,21 @@ extern "C" {
 #include "FragmentLengthDistribution.hpp"
 #include "GZipWriter.hpp"
 #include "HitManager.hpp"
+#include "InferenceSweep.hpp"
+#include "InterimQuant.hpp"
 #include "KmerIntervalMap.hpp"
+#include "KmerLookupPrefetcher.hpp"
+#include "MappingVerifier.hpp"
+#include "PairedHitMerger.hpp"
+#include "PartialExperiment.hpp"
+#include "QuantCheckpoint.hpp"
+#include "ReadMappingCache.hpp"
+#include "ReadPrefilter.hpp"
+#include "RepeatSeedFilter.hpp"
+#include "ThreadPinning.hpp"
+#include "MiniBatchPipeline.hpp"
+#include "MiniBatchScratch.hpp"
+#include "MiniBatchSizer.hpp"
 
 #include "EffectiveLengthStats.hpp"
 #include "PairAlignmentFormatter.hpp"
@@ -129,15 +153,59 @@ using MateStatus = rapmap::utils::MateStatus;
 using QuasiAlignment = rapmap::utils::QuasiAlignment;
 /****** QUASI MAPPING DECLARATIONS  *******/
 
-using paired_parser = fastx_parser::FastxParser<fastx_parser::ReadPair>;
-using single_parser = fastx_parser::FastxParser<fastx_parser::ReadSeq>;
+using paired_parser = fastx_parser::FastxParser<fastx_parser::ReadSpanPair>;
+using single_parser = fastx_parser::FastxParser<fastx_parser::ReadSpanSeq>;
 
 using TranscriptID = uint32_t;
 using TranscriptIDVector = std::vector<TranscriptID>;
 using KmerIDMap = std::vector<TranscriptIDVector>;
 using my_mer = jellyfish::mer_dna_ns::mer_base_static<uint64_t, 1>;
 
-constexpr uint32_t miniBatchSize{5000};
+// The parser's chunks of reads (--parserChunkSize) are, by default, of this
+// many reads, and the online phase's mini-batches (--miniBatchSize) of as
+// many fragments
+constexpr uint32_t defaultChunkSize{5000};
+// The parser also hands off a chunk of reads once it holds this many bytes
+// of sequence and names (so that chunks of long reads stay small), or
+// proportionally more, for larger chunks
+constexpr size_t maxChunkBytes{size_t(1) << 22};
+inline size_t maxChunkBytesFor(uint32_t chunkSize) {
+  return std::max(maxChunkBytes, maxChunkBytes / defaultChunkSize * chunkSize);
+}
+// How many reads ahead of the one being mapped the k-mer lookups are issued
+// (for paired-end reads, each mate counts as one)
+constexpr uint32_t kmerPrefetchDistance{8};
+static_assert(kmerPrefetchDistance % 2 == 0,
+              "kmerPrefetchDistance must cover whole read pairs");
+
+// The sizes of the mini-batches that a thread's chunks are split into
+inline MiniBatchSizer miniBatchSizerFor(const SalmonOpts& sopt) {
+  uint32_t numThreads = (sopt.numInferenceThreads > 0)
+                            ? sopt.numInferenceThreads
+                            : sopt.numThreads;
+  return MiniBatchSizer(sopt.miniBatchSize, numThreads);
+}
+
+// Ready a thread's scratch, which it keeps from one library (and round) to
+// the next, for a library; the online bootstrap weights are drawn only by
+// the threads that have the reads' names, for chunks of up to
+// bootstrapBatchSize fragments (0 for the other threads)
+inline void prepareScratch(MiniBatchScratch& scratch, const SalmonOpts& sopt,
+                           size_t bootstrapBatchSize) {
+  scratch.sizer = miniBatchSizerFor(sopt);
+  if (sopt.threadLocalMass) {
+    scratch.enableLocalMass();
+  }
+  if (sopt.eqClassFlushInterval > 0) {
+    scratch.enableLocalEqClasses(sopt.eqClassFlushInterval);
+  }
+  if (bootstrapBatchSize > 0 and sopt.onlineBootstrap.enabled()) {
+    scratch.enableOnlineBootstrap(sopt.onlineBootstrap.numReplicates(),
+                                  bootstrapBatchSize);
+  } else {
+    scratch.disableOnlineBootstrap();
+  }
+}
 
 template <typename AlnT> using AlnGroupVec = std::vector<AlignmentGroup<AlnT>>;
 
@@ -156,8 +224,40 @@ using AlnGroupQueue = tbb::concurrent_queue<AlignmentGroup<AlnT>*>;
 
 #include "LightweightAlignmentDefs.hpp"
 
-template <typename AlnT>
-void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
+/**
+ * The options processMiniBatchImpl is specialized on.  An instantiation
+ * with SPECIALIZED set takes the others from its flags, at compile time, so
+ * that the branches on them drop out of the per-alignment loop; without it,
+ * they're all read from the SalmonOpts at run time (for the configurations
+ * that processMiniBatch doesn't instantiate).
+ */
+namespace mini_batch_flags {
+constexpr uint32_t SPECIALIZED = 1u << 0;
+constexpr uint32_t POS_BIAS = 1u << 1;
+constexpr uint32_t GC_BIAS = 1u << 2;
+constexpr uint32_t FSPD = 1u << 3;
+constexpr uint32_t FRAG_LEN_DIST = 1u << 4;
+constexpr uint32_t NO_LENGTH_CORRECTION = 1u << 5;
+constexpr uint32_t FAST_MATH = 1u << 6;
+// The defaults (fragment length distribution, and nothing else)
+constexpr uint32_t DEFAULT = SPECIALIZED | FRAG_LEN_DIST;
+
+template <uint32_t Flags, uint32_t Flag>
+constexpr bool value(bool runTimeValue) {
+  return (Flags & SPECIALIZED) ? ((Flags & Flag) != 0) : runTimeValue;
+}
+
+inline uint32_t fromOptions(const SalmonOpts& sopt) {
+  return SPECIALIZED | (sopt.posBiasCorrect ? POS_BIAS : 0) |
+         (sopt.gcBiasCorrect ? GC_BIAS : 0) | (sopt.useFSPD ? FSPD : 0) |
+         (!sopt.noFragLengthDist ? FRAG_LEN_DIST : 0) |
+         (sopt.noLengthCorrection ? NO_LENGTH_CORRECTION : 0) |
+         (sopt.fastMath ? FAST_MATH : 0);
+}
+} // namespace mini_batch_flags
+
+template <typename AlnT, uint32_t Flags>
+void processMiniBatchImpl(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
                       uint64_t firstTimestepOfRound, ReadLibrary& readLib,
                       const SalmonOpts& salmonOpts,
                       AlnGroupVecRange<AlnT> batchHits,
@@ -165,13 +265,10 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
                       ClusterForest& clusterForest,
                       FragmentLengthDistribution& fragLengthDist,
                       BiasParams& observedBiasParams,
-                      /**
-                       * NOTE : test new el model in future
-                       * EffectiveLengthStats& obsEffLens,
-                       */
                       std::atomic<uint64_t>& numAssignedFragments,
                       std::default_random_engine& randEng, bool initialRound,
-                      std::atomic<bool>& burnedIn, double& maxZeroFrac) {
+                      std::atomic<bool>& burnedIn, double& maxZeroFrac,
+                      MiniBatchScratch& scratch) {
 
   using salmon::math::LOG_0;
   using salmon::math::LOG_1;
@@ -189,7 +286,8 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
   size_t priorNumAssignedFragments{numAssignedFragments};
   std::uniform_real_distribution<> uni(
       0.0, 1.0 + std::numeric_limits<double>::min());
-  std::vector<uint64_t> libTypeCounts(LibraryFormat::maxLibTypeID() + 1);
+  scratch.resetLibTypeCounts();
+  std::vector<uint64_t>& libTypeCounts = scratch.libTypeCounts;
   bool hasCompatibleMapping{false};
   uint64_t numCompatibleFragments{0};
 
@@ -201,24 +299,53 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
   auto& obsRC = observedBiasParams.massRC;
   auto& observedPosBiasFwd = observedBiasParams.posBiasFW;
   auto& observedPosBiasRC = observedBiasParams.posBiasRC;
-
-  bool posBiasCorrect = salmonOpts.posBiasCorrect;
-  bool gcBiasCorrect = salmonOpts.gcBiasCorrect;
+  auto& observedEffLengths = observedBiasParams.observedEffLengths;
+  const bool observeEffLengths = salmonOpts.useObservedEffLengths;
+
+  namespace mbf = mini_batch_flags;
+  const bool posBiasCorrect =
+      mbf::value<Flags, mbf::POS_BIAS>(salmonOpts.posBiasCorrect);
+  const bool gcBiasCorrect =
+      mbf::value<Flags, mbf::GC_BIAS>(salmonOpts.gcBiasCorrect);
   bool updateCounts = initialRound;
   double incompatPrior = salmonOpts.incompatPrior;
   bool useReadCompat = incompatPrior != salmon::math::LOG_1;
-  bool useFSPD{salmonOpts.useFSPD};
-  bool useFragLengthDist{!salmonOpts.noFragLengthDist};
+  const bool useFSPD = mbf::value<Flags, mbf::FSPD>(salmonOpts.useFSPD);
+  const bool useFragLengthDist =
+      mbf::value<Flags, mbf::FRAG_LEN_DIST>(!salmonOpts.noFragLengthDist);
   bool noFragLenFactor{salmonOpts.noFragLenFactor};
   bool useRankEqClasses{salmonOpts.rankEqClasses};
   uint32_t rangeFactorization{salmonOpts.rangeFactorizationBins};
-  bool noLengthCorrection{salmonOpts.noLengthCorrection};
+  const bool noLengthCorrection = mbf::value<Flags, mbf::NO_LENGTH_CORRECTION>(
+      salmonOpts.noLengthCorrection);
+  bool useLocalMass{scratch.useLocalMass()};
+  const bool fastMath = mbf::value<Flags, mbf::FAST_MATH>(salmonOpts.fastMath);
+  // Once the online estimates are stable, the fragments are still counted
+  // into equivalence classes, but no longer update them
+  auto& onlineConvergence = readExp.onlineConvergence();
+  bool skipOnlineUpdates = burnedIn and onlineConvergence.converged();
+  auto& fspdObservations = scratch.fspdObservations;
+  if (useLocalMass and useFSPD) {
+    fspdObservations.resize(fragStartDists.size());
+  }
   bool useAuxParams = ((localNumAssignedFragments + numAssignedFragments) >=
                        salmonOpts.numPreBurninFrags);
 
-  // If we're auto detecting the library type
+  // If we're auto detecting the library type, tally the formats of the
+  // batch's alignments up front, so that the type can be locked in before
+  // the batch is scored (and the scoring loop never checks the detector).
   auto* detector = readLib.getDetector();
   bool autoDetect = (detector != nullptr) ? detector->isActive() : false;
+  if (autoDetect) {
+    std::vector<uint64_t> formatCounts(LibraryFormat::maxLibTypeID() + 1, 0);
+    for (auto& alnGroup : batchHits) {
+      for (auto& aln : alnGroup.alignments()) {
+        ++formatCounts[aln.libFormat().formatID()];
+      }
+    }
+    detector->addSamples(formatCounts);
+    autoDetect = detector->update(readLib.getFormat());
+  }
   // If we haven't detected yet, nothing is incompatible
   if (autoDetect) {
     incompatPrior = salmon::math::LOG_1;
@@ -229,6 +356,17 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
 
   // EQClass
   EquivalenceClassBuilder& eqBuilder = readExp.equivalenceClassBuilder();
+  LocalEqClassMap* localEqClasses = scratch.localEqClasses();
+  // The online bootstrap weights are drawn from the keys of the fragments
+  // (which only the quasi-mapping threads record)
+  const PoissonBootstrap& onlineBootstrap = salmonOpts.onlineBootstrap;
+  bool useOnlineBootstrap =
+      onlineBootstrap.enabled() and
+      scratch.fragmentKeys.size() >= scratch.firstFragment + batchHits.size();
+  uint32_t numReplicates = useOnlineBootstrap ? onlineBootstrap.numReplicates()
+                                              : 0;
+  const uint32_t* replicateWeights =
+      useOnlineBootstrap ? scratch.replicateWeights.data() : nullptr;
 
   // Build reverse map from transcriptID => hit id
   using HitID = uint32_t;
@@ -237,7 +375,9 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
   uint64_t currentMinibatchTimestep{0};
 
   // logForgettingMass and currentMinibatchTimestep are OUT parameters!
-  fmCalc.getLogMassAndTimestep(logForgettingMass, currentMinibatchTimestep);
+  fmCalc.getLogMassAndTimesteps(
+      numTimesteps(batchHits.size(), salmonOpts.timestepFragments),
+      logForgettingMass, currentMinibatchTimestep);
 
   double startingCumulativeMass =
       fmCalc.cumulativeLogMassAt(firstTimestepOfRound);
@@ -253,7 +393,9 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
     // reported
     // for a single read).  Distribute the read's mass to the transcripts
     // where it potentially aligns.
+    size_t nextFragment{0};
     for (auto& alnGroup : batchHits) {
+      size_t fragmentIndex = nextFragment++;
       // If we had no alignments for this read, then skip it
       if (alnGroup.size() == 0) {
         continue;
@@ -266,7 +408,8 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
       bool transcriptUnique{true};
 
       auto firstTranscriptID = alnGroup.alignments().front().transcriptID();
-      std::unordered_set<size_t> observedTranscripts;
+      // Clears the transcript ids, aux probs and observed transcripts
+      scratch.beginFragment();
 
       // New incompat. handling.
       /**
@@ -290,8 +433,8 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
       double auxDenomFinal = salmon::math::LOG_0;
       **/
 
-      std::vector<uint32_t> txpIDs;
-      std::vector<double> auxProbs;
+      EqClassLabel& txpIDs = scratch.eqKey.txps;
+      std::vector<double>& auxProbs = scratch.auxProbs;
       double auxDenom = salmon::math::LOG_0;
 
       uint32_t numInGroup{0};
@@ -313,7 +456,11 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
         double refLength =
             transcript.RefLength > 0 ? transcript.RefLength : 1.0;
         double coverage = aln.score();
-        double logFragCov = (coverage > 0) ? std::log(coverage) : LOG_1;
+        double logFragCov{LOG_1};
+        if (coverage > 0) {
+          logFragCov = fastMath ? salmon::math::fastLog(coverage)
+                                : std::log(coverage);
+        }
 
         // The alignment probability is the product of a
         // transcript-level term (based on abundance and) an
@@ -323,7 +470,7 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
         if (noLengthCorrection) {
           logRefLength = 1.0;
         } else if (salmonOpts.noEffectiveLengthCorrection or !burnedIn) {
-          logRefLength = std::log(static_cast<double>(transcript.RefLength));
+          logRefLength = transcript.logRefLength();
         } else {
           logRefLength = transcript.getCachedLogEffectiveLength();
         }
@@ -381,20 +528,6 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
             logFragProb = LOG_1;
           }
 
-          if (autoDetect) {
-            detector->addSample(aln.libFormat());
-            if (detector->canGuess()) {
-              detector->mostLikelyType(readLib.getFormat());
-              expectedLibraryFormat = readLib.getFormat();
-              incompatPrior = salmonOpts.incompatPrior;
-              autoDetect = false;
-            } else if (!detector->isActive()) {
-              expectedLibraryFormat = readLib.getFormat();
-              incompatPrior = salmonOpts.incompatPrior;
-              autoDetect = false;
-            }
-          }
-
           // TODO: Maybe take the fragment length distribution into account
           // for single-end fragments?
 
@@ -441,11 +574,13 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
           double startPosProb{-logRefLength};
           if (aln.mateStatus == rapmap::utils::MateStatus::PAIRED_END_PAIRED and
               !noLengthCorrection) {
-            startPosProb = (flen <= refLength) ? -std::log(refLength - flen + 1)
-                                               : salmon::math::LOG_EPSILON;
-            // NOTE : test new el model in future
-            // if (flen <= refLength) { obsEffLens.addFragment(transcriptID,
-            // (refLength - flen + 1), logForgettingMass); }
+            double startPosCount = refLength - flen + 1;
+            if (flen > refLength) {
+              startPosProb = salmon::math::LOG_EPSILON;
+            } else {
+              startPosProb = fastMath ? -salmon::math::fastLog(startPosCount)
+                                      : -std::log(startPosCount);
+            }
           }
 
           double fragStartLogNumerator{salmon::math::LOG_1};
@@ -490,12 +625,12 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
             continue;
           }
 
-          sumOfAlignProbs = logAdd(sumOfAlignProbs, aln.logProb);
+          sumOfAlignProbs =
+              fastMath ? salmon::math::fastLogAdd(sumOfAlignProbs, aln.logProb)
+                       : logAdd(sumOfAlignProbs, aln.logProb);
 
-          if (updateCounts and observedTranscripts.find(transcriptID) ==
-                                   observedTranscripts.end()) {
+          if (updateCounts and scratch.markObserved(transcriptID)) {
             transcripts[transcriptID].addTotalCount(1);
-            observedTranscripts.insert(transcriptID);
           }
           // EQCLASS
           if (transcriptID < prevTxpID) {
@@ -505,7 +640,8 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
           prevTxpID = transcriptID;
           txpIDs.push_back(transcriptID);
           auxProbs.push_back(auxProb);
-          auxDenom = salmon::math::logAdd(auxDenom, auxProb);
+          auxDenom = fastMath ? salmon::math::fastLogAdd(auxDenom, auxProb)
+                              : salmon::math::logAdd(auxDenom, auxProb);
         } else {
           aln.logProb = LOG_0;
         }
@@ -526,14 +662,16 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
       // EQCLASS
       double auxProbSum{0.0};
       for (auto& p : auxProbs) {
-        p = std::exp(p - auxDenom);
+        p = fastMath ? salmon::math::fastExp(p - auxDenom)
+                     : std::exp(p - auxDenom);
         auxProbSum += p;
       }
 
       auto eqSize = txpIDs.size();
       if (eqSize > 0) {
         if (useRankEqClasses and eqSize > 1) {
-          std::vector<int> inds(eqSize);
+          std::vector<int>& inds = scratch.rankInds;
+          inds.resize(eqSize);
           std::iota(inds.begin(), inds.end(), 0);
           // Get the indices in order by conditional probability
           std::sort(inds.begin(), inds.end(),
@@ -541,14 +679,17 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
                       return auxProbs[i] < auxProbs[j];
                     });
           {
-            decltype(txpIDs) txpIDsNew(txpIDs.size());
-            decltype(auxProbs) auxProbsNew(auxProbs.size());
+            auto& txpIDsNew = scratch.txpIDsTmp;
+            auto& auxProbsNew = scratch.auxProbsTmp;
+            // appending the ids in rank order also hashes them in that order
+            txpIDsNew.clear();
+            auxProbsNew.resize(auxProbs.size());
             for (size_t r = 0; r < eqSize; ++r) {
               auto ind = inds[r];
-              txpIDsNew[r] = txpIDs[ind];
+              txpIDsNew.push_back(txpIDs[ind]);
               auxProbsNew[r] = auxProbs[ind];
             }
-            std::swap(txpIDsNew, txpIDs);
+            swap(txpIDsNew, txpIDs);
             std::swap(auxProbsNew, auxProbs);
           }
         }
@@ -563,12 +704,29 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
           }
         }
 
-        TranscriptGroup tg(txpIDs);
-        eqBuilder.addGroup(std::move(tg), auxProbs);
+        scratch.eqKey.updateHash();
+        if (useOnlineBootstrap) {
+          onlineBootstrap(scratch.fragmentKeys[scratch.firstFragment +
+                                               fragmentIndex],
+                          scratch.replicateWeights.data());
+        }
+        if (localEqClasses) {
+          if (localEqClasses->add(scratch.eqKey, auxProbs, replicateWeights,
+                                  numReplicates)) {
+            localEqClasses->flush(eqBuilder);
+          }
+        } else {
+          eqBuilder.addGroupInPlace(scratch.eqKey, auxProbs, 1,
+                                    replicateWeights);
+        }
       }
+      scratch.endFragment();
 
       // normalize the hits
       for (auto& aln : alnGroup.alignments()) {
+        if (skipOnlineUpdates) {
+          break;
+        }
         if (std::abs(aln.logProb) == LOG_0) {
           continue;
         }
@@ -580,7 +738,11 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
 
         // Add the new mass to this transcript
         double newMass = logForgettingMass + aln.logProb;
-        transcript.addMass(newMass);
+        if (useLocalMass) {
+          scratch.addMass(transcriptID, newMass);
+        } else {
+          transcript.addMass(newMass);
+        }
 
         // Paired-end
         if (aln.libFormat().type == ReadType::PAIRED_END) {
@@ -642,6 +804,16 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
           }
         }
 
+        if (observeEffLengths and
+            aln.mateStatus == rapmap::utils::MateStatus::PAIRED_END_PAIRED) {
+          auto fragLength = aln.fragLengthPedantic(transcript.RefLength);
+          if (fragLength > 0 and fragLength <= transcript.RefLength) {
+            observedEffLengths.addFragment(
+                transcriptID, transcript.RefLength - fragLength + 1,
+                aln.logProb);
+          }
+        }
+
         if (gcBiasCorrect) {
           if (aln.libFormat().type == ReadType::PAIRED_END) {
             int32_t start = std::min(aln.pos, aln.matePos);
@@ -659,7 +831,7 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
             // For single-end reads, simply assume that every fragment
             // has a length equal to the conditional mean (given the
             // current transcript's length).
-            auto cmeans = readExp.condMeans();
+            const auto& cmeans = readExp.condMeans();
             auto cmean =
                 static_cast<int32_t>((transcript.RefLength >= cmeans.size())
                                          ? cmeans.back()
@@ -682,14 +854,26 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
           // Old fragment length calc: double fragLength = aln.fragLength();
           auto fragLength = aln.fragLengthPedantic(transcript.RefLength);
           if (fragLength > 0) {
-            fragLengthDist.addVal(fragLength, logForgettingMass);
+            if (useLocalMass) {
+              fragLengthDist.addVal(fragLength, logForgettingMass,
+                                    scratch.fldObservations);
+            } else {
+              fragLengthDist.addVal(fragLength, logForgettingMass);
+            }
           }
 
           if (useFSPD) {
             auto hitPos = aln.hitPos();
-            auto& fragStartDist = fragStartDists[transcript.lengthClassIndex()];
-            fragStartDist.addVal(hitPos, transcript.RefLength,
-                                 logForgettingMass);
+            auto lengthClass = transcript.lengthClassIndex();
+            auto& fragStartDist = fragStartDists[lengthClass];
+            if (useLocalMass) {
+              fragStartDist.addVal(hitPos, transcript.RefLength,
+                                   logForgettingMass,
+                                   fspdObservations[lengthClass]);
+            } else {
+              fragStartDist.addVal(hitPos, transcript.RefLength,
+                                   logForgettingMass);
+            }
           }
         }
       } // end normalize
@@ -712,6 +896,15 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
     } // end read group
   }   // end timer
 
+  // The end of the mini-batch; apply any mass that was accumulated locally
+  if (useLocalMass) {
+    scratch.flushMass(transcripts);
+    fragLengthDist.addVals(scratch.fldObservations);
+    for (size_t i = 0; i < fspdObservations.size(); ++i) {
+      fragStartDists[i].addVals(fspdObservations[i]);
+    }
+  }
+
   if (zeroProbFrags > 0) {
     auto batchReads = batchHits.size();
     maxZeroFrac = std::max(
@@ -731,6 +924,17 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
     // thread will set burnedIn to true.
     readExp.updateTranscriptLengthsAtomic(burnedIn);
     fragLengthDist.cacheCMF();
+    if (burnedIn) {
+      salmonOpts.perfStats->endPhase("burn_in");
+    }
+  }
+  if (burnedIn and !skipOnlineUpdates and
+      onlineConvergence.update(transcripts, fragLengthDist,
+                               numAssignedFragments)) {
+    salmonOpts.jointLog->info(
+        "The online estimates were stable after {} assigned fragments; the "
+        "remaining fragments will only be counted into equivalence classes",
+        onlineConvergence.convergedAtFragment());
   }
   if (initialRound) {
     readLib.updateLibTypeCounts(libTypeCounts);
@@ -738,11 +942,158 @@ void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
   }
 }
 
+/**
+ * Process the chunk of mapped fragments batchHits, as the mini-batches that
+ * scratch.sizer splits it into, with the instantiation of
+ * processMiniBatchImpl specialized for the run's options: the defaults, and
+ * --gcBias and / or --posBias on top of them (--seqBias doesn't need its
+ * own, since its samples are taken by the mapping loops); any other
+ * configuration is handled by the generic one.
+ */
+template <typename AlnT>
+void processMiniBatch(ReadExperiment& readExp, ForgettingMassCalculator& fmCalc,
+                      uint64_t firstTimestepOfRound, ReadLibrary& readLib,
+                      const SalmonOpts& salmonOpts,
+                      AlnGroupVecRange<AlnT> batchHits,
+                      std::vector<Transcript>& transcripts,
+                      ClusterForest& clusterForest,
+                      FragmentLengthDistribution& fragLengthDist,
+                      BiasParams& observedBiasParams,
+                      std::atomic<uint64_t>& numAssignedFragments,
+                      std::default_random_engine& randEng, bool initialRound,
+                      std::atomic<bool>& burnedIn, double& maxZeroFrac,
+                      MiniBatchScratch& scratch) {
+  namespace mbf = mini_batch_flags;
+  auto impl = &processMiniBatchImpl<AlnT, 0>;
+  switch (mbf::fromOptions(salmonOpts)) {
+  case mbf::DEFAULT:
+    impl = &processMiniBatchImpl<AlnT, mbf::DEFAULT>;
+    break;
+  case mbf::DEFAULT | mbf::GC_BIAS:
+    impl = &processMiniBatchImpl<AlnT, mbf::DEFAULT | mbf::GC_BIAS>;
+    break;
+  case mbf::DEFAULT | mbf::POS_BIAS:
+    impl = &processMiniBatchImpl<AlnT, mbf::DEFAULT | mbf::POS_BIAS>;
+    break;
+  case mbf::DEFAULT | mbf::GC_BIAS | mbf::POS_BIAS:
+    impl = &processMiniBatchImpl<AlnT,
+                                 mbf::DEFAULT | mbf::GC_BIAS | mbf::POS_BIAS>;
+    break;
+  default:
+    break;
+  }
+  auto& sizer = scratch.sizer;
+  auto first = batchHits.begin();
+  auto last = batchHits.end();
+  scratch.firstFragment = 0;
+  // (an empty chunk still takes its timestep, as it always has)
+  do {
+    size_t n = std::min(static_cast<size_t>(last - first),
+                        static_cast<size_t>(sizer.next(burnedIn)));
+    auto start = std::chrono::steady_clock::now();
+    impl(readExp, fmCalc, firstTimestepOfRound, readLib, salmonOpts,
+         boost::make_iterator_range(first, first + n), transcripts,
+         clusterForest, fragLengthDist, observedBiasParams,
+         numAssignedFragments, randEng, initialRound, burnedIn, maxZeroFrac,
+         scratch);
+    if (sizer.adaptive()) {
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      sizer.observe(n, elapsed.count());
+    }
+    first += n;
+    scratch.firstFragment += n;
+  } while (first != last);
+}
+
 /// START QUASI
 
-// To use the parser in the following, we get "jobs" until none is
-// available. A job behaves like a pointer to the type
-// jellyfish::sequence_list (see whole_sequence_parser.hpp).
+// Append read to w as a FASTA record (for --writeUnmappedReads)
+inline void writeFastaRecord(fmt::MemoryWriter& w,
+                             const fastx_parser::ReadSpanSeq& read) {
+  w << '>' << fmt::StringRef(read.name.data(), read.name.size()) << '\n'
+    << fmt::StringRef(read.seq.data(), read.seq.size()) << '\n';
+}
+
+/**
+ * Add the read start contexts of both mates of the paired mapping h to the
+ * sequence-bias model; false if either context doesn't exist (or the mates
+ * don't face each other), in which case neither is added.
+ */
+inline bool samplePairedSeqBias(const QuasiAlignment& h,
+                                std::vector<Transcript>& transcripts,
+                                BiasParams& observedBiasParams) {
+  auto& t = transcripts[h.tid];
+
+  // The "start" position is the leftmost position if
+  // map to the forward strand, and the leftmost
+  // position + the read length if we map to the reverse complement.
+
+  // read 1
+  int32_t pos1 = static_cast<int32_t>(h.pos);
+  auto dir1 = salmon::utils::boolToDirection(h.fwd);
+  int32_t startPos1 = h.fwd ? pos1 : (pos1 + h.readLen - 1);
+
+  // read 2
+  int32_t pos2 = static_cast<int32_t>(h.matePos);
+  auto dir2 = salmon::utils::boolToDirection(h.mateIsFwd);
+  int32_t startPos2 = h.mateIsFwd ? pos2 : (pos2 + h.mateLen - 1);
+
+  if ((dir1 == dir2) or // Shouldn't be from the same strand
+      !(startPos1 > 0 and startPos1 < t.RefLength) or
+      !(startPos2 > 0 and startPos2 < t.RefLength)) {
+    return false;
+  }
+
+  const char* txpStart = t.Sequence();
+  auto& readBiasFW = observedBiasParams.seqBiasModelFW;
+  auto& readBiasRC = observedBiasParams.seqBiasModelRC;
+  auto& readBias1 = (h.fwd) ? readBiasFW : readBiasRC;
+  auto& readBias2 = (h.mateIsFwd) ? readBiasFW : readBiasRC;
+
+  // Both contexts must exist (and the mates face each other)
+  // for either to be counted
+  int32_t fwPos = (h.fwd) ? startPos1 : startPos2;
+  int32_t rcPos = (h.fwd) ? startPos2 : startPos1;
+  uint64_t code1, code2;
+  if (fwPos < rcPos and
+      readBias1.encodeContext(txpStart, t.RefLength, startPos1, !h.fwd,
+                              code1) and
+      readBias2.encodeContext(txpStart, t.RefLength, startPos2,
+                              !h.mateIsFwd, code2)) {
+    readBias1.addEncoded(code1);
+    readBias2.addEncoded(code2);
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Add the read start context of the single-end mapping h to the
+ * sequence-bias model; false if it doesn't exist.
+ */
+inline bool sampleSingleSeqBias(const QuasiAlignment& h,
+                                std::vector<Transcript>& transcripts,
+                                BiasParams& observedBiasParams) {
+  // the "start" position is the leftmost position if
+  // we hit the forward strand, and the leftmost
+  // position + the read length if we hit the reverse complement
+  int32_t pos = static_cast<int32_t>(h.pos);
+  int32_t startPos = h.fwd ? pos : pos + h.readLen;
+
+  auto& t = transcripts[h.tid];
+  if (startPos > 0 and startPos < t.RefLength) {
+    auto& readBias = (h.fwd) ? observedBiasParams.seqBiasModelFW
+                             : observedBiasParams.seqBiasModelRC;
+    // If the context exists around the read, add it to the observed
+    // read start sequences.
+    return readBias.addContext(t.Sequence(), t.RefLength, startPos, !h.fwd);
+  }
+  return false;
+}
+
+// The reads are taken from the parser a chunk (read group) at a time, until
+// it has none left (see FastxParser.hpp).
 template <typename RapMapIndexT>
 void processReadsQuasi(
     paired_parser* parser, ReadExperiment& readExp, ReadLibrary& rl,
@@ -753,13 +1104,10 @@ void processReadsQuasi(
     RapMapIndexT* idx, std::vector<Transcript>& transcripts,
     ForgettingMassCalculator& fmCalc, ClusterForest& clusterForest,
     FragmentLengthDistribution& fragLengthDist, BiasParams& observedBiasParams,
-    /**
-     * NOTE : test new el model in future
-     * EffectiveLengthStats& obsEffLengths,
-     */
-    mem_opt_t* memOptions, SalmonOpts& salmonOpts, double coverageThresh,
-    std::mutex& iomutex, bool initialRound, std::atomic<bool>& burnedIn,
-    volatile bool& writeToCache) {
+    MiniBatchScratch& scratch, mem_opt_t* memOptions, SalmonOpts& salmonOpts,
+    double coverageThresh, std::mutex& iomutex, bool initialRound,
+    std::atomic<bool>& burnedIn, volatile bool& writeToCache,
+    MiniBatchPipeline<AlnGroupVec<SMEMAlignment>>* pipeline) {
 
   // ERROR
   salmonOpts.jointLog->error("MEM-mapping cannot be used with the Quasi index "
@@ -777,13 +1125,10 @@ void processReadsQuasi(
     RapMapIndexT* sidx, std::vector<Transcript>& transcripts,
     ForgettingMassCalculator& fmCalc, ClusterForest& clusterForest,
     FragmentLengthDistribution& fragLengthDist, BiasParams& observedBiasParams,
-    /**
-     * NOTE : test new el model in future
-     * EffectiveLengthStats& obsEffLengths,
-     */
-    mem_opt_t* memOptions, SalmonOpts& salmonOpts, double coverageThresh,
-    std::mutex& iomutex, bool initialRound, std::atomic<bool>& burnedIn,
-    volatile bool& writeToCache) {
+    MiniBatchScratch& scratch, mem_opt_t* memOptions, SalmonOpts& salmonOpts,
+    double coverageThresh, std::mutex& iomutex, bool initialRound,
+    std::atomic<bool>& burnedIn, volatile bool& writeToCache,
+    MiniBatchPipeline<AlnGroupVec<SMEMAlignment>>* pipeline) {
   // ERROR
   salmonOpts.jointLog->error("MEM-mapping cannot be used with the Quasi index "
                              "--- please report this bug on GitHub");
@@ -793,60 +1138,54 @@ void processReadsQuasi(
 template <typename RapMapIndexT>
 void processReadsQuasi(
     paired_parser* parser, ReadExperiment& readExp, ReadLibrary& rl,
-    AlnGroupVec<QuasiAlignment>& structureVec,
+    AlnGroupVec<QuasiAlignment>& threadStructureVec,
     std::atomic<uint64_t>& numObservedFragments,
     std::atomic<uint64_t>& numAssignedFragments,
     std::atomic<uint64_t>& validHits, std::atomic<uint64_t>& upperBoundHits,
     RapMapIndexT* qidx, std::vector<Transcript>& transcripts,
     ForgettingMassCalculator& fmCalc, ClusterForest& clusterForest,
     FragmentLengthDistribution& fragLengthDist, BiasParams& observedBiasParams,
-    /**
-     * NOTE : test new el model in future
-     * EffectiveLengthStats& obsEffLengths,
-     **/
-    mem_opt_t* memOptions, SalmonOpts& salmonOpts, double coverageThresh,
-    std::mutex& iomutex, bool initialRound, std::atomic<bool>& burnedIn,
-    volatile bool& writeToCache) {
+    MiniBatchScratch& scratch, mem_opt_t* memOptions, SalmonOpts& salmonOpts,
+    double coverageThresh, std::mutex& iomutex, bool initialRound,
+    std::atomic<bool>& burnedIn, volatile bool& writeToCache,
+    MiniBatchPipeline<AlnGroupVec<QuasiAlignment>>* pipeline) {
   uint64_t count_fwd = 0, count_bwd = 0;
-  // Seed with a real random value, if available
-  std::random_device rd;
-
-  // Create a random uniform distribution
-  std::default_random_engine eng(rd());
+  // Seed with a real random value, unless a seed was given
+  std::default_random_engine eng(salmon::utils::onlinePhaseSeed(salmonOpts));
 
   uint64_t prevObservedFrags{1};
   uint64_t leftHitCount{0};
   uint64_t hitListCount{0};
   salmon::utils::ShortFragStats shortFragStats;
   double maxZeroFrac{0.0};
+  prepareScratch(scratch, salmonOpts, threadStructureVec.size());
+  bool onlineBootstrap = salmonOpts.onlineBootstrap.enabled();
 
   // Write unmapped reads
   fmt::MemoryWriter unmappedNames;
   bool writeUnmapped = salmonOpts.writeUnmappedNames;
-  spdlog::logger* unmappedLogger =
-      (writeUnmapped) ? salmonOpts.unmappedLog.get() : nullptr;
+  AuxRecordWriter* unmappedWriter =
+      (writeUnmapped) ? salmonOpts.unmappedWriter.get() : nullptr;
+
+  // Write the unmapped (and perhaps the orphaned) pairs themselves
+  fmt::MemoryWriter unmappedLeft, unmappedRight;
+  AuxRecordWriter* unmappedPairWriter = salmonOpts.unmappedPairWriter.get();
+  bool writeUnmappedReads = (unmappedPairWriter != nullptr);
+  bool writeOrphanedReads = salmonOpts.writeOrphanedReads;
 
   // Write unmapped reads
   fmt::MemoryWriter orphanLinks;
   bool writeOrphanLinks = salmonOpts.writeOrphanLinks;
-  spdlog::logger* orphanLinkLogger =
-      (writeOrphanLinks) ? salmonOpts.orphanLinkLog.get() : nullptr;
-
-  auto& readBiasFW =
-      observedBiasParams
-          .seqBiasModelFW; // readExp.readBias(salmon::utils::Direction::FORWARD);
-  auto& readBiasRC =
-      observedBiasParams
-          .seqBiasModelRC; // readExp.readBias(salmon::utils::Direction::REVERSE_COMPLEMENT);
-  // k-mers for sequence bias context
-  Mer leftMer;
-  Mer rightMer;
+  AuxRecordWriter* orphanLinkWriter =
+      (writeOrphanLinks) ? salmonOpts.orphanLinkWriter.get() : nullptr;
 
   auto expectedLibType = rl.format();
 
   uint64_t firstTimestepOfRound = fmCalc.getCurrentTimestep();
   size_t minK = rapmap::utils::my_mer::k();
 
+  auto threadStart = std::chrono::steady_clock::now();
+  auto threadCounters = salmonOpts.perfStats->threadCounters();
   size_t locRead{0};
   uint64_t localUpperBoundHits{0};
   size_t rangeSize{0};
@@ -881,10 +1220,43 @@ void processReadsQuasi(
   fmt::MemoryWriter sstream;
   auto* qmLog = salmonOpts.qmLog.get();
   bool writeQuasimappings = (qmLog != nullptr);
+  auto* qmWriter = salmonOpts.qmWriter.get();
+  bool writeBinaryMappings = (qmWriter != nullptr);
+  salmon::mappings::BlockEncoder mappingBlock;
+  // The final mappings of the fragments go to the cache (--mappingCacheDir)
+  auto* cacheWriter = salmonOpts.mappingCacheWriter.get();
+  salmon::mapcache::BlockEncoder cacheBlock;
+
+  // The reads arrive as spans of their chunk's buffer; the hit collector and
+  // the mapping writer work on strings, so we copy each read into these
+  // (whose capacity is reused) here, on the mapping thread.
+  fastx_parser::ReadPair readTemp;
+  KmerLookupPrefetcher<RapMapIndexT> prefetcher(qidx, kmerPrefetchDistance);
+  MappingVerifier verifier(salmonOpts.maxEditFraction);
+  MappingVerifier::Read verifyLeft, verifyRight;
+  // (the orphan links are written from the unmerged hits, which aren't kept)
+  ReadMappingCache<QuasiAlignment> readCache(
+      writeOrphanLinks ? 0 : salmonOpts.readCacheSize);
+  RepeatSeedFilter<RapMapIndexT> repeatFilter(qidx, salmonOpts.maxKmerOcc);
+  uint64_t numRepeatRejected{0};
+  ReadPrefilter prefilter(salmonOpts.maxDust, salmonOpts.adapters,
+                          salmonOpts.minAdapterOverlap);
+  uint64_t numAdapterClipped{0};
+  uint64_t numLowComplexity{0};
+  auto* checkpointer = salmonOpts.checkpointer.get();
+  // (with a pipeline, the inference threads take the interim estimates)
+  auto* snapshotter =
+      (pipeline == nullptr) ? salmonOpts.snapshotter.get() : nullptr;
 
   auto rg = parser->getReadGroup();
+  // (the spans are only recorded with --trace)
+  auto spanStart = PerformanceStats::Clock::now();
   while (parser->refill(rg)) {
+    salmonOpts.perfStats->span("parser_wait", spanStart);
     rangeSize = rg.size();
+    // (with a pipeline, the fragments are mapped into one of its slots)
+    auto& structureVec =
+        (pipeline != nullptr) ? *pipeline->acquire() : threadStructureVec;
 
     if (rangeSize > structureVec.size()) {
       salmonOpts.jointLog->error("rangeSize = {}, but structureVec.size() = {} "
@@ -894,10 +1266,36 @@ void processReadsQuasi(
       std::exit(1);
     }
 
+    size_t numPrimed = std::min(rangeSize, size_t(prefetcher.distance() / 2));
+    for (size_t i = 0; i < numPrimed; ++i) {
+      prefetcher.prime(2 * i, rg[i].first.seq.data(), rg[i].first.seq.size());
+      prefetcher.prime(2 * i + 1, rg[i].second.seq.data(),
+                       rg[i].second.seq.size());
+    }
+
     for (size_t i = 0; i < rangeSize; ++i) { // For all the read in this batch
       auto& rp = rg[i];
-      readLenLeft = rp.first.seq.length();
-      readLenRight = rp.second.seq.length();
+      if (onlineBootstrap) {
+        // (the key of a pair is that of its first mate's name)
+        scratch.fragmentKeys[i] =
+            XXH64(rp.first.name.data(), rp.first.name.size(), 0);
+      }
+      // (each mate takes a slot, so the pair distance / 2 ahead is staged)
+      size_t ahead = i + prefetcher.distance() / 2;
+      bool haveAhead = (ahead < rangeSize);
+      prefetcher(2 * i, haveAhead ? rg[ahead].first.seq.data() : nullptr,
+                 haveAhead ? rg[ahead].first.seq.size() : 0);
+      prefetcher(2 * i + 1, haveAhead ? rg[ahead].second.seq.data() : nullptr,
+                 haveAhead ? rg[ahead].second.seq.size() : 0);
+      rp.first.seq.assignTo(readTemp.first.seq);
+      rp.second.seq.assignTo(readTemp.second.seq);
+      // Adapters are clipped off before anything else looks at the reads
+      if (prefilter.clipsAdapters()) {
+        numAdapterClipped += prefilter.clipAdapter(readTemp.first.seq);
+        numAdapterClipped += prefilter.clipAdapter(readTemp.second.seq);
+      }
+      readLenLeft = readTemp.first.seq.length();
+      readLenRight = readTemp.second.seq.length();
       bool tooShortLeft = (readLenLeft < minK);
       bool tooShortRight = (readLenRight < minK);
       tooManyHits = false;
@@ -909,16 +1307,35 @@ void processReadsQuasi(
       rightHits.clear();
       mapType = salmon::utils::MappingType::UNMAPPED;
 
-      bool lh = tooShortLeft
-                    ? false
-                    : hitCollector(rp.first.seq, leftHits, saSearcher,
-                                   MateStatus::PAIRED_END_LEFT, consistentHits);
-
-      bool rh =
-          tooShortRight
-              ? false
-              : hitCollector(rp.second.seq, rightHits, saSearcher,
-                             MateStatus::PAIRED_END_RIGHT, consistentHits);
+      // An exact duplicate of a recently mapped pair has the same hits
+      bool cachedHits = readCache.enabled() and
+                        !(tooShortLeft and tooShortRight) and
+                        readCache.lookup(readTemp.first.seq,
+                                         readTemp.second.seq, jointHits);
+      // Nor is a pair of low complexity
+      bool lowComplexity =
+          prefilter.filtersComplexity() and !cachedHits and
+          !(tooShortLeft and tooShortRight) and
+          (tooShortLeft or prefilter.lowComplexity(readTemp.first.seq)) and
+          (tooShortRight or prefilter.lowComplexity(readTemp.second.seq));
+      numLowComplexity += lowComplexity;
+      // A pair made only of highly repetitive sequence isn't mapped
+      bool repeatOnly =
+          repeatFilter.enabled() and !cachedHits and !lowComplexity and
+          !(tooShortLeft and tooShortRight) and
+          (tooShortLeft or repeatFilter.tooFrequent(readTemp.first.seq)) and
+          (tooShortRight or repeatFilter.tooFrequent(readTemp.second.seq));
+      numRepeatRejected += repeatOnly;
+      bool skipMapping = cachedHits or lowComplexity or repeatOnly;
+
+      if (!tooShortLeft and !skipMapping) {
+        hitCollector(readTemp.first.seq, leftHits, saSearcher,
+                     MateStatus::PAIRED_END_LEFT, consistentHits);
+      }
+      if (!tooShortRight and !skipMapping) {
+        hitCollector(readTemp.second.seq, rightHits, saSearcher,
+                     MateStatus::PAIRED_END_RIGHT, consistentHits);
+      }
 
       // Consider a read as too short if both ends are too short
       if (tooShortLeft and tooShortRight) {
@@ -928,15 +1345,15 @@ void processReadsQuasi(
       } else {
         // If we actually attempted to map the fragment (it wasn't too short),
         // then
-        // do the intersection.
-        if (strictIntersect) {
-          rapmap::utils::mergeLeftRightHits(leftHits, rightHits, jointHits,
-                                            readLenLeft, maxNumHits,
-                                            tooManyHits, hctr);
-        } else {
-          rapmap::utils::mergeLeftRightHitsFuzzy(lh, rh, leftHits, rightHits,
-                                                 jointHits, readLenLeft,
-                                                 maxNumHits, tooManyHits, hctr);
+        // do the intersection (unless jointHits came from the cache).
+        if (!skipMapping) {
+          tooManyHits = salmon::utils::mergePairedHits(
+              leftHits, rightHits, jointHits, !strictIntersect, maxNumHits,
+              hctr);
+        }
+        if (readCache.enabled() and !skipMapping) {
+          readCache.insert(readTemp.first.seq, readTemp.second.seq,
+                           jointHits);
         }
 
         if (initialRound) {
@@ -947,6 +1364,32 @@ void processReadsQuasi(
         if (jointHits.size() > salmonOpts.maxReadOccs) {
           jointHitGroup.clearAlignments();
         }
+
+        // Drop the candidates that are too far from the transcript
+        if (verifier.enabled() and !jointHits.empty()) {
+          verifyLeft.reset(readTemp.first.seq);
+          verifyRight.reset(readTemp.second.seq);
+          auto failsCheck = [&](const QuasiAlignment& h) -> bool {
+            auto& t = transcripts[h.tid];
+            int32_t txpLen = static_cast<int32_t>(t.RefLength);
+            switch (h.mateStatus) {
+            case rapmap::utils::MateStatus::PAIRED_END_PAIRED:
+              return !verifier.check(verifyLeft, h.tid, h.pos, h.fwd,
+                                     t.Sequence(), txpLen) or
+                     !verifier.check(verifyRight, h.tid, h.matePos,
+                                     h.mateIsFwd, t.Sequence(), txpLen);
+            case rapmap::utils::MateStatus::PAIRED_END_RIGHT:
+              return !verifier.check(verifyRight, h.tid, h.pos, h.fwd,
+                                     t.Sequence(), txpLen);
+            default:
+              return !verifier.check(verifyLeft, h.tid, h.pos, h.fwd,
+                                     t.Sequence(), txpLen);
+            }
+          };
+          jointHits.erase(
+              std::remove_if(jointHits.begin(), jointHits.end(), failsCheck),
+              jointHits.end());
+        }
       }
 
       // NOTE: This will currently not work with "strict intersect", i.e.
@@ -988,37 +1431,14 @@ void processReadsQuasi(
             jointHitGroup.clearAlignments();
           }
         } else {
-          // If these aren't paired-end reads --- so that
-          // we have orphans --- make sure we sort the
-          // mappings so that they are in transcript order
+          // If these aren't paired-end reads --- so that we have orphans ---
+          // they all came from the same end (see mergePairedHits), which
+          // the first one tells us
           if (!isPaired) {
-            // Find the end of the hits for the left read
-            auto leftHitEndIt = std::partition_point(
-                jointHits.begin(), jointHits.end(),
-                [](const QuasiAlignment& q) -> bool {
-                  return q.mateStatus ==
-                         rapmap::utils::MateStatus::PAIRED_END_LEFT;
-                });
-            // If we found left hits
-            bool foundLeftMappings = (leftHitEndIt > jointHits.begin());
-            // If we found right hits
-            bool foundRightMappings = (leftHitEndIt < jointHits.end());
-
-            if (foundLeftMappings and foundRightMappings) {
-              mapType = salmon::utils::MappingType::BOTH_ORPHAN;
-            } else if (foundLeftMappings) {
-              mapType = salmon::utils::MappingType::LEFT_ORPHAN;
-            } else if (foundRightMappings) {
-              mapType = salmon::utils::MappingType::RIGHT_ORPHAN;
-            }
-
-            // Merge the hits so that the entire list is in order
-            // by transcript ID.
-            std::inplace_merge(
-                jointHits.begin(), leftHitEndIt, jointHits.end(),
-                [](const QuasiAlignment& a, const QuasiAlignment& b) -> bool {
-                  return a.transcriptID() < b.transcriptID();
-                });
+            mapType = (jointHits.front().mateStatus ==
+                       rapmap::utils::MateStatus::PAIRED_END_LEFT)
+                          ? salmon::utils::MappingType::LEFT_ORPHAN
+                          : salmon::utils::MappingType::RIGHT_ORPHAN;
           }
         }
 
@@ -1037,76 +1457,10 @@ void processReadsQuasi(
           // for this read yet, and we haven't collected the required number of
           // samples overall.
           if (needBiasSample and salmonOpts.numBiasSamples > 0 and isPaired and
-              hn == hitSamp) {
-            auto& t = transcripts[h.tid];
-
-            // The "start" position is the leftmost position if
-            // map to the forward strand, and the leftmost
-            // position + the read length if we map to the reverse complement.
-
-            // read 1
-            int32_t pos1 = static_cast<int32_t>(h.pos);
-            auto dir1 = salmon::utils::boolToDirection(h.fwd);
-            int32_t startPos1 = h.fwd ? pos1 : (pos1 + h.readLen - 1);
-
-            // read 2
-            int32_t pos2 = static_cast<int32_t>(h.matePos);
-            auto dir2 = salmon::utils::boolToDirection(h.mateIsFwd);
-            int32_t startPos2 = h.mateIsFwd ? pos2 : (pos2 + h.mateLen - 1);
-
-            bool success = false;
-
-            if ((dir1 != dir2) and // Shouldn't be from the same strand
-                (startPos1 > 0 and startPos1 < t.RefLength) and
-                (startPos2 > 0 and startPos2 < t.RefLength)) {
-
-              const char* txpStart = t.Sequence();
-              const char* txpEnd = txpStart + t.RefLength;
-
-              const char* readStart1 = txpStart + startPos1;
-              auto& readBias1 = (h.fwd) ? readBiasFW : readBiasRC;
-
-              const char* readStart2 = txpStart + startPos2;
-              auto& readBias2 = (h.mateIsFwd) ? readBiasFW : readBiasRC;
-
-              int32_t fwPre = readBias1.contextBefore(!h.fwd);
-              int32_t fwPost = readBias1.contextAfter(!h.fwd);
-
-              int32_t rcPre = readBias2.contextBefore(!h.mateIsFwd);
-              int32_t rcPost = readBias2.contextAfter(!h.mateIsFwd);
-
-              bool read1RC = !h.fwd;
-              bool read2RC = !h.mateIsFwd;
-
-              if ((startPos1 >= readBias1.contextBefore(read1RC) and
-                   startPos1 + readBias1.contextAfter(read1RC) <
-                       t.RefLength) and
-                  (startPos2 >= readBias2.contextBefore(read2RC) and
-                   startPos2 + readBias2.contextAfter(read2RC) < t.RefLength)) {
-
-                int32_t fwPos = (h.fwd) ? startPos1 : startPos2;
-                int32_t rcPos = (h.fwd) ? startPos2 : startPos1;
-                if (fwPos < rcPos) {
-                  leftMer.from_chars(txpStart + startPos1 -
-                                     readBias1.contextBefore(read1RC));
-                  rightMer.from_chars(txpStart + startPos2 -
-                                      readBias2.contextBefore(read2RC));
-                  if (read1RC) {
-                    leftMer.reverse_complement();
-                  } else {
-                    rightMer.reverse_complement();
-                  }
-
-                  success = readBias1.addSequence(leftMer, 1.0);
-                  success = readBias2.addSequence(rightMer, 1.0);
-                }
-              }
-
-              if (success) {
-                salmonOpts.numBiasSamples -= 1;
-                needBiasSample = false;
-              }
-            }
+              hn == hitSamp and
+              samplePairedSeqBias(h, transcripts, observedBiasParams)) {
+            salmonOpts.numBiasSamples -= 1;
+            needBiasSample = false;
           }
           // ---- Collect bias samples ------ //
           ++hn;
@@ -1133,8 +1487,14 @@ void processReadsQuasi(
         }
 
         if (writeQuasimappings) {
-          rapmap::utils::writeAlignmentsToStream(rp, formatter, hctr, jointHits,
-                                                 sstream);
+          rp.first.name.assignTo(readTemp.first.name);
+          rp.second.name.assignTo(readTemp.second.name);
+          rapmap::utils::writeAlignmentsToStream(readTemp, formatter, hctr,
+                                                 jointHits, sstream);
+        }
+        if (writeBinaryMappings) {
+          mappingBlock.add(rp.first.name.data(), rp.first.name.size(),
+                           jointHits);
         }
 
       } else {
@@ -1146,10 +1506,22 @@ void processReadsQuasi(
           mapType != salmon::utils::MappingType::PAIRED_MAPPED) {
         // If we have no mappings --- then there's nothing to do
         // unless we're outputting names for un-mapped reads
-        unmappedNames << rp.first.name << ' ' << salmon::utils::str(mapType)
+        unmappedNames << fmt::StringRef(rp.first.name.data(),
+                                        rp.first.name.size())
+                      << ' ' << salmon::utils::str(mapType)
                       << '\n';
       }
+      if (writeUnmappedReads and
+          (mapType == salmon::utils::MappingType::UNMAPPED or
+           (writeOrphanedReads and
+            mapType != salmon::utils::MappingType::PAIRED_MAPPED))) {
+        writeFastaRecord(unmappedLeft, rp.first);
+        writeFastaRecord(unmappedRight, rp.second);
+      }
 
+      if (cacheWriter != nullptr) {
+        cacheBlock.add(jointHits);
+      }
       validHits += jointHits.size();
       localNumAssignedFragments += (jointHits.size() > 0);
       locRead++;
@@ -1176,13 +1548,8 @@ void processReadsQuasi(
     } // end for i < j->nb_filled
 
     if (writeUnmapped) {
-      std::string outStr(unmappedNames.str());
-      // Get rid of last newline
-      if (!outStr.empty()) {
-        outStr.pop_back();
-        unmappedLogger->info(std::move(outStr));
-      }
-      unmappedNames.clear();
+      // hands the batch (newlines and all) to the writer's thread
+      unmappedWriter->write(unmappedNames);
     }
 
     if (writeQuasimappings) {
@@ -1194,28 +1561,46 @@ void processReadsQuasi(
       }
       sstream.clear();
     }
+    if (writeBinaryMappings) {
+      mappingBlock.flushIfFull(*qmWriter);
+    }
+    if (cacheWriter != nullptr) {
+      cacheBlock.flushIfFull(*cacheWriter);
+    }
 
     if (writeOrphanLinks) {
-      std::string outStr(orphanLinks.str());
-      // Get rid of last newline
-      if (!outStr.empty()) {
-        outStr.pop_back();
-        orphanLinkLogger->info(std::move(outStr));
-      }
-      orphanLinks.clear();
+      orphanLinkWriter->write(orphanLinks);
+    }
+    if (writeUnmappedReads) {
+      // (the mates of the batch go to the two files together)
+      unmappedPairWriter->write(unmappedLeft, unmappedRight);
     }
 
     prevObservedFrags = numObservedFragments;
     AlnGroupVecRange<QuasiAlignment> hitLists = boost::make_iterator_range(
         structureVec.begin(), structureVec.begin() + rangeSize);
+    salmonOpts.perfStats->span("map_reads", spanStart);
+    if (pipeline != nullptr) {
+      // (the inference threads process it; see processMiniBatches)
+      pipeline->submit(&structureVec, rangeSize);
+      continue;
+    }
     processMiniBatch<QuasiAlignment>(
         readExp, fmCalc, firstTimestepOfRound, rl, salmonOpts, hitLists,
         transcripts, clusterForest, fragLengthDist, observedBiasParams,
-        /**
-         * NOTE : test new el model in future
-         * obsEffLengths,
-         */
-        numAssignedFragments, eng, initialRound, burnedIn, maxZeroFrac);
+        numAssignedFragments, eng, initialRound, burnedIn, maxZeroFrac,
+        scratch);
+    salmonOpts.perfStats->span("processMiniBatch", spanStart);
+    if (checkpointer != nullptr) {
+      checkpointer->pauseIfDue(numObservedFragments, [&]() -> void {
+        if (scratch.localEqClasses() != nullptr) {
+          scratch.localEqClasses()->flush(readExp.equivalenceClassBuilder());
+        }
+      });
+    }
+    if (snapshotter != nullptr) {
+      snapshotter->pauseIfDue(numObservedFragments);
+    }
   }
 
   if (maxZeroFrac > 0.0) {
@@ -1224,37 +1609,52 @@ void processReadsQuasi(
                               maxZeroFrac);
   }
 
+  if (writeBinaryMappings) {
+    mappingBlock.flush(*qmWriter);
+  }
+  if (cacheWriter != nullptr) {
+    cacheBlock.flush(*cacheWriter);
+  }
+  std::chrono::duration<double> threadTime =
+      std::chrono::steady_clock::now() - threadStart;
+  salmonOpts.perfStats->addMappingThread(locRead, threadTime.count(),
+                                         threadCounters.get());
   readExp.updateShortFrags(shortFragStats);
+  readExp.addScratchRegrowths(scratch.takeRegrowths());
+  readExp.addMappingVerifierStats(verifier.stats());
+  readExp.addReadCacheStats(readCache.numLookups(), readCache.numHits());
+  readExp.addRepeatRejections(numRepeatRejected);
+  readExp.addPrefilterStats(numAdapterClipped, numLowComplexity);
+  scratch.finishLocalEqClasses(readExp.equivalenceClassBuilder());
+  if (checkpointer != nullptr) {
+    checkpointer->leave();
+  }
+  if (snapshotter != nullptr) {
+    snapshotter->leave();
+  }
 }
 
 // SINGLE END
 
-// To use the parser in the following, we get "jobs" until none is
-// available. A job behaves like a pointer to the type
-// jellyfish::sequence_list (see whole_sequence_parser.hpp).
+// The reads are taken from the parser a chunk (read group) at a time, until
+// it has none left (see FastxParser.hpp).
 template <typename RapMapIndexT>
 void processReadsQuasi(
     single_parser* parser, ReadExperiment& readExp, ReadLibrary& rl,
-    AlnGroupVec<QuasiAlignment>& structureVec,
+    AlnGroupVec<QuasiAlignment>& threadStructureVec,
     std::atomic<uint64_t>& numObservedFragments,
     std::atomic<uint64_t>& numAssignedFragments,
     std::atomic<uint64_t>& validHits, std::atomic<uint64_t>& upperBoundHits,
     RapMapIndexT* qidx, std::vector<Transcript>& transcripts,
     ForgettingMassCalculator& fmCalc, ClusterForest& clusterForest,
     FragmentLengthDistribution& fragLengthDist, BiasParams& observedBiasParams,
-    /**
-     * NOTE : test new el model in future
-     * EffectiveLengthStats& obsEffLengths,
-     **/
-    mem_opt_t* memOptions, SalmonOpts& salmonOpts, double coverageThresh,
-    std::mutex& iomutex, bool initialRound, std::atomic<bool>& burnedIn,
-    volatile bool& writeToCache) {
+    MiniBatchScratch& scratch, mem_opt_t* memOptions, SalmonOpts& salmonOpts,
+    double coverageThresh, std::mutex& iomutex, bool initialRound,
+    std::atomic<bool>& burnedIn, volatile bool& writeToCache,
+    MiniBatchPipeline<AlnGroupVec<QuasiAlignment>>* pipeline) {
   uint64_t count_fwd = 0, count_bwd = 0;
-  // Seed with a real random value, if available
-  std::random_device rd;
-
-  // Create a random uniform distribution
-  std::default_random_engine eng(rd());
+  // Seed with a real random value, unless a seed was given
+  std::default_random_engine eng(salmon::utils::onlinePhaseSeed(salmonOpts));
 
   uint64_t prevObservedFrags{1};
   uint64_t leftHitCount{0};
@@ -1262,16 +1662,18 @@ void processReadsQuasi(
   salmon::utils::ShortFragStats shortFragStats;
   bool tooShort{false};
   double maxZeroFrac{0.0};
+  prepareScratch(scratch, salmonOpts, threadStructureVec.size());
+  bool onlineBootstrap = salmonOpts.onlineBootstrap.enabled();
 
   // Write unmapped reads
   fmt::MemoryWriter unmappedNames;
   bool writeUnmapped = salmonOpts.writeUnmappedNames;
-  spdlog::logger* unmappedLogger =
-      (writeUnmapped) ? salmonOpts.unmappedLog.get() : nullptr;
-
-  auto& readBiasFW = observedBiasParams.seqBiasModelFW;
-  auto& readBiasRC = observedBiasParams.seqBiasModelRC;
-  Mer context;
+  AuxRecordWriter* unmappedWriter =
+      (writeUnmapped) ? salmonOpts.unmappedWriter.get() : nullptr;
+  // ... and the unmapped reads themselves
+  fmt::MemoryWriter unmappedReads;
+  AuxRecordWriter* unmappedReadWriter = salmonOpts.unmappedReadWriter.get();
+  bool writeUnmappedReads = (unmappedReadWriter != nullptr);
 
   const char* txomeStr = qidx->seq.c_str();
 
@@ -1280,6 +1682,8 @@ void processReadsQuasi(
   uint64_t firstTimestepOfRound = fmCalc.getCurrentTimestep();
   size_t minK = rapmap::utils::my_mer::k();
 
+  auto threadStart = std::chrono::steady_clock::now();
+  auto threadCounters = salmonOpts.perfStats->threadCounters();
   size_t locRead{0};
   uint64_t localUpperBoundHits{0};
   size_t rangeSize{0};
@@ -1309,10 +1713,40 @@ void processReadsQuasi(
   fmt::MemoryWriter sstream;
   auto* qmLog = salmonOpts.qmLog.get();
   bool writeQuasimappings = (qmLog != nullptr);
+  auto* qmWriter = salmonOpts.qmWriter.get();
+  bool writeBinaryMappings = (qmWriter != nullptr);
+  salmon::mappings::BlockEncoder mappingBlock;
+  // The final mappings of the fragments go to the cache (--mappingCacheDir)
+  auto* cacheWriter = salmonOpts.mappingCacheWriter.get();
+  salmon::mapcache::BlockEncoder cacheBlock;
+
+  // The hit collector and the mapping writer work on strings (see the
+  // paired-end version)
+  fastx_parser::ReadSeq readTemp;
+  KmerLookupPrefetcher<RapMapIndexT> prefetcher(qidx, kmerPrefetchDistance);
+  MappingVerifier verifier(salmonOpts.maxEditFraction);
+  MappingVerifier::Read verifyRead;
+  ReadMappingCache<QuasiAlignment> readCache(salmonOpts.readCacheSize);
+  RepeatSeedFilter<RapMapIndexT> repeatFilter(qidx, salmonOpts.maxKmerOcc);
+  uint64_t numRepeatRejected{0};
+  ReadPrefilter prefilter(salmonOpts.maxDust, salmonOpts.adapters,
+                          salmonOpts.minAdapterOverlap);
+  uint64_t numAdapterClipped{0};
+  uint64_t numLowComplexity{0};
+  auto* checkpointer = salmonOpts.checkpointer.get();
+  // (with a pipeline, the inference threads take the interim estimates)
+  auto* snapshotter =
+      (pipeline == nullptr) ? salmonOpts.snapshotter.get() : nullptr;
 
   auto rg = parser->getReadGroup();
+  // (the spans are only recorded with --trace)
+  auto spanStart = PerformanceStats::Clock::now();
   while (parser->refill(rg)) {
+    salmonOpts.perfStats->span("parser_wait", spanStart);
     rangeSize = rg.size();
+    // (with a pipeline, the fragments are mapped into one of its slots)
+    auto& structureVec =
+        (pipeline != nullptr) ? *pipeline->acquire() : threadStructureVec;
     if (rangeSize > structureVec.size()) {
       salmonOpts.jointLog->error("rangeSize = {}, but structureVec.size() = {} "
                                  "--- this shouldn't happen.\n"
@@ -1321,9 +1755,26 @@ void processReadsQuasi(
       std::exit(1);
     }
 
+    size_t numPrimed = std::min(rangeSize, size_t(prefetcher.distance()));
+    for (size_t i = 0; i < numPrimed; ++i) {
+      prefetcher.prime(i, rg[i].seq.data(), rg[i].seq.size());
+    }
+
     for (size_t i = 0; i < rangeSize; ++i) { // For all the read in this batch
       auto& rp = rg[i];
-      readLen = rp.seq.length();
+      if (onlineBootstrap) {
+        scratch.fragmentKeys[i] = XXH64(rp.name.data(), rp.name.size(), 0);
+      }
+      size_t ahead = i + prefetcher.distance();
+      bool haveAhead = (ahead < rangeSize);
+      prefetcher(i, haveAhead ? rg[ahead].seq.data() : nullptr,
+                 haveAhead ? rg[ahead].seq.size() : 0);
+      rp.seq.assignTo(readTemp.seq);
+      // Adapters are clipped off before anything else looks at the read
+      if (prefilter.clipsAdapters()) {
+        numAdapterClipped += prefilter.clipAdapter(readTemp.seq);
+      }
+      readLen = readTemp.seq.length();
       tooShort = (readLen < minK);
       tooManyHits = false;
       localUpperBoundHits = 0;
@@ -1331,9 +1782,26 @@ void processReadsQuasi(
       auto& jointHits = jointHitGroup.alignments();
       jointHitGroup.clearAlignments();
 
-      bool lh = tooShort ? false
-                         : hitCollector(rp.seq, jointHits, saSearcher,
-                                        MateStatus::SINGLE_END, consistentHits);
+      // An exact duplicate of a recently mapped read has the same hits
+      bool cachedHits = readCache.enabled() and !tooShort and
+                        readCache.lookup(readTemp.seq, jointHits);
+      // Nor is a read of low complexity, or one made only of highly
+      // repetitive sequence
+      bool lowComplexity = !tooShort and !cachedHits and
+                           prefilter.lowComplexity(readTemp.seq);
+      numLowComplexity += lowComplexity;
+      bool repeatOnly = !tooShort and !cachedHits and !lowComplexity and
+                        repeatFilter.tooFrequent(readTemp.seq);
+      numRepeatRejected += repeatOnly;
+      bool skipMapping = cachedHits or lowComplexity or repeatOnly;
+
+      bool lh = (tooShort or skipMapping)
+                    ? false
+                    : hitCollector(readTemp.seq, jointHits, saSearcher,
+                                   MateStatus::SINGLE_END, consistentHits);
+      if (readCache.enabled() and !tooShort and !skipMapping) {
+        readCache.insert(readTemp.seq, jointHits);
+      }
 
       // If the fragment was too short, record it
       if (tooShort) {
@@ -1350,48 +1818,33 @@ void processReadsQuasi(
         jointHitGroup.clearAlignments();
       }
 
+      // Drop the candidates that are too far from the transcript
+      if (verifier.enabled() and !jointHits.empty()) {
+        verifyRead.reset(readTemp.seq);
+        auto failsCheck = [&](const QuasiAlignment& h) -> bool {
+          auto& t = transcripts[h.tid];
+          return !verifier.check(verifyRead, h.tid, h.pos, h.fwd,
+                                 t.Sequence(),
+                                 static_cast<int32_t>(t.RefLength));
+        };
+        jointHits.erase(
+            std::remove_if(jointHits.begin(), jointHits.end(), failsCheck),
+            jointHits.end());
+      }
+
       bool needBiasSample = salmonOpts.biasCorrect;
 
       for (auto& h : jointHits) {
 
         // ---- Collect bias samples ------ //
-        int32_t pos = static_cast<int32_t>(h.pos);
-        auto dir = salmon::utils::boolToDirection(h.fwd);
 
         // If bias correction is turned on, and we haven't sampled a mapping
         // for this read yet, and we haven't collected the required number of
         // samples overall.
-        if (needBiasSample and salmonOpts.numBiasSamples > 0) {
-          // the "start" position is the leftmost position if
-          // we hit the forward strand, and the leftmost
-          // position + the read length if we hit the reverse complement
-          int32_t startPos = h.fwd ? pos : pos + h.readLen;
-
-          auto& t = transcripts[h.tid];
-          if (startPos > 0 and startPos < t.RefLength) {
-            auto& readBias = (h.fwd) ? readBiasFW : readBiasRC;
-            const char* txpStart = t.Sequence();
-            const char* readStart = txpStart + startPos;
-            const char* txpEnd = txpStart + t.RefLength;
-
-            bool success{false};
-            // If the context exists around the read, add it to the observed
-            // read start sequences.
-            if (startPos >= readBias.contextBefore(!h.fwd) and
-                startPos + readBias.contextAfter(!h.fwd) < t.RefLength) {
-              context.from_chars(txpStart + startPos -
-                                 readBias.contextBefore(!h.fwd));
-              if (!h.fwd) {
-                context.reverse_complement();
-              }
-              success = readBias.addSequence(context, 1.0);
-            }
-
-            if (success) {
-              salmonOpts.numBiasSamples -= 1;
-              needBiasSample = false;
-            }
-          }
+        if (needBiasSample and salmonOpts.numBiasSamples > 0 and
+            sampleSingleSeqBias(h, transcripts, observedBiasParams)) {
+          salmonOpts.numBiasSamples -= 1;
+          needBiasSample = false;
         }
         // ---- Collect bias samples ------ //
 
@@ -1403,16 +1856,27 @@ void processReadsQuasi(
       }
 
       if (writeQuasimappings) {
-        rapmap::utils::writeAlignmentsToStream(rp, formatter, hctr, jointHits,
-                                               sstream);
+        rp.name.assignTo(readTemp.name);
+        rapmap::utils::writeAlignmentsToStream(readTemp, formatter, hctr,
+                                               jointHits, sstream);
+      }
+      if (writeBinaryMappings and !jointHits.empty()) {
+        mappingBlock.add(rp.name.data(), rp.name.size(), jointHits);
       }
 
       if (writeUnmapped and jointHits.empty()) {
         // If we have no mappings --- then there's nothing to do
         // unless we're outputting names for un-mapped reads
-        unmappedNames << rp.name << " u\n";
+        unmappedNames << fmt::StringRef(rp.name.data(), rp.name.size())
+                      << " u\n";
+      }
+      if (writeUnmappedReads and jointHits.empty()) {
+        writeFastaRecord(unmappedReads, rp);
       }
 
+      if (cacheWriter != nullptr) {
+        cacheBlock.add(jointHits);
+      }
       validHits += jointHits.size();
       locRead++;
       ++numObservedFragments;
@@ -1438,13 +1902,11 @@ void processReadsQuasi(
     } // end for i < j->nb_filled
 
     if (writeUnmapped) {
-      std::string outStr(unmappedNames.str());
-      // Get rid of last newline
-      if (!outStr.empty()) {
-        outStr.pop_back();
-        unmappedLogger->info(std::move(outStr));
-      }
-      unmappedNames.clear();
+      // hands the batch (newlines and all) to the writer's thread
+      unmappedWriter->write(unmappedNames);
+    }
+    if (writeUnmappedReads) {
+      unmappedReadWriter->write(unmappedReads);
     }
 
     if (writeQuasimappings) {
@@ -1456,20 +1918,62 @@ void processReadsQuasi(
       }
       sstream.clear();
     }
+    if (writeBinaryMappings) {
+      mappingBlock.flushIfFull(*qmWriter);
+    }
+    if (cacheWriter != nullptr) {
+      cacheBlock.flushIfFull(*cacheWriter);
+    }
 
     prevObservedFrags = numObservedFragments;
     AlnGroupVecRange<QuasiAlignment> hitLists = boost::make_iterator_range(
         structureVec.begin(), structureVec.begin() + rangeSize);
+    salmonOpts.perfStats->span("map_reads", spanStart);
+    if (pipeline != nullptr) {
+      // (the inference threads process it; see processMiniBatches)
+      pipeline->submit(&structureVec, rangeSize);
+      continue;
+    }
     processMiniBatch<QuasiAlignment>(
         readExp, fmCalc, firstTimestepOfRound, rl, salmonOpts, hitLists,
         transcripts, clusterForest, fragLengthDist, observedBiasParams,
-        /**
-         * NOTE : test new el model in future
-         * obsEffLengths,
-         **/
-        numAssignedFragments, eng, initialRound, burnedIn, maxZeroFrac);
+        numAssignedFragments, eng, initialRound, burnedIn, maxZeroFrac,
+        scratch);
+    salmonOpts.perfStats->span("processMiniBatch", spanStart);
+    if (checkpointer != nullptr) {
+      checkpointer->pauseIfDue(numObservedFragments, [&]() -> void {
+        if (scratch.localEqClasses() != nullptr) {
+          scratch.localEqClasses()->flush(readExp.equivalenceClassBuilder());
+        }
+      });
+    }
+    if (snapshotter != nullptr) {
+      snapshotter->pauseIfDue(numObservedFragments);
+    }
   }
+  if (writeBinaryMappings) {
+    mappingBlock.flush(*qmWriter);
+  }
+  if (cacheWriter != nullptr) {
+    cacheBlock.flush(*cacheWriter);
+  }
+  std::chrono::duration<double> threadTime =
+      std::chrono::steady_clock::now() - threadStart;
+  salmonOpts.perfStats->addMappingThread(locRead, threadTime.count(),
+                                         threadCounters.get());
   readExp.updateShortFrags(shortFragStats);
+  readExp.addScratchRegrowths(scratch.takeRegrowths());
+  readExp.addMappingVerifierStats(verifier.stats());
+  readExp.addReadCacheStats(readCache.numLookups(), readCache.numHits());
+  readExp.addRepeatRejections(numRepeatRejected);
+  readExp.addPrefilterStats(numAdapterClipped, numLowComplexity);
+  scratch.finishLocalEqClasses(readExp.equivalenceClassBuilder());
+  if (checkpointer != nullptr) {
+    checkpointer->leave();
+  }
+  if (snapshotter != nullptr) {
+    snapshotter->leave();
+  }
 
   if (maxZeroFrac > 0.0) {
     salmonOpts.jointLog->info("Thread saw mini-batch with a maximum of "
@@ -1478,8 +1982,348 @@ void processReadsQuasi(
   }
 }
 
+/**
+ * The inference stage of a pipelined library (see --inferenceThreads): run
+ * processMiniBatch on the mini-batches the mapping threads submit to
+ * pipeline, with this thread's own bias parameters and scratch, until the
+ * pipeline is closed.
+ */
+template <typename AlnT>
+void processMiniBatches(MiniBatchPipeline<AlnGroupVec<AlnT>>& pipeline,
+                        ReadExperiment& readExp, ReadLibrary& rl,
+                        std::vector<Transcript>& transcripts,
+                        ForgettingMassCalculator& fmCalc,
+                        ClusterForest& clusterForest,
+                        FragmentLengthDistribution& fragLengthDist,
+                        BiasParams& observedBiasParams,
+                        MiniBatchScratch& scratch,
+                        std::atomic<uint64_t>& numObservedFragments,
+                        std::atomic<uint64_t>& numAssignedFragments,
+                        SalmonOpts& salmonOpts, bool initialRound,
+                        std::atomic<bool>& burnedIn) {
+  std::default_random_engine eng(salmon::utils::onlinePhaseSeed(salmonOpts));
+  double maxZeroFrac{0.0};
+  prepareScratch(scratch, salmonOpts, 0);
+  uint64_t firstTimestepOfRound = fmCalc.getCurrentTimestep();
+  auto* snapshotter = salmonOpts.snapshotter.get();
+
+  typename MiniBatchPipeline<AlnGroupVec<AlnT>>::Batch batch;
+  auto spanStart = PerformanceStats::Clock::now();
+  while (pipeline.next(batch)) {
+    salmonOpts.perfStats->span("inference_wait", spanStart);
+    AlnGroupVecRange<AlnT> hitLists = boost::make_iterator_range(
+        batch.hits->begin(), batch.hits->begin() + batch.size);
+    processMiniBatch<AlnT>(readExp, fmCalc, firstTimestepOfRound, rl,
+                           salmonOpts, hitLists, transcripts, clusterForest,
+                           fragLengthDist, observedBiasParams,
+                           numAssignedFragments, eng, initialRound, burnedIn,
+                           maxZeroFrac, scratch);
+    pipeline.release(batch.hits);
+    salmonOpts.perfStats->span("processMiniBatch", spanStart);
+    if (snapshotter != nullptr) {
+      snapshotter->pauseIfDue(numObservedFragments);
+    }
+  }
+
+  readExp.addScratchRegrowths(scratch.takeRegrowths());
+  scratch.finishLocalEqClasses(readExp.equivalenceClassBuilder());
+  if (snapshotter != nullptr) {
+    snapshotter->leave();
+  }
+  if (maxZeroFrac > 0.0) {
+    salmonOpts.jointLog->info("Thread saw mini-batch with a maximum of "
+                              "{0:.2f}\% zero probability fragments",
+                              maxZeroFrac);
+  }
+}
+
+/**
+ * Replay the mappings of a read library from its cache file (see
+ * --mappingCacheDir and MappingCacheFile.hpp) instead of mapping its reads:
+ * the fragments of the blocks this thread takes from reader go through
+ * processMiniBatch, a mini-batch at a time, as they would have after
+ * mapping.  The sequence-bias samples are taken from the cached mappings;
+ * the upper bound on the mapped fragments counts those with a mapping left
+ * after the filters (rather than before them).
+ */
+inline void replayMappings(
+    salmon::mapcache::Reader& reader, ReadExperiment& readExp,
+    ReadLibrary& rl, AlnGroupVec<SMEMAlignment>& structureVec,
+    std::atomic<uint64_t>& numObservedFragments,
+    std::atomic<uint64_t>& numAssignedFragments,
+    std::atomic<uint64_t>& validHits, std::atomic<uint64_t>& upperBoundHits,
+    std::vector<Transcript>& transcripts, ForgettingMassCalculator& fmCalc,
+    ClusterForest& clusterForest, FragmentLengthDistribution& fragLengthDist,
+    BiasParams& observedBiasParams, MiniBatchScratch& scratch,
+    SalmonOpts& salmonOpts, bool initialRound, std::atomic<bool>& burnedIn) {
+  // ERROR
+  salmonOpts.jointLog->error("MEM-mappings cannot be replayed from the "
+                             "mapping cache --- please report this bug on "
+                             "GitHub");
+  std::exit(1);
+}
+
+inline void replayMappings(
+    salmon::mapcache::Reader& reader, ReadExperiment& readExp,
+    ReadLibrary& rl, AlnGroupVec<QuasiAlignment>& structureVec,
+    std::atomic<uint64_t>& numObservedFragments,
+    std::atomic<uint64_t>& numAssignedFragments,
+    std::atomic<uint64_t>& validHits, std::atomic<uint64_t>& upperBoundHits,
+    std::vector<Transcript>& transcripts, ForgettingMassCalculator& fmCalc,
+    ClusterForest& clusterForest, FragmentLengthDistribution& fragLengthDist,
+    BiasParams& observedBiasParams, MiniBatchScratch& scratch,
+    SalmonOpts& salmonOpts, bool initialRound, std::atomic<bool>& burnedIn) {
+  std::default_random_engine eng(salmon::utils::onlinePhaseSeed(salmonOpts));
+  double maxZeroFrac{0.0};
+  prepareScratch(scratch, salmonOpts, 0);
+  uint64_t firstTimestepOfRound = fmCalc.getCurrentTimestep();
+  bool isPairedLibrary = (rl.format().type == ReadType::PAIRED_END);
+  auto* snapshotter = salmonOpts.snapshotter.get();
+
+  auto threadStart = std::chrono::steady_clock::now();
+  auto threadCounters = salmonOpts.perfStats->threadCounters();
+  size_t locRead{0};
+  size_t rangeSize{0};
+  auto processBatch = [&]() -> void {
+    AlnGroupVecRange<QuasiAlignment> hitLists = boost::make_iterator_range(
+        structureVec.begin(), structureVec.begin() + rangeSize);
+    processMiniBatch<QuasiAlignment>(
+        readExp, fmCalc, firstTimestepOfRound, rl, salmonOpts, hitLists,
+        transcripts, clusterForest, fragLengthDist, observedBiasParams,
+        numAssignedFragments, eng, initialRound, burnedIn, maxZeroFrac,
+        scratch);
+    rangeSize = 0;
+  };
+
+  salmon::mapcache::BlockDecoder decoder;
+  while (reader.next(decoder)) {
+    while (true) {
+      auto& jointHitGroup = structureVec[rangeSize];
+      jointHitGroup.clearAlignments();
+      auto& jointHits = jointHitGroup.alignments();
+      if (!decoder.next(jointHits)) {
+        break;
+      }
+      if (initialRound) {
+        upperBoundHits += (jointHits.size() > 0);
+      }
+
+      // The bias samples are drawn as the mapping loops draw them
+      if (salmonOpts.biasCorrect and salmonOpts.numBiasSamples > 0 and
+          !jointHits.empty()) {
+        if (isPairedLibrary) {
+          std::uniform_int_distribution<> dis(0, jointHits.size());
+          size_t hitSamp = dis(eng);
+          if (hitSamp < jointHits.size() and
+              jointHits[hitSamp].mateStatus ==
+                  rapmap::utils::MateStatus::PAIRED_END_PAIRED and
+              samplePairedSeqBias(jointHits[hitSamp], transcripts,
+                                  observedBiasParams)) {
+            salmonOpts.numBiasSamples -= 1;
+          }
+        } else {
+          for (auto& h : jointHits) {
+            if (sampleSingleSeqBias(h, transcripts, observedBiasParams)) {
+              salmonOpts.numBiasSamples -= 1;
+              break;
+            }
+          }
+        }
+      }
+
+      validHits += jointHits.size();
+      ++locRead;
+      ++numObservedFragments;
+      if (++rangeSize == structureVec.size()) {
+        processBatch();
+        if (snapshotter != nullptr) {
+          snapshotter->pauseIfDue(numObservedFragments);
+        }
+      }
+    }
+  }
+  if (rangeSize > 0) {
+    processBatch();
+  }
+  if (snapshotter != nullptr) {
+    snapshotter->leave();
+  }
+
+  std::chrono::duration<double> threadTime =
+      std::chrono::steady_clock::now() - threadStart;
+  salmonOpts.perfStats->addMappingThread(locRead, threadTime.count(),
+                                         threadCounters.get());
+  readExp.addScratchRegrowths(scratch.takeRegrowths());
+  scratch.finishLocalEqClasses(readExp.equivalenceClassBuilder());
+  if (maxZeroFrac > 0.0) {
+    salmonOpts.jointLog->info("Thread saw mini-batch with a maximum of "
+                              "{0:.2f}\% zero probability fragments",
+                              maxZeroFrac);
+  }
+}
+
+/**
+ * Map the reads of a droplet single-cell library (see --cellBarcodeLength):
+ * the cell barcode and UMI are read from the start of the first mate, and
+ * the second mate is mapped on its own.  A mapped read is recorded as the
+ * (cell, equivalence class, UMI) of its hits; there are no online estimates.
+ */
+template <typename RapMapIndexT>
+void processReadsSingleCell(paired_parser* parser, RapMapIndexT* qidx,
+                            CellEquivalenceClasses& cellEqClasses,
+                            std::atomic<uint64_t>& numObservedFragments,
+                            std::atomic<uint64_t>& numAssignedFragments,
+                            std::atomic<uint64_t>& numBadBarcodes,
+                            SalmonOpts& salmonOpts) {
+  size_t minK = rapmap::utils::my_mer::k();
+  size_t cbLen = salmonOpts.cellBarcodeLength;
+  size_t umiLen = salmonOpts.umiLength;
+  bool consistentHits{salmonOpts.consistentHits};
+
+  SACollector<RapMapIndexT> hitCollector(qidx);
+  if (salmonOpts.fasterMapping) {
+    hitCollector.enableNIP();
+  } else {
+    hitCollector.disableNIP();
+  }
+  hitCollector.setStrictCheck(true);
+  if (salmonOpts.quasiCoverage > 0.0) {
+    hitCollector.setCoverageRequirement(salmonOpts.quasiCoverage);
+  }
+  SASearcher<RapMapIndexT> saSearcher(qidx);
+
+  CellEquivalenceClasses::Local localRecords;
+  std::vector<QuasiAlignment> hits;
+  std::vector<uint32_t> txpIDs;
+  std::string cdnaSeq;
+  uint64_t localObserved{0};
+  uint64_t localAssigned{0};
+  uint64_t localBadBarcodes{0};
+
+  auto rg = parser->getReadGroup();
+  while (parser->refill(rg)) {
+    for (size_t i = 0; i < rg.size(); ++i) {
+      auto& rp = rg[i];
+      ++localObserved;
+      const char* tag = rp.first.seq.data();
+      uint64_t umi{0};
+      if (rp.first.seq.length() < cbLen + umiLen or
+          !CellEquivalenceClasses::encodeUMI(tag + cbLen, umiLen, umi) or
+          std::find(tag, tag + cbLen, 'N') != tag + cbLen) {
+        ++localBadBarcodes;
+        continue;
+      }
+      if (rp.second.seq.length() < minK) {
+        continue;
+      }
+
+      rp.second.seq.assignTo(cdnaSeq);
+      hits.clear();
+      hitCollector(cdnaSeq, hits, saSearcher, MateStatus::SINGLE_END,
+                   consistentHits);
+      if (hits.empty() or hits.size() > salmonOpts.maxReadOccs) {
+        continue;
+      }
+
+      txpIDs.clear();
+      for (auto& h : hits) {
+        txpIDs.push_back(h.tid);
+      }
+      std::sort(txpIDs.begin(), txpIDs.end());
+      txpIDs.erase(std::unique(txpIDs.begin(), txpIDs.end()), txpIDs.end());
+      localRecords.add(cellEqClasses.cellID(tag, cbLen),
+                       cellEqClasses.eqClassID(txpIDs), umi);
+      ++localAssigned;
+    }
+    numObservedFragments += localObserved;
+    numAssignedFragments += localAssigned;
+    localObserved = localAssigned = 0;
+  }
+  numBadBarcodes += localBadBarcodes;
+  cellEqClasses.merge(localRecords);
+}
+
 /// DONE QUASI
 
+/**
+ * Write the header of the --writeMappings output: the SAM header, or that
+ * of the binary mapping file.
+ */
+template <typename RapMapIndexT>
+void writeMappingHeader(RapMapIndexT* qidx,
+                        const std::vector<Transcript>& transcripts,
+                        SalmonOpts& salmonOpts) {
+  if (salmonOpts.qmWriter) {
+    std::vector<std::string> names;
+    std::vector<uint32_t> lengths;
+    names.reserve(transcripts.size());
+    lengths.reserve(transcripts.size());
+    for (auto& t : transcripts) {
+      names.push_back(t.RefName);
+      lengths.push_back(t.RefLength);
+    }
+    if (!salmon::mappings::writeHeader(*salmonOpts.qmWriter, names,
+                                       lengths)) {
+      salmonOpts.jointLog->error("Couldn't write the header of the binary "
+                                 "mapping file");
+    }
+  } else {
+    rapmap::utils::writeSAMHeader(*qidx, salmonOpts.qmLog);
+  }
+}
+
+/**
+ * Report how the parser and the mapping threads waited on each other during
+ * a pass over the reads.
+ */
+inline void logParserStats(const fastx_parser::ParserStats& st,
+                           spdlog::logger* log) {
+  log->info("Read parser handed off {} chunks (with a mean of {:.2f} chunks "
+            "ready at each request); mapping threads waited {:.2f}s for "
+            "reads (inflating {} batches of the input meanwhile), parsing "
+            "threads waited {:.2f}s for free chunks",
+            st.numChunks, st.meanReadyChunks, st.consumerWaitSeconds,
+            st.numHelpedBatches, st.parserWaitSeconds);
+}
+
+/**
+ * The number of threads that parse the files (or file pairs) of a library.
+ * Each parsing thread takes the next file that nobody is reading yet, so
+ * that, when a library has many files (e.g. one per lane), several of them
+ * are read at once, and the mapping threads aren't left waiting on a
+ * single parser; one parsing thread is used for every 8 mapping threads.
+ */
+inline uint32_t numParsingThreadsFor(size_t numFiles, size_t numThreads) {
+  size_t numParsers = (numThreads + 7) / 8;
+  return static_cast<uint32_t>(
+      std::max(size_t(1), std::min(numFiles, numParsers)));
+}
+
+/**
+ * The options that change the mappings of the reads of rl (which, with the
+ * index and the reads, key its file in the mapping cache)
+ */
+inline std::string mappingCacheOptions(const SalmonOpts& sopt,
+                                       const ReadLibrary& rl) {
+  fmt::MemoryWriter w;
+  w << "paired=" << (rl.format().type == ReadType::PAIRED_END)
+    << " consistentHits=" << sopt.consistentHits
+    << " strictIntersect=" << sopt.strictIntersect
+    << " fasterMapping=" << sopt.fasterMapping
+    << " quasiCoverage=" << sopt.quasiCoverage
+    << " maxEditFraction=" << sopt.maxEditFraction
+    << " maxReadOccs=" << sopt.maxReadOccs
+    << " maxKmerOcc=" << sopt.maxKmerOcc << " maxDust=" << sopt.maxDust
+    << " minAdapterOverlap=" << sopt.minAdapterOverlap
+    << " allowOrphans=" << sopt.allowOrphans
+    << " subsample=" << sopt.subsampleFraction
+    << " seed=" << sopt.samplerSeed << " adapters=";
+  for (auto& a : sopt.adapters) {
+    w << a << ',';
+  }
+  return w.str();
+}
+
 template <typename AlnT>
 void processReadLibrary(
     ReadExperiment& readExp, ReadLibrary& rl, SalmonIndex* sidx,
@@ -1494,7 +2338,9 @@ void processReadLibrary(
     FragmentLengthDistribution& fragLengthDist, mem_opt_t* memOptions,
     SalmonOpts& salmonOpts, double coverageThresh, bool greedyChain,
     std::mutex& iomutex, size_t numThreads,
-    std::vector<AlnGroupVec<AlnT>>& structureVec, volatile bool& writeToCache) {
+    std::vector<AlnGroupVec<AlnT>>& structureVec,
+    std::vector<BiasParams>& observedBiasParams,
+    std::vector<MiniBatchScratch>& threadScratch, volatile bool& writeToCache) {
 
   std::vector<std::thread> threads;
 
@@ -1502,13 +2348,38 @@ void processReadLibrary(
   rl.checkValid();
 
   auto indexType = sidx->indexType();
+  uint32_t chunkSize = salmonOpts.parserChunkSize;
+
+  // With checkpoints, the reads are handed out in order (by one parsing
+  // thread), and those of a resumed checkpoint are skipped
+  auto* checkpointer = salmonOpts.checkpointer.get();
+  uint64_t numToSkip{0};
+  if (checkpointer != nullptr) {
+    numToSkip = checkpointer->beginLibrary(
+        numThreads, numObservedFragments,
+        [&](salmon::checkpoint::Snapshot& s) -> void {
+          salmon::checkpoint::take(readExp, fmCalc, numObservedFragments,
+                                   numAssignedFragments, upperBoundHits, s);
+        });
+    if (numToSkip == ~uint64_t(0)) {
+      salmonOpts.jointLog->info("The reads of [{}] are all in the checkpoint",
+                                rl.readFilesAsString());
+      return;
+    }
+    if (numToSkip > 0) {
+      salmonOpts.jointLog->info("Skipping the {} fragments of [{}] that are "
+                                "in the checkpoint",
+                                numToSkip, rl.readFilesAsString());
+    }
+  }
 
   // Catch any exceptions that might be thrown while processing the reads
 
   // These two deleters are highly redundant (identical in content, but have
   // different argument types). This will be resolved by generic lambdas as soon
   // as we can rely on c++14.
-  auto pairedPtrDeleter = [&salmonOpts](paired_parser* p) -> void {
+  auto pairedPtrDeleter = [&salmonOpts, &readExp](paired_parser* p) -> void {
+    salmonOpts.runStatus->trackReadQueue(nullptr);
     try {
       p->stop();
     } catch (const std::exception& e) {
@@ -1518,10 +2389,17 @@ void processReadLibrary(
       spdlog::drop_all();
       std::exit(-1);
     }
+    logParserStats(p->stats(), salmonOpts.jointLog.get());
+    auto st = p->stats();
+    salmonOpts.perfStats->addParserStats(
+        st.numChunks, st.meanReadyChunks, st.consumerWaitSeconds,
+        st.parserWaitSeconds, st.numHelpedBatches);
+    readExp.addSubsampledOut(p->numSubsampledOut());
     delete p;
   };
 
-  auto singlePtrDeleter = [&salmonOpts](single_parser* p) -> void {
+  auto singlePtrDeleter = [&salmonOpts, &readExp](single_parser* p) -> void {
+    salmonOpts.runStatus->trackReadQueue(nullptr);
     try {
       p->stop();
     } catch (const std::exception& e) {
@@ -1531,6 +2409,12 @@ void processReadLibrary(
       spdlog::drop_all();
       std::exit(-1);
     }
+    logParserStats(p->stats(), salmonOpts.jointLog.get());
+    auto st = p->stats();
+    salmonOpts.perfStats->addParserStats(
+        st.numChunks, st.meanReadyChunks, st.consumerWaitSeconds,
+        st.parserWaitSeconds, st.numHelpedBatches);
+    readExp.addSubsampledOut(p->numSubsampledOut());
     delete p;
   };
 
@@ -1539,18 +2423,139 @@ void processReadLibrary(
   std::unique_ptr<single_parser, decltype(singlePtrDeleter)> singleParserPtr(
       nullptr, singlePtrDeleter);
 
+  // With --mappingCacheDir, a library that an earlier run mapped (with the
+  // same index and mapping options) is replayed from its cache file, rather
+  // than mapped; one that no run has is cached as it's mapped
+  std::unique_ptr<salmon::mapcache::Reader> cacheReader{nullptr};
+  boost::filesystem::path cachePath;
+  if (indexType == SalmonIndexType::QUASI and
+      !salmonOpts.mappingCacheDir.empty()) {
+    std::vector<std::string> readFiles(rl.mates1());
+    readFiles.insert(readFiles.end(), rl.mates2().begin(), rl.mates2().end());
+    readFiles.insert(readFiles.end(), rl.unmated().begin(),
+                     rl.unmated().end());
+    std::string key = salmon::mapcache::libraryKey(
+        salmonOpts.indexDirectory, readFiles,
+        mappingCacheOptions(salmonOpts, rl));
+    cachePath = salmon::mapcache::cacheFile(salmonOpts.mappingCacheDir, key);
+    cacheReader.reset(new salmon::mapcache::Reader());
+    if (cacheReader->open(cachePath, key)) {
+      salmonOpts.jointLog->info("Replaying the mappings of [{}] from {}",
+                                rl.readFilesAsString(), cachePath.string());
+    } else {
+      cacheReader.reset(nullptr);
+      salmonOpts.mappingCacheWriter.reset(
+          new salmon::mapcache::Writer(salmonOpts.mappingCacheDir, key));
+      if (!salmonOpts.mappingCacheWriter->good()) {
+        salmonOpts.jointLog->warn("Could not write to {}; the mappings of "
+                                  "[{}] won't be cached",
+                                  salmonOpts.mappingCacheDir.string(),
+                                  rl.readFilesAsString());
+        salmonOpts.mappingCacheWriter.reset();
+      }
+    }
+  }
+  auto startReplayThreads = [&]() -> void {
+    for (int i = 0; i < numThreads; ++i) {
+      threads.emplace_back([&, i]() -> void {
+        replayMappings(*cacheReader, readExp, rl, structureVec[i],
+                       numObservedFragments, numAssignedFragments,
+                       numValidHits, upperBoundHits, transcripts, fmCalc,
+                       clusterForest, fragLengthDist, observedBiasParams[i],
+                       threadScratch[i], salmonOpts, initialRound, burnedIn);
+      });
+    }
+  };
+  // Called once the threads are done
+  auto finishMappingCache = [&]() -> void {
+    if (cacheReader != nullptr and cacheReader->failed()) {
+      salmonOpts.jointLog->error("The mapping cache file {} is truncated or "
+                                 "corrupt; remove it and run again",
+                                 cachePath.string());
+      std::exit(1);
+    }
+    if (salmonOpts.mappingCacheWriter) {
+      if (salmonOpts.mappingCacheWriter->commit()) {
+        salmonOpts.jointLog->info("Cached the mappings of [{}] in {}",
+                                  rl.readFilesAsString(), cachePath.string());
+      } else {
+        salmonOpts.jointLog->warn("Could not write the mapping cache file {}",
+                                  cachePath.string());
+      }
+      salmonOpts.mappingCacheWriter.reset();
+    }
+  };
+
   /** sequence-specific and GC-fragment bias vectors --- each thread gets it's
-   * own **/
+   * own; they're reset, rather than reallocated, for each library **/
   size_t numTxp = readExp.transcripts().size();
-  std::vector<BiasParams> observedBiasParams(
-      numThreads, BiasParams(salmonOpts.numConditionalGCBins,
-                             salmonOpts.numFragGCBins, false));
+  // With --inferenceThreads, the quasi-mapping threads hand their
+  // mini-batches to a pool of inference threads (see MiniBatchPipeline),
+  // whose bias parameters follow those of the mapping threads (a replayed
+  // library needs no mapping threads, so its threads do the inference)
+  size_t numInferenceThreads =
+      (indexType == SalmonIndexType::QUASI and cacheReader == nullptr)
+          ? salmonOpts.numInferenceThreads
+          : 0;
+  for (auto& bp : observedBiasParams) {
+    bp.reset();
+  }
+  if (observedBiasParams.size() != numThreads + numInferenceThreads) {
+    observedBiasParams.resize(numThreads + numInferenceThreads,
+                              BiasParams(salmonOpts.numConditionalGCBins,
+                                         salmonOpts.numFragGCBins, false));
+  }
+  // Likewise the per-thread mini-batch scratch (see prepareScratch), which
+  // is only allocated for the threads that no library has had yet
+  while (threadScratch.size() < numThreads + numInferenceThreads) {
+    threadScratch.emplace_back(numTxp, LibraryFormat::maxLibTypeID() + 1);
+  }
+
+  std::unique_ptr<MiniBatchPipeline<AlnGroupVec<AlnT>>> pipeline{nullptr};
+  std::vector<std::thread> inferenceThreads;
+  if (numInferenceThreads > 0) {
+    // (a slot being filled and one waiting per mapping thread, and one being
+    // processed per inference thread)
+    pipeline.reset(new MiniBatchPipeline<AlnGroupVec<AlnT>>(
+        2 * numThreads + numInferenceThreads, structureVec.front().size(),
+        numInferenceThreads));
+  }
+  // The interim estimates are taken between the mini-batches of the threads
+  // that process them: the inference threads, if there are any
+  if (salmonOpts.snapshotter) {
+    salmonOpts.snapshotter->beginLibrary(
+        (numInferenceThreads > 0) ? numInferenceThreads : numThreads,
+        [&](salmon::interim::Estimates& e) -> void {
+          salmon::interim::take(readExp, numObservedFragments, e);
+        });
+  }
+  auto startInferenceThreads = [&]() -> void {
+    for (size_t i = 0; i < numInferenceThreads; ++i) {
+      inferenceThreads.emplace_back([&, i]() -> void {
+        processMiniBatches<AlnT>(*pipeline, readExp, rl, transcripts, fmCalc,
+                                 clusterForest, fragLengthDist,
+                                 observedBiasParams[numThreads + i],
+                                 threadScratch[numThreads + i],
+                                 numObservedFragments, numAssignedFragments,
+                                 salmonOpts,
+                                 initialRound, burnedIn);
+      });
+      if (salmonOpts.pinThreads) {
+        salmon::threads::pinThread(inferenceThreads.back(), numThreads + i);
+      }
+    }
+  };
+  // Called once the mapping threads are done
+  auto joinInferenceThreads = [&]() -> void {
+    if (pipeline) {
+      pipeline->close();
+    }
+    for (auto& t : inferenceThreads) {
+      t.join();
+    }
+    inferenceThreads.clear();
+  };
 
-  /**
-   * NOTE : test new el model in future
-   * std::vector<EffectiveLengthStats> observedEffectiveLengths(numThreads,
-   *EffectiveLengthStats(numTxp));
-   **/
 
   // If the read library is paired-end
   // ------ Paired-end --------
@@ -1562,16 +2567,26 @@ void processReadLibrary(
       std::exit(1);
     }
 
-    size_t numFiles = rl.mates1().size() + rl.mates2().size();
-    uint32_t numParsingThreads{1};
-    // HACK!
-    if (rl.mates1().size() > 1 and numThreads > 8) {
-      numParsingThreads = 2;
+    // (a replayed library isn't parsed)
+    if (cacheReader == nullptr) {
+      std::vector<std::string> files1, files2;
+      rl.parserFiles(files1, files2);
+      uint32_t numParsingThreads =
+          (checkpointer != nullptr)
+              ? 1
+              : numParsingThreadsFor(files1.size(), numThreads);
+      pairedParserPtr.reset(new paired_parser(files1, files2, numThreads,
+                                              numParsingThreads, chunkSize,
+                                              maxChunkBytesFor(chunkSize)));
+      pairedParserPtr->skipRecords(numToSkip);
+      pairedParserPtr->subsample(salmonOpts.subsampleFraction,
+                                 salmonOpts.samplerSeed);
+      pairedParserPtr->start();
+      paired_parser* pairedParser = pairedParserPtr.get();
+      salmonOpts.runStatus->trackReadQueue([pairedParser]() -> uint64_t {
+        return pairedParser->numReadyChunks();
+      });
     }
-    pairedParserPtr.reset(new paired_parser(rl.mates1(), rl.mates2(),
-                                            numThreads, numParsingThreads,
-                                            miniBatchSize));
-    pairedParserPtr->start();
 
     switch (indexType) {
     case SalmonIndexType::FMD: {
@@ -1584,17 +2599,17 @@ void processReadLibrary(
               numObservedFragments, numAssignedFragments, numValidHits,
               upperBoundHits, sidx, transcripts, fmCalc, clusterForest,
               fragLengthDist, observedBiasParams[i],
-              /**
-               * NOTE : test new el model in future
-               * observedEffectiveLengths[i],
-               */
-              memOptions, salmonOpts, coverageThresh, iomutex, initialRound,
-              burnedIn, writeToCache);
+              threadScratch[i], memOptions, salmonOpts, coverageThresh, iomutex,
+              initialRound, burnedIn, writeToCache);
         };
         threads.emplace_back(threadFun);
       }
     } break;
     case SalmonIndexType::QUASI: {
+      if (cacheReader != nullptr) {
+        startReplayThreads();
+        break;
+      }
       // True if we have a 64-bit SA index, false otherwise
       bool largeIndex = sidx->is64BitQuasi();
       bool perfectHashIndex = sidx->isPerfectHashQuasi();
@@ -1604,8 +2619,7 @@ void processReadLibrary(
         if (largeIndex) {
           if (perfectHashIndex) { // Perfect Hash
             if (salmonOpts.qmFileName != "" and i == 0) {
-              rapmap::utils::writeSAMHeader(*(sidx->quasiIndexPerfectHash64()),
-                                            salmonOpts.qmLog);
+              writeMappingHeader(sidx->quasiIndexPerfectHash64(), transcripts, salmonOpts);
             }
             auto threadFun = [&, i]() -> void {
               processReadsQuasi<RapMapSAIndex<int64_t, PerfectHash<int64_t>>>(
@@ -1613,18 +2627,14 @@ void processReadLibrary(
                   numObservedFragments, numAssignedFragments, numValidHits,
                   upperBoundHits, sidx->quasiIndexPerfectHash64(), transcripts,
                   fmCalc, clusterForest, fragLengthDist, observedBiasParams[i],
-                  /**
-                   * NOTE : test new el model in future
-                   * observedEffectiveLengths[i],
-                   **/
-                  memOptions, salmonOpts, coverageThresh, iomutex, initialRound,
-                  burnedIn, writeToCache);
+                  threadScratch[i], memOptions, salmonOpts, coverageThresh,
+                  iomutex, initialRound, burnedIn, writeToCache,
+                  pipeline.get());
             };
             threads.emplace_back(threadFun);
           } else { // Dense Hash
             if (salmonOpts.qmFileName != "" and i == 0) {
-              rapmap::utils::writeSAMHeader(*(sidx->quasiIndex64()),
-                                            salmonOpts.qmLog);
+              writeMappingHeader(sidx->quasiIndex64(), transcripts, salmonOpts);
             }
             auto threadFun = [&, i]() -> void {
               processReadsQuasi<RapMapSAIndex<int64_t, DenseHash<int64_t>>>(
@@ -1632,20 +2642,16 @@ void processReadLibrary(
                   numObservedFragments, numAssignedFragments, numValidHits,
                   upperBoundHits, sidx->quasiIndex64(), transcripts, fmCalc,
                   clusterForest, fragLengthDist, observedBiasParams[i],
-                  /**
-                   * NOTE : test new el model in future
-                   * observedEffectiveLengths[i],
-                   **/
-                  memOptions, salmonOpts, coverageThresh, iomutex, initialRound,
-                  burnedIn, writeToCache);
+                  threadScratch[i], memOptions, salmonOpts, coverageThresh,
+                  iomutex, initialRound, burnedIn, writeToCache,
+                  pipeline.get());
             };
             threads.emplace_back(threadFun);
           }
         } else {
           if (perfectHashIndex) { // Perfect Hash
             if (salmonOpts.qmFileName != "" and i == 0) {
-              rapmap::utils::writeSAMHeader(*(sidx->quasiIndexPerfectHash32()),
-                                            salmonOpts.qmLog);
+              writeMappingHeader(sidx->quasiIndexPerfectHash32(), transcripts, salmonOpts);
             }
             auto threadFun = [&, i]() -> void {
               processReadsQuasi<RapMapSAIndex<int32_t, PerfectHash<int32_t>>>(
@@ -1653,18 +2659,14 @@ void processReadLibrary(
                   numObservedFragments, numAssignedFragments, numValidHits,
                   upperBoundHits, sidx->quasiIndexPerfectHash32(), transcripts,
                   fmCalc, clusterForest, fragLengthDist, observedBiasParams[i],
-                  /**
-                   * NOTE : test new el model in future
-                   * observedEffectiveLengths[i],
-                   **/
-                  memOptions, salmonOpts, coverageThresh, iomutex, initialRound,
-                  burnedIn, writeToCache);
+                  threadScratch[i], memOptions, salmonOpts, coverageThresh,
+                  iomutex, initialRound, burnedIn, writeToCache,
+                  pipeline.get());
             };
             threads.emplace_back(threadFun);
           } else { // Dense Hash
             if (salmonOpts.qmFileName != "" and i == 0) {
-              rapmap::utils::writeSAMHeader(*(sidx->quasiIndex32()),
-                                            salmonOpts.qmLog);
+              writeMappingHeader(sidx->quasiIndex32(), transcripts, salmonOpts);
             }
             auto threadFun = [&, i]() -> void {
               processReadsQuasi<RapMapSAIndex<int32_t, DenseHash<int32_t>>>(
@@ -1672,12 +2674,9 @@ void processReadLibrary(
                   numObservedFragments, numAssignedFragments, numValidHits,
                   upperBoundHits, sidx->quasiIndex32(), transcripts, fmCalc,
                   clusterForest, fragLengthDist, observedBiasParams[i],
-                  /**
-                   * NOTE : test new el model in future
-                   * observedEffectiveLengths[i],
-                   **/
-                  memOptions, salmonOpts, coverageThresh, iomutex, initialRound,
-                  burnedIn, writeToCache);
+                  threadScratch[i], memOptions, salmonOpts, coverageThresh,
+                  iomutex, initialRound, burnedIn, writeToCache,
+                  pipeline.get());
             };
             threads.emplace_back(threadFun);
           }
@@ -1689,9 +2688,17 @@ void processReadLibrary(
     break;
     } // end switch
 
+    startInferenceThreads();
+    if (salmonOpts.pinThreads) {
+      for (int i = 0; i < numThreads; ++i) {
+        salmon::threads::pinThread(threads[i], i);
+      }
+    }
     for (int i = 0; i < numThreads; ++i) {
       threads[i].join();
     }
+    joinInferenceThreads();
+    finishMappingCache();
 
     // If we don't have a sufficient number of assigned fragments, then
     // complain here!
@@ -1705,22 +2712,6 @@ void processReadLibrary(
                                           salmonOpts.minRequiredFrags);
     }
 
-    /**
-     * NOTE : test new el model in future
-    EffectiveLengthStats eel(numTxp);
-    for (auto& els : observedEffectiveLengths) {
-      eel.merge(els);
-    }
-    auto& transcripts = readExp.transcripts();
-    for (size_t tid = 0; tid < numTxp; ++tid) {
-      auto el = eel.getExpectedEffectiveLength(tid);
-      auto countObs = eel.getObservedCount(tid);
-      if (countObs > salmonOpts.eelCountCutoff and el >= 1.0) {
-        transcripts[tid].setCachedLogEffectiveLength(std::log(el));
-      }
-    }
-    **/
-
     /** GC-fragment bias **/
     // Set the global distribution based on the sum of local
     // distributions.
@@ -1728,7 +2719,9 @@ void processReadLibrary(
     double globalMass{salmon::math::LOG_0};
     double globalFwdMass{salmon::math::LOG_0};
     auto& globalGCMass = readExp.observedGC();
-    for (auto& gcp : observedBiasParams) {
+    {
+      // the per-thread parameters, combined
+      auto& gcp = reduceBiasParams(observedBiasParams);
       auto& gcm = gcp.observedGCMass;
       globalGCMass.combineCounts(gcm);
 
@@ -1752,6 +2745,22 @@ void processReadLibrary(
         posBiasesFW[i].combine(gcp.posBiasFW[i]);
         posBiasesRC[i].combine(gcp.posBiasRC[i]);
       }
+
+      /**
+       * observed effective lengths: those of the transcripts with enough
+       * fragments (so far) stand in for the model-based ones
+       **/
+      if (salmonOpts.useObservedEffLengths) {
+        auto& eel = readExp.observedEffectiveLengths();
+        eel.merge(gcp.observedEffLengths);
+        uint32_t countCutoff = salmonOpts.eelCountCutoff;
+        eel.forEachObserved([&transcripts, countCutoff](
+                                uint32_t tid, double el, uint32_t countObs) {
+          if (countObs > countCutoff and el >= 1.0) {
+            transcripts[tid].setObservedEffectiveLength(el);
+          }
+        });
+      }
       /*
               for (size_t i = 0; i < fwloc.counts.size(); ++i) {
                   fw.counts[i] += fwloc.counts[i];
@@ -1787,14 +2796,24 @@ void processReadLibrary(
   } // ------ Single-end --------
   else if (rl.format().type == ReadType::SINGLE_END) {
 
-    uint32_t numParsingThreads{1};
-    // HACK!
-    if (rl.unmated().size() > 1 and numThreads > 8) {
-      numParsingThreads = 2;
+    // (a replayed library isn't parsed)
+    if (cacheReader == nullptr) {
+      uint32_t numParsingThreads =
+          (checkpointer != nullptr)
+              ? 1
+              : numParsingThreadsFor(rl.unmated().size(), numThreads);
+      singleParserPtr.reset(new single_parser(rl.unmated(), numThreads,
+                                              numParsingThreads, chunkSize,
+                                              maxChunkBytesFor(chunkSize)));
+      singleParserPtr->skipRecords(numToSkip);
+      singleParserPtr->subsample(salmonOpts.subsampleFraction,
+                                 salmonOpts.samplerSeed);
+      singleParserPtr->start();
+      single_parser* singleParser = singleParserPtr.get();
+      salmonOpts.runStatus->trackReadQueue([singleParser]() -> uint64_t {
+        return singleParser->numReadyChunks();
+      });
     }
-    singleParserPtr.reset(new single_parser(rl.unmated(), numThreads,
-                                            numParsingThreads, miniBatchSize));
-    singleParserPtr->start();
     switch (indexType) {
     case SalmonIndexType::FMD: {
       for (int i = 0; i < numThreads; ++i) {
@@ -1806,18 +2825,18 @@ void processReadLibrary(
               numObservedFragments, numAssignedFragments, numValidHits,
               upperBoundHits, sidx, transcripts, fmCalc, clusterForest,
               fragLengthDist, observedBiasParams[i],
-              /**
-               * NOTE : test new el model in future
-               * observedEffectiveLengths[i],
-               **/
-              memOptions, salmonOpts, coverageThresh, iomutex, initialRound,
-              burnedIn, writeToCache);
+              threadScratch[i], memOptions, salmonOpts, coverageThresh, iomutex,
+              initialRound, burnedIn, writeToCache);
         };
         threads.emplace_back(threadFun);
       }
     } break;
 
     case SalmonIndexType::QUASI: {
+      if (cacheReader != nullptr) {
+        startReplayThreads();
+        break;
+      }
       // True if we have a 64-bit SA index, false otherwise
       bool largeIndex = sidx->is64BitQuasi();
       bool perfectHashIndex = sidx->isPerfectHashQuasi();
@@ -1828,8 +2847,7 @@ void processReadLibrary(
         if (largeIndex) {
           if (perfectHashIndex) { // Perfect Hash
             if (salmonOpts.qmFileName != "" and i == 0) {
-              rapmap::utils::writeSAMHeader(*(sidx->quasiIndexPerfectHash64()),
-                                            salmonOpts.qmLog);
+              writeMappingHeader(sidx->quasiIndexPerfectHash64(), transcripts, salmonOpts);
             }
             auto threadFun = [&, i]() -> void {
               processReadsQuasi<RapMapSAIndex<int64_t, PerfectHash<int64_t>>>(
@@ -1837,18 +2855,14 @@ void processReadLibrary(
                   numObservedFragments, numAssignedFragments, numValidHits,
                   upperBoundHits, sidx->quasiIndexPerfectHash64(), transcripts,
                   fmCalc, clusterForest, fragLengthDist, observedBiasParams[i],
-                  /**
-                   * NOTE : test new el model in future
-                   * observedEffectiveLengths[i],
-                   **/
-                  memOptions, salmonOpts, coverageThresh, iomutex, initialRound,
-                  burnedIn, writeToCache);
+                  threadScratch[i], memOptions, salmonOpts, coverageThresh,
+                  iomutex, initialRound, burnedIn, writeToCache,
+                  pipeline.get());
             };
             threads.emplace_back(threadFun);
           } else { // Dense Hash
             if (salmonOpts.qmFileName != "" and i == 0) {
-              rapmap::utils::writeSAMHeader(*(sidx->quasiIndex64()),
-                                            salmonOpts.qmLog);
+              writeMappingHeader(sidx->quasiIndex64(), transcripts, salmonOpts);
             }
 
             auto threadFun = [&, i]() -> void {
@@ -1857,20 +2871,16 @@ void processReadLibrary(
                   numObservedFragments, numAssignedFragments, numValidHits,
                   upperBoundHits, sidx->quasiIndex64(), transcripts, fmCalc,
                   clusterForest, fragLengthDist, observedBiasParams[i],
-                  /**
-                   * NOTE : test new el model in future
-                   * observedEffectiveLengths[i],
-                   **/
-                  memOptions, salmonOpts, coverageThresh, iomutex, initialRound,
-                  burnedIn, writeToCache);
+                  threadScratch[i], memOptions, salmonOpts, coverageThresh,
+                  iomutex, initialRound, burnedIn, writeToCache,
+                  pipeline.get());
             };
             threads.emplace_back(threadFun);
           }
         } else {
           if (perfectHashIndex) { // Perfect Hash
             if (salmonOpts.qmFileName != "" and i == 0) {
-              rapmap::utils::writeSAMHeader(*(sidx->quasiIndexPerfectHash32()),
-                                            salmonOpts.qmLog);
+              writeMappingHeader(sidx->quasiIndexPerfectHash32(), transcripts, salmonOpts);
             }
 
             auto threadFun = [&, i]() -> void {
@@ -1879,18 +2889,14 @@ void processReadLibrary(
                   numObservedFragments, numAssignedFragments, numValidHits,
                   upperBoundHits, sidx->quasiIndexPerfectHash32(), transcripts,
                   fmCalc, clusterForest, fragLengthDist, observedBiasParams[i],
-                  /**
-                   * NOTE : test new el model in future
-                   * observedEffectiveLengths[i],
-                   **/
-                  memOptions, salmonOpts, coverageThresh, iomutex, initialRound,
-                  burnedIn, writeToCache);
+                  threadScratch[i], memOptions, salmonOpts, coverageThresh,
+                  iomutex, initialRound, burnedIn, writeToCache,
+                  pipeline.get());
             };
             threads.emplace_back(threadFun);
           } else { // Dense Hash
             if (salmonOpts.qmFileName != "" and i == 0) {
-              rapmap::utils::writeSAMHeader(*(sidx->quasiIndex32()),
-                                            salmonOpts.qmLog);
+              writeMappingHeader(sidx->quasiIndex32(), transcripts, salmonOpts);
             }
 
             auto threadFun = [&, i]() -> void {
@@ -1899,12 +2905,9 @@ void processReadLibrary(
                   numObservedFragments, numAssignedFragments, numValidHits,
                   upperBoundHits, sidx->quasiIndex32(), transcripts, fmCalc,
                   clusterForest, fragLengthDist, observedBiasParams[i],
-                  /**
-                   * NOTE : test new el model in future
-                   * observedEffectiveLengths[i],
-                   **/
-                  memOptions, salmonOpts, coverageThresh, iomutex, initialRound,
-                  burnedIn, writeToCache);
+                  threadScratch[i], memOptions, salmonOpts, coverageThresh,
+                  iomutex, initialRound, burnedIn, writeToCache,
+                  pipeline.get());
             };
             threads.emplace_back(threadFun);
           }
@@ -1915,9 +2918,17 @@ void processReadLibrary(
     }   // End Quasi index
     break;
     }
+    startInferenceThreads();
+    if (salmonOpts.pinThreads) {
+      for (int i = 0; i < numThreads; ++i) {
+        salmon::threads::pinThread(threads[i], i);
+      }
+    }
     for (int i = 0; i < numThreads; ++i) {
       threads[i].join();
     }
+    joinInferenceThreads();
+    finishMappingCache();
 
     // If we don't have a sufficient number of assigned fragments, then
     // complain here!
@@ -1931,19 +2942,6 @@ void processReadLibrary(
                                           salmonOpts.minRequiredFrags);
     }
 
-    /** This model doesn't really make sense for SE data
-    EffectiveLengthStats eel(numTxp);
-    for (auto& els : observedEffectiveLengths) {
-      eel.merge(els);
-    }
-    auto& transcripts = readExp.transcripts();
-    for (size_t tid = 0; tid < numTxp; ++tid) {
-      auto el = eel.getExpectedEffectiveLength(tid);
-      if (el >= 1.0) {
-    transcripts[tid].setCachedLogEffectiveLength(std::log(el)); }
-    }
-    **/
-
     /** GC-fragment bias **/
     // Set the global distribution based on the sum of local
     // distributions.
@@ -1951,7 +2949,9 @@ void processReadLibrary(
     double globalMass{salmon::math::LOG_0};
     double globalFwdMass{salmon::math::LOG_0};
     auto& globalGCMass = readExp.observedGC();
-    for (auto& gcp : observedBiasParams) {
+    {
+      // the per-thread parameters, combined
+      auto& gcp = reduceBiasParams(observedBiasParams);
       auto& gcm = gcp.observedGCMass;
       globalGCMass.combineCounts(gcm);
 
@@ -2046,6 +3046,261 @@ void processReadLibrary(
  *  specified by `libFmt`.
  *
  */
+/**
+ * Quantify a droplet single-cell library (see processReadsSingleCell): map
+ * its reads in a single pass, deduplicate the UMIs, estimate the transcript
+ * counts of each cell, and write them as a sparse matrix to <output>/cells.
+ */
+bool quantifySingleCells(ReadExperiment& experiment, SalmonOpts& sopt) {
+  namespace bfs = boost::filesystem;
+  auto jointLog = sopt.jointLog;
+  auto& readLibraries = experiment.readLibraries();
+  if (readLibraries.size() != 1 or
+      readLibraries.front().format().type != ReadType::PAIRED_END or
+      readLibraries.front().mates1().size() !=
+          readLibraries.front().mates2().size()) {
+    jointLog->error("Single-cell mode (--cellBarcodeLength) requires one "
+                    "paired-end library, whose first mates hold the cell "
+                    "barcodes and UMIs.");
+    return false;
+  }
+  auto& rl = readLibraries.front();
+  SalmonIndex* sidx = experiment.getIndex();
+  size_t numThreads = sopt.numThreads;
+
+  std::vector<std::string> files1, files2;
+  rl.parserFiles(files1, files2);
+  paired_parser parser(files1, files2, numThreads,
+                       numParsingThreadsFor(files1.size(), numThreads),
+                       sopt.parserChunkSize,
+                       maxChunkBytesFor(sopt.parserChunkSize));
+  parser.start();
+
+  CellEquivalenceClasses cellEqClasses;
+  std::atomic<uint64_t> numObservedFragments{0};
+  std::atomic<uint64_t> numAssignedFragments{0};
+  std::atomic<uint64_t> numBadBarcodes{0};
+  PerformanceStats::Scope mappingPhase(*sopt.perfStats, "mapping");
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < numThreads; ++i) {
+    threads.emplace_back([&]() -> void {
+      if (sidx->is64BitQuasi()) {
+        if (sidx->isPerfectHashQuasi()) {
+          processReadsSingleCell(&parser, sidx->quasiIndexPerfectHash64(),
+                                 cellEqClasses, numObservedFragments,
+                                 numAssignedFragments, numBadBarcodes, sopt);
+        } else {
+          processReadsSingleCell(&parser, sidx->quasiIndex64(), cellEqClasses,
+                                 numObservedFragments, numAssignedFragments,
+                                 numBadBarcodes, sopt);
+        }
+      } else {
+        if (sidx->isPerfectHashQuasi()) {
+          processReadsSingleCell(&parser, sidx->quasiIndexPerfectHash32(),
+                                 cellEqClasses, numObservedFragments,
+                                 numAssignedFragments, numBadBarcodes, sopt);
+        } else {
+          processReadsSingleCell(&parser, sidx->quasiIndex32(), cellEqClasses,
+                                 numObservedFragments, numAssignedFragments,
+                                 numBadBarcodes, sopt);
+        }
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  parser.stop();
+  logParserStats(parser.stats(), jointLog.get());
+  mappingPhase.finish();
+
+  cellEqClasses.finish();
+  experiment.setNumObservedFragments(numObservedFragments);
+  if (numObservedFragments > 0) {
+    experiment.setEffectiveMappingRate(
+        numAssignedFragments / static_cast<double>(numObservedFragments));
+  }
+  jointLog->info("Mapping rate = {}\%", experiment.effectiveMappingRate() *
+                                            100.0);
+  jointLog->info("{} reads had a barcode or UMI that was too short or "
+                 "contained an N",
+                 numBadBarcodes.load());
+  jointLog->info("Found {} cell barcodes and {} equivalence classes; {} "
+                 "mapped reads were deduplicated into {} (cell, class) pairs",
+                 cellEqClasses.numCells(), cellEqClasses.numEqClasses(),
+                 cellEqClasses.numRecords(), cellEqClasses.numCellClasses());
+
+  PerformanceStats::Scope emPhase(*sopt.perfStats, "offline_em");
+  auto estimates = cellEqClasses.quantify(sopt.minCellUMIs, 0.01, 10000);
+  emPhase.finish();
+
+  std::vector<std::string> txpNames;
+  for (auto& t : experiment.transcripts()) {
+    txpNames.push_back(t.RefName);
+  }
+  bfs::path cellDir = sopt.outputDirectory / "cells";
+  boost::system::error_code ec;
+  bfs::create_directories(cellDir, ec);
+  if (!cellEqClasses.writeMatrix(cellDir, estimates.data(),
+                                 estimates.data() + estimates.size(),
+                                 txpNames)) {
+    jointLog->error("Couldn't write the cell quantification matrix to {}",
+                    cellDir.string());
+    return false;
+  }
+  jointLog->info("Wrote the counts of the cells with at least {} UMIs to {}",
+                 sopt.minCellUMIs, cellDir.string());
+  return true;
+}
+
+/**
+ * Replace the fragment length distribution with the one of an earlier run
+ * (--importModels; its libParams/flenDist.txt), and compute the effective
+ * lengths from it, so that the run is burned in from its first fragment.
+ */
+bool importFragLengthDist(const boost::filesystem::path& modelDir,
+                          ReadExperiment& experiment, SalmonOpts& sopt) {
+  auto fldPath = modelDir / "libParams" / "flenDist.txt";
+  std::ifstream fldFile(fldPath.string());
+  std::vector<double> pmf;
+  double v;
+  while (fldFile >> v) {
+    pmf.push_back(v);
+  }
+  auto* fld = experiment.fragmentLengthDistribution();
+  size_t numBins = static_cast<size_t>(fld->maxVal()) + 1;
+  if (pmf.size() != numBins) {
+    sopt.jointLog->error("{} doesn't hold a fragment length distribution of "
+                         "{} bins (--fldMax)",
+                         fldPath.string(), numBins);
+    return false;
+  }
+
+  // The pmf is taken as the observations (of a unit mass) of the run
+  std::vector<double> logHist(numBins, salmon::math::LOG_0);
+  double logTotMass{salmon::math::LOG_0};
+  double logSum{salmon::math::LOG_0};
+  size_t minV{numBins - 1};
+  for (size_t i = 0; i < numBins; ++i) {
+    if (pmf[i] > 0.0) {
+      logHist[i] = std::log(pmf[i]);
+      logTotMass = salmon::math::logAdd(logTotMass, logHist[i]);
+      if (i > 0) {
+        logSum = salmon::math::logAdd(logSum,
+                                      std::log(static_cast<double>(i)) +
+                                          logHist[i]);
+      }
+      minV = std::min(minV, i);
+    }
+  }
+  if (salmon::math::isLog0(logTotMass)) {
+    sopt.jointLog->error("{} holds no fragment length mass", fldPath.string());
+    return false;
+  }
+  fld->loadState(logHist, logTotMass, logSum, minV);
+
+  std::atomic<bool> done{false};
+  experiment.updateTranscriptLengthsAtomic(done);
+  fld->cacheCMF();
+  return true;
+}
+
+/**
+ * Replace the observed bias models of the run with those of an earlier run
+ * (--importModels; its aux_info/{obs5,obs3}_seq.gz, obs_gc.gz and
+ * {obs5,obs3}_pos.gz), for each bias correction that is enabled.  A model
+ * that is missing, or that doesn't fit this run's models, is left as learned
+ * from this run's fragments.  The expected models are still computed, from
+ * this run's abundances.
+ */
+void importBiasModels(const boost::filesystem::path& modelDir,
+                      ReadExperiment& experiment, SalmonOpts& sopt) {
+  namespace bfs = boost::filesystem;
+  namespace bio = boost::iostreams;
+  using salmon::utils::Direction;
+  auto auxDir = modelDir / sopt.auxDir;
+  auto& log = sopt.jointLog;
+
+  // Read the model in auxDir/fname with readFn; says why not if it can't
+  using ReadFn = std::function<bool(bio::filtering_istream&)>;
+  auto readModel = [&auxDir, &log](const std::string& fname,
+                                   ReadFn readFn) -> bool {
+    auto path = auxDir / fname;
+    if (!bfs::exists(path)) {
+      log->warn("There is no {} to import; this run's model is used",
+                path.string());
+      return false;
+    }
+    bio::filtering_istream in;
+    in.push(bio::gzip_decompressor());
+    in.push(bio::file_source(path.string(), std::ios_base::binary));
+    if (!readFn(in)) {
+      log->warn("{} doesn't match this run's model; this run's model is used",
+                path.string());
+      return false;
+    }
+    log->info("Imported the bias model {}", path.string());
+    return true;
+  };
+
+  if (sopt.biasCorrect) {
+    for (auto dir : {Direction::FORWARD, Direction::REVERSE_COMPLEMENT}) {
+      // read into a copy, so a partial read doesn't clobber the model
+      SBModel model = experiment.readBiasModelObserved(dir);
+      if (readModel((dir == Direction::FORWARD) ? "obs5_seq.gz"
+                                                : "obs3_seq.gz",
+                    [&model](bio::filtering_istream& in) -> bool {
+                      return model.readBinary(in);
+                    })) {
+        experiment.readBiasModelObserved(dir) = std::move(model);
+      }
+    }
+  }
+
+  if (sopt.gcBiasCorrect) {
+    GCFragModel model = experiment.observedGC();
+    if (readModel("obs_gc.gz", [&model](bio::filtering_istream& in) -> bool {
+          return model.readBinary(in);
+        })) {
+      experiment.observedGC() = std::move(model);
+    }
+  }
+
+  if (sopt.posBiasCorrect) {
+    const auto& lenBounds = experiment.getLengthQuantiles();
+    for (auto dir : {Direction::FORWARD, Direction::REVERSE_COMPLEMENT}) {
+      std::vector<SimplePosBias> models = experiment.posBias(dir);
+      auto readPosModels = [&lenBounds,
+                            &models](bio::filtering_istream& in) -> bool {
+        uint32_t numModels{0};
+        in.read(reinterpret_cast<char*>(&numModels), sizeof(numModels));
+        if (!in or numModels != lenBounds.size() or
+            numModels != models.size()) {
+          return false;
+        }
+        // the length classes must be those of this run's transcripts
+        std::vector<uint32_t> bounds(numModels, 0);
+        in.read(reinterpret_cast<char*>(bounds.data()),
+                sizeof(uint32_t) * numModels);
+        if (!in or bounds != lenBounds) {
+          return false;
+        }
+        for (auto& m : models) {
+          if (!m.readBinary(in)) {
+            return false;
+          }
+        }
+        return true;
+      };
+      if (readModel((dir == Direction::FORWARD) ? "obs5_pos.gz"
+                                                : "obs3_pos.gz",
+                    readPosModels)) {
+        experiment.posBias(dir) = std::move(models);
+      }
+    }
+  }
+}
+
 template <typename AlnT>
 void quantifyLibrary(ReadExperiment& experiment, bool greedyChain,
                      mem_opt_t* memOptions, SalmonOpts& salmonOpts,
@@ -2069,9 +3324,39 @@ void quantifyLibrary(ReadExperiment& experiment, bool greedyChain,
   auto jointLog = salmonOpts.jointLog;
 
   ForgettingMassCalculator fmCalc(salmonOpts.forgettingFactor);
-  size_t prefillSize = 1000000000 / miniBatchSize;
+  // (a timestep stands for timestepFragments fragments; see numTimesteps)
+  size_t prefillSize = 1000000000 / salmonOpts.timestepFragments;
   fmCalc.prefill(prefillSize);
 
+  // Go on from where the checkpoint of an earlier run left off
+  auto* checkpointer = salmonOpts.checkpointer.get();
+  if (salmonOpts.resume and checkpointer != nullptr) {
+    salmon::checkpoint::Snapshot snapshot;
+    if (!salmon::checkpoint::read(checkpointer->path(), snapshot)) {
+      jointLog->warn("There is no (complete) checkpoint at {}; starting from "
+                     "the first read",
+                     checkpointer->path().string());
+    } else {
+      if (!salmon::checkpoint::restore(snapshot, experiment, fmCalc,
+                                       jointLog.get())) {
+        jointLog->flush();
+        std::exit(1);
+      }
+      numObservedFragments = snapshot.numObservedFragments;
+      totalAssignedFragments = snapshot.numAssignedFragments;
+      upperBoundHits = snapshot.upperBoundHits;
+      if (snapshot.numAssignedFragments >= salmonOpts.numBurninFrags) {
+        experiment.fragmentLengthDistribution()->cacheCMF();
+      }
+      checkpointer->resumeFrom(snapshot);
+      jointLog->info("Resuming from the checkpoint at {} ({} fragments "
+                     "observed, {} assigned)",
+                     checkpointer->path().string(),
+                     snapshot.numObservedFragments,
+                     snapshot.numAssignedFragments);
+    }
+  }
+
   bool initialRound{true};
   uint32_t roundNum{0};
 
@@ -2080,9 +3365,21 @@ void quantifyLibrary(ReadExperiment& experiment, bool greedyChain,
 
   size_t numPrevObservedFragments = 0;
 
-  size_t maxReadGroup{miniBatchSize};
+  size_t maxReadGroup{salmonOpts.parserChunkSize};
   uint32_t structCacheSize = numQuantThreads * maxReadGroup * 10;
 
+  // This structure is a vector of vectors of alignment
+  // groups.  Each thread will get its own vector, so we
+  // allocate these up front to save time and allow
+  // reuse (by every library, in every round).
+  std::vector<AlnGroupVec<AlnT>> groupVec;
+  for (size_t i = 0; i < numQuantThreads; ++i) {
+    groupVec.emplace_back(maxReadGroup);
+  }
+  // Likewise, the per-thread bias parameters and mini-batch scratch
+  std::vector<BiasParams> observedBiasParams;
+  std::vector<MiniBatchScratch> threadScratch;
+
   // EQCLASS
   bool terminate{false};
 
@@ -2117,15 +3414,6 @@ void quantifyLibrary(ReadExperiment& experiment, bool greedyChain,
       numPrevObservedFragments = numObservedFragments;
     }
 
-    // This structure is a vector of vectors of alignment
-    // groups.  Each thread will get its own vector, so we
-    // allocate these up front to save time and allow
-    // reuse.
-    std::vector<AlnGroupVec<AlnT>> groupVec;
-    for (size_t i = 0; i < numQuantThreads; ++i) {
-      groupVec.emplace_back(maxReadGroup);
-    }
-
     bool writeToCache = !salmonOpts.disableMappingCache;
     auto processReadLibraryCallback =
         [&](ReadLibrary& rl, SalmonIndex* sidx,
@@ -2139,7 +3427,8 @@ void quantifyLibrary(ReadExperiment& experiment, bool greedyChain,
                                upperBoundHits, initialRound, burnedIn, fmCalc,
                                fragLengthDist, memOptions, salmonOpts,
                                coverageThresh, greedyChain, ioMutex,
-                               numQuantThreads, groupVec, writeToCache);
+                               numQuantThreads, groupVec, observedBiasParams,
+                               threadScratch, writeToCache);
 
       numAssignedFragments = totalAssignedFragments - prevNumAssignedFragments;
       prevNumAssignedFragments = totalAssignedFragments;
@@ -2149,13 +3438,48 @@ void quantifyLibrary(ReadExperiment& experiment, bool greedyChain,
     if (!salmonOpts.quiet) {
       fmt::print(stderr, "\n\n\n\n");
     }
+    PerformanceStats::Scope mappingPhase(*salmonOpts.perfStats, "mapping");
+    if (!burnedIn) {
+      salmonOpts.perfStats->beginPhase("burn_in");
+    }
+    salmonOpts.runStatus->trackFragments(
+        [&numObservedFragments]() -> uint64_t { return numObservedFragments; },
+        [&totalAssignedFragments]() -> uint64_t {
+          return totalAssignedFragments;
+        });
     experiment.processReads(numQuantThreads, salmonOpts,
                             processReadLibraryCallback);
+    salmonOpts.runStatus->untrackFragments();
+    if (checkpointer != nullptr) {
+      if (!checkpointer->finish()) {
+        jointLog->warn("The last checkpoint couldn't be written to {}",
+                       checkpointer->path().string());
+      }
+      jointLog->info("Took {} checkpoint(s) of the mapping phase",
+                     checkpointer->numTaken());
+    }
+    if (salmonOpts.snapshotter) {
+      if (!salmonOpts.snapshotter->finish()) {
+        jointLog->warn("The interim estimates couldn't all be written to {}",
+                       salmonOpts.snapshotter->path().string());
+      }
+      jointLog->info("Wrote {} interim estimate(s) of the abundances",
+                     salmonOpts.snapshotter->numTaken());
+    }
+    mappingPhase.finish();
     experiment.setNumObservedFragments(numObservedFragments);
+    if (!salmonOpts.importModels.empty()) {
+      importBiasModels(salmonOpts.importModels, experiment, salmonOpts);
+    }
 
     // EQCLASS
+    auto eqFinishStart = PerformanceStats::Clock::now();
     bool done = experiment.equivalenceClassBuilder().finish();
-    // skip the extra online rounds
+    salmonOpts.perfStats->span("equivalence_class_finish", eqFinishStart,
+                               "phase");
+    // skip the extra online rounds; the offline optimization over the
+    // equivalence classes takes the place of further passes, so streamed
+    // input (stdin, named pipes) only ever has to be read once.
     terminate = true;
 
     initialRound = false;
@@ -2263,7 +3587,19 @@ void quantifyLibrary(ReadExperiment& experiment, bool greedyChain,
   jointLog->info("finished quantifyLibrary()");
 }
 
+int salmonQuantify(int argc, char* argv[],
+                   std::shared_ptr<SalmonIndex> salmonIndex);
+
 int salmonQuantify(int argc, char* argv[]) {
+  return salmonQuantify(argc, argv, nullptr);
+}
+
+/**
+ * Quantify a sample; if salmonIndex is given, it is the (already loaded)
+ * index named by the --index option (see salmon serve).
+ */
+int salmonQuantify(int argc, char* argv[],
+                   std::shared_ptr<SalmonIndex> salmonIndex) {
   using std::cerr;
   using std::vector;
   using std::string;
@@ -2284,14 +3620,21 @@ int salmonQuantify(int argc, char* argv[]) {
   vector<string> unmatedReadFiles;
   vector<string> mate1ReadFiles;
   vector<string> mate2ReadFiles;
+  vector<string> interleavedReadFiles;
 
   po::options_description generic("\n"
                                   "basic options");
   generic.add_options()("version,v", "print version string")(
       "help,h", "produce help message")(
       "index,i", po::value<string>()->required(),
-      "Salmon index")("libType,l", po::value<std::string>()->required(),
-                      "Format string describing the library type")(
+      "Salmon index.  Given more than once (e.g. a host and a pathogen "
+      "index), the reads are quantified against each index in a process of "
+      "its own, with its output in <output>/<the index directory's name>, "
+      "and each read file is read and decompressed only once for all of "
+      "them.  These processes run at the same time, and the --threads are "
+      "split among them.")(
+      "libType,l", po::value<std::string>()->required(),
+      "Format string describing the library type")(
       "unmatedReads,r",
       po::value<vector<string>>(&unmatedReadFiles)->multitoken(),
       "List of files containing unmated reads of (e.g. single-end reads)")(
@@ -2299,9 +3642,23 @@ int salmonQuantify(int argc, char* argv[]) {
       "File containing the #1 mates")(
       "mates2,2", po::value<vector<string>>(&mate2ReadFiles)->multitoken(),
       "File containing the #2 mates")(
+      "interleaved",
+      po::value<vector<string>>(&interleavedReadFiles)->multitoken(),
+      "Files containing interleaved mated reads (each #1 mate followed by "
+      "its #2 mate), read as a paired-end library without first splitting "
+      "them into #1 and #2 files")(
 
       "output,o", po::value<std::string>()->required(),
       "Output quantification file.")(
+      "batch", po::value<std::string>(),
+      "Quantify many samples, against one loaded index, in this process.  "
+      "Each line of this file is a sample name followed by the arguments "
+      "particular to that sample (e.g. -1 r1.fq -2 r2.fq); every sample is "
+      "also given the rest of this command's options, and its output is "
+      "written to <output>/<name>.")(
+      "batchJobs", po::value<uint32_t>()->default_value(1),
+      "With --batch, the number of samples that are quantified at the same "
+      "time (each with --threads threads).")(
       "discardOrphansQuasi",
       po::bool_switch(&discardOrphansQuasi)->default_value(false),
       "[Quasi-mapping mode only] : Discard orphan mappings in quasi-mapping "
@@ -2359,7 +3716,12 @@ int salmonQuantify(int argc, char* argv[]) {
       "contain the "
       "transcript identifier and the \"gene_id\" is assumed to contain the "
       "corresponding "
-      "gene identifier.")("writeMappings,z",
+      "gene identifier.")(
+      "geneMapCache", po::value<string>(),
+      "The directory in which a transcript to gene mapping that is parsed "
+      "from a GTF / GFF file is cached (keyed by the checksum of the file), so "
+      "that later runs with the same file needn't parse it again.  By "
+      "default, this is the index directory.")("writeMappings,z",
                           po::value<string>(&sopt.qmFileName)
                               ->default_value("")
                               ->implicit_value("-"),
@@ -2368,6 +3730,11 @@ int salmonQuantify(int argc, char* argv[]) {
                           "format.  By default, output will be directed to "
                           "stdout, but an alternative file name can be "
                           "provided instead.")(
+      "binaryMappings",
+      po::bool_switch(&(sopt.binaryMappings))->default_value(false),
+      "Write the --writeMappings output in a compact binary format (see "
+      "MappingFile.hpp, and scripts/Mappings.py for a reader) rather than as "
+      "SAM, which is much faster to write.")(
       "meta", po::bool_switch(&(sopt.meta))->default_value(false),
       "If you're using Salmon on a metagenomic dataset, consider setting this "
       "flag to disable parts of the "
@@ -2419,6 +3786,12 @@ int salmonQuantify(int argc, char* argv[]) {
           "Includes \"rich\" equivlance class weights in the output when "
           "equivalence "
           "class information is being dumped to file.")(
+          "dumpEqFormat",
+          po::value<std::string>(&(sopt.eqClassFormat))->default_value("text"),
+          "How the equivalence classes are dumped: \"text\" "
+          "(aux/eq_classes.txt), or \"binary\" (aux/eq_classes.bin, a "
+          "compressed file with varint-encoded transcript ids and float "
+          "weights; see scripts/EquivClasses.py for a reader).")(
           "fasterMapping",
           po::bool_switch(&(sopt.fasterMapping))->default_value(false),
           "[Developer]: Disables some extra checks during quasi-mapping. This "
@@ -2433,11 +3806,9 @@ int salmonQuantify(int argc, char* argv[]) {
           "quantification to proceed.")(
           "reduceGCMemory",
           po::bool_switch(&(sopt.reduceGCMemory))->default_value(false),
-          "If this option is selected, a more memory efficient (but slightly "
-          "slower) representation is "
-          "used to compute fragment GC content. Enabling this will reduce "
-          "memory usage, but can also reduce "
-          "speed.  However, the results themselves will remain the same.")(
+          "[Deprecated]: Fragment GC content is now always computed from a "
+          "compact (~1.3 bits / base) representation, so this option has "
+          "no effect.")(
           "biasSpeedSamp",
           po::value<std::uint32_t>(&(sopt.pdfSampFactor))->default_value(1),
           "The value at which the fragment length PMF is down-sampled "
@@ -2472,6 +3843,26 @@ int salmonQuantify(int argc, char* argv[]) {
           "and may be unstable.  A larger value results in slower learning but "
           "may be more stable.  Value should "
           "be in the interval (0.5, 1.0].")(
+          "miniBatchSize",
+          po::value<uint32_t>(&(sopt.miniBatchSize))->default_value(5000),
+          "The number of fragments in each mini-batch of the online phase; "
+          "each chunk of reads a mapping thread takes from the parser is "
+          "processed as mini-batches of this size.  With 0, the size is tuned "
+          "as the reads are processed: the mini-batches are small (1000 "
+          "fragments) during the burn-in, so that the online estimates "
+          "respond quickly, and then grow until each takes about a "
+          "millisecond per thread to process.  Each mini-batch weighs its "
+          "fragments as if they had come in mini-batches of one size (the "
+          "given one, or 1000), so the learning schedule doesn't depend on "
+          "the batching.  (A tuned size depends on the timing, so the "
+          "estimates aren't reproducible from --seed with it.)")(
+          "parserChunkSize",
+          po::value<uint32_t>(&(sopt.parserChunkSize))->default_value(0),
+          "The number of reads (or pairs) in each chunk that the parser hands "
+          "to a mapping thread.  With 0, the chunks are of --miniBatchSize "
+          "reads, or, with --miniBatchSize 0, of 5000 for every 8 threads, "
+          "so that the many threads of a large machine contend less for the "
+          "parser's queue.")(
           "maxOcc,m",
           po::value<int>(&(memOptions->max_occ))->default_value(200),
           "(S)MEMs occuring more than this many times won't be considered.")(
@@ -2479,6 +3870,43 @@ int salmonQuantify(int argc, char* argv[]) {
           po::bool_switch(&(sopt.initUniform))->default_value(false),
           "initialize the offline inference with uniform parameters, rather "
           "than seeding with online parameters.")(
+          "initFrom", po::value<std::string>(&(sopt.initFrom)),
+          "Initialize the offline inference from this abundance profile, "
+          "rather than from the online estimates: a quant.sf of a similar "
+          "sample, or a table of salmon quantmerge --column numreads over a "
+          "cohort (whose samples are averaged).  The profile is scaled to "
+          "this sample's mapped fragments; for similar samples, the (VB)EM "
+          "then converges in fewer iterations.  The source is recorded in "
+          "meta_info.json (em_init_source).")(
+          "targets", po::value<std::string>(&(sopt.targetsFile)),
+          "Targeted quantification: a file listing the transcripts of "
+          "interest (one name per line).  The reads are still mapped against "
+          "the whole index, but the offline phase (the (VB)EM, the bias "
+          "corrected effective lengths, and the bootstraps or Gibbs samples) "
+          "only runs over the connected components of equivalence classes "
+          "that hold a target.  The fragments of the other classes are "
+          "counted as background (num_background_frags in meta_info.json), "
+          "and the other transcripts are reported with no reads; the TPMs "
+          "are relative to the targets' components.")(
+          "sweep", po::value<std::string>(&(sopt.sweepFile)),
+          "Also quantify the sample with each of the inference "
+          "configurations in this file, from the same equivalence classes "
+          "(the reads are mapped once).  Each line is a name, then any of "
+          "--useVBOpt or --useEM, --vbPrior <prior>, --perTranscriptPrior or "
+          "--perNucleotidePrior, and --noBiasCorrect (the other options are "
+          "the run's); the configuration's quant.sf is written to "
+          "<output>/sweep/<name>.")(
+          "importModels", po::value<std::string>(&(sopt.importModels)),
+          "Import the fragment length distribution and the observed bias "
+          "models from this earlier quant output directory (e.g. of a "
+          "technical replicate, or of an earlier sequencing of the same "
+          "library), rather than learning them from this run's reads.  The "
+          "imported models are taken as burned in from the first fragment "
+          "(the --numAuxModelSamples burn-in is skipped) and are not "
+          "refined.  The bias models are imported for the bias corrections "
+          "that are enabled (and were enabled in the earlier run); the "
+          "expected bias models are still computed from this run's "
+          "abundances.")(
           "maxReadOcc,w",
           po::value<uint32_t>(&(sopt.maxReadOccs))->default_value(100),
           "Reads \"mapping\" to more than this many places won't be "
@@ -2521,6 +3949,15 @@ int salmonQuantify(int argc, char* argv[]) {
           "increase the precision "
           "of bias correction, but harm robustness.  The default correction "
           "applies a threshold.")(
+          "observedEffLens",
+          po::bool_switch(&(sopt.useObservedEffLengths))->default_value(false),
+          "[experimental] : "
+          "With bias correction of paired-end reads, give each transcript "
+          "with more than 50 mapped fragments the average of the effective "
+          "lengths observed for it (its length, minus each fragment's length, "
+          "plus 1, weighted by the fragment's assignment probability), rather "
+          "than computing its bias-corrected effective length from the "
+          "models.")(
           "numBiasSamples",
           po::value<int32_t>(&numBiasSamples)->default_value(2000000),
           "Number of fragment mappings to use when learning the "
@@ -2546,6 +3983,12 @@ int salmonQuantify(int argc, char* argv[]) {
           "useVBOpt", po::bool_switch(&(sopt.useVBOpt))->default_value(false),
           "Use the Variational Bayesian EM rather than the "
           "traditional EM algorithm for optimization in the batch passes.")(
+          "useSQUAREM",
+          po::bool_switch(&(sopt.useSQUAREM))->default_value(false),
+          "Accelerate the EM (or VBEM) used for the point estimate and for "
+          "bootstrapping with SQUAREM extrapolation.  Each extrapolated step is "
+          "only accepted if it does not decrease the likelihood; otherwise, the "
+          "plain EM step is used.")(
           "rangeFactorizationBins",
           po::value<uint32_t>(&(sopt.rangeFactorizationBins))->default_value(0),
           "Factorizes the likelihood used in quantification by adopting a new "
@@ -2565,6 +4008,89 @@ int salmonQuantify(int argc, char* argv[]) {
           po::value<uint32_t>(&(sopt.numBootstraps))->default_value(0),
           "Number of bootstrap samples to generate. Note: "
           "This is mutually exclusive with Gibbs sampling.")(
+          "bootstrapTolerance",
+          po::value<double>(&(sopt.bootstrapRelDiffTolerance))->default_value(0.01),
+          "The maximum relative change of any (expressed) transcript's estimate "
+          "between (VB)EM iterations at which a bootstrap sample is considered "
+          "converged.  Larger values make bootstrapping faster, at some cost in "
+          "precision.")(
+          "bootstrapWarmStart",
+          po::bool_switch(&(sopt.bootstrapWarmStart))->default_value(false),
+          "Start the (VB)EM of each bootstrap sample from the point estimates, "
+          "rather than from uniform abundances.  The samples converge in fewer "
+          "iterations, but each stops (at --bootstrapTolerance) nearer the "
+          "point estimates, which can understate their variance; use it with "
+          "a smaller --bootstrapTolerance.")(
+          "approxVariance",
+          po::bool_switch(&(sopt.approxVariance))->default_value(false),
+          "Also write quant_var.sf: the columns of quant.sf, followed by the "
+          "standard deviations of the TPM and NumReads, and a 95% interval "
+          "of the NumReads, approximated from the curvature of the "
+          "likelihood at the estimates (the delta method) in seconds, rather "
+          "than from bootstrap samples.")(
+          "bootstrapBatchSize",
+          po::value<uint32_t>(&(sopt.bootstrapBatchSize))->default_value(0),
+          "Have each bootstrap thread solve this many samples at once, with "
+          "their abundances interleaved, so that every (VB)EM iteration reads "
+          "the equivalence classes once for the whole batch rather than once "
+          "per sample.  A batch runs until its slowest sample has converged. "
+          "Ignored with --useSQUAREM.  The default (0) solves batches of 4 (or "
+          "2) samples when there are enough samples to give every thread a "
+          "batch, and one sample at a time otherwise.")(
+          "onlineBootstraps",
+          po::bool_switch(&(sopt.onlineBootstraps))->default_value(false),
+          "Draw the counts of the --numBootstraps samples while the reads are "
+          "mapped, rather than by resampling the equivalence classes "
+          "afterwards: each fragment is counted Poisson(1) times in each "
+          "sample (drawn from a hash of --seed and the read's name), and every "
+          "equivalence class keeps its count in each sample.  This takes "
+          "4 * numBootstraps bytes per class.  Quasi-mapping mode only.")(
+          "numGibbsChains",
+          po::value<uint32_t>(&(sopt.numGibbsChains))->default_value(0),
+          "Run this many independent Gibbs chains side by side, each with "
+          "its own share of the threads, and write their samples as they are "
+          "drawn.  The default (0) runs the chains one after another, using "
+          "all of the threads for each.")(
+          "sampleFormat",
+          po::value<std::string>(&(sopt.sampleFormat))->default_value("gzip"),
+          "The format of the bootstrap / Gibbs samples.  \"gzip\" writes "
+          "bootstraps.gz, one sample after another; \"columnar\" writes "
+          "bootstraps.col, which stores the samples by transcript in "
+          "separately compressed blocks, so that the samples of a few "
+          "transcripts can be read without decompressing the whole file "
+          "(see scripts/ColumnarSamples.py).")(
+          "samplePrecision",
+          po::value<std::string>(&(sopt.samplePrecision))
+              ->default_value("double"),
+          "How the values of the bootstrap / Gibbs samples are stored: "
+          "\"double\" (64-bit floating point), \"float\" (32-bit floating "
+          "point) or \"fixed\" (the counts multiplied by --sampleFixedScale "
+          "and rounded to integers).  With the gzip format, the reduced "
+          "precisions also store only the non-zero values of each sample, "
+          "unless --denseSamples is given.")(
+          "sampleFixedScale",
+          po::value<uint32_t>(&(sopt.sampleFixedScale))->default_value(100),
+          "With --samplePrecision fixed, the counts are stored with a "
+          "resolution of 1 / this value.")(
+          "denseSamples",
+          po::bool_switch(&(sopt.denseSamples))->default_value(false),
+          "Store every value of each (reduced-precision) sample in the gzip "
+          "format, rather than only the non-zero ones.")(
+          "gibbsActiveSet",
+          po::bool_switch(&(sopt.gibbsActiveSet))->default_value(false),
+          "In the thinning rounds between two Gibbs samples, resample only "
+          "the transcripts that had a non-zero count in the previous sample "
+          "(and the equivalence classes containing them).  Each sample is "
+          "still drawn after a round over all of the transcripts.")(
+          "seed",
+          po::value<uint64_t>(&(sopt.samplerSeed))->default_value(0),
+          "The seed for the random number generators used to draw the "
+          "bootstrap or Gibbs samples.  Runs with the same seed and input "
+          "produce the same samples, regardless of the number of threads.  "
+          "The generators of the online phase (which sample the fragments "
+          "used to learn the fragment length distribution) are seeded from "
+          "it as well; with a single thread, the whole run is reproducible.  "
+          "The default (0) draws a seed at random.")(
           "thinningFactor",
           po::value<uint32_t>(&(sopt.thinningFactor))->default_value(16),
           "Number of steps to discard for every sample kept from the Gibbs "
@@ -2587,6 +4113,138 @@ int salmonQuantify(int argc, char* argv[]) {
           "as a per-nucleotide prior, unless the --perTranscriptPrior flag "
           "is also given, in which case this is used as a transcript-level "
           "prior")(
+          "eqClassFlushInterval",
+          po::value<uint32_t>(&(sopt.eqClassFlushInterval))
+              ->default_value(25000),
+          "Each mapping thread aggregates the equivalence classes of the "
+          "fragments it processes locally, and merges them into the global "
+          "set of equivalence classes after (at most) this many fragments.  "
+          "Larger values reduce contention between threads; a value of 0 "
+          "disables local aggregation.")(
+          "threadLocalMass",
+          po::bool_switch(&(sopt.threadLocalMass))->default_value(false),
+          "[Experimental]: During the online phase, accumulate the mass "
+          "assigned to each transcript in a per-thread buffer, and apply it "
+          "to the shared abundance estimates once per mini-batch.  This "
+          "reduces contention between threads on highly-expressed "
+          "transcripts at the cost of one extra value per transcript, per "
+          "thread.  The observed fragment lengths and start positions are "
+          "buffered, and added to their distributions, in the same way.")(
+          "atomicEMUpdates",
+          po::bool_switch(&(sopt.atomicEMUpdates))->default_value(false),
+          "[Experimental]: In the offline phase, accumulate the parallel (VB)EM "
+          "updates using atomic compare-and-swap operations, rather than "
+          "partitioning the equivalence classes by connected component so "
+          "that each thread updates a disjoint set of transcripts.")(
+          "componentConvergence",
+          po::bool_switch(&(sopt.componentConvergence))->default_value(false),
+          "[Experimental]: In the offline phase, test the convergence of "
+          "each connected component of the transcripts separately, and stop "
+          "updating a component once it has converged, rather than updating "
+          "every component until all of them have.  This is faster, but the "
+          "estimates of slowly-converging components can differ from those "
+          "of the global EM.  This has no effect if --atomicEMUpdates is "
+          "passed.")(
+          "emObjectiveInterval",
+          po::value<uint32_t>(&(sopt.emObjectiveInterval))->default_value(0),
+          "[Experimental]: Compute (and log) the log-likelihood of the "
+          "estimates every this many iterations of the offline (VB)EM, and "
+          "stop, once at least the minimum number of iterations has been "
+          "run, if it has changed by less than --emObjectiveTolerance "
+          "(relative) since the last time, even if some transcripts' "
+          "estimates are still changing by more than the tolerance.  A value "
+          "of 0 (the default) disables this.")(
+          "emObjectiveTolerance",
+          po::value<double>(&(sopt.emObjectiveTolerance))
+              ->default_value(1e-8),
+          "The relative change of the log-likelihood at which the offline "
+          "(VB)EM stops (see --emObjectiveInterval).")(
+          "geneLevelEM",
+          po::bool_switch(&(sopt.geneLevelEM))->default_value(false),
+          "[Experimental]: With --geneMap, resolve the abundances of the genes "
+          "first, on equivalence classes whose labels are genes: the classes "
+          "whose transcripts all belong to one gene collapse into one class "
+          "per gene, which makes the table the offline phase iterates over "
+          "much smaller.  Within a gene, the transcripts are weighted by their "
+          "online estimates.  Unless --refineTranscripts is passed (or the "
+          "biases are corrected for), the transcript-level estimates in "
+          "quant.sf are just those of their gene, split by the online "
+          "estimates; only quant.genes.sf should be relied on.")(
+          "refineTranscripts",
+          po::bool_switch(&(sopt.refineTranscripts))->default_value(false),
+          "With --geneLevelEM, go on to resolve the transcripts, starting the "
+          "transcript-level offline (VB)EM from the gene-level estimates.")(
+          "emSinglePrecision",
+          po::bool_switch(&(sopt.emSinglePrecision))->default_value(false),
+          "[Experimental]: Keep the equivalence class weights that each "
+          "offline (VB)EM iteration reads in single precision, halving the "
+          "memory traffic of the iterations over large equivalence class "
+          "tables.  The abundances, and all sums, stay in double precision; "
+          "the estimates differ from the default ones by about the float "
+          "rounding error of the weights.  This has no effect if "
+          "--atomicEMUpdates is passed.")(
+          "indexHugePages",
+          po::bool_switch(&(sopt.indexPlacement.hugePages))
+              ->default_value(false),
+          "[Experimental]: After loading the quasi index, move its suffix "
+          "array and transcript sequence into memory backed by (transparent) "
+          "huge pages, to reduce TLB misses during mapping.  Each array is "
+          "briefly held twice while it is moved.")(
+          "interleaveIndex",
+          po::bool_switch(&(sopt.indexPlacement.interleave))
+              ->default_value(false),
+          "[Experimental]: After loading the quasi index, interleave the "
+          "pages of its suffix array and transcript sequence across all NUMA "
+          "nodes, so that mapping threads on every socket see the same "
+          "(average) memory latency.  This has no effect on single-node "
+          "machines.")(
+          "pinThreads",
+          po::bool_switch(&(sopt.pinThreads))->default_value(false),
+          "[Experimental]: Pin each mapping thread, and each worker thread of "
+          "the later (EM, bootstrapping, ...) phases, to its own CPU (of those "
+          "this process may run on), so that threads and their caches aren't "
+          "moved between CPUs.")(
+          "inferenceThreads",
+          po::value<uint32_t>(&(sopt.numInferenceThreads))->default_value(0),
+          "[Experimental]: Run the online inference (the assignment of the "
+          "mapped fragments, and the updates of the abundances, fragment "
+          "length distribution and bias models) on this many threads of its "
+          "own, which take the mini-batches of the mapping threads (-p) "
+          "from a bounded queue, so that each stage keeps its own data in "
+          "cache and the two can be sized independently.  With 0, each "
+          "mapping thread processes its own mini-batches.  Quasi-mapping "
+          "only.")(
+          "mappingCacheDir",
+          po::value<std::string>(&(sopt.mappingCacheDir)),
+          "[Experimental]: Keep the mappings of each read library in this "
+          "directory (in a file named by a hash of the index, the read files "
+          "and the mapping options), and replay them, rather than mapping "
+          "the reads again, in later runs that find them there (e.g. to "
+          "re-run the inference with other options).  A read file is known "
+          "by its path, size, modification time and the hash of its first "
+          "and last MiB.  Quasi-mapping only; not with checkpoints, "
+          "--onlineBootstraps or the options that write out per-read "
+          "records (--writeMappings, --writeUnmappedNames, ...).")(
+          "memoryBudget",
+          po::value<double>(&(sopt.memoryBudget))->default_value(0.0),
+          "The memory (in GB) that the run's large structures (the index, "
+          "the equivalence classes, the bootstrap buffers) should fit in.  "
+          "The initial equivalence class table and the bootstrap buffers are "
+          "made smaller if they wouldn't fit, and the equivalence classes are "
+          "spilled to disk (see --maxInMemoryEqClasses) beyond a quarter of "
+          "the budget.  The estimates don't cover "
+          "every allocation, so leave some headroom below the hard limit of "
+          "your scheduler.  0 sets no budget.")(
+          "maxInMemoryEqClasses",
+          po::value<size_t>(&(sopt.maxInMemoryEqClasses))->default_value(0),
+          "Keep at most this many equivalence classes in memory while "
+          "mapping; whenever there are more, the least frequent half of them "
+          "is written, sorted, to <output>/eq_classes.spill, and the runs "
+          "written are merged once mapping is done.  This keeps the memory "
+          "of the mapping phase flat, and the class table from ever growing "
+          "(and rehashing), for samples with tens of millions of distinct "
+          "classes.  With 0, classes are only spilled under a --memoryBudget "
+          "(beyond those that fit in a quarter of it).")(
           "writeOrphanLinks",
           po::bool_switch(&(sopt.writeOrphanLinks))->default_value(false),
           "Write the transcripts that are linked by orphaned reads.")(
@@ -2594,6 +4252,83 @@ int salmonQuantify(int argc, char* argv[]) {
           po::bool_switch(&(sopt.writeUnmappedNames))->default_value(false),
           "Write the names of un-mapped reads to the file unmapped_names.txt "
           "in the auxiliary directory.")(
+          "writeUnmappedReads",
+          po::bool_switch(&(sopt.writeUnmappedReads))->default_value(false),
+          "Write the unmapped reads themselves, as FASTA (the qualities "
+          "aren't kept), to unmapped.fa (unpaired reads) and unmapped_1.fa "
+          "and unmapped_2.fa (the mates of pairs) in the auxiliary "
+          "directory, while mapping, so that they needn't be extracted from "
+          "the input afterwards.")(
+          "writeOrphanedReads",
+          po::bool_switch(&(sopt.writeOrphanedReads))->default_value(false),
+          "With --writeUnmappedReads, also write the pairs of which only one "
+          "mate mapped (both mates).")(
+          "compressAuxRecords",
+          po::bool_switch(&(sopt.compressAuxRecords))->default_value(false),
+          "Gzip the files written by --writeUnmappedNames, "
+          "--writeUnmappedReads and --writeOrphanLinks (to "
+          "unmapped_names.txt.gz, unmapped*.fa.gz and orphan_links.txt.gz).  "
+          "Each batch of records is compressed by the mapping thread that "
+          "wrote it.")(
+          "writePartial",
+          po::bool_switch(&(sopt.writePartial))->default_value(false),
+          "Don't run the offline phase; write the equivalence classes, "
+          "effective lengths, fragment length distribution and mapping "
+          "statistics it needs to <output>/partial instead, so that the runs "
+          "over the shards of a sample's reads can be merged (and quantified "
+          "at once) with salmon merge-partials.  Bias correction is not "
+          "carried over.")(
+          "checkpointInterval",
+          po::value<uint64_t>(&(sopt.checkpointInterval))->default_value(0),
+          "Every this many observed fragments, write the state of the mapping "
+          "phase (equivalence classes, fragment length distribution, online "
+          "abundance estimates, and the number of reads consumed) to "
+          "<output>/checkpoint, so that an interrupted run can be taken up "
+          "again with --resume.  The reads are parsed by a single thread while "
+          "checkpointing, and the bias models are not checkpointed.  0 takes "
+          "no checkpoints (quasi-mapping mode only).")(
+          "resume", po::bool_switch(&(sopt.resume))->default_value(false),
+          "Go on from the checkpoint (see --checkpointInterval) that an earlier "
+          "run with the same index, reads and output directory left in "
+          "<output>/checkpoint, rather than from the first read.")(
+          "snapshotInterval",
+          po::value<uint64_t>(&(sopt.snapshotInterval))->default_value(0),
+          "Every this many observed fragments, write the online abundance "
+          "estimates of the reads processed so far to "
+          "<output>/quant.partial.sf (in the format of quant.sf), so that a "
+          "run can be watched, and stopped once its answer is clear, before "
+          "the offline phase.  These are the rough estimates of the online "
+          "phase, not those of the EM.  0 writes none (quasi-mapping mode "
+          "only).")(
+          "writeQuantBin",
+          po::bool_switch(&(sopt.writeQuantBin))->default_value(false),
+          "Also write the abundances of quant.sf, at full precision, to the "
+          "binary (columnar) file quant.bin; see scripts/QuantBin.py for a "
+          "reader.")(
+          "sparseQuant",
+          po::bool_switch(&(sopt.sparseQuant))->default_value(false),
+          "Only list the transcripts with reads in quant.sf (e.g. against "
+          "a huge metagenomic reference, where nearly none have any); "
+          "quant.bin, if written, still has every transcript.")(
+          "trace", po::value<std::string>(&(sopt.traceFile)),
+          "Write a Chrome trace (for chrome://tracing or Perfetto) of the "
+          "run's phases, and of what each mapping thread spends its time on "
+          "(waiting on the parser, mapping, processing mini-batches), to "
+          "this file.")(
+          "hwCounters",
+          po::bool_switch(&(sopt.hwCounters))->default_value(false),
+          "Count the CPU's events (cycles, instructions, last-level cache "
+          "and dTLB misses, branch mispredictions) of each phase of the "
+          "run, and of each mapping thread, with perf_event_open, and add "
+          "them to the performance section of meta_info.json (Linux only, "
+          "and where /proc/sys/kernel/perf_event_paranoid allows it).")(
+          "statusFile", po::value<std::string>(&(sopt.statusFile)),
+          "Periodically rewrite the live status of the run (fragments "
+          "processed and mapped, throughput, current phase, parser queue "
+          "depth, EM progress) to this file, as JSON, for monitoring.")(
+          "statusInterval",
+          po::value<double>(&(sopt.statusInterval))->default_value(10.0),
+          "The number of seconds between rewrites of the --statusFile.")(
           "quasiCoverage,x",
           po::value<double>(&(sopt.quasiCoverage))->default_value(0.0),
           "[Experimental]: The fraction of the read that must be covered by "
@@ -2604,7 +4339,95 @@ int salmonQuantify(int argc, char* argv[]) {
           "31-mer can yield a mapping).  "
           "Since coverage by exact matching, large, MMPs is a rather strict "
           "condition, this value should likely "
-          "be set to something low, if used.");
+          "be set to something low, if used.")(
+          "maxEditFraction",
+          po::value<double>(&(sopt.maxEditFraction))->default_value(0.0),
+          "[Experimental]: Score each quasi-mapping of a read against the "
+          "transcript sequence, and discard it if the (banded) edit distance "
+          "between the read and the transcript at that position exceeds this "
+          "fraction of the read length.  The outcome for each distinct "
+          "(read, position) pair is cached, so duplicate reads are cheap to "
+          "check.  A value of 0 (the default) disables this check.")(
+          "readCacheSize",
+          po::value<uint32_t>(&(sopt.readCacheSize))->default_value(0),
+          "[Experimental]: The number of recently mapped reads (or read "
+          "pairs) whose mappings each mapping thread remembers; an exact "
+          "duplicate of one of these is not mapped again.  This can help with "
+          "libraries that have many duplicate reads.  It has no effect with "
+          "--writeOrphanLinks.  A value of 0 (the default) disables the "
+          "cache.")(
+          "maxKmerOcc",
+          po::value<uint64_t>(&(sopt.maxKmerOcc))->default_value(0),
+          "[Experimental]: Discard, without mapping it, a read (or a read "
+          "pair, if both of its ends qualify) all of whose k-mers that are in "
+          "the index occur there more than this many times (e.g. poly-A, "
+          "Alu-like or rRNA repeats).  A tiling of the read's k-mers is "
+          "looked up in the k-mer hash, which holds their number of "
+          "occurrences, so such reads are rejected without walking their "
+          "suffix array intervals.  These reads would usually be discarded "
+          "for mapping to more than --maxReadOcc places.  A value of 0 (the "
+          "default) disables this check.")(
+          "maxDust", po::value<double>(&(sopt.maxDust))->default_value(0.0),
+          "[Experimental]: Discard, without mapping it, a read (or a read "
+          "pair, if both of its ends qualify) of low complexity: one whose "
+          "DUST score (of its trinucleotides) is above this.  A random "
+          "sequence scores about 1, and a homopolymer or poly-A tail about "
+          "half its length; e.g. 20 discards the reads that are mostly "
+          "homopolymer or short tandem repeat.  A value of 0 (the default) "
+          "disables this check.")(
+          "adapters",
+          po::value<std::vector<std::string>>(&(sopt.adapters))->multitoken(),
+          "[Experimental]: Clip these adapter sequences (e.g. AGATCGGAAGAGC "
+          "for Illumina TruSeq) off the reads before mapping them: each read "
+          "is cut at the first occurrence of an adapter, or of a prefix of "
+          "one of at least --minAdapterOverlap bases at its 3' end.  The "
+          "reads of adapter dimers are then too short to be mapped.")(
+          "minAdapterOverlap",
+          po::value<uint32_t>(&(sopt.minAdapterOverlap))->default_value(8),
+          "The shortest partial adapter clipped off the 3' end of a read (see "
+          "--adapters).")(
+          "subsample",
+          po::value<double>(&(sopt.subsampleFraction))->default_value(1.0),
+          "[Experimental]: Quantify only this fraction (in (0, 1]) of the "
+          "reads, for a quick estimate.  The reads (pairs) are chosen by a "
+          "hash of their names (seeded by --seed), so the same ones are "
+          "chosen in every run; the others are dropped by the parser without "
+          "being copied or mapped.  The NumReads in quant.sf are scaled up "
+          "to all of the reads.")(
+          "onlineStopTolerance",
+          po::value<double>(&(sopt.onlineStopTolerance))->default_value(0.0),
+          "[Experimental]: After burn-in, periodically compare the online "
+          "abundance estimates of the most abundant transcripts (and the mean "
+          "fragment length); once they change by less than this between two "
+          "consecutive checks, the remaining fragments are still mapped and "
+          "counted into equivalence classes, but no longer update the online "
+          "estimates or the observed bias models.  This is meant for quick "
+          "(e.g. QC) runs.  A value of 0 (the default) never stops the "
+          "online updates.")(
+          "fastMath",
+          po::bool_switch(&(sopt.fastMath))->default_value(false),
+          "[Experimental]: In the online phase, compute the logarithms and "
+          "exponentials of each alignment's probability (and of the "
+          "equivalence class weights) with single-precision approximations, "
+          "which are within about 1e-4 of the exact values.")(
+          "cellBarcodeLength",
+          po::value<uint32_t>(&(sopt.cellBarcodeLength))->default_value(0),
+          "[Experimental]: Quantify a droplet single-cell library, in which "
+          "the first mate starts with a cell barcode of this length, "
+          "followed by the UMI (--umiLength), and the second mate is the "
+          "cDNA read.  The second mates are mapped, and the UMIs are "
+          "deduplicated within each (cell, equivalence class); the "
+          "transcript counts of each cell are then estimated separately, and "
+          "written as a sparse (cell x transcript) matrix to the cells "
+          "directory of the output.  A value of 0 (the default) is a bulk "
+          "library.")(
+          "umiLength", po::value<uint32_t>(&(sopt.umiLength))->default_value(0),
+          "[Experimental]: With --cellBarcodeLength, the length of the UMI "
+          "(at most 32) that follows the cell barcode.")(
+          "minCellUMIs",
+          po::value<uint64_t>(&(sopt.minCellUMIs))->default_value(10),
+          "[Experimental]: With --cellBarcodeLength, the cells (barcodes) "
+          "with fewer than this many UMIs are not quantified.");
 
   po::options_description fmd("\noptions that apply to the old FMD index");
   fmd.add_options()(
@@ -2781,14 +4604,213 @@ transcript abundance from RNA-seq reads
     versionInfo.load(versionPath);
     auto idxType = versionInfo.indexType();
 
-    ReadExperiment experiment(readLibraries, indexDirectory, sopt);
+    // One TBB scheduler for the whole run, so that its worker threads are
+    // kept (rather than created and torn down) from one parallel phase to
+    // the next; the phases' own task_scheduler_inits just share it.
+    tbb::task_scheduler_init tbbScheduler(sopt.numThreads);
+    std::unique_ptr<salmon::threads::TBBWorkerPinner> tbbPinner(
+        sopt.pinThreads ? new salmon::threads::TBBWorkerPinner() : nullptr);
+
+    PerformanceStats::Scope indexLoadPhase(*sopt.perfStats, "index_load");
+    ReadExperiment experiment(readLibraries, indexDirectory, sopt,
+                              salmonIndex);
+    indexLoadPhase.finish();
 
     // This will be the class in charge of maintaining our
     // rich equivalence classes
     experiment.equivalenceClassBuilder().start();
+    experiment.equivalenceClassBuilder().spillTo(
+        (sopt.outputDirectory / "eq_classes.spill").string(),
+        sopt.maxInMemoryEqClasses);
 
     auto indexType = experiment.getIndex()->indexType();
 
+    if (sopt.cellBarcodeLength > 0) {
+      if (indexType != SalmonIndexType::QUASI) {
+        jointLog->error("Single-cell mode (--cellBarcodeLength) requires "
+                        "the quasi-index.");
+        return 1;
+      }
+      sopt.useQuasi = true;
+      bool cellsOK = quantifySingleCells(experiment, sopt);
+      salmon::utils::writeCmdInfo(sopt, orderedOptions);
+      free(memOptions);
+      sopt.runStatus->stop();
+      return cellsOK ? 0 : 1;
+    }
+
+    if (sopt.checkpointInterval > 0 or sopt.resume) {
+      if (indexType != SalmonIndexType::QUASI) {
+        jointLog->warn("Checkpoints (--checkpointInterval, --resume) require "
+                       "the quasi-index; they are disabled");
+      } else {
+        bfs::path checkpointDir = outputDirectory / "checkpoint";
+        boost::system::error_code ec;
+        bfs::create_directories(checkpointDir, ec);
+        if (ec) {
+          jointLog->error("Could not create the checkpoint directory {}",
+                          checkpointDir.string());
+          return 1;
+        }
+        // with --resume alone, go on from the checkpoint but take no more
+        uint64_t interval = (sopt.checkpointInterval > 0)
+                                ? sopt.checkpointInterval
+                                : std::numeric_limits<uint64_t>::max();
+        sopt.checkpointer = std::make_shared<salmon::checkpoint::Checkpointer>(
+            checkpointDir / "checkpoint.bin", interval, jointLog);
+        if (sopt.biasCorrect or sopt.gcBiasCorrect or sopt.posBiasCorrect) {
+          jointLog->warn("The bias models are not checkpointed; a resumed run "
+                         "only learns them from the reads after the "
+                         "checkpoint");
+        }
+      }
+    }
+
+    if (sopt.snapshotInterval > 0) {
+      if (indexType != SalmonIndexType::QUASI) {
+        jointLog->warn("--snapshotInterval requires the quasi-index; it is "
+                       "ignored");
+      } else {
+        sopt.snapshotter = std::make_shared<salmon::interim::Snapshotter>(
+            outputDirectory / "quant.partial.sf", sopt.snapshotInterval,
+            experiment.transcripts(), jointLog);
+      }
+    }
+
+    if (!sopt.initFrom.empty()) {
+      if (sopt.initUniform) {
+        jointLog->warn("--initFrom overrides --initUniform");
+        sopt.initUniform = false;
+      }
+      if (!salmon::utils::readAbundanceProfile(sopt.initFrom,
+                                               experiment.transcriptNames(),
+                                               sopt.initProfile,
+                                               jointLog.get())) {
+        return 1;
+      }
+    }
+
+    if (!sopt.targetsFile.empty() and
+        !salmon::utils::readTargetList(sopt.targetsFile,
+                                       experiment.transcriptNames(),
+                                       sopt.targets, jointLog.get())) {
+      return 1;
+    }
+
+    salmon::sweep::Sweep sweep;
+    if (!sopt.sweepFile.empty()) {
+      if (sopt.writePartial) {
+        jointLog->warn("--sweep can't be used with --writePartial; it is "
+                       "ignored");
+      } else if (!sweep.load(sopt.sweepFile, sopt, jointLog.get())) {
+        return 1;
+      }
+    }
+
+    if (!sopt.importModels.empty()) {
+      if (!importFragLengthDist(sopt.importModels, experiment, sopt)) {
+        return 1;
+      }
+      // The models are burned in already
+      sopt.numBurninFrags = 0;
+      sopt.numPreBurninFrags = 0;
+      if (sopt.useFSPD) {
+        jointLog->warn("The fragment start position distribution isn't "
+                       "imported (and isn't learned once burned in); it is "
+                       "disabled");
+        sopt.useFSPD = false;
+      }
+      jointLog->info("Imported the fragment length distribution of {}; the "
+                     "burn-in is skipped",
+                     sopt.importModels);
+    }
+
+    if (sopt.subsampleFraction <= 0.0 or sopt.subsampleFraction > 1.0) {
+      jointLog->error("--subsample must be in (0, 1], not {}",
+                      sopt.subsampleFraction);
+      return 1;
+    }
+
+    if (sopt.onlineBootstraps) {
+      if (indexType != SalmonIndexType::QUASI or sopt.numBootstraps == 0) {
+        jointLog->warn("--onlineBootstraps requires the quasi-index and "
+                       "--numBootstraps > 0; it is ignored");
+        sopt.onlineBootstraps = false;
+      } else if (sopt.checkpointer) {
+        jointLog->warn("The online bootstrap counts are not checkpointed; "
+                       "the bootstraps will be drawn after mapping instead");
+        sopt.onlineBootstraps = false;
+      } else {
+        // the weights are drawn during mapping, so the seed is needed now
+        if (sopt.samplerSeed == 0) {
+          std::random_device rd;
+          sopt.samplerSeed = (static_cast<uint64_t>(rd()) << 32) | rd();
+        }
+        sopt.onlineBootstrap =
+            PoissonBootstrap(sopt.samplerSeed, sopt.numBootstraps);
+        experiment.equivalenceClassBuilder().setNumReplicates(
+            sopt.numBootstraps);
+        jointLog->info("Drawing the counts of {} bootstrap samples online, "
+                       "with seed {}",
+                       sopt.numBootstraps, sopt.samplerSeed);
+      }
+    }
+
+    if (!sopt.mappingCacheDir.empty()) {
+      boost::system::error_code ec;
+      if (indexType != SalmonIndexType::QUASI) {
+        jointLog->warn("--mappingCacheDir requires the quasi-index; it is "
+                       "ignored");
+        sopt.mappingCacheDir.clear();
+      } else if (sopt.checkpointer or sopt.onlineBootstraps) {
+        jointLog->warn("--mappingCacheDir can't be used with checkpoints or "
+                       "--onlineBootstraps; it is ignored");
+        sopt.mappingCacheDir.clear();
+      } else if (!sopt.qmFileName.empty() or sopt.writeUnmappedNames or
+                 sopt.writeUnmappedReads or sopt.writeOrphanLinks) {
+        // (a replayed library has no reads to write them from)
+        jointLog->warn("--mappingCacheDir can't be used with --writeMappings, "
+                       "--writeUnmappedNames, --writeUnmappedReads or "
+                       "--writeOrphanLinks; it is ignored");
+        sopt.mappingCacheDir.clear();
+      } else if (!bfs::create_directories(sopt.mappingCacheDir, ec) and ec) {
+        jointLog->error("Could not create the mapping cache directory {}",
+                        sopt.mappingCacheDir);
+        return 1;
+      }
+    }
+
+    if (sopt.numInferenceThreads > 0) {
+      if (indexType != SalmonIndexType::QUASI) {
+        jointLog->warn("--inferenceThreads requires the quasi-index; it is "
+                       "ignored");
+        sopt.numInferenceThreads = 0;
+      } else if (sopt.checkpointer or sopt.onlineBootstraps) {
+        jointLog->warn("--inferenceThreads can't be used with checkpoints or "
+                       "--onlineBootstraps; it is ignored");
+        sopt.numInferenceThreads = 0;
+      }
+    }
+
+    // The chunks hold at least one mini-batch of a fixed size; a timestep of
+    // the forgetting mass stands for one such mini-batch, or for one of the
+    // smallest tuned ones
+    if (sopt.parserChunkSize == 0) {
+      uint32_t numThreadBlocks = std::max(sopt.numThreads / 8, uint32_t(1));
+      sopt.parserChunkSize = (sopt.miniBatchSize > 0)
+                                 ? sopt.miniBatchSize
+                                 : defaultChunkSize * numThreadBlocks;
+    } else if (sopt.parserChunkSize < sopt.miniBatchSize) {
+      jointLog->warn("--parserChunkSize {} is smaller than --miniBatchSize "
+                     "{}; the chunks will be of {} reads",
+                     sopt.parserChunkSize, sopt.miniBatchSize,
+                     sopt.miniBatchSize);
+      sopt.parserChunkSize = sopt.miniBatchSize;
+    }
+    sopt.timestepFragments = (sopt.miniBatchSize > 0)
+                                 ? sopt.miniBatchSize
+                                 : uint32_t(MiniBatchSizer::minAdaptiveSize);
+
     try {
       switch (indexType) {
       case SalmonIndexType::FMD: {
@@ -2841,8 +4863,37 @@ transcript abundance from RNA-seq reads
     // Write out information about the command / run
     salmon::utils::writeCmdInfo(sopt, orderedOptions);
 
+    if (sopt.writePartial) {
+      if (sopt.biasCorrect or sopt.gcBiasCorrect or sopt.posBiasCorrect) {
+        jointLog->warn("The bias models are not written to the partial; the "
+                       "merged quantification will not be bias-corrected.");
+      }
+      salmon::utils::normalizeAlphas(sopt, experiment);
+      bool partialOK =
+          writePartial(outputDirectory / "partial", sopt, experiment);
+      if (!partialOK) {
+        jointLog->error("Couldn't write the partial to {}",
+                        (outputDirectory / "partial").string());
+      }
+      free(memOptions);
+      sopt.runStatus->stop();
+      return partialOK ? 0 : 1;
+    }
+
     GZipWriter gzw(outputDirectory, jointLog);
 
+    if (experiment.numSubsampledOut() > 0 and
+        experiment.numObservedFragments() > 0) {
+      uint64_t numKept = experiment.numObservedFragments();
+      sopt.numReadsScale =
+          static_cast<double>(numKept + experiment.numSubsampledOut()) /
+          numKept;
+      jointLog->info("Quantified a subsample of {} fragments ({} were left "
+                     "out); the NumReads are scaled by {:.4f}",
+                     numKept, experiment.numSubsampledOut(),
+                     sopt.numReadsScale);
+    }
+
     // Now that the streaming pass is complete, we have
     // our initial estimates, and our rich equivalence
     // classes.  Perform further optimization until
@@ -2853,7 +4904,12 @@ transcript abundance from RNA-seq reads
     CollapsedEMOptimizer optimizer;
     jointLog->info("Starting optimizer");
     salmon::utils::normalizeAlphas(sopt, experiment);
+    if (!sweep.empty()) {
+      sweep.saveInitialEstimates(experiment);
+    }
+    PerformanceStats::Scope emPhase(*sopt.perfStats, "offline_em");
     bool optSuccess = optimizer.optimize(experiment, sopt, 0.01, 10000);
+    emPhase.finish();
 
     if (!optSuccess) {
       jointLog->error(
@@ -2872,14 +4928,80 @@ transcript abundance from RNA-seq reads
     bfs::path estFilePath = outputDirectory / "quant.sf";
 
     // Write the main results
+    PerformanceStats::Scope abundancePhase(*sopt.perfStats, "write_abundances");
     gzw.writeAbundances(sopt, experiment);
+    abundancePhase.finish();
+
+    if (sopt.approxVariance) {
+      PerformanceStats::Scope variancePhase(*sopt.perfStats,
+                                            "approx_variance");
+      std::vector<double> variances;
+      if (!optimizer.approximateVariances(experiment, sopt, variances) or
+          !gzw.writeVariances(sopt, experiment, variances)) {
+        return 1;
+      }
+    }
+
+    // The abundances (with the counts just projected by writeAbundances),
+    // the equivalence classes and the library and fragment length
+    // statistics don't change from here on, so the rest of the output that
+    // is derived from them is written in the background, while the
+    // bootstraps / Gibbs samples are drawn.
+    AsyncOutputService outputService(jointLog, 2);
+
+    /** If the user requested gene-level abundances, then compute those now
+     *  (from the abundances just written, rather than by re-reading quant.sf)
+     **/
+    if (vm.count("geneMap")) {
+      outputService.submit("quant.genes.sf", [&]() -> bool {
+        try {
+          salmon::utils::generateGeneLevelEstimates(
+              sopt.geneMapPath, outputDirectory, experiment,
+              sopt.geneMapCacheDirectory);
+        } catch (std::invalid_argument& e) {
+          fmt::print(stderr,
+                     "Error: [{}] when trying to compute gene-level "
+                     "estimates. The gene-level file(s) may not exist",
+                     e.what());
+        }
+        return true;
+      });
+    }
 
     // If we are dumping the equivalence classes, then
     // do it here.
     if (sopt.dumpEq) {
-      gzw.writeEquivCounts(sopt, experiment);
+      outputService.submit("the equivalence classes", [&]() -> bool {
+        return gzw.writeEquivCounts(sopt, experiment);
+      });
+    }
+
+    bfs::path libCountFilePath = outputDirectory / "lib_format_counts.json";
+    outputService.submit("lib_format_counts.json",
+                         [&experiment, libCountFilePath]() -> bool {
+      experiment.summarizeLibraryTypeCounts(libCountFilePath);
+      return true;
+    });
+
+    // Test writing out the fragment length distribution
+    if (!sopt.noFragLengthDist) {
+      outputService.submit("flenDist.txt", [&]() -> bool {
+        bfs::path distFileName = sopt.paramsDirectory / "flenDist.txt";
+        std::unique_ptr<std::FILE, int (*)(std::FILE*)> distOut(
+            std::fopen(distFileName.c_str(), "w"), std::fclose);
+        if (!distOut) {
+          return false;
+        }
+        fmt::print(distOut.get(), "{}\n",
+                   experiment.fragmentLengthDistribution()->toString());
+        return true;
+      });
     }
 
+    // The samples are written, in order, by a thread of their own; each is
+    // copied, so the sampler can go on to the next one right away.
+    AsyncOutputService sampleWriter(jointLog, 1);
+
     if (sopt.numGibbsSamples > 0) {
 
       jointLog->info("Starting Gibbs Sampler");
@@ -2887,14 +5009,19 @@ transcript abundance from RNA-seq reads
       gzw.setSamplingPath(sopt);
       // The function we'll use as a callback to write samples
       std::function<bool(const std::vector<double>&)> bsWriter =
-          [&gzw](const std::vector<double>& alphas) -> bool {
-        return gzw.writeBootstrap(alphas, true);
+          [&gzw, &sampleWriter](const std::vector<double>& alphas) -> bool {
+        sampleWriter.submit("a Gibbs sample", [&gzw, alphas]() -> bool {
+          return gzw.writeBootstrap(alphas, true);
+        });
+        return sampleWriter.ok();
       };
 
+      PerformanceStats::Scope samplingPhase(*sopt.perfStats, "gibbs_sampling");
       bool sampleSuccess =
           // sampler.sampleMultipleChains(experiment, sopt, bsWriter,
           // sopt.numGibbsSamples);
           sampler.sample(experiment, sopt, bsWriter, sopt.numGibbsSamples);
+      samplingPhase.finish();
       if (!sampleSuccess) {
         jointLog->error("Encountered error during Gibbs sampling.\n"
                         "This should not happen.\n"
@@ -2906,13 +5033,19 @@ transcript abundance from RNA-seq reads
       gzw.setSamplingPath(sopt);
       // The function we'll use as a callback to write samples
       std::function<bool(const std::vector<double>&)> bsWriter =
-          [&gzw](const std::vector<double>& alphas) -> bool {
-        return gzw.writeBootstrap(alphas);
+          [&gzw, &sampleWriter](const std::vector<double>& alphas) -> bool {
+        sampleWriter.submit("a bootstrap sample", [&gzw, alphas]() -> bool {
+          return gzw.writeBootstrap(alphas);
+        });
+        return sampleWriter.ok();
       };
 
       jointLog->info("Starting Bootstrapping");
+      PerformanceStats::Scope bootstrapPhase(*sopt.perfStats, "bootstraps");
       bool bootstrapSuccess =
-          optimizer.gatherBootstraps(experiment, sopt, bsWriter, 0.01, 10000);
+          optimizer.gatherBootstraps(experiment, sopt, bsWriter,
+                                     sopt.bootstrapRelDiffTolerance, 10000);
+      bootstrapPhase.finish();
       jointLog->info("Finished Bootstrapping");
       if (!bootstrapSuccess) {
         jointLog->error("Encountered error during bootstrapping.\n"
@@ -2921,60 +5054,32 @@ transcript abundance from RNA-seq reads
         return 1;
       }
     }
-
-    bfs::path libCountFilePath = outputDirectory / "lib_format_counts.json";
-    experiment.summarizeLibraryTypeCounts(libCountFilePath);
-
-    // Test writing out the fragment length distribution
-    if (!sopt.noFragLengthDist) {
-      bfs::path distFileName = sopt.paramsDirectory / "flenDist.txt";
-      {
-        std::unique_ptr<std::FILE, int (*)(std::FILE*)> distOut(
-            std::fopen(distFileName.c_str(), "w"), std::fclose);
-        fmt::print(distOut.get(), "{}\n",
-                   experiment.fragmentLengthDistribution()->toString());
+    // The time spent waiting for the output written in the background
+    PerformanceStats::Scope outputWaitPhase(*sopt.perfStats, "output_wait");
+    if (sopt.numGibbsSamples > 0 or sopt.numBootstraps > 0) {
+      if (!sampleWriter.wait() or !gzw.finishSamples()) {
+        return 1;
       }
     }
 
-    /** If the user requested gene-level abundances, then compute those now **/
-    if (vm.count("geneMap")) {
-      try {
-        salmon::utils::generateGeneLevelEstimates(sopt.geneMapPath,
-                                                  outputDirectory);
-      } catch (std::invalid_argument& e) {
-        fmt::print(stderr,
-                   "Error: [{}] when trying to compute gene-level "
-                   "estimates. The gene-level file(s) may not exist",
-                   e.what());
-      }
-    }
-
-    if (sopt.writeUnmappedNames) {
-      auto l = sopt.unmappedLog.get();
-      // If the logger was created, then flush it and
-      // close the associated file.
-      if (l) {
-        l->flush();
-        if (sopt.unmappedFile) {
-          sopt.unmappedFile->close();
-        }
-      }
+    // Write out whatever is still buffered, and close the files
+    if (sopt.unmappedWriter) {
+      sopt.unmappedWriter->close();
     }
-
-    if (sopt.writeOrphanLinks) {
-      auto l = sopt.orphanLinkLog.get();
-      // If the logger was created, then flush it and
-      // close the associated file.
-      if (l) {
-        l->flush();
-        if (sopt.orphanLinkFile) {
-          sopt.orphanLinkFile->close();
-        }
-      }
+    if (sopt.orphanLinkWriter) {
+      sopt.orphanLinkWriter->close();
+    }
+    if (sopt.unmappedReadWriter) {
+      sopt.unmappedReadWriter->close();
+    }
+    if (sopt.unmappedPairWriter) {
+      sopt.unmappedPairWriter->close();
     }
 
     // if we wrote quasimappings, flush that buffer
-    if (sopt.qmFileName != "") {
+    if (sopt.qmWriter) {
+      sopt.qmWriter->close();
+    } else if (sopt.qmFileName != "") {
       sopt.qmLog->flush();
       // if we wrote to a buffer other than stdout, close
       // the file
@@ -2983,11 +5088,25 @@ transcript abundance from RNA-seq reads
       }
     }
 
+    // Everything else must be written before the meta-information
+    outputService.wait();
+    outputWaitPhase.finish();
+
     sopt.runStopTime = salmon::utils::getCurrentTimeAsString();
 
     // Write meta-information about the run
     gzw.writeMeta(sopt, experiment);
 
+    // The sweep changes the estimates, so it comes after all of the output
+    if (!sweep.empty() and !sweep.run(experiment, sopt, outputDirectory)) {
+      return 1;
+    }
+    sopt.runStatus->stop();
+    if (!sopt.traceFile.empty() and
+        !sopt.perfStats->writeTrace(sopt.traceFile)) {
+      jointLog->warn("Couldn't write the trace to {}", sopt.traceFile);
+    }
+
   } catch (po::error& e) {
     std::cerr << "Exception : [" << e.what() << "]. Exiting.\n";
     std::exit(1);
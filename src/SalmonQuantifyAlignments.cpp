@@ -47,6 +47,7 @@ extern "C" {
 #include "Transcript.hpp"
 
 #include "AlignmentModel.hpp"
+#include "AsyncOutputService.hpp"
 #include "BiasParams.hpp"
 #include "CollapsedEMOptimizer.hpp"
 #include "CollapsedGibbsSampler.hpp"
@@ -120,14 +121,12 @@ void processMiniBatch(AlignmentLibrary<FragT>& alnLib,
                       MiniBatchQueue<AlignmentGroup<FragT*>>& workQueue,
                       MiniBatchQueue<AlignmentGroup<FragT*>>* processedCache,
                       std::condition_variable& workAvailable,
-                      std::mutex& cvmutex, volatile bool& doneParsing,
+                      std::mutex& cvmutex, std::atomic<bool>& doneParsing,
                       std::atomic<size_t>& activeBatches,
                       SalmonOpts& salmonOpts, BiasParams& observedBiasParams,
                       std::atomic<bool>& burnedIn, bool initialRound,
                       std::atomic<size_t>& processedReads) {
 
-  // Seed with a real random value, if available
-  std::random_device rd;
   auto& log = salmonOpts.jointLog;
 
   // Whether or not we are using "banking"
@@ -135,14 +134,15 @@ void processMiniBatch(AlignmentLibrary<FragT>& alnLib,
   double incompatPrior = salmonOpts.incompatPrior;
   bool useReadCompat = incompatPrior != salmon::math::LOG_1;
 
-  // Create a random uniform distribution
-  std::default_random_engine eng(rd());
+  // Seed with a real random value, unless a seed was given
+  std::default_random_engine eng(salmon::utils::onlinePhaseSeed(salmonOpts));
   std::uniform_real_distribution<> uni(
       0.0, 1.0 + std::numeric_limits<double>::min());
 
-  // If we're auto detecting the library type
+  // If we're auto detecting the library type (see the start of each batch)
   auto* detector = alnLib.getDetector();
   bool autoDetect = (detector != nullptr) ? detector->isActive() : false;
+  std::vector<uint64_t> formatCounts;
   // If we haven't detected yet, nothing is incompatible
   if (autoDetect) {
     incompatPrior = salmon::math::LOG_1;
@@ -164,11 +164,6 @@ void processMiniBatch(AlignmentLibrary<FragT>& alnLib,
   using salmon::math::logAdd;
   using salmon::math::logSub;
 
-  // k-mers for sequence bias
-  Mer leftMer;
-  Mer rightMer;
-  Mer context;
-
   auto& refs = alnLib.transcripts();
   auto& clusterForest = alnLib.clusterForest();
   auto& fragmentQueue = alnLib.fragmentQueue();
@@ -179,6 +174,10 @@ void processMiniBatch(AlignmentLibrary<FragT>& alnLib,
 
   auto& fragLengthDist = *(alnLib.fragmentLengthDistribution());
   auto& alnMod = alnLib.alignmentModel();
+  bool useLocalErrorModel{salmonOpts.threadLocalMass and
+                          salmonOpts.useErrorModel};
+  AlignmentModel::LocalObservations alnModObservations;
+  auto& onlineConvergence = alnLib.onlineConvergence();
 
   bool useFSPD{salmonOpts.useFSPD};
   bool useFragLengthDist{!salmonOpts.noFragLengthDist};
@@ -206,6 +205,8 @@ void processMiniBatch(AlignmentLibrary<FragT>& alnLib,
             !aln->isPaired());
   };
 
+  // (the spans are only recorded with --trace)
+  auto spanStart = PerformanceStats::Clock::now();
   while (!doneParsing or !workQueue.empty()) {
     uint32_t zeroProbFrags{0};
 
@@ -222,6 +223,7 @@ void processMiniBatch(AlignmentLibrary<FragT>& alnLib,
         return workQueue.try_pop(miniBatch) or doneParsing;
       });
     }
+    salmonOpts.perfStats->span("parser_wait", spanStart);
 
     uint64_t batchReads{0};
 
@@ -230,6 +232,9 @@ void processMiniBatch(AlignmentLibrary<FragT>& alnLib,
 
       useAuxParams = (processedReads >= salmonOpts.numPreBurninFrags);
       bool considerCondProb = (useAuxParams or burnedIn);
+      // Once the online estimates are stable, the fragments are still
+      // counted into equivalence classes, but no longer update them
+      bool skipOnlineUpdates = burnedIn and onlineConvergence.converged();
       ++activeBatches;
       batchReads = 0;
       zeroProbFrags = 0;
@@ -244,6 +249,24 @@ void processMiniBatch(AlignmentLibrary<FragT>& alnLib,
       std::vector<AlignmentGroup<FragT*>*>& alignmentGroups =
           *(miniBatch->alignments);
 
+      // Tally the formats of the batch's alignments up front, so that the
+      // library type can be locked in before the batch is scored (and the
+      // scoring loop never checks the detector).
+      if (autoDetect) {
+        formatCounts.assign(LibraryFormat::maxLibTypeID() + 1, 0);
+        for (auto* alnGroup : alignmentGroups) {
+          for (auto* aln : alnGroup->alignments()) {
+            ++formatCounts[aln->libFormat().formatID()];
+          }
+        }
+        detector->addSamples(formatCounts);
+        autoDetect = detector->update(alnLib.getFormat());
+        if (!autoDetect) {
+          expectedLibraryFormat = alnLib.getFormat();
+          incompatPrior = salmonOpts.incompatPrior;
+        }
+      }
+
       using TranscriptID = size_t;
       using HitIDVector = std::vector<size_t>;
       using HitProbVector = std::vector<double>;
@@ -252,11 +275,15 @@ void processMiniBatch(AlignmentLibrary<FragT>& alnLib,
         // Iterate over each group of alignments (a group consists of all
         // alignments reported for a single read).  Distribute the read's mass
         // proportionally dependent on the current
+        // EQCLASS: reused for every group, so that, once they've grown large
+        // enough, adding a group to an existing class allocates nothing
+        std::vector<uint32_t> txpIDs;
+        std::vector<double> auxProbs;
+        TranscriptGroup eqKey;
         for (auto alnGroup : alignmentGroups) {
 
-          // EQCLASS
-          std::vector<uint32_t> txpIDs;
-          std::vector<double> auxProbs;
+          txpIDs.clear();
+          auxProbs.clear();
           double auxDenom = salmon::math::LOG_0;
 
           // The alignments must be sorted by transcript id
@@ -332,19 +359,6 @@ void processMiniBatch(AlignmentLibrary<FragT>& alnLib,
               logFragProb = LOG_1;
             }
 
-            if (autoDetect) {
-              detector->addSample(aln->libFormat());
-              if (detector->canGuess()) {
-                detector->mostLikelyType(alnLib.getFormat());
-                expectedLibraryFormat = alnLib.getFormat();
-                incompatPrior = salmonOpts.incompatPrior;
-                autoDetect = false;
-              } else if (!detector->isActive()) {
-                expectedLibraryFormat = alnLib.getFormat();
-                incompatPrior = salmonOpts.incompatPrior;
-                autoDetect = false;
-              }
-            }
             // @TODO: handle this case better
             // double fragProb = cdf(fragLengthDist, fragLength + 0.5) -
             // cdf(fragLengthDist, fragLength - 0.5);  fragProb =
@@ -482,8 +496,9 @@ void processMiniBatch(AlignmentLibrary<FragT>& alnLib,
               }
             }
 
-            TranscriptGroup tg(txpIDs);
-            eqBuilder.addGroup(std::move(tg), auxProbs);
+            eqKey.txps.assign(txpIDs.begin(), txpIDs.end());
+            eqKey.updateHash();
+            eqBuilder.addGroupInPlace(eqKey, auxProbs);
           }
 
           // Are we doing bias correction?
@@ -491,6 +506,9 @@ void processMiniBatch(AlignmentLibrary<FragT>& alnLib,
 
           // Normalize the scores
           for (auto& aln : alnGroup->alignments()) {
+            if (skipOnlineUpdates) {
+              break;
+            }
             if (aln->logProb == LOG_0) {
               continue;
             }
@@ -521,7 +539,6 @@ void processMiniBatch(AlignmentLibrary<FragT>& alnLib,
             bool success = false;
             if (needBiasSample and salmonOpts.numBiasSamples > 0) {
               const char* txpStart = transcript.Sequence();
-              const char* txpEnd = txpStart + transcript.RefLength;
               if (aln->isPaired()) {
                 ReadPair* alnp = reinterpret_cast<ReadPair*>(aln);
                 bam_seq_t* r1 = alnp->read1;
@@ -543,44 +560,23 @@ void processMiniBatch(AlignmentLibrary<FragT>& alnLib,
                       (startPos1 > 0 and startPos1 < transcript.RefLength) and
                       (startPos2 > 0 and startPos2 < transcript.RefLength)) {
 
-                    const char* readStart1 = txpStart + startPos1;
                     auto& readBias1 = (fwd1) ? readBiasFW : readBiasRC;
-
-                    const char* readStart2 = txpStart + startPos2;
                     auto& readBias2 = (fwd2) ? readBiasFW : readBiasRC;
 
-                    int32_t fwPre = readBias1.contextBefore(!fwd1);
-                    int32_t fwPost = readBias1.contextAfter(!fwd1);
-
-                    int32_t rcPre = readBias2.contextBefore(!fwd2);
-                    int32_t rcPost = readBias2.contextAfter(!fwd2);
-
-                    bool read1RC = !fwd1;
-                    bool read2RC = !fwd2;
-
-                    if ((startPos1 >= readBias1.contextBefore(read1RC) and
-                         startPos1 + readBias1.contextAfter(read1RC) <
-                             transcript.RefLength) and
-                        (startPos2 >= readBias2.contextBefore(read2RC) and
-                         startPos2 + readBias2.contextAfter(read2RC) <
-                             transcript.RefLength)) {
-
-                      int32_t fwPos = (fwd1) ? startPos1 : startPos2;
-                      int32_t rcPos = (fwd1) ? startPos2 : startPos1;
-                      if (fwPos < rcPos) {
-                        leftMer.from_chars(txpStart + startPos1 -
-                                           readBias1.contextBefore(read1RC));
-                        rightMer.from_chars(txpStart + startPos2 -
-                                            readBias2.contextBefore(read2RC));
-                        if (read1RC) {
-                          leftMer.reverse_complement();
-                        } else {
-                          rightMer.reverse_complement();
-                        }
-
-                        success = readBias1.addSequence(leftMer, 1.0);
-                        success = readBias2.addSequence(rightMer, 1.0);
-                      }
+                    // Both contexts must exist (and the mates face each
+                    // other) for either to be counted
+                    int32_t fwPos = (fwd1) ? startPos1 : startPos2;
+                    int32_t rcPos = (fwd1) ? startPos2 : startPos1;
+                    int32_t len = transcript.RefLength;
+                    uint64_t code1, code2;
+                    if (fwPos < rcPos and
+                        readBias1.encodeContext(txpStart, len, startPos1,
+                                                !fwd1, code1) and
+                        readBias2.encodeContext(txpStart, len, startPos2,
+                                                !fwd2, code2)) {
+                      readBias1.addEncoded(code1);
+                      readBias2.addEncoded(code2);
+                      success = true;
                     }
                   }
                 }
@@ -595,22 +591,10 @@ void processMiniBatch(AlignmentLibrary<FragT>& alnLib,
 
                   if (startPos1 > 0 and startPos1 < transcript.RefLength) {
 
-                    const char* txpStart = transcript.Sequence();
-                    const char* txpEnd = txpStart + transcript.RefLength;
-
-                    const char* readStart1 = txpStart + startPos1;
                     auto& readBias1 = (fwd1) ? readBiasFW : readBiasRC;
-
-                    if (startPos1 >= readBias1.contextBefore(!fwd1) and
-                        startPos1 + readBias1.contextAfter(!fwd1) <
-                            transcript.RefLength) {
-                      context.from_chars(txpStart + startPos1 -
-                                         readBias1.contextBefore(!fwd1));
-                      if (!fwd1) {
-                        context.reverse_complement();
-                      }
-                      success = readBias1.addSequence(context, 1.0);
-                    }
+                    success = readBias1.addContext(txpStart,
+                                                   transcript.RefLength,
+                                                   startPos1, !fwd1);
                   }
                 }
               } // end unpaired read
@@ -670,7 +654,7 @@ void processMiniBatch(AlignmentLibrary<FragT>& alnLib,
                   // For single-end reads, simply assume that every fragment
                   // has a length equal to the conditional mean (given the
                   // current transcript's length).
-                  auto cmeans = alnLib.condMeans();
+                  const auto& cmeans = alnLib.condMeans();
                   auto cmean = static_cast<int32_t>(
                       (transcript.RefLength >= cmeans.size())
                           ? cmeans.back()
@@ -725,7 +709,10 @@ void processMiniBatch(AlignmentLibrary<FragT>& alnLib,
                           */
 
               // Update the error model
-              if (salmonOpts.useErrorModel) {
+              if (useLocalErrorModel) {
+                alnMod.update(*aln, transcript, LOG_1, logForgettingMass,
+                              alnModObservations);
+              } else if (salmonOpts.useErrorModel) {
                 alnMod.update(*aln, transcript, LOG_1, logForgettingMass);
               }
               // Update the fragment length distribution
@@ -812,6 +799,11 @@ void processMiniBatch(AlignmentLibrary<FragT>& alnLib,
         */
       } // end timer
 
+      // Add this mini-batch's error model observations to the shared model
+      if (useLocalErrorModel) {
+        alnMod.addObservations(alnModObservations);
+      }
+
       // If we're not keeping around a cache, then
       // reclaim the memory for these fragments and alignments
       // and delete the mini batch.
@@ -837,6 +829,17 @@ void processMiniBatch(AlignmentLibrary<FragT>& alnLib,
         // thread will set burnedIn to true
         alnLib.updateTranscriptLengthsAtomic(burnedIn);
         fragLengthDist.cacheCMF();
+        if (burnedIn) {
+          salmonOpts.perfStats->endPhase("burn_in");
+        }
+      }
+      if (burnedIn and !skipOnlineUpdates and
+          onlineConvergence.update(refs, fragLengthDist, processedReads)) {
+        salmonOpts.jointLog->info(
+            "The online estimates were stable after {} fragments; the "
+            "remaining fragments will only be counted into equivalence "
+            "classes",
+            onlineConvergence.convergedAtFragment());
       }
 
       if (zeroProbFrags > 0) {
@@ -844,6 +847,7 @@ void processMiniBatch(AlignmentLibrary<FragT>& alnLib,
             std::max(maxZeroFrac,
                      static_cast<double>(100.0 * zeroProbFrags) / batchReads);
       }
+      salmonOpts.perfStats->span("processMiniBatch", spanStart);
     }
 
     miniBatch = nullptr;
@@ -873,6 +877,7 @@ bool quantifyLibrary(AlignmentLibrary<FragT>& alnLib,
   size_t numTranscripts = refs.size();
   size_t numObservedFragments{0};
 
+  auto& jointLog = salmonOpts.jointLog;
   auto& fileLog = salmonOpts.fileLog;
   bool useMassBanking = salmonOpts.useMassBanking;
 
@@ -895,6 +900,8 @@ bool quantifyLibrary(AlignmentLibrary<FragT>& alnLib,
   bool doReset{true};
   bool gcBiasCorrect{salmonOpts.gcBiasCorrect};
   size_t maxCacheSize{salmonOpts.mappingCacheMemoryLimit};
+  auto& memBudget = salmon::memory::budget();
+  bool skippedCache{false};
 
   NullFragmentFilter<FragT>* nff = nullptr;
   bool terminate{false};
@@ -902,6 +909,7 @@ bool quantifyLibrary(AlignmentLibrary<FragT>& alnLib,
   // Give ourselves some space
   fmt::print(stderr, "\n\n\n\n");
 
+  std::vector<BiasParams> observedBiasParams;
   while (numObservedFragments < numRequiredFragments and !terminate) {
     if (!initialRound) {
 
@@ -915,9 +923,21 @@ bool quantifyLibrary(AlignmentLibrary<FragT>& alnLib,
         doReset = false;
         fmt::print(stderr, "\n\n");
       } else if (numToCache <= maxCacheSize) {
-        processedCachePtr = &processedCache;
-        doReset = true;
-        fmt::print(stderr, "\n");
+        // Within a memory budget, the fragments are only cached if they fit
+        // in it; otherwise, they're read from the file again in each round
+        uint64_t cacheBytes = numToCache * BAMQueue<FragT>::bytesPerFragment();
+        if (memBudget.fits(cacheBytes)) {
+          processedCachePtr = &processedCache;
+          memBudget.account("alignment_cache").set(cacheBytes);
+          doReset = true;
+          fmt::print(stderr, "\n");
+        } else if (!skippedCache) {
+          jointLog->info("Not caching the {} mapped fragments (~{:.2f} GB), "
+                         "which wouldn't fit in the memory budget; they'll be "
+                         "read from the file again in each round",
+                         numToCache, cacheBytes / 1073741824.0);
+          skippedCache = true;
+        }
       }
 
       if (doReset and
@@ -941,7 +961,7 @@ bool quantifyLibrary(AlignmentLibrary<FragT>& alnLib,
       }
     }
 
-    volatile bool doneParsing{false};
+    std::atomic<bool> doneParsing{false};
     std::condition_variable workAvailable;
     std::mutex cvmutex;
     std::vector<std::thread> workers;
@@ -956,11 +976,22 @@ bool quantifyLibrary(AlignmentLibrary<FragT>& alnLib,
     }
 
     /** sequence-specific and GC-fragment bias vectors --- each thread gets it's
-     * own **/
-    std::vector<BiasParams> observedBiasParams(
-        currentQuantThreads, BiasParams(salmonOpts.numConditionalGCBins,
-                                        salmonOpts.numFragGCBins, false));
+     * own; they're reset, rather than reallocated, for each round **/
+    for (auto& bp : observedBiasParams) {
+      bp.reset();
+    }
+    if (observedBiasParams.size() != currentQuantThreads) {
+      observedBiasParams.resize(
+          currentQuantThreads, BiasParams(salmonOpts.numConditionalGCBins,
+                                          salmonOpts.numFragGCBins, false));
+    }
 
+    if (!burnedIn) {
+      salmonOpts.perfStats->beginPhase("burn_in");
+    }
+    salmonOpts.runStatus->trackFragments(
+        [&alnLib]() -> uint64_t { return alnLib.numObservedFragments(); },
+        [&alnLib]() -> uint64_t { return alnLib.numMappedFragments(); });
     for (uint32_t i = 0; i < currentQuantThreads; ++i) {
       workers.emplace_back(
           processMiniBatch<FragT>, std::ref(alnLib), std::ref(fmCalc),
@@ -1015,11 +1046,12 @@ bool quantifyLibrary(AlignmentLibrary<FragT>& alnLib,
       }
       fmt::print(stderr, "\n");
 
-      // Free the alignments and the vector holding them
+      // Return the alignment groups to the pool (they belong to the
+      // BAMQueue) and free the vector holding them
       if (processedCachePtr == nullptr) {
         for (auto& alnGroup : *alignments) {
           alnGroup->alignments().clear();
-          delete alnGroup;
+          bq.getAlignmentGroupQueue().enqueue(alnGroup);
           alnGroup = nullptr;
         }
         delete alignments;
@@ -1028,31 +1060,26 @@ bool quantifyLibrary(AlignmentLibrary<FragT>& alnLib,
       fmt::print(stderr, "\n");
     }
 
-    doneParsing = true;
-
     /**
-     * This could be a problem for small sets of alignments --- make sure the
-     * work queue is empty!!
-     * --- Thanks for finding a dataset that exposes this bug, Richard
-     * (Smith-Unna)!
+     * The workers drain the work queue before they exit (they only stop once
+     * parsing is done *and* the queue is empty), so, rather than spinning
+     * until it's empty, just wake them all.  doneParsing is set under the
+     * mutex so that no worker can miss the wake-up.
      */
-    size_t t = 0;
-    while (!workQueuePtr->empty()) {
+    {
       std::unique_lock<std::mutex> l(cvmutex);
-      workAvailable.notify_one();
+      doneParsing = true;
     }
+    workAvailable.notify_all();
 
     size_t tnum{0};
     for (auto& t : workers) {
       fmt::print(stderr, "\r\rkilling thread {} . . . ", tnum++);
-      {
-        std::unique_lock<std::mutex> l(cvmutex);
-        workAvailable.notify_all();
-      }
       t.join();
       fmt::print(stderr, "done");
     }
     fmt::print(stderr, "\n\n");
+    salmonOpts.runStatus->untrackFragments();
 
     numObservedFragments += alnLib.numMappedFragments();
 
@@ -1077,7 +1104,9 @@ bool quantifyLibrary(AlignmentLibrary<FragT>& alnLib,
     double globalMass{salmon::math::LOG_0};
     double globalFwdMass{salmon::math::LOG_0};
     auto& globalGCMass = alnLib.observedGC();
-    for (auto& gcp : observedBiasParams) {
+    {
+      // the per-thread parameters, combined
+      auto& gcp = reduceBiasParams(observedBiasParams);
       auto& gcm = gcp.observedGCMass;
       globalGCMass.combineCounts(gcm);
 
@@ -1129,7 +1158,10 @@ bool quantifyLibrary(AlignmentLibrary<FragT>& alnLib,
       haveCache = true;
     }
     // EQCLASS
+    auto eqFinishStart = PerformanceStats::Clock::now();
     bool done = alnLib.equivalenceClassBuilder().finish();
+    salmonOpts.perfStats->span("equivalence_class_finish", eqFinishStart,
+                               "phase");
     // skip the extra online rounds
     terminate = true;
     // END EQCLASS
@@ -1175,6 +1207,7 @@ bool quantifyLibrary(AlignmentLibrary<FragT>& alnLib,
         delete mbi;
       }
     }
+    memBudget.account("alignment_cache").set(0);
   }
 
   return burnedIn.load();
@@ -1187,6 +1220,9 @@ bool processSample(AlignmentLibrary<ReadT>& alnLib, size_t requiredObservations,
   auto& jointLog = sopt.jointLog;
   // EQCLASS
   alnLib.equivalenceClassBuilder().start();
+  alnLib.equivalenceClassBuilder().spillTo(
+      (sopt.outputDirectory / "eq_classes.spill").string(),
+      sopt.maxInMemoryEqClasses);
 
   bool burnedIn = false;
   try {
@@ -1209,7 +1245,9 @@ bool processSample(AlignmentLibrary<ReadT>& alnLib, size_t requiredObservations,
   CollapsedEMOptimizer optimizer;
   jointLog->info("starting optimizer");
   salmon::utils::normalizeAlphas(sopt, alnLib);
+  PerformanceStats::Scope emPhase(*sopt.perfStats, "offline_em");
   bool optSuccess = optimizer.optimize(alnLib, sopt, 0.01, 10000);
+  emPhase.finish();
   // If the optimizer didn't work, then bail out here.
   if (!optSuccess) {
     return false;
@@ -1220,14 +1258,57 @@ bool processSample(AlignmentLibrary<ReadT>& alnLib, size_t requiredObservations,
   fmt::print(stderr, "\n\nwriting output \n");
   GZipWriter gzw(outputDirectory, jointLog);
   // Write the main results
+  PerformanceStats::Scope abundancePhase(*sopt.perfStats, "write_abundances");
   gzw.writeAbundances(sopt, alnLib);
+  abundancePhase.finish();
+
+  if (sopt.approxVariance) {
+    PerformanceStats::Scope variancePhase(*sopt.perfStats, "approx_variance");
+    std::vector<double> variances;
+    if (!optimizer.approximateVariances(alnLib, sopt, variances) or
+        !gzw.writeVariances(sopt, alnLib, variances)) {
+      return false;
+    }
+  }
+
+  // The abundances (with the counts just projected by writeAbundances) and
+  // the equivalence classes don't change from here on (the sampled output
+  // below only changes the masses), so the rest of the output that is
+  // derived from them is written in the background, while the bootstraps /
+  // Gibbs samples are drawn.
+  AsyncOutputService outputService(jointLog, 2);
+
+  /** If the user requested gene-level abundances, then compute those now
+   *  (from the abundances just written, rather than by re-reading quant.sf)
+   **/
+  if (!sopt.geneMapPath.empty()) {
+    outputService.submit("quant.genes.sf", [&]() -> bool {
+      try {
+        salmon::utils::generateGeneLevelEstimates(sopt.geneMapPath,
+                                                  outputDirectory, alnLib,
+                                                  sopt.geneMapCacheDirectory);
+      } catch (std::exception& e) {
+        fmt::print(stderr,
+                   "Error: [{}] when trying to compute gene-level "
+                   "estimates. The gene-level file(s) may not exist",
+                   e.what());
+      }
+      return true;
+    });
+  }
 
   // If we are dumping the equivalence classes, then
   // do it here.
   if (sopt.dumpEq) {
-    gzw.writeEquivCounts(sopt, alnLib);
+    outputService.submit("the equivalence classes", [&]() -> bool {
+      return gzw.writeEquivCounts(sopt, alnLib);
+    });
   }
 
+  // The samples are written, in order, by a thread of their own; each is
+  // copied, so the sampler can go on to the next one right away.
+  AsyncOutputService sampleWriter(jointLog, 1);
+
   if (sopt.numGibbsSamples > 0) {
 
     jointLog->info("Starting Gibbs Sampler");
@@ -1235,12 +1316,17 @@ bool processSample(AlignmentLibrary<ReadT>& alnLib, size_t requiredObservations,
     gzw.setSamplingPath(sopt);
     // The function we'll use as a callback to write samples
     std::function<bool(const std::vector<double>&)> bsWriter =
-        [&gzw](const std::vector<double>& alphas) -> bool {
-      return gzw.writeBootstrap(alphas);
+        [&gzw, &sampleWriter](const std::vector<double>& alphas) -> bool {
+      sampleWriter.submit("a sample", [&gzw, alphas]() -> bool {
+        return gzw.writeBootstrap(alphas);
+      });
+      return sampleWriter.ok();
     };
 
+    PerformanceStats::Scope samplingPhase(*sopt.perfStats, "gibbs_sampling");
     bool sampleSuccess =
         sampler.sample(alnLib, sopt, bsWriter, sopt.numGibbsSamples);
+    samplingPhase.finish();
     if (!sampleSuccess) {
       jointLog->error("Encountered error during Gibb sampling .\n"
                       "This should not happen.\n"
@@ -1251,14 +1337,20 @@ bool processSample(AlignmentLibrary<ReadT>& alnLib, size_t requiredObservations,
   } else if (sopt.numBootstraps > 0) {
     // The function we'll use as a callback to write samples
     std::function<bool(const std::vector<double>&)> bsWriter =
-        [&gzw](const std::vector<double>& alphas) -> bool {
-      return gzw.writeBootstrap(alphas);
+        [&gzw, &sampleWriter](const std::vector<double>& alphas) -> bool {
+      sampleWriter.submit("a sample", [&gzw, alphas]() -> bool {
+        return gzw.writeBootstrap(alphas);
+      });
+      return sampleWriter.ok();
     };
 
     jointLog->info("Staring Bootstrapping");
     gzw.setSamplingPath(sopt);
+    PerformanceStats::Scope bootstrapPhase(*sopt.perfStats, "bootstraps");
     bool bootstrapSuccess =
-        optimizer.gatherBootstraps(alnLib, sopt, bsWriter, 0.01, 10000);
+        optimizer.gatherBootstraps(alnLib, sopt, bsWriter,
+                                   sopt.bootstrapRelDiffTolerance, 10000);
+    bootstrapPhase.finish();
     jointLog->info("Finished Bootstrapping");
     if (!bootstrapSuccess) {
       jointLog->error("Encountered error during bootstrapping.\n"
@@ -1267,6 +1359,14 @@ bool processSample(AlignmentLibrary<ReadT>& alnLib, size_t requiredObservations,
       return false;
     }
   }
+  // The time spent waiting for the output written in the background
+  PerformanceStats::Scope outputWaitPhase(*sopt.perfStats, "output_wait");
+  if (sopt.numGibbsSamples > 0 or sopt.numBootstraps > 0) {
+    if (!sampleWriter.wait() or !gzw.finishSamples()) {
+      return false;
+    }
+  }
+  outputWaitPhase.finish();
 
   // bfs::path libCountFilePath = outputDirectory / "lib_format_counts.json";
   // alnLib.summarizeLibraryTypeCounts(libCountFilePath);
@@ -1291,9 +1391,17 @@ bool processSample(AlignmentLibrary<ReadT>& alnLib, size_t requiredObservations,
     }
   }
 
+  // Everything else must be written before the meta-information
+  outputService.wait();
+
   sopt.runStopTime = salmon::utils::getCurrentTimeAsString();
   // Write meta-information about the run
   gzw.writeMeta(sopt, alnLib);
+  sopt.runStatus->stop();
+  if (!sopt.traceFile.empty() and
+      !sopt.perfStats->writeTrace(sopt.traceFile)) {
+    jointLog->warn("Couldn't write the trace to {}", sopt.traceFile);
+  }
 
   return true;
 }
@@ -1317,7 +1425,7 @@ int salmonAlignmentQuantify(int argc, char* argv[]) {
       "libType,l", po::value<std::string>()->required(),
       "Format string describing the library type.")(
       "alignments,a", po::value<vector<string>>()->multitoken()->required(),
-      "input alignment (BAM) file(s).")(
+      "input alignment (SAM/BAM/CRAM) file(s).")(
       "targets,t", po::value<std::string>()->required(),
       "FASTA format file containing target transcripts.")(
       "threads,p", po::value<uint32_t>(&numThreads)->default_value(6),
@@ -1374,7 +1482,12 @@ int salmonAlignmentQuantify(int argc, char* argv[]) {
       "contain the "
       "transcript identifier and the \"gene_id\" is assumed to contain the "
       "corresponding "
-      "gene identifier.");
+      "gene identifier.")(
+      "geneMapCache", po::value<std::string>(),
+      "The directory in which a transcript to gene mapping that is parsed "
+      "from a GTF / GFF file is cached (keyed by the checksum of the file), so "
+      "that later runs with the same file needn't parse it again.  If this "
+      "isn't given, the mapping isn't cached.");
 
   // no sequence bias for now
   sopt.useMassBanking = false;
@@ -1402,6 +1515,33 @@ int salmonAlignmentQuantify(int argc, char* argv[]) {
       "the precision "
       "of bias correction, but harm robustness.  The default correction "
       "applies a threshold.")(
+      "writeQuantBin",
+      po::bool_switch(&(sopt.writeQuantBin))->default_value(false),
+      "Also write the abundances of quant.sf, at full precision, to the "
+      "binary (columnar) file quant.bin; see scripts/QuantBin.py for a "
+      "reader.")(
+      "sparseQuant",
+      po::bool_switch(&(sopt.sparseQuant))->default_value(false),
+      "Only list the transcripts with reads in quant.sf (e.g. against "
+      "a huge metagenomic reference, where nearly none have any); "
+      "quant.bin, if written, still has every transcript.")(
+      "trace", po::value<std::string>(&(sopt.traceFile)),
+      "Write a Chrome trace (for chrome://tracing or Perfetto) of the run's "
+      "phases, and of what each thread spends its time on (waiting on the "
+      "alignment parser, processing mini-batches), to this file.")(
+      "hwCounters", po::bool_switch(&(sopt.hwCounters))->default_value(false),
+      "Count the CPU's events (cycles, instructions, last-level cache and "
+      "dTLB misses, branch mispredictions) of each phase of the run with "
+      "perf_event_open, and add them to the performance section of "
+      "meta_info.json (Linux only, and where "
+      "/proc/sys/kernel/perf_event_paranoid allows it).")(
+      "statusFile", po::value<std::string>(&(sopt.statusFile)),
+      "Periodically rewrite the live status of the run (fragments "
+      "processed and mapped, throughput, current phase, EM progress) to "
+      "this file, as JSON, for monitoring.")(
+      "statusInterval",
+      po::value<double>(&(sopt.statusInterval))->default_value(10.0),
+      "The number of seconds between rewrites of the --statusFile.")(
       "dumpEq", po::bool_switch(&(sopt.dumpEq))->default_value(false),
       "Dump the equivalence class counts "
       "that were computed during quasi-mapping")(
@@ -1410,6 +1550,12 @@ int salmonAlignmentQuantify(int argc, char* argv[]) {
       "Includes \"rich\" equivlance class weights in the output when "
       "equivalence "
       "class information is being dumped to file.")(
+      "dumpEqFormat",
+      po::value<std::string>(&(sopt.eqClassFormat))->default_value("text"),
+      "How the equivalence classes are dumped: \"text\" "
+      "(aux/eq_classes.txt), or \"binary\" (aux/eq_classes.bin, a "
+      "compressed file with varint-encoded transcript ids and float "
+      "weights; see scripts/EquivClasses.py for a reader).")(
       "fldMax", po::value<size_t>(&(sopt.fragLenDistMax))->default_value(1000),
       "The maximum fragment length to consider when building the empirical "
       "distribution")(
@@ -1439,11 +1585,26 @@ int salmonAlignmentQuantify(int argc, char* argv[]) {
       "transcript GTF.")(
       "reduceGCMemory",
       po::bool_switch(&(sopt.reduceGCMemory))->default_value(false),
-      "If this option is selected, a more memory efficient (but slightly "
-      "slower) representation is "
-      "used to compute fragment GC content. Enabling this will reduce memory "
-      "usage, but can also reduce "
-      "speed.  However, the results themselves will remain the same.")(
+      "[Deprecated]: Fragment GC content is now always computed from a "
+      "compact (~1.3 bits / base) representation, so this option has "
+      "no effect.")(
+      "onlineStopTolerance",
+      po::value<double>(&(sopt.onlineStopTolerance))->default_value(0.0),
+      "[Experimental]: After burn-in, periodically compare the online "
+      "abundance estimates of the most abundant transcripts (and the mean "
+      "fragment length); once they change by less than this between two "
+      "consecutive checks, the likelihoods of the remaining alignments are "
+      "only used to count them into equivalence classes, and no longer "
+      "update the online estimates, the error model or the fragment length "
+      "and start position distributions.  A value of 0 (the default) never "
+      "stops the online updates.")(
+      "threadLocalMass",
+      po::bool_switch(&(sopt.threadLocalMass))->default_value(false),
+      "[Experimental]: During the online phase, accumulate the observations "
+      "of the error model (--useErrorModel) in a per-thread buffer, and add "
+      "them to the shared model once per mini-batch.  This reduces "
+      "contention between threads on the most common (e.g. match) "
+      "transitions at the cost of one extra copy of the model per thread.")(
       "biasSpeedSamp",
       po::value<std::uint32_t>(&(sopt.pdfSampFactor))->default_value(1),
       "The value at which the fragment length PMF is down-sampled "
@@ -1451,6 +1612,13 @@ int salmonAlignmentQuantify(int argc, char* argv[]) {
       "speed up effective "
       "length correction, but may decrease the fidelity of bias modeling "
       "results.")(
+      "cramReference",
+      po::value<std::string>(&(sopt.cramReference))->default_value(""),
+      "The FASTA file of the reference that CRAM alignment files (those "
+      "named *.cram) were compressed against; all of them are decoded "
+      "against this one (memory mapped) file, rather than against the "
+      "sequences that io_lib would otherwise look up (or download) for each "
+      "of them.  By default, the targets (-t) are used.")(
       "mappingCacheMemoryLimit",
       po::value<uint32_t>(&(sopt.mappingCacheMemoryLimit))
           ->default_value(2000000),
@@ -1461,6 +1629,27 @@ int salmonAlignmentQuantify(int argc, char* argv[]) {
       "large enough to accommodate all of the mapped "
       "read can substantially speed up inference on \"small\" files that "
       "contain only a few million reads.")(
+      "memoryBudget",
+      po::value<double>(&(sopt.memoryBudget))->default_value(0.0),
+      "The memory (in GB) that the run's large structures (the alignment "
+      "pools and cache, the equivalence classes, the bootstrap buffers) "
+      "should fit in.  The alignment pools are made smaller, and the "
+      "alignments are read from the file again in each round, rather than "
+      "cached, if they wouldn't fit; the equivalence classes are spilled "
+      "to disk (see --maxInMemoryEqClasses) beyond a quarter of the budget.  "
+      "The estimates don't cover every "
+      "allocation, so leave some headroom below the hard limit of your "
+      "scheduler.  0 sets no budget.")(
+      "maxInMemoryEqClasses",
+      po::value<size_t>(&(sopt.maxInMemoryEqClasses))->default_value(0),
+      "Keep at most this many equivalence classes in memory while "
+      "mapping; whenever there are more, the least frequent half of them "
+      "is written, sorted, to <output>/eq_classes.spill, and the runs "
+      "written are merged once mapping is done.  This keeps the memory "
+      "of the mapping phase flat, and the class table from ever growing "
+      "(and rehashing), for samples with tens of millions of distinct "
+      "classes.  With 0, classes are only spilled under a --memoryBudget "
+      "(beyond those that fit in a quarter of it).")(
       "maxReadOcc,w",
       po::value<uint32_t>(&(sopt.maxReadOccs))->default_value(200),
       "Reads \"mapping\" to more than this many places won't be considered.")(
@@ -1488,6 +1677,64 @@ int salmonAlignmentQuantify(int argc, char* argv[]) {
       "useVBOpt,v", po::bool_switch(&(sopt.useVBOpt))->default_value(false),
       "Use the Variational Bayesian EM rather than the "
       "traditional EM algorithm for optimization in the batch passes.")(
+      "useSQUAREM",
+      po::bool_switch(&(sopt.useSQUAREM))->default_value(false),
+      "Accelerate the EM (or VBEM) used for the point estimate and for "
+      "bootstrapping with SQUAREM extrapolation.  Each extrapolated step is "
+      "only accepted if it does not decrease the likelihood; otherwise, the "
+      "plain EM step is used.")(
+      "atomicEMUpdates",
+      po::bool_switch(&(sopt.atomicEMUpdates))->default_value(false),
+      "[Experimental]: In the offline phase, accumulate the parallel (VB)EM "
+      "updates using atomic compare-and-swap operations, rather than "
+      "partitioning the equivalence classes by connected component so "
+      "that each thread updates a disjoint set of transcripts.")(
+      "componentConvergence",
+      po::bool_switch(&(sopt.componentConvergence))->default_value(false),
+      "[Experimental]: In the offline phase, test the convergence of each "
+      "connected component of the transcripts separately, and stop updating "
+      "a component once it has converged, rather than updating every "
+      "component until all of them have.  This is faster, but the "
+      "estimates of slowly-converging components can differ from those of "
+      "the global EM.  This has no effect if --atomicEMUpdates is passed.")(
+      "emObjectiveInterval",
+      po::value<uint32_t>(&(sopt.emObjectiveInterval))->default_value(0),
+      "[Experimental]: Compute (and log) the log-likelihood of the "
+      "estimates every this many iterations of the offline (VB)EM, and "
+      "stop, once at least the minimum number of iterations has been "
+      "run, if it has changed by less than --emObjectiveTolerance "
+      "(relative) since the last time, even if some transcripts' "
+      "estimates are still changing by more than the tolerance.  A value "
+      "of 0 (the default) disables this.")(
+      "emObjectiveTolerance",
+      po::value<double>(&(sopt.emObjectiveTolerance))
+          ->default_value(1e-8),
+      "The relative change of the log-likelihood at which the offline "
+      "(VB)EM stops (see --emObjectiveInterval).")(
+      "geneLevelEM",
+      po::bool_switch(&(sopt.geneLevelEM))->default_value(false),
+      "[Experimental]: With --geneMap, resolve the abundances of the genes "
+      "first, on equivalence classes whose labels are genes: the classes "
+      "whose transcripts all belong to one gene collapse into one class per "
+      "gene, which makes the table the offline phase iterates over much "
+      "smaller.  Within a gene, the transcripts are weighted by their "
+      "online estimates.  Unless --refineTranscripts is passed (or the "
+      "biases are corrected for), the transcript-level estimates in "
+      "quant.sf are just those of their gene, split by the online "
+      "estimates; only quant.genes.sf should be relied on.")(
+      "refineTranscripts",
+      po::bool_switch(&(sopt.refineTranscripts))->default_value(false),
+      "With --geneLevelEM, go on to resolve the transcripts, starting the "
+      "transcript-level offline (VB)EM from the gene-level estimates.")(
+      "emSinglePrecision",
+      po::bool_switch(&(sopt.emSinglePrecision))->default_value(false),
+      "[Experimental]: Keep the equivalence class weights that each "
+      "offline (VB)EM iteration reads in single precision, halving the "
+      "memory traffic of the iterations over large equivalence class "
+      "tables.  The abundances, and all sums, stay in double precision; "
+      "the estimates differ from the default ones by about the float "
+      "rounding error of the weights.  This has no effect if "
+      "--atomicEMUpdates is passed.")(
       "rangeFactorizationBins",
       po::value<uint32_t>(&(sopt.rangeFactorizationBins))->default_value(0),
       "Factorizes the likelihood used in quantification by adopting a new "
@@ -1577,6 +1824,81 @@ int salmonAlignmentQuantify(int argc, char* argv[]) {
           po::value<uint32_t>(&(sopt.numBootstraps))->default_value(0),
           "Number of bootstrap samples to generate. Note: "
           "This is mutually exclusive with Gibbs sampling.")(
+          "bootstrapTolerance",
+          po::value<double>(&(sopt.bootstrapRelDiffTolerance))->default_value(0.01),
+          "The maximum relative change of any (expressed) transcript's estimate "
+          "between (VB)EM iterations at which a bootstrap sample is considered "
+          "converged.  Larger values make bootstrapping faster, at some cost in "
+          "precision.")(
+          "bootstrapWarmStart",
+          po::bool_switch(&(sopt.bootstrapWarmStart))->default_value(false),
+          "Start the (VB)EM of each bootstrap sample from the point estimates, "
+          "rather than from uniform abundances.  The samples converge in fewer "
+          "iterations, but each stops (at --bootstrapTolerance) nearer the "
+          "point estimates, which can understate their variance; use it with "
+          "a smaller --bootstrapTolerance.")(
+          "approxVariance",
+          po::bool_switch(&(sopt.approxVariance))->default_value(false),
+          "Also write quant_var.sf: the columns of quant.sf, followed by the "
+          "standard deviations of the TPM and NumReads, and a 95% interval "
+          "of the NumReads, approximated from the curvature of the "
+          "likelihood at the estimates (the delta method) in seconds, rather "
+          "than from bootstrap samples.")(
+          "bootstrapBatchSize",
+          po::value<uint32_t>(&(sopt.bootstrapBatchSize))->default_value(0),
+          "Have each bootstrap thread solve this many samples at once, with "
+          "their abundances interleaved, so that every (VB)EM iteration reads "
+          "the equivalence classes once for the whole batch rather than once "
+          "per sample.  A batch runs until its slowest sample has converged. "
+          "Ignored with --useSQUAREM.  The default (0) solves batches of 4 (or "
+          "2) samples when there are enough samples to give every thread a "
+          "batch, and one sample at a time otherwise.")(
+          "numGibbsChains",
+          po::value<uint32_t>(&(sopt.numGibbsChains))->default_value(0),
+          "Run this many independent Gibbs chains side by side, each with "
+          "its own share of the threads, and write their samples as they are "
+          "drawn.  The default (0) runs the chains one after another, using "
+          "all of the threads for each.")(
+          "sampleFormat",
+          po::value<std::string>(&(sopt.sampleFormat))->default_value("gzip"),
+          "The format of the bootstrap / Gibbs samples.  \"gzip\" writes "
+          "bootstraps.gz, one sample after another; \"columnar\" writes "
+          "bootstraps.col, which stores the samples by transcript in "
+          "separately compressed blocks, so that the samples of a few "
+          "transcripts can be read without decompressing the whole file "
+          "(see scripts/ColumnarSamples.py).")(
+          "samplePrecision",
+          po::value<std::string>(&(sopt.samplePrecision))
+              ->default_value("double"),
+          "How the values of the bootstrap / Gibbs samples are stored: "
+          "\"double\" (64-bit floating point), \"float\" (32-bit floating "
+          "point) or \"fixed\" (the counts multiplied by --sampleFixedScale "
+          "and rounded to integers).  With the gzip format, the reduced "
+          "precisions also store only the non-zero values of each sample, "
+          "unless --denseSamples is given.")(
+          "sampleFixedScale",
+          po::value<uint32_t>(&(sopt.sampleFixedScale))->default_value(100),
+          "With --samplePrecision fixed, the counts are stored with a "
+          "resolution of 1 / this value.")(
+          "denseSamples",
+          po::bool_switch(&(sopt.denseSamples))->default_value(false),
+          "Store every value of each (reduced-precision) sample in the gzip "
+          "format, rather than only the non-zero ones.")(
+          "gibbsActiveSet",
+          po::bool_switch(&(sopt.gibbsActiveSet))->default_value(false),
+          "In the thinning rounds between two Gibbs samples, resample only "
+          "the transcripts that had a non-zero count in the previous sample "
+          "(and the equivalence classes containing them).  Each sample is "
+          "still drawn after a round over all of the transcripts.")(
+          "seed",
+          po::value<uint64_t>(&(sopt.samplerSeed))->default_value(0),
+          "The seed for the random number generators used to draw the "
+          "bootstrap or Gibbs samples.  Runs with the same seed and input "
+          "produce the same samples, regardless of the number of threads.  "
+          "The generators of the online phase (which sample the fragments "
+          "used to learn the fragment length distribution) are seeded from "
+          "it as well; with a single thread, the whole run is reproducible.  "
+          "The default (0) draws a seed at random.")(
           "thinningFactor",
           po::value<uint32_t>(&(sopt.thinningFactor))->default_value(16),
           "Number of steps to discard for every sample "
@@ -1720,6 +2042,28 @@ transcript abundance from RNA-seq reads
       }
     }
 
+    bool haveCRAM{false};
+    for (auto& alignmentFile : alignmentFiles) {
+      haveCRAM = haveCRAM or
+                 (salmon::utils::alignmentReadMode(alignmentFile) == "rc");
+    }
+    if (sopt.cramReference.empty()) {
+      sopt.cramReference = vm["targets"].as<std::string>();
+    }
+
+    // Streamed input (e.g. from a pipe) is quantified in one pass, but
+    // can't be read a second time to sample from it.
+    if (sopt.sampleOutput) {
+      for (auto& alignmentFile : alignmentFiles) {
+        if (!bfs::is_regular_file(alignmentFile)) {
+          jointLog->warn("The alignment file {} is not a regular file, so "
+                         "it can only be read once; no sampled output "
+                         "(--sampleOut) will be written.",
+                         alignmentFile.string());
+        }
+      }
+    }
+
     // Just so we have the variable around
     LibraryFormat libFmt(ReadType::PAIRED_END, ReadOrientation::TOWARD,
                          ReadStrandedness::U);
@@ -1732,7 +2076,8 @@ transcript abundance from RNA-seq reads
          libFmtStr == "A"); //(autoTypes.find(libFmtStr) != autoTypes.end());
     if (autoDetectFmt) {
 
-      bool isPairedEnd = salmon::utils::peekBAMIsPaired(alignmentFiles.front());
+      bool isPairedEnd = salmon::utils::peekBAMIsPaired(
+          alignmentFiles.front(), sopt.cramReference);
       if (isPairedEnd) {
         libFmt = LibraryFormat(ReadType::PAIRED_END, ReadOrientation::TOWARD,
                                ReadStrandedness::U);
@@ -1761,9 +2106,13 @@ transcript abundance from RNA-seq reads
     // BAM/SAM parsing, as this is the current bottleneck.  For the time
     // being, however, the number of quantification threads is the
     // total number of threads - 1.
-    uint32_t numParseThreads =
-        std::min(uint32_t(6),
-                 std::max(uint32_t(2), uint32_t(std::ceil(numThreads / 2.0))));
+    //
+    // Decoding CRAM takes far more work than inflating BAM, so it isn't
+    // capped: half of the threads decode, and the rest quantify.
+    uint32_t maxParseThreads = haveCRAM ? numThreads : uint32_t(6);
+    uint32_t numParseThreads = std::min(
+        maxParseThreads,
+        std::max(uint32_t(2), uint32_t(std::ceil(numThreads / 2.0))));
     numThreads = std::max(numThreads, numParseThreads);
     uint32_t numQuantThreads =
         std::max(uint32_t(2), uint32_t(numThreads - numParseThreads));
@@ -1823,21 +2172,6 @@ transcript abundance from RNA-seq reads
       return 1;
     }
 
-    bfs::path estFilePath = outputDirectory / "quant.sf";
-
-    /** If the user requested gene-level abundances, then compute those now **/
-    if (vm.count("geneMap")) {
-      try {
-        salmon::utils::generateGeneLevelEstimates(sopt.geneMapPath,
-                                                  outputDirectory);
-      } catch (std::exception& e) {
-        fmt::print(stderr,
-                   "Error: [{}] when trying to compute gene-level "
-                   "estimates. The gene-level file(s) may not exist",
-                   e.what());
-      }
-    }
-
   } catch (po::error& e) {
     std::cerr << "exception : [" << e.what() << "]. Exiting.\n";
     std::exit(1);
@@ -0,0 +1,691 @@
+/**
+>HEADER
+    Copyright (c) 2013 -- 2017 Rob Patro rob.patro@cs.stonybrook.edu
+
+    This file is part of Salmon.
+
+    Salmon is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Salmon is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Salmon.  If not, see <http://www.gnu.org/licenses/>.
+<HEADER
+**/
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <boost/program_options/parsers.hpp>
+
+// logger includes
+#include "spdlog/spdlog.h"
+
+#include "FastxReadTee.hpp"
+#include "SalmonIndex.hpp"
+#include "SalmonIndexVersionInfo.hpp"
+#include "SalmonOpts.hpp"
+
+int salmonQuantify(int argc, char* argv[],
+                   std::shared_ptr<SalmonIndex> salmonIndex);
+
+namespace {
+struct ServeJob {
+  size_t id;
+  std::string args;
+  std::chrono::steady_clock::time_point start;
+};
+
+/**
+ * Run one job --- the arguments of a salmon quant invocation, without the
+ * index --- in a child process, which shares the loaded index with the
+ * server (copy-on-write).  The child exits when it's done, so that no job
+ * can leave state behind for the next (nor take the server down with it).
+ * With no indexDir, the job's own arguments name its index, which the child
+ * loads itself; inChild (if given) is called in the child before the job is
+ * run.
+ */
+pid_t startJob(const std::string& argZero, const std::string& indexDir,
+               const std::vector<std::string>& jobArgs,
+               std::shared_ptr<SalmonIndex>& salmonIndex,
+               const std::function<void()>& inChild) {
+  std::fflush(nullptr);
+  pid_t pid = ::fork();
+  if (pid != 0) {
+    return pid;
+  }
+  if (inChild) {
+    inChild();
+  }
+  std::vector<std::string> args{argZero};
+  if (!indexDir.empty()) {
+    args.push_back("--index");
+    args.push_back(indexDir);
+  }
+  args.insert(args.end(), jobArgs.begin(), jobArgs.end());
+  std::vector<char*> argv;
+  for (auto& a : args) {
+    argv.push_back(&a[0]);
+  }
+  argv.push_back(nullptr);
+  int ret = salmonQuantify(static_cast<int>(args.size()), argv.data(),
+                           salmonIndex);
+  spdlog::drop_all();
+  std::exit(ret);
+}
+
+bool isAlignmentJob(const std::vector<std::string>& jobArgs) {
+  for (auto& a : jobArgs) {
+    if (a == "-a" or a == "--alignments" or
+        a.compare(0, 13, "--alignments=") == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Load the index in indexDirectory once, to be shared by every job; returns
+ * nullptr (having said why) if there's no index there.
+ */
+std::shared_ptr<SalmonIndex>
+loadSharedIndex(std::shared_ptr<spdlog::logger>& log,
+                const boost::filesystem::path& indexDirectory,
+                const salmon::memory::Placement& placement) {
+  SalmonIndexVersionInfo versionInfo;
+  versionInfo.load(indexDirectory / "versionInfo.json");
+  if (versionInfo.indexVersion() == 0) {
+    log->error("The index version file {} doesn't seem to exist.  "
+               "Please try re-building the salmon index.",
+               (indexDirectory / "versionInfo.json").string());
+    return nullptr;
+  }
+
+  std::shared_ptr<SalmonIndex> salmonIndex(
+      new SalmonIndex(log, versionInfo.indexType()));
+  auto loadStart = std::chrono::steady_clock::now();
+  salmonIndex->load(indexDirectory);
+  salmonIndex->placeQuasiIndex(placement);
+  std::chrono::duration<double> loadTime =
+      std::chrono::steady_clock::now() - loadStart;
+  log->info("loaded the index in {:.1f}s", loadTime.count());
+  return salmonIndex;
+}
+
+/**
+ * Runs jobs (see startJob) against a shared index, at most parallelJobs of
+ * them at a time, and keeps track of how they fared.
+ */
+class JobRunner {
+public:
+  JobRunner(std::shared_ptr<spdlog::logger> log, std::string argZero,
+            std::string indexDir, std::shared_ptr<SalmonIndex> salmonIndex,
+            uint32_t parallelJobs)
+      : log_(log), argZero_(argZero), indexDir_(indexDir),
+        salmonIndex_(salmonIndex), parallelJobs_(parallelJobs) {}
+
+  // Start the job (once one of those running has finished, if need be)
+  void start(const std::string& desc, const std::vector<std::string>& args,
+             const std::function<void()>& inChild = nullptr) {
+    if (isAlignmentJob(args)) {
+      fail(desc, "alignment-based jobs can't be run from an index");
+      return;
+    }
+    ++numJobs_;
+    while (running_.size() >= parallelJobs_) {
+      reap_();
+    }
+    log_->flush();
+    pid_t pid = startJob(argZero_, indexDir_, args, salmonIndex_, inChild);
+    if (pid < 0) {
+      ++numFailed_;
+      log_->error("job {} [{}]: couldn't start a process for it", numJobs_,
+                  desc);
+      return;
+    }
+    running_[pid] = ServeJob{numJobs_, desc, std::chrono::steady_clock::now()};
+    log_->info("started job {} [{}]", numJobs_, desc);
+  }
+
+  // Count a job that can't be run at all as a failure
+  void fail(const std::string& desc, const std::string& why) {
+    ++numJobs_;
+    ++numFailed_;
+    log_->error("job {} [{}]: {}; skipping it", numJobs_, desc, why);
+  }
+
+  // Wait for every running job; returns the number of jobs that failed
+  size_t finish() {
+    while (!running_.empty()) {
+      reap_();
+    }
+    log_->info("ran {} jobs; {} failed", numJobs_, numFailed_);
+    log_->flush();
+    return numFailed_;
+  }
+
+private:
+  // Wait for one of the running jobs to finish, and report on it.
+  void reap_() {
+    int status{0};
+    pid_t pid = ::waitpid(-1, &status, 0);
+    if (pid < 0) {
+      // no children left (which shouldn't happen with jobs running)
+      numFailed_ += running_.size();
+      running_.clear();
+      return;
+    }
+    auto it = running_.find(pid);
+    if (it == running_.end()) {
+      return;
+    }
+    std::chrono::duration<double> jobTime =
+        std::chrono::steady_clock::now() - it->second.start;
+    bool ok = WIFEXITED(status) and WEXITSTATUS(status) == 0;
+    if (ok) {
+      log_->info("job {} finished in {:.1f}s", it->second.id, jobTime.count());
+    } else {
+      ++numFailed_;
+      if (WIFEXITED(status)) {
+        log_->error("job {} [{}] failed with exit status {}", it->second.id,
+                    it->second.args, WEXITSTATUS(status));
+      } else {
+        log_->error("job {} [{}] was terminated by signal {}", it->second.id,
+                    it->second.args,
+                    WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+      }
+    }
+    running_.erase(it);
+  }
+
+  std::shared_ptr<spdlog::logger> log_;
+  std::string argZero_;
+  std::string indexDir_;
+  std::shared_ptr<SalmonIndex> salmonIndex_;
+  uint32_t parallelJobs_;
+  std::map<pid_t, ServeJob> running_;
+  size_t numJobs_{0};
+  size_t numFailed_{0};
+};
+
+// Whether arg is the option name (or one of its aliases), given either on
+// its own or, if it takes a value, as name=value (which is put in value)
+bool matchOption(const std::string& arg,
+                 const std::vector<std::string>& names, std::string& value) {
+  for (auto& n : names) {
+    if (arg == n) {
+      return true;
+    }
+    if (n.compare(0, 2, "--") == 0 and arg.size() > n.size() and
+        arg.compare(0, n.size() + 1, n + "=") == 0) {
+      value = arg.substr(n.size() + 1);
+      return true;
+    }
+  }
+  return false;
+}
+}
+
+int salmonServe(int argc, char* argv[]) {
+  using std::string;
+  namespace po = boost::program_options;
+
+  string indexDirStr;
+  string jobsFile;
+  uint32_t parallelJobs{1};
+  salmon::memory::Placement placement;
+
+  po::options_description generic("\n"
+                                  "basic options");
+  generic.add_options()("version,v", "print version string")(
+      "help,h", "produce help message")(
+      "index,i", po::value<string>(&indexDirStr)->required(),
+      "Salmon index, which is loaded once and shared by every job")(
+      "jobs,j", po::value<string>(&jobsFile)->default_value("-"),
+      "File from which jobs are read, one per line, until its end (\"-\" is "
+      "the standard input).  A job is the list of arguments that would be "
+      "passed to salmon quant (e.g. -l A -1 r1.fq -2 r2.fq -o out), "
+      "without --index.  Empty lines and lines starting with '#' are "
+      "skipped.  A named pipe can be used as a queue of jobs.")(
+      "parallelJobs", po::value<uint32_t>(&parallelJobs)->default_value(1),
+      "The number of jobs that are run at the same time (each with the "
+      "number of threads given by its own --threads option).")(
+      "indexHugePages",
+      po::bool_switch(&(placement.hugePages))->default_value(false),
+      "[Experimental]: Back the suffix array and transcript sequence of the "
+      "(quasi) index with huge pages (see salmon quant).")(
+      "interleaveIndex",
+      po::bool_switch(&(placement.interleave))->default_value(false),
+      "[Experimental]: Interleave the suffix array and transcript sequence "
+      "of the (quasi) index across all NUMA nodes (see salmon quant).");
+
+  po::options_description visible("salmon serve options");
+  visible.add(generic);
+
+  po::variables_map vm;
+  try {
+    auto orderedOptions =
+        po::command_line_parser(argc, argv).options(visible).run();
+    po::store(orderedOptions, vm);
+
+    if (vm.count("help")) {
+      auto hstring = R"(
+Serve
+==========
+Load an index once, and quantify many samples
+against it (each with the options of salmon quant)
+)";
+      std::cerr << hstring << std::endl;
+      std::cerr << visible << std::endl;
+      std::exit(0);
+    }
+
+    po::notify(vm);
+
+    // The server's logger is synchronous: a job is run in a forked child,
+    // and the server must not have any threads of its own when it forks.
+    auto consoleSink =
+        std::make_shared<spdlog::sinks::ansicolor_stderr_sink_mt>();
+    auto serveLog = spdlog::create("serveLog", {consoleSink});
+
+    if (parallelJobs == 0) {
+      serveLog->error("--parallelJobs must be at least 1");
+      return 1;
+    }
+
+    auto salmonIndex = loadSharedIndex(serveLog, indexDirStr, placement);
+    if (!salmonIndex) {
+      return 1;
+    }
+    serveLog->info("waiting for jobs");
+
+    std::istream* jobStream = &std::cin;
+    std::ifstream jobFileStream;
+    if (jobsFile != "-") {
+      jobFileStream.open(jobsFile);
+      if (!jobFileStream.good()) {
+        serveLog->error("Couldn't open the job file {}", jobsFile);
+        return 1;
+      }
+      jobStream = &jobFileStream;
+    }
+
+    JobRunner runner(serveLog, argv[0], indexDirStr, salmonIndex,
+                     parallelJobs);
+    string line;
+    while (std::getline(*jobStream, line)) {
+      auto first = line.find_first_not_of(" \t\r");
+      if (first == string::npos or line[first] == '#') {
+        continue;
+      }
+      runner.start(line, po::split_unix(line));
+    }
+    size_t numFailed = runner.finish();
+
+    spdlog::drop_all();
+    return (numFailed == 0) ? 0 : 1;
+  } catch (po::error& e) {
+    std::cerr << "Exception : [" << e.what() << "]. Exiting.\n";
+    std::exit(1);
+  } catch (const spdlog::spdlog_ex& ex) {
+    std::cerr << "logger failed with : [" << ex.what() << "]. Exiting.\n";
+    std::exit(1);
+  } catch (std::exception& e) {
+    std::cerr << "Exception : [" << e.what() << "]\n";
+    std::cerr << argv[0] << " serve was invoked improperly.\n";
+    std::cerr << "For usage information, try " << argv[0]
+              << " serve --help\nExiting.\n";
+    std::exit(1);
+  }
+  return 0;
+}
+
+/**
+ * salmon quant --batch: quantify every sample listed in the batch file, with
+ * the rest of the quant arguments, against one loaded index.  Each line of
+ * the batch file is a sample name, then (after a tab or spaces) the
+ * arguments that are particular to that sample (e.g. its reads); its output
+ * goes to <output>/<name>.  Up to --batchJobs samples are run at once, each
+ * in a child process (see salmon serve).
+ */
+int salmonQuantBatch(int argc, char* argv[]) {
+  using std::string;
+  using std::vector;
+  namespace bfs = boost::filesystem;
+  namespace po = boost::program_options;
+
+  string indexDirStr;
+  string batchFile;
+  string outputDirStr;
+  string batchJobsStr{"1"};
+  salmon::memory::Placement placement;
+  vector<string> commonArgs;
+
+  // Only the options that batch mode itself needs are picked out here; the
+  // rest are passed along to (and checked by) each sample's salmon quant.
+  for (int i = 1; i < argc; ++i) {
+    string arg(argv[i]);
+    string* target{nullptr};
+    string value;
+    if (matchOption(arg, {"-i", "--index"}, value)) {
+      target = &indexDirStr;
+    } else if (matchOption(arg, {"-o", "--output"}, value)) {
+      target = &outputDirStr;
+    } else if (matchOption(arg, {"--batch"}, value)) {
+      target = &batchFile;
+    } else if (matchOption(arg, {"--batchJobs"}, value)) {
+      target = &batchJobsStr;
+    } else {
+      if (arg == "--indexHugePages") {
+        placement.hugePages = true;
+      } else if (arg == "--interleaveIndex") {
+        placement.interleave = true;
+      }
+      commonArgs.push_back(arg);
+      continue;
+    }
+    if (value.empty()) {
+      if (i + 1 >= argc) {
+        std::cerr << "salmon quant --batch: " << arg << " requires a value\n";
+        return 1;
+      }
+      value = argv[++i];
+    }
+    *target = value;
+  }
+
+  auto consoleSink =
+      std::make_shared<spdlog::sinks::ansicolor_stderr_sink_mt>();
+  auto batchLog = spdlog::create("batchLog", {consoleSink});
+
+  uint32_t batchJobs{0};
+  try {
+    batchJobs = static_cast<uint32_t>(std::stoul(batchJobsStr));
+  } catch (std::exception& e) {
+    batchJobs = 0;
+  }
+  if (batchJobs == 0) {
+    batchLog->error("--batchJobs must be a number of at least 1");
+    return 1;
+  }
+  if (indexDirStr.empty() or outputDirStr.empty()) {
+    batchLog->error("salmon quant --batch requires --index and --output");
+    return 1;
+  }
+
+  std::ifstream batchStream(batchFile);
+  if (!batchStream.good()) {
+    batchLog->error("Couldn't open the batch file {}", batchFile);
+    return 1;
+  }
+
+  auto salmonIndex = loadSharedIndex(batchLog, indexDirStr, placement);
+  if (!salmonIndex) {
+    return 1;
+  }
+
+  JobRunner runner(batchLog, argv[0], indexDirStr, salmonIndex, batchJobs);
+  bfs::path outputRoot(outputDirStr);
+  std::map<string, size_t> seen;
+  string line;
+  while (std::getline(batchStream, line)) {
+    auto first = line.find_first_not_of(" \t\r");
+    if (first == string::npos or line[first] == '#') {
+      continue;
+    }
+    auto nameEnd = line.find_first_of(" \t\r", first);
+    string name = line.substr(first, nameEnd - first);
+    auto sampleArgs = (nameEnd == string::npos)
+                          ? vector<string>()
+                          : po::split_unix(line.substr(nameEnd));
+    vector<string> jobArgs(commonArgs);
+    jobArgs.insert(jobArgs.end(), sampleArgs.begin(), sampleArgs.end());
+    jobArgs.push_back("--output");
+    jobArgs.push_back((outputRoot / name).string());
+    if (seen[name]++ > 0) {
+      runner.fail(name, "another sample has the same name (and output)");
+      continue;
+    }
+    runner.start(name, jobArgs);
+  }
+  size_t numFailed = runner.finish();
+
+  spdlog::drop_all();
+  return (numFailed == 0) ? 0 : 1;
+}
+
+/**
+ * salmon quant with more than one --index (e.g. a host and a pathogen
+ * transcriptome, or one with spike-ins): quantify the reads against each
+ * index, with the rest of the quant arguments, and put the output for each
+ * in <output>/<the index directory's name>.  Each index has a child process
+ * of its own (see salmon serve), all of them running at once, and each read
+ * file is read and decompressed once, here, and teed to all of them (see
+ * fastx_parser::ReadTee) rather than once per index.  Since the children
+ * run at once, the --threads are split among them, rather than each of them
+ * being given all of them.  The fragments are assigned within each index on
+ * its own; to have the indices compete for them, build one index of all the
+ * transcripts instead.
+ */
+int salmonQuantMultiIndex(int argc, char* argv[]) {
+  using std::string;
+  using std::vector;
+  namespace bfs = boost::filesystem;
+
+  vector<string> indexDirs;
+  string outputDirStr;
+  // The arguments for every index, but with each read file (whose path is
+  // in readFiles) left as a placeholder, at readArgPos in commonArgs
+  vector<string> commonArgs;
+  vector<string> readFiles;
+  vector<size_t> readArgPos;
+  bool inReadFiles{false};
+  // The threads of all of the children together
+  uint32_t numThreads = std::thread::hardware_concurrency();
+
+  for (int i = 1; i < argc; ++i) {
+    string arg(argv[i]);
+    string value;
+    if (inReadFiles and !arg.empty() and arg[0] != '-') {
+      readArgPos.push_back(commonArgs.size());
+      readFiles.push_back(arg);
+      commonArgs.push_back(arg);
+      continue;
+    }
+    inReadFiles = false;
+    if (matchOption(arg, {"--batch", "--mappingCacheDir"}, value)) {
+      std::cerr << "salmon quant: " << arg << " can't be used with more than "
+                << "one --index\n";
+      return 1;
+    }
+    bool isIndex = matchOption(arg, {"-i", "--index"}, value);
+    bool isOutput =
+        !isIndex and matchOption(arg, {"-o", "--output"}, value);
+    if (isIndex or isOutput) {
+      if (value.empty()) {
+        if (i + 1 >= argc) {
+          std::cerr << "salmon quant: " << arg << " requires a value\n";
+          return 1;
+        }
+        value = argv[++i];
+      }
+      if (isIndex) {
+        indexDirs.push_back(value);
+      } else {
+        outputDirStr = value;
+      }
+      continue;
+    }
+    // (-p8 as well as -p 8, --threads 8 and --threads=8)
+    bool isAttachedThreads = arg.size() > 2 and arg.compare(0, 2, "-p") == 0;
+    if (isAttachedThreads or matchOption(arg, {"-p", "--threads"}, value)) {
+      if (isAttachedThreads) {
+        value = arg.substr(2);
+      } else if (value.empty()) {
+        if (i + 1 >= argc) {
+          std::cerr << "salmon quant: " << arg << " requires a value\n";
+          return 1;
+        }
+        value = argv[++i];
+      }
+      try {
+        numThreads = static_cast<uint32_t>(std::stoul(value));
+      } catch (const std::exception&) {
+        std::cerr << "salmon quant: the number of threads (" << value
+                  << ") isn't a number\n";
+        return 1;
+      }
+      continue;
+    }
+    if (matchOption(arg, {"-r", "--unmatedReads", "-1", "--mates1", "-2",
+                          "--mates2", "--interleaved"},
+                    value)) {
+      inReadFiles = true;
+      if (!value.empty()) {
+        commonArgs.push_back(arg.substr(0, arg.find('=')));
+        readArgPos.push_back(commonArgs.size());
+        readFiles.push_back(value);
+        commonArgs.push_back(value);
+        continue;
+      }
+    }
+    commonArgs.push_back(arg);
+  }
+
+  auto consoleSink =
+      std::make_shared<spdlog::sinks::ansicolor_stderr_sink_mt>();
+  auto multiLog = spdlog::create("multiIndexLog", {consoleSink});
+
+  if (outputDirStr.empty()) {
+    multiLog->error("salmon quant requires --output");
+    return 1;
+  }
+  if (readFiles.empty()) {
+    multiLog->error("salmon quant requires read files (-r, -1 and -2, or "
+                    "--interleaved)");
+    return 1;
+  }
+
+  // Each index's output directory is named after the index's own
+  vector<string> outputDirs;
+  std::map<string, size_t> seen;
+  for (auto& dir : indexDirs) {
+    string trimmed(dir);
+    while (trimmed.size() > 1 and trimmed.back() == '/') {
+      trimmed.pop_back();
+    }
+    string name = bfs::path(trimmed).filename().string();
+    if (seen[name]++ > 0) {
+      multiLog->error("more than one index (e.g. {}) is named {}; their "
+                      "output would go to the same directory",
+                      dir, name);
+      return 1;
+    }
+    outputDirs.push_back((bfs::path(outputDirStr) / name).string());
+  }
+
+  // A pipe from every read file to every index's process:
+  // pipes[f][k] is that of read file f and index k
+  size_t numIndices = indexDirs.size();
+  vector<vector<std::array<int, 2>>> pipes(
+      readFiles.size(), vector<std::array<int, 2>>(numIndices));
+  for (auto& filePipes : pipes) {
+    for (auto& p : filePipes) {
+      if (::pipe(p.data()) != 0) {
+        multiLog->error("couldn't create the pipes to the processes for "
+                        "each index");
+        return 1;
+      }
+    }
+  }
+
+  // The children run at once, so they share the threads (each has at least
+  // one)
+  numThreads = std::max(numThreads, uint32_t(1));
+  if (numThreads < numIndices) {
+    multiLog->warn("there are fewer threads ({}) than indices ({}); each "
+                   "index's process is given one thread",
+                   numThreads, numIndices);
+  }
+
+  // The children are forked before any of the tees' threads are started
+  JobRunner runner(multiLog, argv[0], "", nullptr,
+                   static_cast<uint32_t>(numIndices));
+  for (size_t k = 0; k < numIndices; ++k) {
+    vector<string> jobArgs{"--index", indexDirs[k]};
+    vector<string> args(commonArgs);
+    for (size_t f = 0; f < readFiles.size(); ++f) {
+      args[readArgPos[f]] = "/dev/fd/" + std::to_string(pipes[f][k][0]);
+    }
+    jobArgs.insert(jobArgs.end(), args.begin(), args.end());
+    jobArgs.push_back("--output");
+    jobArgs.push_back(outputDirs[k]);
+    uint32_t share = static_cast<uint32_t>(
+        numThreads / numIndices + ((k < numThreads % numIndices) ? 1 : 0));
+    jobArgs.push_back("--threads");
+    jobArgs.push_back(std::to_string(std::max(share, uint32_t(1))));
+    // The child keeps only the read ends of its own pipes
+    auto closeOthers = [&pipes, k]() -> void {
+      for (auto& filePipes : pipes) {
+        for (size_t j = 0; j < filePipes.size(); ++j) {
+          ::close(filePipes[j][1]);
+          if (j != k) {
+            ::close(filePipes[j][0]);
+          }
+        }
+      }
+    };
+    runner.start(indexDirs[k], jobArgs, closeOthers);
+  }
+  for (auto& filePipes : pipes) {
+    for (auto& p : filePipes) {
+      ::close(p[0]);
+    }
+  }
+
+  // A process that stops reading (having failed) just drops out of the tee
+  std::signal(SIGPIPE, SIG_IGN);
+  vector<std::unique_ptr<fastx_parser::ReadTee>> tees;
+  for (size_t f = 0; f < readFiles.size(); ++f) {
+    vector<int> fds;
+    for (auto& p : pipes[f]) {
+      fds.push_back(p[1]);
+    }
+    tees.emplace_back(new fastx_parser::ReadTee(readFiles[f], fds));
+  }
+  bool readOk{true};
+  for (size_t f = 0; f < readFiles.size(); ++f) {
+    if (!tees[f]->finish()) {
+      multiLog->error("couldn't read all of {}", readFiles[f]);
+      readOk = false;
+    }
+  }
+  size_t numFailed = runner.finish();
+
+  spdlog::drop_all();
+  return (readOk and numFailed == 0) ? 0 : 1;
+}
@@ -3,6 +3,49 @@
 #include <cstdint>
 #include <iostream>
 
+#include "CPUDispatch.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+// The vector variant of encodeTwoBit is the baseline of the target (fixed
+// at compile time), so it's only recorded.
+void recordTwoBitVariant() {
+#if defined(__SSE2__)
+  salmon::cpu::record("encode_two_bit", salmon::cpu::ISA::sse2);
+#elif defined(__ARM_NEON)
+  salmon::cpu::record("encode_two_bit", salmon::cpu::ISA::neon);
+#else
+  salmon::cpu::record("encode_two_bit", salmon::cpu::ISA::scalar);
+#endif
+}
+
+const salmon::cpu::Registration twoBitRegistration(recordTwoBitVariant);
+
+inline int8_t twoBitCode(char c) {
+  switch (c) {
+  case 'A':
+  case 'a':
+    return 0;
+  case 'C':
+  case 'c':
+    return 1;
+  case 'G':
+  case 'g':
+    return 2;
+  case 'T':
+  case 't':
+    return 3;
+  default:
+    return -1;
+  }
+}
+}
+
 uint8_t* salmon::stringtools::encodeSequenceInSAM(const char* src, size_t len) {
   uint8_t* target = new uint8_t[static_cast<size_t>(ceil(len / 2.0))]();
   for (size_t i = 0; i < len; ++i) {
@@ -16,3 +59,64 @@ uint8_t* salmon::stringtools::encodeSequenceInSAM(const char* src, size_t len) {
   }
   return target;
 }
+
+void salmon::stringtools::encodeTwoBit(const char* src, size_t len,
+                                       int8_t* codes) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  // Fold lower case onto upper case, compare against each base, and
+  // combine the masks into the codes; a base that matched none is -1.
+  const __m128i caseMask = _mm_set1_epi8(static_cast<char>(0xDF));
+  const __m128i baseA = _mm_set1_epi8('A');
+  const __m128i baseC = _mm_set1_epi8('C');
+  const __m128i baseG = _mm_set1_epi8('G');
+  const __m128i baseT = _mm_set1_epi8('T');
+  const __m128i one = _mm_set1_epi8(1);
+  const __m128i two = _mm_set1_epi8(2);
+  const __m128i three = _mm_set1_epi8(3);
+  for (; i + 16 <= len; i += 16) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m128i u = _mm_and_si128(x, caseMask);
+    __m128i isA = _mm_cmpeq_epi8(u, baseA);
+    __m128i isC = _mm_cmpeq_epi8(u, baseC);
+    __m128i isG = _mm_cmpeq_epi8(u, baseG);
+    __m128i isT = _mm_cmpeq_epi8(u, baseT);
+    __m128i valid =
+        _mm_or_si128(_mm_or_si128(isA, isC), _mm_or_si128(isG, isT));
+    __m128i code = _mm_or_si128(
+        _mm_or_si128(_mm_and_si128(isC, one), _mm_and_si128(isG, two)),
+        _mm_and_si128(isT, three));
+    code = _mm_or_si128(code, _mm_andnot_si128(valid, _mm_set1_epi8(-1)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(codes + i), code);
+  }
+#elif defined(__ARM_NEON)
+  const uint8x16_t caseMask = vdupq_n_u8(0xDF);
+  for (; i + 16 <= len; i += 16) {
+    uint8x16_t u =
+        vandq_u8(vld1q_u8(reinterpret_cast<const uint8_t*>(src + i)), caseMask);
+    uint8x16_t isA = vceqq_u8(u, vdupq_n_u8('A'));
+    uint8x16_t isC = vceqq_u8(u, vdupq_n_u8('C'));
+    uint8x16_t isG = vceqq_u8(u, vdupq_n_u8('G'));
+    uint8x16_t isT = vceqq_u8(u, vdupq_n_u8('T'));
+    uint8x16_t valid = vorrq_u8(vorrq_u8(isA, isC), vorrq_u8(isG, isT));
+    uint8x16_t code = vorrq_u8(vorrq_u8(vandq_u8(isC, vdupq_n_u8(1)),
+                                        vandq_u8(isG, vdupq_n_u8(2))),
+                               vandq_u8(isT, vdupq_n_u8(3)));
+    code = vorrq_u8(code, vmvnq_u8(valid));
+    vst1q_u8(reinterpret_cast<uint8_t*>(codes + i), code);
+  }
+#endif
+  for (; i < len; ++i) {
+    codes[i] = twoBitCode(src[i]);
+  }
+}
+
+void salmon::stringtools::reverseComplementTwoBit(const int8_t* codes,
+                                                  size_t len,
+                                                  int8_t* rcCodes) {
+  for (size_t i = 0, j = len; i < len; ++i) {
+    int8_t c = codes[--j];
+    // complement (c ^ 3) the bases, but leave -1 alone
+    rcCodes[i] = c ^ (3 & ~(c >> 7));
+  }
+}
@@ -1,9 +1,14 @@
 #include <algorithm>
+#include <atomic>
 #include <boost/filesystem.hpp>
 #include <boost/range/join.hpp>
 #include <boost/thread/thread.hpp>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <limits>
 #include <random>
 #include <tuple>
 #include <unordered_map>
@@ -14,15 +19,21 @@
 #include "tbb/parallel_for.h"
 
 #include "AlignmentLibrary.hpp"
+#include "AuxRecordWriter.hpp"
 #include "DistributionUtils.hpp"
 #include "GCFragModel.hpp"
 #include "KmerContext.hpp"
 #include "LibraryFormat.hpp"
+#include "MemoryBudget.hpp"
+#include "PartialExperiment.hpp"
 #include "ReadExperiment.hpp"
 #include "ReadPair.hpp"
 #include "SBModel.hpp"
+#include "SalmonLogging.hpp"
 #include "SalmonMath.hpp"
+#include "SalmonStringUtils.hpp"
 #include "SalmonUtils.hpp"
+#include "SampleEncoding.hpp"
 #include "TryableSpinLock.hpp"
 #include "UnpairedRead.hpp"
 
@@ -39,6 +50,7 @@
 #include "GenomicFeature.hpp"
 #include "SGSmooth.hpp"
 #include "TranscriptGeneMap.hpp"
+#include "xxhash.h"
 
 #include "StadenUtils.hpp"
 
@@ -85,23 +97,43 @@ bool headersAreConsistent(SAM_hdr* h1, SAM_hdr* h2) {
   return consistent;
 }
 
+bool isCoordinateSorted(SAM_hdr* header) {
+  SAM_hdr_type* hd =
+      sam_hdr_find(header, const_cast<char*>("HD"), nullptr, nullptr);
+  if (hd == nullptr) {
+    return false;
+  }
+  SAM_hdr_tag* so =
+      sam_hdr_find_key(header, hd, const_cast<char*>("SO"), nullptr);
+  // the tag's text includes its key ("SO:")
+  const char* order = "coordinate";
+  size_t n = std::strlen(order);
+  return so != nullptr and so->len == static_cast<int>(n + 3) and
+         std::strncmp(so->str + 3, order, n) == 0;
+}
+
 bool headersAreConsistent(std::vector<SAM_hdr*>&& headers) {
   if (headers.size() == 1) {
     return true;
   }
 
   // Ensure that all of the headers are consistent (i.e. the same), by
-  // comparing each with the first.
-  bool consistent{true};
-  auto itFirst = headers.begin();
-  auto it = itFirst;
-  while (++it != headers.end()) {
-    if (!headersAreConsistent(*itFirst, *it)) {
-      consistent = false;
-      break;
+  // comparing each with the first.  The target counts are checked up front;
+  // the (much longer) comparisons of the targets themselves are done in
+  // parallel, one header per task.
+  SAM_hdr* first = headers.front();
+  for (auto* h : headers) {
+    if (h->nref != first->nref) {
+      return false;
     }
   }
-  return consistent;
+  std::atomic<bool> consistent{true};
+  tbb::parallel_for(size_t(1), headers.size(), [&](size_t i) -> void {
+    if (consistent and !headersAreConsistent(first, headers[i])) {
+      consistent = false;
+    }
+  });
+  return consistent.load();
 }
 
 std::ostream& operator<<(std::ostream& os, OrphanStatus s) {
@@ -119,29 +151,82 @@ std::ostream& operator<<(std::ostream& os, OrphanStatus s) {
   return os;
 }
 
+namespace {
+/**
+ * Whether an alignment is compatible with the expected library type, for
+ * every (expected, observed) pair, so that the check done for each alignment
+ * is a single load rather than a walk through compatibleHit()'s branches.
+ * The expected format is indexed by its formatID(); the observed one by
+ * observedKey() below: a paired-end format by its formatID(), and a single
+ * end read or orphan by its mate status and strand (all compatibleHit()
+ * looks at for those).
+ */
+class CompatibilityTable {
+public:
+  static constexpr size_t numFormats = LibraryFormat::maxLibTypeID() + 1;
+  // (single end, left orphan, right orphan) x (reverse, forward)
+  static constexpr size_t numKeys = numFormats + 6;
+
+  CompatibilityTable() {
+    std::vector<MateStatus> unpaired{MateStatus::SINGLE_END,
+                                     MateStatus::PAIRED_END_LEFT,
+                                     MateStatus::PAIRED_END_RIGHT};
+    for (size_t e = 0; e < numFormats; ++e) {
+      auto expected = LibraryFormat::formatFromID(e);
+      for (size_t o = 0; o < numFormats; ++o) {
+        auto observed = LibraryFormat::formatFromID(o);
+        compat_[e][o] = observed.type == ReadType::PAIRED_END and
+                        compatibleHit(expected, observed);
+      }
+      for (auto ms : unpaired) {
+        for (bool isForward : {false, true}) {
+          compat_[e][unpairedKey(ms, isForward)] =
+              compatibleHit(expected, 0, isForward, ms);
+        }
+      }
+    }
+  }
+
+  static size_t unpairedKey(MateStatus ms, bool isForward) {
+    size_t k = (ms == MateStatus::PAIRED_END_LEFT)
+                   ? 1
+                   : (ms == MateStatus::PAIRED_END_RIGHT) ? 2 : 0;
+    return numFormats + 2 * k + (isForward ? 1 : 0);
+  }
+
+  static size_t observedKey(const LibraryFormat& observed, bool isForward,
+                            MateStatus ms) {
+    return (ms == MateStatus::PAIRED_END_PAIRED)
+               ? observed.formatID()
+               : unpairedKey(ms, isForward);
+  }
+
+  bool operator()(const LibraryFormat& expected,
+                  const LibraryFormat& observed, bool isForward,
+                  MateStatus ms) const {
+    return compat_[expected.formatID()][observedKey(observed, isForward, ms)];
+  }
+
+private:
+  bool compat_[numFormats][numKeys];
+};
+
+constexpr size_t CompatibilityTable::numFormats;
+constexpr size_t CompatibilityTable::numKeys;
+
+const CompatibilityTable compatibilityTable;
+} // namespace
+
 bool isCompatible(const LibraryFormat observed, const LibraryFormat expected,
                   int32_t start, bool isForward, rapmap::utils::MateStatus ms) {
-  // If we're dealing with a single end read.
-  bool compat{false};
-  if (ms != rapmap::utils::MateStatus::PAIRED_END_PAIRED) {
-    compat = compatibleHit(expected, start, isForward, ms);
-  } else {
-    compat = compatibleHit(expected, observed);
-  }
-  return compat;
+  return compatibilityTable(expected, observed, isForward, ms);
 }
 
 double logAlignFormatProb(const LibraryFormat observed,
                           const LibraryFormat expected, int32_t start,
                           bool isForward, rapmap::utils::MateStatus ms,
                           double incompatPrior) {
-  // If we're dealing with a single end read.
-  bool compat{false};
-  if (ms != rapmap::utils::MateStatus::PAIRED_END_PAIRED) {
-    compat = compatibleHit(expected, start, isForward, ms);
-  } else {
-    compat = compatibleHit(expected, observed);
-  }
+  bool compat = compatibilityTable(expected, observed, isForward, ms);
   return (compat) ? salmon::math::LOG_1 : incompatPrior;
   /** Old compat code
   if (expected.type == ReadType::PAIRED_END and
@@ -735,6 +820,12 @@ extractReadLibraries(boost::program_options::parsed_options& orderedOptions) {
         peLibs.back().enableAutodetect();
       }
     }
+    if (opt.string_key == "interleaved") {
+      peLibs.back().addInterleaved(opt.value);
+      if (autoLibType) {
+        peLibs.back().enableAutodetect();
+      }
+    }
     if (opt.string_key == "unmatedReads") {
       seLibs.back().addUnmated(opt.value);
       if (autoLibType) {
@@ -752,11 +843,27 @@ extractReadLibraries(boost::program_options::parsed_options& orderedOptions) {
         continue;
       }
     } else if (lib.format().type == ReadType::PAIRED_END) {
-      if (lib.mates1().size() == 0 or lib.mates2().size() == 0) {
+      if ((lib.mates1().size() == 0 or lib.mates2().size() == 0) and
+          lib.interleaved().size() == 0) {
         // Didn't use default paired-end library type
         continue;
       }
     }
+    // A library of the same format as an earlier one (e.g. another lane of
+    // the same sample, given after a repeated --libType) joins it, so that
+    // all of their files are parsed together and share the mapping threads.
+    auto sameFormat = std::find_if(
+        libs.begin(), libs.end(), [&lib](const ReadLibrary& other) -> bool {
+          return other.format() == lib.format() and
+                 other.autoDetect() == lib.autoDetect();
+        });
+    if (sameFormat != libs.end()) {
+      sameFormat->addMates1(lib.mates1());
+      sameFormat->addMates2(lib.mates2());
+      sameFormat->addInterleaved(lib.interleaved());
+      sameFormat->addUnmated(lib.unmated());
+      continue;
+    }
     libs.push_back(lib);
   }
 
@@ -862,9 +969,27 @@ LibraryFormat parseLibraryFormatString(std::string& fmt) {
   return lf;
 }
 
-bool peekBAMIsPaired(const boost::filesystem::path& file) {
+std::string alignmentReadMode(const boost::filesystem::path& fname) {
+  if (fname.extension() == ".bam") {
+    return "rb";
+  }
+  if (fname.extension() == ".cram") {
+    return "rc";
+  }
+  return "r";
+}
+
+void setCRAMReference(scram_fd* fp, const std::string& reference) {
+  if (fp == nullptr or reference.empty()) {
+    return;
+  }
+  scram_set_option(fp, CRAM_OPT_REFERENCE, reference.c_str());
+}
+
+bool peekBAMIsPaired(const boost::filesystem::path& file,
+                     const std::string& cramReference) {
   namespace bfs = boost::filesystem;
-  std::string readMode = "r";
+  std::string readMode = alignmentReadMode(file);
 
   if (bfs::is_regular_file(file)) {
     if (bfs::is_empty(file)) {
@@ -877,10 +1002,6 @@ bool peekBAMIsPaired(const boost::filesystem::path& file) {
       return false;
     }
   }
-  if (file.extension() == ".bam") {
-    readMode = "rb";
-  }
-
   auto* fp = scram_open(file.c_str(), readMode.c_str());
 
   // If we couldn't open the file, then report this and exit.
@@ -890,6 +1011,9 @@ bool peekBAMIsPaired(const boost::filesystem::path& file) {
     throw std::invalid_argument(errstr.str());
     return false;
   }
+  if (readMode == "rc") {
+    setCRAMReference(fp, cramReference);
+  }
 
   bam_seq_t* read = nullptr;
   read = staden::utils::bam_init();
@@ -1112,6 +1236,95 @@ TranscriptGeneMap transcriptGeneMapFromGTF(const std::string& fname,
   return TranscriptGeneMap(transcriptNames, geneNames, t2g);
 }
 
+namespace {
+// Bump this whenever the serialized layout of TranscriptGeneMap changes
+constexpr uint32_t geneMapCacheVersion = 1;
+
+// The XXH64 checksum of the contents of fname; returns false if the file
+// can't be read.
+bool fileChecksum(const std::string& fname, uint64_t& checksum) {
+  std::ifstream ifs(fname, std::ios_base::in | std::ios_base::binary);
+  if (!ifs.good()) {
+    return false;
+  }
+  XXH64_state_t* state = XXH64_createState();
+  XXH64_reset(state, 0);
+  std::vector<char> buf(1 << 22);
+  while (ifs) {
+    ifs.read(buf.data(), buf.size());
+    XXH64_update(state, buf.data(), ifs.gcount());
+  }
+  bool ok = ifs.eof();
+  checksum = XXH64_digest(state);
+  XXH64_freeState(state);
+  return ok;
+}
+} // namespace
+
+TranscriptGeneMap
+cachedTranscriptGeneMapFromGTF(const std::string& fname,
+                               const boost::filesystem::path& cacheDir,
+                               std::string key) {
+  namespace bfs = boost::filesystem;
+  auto logger = spdlog::get("jointLog");
+
+  uint64_t checksum{0};
+  if (cacheDir.empty() or !fileChecksum(fname, checksum)) {
+    return transcriptGeneMapFromGTF(fname, key);
+  }
+  // The map also depends on the attribute by which transcripts are grouped
+  checksum = XXH64(key.data(), key.size(), checksum);
+  bfs::path cacheFile =
+      cacheDir / fmt::format("gene_map_{:016x}.bin", checksum);
+
+  TranscriptGeneMap tranGeneMap;
+  if (bfs::exists(cacheFile)) {
+    try {
+      std::ifstream ifs(cacheFile.string(), std::ios::binary);
+      cereal::BinaryInputArchive iarchive(ifs);
+      uint32_t version{0};
+      std::string cachedKey;
+      iarchive(version, cachedKey);
+      if (version == geneMapCacheVersion and cachedKey == key) {
+        iarchive(tranGeneMap);
+        logger->info("Read the transcript <-> gene map for {} from {}", fname,
+                     cacheFile.string());
+        return tranGeneMap;
+      }
+    } catch (std::exception& e) {
+      logger->warn("Couldn't read the cached transcript <-> gene map {} ({}); "
+                   "re-parsing {}",
+                   cacheFile.string(), e.what(), fname);
+    }
+  }
+
+  tranGeneMap = transcriptGeneMapFromGTF(fname, key);
+
+  // Write the map to a temporary file first, and move it into place once
+  // it's complete, so that concurrent runs never read a partial cache.
+  bfs::path tmpFile = cacheFile;
+  tmpFile += bfs::unique_path(".%%%%-%%%%.tmp");
+  try {
+    {
+      std::ofstream ofs(tmpFile.string(), std::ios::binary);
+      if (!ofs.good()) {
+        throw std::runtime_error("couldn't open the file for writing");
+      }
+      cereal::BinaryOutputArchive oarchive(ofs);
+      oarchive(geneMapCacheVersion, key, tranGeneMap);
+    }
+    bfs::rename(tmpFile, cacheFile);
+    logger->info("Cached the transcript <-> gene map for {} in {}", fname,
+                 cacheFile.string());
+  } catch (std::exception& e) {
+    boost::system::error_code ec;
+    bfs::remove(tmpFile, ec);
+    logger->info("Couldn't cache the transcript <-> gene map in {} ({})",
+                 cacheDir.string(), e.what());
+  }
+  return tranGeneMap;
+}
+
 TranscriptGeneMap readTranscriptToGeneMap(std::ifstream& ifile) {
 
   using std::unordered_set;
@@ -1285,6 +1498,128 @@ std::string getCurrentTimeAsString() {
   return time;
 }
 
+uint64_t onlinePhaseSeed(const SalmonOpts& sopt) {
+  static std::atomic<uint64_t> numSeeds{0};
+  if (sopt.samplerSeed == 0) {
+    std::random_device rd;
+    return (static_cast<uint64_t>(rd()) << 32) | rd();
+  }
+  // splitmix64, so that the streams differ in their low bits as well
+  uint64_t z = sopt.samplerSeed + (++numSeeds) * 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+bool readAbundanceProfile(const std::string& fname,
+                          const TranscriptNames& names,
+                          std::vector<double>& profile, spdlog::logger* log) {
+  std::ifstream ifile(fname);
+  if (!ifile.good()) {
+    log->error("Could not open the abundance profile {}", fname);
+    return false;
+  }
+
+  std::string line;
+  if (!std::getline(ifile, line)) {
+    log->error("The abundance profile {} is empty", fname);
+    return false;
+  }
+  auto header = split(line);
+  // A quant.sf has a NumReads column; otherwise, every column after the
+  // first is a sample (of quantmerge)
+  std::vector<size_t> cols;
+  for (size_t c = 1; c < header.size(); ++c) {
+    if (header[c] == "NumReads") {
+      cols.assign(1, c);
+      break;
+    }
+    cols.push_back(c);
+  }
+  if (header.empty() or header.front() != "Name" or cols.empty()) {
+    log->error("{} is neither a quant.sf nor a quantmerge table", fname);
+    return false;
+  }
+
+  profile.assign(names.size(), 0.0);
+  size_t numFound{0};
+  size_t numUnknown{0};
+  while (std::getline(ifile, line)) {
+    auto fields = split(line);
+    if (fields.empty()) {
+      continue;
+    }
+    auto id = names.find(fields.front());
+    if (id == TranscriptNames::npos) {
+      ++numUnknown;
+      continue;
+    }
+    double sum{0.0};
+    size_t n{0};
+    for (auto c : cols) {
+      if (c >= fields.size()) {
+        continue;
+      }
+      char* end{nullptr};
+      double v = std::strtod(fields[c].c_str(), &end);
+      if (end != fields[c].c_str() and std::isfinite(v) and v >= 0.0) {
+        sum += v;
+        ++n;
+      }
+    }
+    profile[id] = (n > 0) ? sum / n : 0.0;
+    ++numFound;
+  }
+  if (numFound == 0) {
+    log->error("The abundance profile {} names none of the index's "
+               "transcripts",
+               fname);
+    return false;
+  }
+  log->info("Read the abundance profile {} ({} of {} transcripts; {} names "
+            "not in the index)",
+            fname, numFound, names.size(), numUnknown);
+  return true;
+}
+
+bool readTargetList(const std::string& fname, const TranscriptNames& names,
+                    std::vector<uint32_t>& targets, spdlog::logger* log) {
+  std::ifstream ifile(fname);
+  if (!ifile.good()) {
+    log->error("Could not open the target list {}", fname);
+    return false;
+  }
+
+  std::vector<bool> seen(names.size(), false);
+  targets.clear();
+  size_t numUnknown{0};
+  std::string line;
+  while (std::getline(ifile, line)) {
+    auto fields = split(line);
+    if (fields.empty() or fields.front().front() == '#') {
+      continue;
+    }
+    auto id = names.find(fields.front());
+    if (id == TranscriptNames::npos) {
+      ++numUnknown;
+      continue;
+    }
+    if (!seen[id]) {
+      seen[id] = true;
+      targets.push_back(id);
+    }
+  }
+  if (targets.empty()) {
+    log->error("The target list {} names none of the index's transcripts",
+               fname);
+    return false;
+  }
+  log->info("Read the target list {} ({} transcripts; {} names not in the "
+            "index)",
+            fname, targets.size(), numUnknown);
+  return true;
+}
+
 bool validateOptionsAlignment_(SalmonOpts& sopt) {
   if (!sopt.sampleOutput and sopt.sampleUnaligned) {
     sopt.jointLog->warn(
@@ -1310,61 +1645,76 @@ bool createAuxMapLoggers_(SalmonOpts& sopt,
 
   auto jointLog = sopt.jointLog;
 
-  // Create the file (and logger) for outputting unmapped reads, if the user has
-  // asked for it.
+  // Create the writers (each with a thread of its own) for the unmapped read
+  // names and the orphan links, if the user has asked for them.
+  std::string auxExt = sopt.compressAuxRecords ? ".txt.gz" : ".txt";
   if (sopt.writeUnmappedNames) {
     boost::filesystem::path auxDir = sopt.outputDirectory / sopt.auxDir;
     bool auxSuccess = bfs::exists(auxDir) and bfs::is_directory(auxDir);
     if (!auxSuccess) {
       return false;
     }
-    bfs::path unmappedNameFile = auxDir / "unmapped_names.txt";
-    std::ofstream* outFile = new std::ofstream(unmappedNameFile.string());
+    bfs::path unmappedNameFile = auxDir / ("unmapped_names" + auxExt);
+    auto writer = std::make_shared<AuxRecordWriter>(unmappedNameFile,
+                                                    sopt.compressAuxRecords);
     // Make sure file opened successfully.
-    if (!outFile->is_open()) {
+    if (!writer->good()) {
       jointLog->error("Could not create file for unmapped read names [{}]",
                       unmappedNameFile.string());
-      delete outFile;
       return false;
     }
-    auto outputSink =
-        std::make_shared<spdlog::sinks::ostream_sink_mt>(*outFile);
-
-    std::shared_ptr<spdlog::logger> outLog =
-        std::make_shared<spdlog::logger>("unmappedLog", outputSink);
-    spdlog::register_logger(outLog);
-    outLog->set_pattern("%v");
-    sopt.unmappedFile.reset(outFile);
-    sopt.unmappedLog = outLog;
+    sopt.unmappedWriter = writer;
   }
 
-  // Create the file (and logger) for outputting unmapped reads, if the user has
-  // asked for it.
   if (sopt.writeOrphanLinks) {
     boost::filesystem::path auxDir = sopt.outputDirectory / sopt.auxDir;
     bool auxSuccess = bfs::exists(auxDir) and bfs::is_directory(auxDir);
     if (!auxSuccess) {
       return false;
     }
-    bfs::path orphanLinkFile = auxDir / "orphan_links.txt";
-    std::ofstream* outFile = new std::ofstream(orphanLinkFile.string());
+    bfs::path orphanLinkFile = auxDir / ("orphan_links" + auxExt);
+    auto writer = std::make_shared<AuxRecordWriter>(orphanLinkFile,
+                                                    sopt.compressAuxRecords);
     // Make sure file opened successfully.
-    if (!outFile->is_open()) {
+    if (!writer->good()) {
       jointLog->error("Could not create file for orphan links [{}]",
                       orphanLinkFile.string());
-      delete outFile;
       return false;
     }
+    sopt.orphanLinkWriter = writer;
+  }
 
-    auto outputSink =
-        std::make_shared<spdlog::sinks::ostream_sink_mt>(*outFile);
-
-    std::shared_ptr<spdlog::logger> outLog =
-        std::make_shared<spdlog::logger>("orphanLinkLog", outputSink);
-    spdlog::register_logger(outLog);
-    outLog->set_pattern("%v");
-    sopt.orphanLinkFile.reset(outFile);
-    sopt.orphanLinkLog = outLog;
+  if (sopt.writeUnmappedReads) {
+    boost::filesystem::path auxDir = sopt.outputDirectory / sopt.auxDir;
+    bool auxSuccess = bfs::exists(auxDir) and bfs::is_directory(auxDir);
+    if (!auxSuccess) {
+      return false;
+    }
+    std::string readExt = sopt.compressAuxRecords ? ".fa.gz" : ".fa";
+    // One file for the unpaired reads, and one per mate for the pairs
+    if (vm.count("unmatedReads")) {
+      bfs::path readFile = auxDir / ("unmapped" + readExt);
+      auto writer = std::make_shared<AuxRecordWriter>(readFile,
+                                                      sopt.compressAuxRecords);
+      if (!writer->good()) {
+        jointLog->error("Could not create file for unmapped reads [{}]",
+                        readFile.string());
+        return false;
+      }
+      sopt.unmappedReadWriter = writer;
+    }
+    if (vm.count("mates1")) {
+      std::vector<bfs::path> mateFiles{auxDir / ("unmapped_1" + readExt),
+                                       auxDir / ("unmapped_2" + readExt)};
+      auto writer = std::make_shared<AuxRecordWriter>(
+          mateFiles, sopt.compressAuxRecords);
+      if (!writer->good()) {
+        jointLog->error("Could not create files for unmapped reads [{}, {}]",
+                        mateFiles[0].string(), mateFiles[1].string());
+        return false;
+      }
+      sopt.unmappedPairWriter = writer;
+    }
   }
 
   // Determine what we'll do with quasi-mapping results
@@ -1412,9 +1762,19 @@ bool createAuxMapLoggers_(SalmonOpts& sopt,
     // either std::cout, or a file.
     sopt.qmStream.reset(new std::ostream(qmBuf));
 
+    // The binary records are written (by a thread of their own) directly to
+    // the stream
+    if (sopt.binaryMappings) {
+      sopt.qmWriter =
+          std::make_shared<AuxRecordWriter>(*(sopt.qmStream.get()), false);
+      return true;
+    }
+
     auto outputSink = std::make_shared<spdlog::sinks::ostream_sink_mt>(
         *(sopt.qmStream.get()));
-    sopt.qmLog = std::make_shared<spdlog::logger>("qmStream", outputSink);
+    // Created (like the other loggers) asynchronous, so that the mapping
+    // threads only queue their records
+    sopt.qmLog = spdlog::create("qmStream", {outputSink});
     sopt.qmLog->set_pattern("%v");
   }
   return true;
@@ -1471,6 +1831,22 @@ bool processQuantOptions(SalmonOpts& sopt,
   // Get the time at the start of the run
   sopt.runStartTime = getCurrentTimeAsString();
 
+  if (!sopt.traceFile.empty()) {
+    sopt.perfStats->enableTracing();
+  }
+  if (!sopt.statusFile.empty()) {
+    sopt.runStatus->start(sopt.statusFile, sopt.statusInterval,
+                          sopt.perfStats);
+  }
+  if (sopt.memoryBudget < 0.0) {
+    std::cerr << "ERROR: --memoryBudget must be non-negative\n";
+    return false;
+  }
+  if (sopt.memoryBudget > 0.0) {
+    salmon::memory::budget().setLimit(
+        static_cast<uint64_t>(sopt.memoryBudget * (1ULL << 30)));
+  }
+
   // Verify the geneMap before we start doing any real work.
   bfs::path geneMapPath;
   if (vm.count("geneMap")) {
@@ -1484,6 +1860,18 @@ bool processQuantOptions(SalmonOpts& sopt,
       return false;
     }
     sopt.geneMapPath = geneMapPath;
+  } else if (sopt.geneLevelEM) {
+    std::cerr << "ERROR: --geneLevelEM needs the transcript <=> gene map "
+                 "(--geneMap)\n";
+    return false;
+  }
+  if (vm.count("geneMapCache")) {
+    sopt.geneMapCacheDirectory = vm["geneMapCache"].as<std::string>();
+    if (!bfs::is_directory(sopt.geneMapCacheDirectory)) {
+      std::cerr << "ERROR: The gene map cache directory "
+                << sopt.geneMapCacheDirectory << " does not exist\n";
+      return false;
+    }
   }
 
   /**
@@ -1540,6 +1928,9 @@ bool processQuantOptions(SalmonOpts& sopt,
   if (sopt.quantMode == SalmonQuantMode::MAP) {
     bfs::path indexDirectory(vm["index"].as<string>());
     sopt.indexDirectory = indexDirectory;
+    if (sopt.geneMapCacheDirectory.empty()) {
+      sopt.geneMapCacheDirectory = indexDirectory;
+    }
 
     // Determine what we'll do with quasi-mapping results
     bool writeQuasimappings = (sopt.qmFileName != "");
@@ -1547,12 +1938,12 @@ bool processQuantOptions(SalmonOpts& sopt,
     // make it larger if we're writing mappings or
     // unmapped names.
     if (writeQuasimappings or sopt.writeUnmappedNames or
-        sopt.writeOrphanLinks) {
+        sopt.writeOrphanLinks or sopt.writeUnmappedReads) {
       max_q_size = 2097152; // 4194304;//16777216;
     }
   }
 
-  spdlog::set_async_mode(max_q_size);
+  salmon::logging::setAsyncMode(max_q_size);
   auto fileSink =
       std::make_shared<spdlog::sinks::simple_file_sink_mt>(logPath.string());
   // auto rawConsoleSink = std::make_shared<spdlog::sinks::stderr_sink_mt>();
@@ -1574,6 +1965,14 @@ bool processQuantOptions(SalmonOpts& sopt,
   sopt.jointLog = jointLog;
   sopt.fileLog = fileLog;
 
+  std::string noCountersWhy;
+  if (sopt.hwCounters and
+      !sopt.perfStats->enableHardwareCounters(noCountersWhy)) {
+    jointLog->warn("The hardware counters can't be read here ({}); "
+                   "--hwCounters is ignored",
+                   noCountersWhy);
+  }
+
   if (sopt.quantMode == SalmonQuantMode::MAP) {
     bool auxLoggersOK = createAuxMapLoggers_(sopt, vm);
     if (!auxLoggersOK) {
@@ -1646,6 +2045,36 @@ bool processQuantOptions(SalmonOpts& sopt,
       jointLog->flush();
       return false;
     }
+    if (sopt.eqClassFormat != "text" and sopt.eqClassFormat != "binary") {
+      jointLog->critical("The equivalence class format (--dumpEqFormat) must "
+                         "be either \"text\" or \"binary\", not \"{}\".",
+                         sopt.eqClassFormat);
+      jointLog->flush();
+      return false;
+    }
+    if (sopt.sampleFormat != "gzip" and sopt.sampleFormat != "columnar") {
+      jointLog->critical("The sample format (--sampleFormat) must be either "
+                         "\"gzip\" or \"columnar\", not \"{}\".",
+                         sopt.sampleFormat);
+      jointLog->flush();
+      return false;
+    }
+    SamplePrecision samplePrecision{SamplePrecision::FLOAT64};
+    if (!salmon::samples::parsePrecision(sopt.samplePrecision,
+                                         samplePrecision)) {
+      jointLog->critical("The sample precision (--samplePrecision) must be "
+                         "\"double\", \"float\" or \"fixed\", not \"{}\".",
+                         sopt.samplePrecision);
+      jointLog->flush();
+      return false;
+    }
+    if (samplePrecision == SamplePrecision::FIXED and
+        sopt.sampleFixedScale == 0) {
+      jointLog->critical("The fixed-point sample scale (--sampleFixedScale) "
+                         "must be at least 1.");
+      jointLog->flush();
+      return false;
+    }
     if (sopt.numGibbsSamples > 0) {
       if (!sopt.thinningFactor >= 1) {
         jointLog->critical(
@@ -1656,6 +2085,32 @@ bool processQuantOptions(SalmonOpts& sopt,
       }
     }
 
+    if (sopt.maxEditFraction < 0.0 or sopt.maxEditFraction >= 1.0) {
+      jointLog->critical("The maximum edit fraction (--maxEditFraction) must "
+                         "be at least 0 and less than 1, not {}.",
+                         sopt.maxEditFraction);
+      jointLog->flush();
+      return false;
+    }
+
+    if (sopt.cellBarcodeLength > 0 and
+        (sopt.umiLength == 0 or sopt.umiLength > 32)) {
+      jointLog->critical("In single-cell mode (--cellBarcodeLength), the "
+                         "UMI length (--umiLength) must be between 1 and 32, "
+                         "not {}.",
+                         sopt.umiLength);
+      jointLog->flush();
+      return false;
+    }
+
+    if (sopt.onlineStopTolerance < 0.0) {
+      jointLog->critical("The online stopping tolerance "
+                         "(--onlineStopTolerance) must be at least 0, not {}.",
+                         sopt.onlineStopTolerance);
+      jointLog->flush();
+      return false;
+    }
+
     if (sopt.useFSPD) {
       jointLog->critical("The --useFSPD option has been deprecated.  "
                          "Positional bias modeling is available "
@@ -1844,33 +2299,32 @@ updateEffectiveLengths(SalmonOpts& sopt, ReadExpT& readExp,
     GCFragModel expectGC;
   };
 
-  auto revComplement = [](const char* s, int32_t l, std::string& o) -> void {
-    if (l > o.size()) {
-      o.resize(l, 'A');
-    }
-    int32_t j = 0;
-    for (int32_t i = l - 1; i >= 0; --i, ++j) {
-      switch (s[i]) {
-      case 'A':
-      case 'a':
-        o[j] = 'T';
-        break;
-      case 'C':
-      case 'c':
-        o[j] = 'G';
-        break;
-      case 'T':
-      case 't':
-        o[j] = 'A';
-        break;
-      case 'G':
-      case 'g':
-        o[j] = 'C';
-        break;
-      default:
-        o[j] = 'N';
+  // Encode a transcript (and its reverse complement) once, so that the
+  // sequence-specific contexts can be rolled along it from the codes.
+  auto encodeBothStrands = [](const char* s, int32_t l,
+                              std::vector<int8_t>& fw,
+                              std::vector<int8_t>& rc) -> void {
+    if (l > fw.size()) {
+      fw.resize(l, 0);
+      rc.resize(l, 0);
+    }
+    salmon::stringtools::encodeTwoBit(s, l, fw.data());
+    salmon::stringtools::reverseComplementTwoBit(fw.data(), l, rc.data());
+  };
+
+  // As Mer::from_chars on the bases encoded by codes
+  auto merFromCodes = [](Mer& mer, const int8_t* codes, int32_t l) -> void {
+    for (int32_t i = 0; i < std::min(static_cast<int32_t>(Mer::k()), l); ++i) {
+      if (codes[i] < 0) {
         break;
       }
+      mer.shift_left(static_cast<int>(codes[i]));
+    }
+  };
+  // As Mer::shift_left on the base encoded by code
+  auto shiftCode = [](Mer& mer, int8_t code) -> void {
+    if (code >= 0) {
+      mer.shift_left(static_cast<int>(code));
     }
   };
 
@@ -2010,7 +2464,10 @@ int contextSize = outsideContext + insideContext;
         auto& expectPos5 = expectedDist.local().expectPos5;
         auto& expectPos3 = expectedDist.local().expectPos3;
 
-        std::string rcSeq;
+        std::vector<int8_t> fwCodes, rcCodes;
+        // The weighted mass of each (sampled) fragment length, which doesn't
+        // depend on where the fragment starts
+        std::vector<double> flMass;
         // For each transcript
         for (auto it : boost::irange(range.begin(), range.end())) {
 
@@ -2062,13 +2519,12 @@ int contextSize = outsideContext + insideContext;
 
           // This transcript's sequence
           const char* tseq = txp.Sequence();
-          revComplement(tseq, refLen, rcSeq);
-          const char* rseq = rcSeq.c_str();
+          encodeBothStrands(tseq, refLen, fwCodes, rcCodes);
 
           Mer fwmer;
-          fwmer.from_chars(tseq);
+          merFromCodes(fwmer, fwCodes.data(), refLen);
           Mer rcmer;
-          rcmer.from_chars(rseq);
+          merFromCodes(rcmer, rcCodes.data(), refLen);
           int32_t contextLength{expectSeqFW.getContextLength()};
 
           if (gcBiasCorrect and seqBiasCorrect) {
@@ -2081,6 +2537,17 @@ int contextSize = outsideContext + insideContext;
           int32_t locFLDLow = (refLen < cdfMaxArg) ? 1 : fldLow;
           int32_t locFLDHigh = (refLen < cdfMaxArg) ? cdfMaxArg : fldHigh;
 
+          if (gcBiasCorrect) {
+            flMass.clear();
+            size_t sp =
+                static_cast<size_t>((locFLDLow > 0) ? locFLDLow - 1 : 0);
+            double prevFLMass = conditionalCDF(sp);
+            for (int32_t fl = locFLDLow; fl <= locFLDHigh; fl += gcSamp) {
+              flMass.push_back(weight * (conditionalCDF(fl) - prevFLMass));
+              prevFLMass = conditionalCDF(fl);
+            }
+          }
+
           // For each position along the transcript
           // Starting from the 5' end and moving toward the 3' end
           for (int32_t fragStartPos = 0; fragStartPos < refLen - K;
@@ -2101,17 +2568,15 @@ int contextSize = outsideContext + insideContext;
               }
 
               // shift the context one nucleotide to the right
-              fwmer.shift_left(tseq[fragStartPos + contextLength]);
-              rcmer.shift_left(rseq[fragStartPos + contextLength]);
+              shiftCode(fwmer, fwCodes[fragStartPos + contextLength]);
+              shiftCode(rcmer, rcCodes[fragStartPos + contextLength]);
             } // end: Seq-specific bias
 
             // fragment-GC bias
             if (gcBiasCorrect) {
-              size_t sp =
-                  static_cast<size_t>((locFLDLow > 0) ? locFLDLow - 1 : 0);
-              double prevFLMass = conditionalCDF(sp);
               int32_t fragStart = fragStartPos;
-              for (int32_t fl = locFLDLow; fl <= locFLDHigh; fl += gcSamp) {
+              int32_t fl = locFLDLow;
+              for (size_t fli = 0; fli < flMass.size(); ++fli, fl += gcSamp) {
                 int32_t fragEnd = fragStart + fl - 1;
                 if (fragEnd < refLen) {
                   // The GC fraction for this putative fragment
@@ -2132,9 +2597,7 @@ int contextSize = outsideContext + insideContext;
                           : 0;
 
                   GCDesc desc{gcFrac, contextFrac};
-                  expectGC.inc(desc,
-                               weight * (conditionalCDF(fl) - prevFLMass));
-                  prevFLMass = conditionalCDF(fl);
+                  expectGC.inc(desc, flMass[fli]);
                 } else {
                   break;
                 } // no more valid positions
@@ -2226,6 +2689,9 @@ int contextSize = outsideContext + insideContext;
 
   exp5.normalize();
   exp3.normalize();
+  // (only their ratios to the observed models are used from here on)
+  SBModelRatio seqBias5(obs5, exp5);
+  SBModelRatio seqBias3(obs3, exp3);
 
   bool noThreshold = sopt.noBiasLengthThreshold;
   std::atomic<size_t> numCorrected{0};
@@ -2245,12 +2711,19 @@ int contextSize = outsideContext + insideContext;
       BlockedIndexRange(size_t(0), size_t(transcripts.size())),
       [&](const BlockedIndexRange& range) -> void {
 
-        std::string rcSeq;
+        std::vector<int8_t> fwCodes, rcCodes;
         // For each transcript
         for (auto it : boost::irange(range.begin(), range.end())) {
 
           auto& txp = transcripts[it];
 
+          // A transcript with enough fragments takes the effective length
+          // observed for them (see --observedEffLens) instead
+          if (txp.observedEffectiveLength() > 0.0) {
+            effLensOut(it) = txp.observedEffectiveLength();
+            continue;
+          }
+
           // eff. length starts out as 0
           double effLength = 0.0;
 
@@ -2297,8 +2770,7 @@ int contextSize = outsideContext + insideContext;
 
             // This transcript's sequence
             const char* tseq = txp.Sequence();
-            revComplement(tseq, refLen, rcSeq);
-            const char* rseq = rcSeq.c_str();
+            encodeBothStrands(tseq, refLen, fwCodes, rcCodes);
 
             int32_t fl = locFLDLow;
             auto maxLen = std::min(refLen, locFLDHigh + 1);
@@ -2309,26 +2781,16 @@ int contextSize = outsideContext + insideContext;
                                     windowLensFP, windowLensTP);
             }
 
-            if (posBiasCorrect) {
-              std::vector<double> posFactorsObs5(refLen, 1.0);
-              std::vector<double> posFactorsObs3(refLen, 1.0);
-              std::vector<double> posFactorsExp5(refLen, 1.0);
-              std::vector<double> posFactorsExp3(refLen, 1.0);
+            if (posBiasCorrect and refLen > K) {
               auto li = txp.lengthClassIndex();
-              auto& p5O = pos5Obs[li];
-              auto& p3O = pos3Obs[li];
-              auto& p5E = pos5Exp[li];
-              auto& p3E = pos3Exp[li];
-              p5O.projectWeights(posFactorsObs5);
-              p3O.projectWeights(posFactorsObs3);
-              p5E.projectWeights(posFactorsExp5);
-              p3E.projectWeights(posFactorsExp3);
-              for (int32_t fragStart = 0; fragStart < refLen - K; ++fragStart) {
-                posFactorsFW[fragStart] =
-                    posFactorsObs5[fragStart] / posFactorsExp5[fragStart];
-                posFactorsRC[fragStart] =
-                    posFactorsObs3[fragStart] / posFactorsExp3[fragStart];
-              }
+              // The positions before refLen - K get the ratio of the
+              // observed to the expected weights; the rest keep 1
+              posFactorsFW.resize(refLen - K);
+              posFactorsRC.resize(refLen - K);
+              pos5Obs[li].projectRatio(pos5Exp[li], refLen, posFactorsFW);
+              pos3Obs[li].projectRatio(pos3Exp[li], refLen, posFactorsRC);
+              posFactorsFW.resize(refLen, 1.0);
+              posFactorsRC.resize(refLen, 1.0);
             }
 
             // Evaluate the sequence specific bias (5' and 3') over the length
@@ -2340,8 +2802,8 @@ int contextSize = outsideContext + insideContext;
             if (seqBiasCorrect) {
               Mer mer;
               Mer rcmer;
-              mer.from_chars(tseq);
-              rcmer.from_chars(rseq);
+              merFromCodes(mer, fwCodes.data(), refLen);
+              merFromCodes(rcmer, rcCodes.data(), refLen);
               int32_t contextLength{exp5.getContextLength()};
 
               for (int32_t fragStart = 0; fragStart < refLen - K; ++fragStart) {
@@ -2351,14 +2813,13 @@ int contextSize = outsideContext + insideContext;
 
                 if (kmerEndPos >= 0 and kmerEndPos < refLen and
                     readStart < refLen) {
-                  seqFactorsFW[readStart] =
-                      std::exp(obs5.evaluateLog(mer) - exp5.evaluateLog(mer));
-                  seqFactorsRC[readStart] = std::exp(obs3.evaluateLog(rcmer) -
-                                                     exp3.evaluateLog(rcmer));
+                  seqFactorsFW[readStart] = std::exp(seqBias5.evaluateLog(mer));
+                  seqFactorsRC[readStart] =
+                      std::exp(seqBias3.evaluateLog(rcmer));
                 }
                 // shift the context one nucleotide to the right
-                mer.shift_left(tseq[fragStart + contextLength]);
-                rcmer.shift_left(rseq[fragStart + contextLength]);
+                shiftCode(mer, fwCodes[fragStart + contextLength]);
+                shiftCode(rcmer, rcCodes[fragStart + contextLength]);
               }
               // We need these in 5' -> 3' order, so reverse them
               seqFactorsRC.reverseInPlace();
@@ -2595,11 +3056,10 @@ void aggregateEstimatesToGeneLevel(TranscriptGeneMap& tgm,
   //====================== From GeneSum =====================
 }
 
-void generateGeneLevelEstimates(boost::filesystem::path& geneMapPath,
-                                boost::filesystem::path& estDir) {
-  namespace bfs = boost::filesystem;
+TranscriptGeneMap
+loadTranscriptGeneMap(boost::filesystem::path& geneMapPath,
+                      const boost::filesystem::path& geneMapCacheDir) {
   auto logger = spdlog::get("jointLog");
-  logger->info("Computing gene-level abundance estimates");
   std::set<std::string> validGTFExtensions = {".gtf", ".gff", ".gff3",
                                               ".GTF", ".GFF", ".GFF3"};
   auto extension = geneMapPath.extension();
@@ -2608,8 +3068,8 @@ void generateGeneLevelEstimates(boost::filesystem::path& geneMapPath,
   // parse the map as a GTF file
   if (validGTFExtensions.find(extension.string()) != validGTFExtensions.end()) {
     // Using libgff
-    tranGeneMap = salmon::utils::transcriptGeneMapFromGTF(geneMapPath.string(),
-                                                          "gene_id");
+    tranGeneMap = salmon::utils::cachedTranscriptGeneMapFromGTF(
+        geneMapPath.string(), geneMapCacheDir, "gene_id");
   } else { // parse the map as a simple format files
     std::ifstream tgfile(geneMapPath.string());
     tranGeneMap = salmon::utils::readTranscriptToGeneMap(tgfile);
@@ -2618,6 +3078,17 @@ void generateGeneLevelEstimates(boost::filesystem::path& geneMapPath,
 
   logger->info("There were {} transcripts mapping to {} genes",
                tranGeneMap.numTranscripts(), tranGeneMap.numGenes());
+  return tranGeneMap;
+}
+
+void generateGeneLevelEstimates(
+    boost::filesystem::path& geneMapPath, boost::filesystem::path& estDir,
+    const boost::filesystem::path& geneMapCacheDir) {
+  namespace bfs = boost::filesystem;
+  auto logger = spdlog::get("jointLog");
+  logger->info("Computing gene-level abundance estimates");
+  TranscriptGeneMap tranGeneMap =
+      loadTranscriptGeneMap(geneMapPath, geneMapCacheDir);
 
   bfs::path estFilePath = estDir / "quant.sf";
   if (!bfs::exists(estFilePath)) {
@@ -2648,11 +3119,135 @@ void generateGeneLevelEstimates(boost::filesystem::path& geneMapPath,
   }
   */
 }
+
+std::vector<uint32_t>
+transcriptGeneIDs(TranscriptGeneMap& tranGeneMap,
+                  const std::vector<Transcript>& transcripts,
+                  std::vector<std::string>& geneNames) {
+  auto logger = spdlog::get("jointLog");
+  geneNames.clear();
+  std::vector<uint32_t> txpGene(transcripts.size());
+  std::vector<uint32_t> mapGeneToOutput(tranGeneMap.numGenes(),
+                                        std::numeric_limits<uint32_t>::max());
+  for (size_t i = 0; i < transcripts.size(); ++i) {
+    auto& name = transcripts[i].RefName;
+    auto tid = tranGeneMap.findTranscriptID(name);
+    if (tid == tranGeneMap.INVALID) {
+      logger->warn("couldn't find transcript named [{}] in transcript "
+                   "<-> gene map; "
+                   "returning transcript as it's own gene",
+                   name);
+      txpGene[i] = geneNames.size();
+      geneNames.push_back(name);
+      continue;
+    }
+    auto gid = tranGeneMap.gene(tid);
+    if (mapGeneToOutput[gid] == std::numeric_limits<uint32_t>::max()) {
+      mapGeneToOutput[gid] = geneNames.size();
+      geneNames.push_back(tranGeneMap.nameFromGeneID(gid));
+    }
+    txpGene[i] = mapGeneToOutput[gid];
+  }
+  return txpGene;
+}
+
+std::vector<uint32_t>
+transcriptGeneIDs(boost::filesystem::path& geneMapPath,
+                  const std::vector<Transcript>& transcripts,
+                  const boost::filesystem::path& geneMapCacheDir) {
+  TranscriptGeneMap tranGeneMap =
+      loadTranscriptGeneMap(geneMapPath, geneMapCacheDir);
+  std::vector<std::string> geneNames;
+  return transcriptGeneIDs(tranGeneMap, transcripts, geneNames);
+}
+
+template <typename ExpT>
+void generateGeneLevelEstimates(
+    boost::filesystem::path& geneMapPath, boost::filesystem::path& estDir,
+    ExpT& experiment, const boost::filesystem::path& geneMapCacheDir) {
+  using std::vector;
+  auto logger = spdlog::get("jointLog");
+  logger->info("Computing gene-level abundance estimates");
+  TranscriptGeneMap tranGeneMap =
+      loadTranscriptGeneMap(geneMapPath, geneMapCacheDir);
+
+  constexpr double minTPM = std::numeric_limits<double>::denorm_min();
+  auto& transcripts = experiment.transcripts();
+
+  vector<std::string> geneNames;
+  vector<uint32_t> txpGene =
+      transcriptGeneIDs(tranGeneMap, transcripts, geneNames);
+
+  // The TPMs, exactly as GZipWriter::writeAbundances computes them
+  double tfracDenom{0.0};
+  for (auto& t : transcripts) {
+    tfracDenom += t.projectedCounts / t.EffectiveLength;
+  }
+  double million = 1000000.0;
+
+  size_t numGenes = geneNames.size();
+  vector<double> tpm(numGenes, 0.0), count(numGenes, 0.0);
+  vector<double> tpmLength(numGenes, 0.0), tpmEffLength(numGenes, 0.0);
+  vector<double> sumLength(numGenes, 0.0), sumEffLength(numGenes, 0.0);
+  vector<uint32_t> numTxps(numGenes, 0);
+  for (size_t i = 0; i < transcripts.size(); ++i) {
+    auto& t = transcripts[i];
+    auto g = txpGene[i];
+    double txpTPM =
+        (t.projectedCounts / t.EffectiveLength) / tfracDenom * million;
+    tpm[g] += txpTPM;
+    count[g] += t.projectedCounts;
+    tpmLength[g] += t.CompleteLength * txpTPM;
+    tpmEffLength[g] += t.EffectiveLength * txpTPM;
+    sumLength[g] += t.CompleteLength;
+    sumEffLength[g] += t.EffectiveLength;
+    ++numTxps[g];
+  }
+
+  logger->info("Aggregating expressions to gene level");
+  boost::filesystem::path outputFilePath = estDir / "quant.genes.sf";
+  std::ofstream outFile(outputFilePath.string());
+  outFile << "Name\tLength\tEffectiveLength\tTPM\tNumReads\n";
+  for (size_t g = 0; g < numGenes; ++g) {
+    double geneLength, geneEffLength;
+    // If this gene was expressed, its length is the abundance-weighted mean
+    // of its transcripts' lengths; otherwise, their plain mean.
+    if (tpm[g] > minTPM) {
+      geneLength = tpmLength[g] / tpm[g];
+      geneEffLength = tpmEffLength[g] / tpm[g];
+    } else {
+      geneLength = sumLength[g] / numTxps[g];
+      geneEffLength = sumEffLength[g] / numTxps[g];
+    }
+    outFile << geneNames[g] << '\t' << geneLength << '\t' << geneEffLength
+            << '\t' << tpm[g] << '\t' << count[g] << '\n';
+  }
+  outFile.close();
+  logger->info("done");
+}
 } // namespace utils
 } // namespace salmon
 
 // === Explicit instantiations
 
+template void
+salmon::utils::generateGeneLevelEstimates<AlignmentLibrary<ReadPair>>(
+    boost::filesystem::path& geneMapPath, boost::filesystem::path& estDir,
+    AlignmentLibrary<ReadPair>& alnLib,
+    const boost::filesystem::path& geneMapCacheDir);
+template void
+salmon::utils::generateGeneLevelEstimates<AlignmentLibrary<UnpairedRead>>(
+    boost::filesystem::path& geneMapPath, boost::filesystem::path& estDir,
+    AlignmentLibrary<UnpairedRead>& alnLib,
+    const boost::filesystem::path& geneMapCacheDir);
+template void salmon::utils::generateGeneLevelEstimates<ReadExperiment>(
+    boost::filesystem::path& geneMapPath, boost::filesystem::path& estDir,
+    ReadExperiment& experiment, const boost::filesystem::path& geneMapCacheDir);
+template void salmon::utils::generateGeneLevelEstimates<PartialExperiment>(
+    boost::filesystem::path& geneMapPath, boost::filesystem::path& estDir,
+    PartialExperiment& experiment,
+    const boost::filesystem::path& geneMapCacheDir);
+
 // explicit instantiations for writing abundances ---
 template void salmon::utils::writeAbundances<AlignmentLibrary<ReadPair>>(
     const SalmonOpts& opts, AlignmentLibrary<ReadPair>& alnLib,
@@ -3278,26 +3873,16 @@ txp.uniqueUpdateFraction() < 0.90) {
             auto maxLen = std::min(refLen, fldHigh + 1);
             bool done{fl >= maxLen};
 
-            if (posBiasCorrect) {
-              std::vector<double> posFactorsObs5(refLen, 1.0);
-              std::vector<double> posFactorsObs3(refLen, 1.0);
-              std::vector<double> posFactorsExp5(refLen, 1.0);
-              std::vector<double> posFactorsExp3(refLen, 1.0);
+            if (posBiasCorrect and refLen > K) {
               auto li = txp.lengthClassIndex();
-              auto& p5O = pos5Obs[li];
-              auto& p3O = pos3Obs[li];
-              auto& p5E = pos5Exp[li];
-              auto& p3E = pos3Exp[li];
-              p5O.projectWeights(posFactorsObs5);
-              p3O.projectWeights(posFactorsObs3);
-              p5E.projectWeights(posFactorsExp5);
-              p3E.projectWeights(posFactorsExp3);
-              for (int32_t fragStart = 0; fragStart < refLen - K; ++fragStart) {
-                posFactorsFW[fragStart] =
-                    posFactorsObs5[fragStart] / posFactorsExp5[fragStart];
-                posFactorsRC[fragStart] =
-                    posFactorsObs3[fragStart] / posFactorsExp3[fragStart];
-              }
+              // The positions before refLen - K get the ratio of the
+              // observed to the expected weights; the rest keep 1
+              posFactorsFW.resize(refLen - K);
+              posFactorsRC.resize(refLen - K);
+              pos5Obs[li].projectRatio(pos5Exp[li], refLen, posFactorsFW);
+              pos3Obs[li].projectRatio(pos3Exp[li], refLen, posFactorsRC);
+              posFactorsFW.resize(refLen, 1.0);
+              posFactorsRC.resize(refLen, 1.0);
             }
 
             // Evaluate the sequence specific bias (5' and 3') over the length
@@ -1,5 +1,6 @@
 #include "SimplePosBias.hpp"
 #include "SalmonMath.hpp"
+#include "spline.h"
 #include <algorithm>
 #include <cassert>
 #include <iostream>
@@ -25,14 +26,36 @@ void SimplePosBias::addMass(int32_t pos, int32_t length, double mass) {
   addMass(bin, mass);
 }
 
-// Project, the weights contained in "bins"
-// into the vector @out (using spline interpolation)
-void SimplePosBias::projectWeights(std::vector<double>& out) {
+constexpr int32_t SimplePosBias::tableSize_;
+
+// Project the weights contained in "bins" into the vector @out (by linear
+// interpolation in the table of the spline through them)
+void SimplePosBias::projectWeights(std::vector<double>& out) const {
   auto len = out.size();
+  // table_[k] is at fraction k / tableSize_, so p / len falls at
+  // p * scale in the table
+  double scale = static_cast<double>(tableSize_) / len;
+  const double* t = table_.data();
   for (size_t p = 0; p < len; ++p) {
-    // The fractional sampling factor position p would have
-    double fracP = static_cast<double>(p) / len;
-    out[p] = std::max(0.001, s_(fracP));
+    double x = p * scale;
+    size_t k = static_cast<size_t>(x);
+    double f = x - k;
+    out[p] = t[k] + f * (t[k + 1] - t[k]);
+  }
+}
+
+// out[p] = the weight of this model over that of @expected, at the fraction
+// p / len, for p < out.size()
+void SimplePosBias::projectRatio(const SimplePosBias& expected, int32_t len,
+                                 std::vector<double>& out) const {
+  double scale = static_cast<double>(tableSize_) / len;
+  const double* o = table_.data();
+  const double* e = expected.table_.data();
+  for (size_t p = 0; p < out.size(); ++p) {
+    double x = p * scale;
+    size_t k = static_cast<size_t>(x);
+    double f = x - k;
+    out[p] = (o[k] + f * (o[k + 1] - o[k])) / (e[k] + f * (e[k + 1] - e[k]));
   }
 }
 
@@ -45,6 +68,13 @@ void SimplePosBias::combine(const SimplePosBias& other) {
   }
 }
 
+// Discard the masses added so far
+void SimplePosBias::reset() {
+  std::fill(masses_.begin(), masses_.end(),
+            (isLogged_ ? salmon::math::LOG_1 : 1.0));
+  isFinalized_ = false;
+}
+
 // We're finished updating this distribution, so
 // compute the cdf etc.
 void SimplePosBias::finalize() {
@@ -73,7 +103,15 @@ void SimplePosBias::finalize() {
     splineBins[i + 1] = positionBins_[i] - 0.01;
   }
   splineBins.back() = 1.0;
-  s_.set_points(splineBins, splineMass);
+  tk::spline s;
+  s.set_points(splineBins, splineMass);
+  // One more sample than intervals, so that interpolating at a fraction
+  // just below 1 can read the sample after it
+  table_.resize(tableSize_ + 1);
+  for (int32_t k = 0; k <= tableSize_; ++k) {
+    double x = static_cast<double>(k) / tableSize_;
+    table_[k] = std::max(0.001, s(x));
+  }
   isLogged_ = false;
   isFinalized_ = true;
 }
@@ -97,3 +135,25 @@ bool SimplePosBias::writeBinary(
             sizeof(masses_.front()) * modelLen);
   return true;
 }
+
+bool SimplePosBias::readBinary(boost::iostreams::filtering_istream& in) {
+  uint32_t modelLen{0};
+  in.read(reinterpret_cast<char*>(&modelLen), sizeof(modelLen));
+  if (!in or modelLen != static_cast<uint32_t>(numBins_)) {
+    return false;
+  }
+  std::vector<double> masses(modelLen, 0.0);
+  in.read(reinterpret_cast<char*>(masses.data()),
+          sizeof(masses.front()) * modelLen);
+  if (!in) {
+    return false;
+  }
+  // The written masses are normalized, so finalizing them (again) yields the
+  // same masses and spline as the model that was written
+  for (size_t i = 0; i < masses.size(); ++i) {
+    masses_[i] = (masses[i] > 0.0) ? std::log(masses[i]) : salmon::math::LOG_0;
+  }
+  isLogged_ = true;
+  finalize();
+  return true;
+}
@@ -0,0 +1,59 @@
+#include "ThreadPinning.hpp"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace salmon {
+namespace threads {
+
+#if defined(__linux__)
+namespace {
+bool pinToCpu(pthread_t handle, int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return ::pthread_setaffinity_np(handle, sizeof(set), &set) == 0;
+}
+}
+
+std::vector<int> allowedCpus() {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (::sched_getaffinity(0, sizeof(set), &set) != 0) {
+    return cpus;
+  }
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &set)) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+bool pinThread(std::thread& t, size_t i) {
+  // (computed on every call, as this is done once per thread per round)
+  auto cpus = allowedCpus();
+  if (cpus.empty()) {
+    return false;
+  }
+  return pinToCpu(t.native_handle(), cpus[i % cpus.size()]);
+}
+
+void TBBWorkerPinner::on_scheduler_entry(bool isWorker) {
+  if (!isWorker or cpus_.empty()) {
+    return;
+  }
+  size_t i = next_++;
+  pinToCpu(::pthread_self(), cpus_[i % cpus_.size()]);
+}
+#else
+std::vector<int> allowedCpus() { return std::vector<int>(); }
+bool pinThread(std::thread&, size_t) { return false; }
+void TBBWorkerPinner::on_scheduler_entry(bool) {}
+#endif
+
+} // namespace threads
+} // namespace salmon
@@ -1,28 +1,29 @@
 #include <cstdint>
 #include <vector>
 
-#include "SalmonMath.hpp"
 #include "TranscriptGroup.hpp"
-#include "xxhash.h"
 
-TranscriptGroup::TranscriptGroup() : hash(0) {}
+constexpr uint32_t EqClassLabel::InlineCapacity;
 
-TranscriptGroup::TranscriptGroup(std::vector<uint32_t> txpsIn)
-    : txps(txpsIn), valid(true) {
-  size_t seed{0};
-  hash = XXH64(static_cast<void*>(txps.data()), txps.size() * sizeof(uint32_t),
-               seed);
-}
+TranscriptGroup::TranscriptGroup() : hash(0), valid(true) {}
 
-TranscriptGroup::TranscriptGroup(std::vector<uint32_t> txpsIn, size_t hashIn)
-    : txps(txpsIn), hash(hashIn), valid(true) {}
+TranscriptGroup::TranscriptGroup(const std::vector<uint32_t>& txpsIn)
+    : txps(txpsIn.begin(), txpsIn.end()), valid(true) {
+  hash = txps.hash();
+}
 
-TranscriptGroup::TranscriptGroup(const TranscriptGroup& other) {
-  txps = other.txps;
-  hash = other.hash;
-  valid = other.valid;
+void TranscriptGroup::updateHash() {
+  hash = txps.hash();
+  valid = true;
 }
 
+TranscriptGroup::TranscriptGroup(const std::vector<uint32_t>& txpsIn,
+                                 size_t hashIn)
+    : txps(txpsIn.begin(), txpsIn.end()), hash(hashIn), valid(true) {}
+
+TranscriptGroup::TranscriptGroup(const TranscriptGroup& other)
+    : txps(other.txps), hash(other.hash), valid(other.valid) {}
+
 TranscriptGroup& TranscriptGroup::operator=(const TranscriptGroup& other) {
   txps = other.txps;
   hash = other.hash;
@@ -30,11 +31,8 @@ TranscriptGroup& TranscriptGroup::operator=(const TranscriptGroup& other) {
   return *this;
 }
 
-TranscriptGroup::TranscriptGroup(TranscriptGroup&& other) {
-  txps = std::move(other.txps);
-  hash = other.hash;
-  valid = other.valid;
-}
+TranscriptGroup::TranscriptGroup(TranscriptGroup&& other)
+    : txps(std::move(other.txps)), hash(other.hash), valid(other.valid) {}
 
 void TranscriptGroup::setValid(bool b) const { valid = b; }
 
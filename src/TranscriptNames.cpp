@@ -0,0 +1,120 @@
+#include "TranscriptNames.hpp"
+
+#include <algorithm>
+
+namespace {
+// The (FNV-1a, then mixed) hash of the n bytes of name, in 32 bits
+uint32_t hashName(const char* name, size_t n) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < n; ++i) {
+    h = (h ^ static_cast<unsigned char>(name[i])) * 0x100000001b3ULL;
+  }
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+  return static_cast<uint32_t>(h ^ (h >> 31));
+}
+
+inline uint32_t slotHash(uint64_t slot) {
+  return static_cast<uint32_t>(slot >> 32);
+}
+
+inline uint32_t slotID(uint64_t slot) {
+  return static_cast<uint32_t>(slot) - 1;
+}
+} // namespace
+
+constexpr uint32_t TranscriptNames::npos;
+constexpr size_t TranscriptNames::blockSize_;
+
+void TranscriptNames::reserve(size_t numNames) {
+  names_.reserve(numNames);
+  lengths_.reserve(numNames);
+  if (2 * numNames > slots_.size()) {
+    grow_(2 * numNames);
+  }
+}
+
+uint32_t TranscriptNames::add(const char* name, size_t len) {
+  uint32_t id = static_cast<uint32_t>(names_.size());
+  uint32_t hash = hashName(name, len);
+  names_.push_back(store_(name, len));
+  lengths_.push_back(static_cast<uint32_t>(len));
+  if (2 * names_.size() > slots_.size()) {
+    grow_(2 * names_.size());
+  }
+  if (find_(name, len, hash) == npos) {
+    insert_(id, hash);
+  }
+  return id;
+}
+
+uint32_t TranscriptNames::find(const char* name, size_t len) const {
+  return slots_.empty() ? npos : find_(name, len, hashName(name, len));
+}
+
+uint32_t TranscriptNames::find_(const char* name, size_t len,
+                                uint32_t hash) const {
+  size_t mask = slots_.size() - 1;
+  for (size_t i = hash & mask; slots_[i] != 0; i = (i + 1) & mask) {
+    uint64_t slot = slots_[i];
+    if (slotHash(slot) == hash) {
+      uint32_t id = slotID(slot);
+      if (lengths_[id] == len and std::memcmp(names_[id], name, len) == 0) {
+        return id;
+      }
+    }
+  }
+  return npos;
+}
+
+size_t TranscriptNames::memoryUsage() const {
+  return arenaBytes_ + names_.capacity() * sizeof(const char*) +
+         lengths_.capacity() * sizeof(uint32_t) +
+         slots_.capacity() * sizeof(uint64_t);
+}
+
+const char* TranscriptNames::store_(const char* s, size_t n) {
+  char* dest{nullptr};
+  if (n + 1 > blockSize_ / 4) {
+    // (a very long name gets a block of its own, so as not to waste the
+    // rest of the current one)
+    blocks_.emplace_back(new char[n + 1]);
+    arenaBytes_ += n + 1;
+    dest = blocks_.back().get();
+  } else {
+    if (block_ == nullptr or blockUsed_ + n + 1 > blockSize_) {
+      blocks_.emplace_back(new char[blockSize_]);
+      arenaBytes_ += blockSize_;
+      block_ = blocks_.back().get();
+      blockUsed_ = 0;
+    }
+    dest = block_ + blockUsed_;
+    blockUsed_ += n + 1;
+  }
+  std::memcpy(dest, s, n);
+  dest[n] = '\0';
+  return dest;
+}
+
+void TranscriptNames::insert_(uint32_t id, uint32_t hash) {
+  size_t mask = slots_.size() - 1;
+  size_t i = hash & mask;
+  while (slots_[i] != 0) {
+    i = (i + 1) & mask;
+  }
+  slots_[i] = (static_cast<uint64_t>(hash) << 32) | (uint64_t{id} + 1);
+}
+
+void TranscriptNames::grow_(size_t numSlots) {
+  size_t n = 16;
+  while (n < numSlots) {
+    n <<= 1;
+  }
+  std::vector<uint64_t> old(n, 0);
+  old.swap(slots_);
+  for (auto slot : old) {
+    if (slot != 0) {
+      insert_(slotID(slot), slotHash(slot));
+    }
+  }
+}
@@ -8,11 +8,79 @@
 // file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
 //
 
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
 #include "VersionChecker.hpp"
 #include "SalmonConfig.hpp"
 
 using boost::asio::ip::tcp;
 
+namespace {
+// How long (in seconds) a cached version message is used for
+constexpr std::time_t versionCacheMaxAge = 24 * 60 * 60;
+
+boost::filesystem::path versionCachePath() {
+  namespace bfs = boost::filesystem;
+  bfs::path dir;
+  if (const char* xdg = std::getenv("XDG_CACHE_HOME")) {
+    dir = xdg;
+  } else if (const char* home = std::getenv("HOME")) {
+    dir = bfs::path(home) / ".cache";
+  } else {
+    return bfs::path();
+  }
+  return dir / "salmon" / (std::string("version_info_") + salmon::version);
+}
+
+// The cache is the time of the check, on the first line, then the message
+bool readVersionCache(const boost::filesystem::path& path,
+                      std::string& message) {
+  std::ifstream ifs(path.string());
+  std::time_t checked{0};
+  if (!(ifs >> checked)) {
+    return false;
+  }
+  std::time_t now = std::time(nullptr);
+  if (now < checked or now - checked > versionCacheMaxAge) {
+    return false;
+  }
+  ifs.ignore(1);
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  message = ss.str();
+  return true;
+}
+
+void writeVersionCache(const boost::filesystem::path& path,
+                       const std::string& message) {
+  namespace bfs = boost::filesystem;
+  boost::system::error_code ec;
+  bfs::create_directories(path.parent_path(), ec);
+  // Write a private file and rename it, so that concurrent runs never see
+  // a partial cache
+  bfs::path tmp = path;
+  tmp += "." + std::to_string(::getpid());
+  {
+    std::ofstream ofs(tmp.string());
+    ofs << std::time(nullptr) << '\n' << message;
+    if (!ofs.good()) {
+      bfs::remove(tmp, ec);
+      return;
+    }
+  }
+  bfs::rename(tmp, path, ec);
+}
+} // namespace
+
 VersionChecker::VersionChecker(boost::asio::io_service& io_service,
                                const std::string& server,
                                const std::string& path)
@@ -187,3 +255,38 @@ std::string getVersionMessage() {
 
   return ss.str();
 }
+
+std::string cachedVersionMessage() {
+  auto cachePath = versionCachePath();
+  if (cachePath.empty()) {
+    return "";
+  }
+  std::string message;
+  if (readVersionCache(cachePath, message)) {
+    return message;
+  }
+
+  // Refresh the cache from a grandchild (re-parented to init, so nobody has
+  // to wait for it), forked while we're still single-threaded.  It keeps
+  // none of our standard streams open, so it can't hold up a pipe that
+  // salmon writes to.
+  pid_t pid = ::fork();
+  if (pid == 0) {
+    if (::fork() == 0) {
+      ::setsid();
+      int devNull = ::open("/dev/null", O_RDWR);
+      if (devNull >= 0) {
+        ::dup2(devNull, STDIN_FILENO);
+        ::dup2(devNull, STDOUT_FILENO);
+        ::dup2(devNull, STDERR_FILENO);
+      }
+      // A failed check is cached too, so that a node without network access
+      // only tries once a day
+      writeVersionCache(cachePath, getVersionMessage());
+    }
+    ::_exit(0);
+  } else if (pid > 0) {
+    ::waitpid(pid, nullptr, 0);
+  }
+  return "";
+}
@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "AlignmentCollator.hpp"
+
+// Coordinate-sorted alignments: mates paired as they come, and the
+// alignments of each read gathered by name (spilling what doesn't fit)
+
+namespace {
+struct TestRec {
+  std::string name;
+  int32_t ref, pos, mateRef, matePos;
+  int32_t id;
+};
+
+struct TestRecTraits {
+  static const char* name(const TestRec* r) { return r->name.c_str(); }
+  static int32_t ref(const TestRec* r) { return r->ref; }
+  static int32_t pos(const TestRec* r) { return r->pos; }
+  static int32_t mateRef(const TestRec* r) { return r->mateRef; }
+  static int32_t matePos(const TestRec* r) { return r->matePos; }
+  static size_t bytes(const TestRec* r) {
+    return sizeof(TestRec) + r->name.size();
+  }
+  static void write(std::ostream& os, const TestRec* r) {
+    uint32_t n = static_cast<uint32_t>(r->name.size());
+    os.write(reinterpret_cast<const char*>(&n), sizeof(n));
+    os.write(r->name.data(), n);
+    os.write(reinterpret_cast<const char*>(&r->ref), 5 * sizeof(int32_t));
+  }
+  static TestRec* read(std::istream& is) {
+    uint32_t n{0};
+    is.read(reinterpret_cast<char*>(&n), sizeof(n));
+    TestRec* r = new TestRec;
+    r->name.resize(n);
+    is.read(&r->name[0], n);
+    is.read(reinterpret_cast<char*>(&r->ref), 5 * sizeof(int32_t));
+    return r;
+  }
+  static void destroy(TestRec* r) { delete r; }
+};
+
+using Pairer = salmon::collate::MatePairer<TestRec, TestRecTraits>;
+using Grouper = salmon::collate::ReadGrouper<TestRec, TestRecTraits>;
+using TestFrag = salmon::collate::Frag<TestRec>;
+
+struct PairSink {
+  std::vector<std::pair<int32_t, int32_t>> pairs;
+  std::vector<int32_t> singles;
+  void pair(TestRec* a, TestRec* b) {
+    pairs.emplace_back(a->id, b->id);
+    delete a;
+    delete b;
+  }
+  void single(TestRec* r) {
+    singles.push_back(r->id);
+    delete r;
+  }
+};
+}
+
+SCENARIO("Mates of coordinate-sorted pairs are found as they come") {
+
+    GIVEN("A read aligned as two pairs, and a record whose mate is missing") {
+      // (name, ref, pos, mate ref, mate pos, id), sorted by coordinate
+      std::vector<TestRec> recs{{"r1", 0, 100, 0, 300, 1},
+                                {"r2", 0, 150, 0, 200, 2},
+                                {"r1", 0, 160, 0, 400, 3},
+                                {"r2", 0, 200, 0, 150, 4},
+                                {"r1", 0, 300, 0, 100, 5},
+                                {"r1", 0, 400, 0, 160, 6},
+                                {"r3", 1, 50, 1, 90, 7},
+                                {"r4", 1, 60, 1, 70, 8},
+                                {"r4", 1, 70, 1, 60, 9}};
+
+      WHEN("They are paired") {
+        Pairer pairer(1000);
+        PairSink sink;
+        for (auto& r : recs) {
+          pairer.add(new TestRec(r), r.name.data(), r.name.size(), sink);
+        }
+        pairer.flush(sink);
+
+        THEN("Each record is paired with its own mate") {
+          std::vector<std::pair<int32_t, int32_t>> expected{
+              {2, 4}, {1, 5}, {3, 6}, {8, 9}};
+          REQUIRE(sink.pairs == expected);
+          // r3's mate never came
+          REQUIRE(sink.singles == std::vector<int32_t>{7});
+          REQUIRE(pairer.numPending() == 0);
+          REQUIRE(pairer.pendingBytes() == 0);
+        }
+      }
+
+      WHEN("At most one record may wait") {
+        Pairer pairer(1);
+        PairSink sink;
+        for (auto& r : recs) {
+          pairer.add(new TestRec(r), r.name.data(), r.name.size(), sink);
+        }
+        pairer.flush(sink);
+
+        THEN("Every record is handed back once, paired or not") {
+          REQUIRE(2 * sink.pairs.size() + sink.singles.size() == recs.size());
+          REQUIRE(pairer.numUnpaired() == sink.singles.size());
+        }
+      }
+    }
+}
+
+SCENARIO("The alignments of each read are gathered by name") {
+
+    GIVEN("Thousands of reads, with their alignments shuffled") {
+      std::mt19937 gen(7);
+      std::vector<TestRec> recs;
+      std::map<std::string, int32_t> numHits;
+      for (int32_t i = 0; i < 3000; ++i) {
+        std::string name = "read" + std::to_string(i);
+        int32_t n = 1 + gen() % 4;
+        numHits[name] = n;
+        for (int32_t k = 0; k < n; ++k) {
+          recs.push_back(TestRec{name, k, 0, -1, -1,
+                                 static_cast<int32_t>(recs.size())});
+        }
+      }
+      std::shuffle(recs.begin(), recs.end(), gen);
+
+      // Gathers the alignment ids that the grouper hands out, by read
+      struct GroupSink {
+        std::map<std::string, std::vector<int32_t>> reads;
+        size_t numDuplicates{0};
+        void operator()(std::vector<TestFrag>& frags) {
+          auto& ids = reads[frags.front().first->name];
+          numDuplicates += ids.empty() ? 0 : 1;
+          for (auto& f : frags) {
+            ids.push_back(f.first->id);
+            delete f.first;
+          }
+        }
+      };
+
+      auto check = [&](GroupSink& sink) {
+        REQUIRE(sink.numDuplicates == 0);
+        REQUIRE(sink.reads.size() == numHits.size());
+        size_t total{0};
+        for (auto& kv : sink.reads) {
+          size_t n = static_cast<size_t>(numHits[kv.first]);
+          REQUIRE(kv.second.size() == n);
+          total += kv.second.size();
+        }
+        REQUIRE(total == recs.size());
+      };
+
+      WHEN("They're gathered in memory, with their NH") {
+        Grouper grouper(uint64_t{1} << 30);
+        GroupSink sink;
+        for (auto& r : recs) {
+          TestFrag f;
+          f.first = new TestRec(r);
+          grouper.add(r.name.data(), r.name.size(), numHits[r.name], f, sink);
+        }
+
+        THEN("Each read is handed out once all its alignments are seen") {
+          REQUIRE(grouper.numPending() == 0);
+          REQUIRE(grouper.finish(sink));
+          check(sink);
+          REQUIRE(grouper.numSpills() == 0);
+        }
+      }
+
+      WHEN("They're gathered within 16 KB, spilling the rest") {
+        std::string spillPath = "collate_spill_test.bin";
+        Grouper grouper(16 * 1024);
+        REQUIRE(grouper.spillTo(spillPath));
+        GroupSink sink;
+        for (auto& r : recs) {
+          TestFrag f;
+          f.first = new TestRec(r);
+          grouper.add(r.name.data(), r.name.size(), numHits[r.name], f, sink);
+        }
+        bool merged = grouper.finish(sink);
+
+        THEN("Each read is still handed out once, with all its alignments") {
+          REQUIRE(merged);
+          REQUIRE(grouper.numSpills() > 1);
+          check(sink);
+          // finish() removes the spill file
+          REQUIRE(std::fopen(spillPath.c_str(), "rb") == nullptr);
+        }
+      }
+
+      WHEN("They're gathered without NH, spilling the rest") {
+        std::string spillPath = "collate_spill_test.bin";
+        Grouper grouper(16 * 1024);
+        REQUIRE(grouper.spillTo(spillPath));
+        GroupSink sink;
+        for (auto& r : recs) {
+          TestFrag f;
+          f.first = new TestRec(r);
+          grouper.add(r.name.data(), r.name.size(), 0, f, sink);
+        }
+        REQUIRE(sink.reads.empty());
+        bool merged = grouper.finish(sink);
+
+        THEN("Every read is handed out by finish()") {
+          REQUIRE(merged);
+          check(sink);
+        }
+      }
+    }
+}
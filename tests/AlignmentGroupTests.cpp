@@ -0,0 +1,67 @@
+#include <cstdint>
+#include <vector>
+#include "AlignmentGroup.hpp"
+
+// The hit buffers of the alignment groups, which are reused for fragment
+// after fragment: a run of highly multi-mapping fragments keeps the buffer
+// it grew, which shrinks back (to the retained size, not to nothing) only
+// once enough small fragments in a row have followed.
+
+namespace {
+struct TestHit {
+  int32_t txp;
+  int32_t transcriptID() const { return txp; }
+};
+
+// Give the group a fragment of n hits, and then clear it
+void mapFragment(AlignmentGroup<TestHit*>& group, std::vector<TestHit>& hits,
+                 size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    TestHit* h = &hits[i];
+    group.addAlignment(h);
+  }
+  group.clearAlignments();
+}
+} // namespace
+
+SCENARIO("A reused alignment group keeps the room its fragments need") {
+
+    using Group = AlignmentGroup<TestHit*>;
+    size_t maxKept = Group::maxRetainedAlignments;
+    uint32_t shrinkAfter = Group::shrinkAfterClears;
+    std::vector<TestHit> hits(1000, TestHit{1});
+
+    GIVEN("Large fragments mixed with fewer small ones in between") {
+      Group group;
+      mapFragment(group, hits, 1000);
+      size_t grown = group.alignments().capacity();
+      for (size_t i = 0; i < 10; ++i) {
+        for (uint32_t j = 0; j + 1 < shrinkAfter; ++j) {
+          mapFragment(group, hits, 3);
+        }
+        mapFragment(group, hits, 500);
+      }
+      THEN("the grown buffer is kept") {
+          REQUIRE(grown >= 1000);
+          REQUIRE(group.alignments().capacity() == grown);
+          REQUIRE(group.numAlignments() == 0);
+      }
+    }
+
+    GIVEN("A large fragment followed by a run of small ones") {
+      Group group;
+      mapFragment(group, hits, 1000);
+      for (uint32_t j = 0; j < shrinkAfter; ++j) {
+        mapFragment(group, hits, 5);
+      }
+      size_t shrunk = group.alignments().capacity();
+      mapFragment(group, hits, maxKept);
+      for (uint32_t j = 0; j < 2 * shrinkAfter; ++j) {
+        mapFragment(group, hits, 5);
+      }
+      THEN("the buffer shrinks to the retained size, and no further") {
+          REQUIRE(shrunk == maxKept);
+          REQUIRE(group.alignments().capacity() == maxKept);
+      }
+    }
+}
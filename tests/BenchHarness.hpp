@@ -0,0 +1,145 @@
+#ifndef BENCH_HARNESS_HPP
+#define BENCH_HARNESS_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cereal/archives/json.hpp"
+#include "cereal/types/string.hpp"
+#include "cereal/types/vector.hpp"
+
+#include "spdlog/fmt/fmt.h"
+
+/**
+ * A minimal harness for the micro-benchmarks of salmon-bench (Catch 1.x,
+ * which the unit tests use, has no benchmarking support).  Each benchmark
+ * is a function that does a fixed amount of work (with fixed seeds, so runs
+ * are reproducible); it's run once to warm up, and then timed over a number
+ * of repetitions.  The results are printed and, with --json, written to a
+ * file so that they can be compared from one build to the next.
+ *
+ * Usage: salmon-bench [--filter <substring>] [--reps <n>] [--json <file>]
+ */
+namespace salmon {
+namespace bench {
+
+struct Result {
+  std::string name;
+  uint32_t reps{0};
+  // the number of items (reads, classes, calls ...) processed per repetition
+  uint64_t items{0};
+  double minSec{0.0};
+  double medianSec{0.0};
+  double meanSec{0.0};
+
+  template <typename Archive> void serialize(Archive& ar) {
+    double itemsPerSec = (medianSec > 0.0) ? (items / medianSec) : 0.0;
+    ar(cereal::make_nvp("name", name), cereal::make_nvp("reps", reps),
+       cereal::make_nvp("items", items),
+       cereal::make_nvp("min_sec", minSec),
+       cereal::make_nvp("median_sec", medianSec),
+       cereal::make_nvp("mean_sec", meanSec),
+       cereal::make_nvp("items_per_sec", itemsPerSec));
+  }
+};
+
+class Runner {
+public:
+  Runner(int argc, char* argv[]) {
+    for (int i = 1; i < argc; ++i) {
+      std::string arg(argv[i]);
+      bool hasValue = (i + 1 < argc);
+      if (arg == "--filter" and hasValue) {
+        filter_ = argv[++i];
+      } else if (arg == "--reps" and hasValue) {
+        reps_ = std::max(1, std::atoi(argv[++i]));
+      } else if (arg == "--json" and hasValue) {
+        jsonPath_ = argv[++i];
+      } else {
+        std::cerr << "usage: " << argv[0]
+                  << " [--filter <substring>] [--reps <n>] [--json <file>]\n";
+        std::exit(1);
+      }
+    }
+  }
+
+  // Whether the benchmark name is selected (so its setup is worth doing)
+  bool selected(const std::string& name) const {
+    return filter_.empty() or name.find(filter_) != std::string::npos;
+  }
+
+  /**
+   * Time fn, which processes items items each time it's called.
+   */
+  void run(const std::string& name, uint64_t items,
+           const std::function<void()>& fn) {
+    if (!selected(name)) {
+      return;
+    }
+    fn();
+    std::vector<double> times;
+    for (int r = 0; r < reps_; ++r) {
+      auto start = std::chrono::steady_clock::now();
+      fn();
+      std::chrono::duration<double> t =
+          std::chrono::steady_clock::now() - start;
+      times.push_back(t.count());
+    }
+    std::sort(times.begin(), times.end());
+    Result res;
+    res.name = name;
+    res.reps = reps_;
+    res.items = items;
+    res.minSec = times.front();
+    res.medianSec = times[times.size() / 2];
+    double sum{0.0};
+    for (auto t : times) {
+      sum += t;
+    }
+    res.meanSec = sum / times.size();
+    fmt::print("{:<44} {:>12.6f}s {:>14.1f} items/s\n", name, res.medianSec,
+               (res.medianSec > 0.0) ? (items / res.medianSec) : 0.0);
+    results_.push_back(res);
+  }
+
+  // Write the results, if asked to; returns the exit code
+  int finish() {
+    if (jsonPath_.empty()) {
+      return 0;
+    }
+    std::ofstream ofs(jsonPath_);
+    if (!ofs.good()) {
+      std::cerr << "couldn't write " << jsonPath_ << "\n";
+      return 1;
+    }
+    {
+      cereal::JSONOutputArchive oa(ofs);
+      oa(cereal::make_nvp("benchmarks", results_));
+    }
+    return 0;
+  }
+
+private:
+  std::string filter_;
+  int reps_{5};
+  std::string jsonPath_;
+  std::vector<Result> results_;
+};
+
+// Keep the compiler from optimizing away a result that's otherwise unused
+template <typename T> inline void doNotOptimize(const T& v) {
+  asm volatile("" : : "g"(&v) : "memory");
+}
+
+} // namespace bench
+} // namespace salmon
+
+#endif // BENCH_HARNESS_HPP
@@ -0,0 +1,308 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "spdlog/spdlog.h"
+
+#include "BenchHarness.hpp"
+#include "EMKernels.hpp"
+#include "EquivalenceClassBuilder.hpp"
+#include "FastxParser.hpp"
+#include "FragmentLengthDistribution.hpp"
+#include "GammaSampler.hpp"
+#include "MultinomialSampler.hpp"
+#include "SBModel.hpp"
+#include "SalmonMath.hpp"
+#include "TranscriptGroup.hpp"
+
+/**
+ * The micro-benchmarks of salmon's hot kernels (see BenchHarness.hpp).
+ * The inputs are synthetic and generated from fixed seeds.
+ */
+namespace {
+
+using salmon::bench::Runner;
+using salmon::bench::doNotOptimize;
+
+std::string randomSeq(std::mt19937& gen, size_t len) {
+  static const char bases[] = "ACGT";
+  std::string s(len, 'A');
+  for (auto& c : s) {
+    c = bases[gen() & 3];
+  }
+  return s;
+}
+
+// Parse a FASTQ file of numReads 100bp reads with a single consumer
+void benchFastxParser(Runner& runner) {
+  const std::string name = "FastxParser/refill_fastq";
+  if (!runner.selected(name)) {
+    return;
+  }
+  namespace bfs = boost::filesystem;
+  size_t numReads = 500000;
+  bfs::path fastq = bfs::temp_directory_path() /
+                    bfs::unique_path("salmon-bench-%%%%-%%%%.fastq");
+  {
+    std::mt19937 gen(42);
+    std::ofstream ofs(fastq.string());
+    std::string qual(100, 'I');
+    for (size_t i = 0; i < numReads; ++i) {
+      ofs << "@read" << i << '\n'
+          << randomSeq(gen, 100) << "\n+\n"
+          << qual << '\n';
+    }
+  }
+
+  runner.run(name, numReads, [&]() -> void {
+    fastx_parser::FastxParser<fastx_parser::ReadSpanSeq> parser(
+        {fastq.string()}, 1, 1);
+    parser.start();
+    auto rg = parser.getReadGroup();
+    uint64_t bases{0};
+    while (parser.refill(rg)) {
+      for (auto& r : rg) {
+        bases += r.seq.size();
+      }
+    }
+    parser.stop();
+    doNotOptimize(bases);
+  });
+  boost::system::error_code ec;
+  bfs::remove(fastq, ec);
+}
+
+// Threads adding (mostly recurring) classes to one builder at once
+void benchEqClassBuilder(Runner& runner) {
+  uint32_t numThreads =
+      std::max(2u, std::min(16u, std::thread::hardware_concurrency()));
+  const std::string name =
+      "EquivalenceClassBuilder/addGroup_" + std::to_string(numThreads) + "t";
+  if (!runner.selected(name)) {
+    return;
+  }
+  size_t numClasses = 20000;
+  size_t addsPerThread = 200000;
+  std::mt19937 gen(42);
+  std::vector<std::vector<uint32_t>> classes(numClasses);
+  for (auto& c : classes) {
+    size_t n = 1 + gen() % 6;
+    for (size_t i = 0; i < n; ++i) {
+      c.push_back(gen() % 100000);
+    }
+    std::sort(c.begin(), c.end());
+    c.erase(std::unique(c.begin(), c.end()), c.end());
+  }
+  auto log = spdlog::stderr_logger_mt("bench");
+  EquivalenceClassBuilder builder(log);
+  builder.start();
+
+  runner.run(name, numThreads * addsPerThread, [&]() -> void {
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < numThreads; ++t) {
+      threads.emplace_back([&, t]() -> void {
+        std::mt19937 tgen(t);
+        for (size_t i = 0; i < addsPerThread; ++i) {
+          auto& c = classes[tgen() % numClasses];
+          std::vector<double> weights(c.size(), 1.0 / c.size());
+          builder.addGroup(TranscriptGroup(c), weights);
+        }
+      });
+    }
+    for (auto& th : threads) {
+      th.join();
+    }
+  });
+  spdlog::drop("bench");
+}
+
+/**
+ * One (VB)EM iteration over flat equivalence classes, as the optimizer's
+ * (file-local) EMUpdate_ / VBEMUpdate_ compute it with the EM kernels.
+ */
+void benchEMIteration(Runner& runner) {
+  if (!runner.selected("EM/em_iteration") and
+      !runner.selected("EM/vbem_iteration")) {
+    return;
+  }
+  size_t numTxps = 200000;
+  size_t numClasses = 500000;
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<> unif(0.01, 1.0);
+  std::vector<uint64_t> offsets{0};
+  std::vector<uint32_t> txps;
+  std::vector<double> aux;
+  std::vector<double> counts;
+  for (size_t c = 0; c < numClasses; ++c) {
+    size_t n = 1 + (gen() % 8);
+    double norm{0.0};
+    for (size_t i = 0; i < n; ++i) {
+      txps.push_back(gen() % numTxps);
+      aux.push_back(unif(gen));
+      norm += aux.back();
+    }
+    for (size_t i = aux.size() - n; i < aux.size(); ++i) {
+      aux[i] /= norm;
+    }
+    offsets.push_back(txps.size());
+    counts.push_back(1 + gen() % 50);
+  }
+  std::vector<double> alphas(numTxps), alphasOut(numTxps), expTheta(numTxps),
+      priors(numTxps, 0.01);
+  for (auto& a : alphas) {
+    a = unif(gen) * 100.0;
+  }
+
+  auto emStep = [&](const std::vector<double>& weightsIn) -> void {
+    for (size_t c = 0; c < numClasses; ++c) {
+      const uint32_t* t = txps.data() + offsets[c];
+      const double* w = aux.data() + offsets[c];
+      size_t n = offsets[c + 1] - offsets[c];
+      double denom =
+          salmon::emkernels::gatherDot(weightsIn.data(), t, w, n);
+      if (denom <= 0.0) {
+        continue;
+      }
+      double invDenom = counts[c] / denom;
+      for (size_t i = 0; i < n; ++i) {
+        alphasOut[t[i]] += weightsIn[t[i]] * w[i] * invDenom;
+      }
+    }
+  };
+
+  runner.run("EM/em_iteration", numClasses, [&]() -> void {
+    std::fill(alphasOut.begin(), alphasOut.end(), 0.0);
+    emStep(alphas);
+    doNotOptimize(alphasOut[0]);
+  });
+
+  runner.run("EM/vbem_iteration", numClasses, [&]() -> void {
+    double alphaSum{0.0};
+    for (size_t i = 0; i < numTxps; ++i) {
+      alphaSum += alphas[i] + priors[i];
+    }
+    double logNorm = salmon::emkernels::digamma(alphaSum);
+    salmon::emkernels::expDigamma(alphas.data(), priors.data(), logNorm,
+                                  1e-8, expTheta.data(), alphasOut.data(),
+                                  numTxps);
+    emStep(expTheta);
+    doNotOptimize(alphasOut[0]);
+  });
+}
+
+void benchMultinomialSampler(Runner& runner) {
+  const std::string name = "MultinomialSampler/draw";
+  if (!runner.selected(name)) {
+    return;
+  }
+  size_t k = 200000;
+  uint64_t n = 50000000;
+  std::mt19937 gen(42);
+  std::vector<double> probs(k);
+  for (auto& p : probs) {
+    p = static_cast<double>(gen() % 1000);
+  }
+  std::vector<uint64_t> sample(k);
+  MultinomialSampler ms(42, 1);
+  runner.run(name, k, [&]() -> void {
+    ms.seed(42, 1);
+    ms(sample.begin(), n, k, probs.begin());
+    doNotOptimize(sample[0]);
+  });
+}
+
+// The transcript fractions of a Gibbs round over 200k transcripts
+void benchGammaSampler(Runner& runner) {
+  const std::string name = "GammaSampler/draw";
+  if (!runner.selected(name)) {
+    return;
+  }
+  size_t k = 200000;
+  std::mt19937 gen(42);
+  std::vector<uint32_t> ids(k);
+  std::vector<double> shapes(k);
+  std::vector<double> scales(k);
+  for (size_t i = 0; i < k; ++i) {
+    ids[i] = static_cast<uint32_t>(i);
+    shapes[i] = 1e-4 * (gen() % 2000) + static_cast<double>(gen() % 1000);
+    scales[i] = 1.0 / (0.1 + 100.0 + gen() % 5000);
+  }
+  std::vector<double> mus(k);
+  uint64_t round{0};
+  runner.run(name, k, [&]() -> void {
+    GammaSampler gs(round++);
+    gs(ids.data(), shapes.data(), scales.data(), mus.data(), k);
+    doNotOptimize(mus[0]);
+  });
+}
+
+void benchSBModel(Runner& runner) {
+  const std::string name = "SBModel/evaluateLog";
+  if (!runner.selected(name)) {
+    return;
+  }
+  std::mt19937 gen(42);
+  std::string seq = randomSeq(gen, 1000000);
+  SBModel model;
+  size_t contextLen = model.getContextLength();
+  for (size_t i = 0; i + contextLen < seq.size(); i += 7) {
+    model.addSequence(seq.data() + i, false);
+  }
+  model.normalize();
+  size_t numPositions = seq.size() - contextLen;
+  runner.run(name, numPositions, [&]() -> void {
+    double sum{0.0};
+    for (size_t i = 0; i < numPositions; ++i) {
+      sum += model.evaluateLog(seq.data() + i);
+    }
+    doNotOptimize(sum);
+  });
+}
+
+void benchFragLengthDist(Runner& runner) {
+  if (!runner.selected("FragmentLengthDistribution/addVal") and
+      !runner.selected("FragmentLengthDistribution/pmf")) {
+    return;
+  }
+  size_t numObs = 2000000;
+  std::mt19937 gen(42);
+  std::normal_distribution<> lens(250.0, 25.0);
+  std::vector<size_t> obs(numObs);
+  for (auto& o : obs) {
+    o = static_cast<size_t>(std::max(1.0, lens(gen)));
+  }
+  FragmentLengthDistribution fld(1.0, 1000, 250, 25, 4, 0.5, 1);
+  runner.run("FragmentLengthDistribution/addVal", numObs, [&]() -> void {
+    for (auto o : obs) {
+      fld.addVal(o, salmon::math::LOG_1);
+    }
+  });
+  runner.run("FragmentLengthDistribution/pmf", numObs, [&]() -> void {
+    double sum{0.0};
+    for (auto o : obs) {
+      sum += fld.pmf(o);
+    }
+    doNotOptimize(sum);
+  });
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  Runner runner(argc, argv);
+  benchFastxParser(runner);
+  benchEqClassBuilder(runner);
+  benchEMIteration(runner);
+  benchMultinomialSampler(runner);
+  benchGammaSampler(runner);
+  benchSBModel(runner);
+  benchFragLengthDist(runner);
+  return runner.finish();
+}
@@ -0,0 +1,60 @@
+#include <string>
+#include <vector>
+#include "CellEquivalenceClasses.hpp"
+
+SCENARIO("Per-cell equivalence classes count distinct UMIs") {
+
+    GIVEN("The reads of two cells, from two threads") {
+      CellEquivalenceClasses cells;
+      CellEquivalenceClasses::Local first, second;
+      std::vector<uint32_t> unique{0};
+      std::vector<uint32_t> shared{0, 1};
+      uint64_t umiA, umiB;
+      REQUIRE(CellEquivalenceClasses::encodeUMI("ACGTAC", 6, umiA));
+      REQUIRE(CellEquivalenceClasses::encodeUMI("acgtag", 6, umiB));
+      REQUIRE(!CellEquivalenceClasses::encodeUMI("ACGNAC", 6, umiB));
+
+      auto c0 = cells.cellID("AAAA", 4);
+      auto c1 = cells.cellID("CCCC", 4);
+      auto u = cells.eqClassID(unique);
+      auto s = cells.eqClassID(shared);
+      // cell 0: two reads with the same UMI, one with another (all unique);
+      // cell 1: 3 UMIs of the shared class, and one of the unique one
+      first.add(c0, u, umiA);
+      first.add(c0, u, umiA);
+      second.add(c0, u, umiB);
+      second.add(c1, s, umiA);
+      first.add(c1, s, umiB);
+      first.add(c1, s, umiB + 1);
+      second.add(c1, u, umiA);
+      cells.merge(first);
+      cells.merge(second);
+      cells.finish();
+
+      THEN("The ids are dense, and the UMIs are deduplicated per class") {
+        REQUIRE(cells.cellID("AAAA", 4) == c0);
+        REQUIRE(cells.eqClassID(shared) == s);
+        REQUIRE(cells.numCells() == 2);
+        REQUIRE(cells.numEqClasses() == 2);
+        REQUIRE(cells.numRecords() == 7);
+        REQUIRE(cells.numCellClasses() == 3);
+        REQUIRE(cells.cellUMIs(c0) == 2);
+        REQUIRE(cells.cellUMIs(c1) == 4);
+      }
+
+      WHEN("Each cell is quantified") {
+        auto est = cells.quantify(3, 1e-6, 10000);
+        THEN("Only the cells with enough UMIs get (all of their) counts") {
+          REQUIRE(est[c0].empty());
+          double total{0.0};
+          for (auto& e : est[c1]) {
+            total += e.second;
+          }
+          REQUIRE(total == Approx(4.0));
+          // the unique UMI draws the shared ones to transcript 0
+          REQUIRE(est[c1].front().first == 0);
+          REQUIRE(est[c1].front().second == Approx(4.0).epsilon(0.01));
+        }
+      }
+    }
+}
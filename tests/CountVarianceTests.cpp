@@ -0,0 +1,74 @@
+#include <cstdint>
+#include <vector>
+#include "CountVariance.hpp"
+#include "EqClassPartition.hpp"
+#include "FlatEquivalenceClasses.hpp"
+
+// --approxVariance: the delta-method variances of the counts
+
+SCENARIO("Delta-method count variances follow the observed information") {
+
+    GIVEN("A lone transcript, a confounded pair, and an indistinguishable "
+          "pair, at their EM estimates") {
+      struct Class {
+        std::vector<uint32_t> txps;
+        uint64_t count;
+      };
+      std::vector<Class> classes{{{0}, 100}, {{1}, 30},     {{2}, 10},
+                                 {{1, 2}, 40}, {{3, 4}, 50}};
+      FlatEquivalenceClasses eqClasses;
+      eqClasses.offsets.push_back(0);
+      for (auto& c : classes) {
+        eqClasses.txps.insert(eqClasses.txps.end(), c.txps.begin(),
+                              c.txps.end());
+        eqClasses.weights.insert(eqClasses.weights.end(), c.txps.size(), 1.0);
+        eqClasses.offsets.push_back(eqClasses.txps.size());
+        eqClasses.counts.push_back(c.count);
+        eqClasses.valid.push_back(1);
+      }
+      eqClasses.combinedWeights = eqClasses.weights;
+      // the fixed point of the EM: a1 = 30 + 40 a1 / (a1 + a2), etc.
+      std::vector<double> alphas{100.0, 60.0, 20.0, 25.0, 25.0};
+      EqClassPartition partition;
+      partition.build(eqClasses, alphas.size(), 1);
+
+      // the inverse of the pair's 2x2 information
+      double i11 = 30.0 / (60.0 * 60.0) + 40.0 / (80.0 * 80.0);
+      double i22 = 10.0 / (20.0 * 20.0) + 40.0 / (80.0 * 80.0);
+      double i12 = 40.0 / (80.0 * 80.0);
+      double det = i11 * i22 - i12 * i12;
+
+      WHEN("The components are inverted") {
+        salmon::variance::VarianceStats stats;
+        auto var = salmon::variance::countVariances(partition, alphas, 8,
+                                                    stats);
+        THEN("The lone transcript has its Poisson variance, the pair the "
+             "inverse of its information, and the others the cap") {
+          REQUIRE(stats.numComponents == 3);
+          REQUIRE(stats.numDense == 3);
+          REQUIRE(stats.numConditional == 0);
+          REQUIRE(var[0] == Approx(100.0));
+          REQUIRE(var[1] == Approx(i22 / det));
+          REQUIRE(var[2] == Approx(i11 / det));
+          REQUIRE(var[3] == Approx(50.0 + 0.25 * 50.0 * 50.0));
+          REQUIRE(var[4] == var[3]);
+        }
+      }
+
+      WHEN("The components are too big to invert") {
+        salmon::variance::VarianceStats stats;
+        auto var = salmon::variance::countVariances(partition, alphas, 1,
+                                                    stats);
+        THEN("The transcripts of the pairs get their conditional "
+             "variances") {
+          REQUIRE(stats.numDense == 1);
+          REQUIRE(stats.numConditional == 4);
+          REQUIRE(var[0] == Approx(100.0));
+          REQUIRE(var[1] == Approx(1.0 / i11));
+          REQUIRE(var[2] == Approx(1.0 / i22));
+          REQUIRE(var[1] < i22 / det);
+          REQUIRE(var[3] == Approx(1.0 / (50.0 / (50.0 * 50.0))));
+        }
+      }
+    }
+}
@@ -0,0 +1,93 @@
+#include <random>
+#include <string>
+#include <vector>
+#include <boost/math/special_functions/digamma.hpp>
+#include "EMKernels.hpp"
+
+SCENARIO("EM kernels agree with the reference computations") {
+
+    GIVEN("Random abundances and equivalence class weights") {
+      std::mt19937 gen(42);
+      std::uniform_real_distribution<> unif(0.0, 1.0);
+      std::vector<double> alphas(10000);
+      for (auto& a : alphas) { a = unif(gen); }
+
+      WHEN("Computing the weighted sum over classes of every size") {
+        for (size_t n = 0; n < 40; ++n) {
+          std::vector<uint32_t> txps(n);
+          std::vector<double> aux(n);
+          double expected{0.0};
+          for (size_t i = 0; i < n; ++i) {
+            txps[i] = gen() % alphas.size();
+            aux[i] = unif(gen);
+            expected += alphas[txps[i]] * aux[i];
+          }
+          double got = salmon::emkernels::gatherDot(alphas.data(), txps.data(),
+                                                    aux.data(), n);
+          THEN("The " + std::string(salmon::emkernels::gatherDotImpl()) +
+               " kernel matches the scalar sum") {
+            REQUIRE(got == Approx(expected).epsilon(1e-12));
+          }
+        }
+      }
+
+      WHEN("Computing the weighted sum with single-precision weights") {
+        for (size_t n = 0; n < 40; ++n) {
+          std::vector<uint32_t> txps(n);
+          std::vector<float> aux(n);
+          double expected{0.0};
+          for (size_t i = 0; i < n; ++i) {
+            txps[i] = gen() % alphas.size();
+            aux[i] = static_cast<float>(unif(gen));
+            expected += alphas[txps[i]] * static_cast<double>(aux[i]);
+          }
+          double got = salmon::emkernels::gatherDot(alphas.data(), txps.data(),
+                                                    aux.data(), n);
+          THEN("The " + std::string(salmon::emkernels::gatherDotImpl()) +
+               " kernel matches the scalar sum") {
+            REQUIRE(got == Approx(expected).epsilon(1e-12));
+          }
+        }
+      }
+
+      WHEN("Computing the digamma function") {
+        for (double x = 1e-10; x < 1e6; x *= 1.5) {
+          THEN("It matches boost at " + std::to_string(x)) {
+            double ref = boost::math::digamma(x);
+            REQUIRE(salmon::emkernels::digamma(x) == Approx(ref).epsilon(1e-12));
+          }
+        }
+      }
+    }
+}
+
+// The runtime choice of the kernels' variants (see CPUDispatch.hpp)
+#include <cstdlib>
+#include "CPUDispatch.hpp"
+
+// SALMON_MAX_ISA caps the variants, and salmon::cpu::init() chooses
+// them again
+
+SCENARIO("The kernels are chosen again under a cap on the instruction set") {
+
+    GIVEN("The cap set to scalar in the environment") {
+      setenv("SALMON_MAX_ISA", "scalar", 1);
+      salmon::cpu::init();
+      std::string capped = salmon::emkernels::gatherDotImpl();
+      bool avx2Allowed = salmon::cpu::supports(salmon::cpu::ISA::avx2);
+      bool recorded{false};
+      for (auto& v : salmon::cpu::chosenVariants()) {
+        if (v.kernel == "em_gather_dot") {
+          recorded = (v.variant == "scalar");
+        }
+      }
+      unsetenv("SALMON_MAX_ISA");
+      salmon::cpu::init();
+
+      THEN("The scalar kernel is chosen, and recorded") {
+          REQUIRE(capped == "scalar");
+          REQUIRE(recorded);
+          REQUIRE_FALSE(avx2Allowed);
+      }
+    }
+}
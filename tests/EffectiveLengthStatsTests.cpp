@@ -0,0 +1,68 @@
+#include <cmath>
+#include <map>
+#include "EffectiveLengthStats.hpp"
+
+// The observed effective lengths every mapping thread records: a weighted
+// average, per transcript, of the effective lengths of its fragments.  Only
+// the observed transcripts have an entry, and merging the per-thread stats
+// must give what one thread seeing all of the fragments would.
+
+namespace {
+// The expected effective length and count of every observed transcript
+std::map<uint32_t, std::pair<double, uint32_t>>
+observed(const EffectiveLengthStats& s) {
+  std::map<uint32_t, std::pair<double, uint32_t>> m;
+  s.forEachObserved([&m](uint32_t tid, double el, uint32_t count) {
+    m[tid] = {el, count};
+  });
+  return m;
+}
+} // namespace
+SCENARIO("Observed effective lengths are sparse and merge like one thread") {
+
+    GIVEN("Fragments on two transcripts of many") {
+      EffectiveLengthStats s;
+      // equal weights, then a fragment with twice the weight
+      s.addFragment(7, 100, std::log(1.0));
+      s.addFragment(7, 200, std::log(1.0));
+      s.addFragment(1000000, 50, std::log(1.0));
+      s.addFragment(1000000, 80, std::log(2.0));
+
+      THEN("only those transcripts are observed, with weighted averages") {
+          REQUIRE(s.size() == 2);
+          REQUIRE(s.getObservedCount(7) == 2);
+          REQUIRE(s.getObservedCount(8) == 0);
+          REQUIRE(s.getExpectedEffectiveLength(7) == Approx(150.0));
+          REQUIRE(s.getExpectedEffectiveLength(1000000) == Approx(70.0));
+          REQUIRE(s.getExpectedEffectiveLength(8) == Approx(0.01));
+      }
+
+      WHEN("they are split across threads and merged") {
+        EffectiveLengthStats a, b, merged;
+        a.addFragment(7, 100, std::log(1.0));
+        a.addFragment(1000000, 50, std::log(1.0));
+        b.addFragment(7, 200, std::log(1.0));
+        b.addFragment(1000000, 80, std::log(2.0));
+        merged.merge(a);
+        merged.merge(b);
+
+        THEN("the lengths and the counts are those of one thread") {
+            auto m = observed(merged);
+            auto expected = observed(s);
+            REQUIRE(m.size() == expected.size());
+            for (auto& kv : expected) {
+              REQUIRE(m[kv.first].first == Approx(kv.second.first));
+              REQUIRE(m[kv.first].second == kv.second.second);
+            }
+        }
+      }
+
+      WHEN("they are reset") {
+        s.reset();
+        THEN("nothing is observed") {
+            REQUIRE(s.size() == 0);
+            REQUIRE(s.getObservedCount(7) == 0);
+        }
+      }
+    }
+}
@@ -0,0 +1,115 @@
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "FlatEquivalenceClasses.hpp"
+
+// The (VB)EM, the bootstraps and the Gibbs sampler rely on compact() leaving
+// only valid, distinct classes
+SCENARIO("Compacting the flat equivalence classes") {
+
+    GIVEN("Classes with an invalid, an empty and a repeated one") {
+      // (label, weights, count) of each class
+      struct Class {
+        std::vector<uint32_t> txps;
+        std::vector<double> weights;
+        uint64_t count;
+      };
+      std::vector<Class> classes{{{0, 1}, {0.5, 0.5}, 10},
+                                 {{1, 2}, {0.25, 0.75}, 20},
+                                 {{3}, {1.0}, 0},
+                                 {{0, 1}, {0.5, 0.5}, 30},
+                                 {{1, 2}, {0.75, 0.25}, 40},
+                                 {{4}, {1.0}, 50}};
+      FlatEquivalenceClasses eqClasses;
+      eqClasses.numReplicates = 2;
+      eqClasses.offsets.push_back(0);
+      for (auto& c : classes) {
+        eqClasses.txps.insert(eqClasses.txps.end(), c.txps.begin(),
+                              c.txps.end());
+        eqClasses.weights.insert(eqClasses.weights.end(), c.weights.begin(),
+                                 c.weights.end());
+        eqClasses.offsets.push_back(eqClasses.txps.size());
+        eqClasses.counts.push_back(c.count);
+        eqClasses.valid.push_back(1);
+        eqClasses.replicateCounts.push_back(c.count);
+        eqClasses.replicateCounts.push_back(c.count + 1);
+      }
+      eqClasses.combinedWeights = eqClasses.weights;
+      eqClasses.valid[5] = 0;
+
+      WHEN("Compacting them") {
+        auto r = eqClasses.compact();
+
+        THEN("The invalid and empty classes are dropped, and the duplicate "
+             "merged into the first") {
+          REQUIRE(r.numDropped == 2);
+          REQUIRE(r.numMerged == 1);
+          REQUIRE(eqClasses.numClasses() == 3);
+          REQUIRE(eqClasses.offsets == (std::vector<uint64_t>{0, 2, 4, 6}));
+          REQUIRE(eqClasses.txps ==
+                  (std::vector<uint32_t>{0, 1, 1, 2, 1, 2}));
+          REQUIRE(eqClasses.weights ==
+                  (std::vector<double>{0.5, 0.5, 0.25, 0.75, 0.75, 0.25}));
+          REQUIRE(eqClasses.combinedWeights == eqClasses.weights);
+          REQUIRE(eqClasses.counts == (std::vector<uint64_t>{40, 20, 40}));
+          REQUIRE(eqClasses.replicateCounts ==
+                  (std::vector<uint32_t>{40, 42, 20, 21, 40, 41}));
+          REQUIRE(eqClasses.valid == (std::vector<uint8_t>{1, 1, 1}));
+        }
+      }
+
+      WHEN("There is nothing to compact") {
+        auto kept = eqClasses.validClasses().compact();
+        FlatEquivalenceClasses distinct;
+        distinct.offsets = {0, 2, 3};
+        distinct.txps = {0, 1, 4};
+        distinct.weights = {0.5, 0.5, 1.0};
+        distinct.counts = {1, 2};
+        distinct.valid = {1, 1};
+        auto r = distinct.compact();
+
+        THEN("The classes are left as they were") {
+          REQUIRE(kept.numMerged == 1);
+          REQUIRE(r.numDropped == 0);
+          REQUIRE(r.numMerged == 0);
+          REQUIRE(distinct.counts == (std::vector<uint64_t>{1, 2}));
+          REQUIRE(distinct.txps == (std::vector<uint32_t>{0, 1, 4}));
+        }
+      }
+    }
+}
+
+SCENARIO("Collapsing the equivalence classes onto genes") {
+
+    GIVEN("Classes over two transcripts of one gene and two single ones") {
+      // genes: {t0, t1} -> 0, t2 -> 1, t3 -> 2
+      std::vector<uint32_t> txpGene{0, 0, 1, 2};
+      std::vector<double> withinGene{0.5, 0.5, 1.0, 1.0};
+      FlatEquivalenceClasses eqClasses;
+      eqClasses.offsets = {0, 2, 3, 5, 7, 9};
+      eqClasses.txps = {0, 1, 0, 1, 2, 2, 3, 1, 2};
+      eqClasses.weights = {0.4, 0.6, 1.0, 0.5, 0.5, 0.5, 0.5, 0.25, 0.75};
+      eqClasses.combinedWeights = eqClasses.weights;
+      eqClasses.counts = {10, 5, 20, 7, 3};
+      eqClasses.valid = {1, 1, 1, 1, 1};
+
+      WHEN("They're collapsed") {
+        auto genes = eqClasses.collapseToGenes(txpGene, withinGene);
+
+        THEN("The single-gene classes become one, and the others get the "
+             "shares of their transcripts' weights") {
+          REQUIRE(genes.numClasses() == 4);
+          REQUIRE(genes.offsets == (std::vector<uint64_t>{0, 1, 3, 5, 7}));
+          REQUIRE(genes.txps ==
+                  (std::vector<uint32_t>{0, 0, 1, 1, 2, 0, 1}));
+          REQUIRE(genes.weights == (std::vector<double>{
+                                       1.0, 0.25, 0.5, 0.5, 0.5, 0.125,
+                                       0.75}));
+          REQUIRE(genes.combinedWeights == genes.weights);
+          REQUIRE(genes.counts == (std::vector<uint64_t>{15, 20, 7, 3}));
+          // the original classes are left as they were
+          REQUIRE(eqClasses.numClasses() == 5);
+        }
+      }
+    }
+}
@@ -0,0 +1,69 @@
+#include <cstdint>
+#include <random>
+#include <vector>
+#include "TranscriptGroup.hpp"
+
+SCENARIO("Equivalence class labels behave as the vectors they replace") {
+
+    GIVEN("Labels of every size, short and long") {
+      std::mt19937 gen(42);
+      for (uint32_t n = 0; n < 3 * EqClassLabel::InlineCapacity; ++n) {
+        std::vector<uint32_t> ids(n);
+        for (auto& i : ids) { i = gen() % 100000; }
+
+        EqClassLabel built;
+        for (auto i : ids) { built.push_back(i); }
+        EqClassLabel assigned(ids.begin(), ids.end());
+
+        WHEN("Appending the ids of a class of size " + std::to_string(n)) {
+          THEN("The label holds them, and hashes as one built at once") {
+            REQUIRE(built.size() == n);
+            REQUIRE(std::vector<uint32_t>(built.begin(), built.end()) == ids);
+            REQUIRE(built == assigned);
+            REQUIRE(built.hash() == assigned.hash());
+            REQUIRE(TranscriptGroup(ids).hash == built.hash());
+          }
+        }
+
+        WHEN("Copying, and then modifying, a label of size " +
+             std::to_string(n)) {
+          EqClassLabel copy(built);
+          EqClassLabel copyOfCopy(copy);
+          THEN("Long labels are shared only among the copies") {
+            REQUIRE(copy == built);
+            REQUIRE(copyOfCopy == built);
+            REQUIRE(copyOfCopy.hash() == built.hash());
+            REQUIRE(!built.shared());
+            REQUIRE(copy.shared() == (n > EqClassLabel::InlineCapacity));
+          }
+          copy.push_back(7);
+          THEN("Modifying one copy leaves the others unchanged") {
+            REQUIRE(copy.size() == n + 1);
+            REQUIRE(copyOfCopy == built);
+            REQUIRE(!copyOfCopy.shared());
+            REQUIRE(copy != built);
+          }
+        }
+      }
+    }
+
+    GIVEN("A label that's reused for every fragment") {
+      EqClassLabel scratch;
+      scratch.reserve(4 * EqClassLabel::InlineCapacity);
+      std::vector<uint32_t> ids;
+      for (uint32_t i = 0; i < 2 * EqClassLabel::InlineCapacity; ++i) {
+        ids.push_back(3 * i);
+        scratch.push_back(3 * i);
+      }
+      EqClassLabel key(scratch);
+      scratch.clear();
+      scratch.push_back(1);
+      THEN("Clearing it starts a new label, and its copies are unaffected") {
+        REQUIRE(scratch.size() == 1);
+        std::vector<uint32_t> one{1};
+        REQUIRE(scratch.hash() == EqClassLabel(one.begin(), one.end()).hash());
+        REQUIRE(std::vector<uint32_t>(key.begin(), key.end()) == ids);
+        REQUIRE(key.hash() == EqClassLabel(ids.begin(), ids.end()).hash());
+      }
+    }
+}
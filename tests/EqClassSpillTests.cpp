@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+#include "EquivalenceClassBuilder.hpp"
+#include "spdlog/spdlog.h"
+
+// --maxInMemoryEqClasses: the classes beyond the bound are spilled to disk in
+// sorted runs, and merged back by finish()
+
+SCENARIO("Spilled equivalence classes are merged back exactly") {
+
+    GIVEN("Many threads adding thousands of distinct classes") {
+      auto log = spdlog::stderr_logger_mt("eqSpillTest");
+      using Counts = std::map<std::vector<uint32_t>, uint64_t>;
+
+      // Adds the same classes to builder b from 4 threads, and returns how
+      // often each was added
+      auto fill = [](EquivalenceClassBuilder& b) -> Counts {
+        std::vector<Counts> local(4);
+        std::vector<std::thread> threads;
+        for (uint32_t t = 0; t < 4; ++t) {
+          threads.emplace_back([&b, &local, t]() -> void {
+            std::mt19937 gen(t);
+            for (size_t i = 0; i < 20000; ++i) {
+              std::vector<uint32_t> txps{gen() % 50};
+              for (size_t k = gen() % 3; k > 0; --k) {
+                txps.push_back(50 + gen() % 3000);
+              }
+              std::sort(txps.begin(), txps.end());
+              txps.erase(std::unique(txps.begin(), txps.end()), txps.end());
+              std::vector<double> weights(txps.size(), 1.0);
+              weights[0] = 2.0;
+              b.addGroupInPlace(TranscriptGroup(txps), weights);
+              ++local[t][txps];
+            }
+          });
+        }
+        for (auto& th : threads) {
+          th.join();
+        }
+        Counts all;
+        for (auto& l : local) {
+          for (auto& kv : l) {
+            all[kv.first] += kv.second;
+          }
+        }
+        return all;
+      };
+
+      WHEN("At most 1000 of them are kept in memory") {
+        std::string spillPath = "eq_spill_test.bin";
+        Counts expected;
+        {
+          EquivalenceClassBuilder b(log);
+          b.start();
+          b.spillTo(spillPath, 1000);
+          expected = fill(b);
+          b.finish();
+
+          THEN("Every class is there once, with its count and weights") {
+            auto& eqVec = b.eqVec();
+            REQUIRE(eqVec.size() == expected.size());
+            for (auto& kv : eqVec) {
+              std::vector<uint32_t> txps(kv.first.txps.begin(),
+                                         kv.first.txps.end());
+              REQUIRE(kv.second.count == expected[txps]);
+              double total = kv.second.weights.size() + 1.0;
+              REQUIRE(kv.second.weights[0] == Approx(2.0 / total));
+            }
+            REQUIRE(b.flatEqClasses().counts.size() == expected.size());
+          }
+        }
+
+        THEN("The spill file is removed") {
+          REQUIRE(std::fopen(spillPath.c_str(), "rb") == nullptr);
+        }
+      }
+      spdlog::drop("eqSpillTest");
+    }
+}
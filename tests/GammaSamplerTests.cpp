@@ -0,0 +1,56 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <numeric>
+#include <vector>
+#include "GammaSampler.hpp"
+
+// The Gibbs sampler draws the transcript fractions with GammaSampler, in
+// batches of whatever size its tasks happen to have
+SCENARIO("The gamma sampler draws reproducible variates of the right moments") {
+
+    GIVEN("Many elements of a few shapes, large and small") {
+      size_t n = 200000;
+      std::vector<double> shapeValues{0.05, 0.5, 1.0, 3.0, 250.0};
+      std::vector<uint32_t> ids(n);
+      std::iota(ids.begin(), ids.end(), 0);
+
+      WHEN("Drawing them with scale 2") {
+        GammaSampler gs(7);
+        std::vector<double> scales(n, 2.0);
+
+        THEN("The sample means and variances match a * 2 and a * 4") {
+          for (double a : shapeValues) {
+            std::vector<double> shapes(n, a), out(n);
+            gs(ids.data(), shapes.data(), scales.data(), out.data(), n);
+            double mean = std::accumulate(out.begin(), out.end(), 0.0) / n;
+            double var{0.0};
+            for (auto x : out) {
+              var += (x - mean) * (x - mean);
+            }
+            var /= (n - 1);
+            REQUIRE(std::abs(mean - 2.0 * a) < 0.02 * 2.0 * a + 1e-3);
+            REQUIRE(std::abs(var - 4.0 * a) < 0.05 * 4.0 * a + 1e-3);
+          }
+        }
+      }
+
+      WHEN("Drawing them in one batch, and in batches of 37") {
+        GammaSampler gs(11);
+        std::vector<double> shapes(n), scales(n, 1.0), whole(n), pieces(n);
+        for (size_t i = 0; i < n; ++i) {
+          shapes[i] = shapeValues[i % shapeValues.size()];
+        }
+        gs(ids.data(), shapes.data(), scales.data(), whole.data(), n);
+        for (size_t b = 0; b < n; b += 37) {
+          size_t m = std::min(size_t(37), n - b);
+          gs(ids.data() + b, shapes.data() + b, scales.data() + b,
+             pieces.data() + b, m);
+        }
+
+        THEN("The variates are the same") {
+          REQUIRE(whole == pieces);
+        }
+      }
+    }
+}
@@ -0,0 +1,66 @@
+#include <string>
+#include <thread>
+#include "HardwareCounters.hpp"
+
+// The hardware counters of --hwCounters: where the events can't be counted
+// (as in many VMs and containers) nothing is, and where they can, a thread's
+// counters count its work, and a process' those of all of its threads.
+
+namespace {
+// Some work (of at least n instructions) for the counters to count
+uint64_t busyWork(uint64_t n) {
+  volatile uint64_t x{0};
+  for (uint64_t i = 0; i < n; ++i) {
+    x = x + i;
+  }
+  return x;
+}
+} // namespace
+
+SCENARIO("Hardware events are counted, where they can be") {
+
+    using salmon::perf::CounterSet;
+    using salmon::perf::CounterValues;
+    using salmon::perf::Event;
+    std::string why;
+    bool available = salmon::perf::available(why);
+    size_t instructions = static_cast<size_t>(Event::INSTRUCTIONS);
+
+    GIVEN("The counters of a thread, and of the process") {
+      CounterSet threadCounters(CounterSet::Scope::THREAD);
+      CounterSet processCounters(CounterSet::Scope::PROCESS);
+      busyWork(1000000);
+      std::thread worker([]() -> void { busyWork(1000000); });
+      worker.join();
+      auto t = threadCounters.read();
+      auto p = processCounters.read();
+      THEN("they count the threads' work, or nothing at all") {
+          REQUIRE(threadCounters.good() == available);
+          REQUIRE(t.any() == available);
+          REQUIRE(p.any() == available);
+          REQUIRE((available or !why.empty()));
+          if (t.counted[instructions] and p.counted[instructions]) {
+            REQUIRE(t[Event::INSTRUCTIONS] > 2000000);
+            REQUIRE(p[Event::INSTRUCTIONS] > 2000000);
+          }
+      }
+    }
+
+    GIVEN("The counts of two spans") {
+      CounterValues a, b;
+      a.counts[0] = 10;
+      a.counted[0] = true;
+      b.counts[0] = 5;
+      b.counted[0] = true;
+      b.counts[instructions] = 7;
+      b.counted[instructions] = true;
+      a += b;
+      THEN("their sum has each event that either counted") {
+          REQUIRE(a[Event::CYCLES] == 15);
+          REQUIRE(a[Event::INSTRUCTIONS] == 7);
+          REQUIRE(a.counted[instructions]);
+          REQUIRE(!a.counted[static_cast<size_t>(Event::DTLB_MISSES)]);
+          REQUIRE(!CounterValues().any());
+      }
+    }
+}
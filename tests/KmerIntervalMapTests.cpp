@@ -0,0 +1,62 @@
+#include <map>
+#include <random>
+#include "KmerIntervalMap.hpp"
+
+// The auxiliary index of the FMD mode: k-mers (as 2-bit codes) to the
+// intervals the seed search reaches at their ends.  It is only probed, so
+// what matters is that nothing inserted is lost as the table grows, and
+// that nothing else is found.
+
+namespace {
+// A random k-mer code
+uint64_t randomKmer(std::mt19937_64& gen, uint32_t k) {
+  return gen() & ((uint64_t(1) << (2 * k)) - 1);
+}
+} // namespace
+
+SCENARIO("The k-mer interval map finds what was inserted, and only that") {
+
+    GIVEN("Many random 19-mers, inserted twice") {
+      KmerIntervalMap kmers;
+      kmers.setK(19);
+      std::mt19937_64 gen(19);
+      std::map<uint64_t, uint64_t> expected;
+      for (size_t i = 0; i < 50000; ++i) {
+        uint64_t code = randomKmer(gen, 19);
+        // The second insertion of a k-mer keeps the first interval
+        uint64_t interval[3] = {i, i + 1, i + 2};
+        kmers.insert(code, interval);
+        expected.insert({code, i});
+      }
+      for (auto& kv : expected) {
+        uint64_t interval[3] = {0, 0, 0};
+        kmers.insert(kv.first, interval);
+      }
+
+      THEN("Each is found with its interval") {
+        REQUIRE(kmers.k() == 19);
+        REQUIRE(kmers.size() == expected.size());
+        for (auto& kv : expected) {
+          const uint64_t* interval = kmers.find(kv.first);
+          REQUIRE(interval != nullptr);
+          REQUIRE(interval[0] == kv.second);
+          REQUIRE(interval[1] == kv.second + 1);
+          REQUIRE(interval[2] == kv.second + 2);
+        }
+      }
+      THEN("Other k-mers are not found") {
+        for (size_t i = 0; i < 50000; ++i) {
+          uint64_t code = randomKmer(gen, 19);
+          REQUIRE(kmers.hasKmer(code) == (expected.count(code) > 0));
+        }
+      }
+    }
+
+    GIVEN("An empty map") {
+      KmerIntervalMap kmers;
+      THEN("Nothing is found") {
+        REQUIRE(kmers.size() == 0);
+        REQUIRE(kmers.find(0) == nullptr);
+      }
+    }
+}
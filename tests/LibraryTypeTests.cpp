@@ -164,3 +164,38 @@ SCENARIO("Single-end library types have proper compatibility") {
 }
 
 
+SCENARIO("The compatibility lookup agrees with compatibleHit") {
+
+    using salmon::utils::compatibleHit;
+    using salmon::utils::isCompatible;
+    using rapmap::utils::MateStatus;
+
+    GIVEN("Every expected library format") {
+        for (uint8_t e = 0; e <= LibraryFormat::maxLibTypeID(); ++e) {
+            LibraryFormat expected = LibraryFormat::formatFromID(e);
+            WHEN("expected is " + expected.toString() + " (id " +
+                 std::to_string(e) + ")") {
+                THEN("paired-end reads get the same answer") {
+                    for (uint8_t o = 0; o <= LibraryFormat::maxLibTypeID(); ++o) {
+                        LibraryFormat observed = LibraryFormat::formatFromID(o);
+                        if (observed.type != ReadType::PAIRED_END) { continue; }
+                        REQUIRE(isCompatible(observed, expected, 0, true,
+                                             MateStatus::PAIRED_END_PAIRED) ==
+                                compatibleHit(expected, observed));
+                    }
+                }
+                THEN("single-end reads and orphans get the same answer") {
+                    for (auto s : {MateStatus::SINGLE_END,
+                                   MateStatus::PAIRED_END_LEFT,
+                                   MateStatus::PAIRED_END_RIGHT}) {
+                        for (bool fwd : {true, false}) {
+                            auto observed = salmon::utils::hitType(0, fwd);
+                            REQUIRE(isCompatible(observed, expected, 0, fwd, s) ==
+                                    compatibleHit(expected, 0, fwd, s));
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,147 @@
+#include <boost/filesystem.hpp>
+#include <vector>
+#include "MappingCacheFile.hpp"
+
+// The mapping cache of --mappingCacheDir: the mappings a run writes must
+// come back unchanged (fragment by fragment, unmapped ones included) in a
+// later run with the same key, and in no run with another.
+
+namespace {
+// Stands in for rapmap::utils::QuasiAlignment (its constructor and fields)
+struct CachedHit {
+  CachedHit(uint32_t tidIn, int32_t posIn, bool fwdIn, uint32_t readLenIn,
+            uint32_t fragLenIn = 0, bool isPairedIn = false)
+      : tid(tidIn), pos(posIn), fwd(fwdIn), readLen(readLenIn),
+        fragLen(fragLenIn), isPaired(isPairedIn) {}
+  uint32_t tid;
+  int32_t pos;
+  bool fwd;
+  uint32_t readLen;
+  uint32_t fragLen;
+  bool isPaired;
+  int32_t matePos{0};
+  bool mateIsFwd{false};
+  uint32_t mateLen{0};
+  rapmap::utils::MateStatus mateStatus{
+      rapmap::utils::MateStatus::SINGLE_END};
+  LibraryFormat format{LibraryFormat::formatFromID(0)};
+};
+
+std::vector<std::vector<CachedHit>> cachedFragments() {
+  using rapmap::utils::MateStatus;
+  std::vector<std::vector<CachedHit>> frags;
+  for (uint32_t i = 0; i < 3000; ++i) {
+    std::vector<CachedHit> hits;
+    // every seventh fragment is unmapped
+    uint32_t numHits = (i % 7 == 0) ? 0 : (i % 5) + 1;
+    for (uint32_t j = 0; j < numHits; ++j) {
+      bool paired = (i % 3) != 0;
+      hits.emplace_back(i * 31 + j, static_cast<int32_t>(i * 17) - 40,
+                        (i + j) % 2 == 0, 100 + j,
+                        paired ? 250 + i % 100 : 0, paired);
+      auto& h = hits.back();
+      h.format = LibraryFormat::formatFromID(paired ? 0x0d : 0x02);
+      if (paired) {
+        h.mateStatus = MateStatus::PAIRED_END_PAIRED;
+        h.matePos = h.pos + 150;
+        h.mateIsFwd = !h.fwd;
+        h.mateLen = 99;
+      } else if (i % 3 == 0 and i % 2 == 0) {
+        h.mateStatus = MateStatus::PAIRED_END_RIGHT;
+        h.mateIsFwd = h.fwd;
+      }
+    }
+    frags.push_back(hits);
+  }
+  return frags;
+}
+} // namespace
+
+SCENARIO("The mapping cache replays the mappings it was written") {
+
+    namespace bfs = boost::filesystem;
+    namespace mc = salmon::mapcache;
+    bfs::path dir = bfs::temp_directory_path() /
+                    bfs::unique_path("salmon-mapcache-%%%%-%%%%");
+    bfs::create_directories(dir);
+    std::string key{"0123456789abcdef"};
+    auto frags = cachedFragments();
+
+    GIVEN("The mappings of a library, written in small blocks") {
+      {
+        mc::Writer writer(dir, key);
+        // small blocks, so there are many of them
+        mc::BlockEncoder encoder(4096);
+        for (auto& hits : frags) {
+          encoder.add(hits);
+          encoder.flushIfFull(writer);
+        }
+        encoder.flush(writer);
+        REQUIRE(writer.commit());
+      }
+
+      WHEN("they are read back with the same key") {
+        mc::Reader reader;
+        REQUIRE(reader.open(mc::cacheFile(dir, key), key));
+        mc::BlockDecoder decoder;
+        std::vector<std::vector<CachedHit>> replayed;
+        std::vector<CachedHit> hits;
+        size_t numBlocks{0};
+        while (reader.next(decoder)) {
+          ++numBlocks;
+          while (decoder.next(hits)) {
+            replayed.push_back(hits);
+          }
+        }
+        THEN("every fragment comes back, in order and unchanged") {
+            REQUIRE_FALSE(reader.failed());
+            REQUIRE(numBlocks > 1);
+            REQUIRE(replayed.size() == frags.size());
+            for (size_t i = 0; i < frags.size(); ++i) {
+              REQUIRE(replayed[i].size() == frags[i].size());
+              for (size_t j = 0; j < frags[i].size(); ++j) {
+                auto& a = frags[i][j];
+                auto& b = replayed[i][j];
+                REQUIRE(a.tid == b.tid);
+                REQUIRE(a.pos == b.pos);
+                REQUIRE(a.fwd == b.fwd);
+                REQUIRE(a.readLen == b.readLen);
+                REQUIRE(a.fragLen == b.fragLen);
+                REQUIRE(a.isPaired == b.isPaired);
+                REQUIRE(a.mateStatus == b.mateStatus);
+                REQUIRE(a.mateIsFwd == b.mateIsFwd);
+                REQUIRE(a.matePos == b.matePos);
+                REQUIRE(a.mateLen == b.mateLen);
+                REQUIRE(a.format == b.format);
+              }
+            }
+        }
+      }
+
+      WHEN("they are looked up with another key") {
+        mc::Reader reader;
+        THEN("there is nothing to replay") {
+            REQUIRE_FALSE(reader.open(mc::cacheFile(dir, key),
+                                      "fedcba9876543210"));
+            REQUIRE_FALSE(reader.open(mc::cacheFile(dir, "fedcba9876543210"),
+                                      "fedcba9876543210"));
+        }
+      }
+    }
+
+    GIVEN("A writer that is never committed") {
+      {
+        mc::Writer writer(dir, key);
+        mc::BlockEncoder encoder;
+        encoder.add(frags[1]);
+        encoder.flush(writer);
+      }
+      THEN("it leaves no file behind") {
+          REQUIRE_FALSE(bfs::exists(mc::cacheFile(dir, key)));
+          auto tmpPath = mc::cacheFile(dir, key).string() + ".tmp";
+          REQUIRE_FALSE(bfs::exists(tmpPath));
+      }
+    }
+
+    bfs::remove_all(dir);
+}
@@ -0,0 +1,50 @@
+#include <string>
+#include "MappingVerifier.hpp"
+
+SCENARIO("The mapping verifier keeps only candidates close to the transcript") {
+
+    GIVEN("A transcript and reads drawn from it") {
+      std::string txp = "GATTACACCGTAGGCTAGCTAGGATCCATGCAAATTTGGGCCCAGTACGT";
+      int32_t txpLen = static_cast<int32_t>(txp.size());
+      // 30 bases, so that up to 3 edits are allowed
+      std::string exact = txp.substr(10, 30);
+      std::string edited = exact;
+      edited[5] = 'A';
+      edited[15] = 'T';
+      std::string deleted = exact.substr(0, 12) + exact.substr(13) + "A";
+      std::string rc;
+      for (auto it = exact.rbegin(); it != exact.rend(); ++it) {
+        rc.push_back(*it == 'A' ? 'T' : *it == 'C' ? 'G' : *it == 'G' ? 'C' : 'A');
+      }
+
+      MappingVerifier verifier(0.1);
+      MappingVerifier::Read read;
+
+      WHEN("Reads are checked at the position they came from") {
+        THEN("Exact, edited and indel reads pass, on either strand") {
+          read.reset(exact);
+          REQUIRE(verifier.check(read, 0, 10, true, txp.data(), txpLen));
+          read.reset(edited);
+          REQUIRE(verifier.check(read, 0, 10, true, txp.data(), txpLen));
+          read.reset(deleted);
+          REQUIRE(verifier.check(read, 0, 10, true, txp.data(), txpLen));
+          read.reset(rc);
+          REQUIRE(verifier.check(read, 0, 10, false, txp.data(), txpLen));
+        }
+      }
+
+      WHEN("Reads are checked far from where they came from") {
+        THEN("They are rejected, and repeated checks come from the cache") {
+          read.reset(exact);
+          REQUIRE_FALSE(verifier.check(read, 0, 0, true, txp.data(), txpLen));
+          REQUIRE_FALSE(verifier.check(read, 0, 0, true, txp.data(), txpLen));
+          read.reset(exact);
+          REQUIRE_FALSE(verifier.check(read, 0, 10, false, txp.data(), txpLen));
+          auto& stats = verifier.stats();
+          REQUIRE(stats.numChecked == 3);
+          REQUIRE(stats.numCacheHits == 1);
+          REQUIRE(stats.numRejected == 3);
+        }
+      }
+    }
+}
@@ -0,0 +1,85 @@
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "MemoryBudget.hpp"
+
+// --memoryBudget: the accounts of the large structures, and what's left of
+// the budget for sizing the rest
+
+namespace {
+constexpr uint64_t GB = uint64_t{1} << 30;
+}
+
+SCENARIO("The memory budget sums its accounts and tracks their peaks") {
+
+    GIVEN("A budget of 4 GB") {
+      salmon::memory::Budget budget;
+      budget.setLimit(4 * GB);
+      auto& index = budget.account("index");
+      auto& classes = budget.account("eq_classes");
+
+      WHEN("Two accounts are charged, and one released in part") {
+        index.set(GB);
+        classes.charge(2 * GB);
+        classes.charge(-static_cast<int64_t>(GB));
+
+        THEN("The budget holds their sum, and remembers the peak") {
+          REQUIRE(&budget.account("index") == &index);
+          REQUIRE(budget.used() == 2 * GB);
+          REQUIRE(budget.peakUsed() == 3 * GB);
+          REQUIRE(classes.bytes() == GB);
+          REQUIRE(classes.peakBytes() == 2 * GB);
+          REQUIRE(budget.available() == 2 * GB);
+          REQUIRE(budget.fits(2 * GB));
+          REQUIRE_FALSE(budget.fits(GB, 0.25));
+          REQUIRE_FALSE(budget.exceeded());
+          auto s = budget.summaries();
+          REQUIRE(s.size() == 2);
+          REQUIRE(s[0].name == "index");
+          REQUIRE(s[1].peakBytes == 2 * GB);
+        }
+      }
+
+      WHEN("The accounts outgrow it") {
+        index.set(3 * GB);
+        classes.charge(2 * GB);
+
+        THEN("It is exceeded, and nothing more fits") {
+          REQUIRE(budget.exceeded());
+          REQUIRE(budget.available() == 0);
+          REQUIRE_FALSE(budget.fits(1));
+        }
+      }
+
+      WHEN("Many threads charge and release an account at once") {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+          threads.emplace_back([&classes]() -> void {
+            for (int i = 0; i < 10000; ++i) {
+              classes.charge(64);
+              classes.charge(-64);
+            }
+          });
+        }
+        for (auto& t : threads) {
+          t.join();
+        }
+
+        THEN("Everything charged is released") {
+          REQUIRE(classes.bytes() == 0);
+          REQUIRE(budget.used() == 0);
+          REQUIRE(classes.peakBytes() >= 64);
+        }
+      }
+    }
+
+    GIVEN("No limit") {
+      salmon::memory::Budget budget;
+      budget.account("index").set(100 * GB);
+
+      THEN("Everything fits") {
+        REQUIRE(budget.fits(1000 * GB));
+        REQUIRE_FALSE(budget.exceeded());
+      }
+    }
+}
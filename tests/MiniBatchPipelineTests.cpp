@@ -0,0 +1,81 @@
+#include <atomic>
+#include <set>
+#include <thread>
+#include <vector>
+#include "MiniBatchPipeline.hpp"
+
+// The hand-off between the mapping and the inference threads of
+// --inferenceThreads: every submitted batch must reach exactly one consumer,
+// with the contents its producer wrote, however the threads interleave, and
+// the consumers must all stop once the pipeline is closed.
+
+namespace {
+// A batch: the fragments are (producer, batch, fragment) triples
+using TestBatch = std::vector<std::vector<uint32_t>>;
+
+// The (unique) id of fragment frag of a producer's batch
+uint32_t fragmentID(uint32_t producer, uint32_t batch, uint32_t frag) {
+  return (producer << 20) | (batch << 8) | frag;
+}
+} // namespace
+
+SCENARIO("The mini-batch pipeline hands every batch to exactly one thread") {
+
+    GIVEN("Four producers and three consumers sharing five slots") {
+      const uint32_t numProducers{4}, numConsumers{3};
+      const uint32_t numBatches{500}, slotSize{64};
+      MiniBatchPipeline<TestBatch> pipeline(5, slotSize, numConsumers);
+
+      std::vector<std::vector<uint32_t>> seen(numConsumers);
+      std::vector<std::thread> consumers;
+      for (uint32_t c = 0; c < numConsumers; ++c) {
+        consumers.emplace_back([&, c]() {
+          MiniBatchPipeline<TestBatch>::Batch batch;
+          while (pipeline.next(batch)) {
+            for (size_t i = 0; i < batch.size; ++i) {
+              seen[c].push_back((*batch.hits)[i].front());
+            }
+            pipeline.release(batch.hits);
+          }
+        });
+      }
+      std::vector<std::thread> producers;
+      for (uint32_t p = 0; p < numProducers; ++p) {
+        producers.emplace_back([&, p]() {
+          for (uint32_t b = 0; b < numBatches; ++b) {
+            TestBatch* hits = pipeline.acquire();
+            // (the batches aren't all full)
+            size_t n = 1 + (b % slotSize);
+            for (size_t i = 0; i < n; ++i) {
+              (*hits)[i].assign(1, fragmentID(p, b, i));
+            }
+            pipeline.submit(hits, n);
+          }
+        });
+      }
+      for (auto& t : producers) {
+        t.join();
+      }
+      pipeline.close();
+      for (auto& t : consumers) {
+        t.join();
+      }
+
+      THEN("each fragment was processed once") {
+          std::multiset<uint32_t> all;
+          for (auto& s : seen) {
+            all.insert(s.begin(), s.end());
+          }
+          size_t expected{0};
+          for (uint32_t p = 0; p < numProducers; ++p) {
+            for (uint32_t b = 0; b < numBatches; ++b) {
+              for (uint32_t i = 0; i < 1 + (b % slotSize); ++i) {
+                REQUIRE(all.count(fragmentID(p, b, i)) == 1);
+                ++expected;
+              }
+            }
+          }
+          REQUIRE(all.size() == expected);
+      }
+    }
+}
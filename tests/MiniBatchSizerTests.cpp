@@ -0,0 +1,82 @@
+#include <cmath>
+#include "ForgettingMassCalculator.hpp"
+#include "MiniBatchSizer.hpp"
+
+// The mini-batch sizes of the online phase: a fixed size is kept, a tuned
+// one is small during the burn-in and then sized to its target processing
+// time, and a mini-batch of several timesteps' fragments carries as much
+// forgetting mass as the mini-batches of one timestep would.
+
+namespace {
+// The mass of k mini-batches of one timestep, after first timesteps
+double massOfSingleSteps(uint64_t first, uint64_t k) {
+  ForgettingMassCalculator fmCalc(0.65);
+  fmCalc.prefill(100);
+  double logMass{0.0};
+  uint64_t timestep{0};
+  double mass{0.0};
+  for (uint64_t t = 0; t < first + k; ++t) {
+    fmCalc.getLogMassAndTimestep(logMass, timestep);
+    mass += (t >= first) ? std::exp(logMass) : 0.0;
+  }
+  return mass;
+}
+} // namespace
+
+SCENARIO("Mini-batches are sized, and weighed, by their fragments") {
+
+    GIVEN("A fixed mini-batch size") {
+      MiniBatchSizer sizer(5000, 16);
+      sizer.observe(5000, 10.0);
+      THEN("every mini-batch has that size") {
+          REQUIRE(!sizer.adaptive());
+          REQUIRE(sizer.next(false) == 5000);
+          REQUIRE(sizer.next(true) == 5000);
+          REQUIRE(MiniBatchSizer().next(true) == ~uint32_t(0));
+      }
+    }
+
+    GIVEN("A tuned mini-batch size, for 8 threads") {
+      MiniBatchSizer sizer(0, 8);
+      uint32_t minSize = MiniBatchSizer::minAdaptiveSize;
+      THEN("it is the smallest until the burn-in is over") {
+          REQUIRE(sizer.adaptive());
+          REQUIRE(sizer.next(false) == minSize);
+          sizer.observe(1000, 1e-3);
+          REQUIRE(sizer.next(false) == minSize);
+      }
+      THEN("it then takes about 8ms, within its bounds") {
+          // 1 microsecond per fragment
+          sizer.observe(1000, 1e-3);
+          REQUIRE(sizer.next(true) >= 7999);
+          REQUIRE(sizer.next(true) <= 8000);
+          sizer.observe(8000, 1e-6);
+          REQUIRE(sizer.next(true) > 8000);
+          for (int i = 0; i < 100; ++i) {
+            sizer.observe(1000, 1.0);
+          }
+          REQUIRE(sizer.next(true) == minSize);
+      }
+    }
+
+    GIVEN("Timesteps of 1000 fragments") {
+      THEN("a mini-batch takes one per 1000 fragments, and at least one") {
+          REQUIRE(numTimesteps(0, 1000) == 1);
+          REQUIRE(numTimesteps(400, 1000) == 1);
+          REQUIRE(numTimesteps(5000, 1000) == 5);
+          REQUIRE(numTimesteps(5600, 1000) == 6);
+      }
+      THEN("a mini-batch of several timesteps has their mean mass") {
+          ForgettingMassCalculator fmCalc(0.65);
+          fmCalc.prefill(100);
+          double logMass{0.0};
+          uint64_t timestep{0};
+          fmCalc.getLogMassAndTimesteps(3, logMass, timestep);
+          fmCalc.getLogMassAndTimesteps(5, logMass, timestep);
+          REQUIRE(timestep == 3);
+          REQUIRE(fmCalc.getCurrentTimestep() == 8);
+          REQUIRE(5 * std::exp(logMass) ==
+                  Approx(massOfSingleSteps(3, 5)).epsilon(1e-12));
+      }
+    }
+}
@@ -0,0 +1,61 @@
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "MultinomialSampler.hpp"
+
+SCENARIO("The multinomial sampler draws valid, reproducible samples") {
+
+    GIVEN("Unnormalized weights over a few thousand categories") {
+      size_t k = 5000;
+      uint64_t n = 100000000;
+      std::vector<double> weights(k);
+      double totalWeight{0.0};
+      for (size_t i = 0; i < k; ++i) {
+        // Include some categories that can never be drawn
+        weights[i] = (i % 7 == 0) ? 0.0 : static_cast<double>(i % 13 + 1);
+        totalWeight += weights[i];
+      }
+
+      WHEN("Drawing samples with the same seed and stream") {
+        std::vector<uint64_t> countsA(k, 1), countsB(k, 1);
+        MultinomialSampler msA(42, 3), msB(42, 3);
+        msA(countsA.begin(), n, k, weights.begin());
+        msB(countsB.begin(), n, k, weights.begin());
+
+        THEN("The samples are identical, sum to n, and avoid 0-weight categories") {
+          REQUIRE(countsA == countsB);
+          uint64_t total{0};
+          bool zeroOk{true};
+          for (size_t i = 0; i < k; ++i) {
+            total += countsA[i];
+            if (weights[i] == 0.0 and countsA[i] != 0) { zeroOk = false; }
+          }
+          REQUIRE(total == n);
+          REQUIRE(zeroOk);
+        }
+
+        THEN("The counts are close to their expectations") {
+          bool closeOk{true};
+          for (size_t i = 0; i < k; ++i) {
+            double p = weights[i] / totalWeight;
+            double mean = n * p;
+            double sd = std::sqrt(n * p * (1.0 - p));
+            if (std::abs(countsA[i] - mean) > 6.0 * sd + 1.0) { closeOk = false; }
+          }
+          REQUIRE(closeOk);
+        }
+      }
+
+      WHEN("Drawing samples from different streams") {
+        std::vector<uint64_t> countsA(k), countsB(k);
+        MultinomialSampler ms(42, 0);
+        ms(countsA.begin(), n, k, weights.begin());
+        ms.seed(42, 1);
+        ms(countsB.begin(), n, k, weights.begin());
+
+        THEN("The samples differ") {
+          REQUIRE(countsA != countsB);
+        }
+      }
+    }
+}
@@ -0,0 +1,58 @@
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "PoissonBootstrap.hpp"
+
+SCENARIO("The online bootstrap draws reproducible Poisson(1) weights") {
+
+    GIVEN("A bootstrap of 64 replicates") {
+      uint32_t numReplicates = 64;
+      PoissonBootstrap pb(42, numReplicates);
+
+      WHEN("Drawing the weights of many fragments") {
+        size_t numFragments = 100000;
+        std::vector<uint32_t> weights(numReplicates);
+        double sum{0.0};
+        double sumSq{0.0};
+        for (size_t f = 0; f < numFragments; ++f) {
+          pb(f, weights.data());
+          for (auto w : weights) {
+            sum += w;
+            sumSq += static_cast<double>(w) * w;
+          }
+        }
+        double n = static_cast<double>(numFragments) * numReplicates;
+        double mean = sum / n;
+        double var = sumSq / n - mean * mean;
+
+        THEN("Their mean and variance are both close to 1") {
+          REQUIRE(std::abs(mean - 1.0) < 0.01);
+          REQUIRE(std::abs(var - 1.0) < 0.02);
+        }
+      }
+
+      WHEN("Drawing the weights of the same fragment twice") {
+        std::vector<uint32_t> a(numReplicates), b(numReplicates),
+            c(numReplicates);
+        pb(12345, a.data());
+        pb(12345, b.data());
+        pb(12346, c.data());
+
+        THEN("They are identical, and differ from another fragment's") {
+          REQUIRE(a == b);
+          REQUIRE(a != c);
+        }
+      }
+
+      WHEN("Drawing with another seed") {
+        PoissonBootstrap other(43, numReplicates);
+        std::vector<uint32_t> a(numReplicates), b(numReplicates);
+        pb(7, a.data());
+        other(7, b.data());
+
+        THEN("The weights differ") {
+          REQUIRE(a != b);
+        }
+      }
+    }
+}
@@ -0,0 +1,78 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "SalmonMath.hpp"
+#include "SimplePosBias.hpp"
+#include "spline.h"
+
+// --posBias: the positional weights of a transcript are interpolated in a
+// table of the spline through the bins (one per length class), rather than
+// read off the spline itself at every position
+
+SCENARIO("Positional bias projections follow the spline through the bins") {
+
+    GIVEN("A model with more mass toward the 5' end") {
+      SimplePosBias obs;
+      SimplePosBias flat;
+      std::vector<double> masses(20);
+      for (int32_t i = 0; i < 20; ++i) {
+        masses[i] = 40.0 - i + 5.0 * std::sin(i);
+        obs.addMass(i, std::log(masses[i]));
+        flat.addMass(i, std::log(10.0));
+      }
+      obs.finalize();
+      flat.finalize();
+
+      // The spline that finalize fits through the (normalized) bins
+      double sum{0.0};
+      for (size_t i = 0; i < masses.size(); ++i) {
+        // each bin starts with a pseudo-count of 1
+        masses[i] += 1.0;
+        sum += masses[i];
+      }
+      std::vector<double> bins{.02, .04, .06, .08, .10, .15, .2,
+                               .3,  .4,  .5,  .6,  .7,  .8,  .85,
+                               .9,  .92, .94, .96, .98, 1.0};
+      std::vector<double> xs{0.0}, ys{masses.front() / sum};
+      double splineSum = sum + (masses.front() + masses.back()) / sum;
+      for (size_t i = 0; i < masses.size(); ++i) {
+        xs.push_back(bins[i] - 0.01);
+        ys.push_back(masses[i] / splineSum);
+      }
+      xs.push_back(1.0);
+      ys.push_back(masses.back() / sum);
+      tk::spline s;
+      s.set_points(xs, ys);
+
+      WHEN("Projecting it onto transcripts of a few lengths") {
+        THEN("The weights match the spline closely") {
+          for (size_t len : {37, 1000, 25013}) {
+            std::vector<double> out(len);
+            obs.projectWeights(out);
+            for (size_t p = 0; p < len; ++p) {
+              double x = static_cast<double>(p) / len;
+              double expected = std::max(0.001, s(x));
+              REQUIRE(std::abs(out[p] - expected) < 1e-5 * expected);
+            }
+          }
+        }
+      }
+
+      WHEN("Projecting its ratio to itself and to a flat model") {
+        std::vector<double> self(5000), toFlat(5000), w(8000), f(8000);
+        obs.projectRatio(obs, 8000, self);
+        obs.projectRatio(flat, 8000, toFlat);
+        obs.projectWeights(w);
+        flat.projectWeights(f);
+
+        THEN("The ratios are those of the projected weights") {
+          for (size_t p = 0; p < self.size(); ++p) {
+            REQUIRE(self[p] == Approx(1.0));
+            REQUIRE(toFlat[p] == Approx(w[p] / f[p]));
+          }
+          REQUIRE(toFlat.front() > toFlat.back());
+        }
+      }
+    }
+}
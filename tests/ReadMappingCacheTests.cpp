@@ -0,0 +1,36 @@
+#include <string>
+#include <vector>
+#include "ReadMappingCache.hpp"
+
+SCENARIO("The read mapping cache returns the hits of exact duplicates only") {
+
+    GIVEN("A cache with a few slots") {
+      ReadMappingCache<int> cache(4);
+      std::string left = "ACGTACGTAC";
+      std::string right = "TTGCAATTGC";
+      std::vector<int> hits{1, 2, 3};
+      std::vector<int> found;
+
+      WHEN("A read pair is looked up, inserted, and looked up again") {
+        bool firstLookup = cache.lookup(left, right, found);
+        cache.insert(left, right, hits);
+        bool secondLookup = cache.lookup(left, right, found);
+        THEN("It is found the second time, with its hits") {
+          REQUIRE(!firstLookup);
+          REQUIRE(secondLookup);
+          REQUIRE(found == hits);
+          REQUIRE(cache.numLookups() == 2);
+          REQUIRE(cache.numHits() == 1);
+        }
+      }
+
+      WHEN("A different read (or the mates swapped) is looked up") {
+        cache.lookup(left, right, found);
+        cache.insert(left, right, hits);
+        THEN("It isn't found") {
+          REQUIRE(!cache.lookup(right, left, found));
+          REQUIRE(!cache.lookup(left, found));
+        }
+      }
+    }
+}
@@ -0,0 +1,52 @@
+#include <string>
+#include <vector>
+#include "ReadPrefilter.hpp"
+
+SCENARIO("The read prefilter clips adapters and scores complexity") {
+
+    GIVEN("A prefilter with the TruSeq adapter and a DUST threshold of 20") {
+      ReadPrefilter prefilter(20.0, {"agatcggaagagc"}, 5);
+
+      WHEN("A read holds the whole adapter") {
+        std::string read = "ACGTTGCATGCAAGATCGGAAGAGCACACGTCTGAAC";
+        bool clipped = prefilter.clipAdapter(read);
+
+        THEN("It is clipped where the adapter starts") {
+          REQUIRE(clipped);
+          REQUIRE(read == "ACGTTGCATGCA");
+        }
+      }
+
+      WHEN("A read ends with a prefix of the adapter") {
+        std::string longEnough = "ACGTTGCATGCAAGATCG";
+        std::string tooShort = "ACGTTGCATGCAAGAT";
+        bool clippedLong = prefilter.clipAdapter(longEnough);
+        bool clippedShort = prefilter.clipAdapter(tooShort);
+
+        THEN("It is clipped only if the prefix is at least 5 bases long") {
+          REQUIRE(clippedLong);
+          REQUIRE(longEnough == "ACGTTGCATGCA");
+          REQUIRE(!clippedShort);
+          REQUIRE(tooShort == "ACGTTGCATGCAAGAT");
+        }
+      }
+
+      WHEN("Scoring a homopolymer, a dinucleotide repeat and a mixed read") {
+        std::string polyA(100, 'A');
+        std::string repeat;
+        for (size_t i = 0; i < 50; ++i) {
+          repeat += "CA";
+        }
+        std::string mixed = "ACGTTGCATGCAAGCTTACCGGATCCTAGGCATCGTTAGCAGTCCATGA"
+                            "TCAGGTACCTAGCGATTCGAACGTAGGCTTCAGTCGATCGGACTTAGC";
+
+        THEN("The repeats are of low complexity, and the mixed read isn't") {
+          REQUIRE(prefilter.dustScore(polyA) == Approx(49.0));
+          REQUIRE(prefilter.lowComplexity(polyA));
+          REQUIRE(prefilter.lowComplexity(repeat));
+          REQUIRE(prefilter.dustScore(mixed) < 2.0);
+          REQUIRE(!prefilter.lowComplexity(mixed));
+        }
+      }
+    }
+}
@@ -0,0 +1,114 @@
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <csignal>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+#include "FastxReadTee.hpp"
+
+// The reads of salmon quant with several indices: each read file is read
+// (and decompressed) once and every process is given the whole of it,
+// whether the processes keep up with each other or not, and one that stops
+// reading early doesn't hold the others back.
+
+namespace {
+namespace bfs = boost::filesystem;
+// Everything that can be read from fd (until its write end is closed)
+std::string drain(int fd, size_t stopAfter = ~size_t(0)) {
+  std::string s;
+  char buf[65536];
+  ssize_t r;
+  while (s.size() < stopAfter and (r = ::read(fd, buf, sizeof(buf))) != 0) {
+    if (r > 0) {
+      s.append(buf, static_cast<size_t>(r));
+    }
+  }
+  ::close(fd);
+  return s;
+}
+} // namespace
+
+SCENARIO("A read file is teed to several readers") {
+
+    std::signal(SIGPIPE, SIG_IGN);
+    bfs::path path = bfs::temp_directory_path() /
+                     bfs::unique_path("salmon-readtee-%%%%-%%%%.fq.gz");
+    std::string reads;
+    for (uint32_t i = 0; i < 200000; ++i) {
+      reads += "@read" + std::to_string(i) + "\nACGTTGCA" +
+               std::string(i % 50, 'G') + "\n+\n" +
+               std::string(8 + i % 50, 'I') + "\n";
+    }
+    gzFile gz = gzopen(path.string().c_str(), "wb");
+    gzwrite(gz, reads.data(), static_cast<unsigned>(reads.size()));
+    gzclose(gz);
+
+    GIVEN("Three readers, one of them slow, and a small lag") {
+      std::vector<int> readEnds, writeEnds;
+      for (int i = 0; i < 3; ++i) {
+        int p[2];
+        REQUIRE(::pipe(p) == 0);
+        readEnds.push_back(p[0]);
+        writeEnds.push_back(p[1]);
+      }
+      fastx_parser::ReadTee tee(path.string(), writeEnds,
+                                fastx_parser::ReadTee::blockSize);
+      std::vector<std::string> got(3);
+      std::vector<std::thread> readers;
+      for (int i = 0; i < 3; ++i) {
+        readers.emplace_back([&, i]() -> void {
+          if (i == 2) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+          }
+          got[i] = drain(readEnds[i]);
+        });
+      }
+      for (auto& t : readers) {
+        t.join();
+      }
+      THEN("each is given the whole decompressed file") {
+          REQUIRE(tee.finish());
+          REQUIRE(tee.numDropped() == 0);
+          for (auto& g : got) {
+            REQUIRE(g == reads);
+          }
+      }
+    }
+
+    GIVEN("A reader that stops early") {
+      std::vector<int> readEnds, writeEnds;
+      for (int i = 0; i < 2; ++i) {
+        int p[2];
+        REQUIRE(::pipe(p) == 0);
+        readEnds.push_back(p[0]);
+        writeEnds.push_back(p[1]);
+      }
+      fastx_parser::ReadTee tee(path.string(), writeEnds,
+                                fastx_parser::ReadTee::blockSize);
+      std::string all, some;
+      std::thread quitter([&]() -> void { some = drain(readEnds[1], 1000); });
+      std::thread reader([&]() -> void { all = drain(readEnds[0]); });
+      quitter.join();
+      reader.join();
+      THEN("it is dropped, and the other is still given the whole file") {
+          REQUIRE(tee.finish());
+          REQUIRE(tee.numDropped() == 1);
+          REQUIRE(all == reads);
+          REQUIRE(reads.compare(0, some.size(), some) == 0);
+      }
+    }
+
+    GIVEN("A file that isn't there") {
+      int p[2];
+      REQUIRE(::pipe(p) == 0);
+      fastx_parser::ReadTee tee((path.string() + ".missing"), {p[1]});
+      THEN("nothing is written, and the tee fails") {
+          REQUIRE(drain(p[0]).empty());
+          REQUIRE(!tee.finish());
+      }
+    }
+
+    bfs::remove(path);
+}
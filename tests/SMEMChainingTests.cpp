@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <vector>
+#include "SMEMChaining.hpp"
+
+// The FMD hits and their best locations, as found before the anchors were
+// grouped by sorting and the votes clustered in one pass
+
+namespace {
+struct TestVote {
+  int32_t votePos;
+  uint32_t readPos;
+  uint32_t voteLen;
+};
+
+struct TestHit {
+  uint32_t targetID;
+  std::vector<TestVote> votes;
+  std::vector<TestVote> rcVotes;
+  void addFragMatch(uint32_t tpos, uint32_t readPos, uint32_t voteLen) {
+    int32_t votePos =
+        static_cast<int32_t>(tpos) - static_cast<int32_t>(readPos);
+    votes.push_back({votePos, readPos, voteLen});
+  }
+  void addFragMatchRC(uint32_t tpos, uint32_t readPos, uint32_t voteLen,
+                      uint32_t readLen) {
+    int32_t votePos = static_cast<int32_t>(tpos) - (readLen - readPos);
+    rcVotes.push_back({votePos, readPos, voteLen});
+  }
+};
+
+bool sameVotes(const std::vector<TestVote>& a, const std::vector<TestVote>& b) {
+  return a.size() == b.size() and
+         std::equal(a.begin(), a.end(), b.begin(),
+                    [](const TestVote& x, const TestVote& y) {
+                      return x.votePos == y.votePos and
+                             x.readPos == y.readPos and x.voteLen == y.voteLen;
+                    });
+}
+} // namespace
+
+SCENARIO("SMEM anchors are grouped and clustered as they were one by one") {
+
+    GIVEN("Reads hitting many paralogs on both strands") {
+      std::mt19937 gen(11);
+      for (size_t read = 0; read < 200; ++read) {
+        uint32_t readLen = 100;
+        uint32_t numTargets = 1 + gen() % 60;
+        std::vector<salmon::smem::Anchor> anchors;
+        size_t numAnchors = gen() % 400;
+        for (size_t i = 0; i < numAnchors; ++i) {
+          salmon::smem::Anchor a;
+          a.targetID = gen() % numTargets;
+          a.order = static_cast<uint32_t>(i);
+          a.tpos = 200 + gen() % 40;
+          a.readPos = gen() % 80;
+          a.len = 19 + gen() % 20;
+          a.readLen = readLen;
+          a.isRC = (gen() % 3 == 0);
+          anchors.push_back(a);
+        }
+
+        // one by one, looking the hit up each time
+        std::vector<TestHit> expected;
+        for (auto& a : anchors) {
+          auto it = std::find_if(expected.begin(), expected.end(),
+                                 [&a](const TestHit& h) {
+                                   return h.targetID == a.targetID;
+                                 });
+          if (it == expected.end()) {
+            expected.emplace_back();
+            expected.back().targetID = a.targetID;
+            it = expected.end() - 1;
+          }
+          if (a.isRC) {
+            it->addFragMatchRC(a.tpos, a.readPos, a.len, a.readLen);
+          } else {
+            it->addFragMatch(a.tpos, a.readPos, a.len);
+          }
+        }
+
+        std::vector<TestHit> hits;
+        salmon::smem::groupAnchors(anchors, hits);
+
+        REQUIRE(hits.size() == expected.size());
+        for (size_t h = 0; h < hits.size(); ++h) {
+          REQUIRE(hits[h].targetID == expected[h].targetID);
+          REQUIRE(sameVotes(hits[h].votes, expected[h].votes));
+          REQUIRE(sameVotes(hits[h].rcVotes, expected[h].rcVotes));
+
+          // and the best cluster, as with a map of the clusters
+          auto votes = hits[h].votes;
+          std::sort(votes.begin(), votes.end(),
+                    [](const TestVote& x, const TestVote& y) {
+                      return x.votePos < y.votePos or
+                             (x.votePos == y.votePos and x.readPos < y.readPos);
+                    });
+          int32_t pos{0}, expPos{0};
+          uint32_t count{0}, expCount{0};
+          double score{0.0}, expScore{0.0};
+          bool updated = salmon::smem::bestVoteCluster(votes, readLen, pos,
+                                                       count, score);
+          bool expUpdated{false};
+          if (!votes.empty()) {
+            struct Info {
+              uint32_t coverage = 0;
+              int32_t rightmostBase = 0;
+            };
+            std::map<uint32_t, Info> clusters;
+            int32_t currClust = votes.front().votePos;
+            for (auto& v : votes) {
+              if (v.votePos - currClust > 10) {
+                currClust = v.votePos;
+              }
+              auto& c = clusters[currClust];
+              c.coverage += std::min(v.voteLen, (v.votePos + v.readPos +
+                                                 v.voteLen) -
+                                                    c.rightmostBase);
+              c.rightmostBase = v.votePos + v.readPos + v.voteLen;
+              if (c.coverage > expCount) {
+                expCount = c.coverage;
+                expPos = currClust;
+                expScore = expCount / static_cast<double>(readLen);
+                expUpdated = true;
+              }
+            }
+          }
+          REQUIRE(updated == expUpdated);
+          REQUIRE(pos == expPos);
+          REQUIRE(count == expCount);
+          REQUIRE(score == expScore);
+        }
+      }
+    }
+}
@@ -0,0 +1,81 @@
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include "SalmonLogging.hpp"
+
+// The throttle of the warnings that the worker threads may hit once per
+// read: a burst, then the powers of two, with the rest only counted (and
+// the counting shared, without a lock, by the threads)
+
+namespace {
+bool isPowerOfTwo(uint64_t n) { return n > 0 and (n & (n - 1)) == 0; }
+}
+
+SCENARIO("Repeated warnings are logged in a burst, then at powers of two") {
+
+    GIVEN("A throttle with a burst of 10") {
+      salmon::logging::WarningThrottle throttle(10);
+
+      WHEN("A warning is hit 1000 times by one thread") {
+        std::vector<uint64_t> logged;
+        for (size_t i = 0; i < 1000; ++i) {
+          uint64_t n{0};
+          if (throttle.admit(n)) {
+            logged.push_back(n);
+          }
+        }
+
+        THEN("The first 10, and then the powers of two, are logged") {
+          REQUIRE(logged.size() == 10 + 6);
+          for (size_t i = 0; i < 10; ++i) {
+            REQUIRE(logged[i] == i + 1);
+          }
+          for (size_t i = 10; i < logged.size(); ++i) {
+            REQUIRE(isPowerOfTwo(logged[i]));
+          }
+          REQUIRE(logged.back() == 512);
+          REQUIRE(throttle.count() == 1000);
+          REQUIRE(throttle.suppressed() == 1000 - logged.size());
+        }
+      }
+
+      WHEN("A warning is hit 100000 times by each of 4 threads") {
+        std::atomic<uint64_t> numLogged{0};
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < 4; ++t) {
+          threads.emplace_back([&]() {
+            for (size_t i = 0; i < 100000; ++i) {
+              uint64_t n{0};
+              if (throttle.admit(n)) {
+                ++numLogged;
+              }
+            }
+          });
+        }
+        for (auto& t : threads) {
+          t.join();
+        }
+
+        THEN("Each occurrence is counted, and every admitted one logged") {
+          REQUIRE(throttle.count() == 400000);
+          // 1, 2, 4, 8 in the burst; 16 up to 262144
+          REQUIRE(numLogged == 10 + 15);
+          REQUIRE(throttle.suppressed() == 400000 - numLogged);
+        }
+      }
+    }
+
+    GIVEN("A throttle hit fewer times than its burst") {
+      salmon::logging::WarningThrottle throttle(10);
+      uint64_t n{0};
+      for (size_t i = 0; i < 7; ++i) {
+        REQUIRE(throttle.admit(n));
+      }
+
+      THEN("Nothing is suppressed") {
+        REQUIRE(n == 7);
+        REQUIRE(throttle.suppressed() == 0);
+      }
+    }
+}
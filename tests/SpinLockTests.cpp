@@ -0,0 +1,65 @@
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+#include "SalmonSpinLock.hpp"
+
+// spin_lock: spins with backoff, then parks, and counts its waits if named
+
+
+
+SCENARIO("The adaptive spin lock excludes and counts its acquisitions") {
+
+    GIVEN("A named lock taken by several threads at once") {
+        spin_lock l("spin_lock_test");
+        uint64_t total{0};
+        size_t numThreads = 4;
+        size_t perThread = 20000;
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < numThreads; ++t) {
+            threads.emplace_back([&]() {
+                for (size_t i = 0; i < perThread; ++i) {
+                    spin_lock::scoped_lock sl(l);
+                    // long enough that the others sometimes park
+                    if (i % 1000 == 0) {
+                        std::this_thread::sleep_for(
+                            std::chrono::microseconds(200));
+                    }
+                    ++total;
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+
+        WHEN("the threads are done") {
+            auto summaries = salmon::locks::summaries();
+            salmon::locks::LockSummary s;
+            for (auto& x : summaries) {
+                if (x.name == "spin_lock_test") {
+                    s = x;
+                }
+            }
+            THEN("no increment was lost, and every acquisition was counted") {
+                REQUIRE(total == numThreads * perThread);
+                REQUIRE(s.acquisitions == numThreads * perThread);
+                REQUIRE(s.contended <= s.acquisitions);
+                REQUIRE(s.parked <= s.contended);
+            }
+        }
+    }
+
+    GIVEN("An unnamed lock") {
+        spin_lock l;
+        WHEN("it's held") {
+            l.lock();
+            THEN("it can't be taken again until it's released") {
+                REQUIRE(!l.try_lock());
+                l.unlock();
+                REQUIRE(l.try_lock());
+                l.unlock();
+            }
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "FlatEquivalenceClasses.hpp"
+
+SCENARIO("Targeted quantification keeps only the targets' components") {
+
+    GIVEN("Classes over two components, {0, 1, 2} and {3, 4}, and 5 alone") {
+      // (label, count) of each class
+      std::vector<std::pair<std::vector<uint32_t>, uint64_t>> classes{
+          {{0, 1}, 10}, {{1, 2}, 20}, {{3}, 30}, {{3, 4}, 40}, {{5}, 50}};
+      FlatEquivalenceClasses eqClasses;
+      eqClasses.offsets.push_back(0);
+      for (auto& c : classes) {
+        for (auto t : c.first) {
+          eqClasses.txps.push_back(t);
+          eqClasses.weights.push_back(1.0);
+        }
+        eqClasses.offsets.push_back(eqClasses.txps.size());
+        eqClasses.counts.push_back(c.second);
+        eqClasses.valid.push_back(1);
+      }
+      eqClasses.combinedWeights.assign(eqClasses.txps.size(), 0.0);
+
+      WHEN("Restricting to the target 2") {
+        std::vector<bool> inTarget;
+        auto numBackground = eqClasses.restrictToTargets({2}, 6, inTarget);
+
+        THEN("The classes of {0, 1, 2} are kept, and the others dropped") {
+          REQUIRE(eqClasses.valid == (std::vector<uint8_t>{1, 1, 0, 0, 0}));
+          REQUIRE(numBackground == 120);
+          REQUIRE(inTarget ==
+                  (std::vector<bool>{true, true, true, false, false, false}));
+        }
+      }
+
+      WHEN("Restricting to the targets 4 and 5") {
+        std::vector<bool> inTarget;
+        auto numBackground = eqClasses.restrictToTargets({4, 5}, 6, inTarget);
+
+        THEN("The classes of {3, 4} and {5} are kept") {
+          REQUIRE(eqClasses.valid == (std::vector<uint8_t>{0, 0, 1, 1, 1}));
+          REQUIRE(numBackground == 30);
+          REQUIRE(inTarget ==
+                  (std::vector<bool>{false, false, false, true, true, true}));
+        }
+      }
+
+      WHEN("A class was already invalid") {
+        eqClasses.valid[0] = 0;
+        std::vector<bool> inTarget;
+        auto numBackground = eqClasses.restrictToTargets({0}, 6, inTarget);
+
+        THEN("It doesn't link its transcripts, nor count as background") {
+          REQUIRE(eqClasses.valid == (std::vector<uint8_t>{0, 0, 0, 0, 0}));
+          REQUIRE(numBackground == 140);
+          REQUIRE(inTarget ==
+                  (std::vector<bool>{true, false, false, false, false, false}));
+        }
+      }
+    }
+}
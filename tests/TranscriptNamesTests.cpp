@@ -0,0 +1,57 @@
+#include <string>
+#include <vector>
+#include "TranscriptNames.hpp"
+
+// The shared table of transcript names: every name must be found under the
+// id it was added with (the first, for a name added twice), nothing else
+// must be found, and the names must stay where they were stored as the
+// table grows and is moved.
+
+namespace {
+// A long, GENCODE-style name
+std::string gencodeName(size_t i) {
+  return "ENST" + std::to_string(10000000000 + i) + ".1|ENSG" +
+         std::to_string(20000000000 + i / 3) + ".7|OTTHUMG|OTTHUMT|NAME-" +
+         std::to_string(i) + "|GENE|1234|protein_coding|";
+}
+} // namespace
+
+SCENARIO("The transcript name table finds each name under its id") {
+
+    GIVEN("Many long names, one of them added twice") {
+      TranscriptNames names;
+      std::vector<const char*> stored;
+      for (size_t i = 0; i < 30000; ++i) {
+        auto id = names.add(gencodeName(i));
+        REQUIRE(id == i);
+        stored.push_back(names.name(id));
+      }
+      auto dupID = names.add(gencodeName(17));
+      std::string huge(1 << 19, 'x');
+      auto hugeID = names.add(huge);
+
+      WHEN("the table has been moved") {
+        TranscriptNames moved(std::move(names));
+        THEN("every name is found under its first id, in place") {
+            REQUIRE(moved.size() == 30002);
+            for (size_t i = 0; i < 30000; ++i) {
+              auto name = gencodeName(i);
+              REQUIRE(moved.find(name) == i);
+              REQUIRE(moved.name(i) == stored[i]);
+              REQUIRE(name == moved.name(i));
+              REQUIRE(moved.length(i) == name.size());
+            }
+            REQUIRE(moved.find(gencodeName(17)) == 17);
+            REQUIRE(std::string(moved.name(dupID)) == gencodeName(17));
+            REQUIRE(moved.find(huge) == hugeID);
+        }
+        THEN("names that weren't added aren't found") {
+            REQUIRE(moved.find(gencodeName(30000)) == TranscriptNames::npos);
+            REQUIRE(moved.find("") == TranscriptNames::npos);
+            auto prefix = gencodeName(5);
+            prefix.pop_back();
+            REQUIRE(moved.find(prefix) == TranscriptNames::npos);
+        }
+      }
+    }
+}
@@ -10,4 +10,32 @@ bool verbose=false; // Apparently, we *need* this (OSX)
 
 #include "GCSampleTests.cpp"
 #include "LibraryTypeTests.cpp"
+#include "EMKernelTests.cpp"
+#include "MultinomialSamplerTests.cpp"
+#include "MappingVerifierTests.cpp"
+#include "ReadMappingCacheTests.cpp"
+#include "EqClassLabelTests.cpp"
+#include "CellEqClassTests.cpp"
+#include "PoissonBootstrapTests.cpp"
+#include "TargetedQuantTests.cpp"
+#include "ReadPrefilterTests.cpp"
+#include "EqClassCompactionTests.cpp"
+#include "GammaSamplerTests.cpp"
+#include "CountVarianceTests.cpp"
+#include "SpinLockTests.cpp"
+#include "PosBiasTests.cpp"
+#include "MemoryBudgetTests.cpp"
+#include "EqClassSpillTests.cpp"
+#include "SalmonLoggingTests.cpp"
+#include "AlignmentCollatorTests.cpp"
+#include "SMEMChainingTests.cpp"
+#include "KmerIntervalMapTests.cpp"
+#include "EffectiveLengthStatsTests.cpp"
+#include "MiniBatchPipelineTests.cpp"
+#include "MappingCacheFileTests.cpp"
+#include "TranscriptNamesTests.cpp"
+#include "MiniBatchSizerTests.cpp"
+#include "ReadTeeTests.cpp"
+#include "HardwareCountersTests.cpp"
+#include "AlignmentGroupTests.cpp"
 //#include "KmerHistTests.cpp"